@@ -14,6 +14,10 @@
  * limitations under the License.
  */
 
+#include <limits.h>
+#include <sys/uio.h>
+
+#include <algorithm>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -46,6 +50,34 @@ ssize_t WriteAll(SharedFD fd, const char* buf, size_t size) {
   return total_written;
 }
 
+ssize_t WriteAll(SharedFD fd, std::vector<struct iovec> iov) {
+  size_t total_written = 0;
+  auto next = iov.begin();
+  while (next != iov.end()) {
+    auto count = std::min<size_t>(iov.end() - next, IOV_MAX);
+    ssize_t written = fd->Writev(&*next, count);
+    if (written < 0) {
+      errno = fd->GetErrno();
+      return written;
+    }
+    if (written == 0) {
+      break;
+    }
+    total_written += written;
+    // Skip what was written, the last buffer may have been written partially.
+    size_t remaining = written;
+    while (next != iov.end() && remaining >= next->iov_len) {
+      remaining -= next->iov_len;
+      ++next;
+    }
+    if (next != iov.end()) {
+      next->iov_base = static_cast<char*>(next->iov_base) + remaining;
+      next->iov_len -= remaining;
+    }
+  }
+  return total_written;
+}
+
 ssize_t ReadExact(SharedFD fd, char* buf, size_t size) {
   size_t total_read = 0;
   ssize_t read = 0;
@@ -106,6 +106,17 @@ ssize_t WriteAll(SharedFD fd, const std::vector<char>& buf);
  */
 ssize_t WriteAll(SharedFD fd, const char* buf, size_t size);
 
+/**
+ * Writes to fd until all the bytes described by iov are written, with as few
+ * writev calls as possible.
+ *
+ * On a successful write, returns the total size of the buffers.
+ *
+ * If a write error is encountered, returns -1. Some data may have already been
+ * written to fd at that point.
+ */
+ssize_t WriteAll(SharedFD fd, std::vector<struct iovec> iov);
+
 /**
  * Writes to fd until `sizeof(T)` bytes are written from binary_data.
  *
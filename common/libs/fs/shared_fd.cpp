@@ -74,6 +74,17 @@ void CheckMarked(fd_set* in_out_mask, SharedFDSet* in_out_set) {
 # endif
 #endif
 
+/*
+ * pidfd_open and pidfd_send_signal have no glibc wrappers in the host
+ * prebuilts either. Their numbers are the same on every architecture.
+ */
+#ifndef __NR_pidfd_send_signal
+# define __NR_pidfd_send_signal 424
+#endif
+#ifndef __NR_pidfd_open
+# define __NR_pidfd_open 434
+#endif
+
 int memfd_create_wrapper(const char* name, unsigned int flags) {
 #ifdef CUTTLEFISH_HOST
   // TODO(schuffelen): Use memfd_create with a newer host libc.
@@ -85,6 +96,13 @@ int memfd_create_wrapper(const char* name, unsigned int flags) {
 
 }  // namespace
 
+int FileInstance::PidFdSendSignal(int signal) {
+  errno = 0;
+  int rval = syscall(__NR_pidfd_send_signal, fd_, signal, nullptr, 0);
+  errno_ = errno;
+  return rval;
+}
+
 bool FileInstance::CopyFrom(FileInstance& in, size_t length) {
   std::vector<char> buffer(8192);
   while (length > 0) {
@@ -101,6 +119,19 @@ bool FileInstance::CopyFrom(FileInstance& in, size_t length) {
   return true;
 }
 
+ssize_t FileInstance::CopyFileRange(FileInstance& in, off_t* in_offset,
+                                    off_t* out_offset, size_t length) {
+  loff_t in_off = *in_offset;
+  loff_t out_off = *out_offset;
+  errno = 0;
+  ssize_t rval = TEMP_FAILURE_RETRY(syscall(__NR_copy_file_range, in.fd_,
+                                            &in_off, fd_, &out_off, length, 0));
+  errno_ = errno;
+  *in_offset = in_off;
+  *out_offset = out_off;
+  return rval;
+}
+
 void FileInstance::Close() {
   std::stringstream message;
   if (fd_ == -1) {
@@ -263,6 +294,22 @@ SharedFD SharedFD::Dup(int unmanaged_fd) {
   return SharedFD(std::shared_ptr<FileInstance>(new FileInstance(fd, error_num)));
 }
 
+int SharedFD::Poll(std::vector<PollSharedFd>& fds, int timeout) {
+  std::vector<struct pollfd> native_fds(fds.size());
+  for (size_t i = 0; i < fds.size(); i++) {
+    native_fds[i] = {
+        .fd = fds[i].fd->IsOpen() ? fds[i].fd->fd_ : -1,
+        .events = fds[i].events,
+    };
+  }
+  int rval = TEMP_FAILURE_RETRY(poll(native_fds.data(), native_fds.size(),
+                                     timeout));
+  for (size_t i = 0; i < fds.size(); i++) {
+    fds[i].revents = native_fds[i].revents;
+  }
+  return rval;
+}
+
 bool SharedFD::Pipe(SharedFD* fd0, SharedFD* fd1) {
   int fds[2];
   int rval = pipe(fds);
@@ -279,12 +326,30 @@ SharedFD SharedFD::Event(int initval, int flags) {
   return std::shared_ptr<FileInstance>(new FileInstance(fd, errno));
 }
 
+SharedFD SharedFD::Epoll(int flags) {
+  int fd = epoll_create1(flags);
+  int error_num = errno;
+  return std::shared_ptr<FileInstance>(new FileInstance(fd, error_num));
+}
+
+SharedFD SharedFD::TimerFd(int clock, int flags) {
+  int fd = timerfd_create(clock, flags);
+  int error_num = errno;
+  return std::shared_ptr<FileInstance>(new FileInstance(fd, error_num));
+}
+
 SharedFD SharedFD::MemfdCreate(const std::string& name, unsigned int flags) {
   int fd = memfd_create_wrapper(name.c_str(), flags);
   int error_num = errno;
   return std::shared_ptr<FileInstance>(new FileInstance(fd, error_num));
 }
 
+SharedFD SharedFD::PidFdOpen(pid_t pid, unsigned int flags) {
+  int fd = syscall(__NR_pidfd_open, pid, flags);
+  int error_num = errno;
+  return std::shared_ptr<FileInstance>(new FileInstance(fd, error_num));
+}
+
 bool SharedFD::SocketPair(int domain, int type, int protocol,
                           SharedFD* fd0, SharedFD* fd1) {
   int fds[2];
@@ -34,9 +34,11 @@
 
 #include <memory>
 #include <sstream>
+#include <vector>
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <string.h>
 #include <termios.h>
 #include <unistd.h>
@@ -67,6 +69,7 @@
 namespace cuttlefish {
 
 class FileInstance;
+struct PollSharedFd;
 
 /**
  * Counted reference to a FileInstance.
@@ -128,7 +131,11 @@ class SharedFD {
   static SharedFD Creat(const std::string& pathname, mode_t mode);
   static bool Pipe(SharedFD* fd0, SharedFD* fd1);
   static SharedFD Event(int initval = 0, int flags = 0);
+  static SharedFD Epoll(int flags = 0);
+  static SharedFD TimerFd(int clock, int flags = 0);
   static SharedFD MemfdCreate(const std::string& name, unsigned int flags = 0);
+  // The returned fd becomes readable when the process exits.
+  static SharedFD PidFdOpen(pid_t pid, unsigned int flags = 0);
   static SharedFD Mkstemp(std::string* path);
   static bool SocketPair(int domain, int type, int protocol, SharedFD* fd0,
                          SharedFD* fd1);
@@ -144,6 +151,9 @@ class SharedFD {
   static SharedFD VsockServer(unsigned int port, int type);
   static SharedFD VsockServer(int type);
   static SharedFD VsockClient(unsigned int cid, unsigned int port, int type);
+  // Like poll(2), the revents of each entry are filled in. Closed SharedFDs
+  // are passed as -1 and ignored.
+  static int Poll(std::vector<PollSharedFd>& fds, int timeout);
 
   bool operator==(const SharedFD& rhs) const { return value_ == rhs.value_; }
 
@@ -169,6 +179,12 @@ class SharedFD {
   std::shared_ptr<FileInstance> value_;
 };
 
+struct PollSharedFd {
+  SharedFD fd;
+  short events;
+  short revents;
+};
+
 /**
  * A non-owning reference to a FileInstance. The referenced FileInstance needs
  * to be managed by a SharedFD. A WeakFD needs to be converted to a SharedFD to
@@ -260,6 +276,15 @@ class FileInstance {
   // reference type.
   bool CopyFrom(FileInstance& in, size_t length);
 
+  // Only valid on fds returned by SharedFD::PidFdOpen.
+  int PidFdSendSignal(int signal);
+
+  // Copies up to `length` bytes from `in` at `*in_offset` to this file at
+  // `*out_offset` without going through userspace, advancing both offsets.
+  // Wraps copy_file_range(2), which older host C libraries don't expose.
+  ssize_t CopyFileRange(FileInstance& in, off_t* in_offset, off_t* out_offset,
+                        size_t length);
+
   int UNMANAGED_Dup() {
     errno = 0;
     int rval = TEMP_FAILURE_RETRY(dup(fd_));
@@ -274,6 +299,60 @@ class FileInstance {
     return rval;
   }
 
+  int Fallocate(int mode, off_t offset, off_t length) {
+    errno = 0;
+    int rval = TEMP_FAILURE_RETRY(fallocate(fd_, mode, offset, length));
+    errno_ = errno;
+    return rval;
+  }
+
+  int Fdatasync() {
+    errno = 0;
+    int rval = TEMP_FAILURE_RETRY(fdatasync(fd_));
+    errno_ = errno;
+    return rval;
+  }
+
+  int EpollCtl(int op, FileInstance& fd, struct epoll_event* event) {
+    errno = 0;
+    int rval = TEMP_FAILURE_RETRY(epoll_ctl(fd_, op, fd.fd_, event));
+    errno_ = errno;
+    return rval;
+  }
+
+  int EpollWait(struct epoll_event* events, int max_events, int timeout) {
+    errno = 0;
+    int rval =
+        TEMP_FAILURE_RETRY(epoll_wait(fd_, events, max_events, timeout));
+    errno_ = errno;
+    return rval;
+  }
+
+  int TimerSet(int flags, const struct itimerspec* new_value,
+               struct itimerspec* old_value) {
+    errno = 0;
+    int rval = timerfd_settime(fd_, flags, new_value, old_value);
+    errno_ = errno;
+    return rval;
+  }
+
+  // Moves up to `length` bytes from `in` to this file without copying them
+  // through userspace. One of the two must be a pipe.
+  ssize_t SpliceFrom(FileInstance& in, size_t length, unsigned int flags) {
+    errno = 0;
+    ssize_t rval = TEMP_FAILURE_RETRY(
+        splice(in.fd_, nullptr, fd_, nullptr, length, flags));
+    errno_ = errno;
+    return rval;
+  }
+
+  int Fstat(struct stat* buf) {
+    errno = 0;
+    int rval = TEMP_FAILURE_RETRY(fstat(fd_, buf));
+    errno_ = errno;
+    return rval;
+  }
+
   int Fcntl(int command, int value) {
     errno = 0;
     int rval = TEMP_FAILURE_RETRY(fcntl(fd_, command, value));
@@ -346,6 +425,20 @@ class FileInstance {
     return rval;
   }
 
+  ssize_t PRead(void* buf, size_t count, off_t offset) {
+    errno = 0;
+    ssize_t rval = TEMP_FAILURE_RETRY(pread(fd_, buf, count, offset));
+    errno_ = errno;
+    return rval;
+  }
+
+  ssize_t PWrite(const void* buf, size_t count, off_t offset) {
+    errno = 0;
+    ssize_t rval = TEMP_FAILURE_RETRY(pwrite(fd_, buf, count, offset));
+    errno_ = errno;
+    return rval;
+  }
+
   ssize_t Recv(void* buf, size_t len, int flags) {
     errno = 0;
     ssize_t rval = TEMP_FAILURE_RETRY(recv(fd_, buf, len, flags));
@@ -360,6 +453,15 @@ class FileInstance {
     return rval;
   }
 
+  int RecvMMsg(struct mmsghdr* msgvec, unsigned int vlen, int flags,
+               struct timespec* timeout) {
+    errno = 0;
+    int rval =
+        TEMP_FAILURE_RETRY(recvmmsg(fd_, msgvec, vlen, flags, timeout));
+    errno_ = errno;
+    return rval;
+  }
+
   ssize_t Read(void* buf, size_t count) {
     errno = 0;
     ssize_t rval = TEMP_FAILURE_RETRY(read(fd_, buf, count));
@@ -388,6 +490,13 @@ class FileInstance {
     return rval;
   }
 
+  int SendMMsg(struct mmsghdr* msgvec, unsigned int vlen, int flags) {
+    errno = 0;
+    int rval = TEMP_FAILURE_RETRY(sendmmsg(fd_, msgvec, vlen, flags));
+    errno_ = errno;
+    return rval;
+  }
+
   template <typename... Args>
   ssize_t SendFileDescriptors(const void* buf, size_t len, Args&&... sent_fds) {
     std::vector<int> fds;
@@ -473,6 +582,13 @@ class FileInstance {
     return rval;
   }
 
+  ssize_t Writev(const struct iovec* iov, int iovcnt) {
+    errno = 0;
+    ssize_t rval = TEMP_FAILURE_RETRY(writev(fd_, iov, iovcnt));
+    errno_ = errno;
+    return rval;
+  }
+
   int EventfdWrite(eventfd_t value) {
     errno = 0;
     int rval = eventfd_write(fd_, value);
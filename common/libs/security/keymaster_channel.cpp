@@ -16,6 +16,8 @@
 
 #include "keymaster_channel.h"
 
+#include <cstring>
+
 #include <android-base/logging.h>
 #include "keymaster/android_keymaster_utils.h"
 
@@ -23,6 +25,30 @@
 
 namespace cuttlefish {
 
+namespace {
+
+constexpr char kRequestIdProbe[] = "cuttlefish keymaster request ids";
+
+} // namespace
+
+keymaster::Buffer RequestIdProbe() {
+  return keymaster::Buffer(kRequestIdProbe, sizeof(kRequestIdProbe));
+}
+
+bool IsRequestIdProbe(const keymaster_message& message) {
+  if (message.cmd != keymaster::GET_VERSION || message.is_response) {
+    return false;
+  }
+  keymaster::Buffer payload;
+  const uint8_t* data = message.payload;
+  if (!payload.Deserialize(&data, data + message.payload_size)) {
+    return false;
+  }
+  return payload.buffer_size() == sizeof(kRequestIdProbe) &&
+      std::memcmp(payload.begin(), kRequestIdProbe,
+                  sizeof(kRequestIdProbe)) == 0;
+}
+
 ManagedKeymasterMessage CreateKeymasterMessage(
     AndroidKeymasterCommand command, bool is_response, size_t payload_size) {
   auto memory = new uint8_t[payload_size + sizeof(keymaster_message)];
@@ -45,19 +71,22 @@ KeymasterChannel::KeymasterChannel(SharedFD input, SharedFD output)
 }
 
 bool KeymasterChannel::SendRequest(
-    AndroidKeymasterCommand command, const keymaster::Serializable& message) {
-  return SendMessage(command, false, message);
+    AndroidKeymasterCommand command, const keymaster::Serializable& message,
+    std::optional<uint32_t> request_id) {
+  return SendMessage(command, false, message, request_id);
 }
 
 bool KeymasterChannel::SendResponse(
-    AndroidKeymasterCommand command, const keymaster::Serializable& message) {
-  return SendMessage(command, true, message);
+    AndroidKeymasterCommand command, const keymaster::Serializable& message,
+    std::optional<uint32_t> request_id) {
+  return SendMessage(command, true, message, request_id);
 }
 
 bool KeymasterChannel::SendMessage(
     AndroidKeymasterCommand command,
     bool is_response,
-    const keymaster::Serializable& message) {
+    const keymaster::Serializable& message,
+    std::optional<uint32_t> request_id) {
   auto payload_size = message.SerializedSize();
   LOG(VERBOSE) << "Sending message with id: " << command << " and size "
                << payload_size;
@@ -65,6 +94,24 @@ bool KeymasterChannel::SendMessage(
   message.Serialize(to_send->payload, to_send->payload + payload_size);
   auto write_size = payload_size + sizeof(keymaster_message);
   auto to_send_bytes = reinterpret_cast<const char*>(to_send.get());
+  // Whole messages are written under the lock so concurrent senders don't
+  // interleave their bytes.
+  std::lock_guard<std::mutex> lock(send_mutex_);
+  if (request_id) {
+    // The id goes between the header and the payload.
+    to_send->cmd = static_cast<AndroidKeymasterCommand>(
+        command | kKeymasterRequestIdFlag);
+    uint32_t id = *request_id;
+    if (WriteAll(output_, to_send_bytes, sizeof(keymaster_message)) !=
+            sizeof(keymaster_message) ||
+        WriteAllBinary(output_, &id) != sizeof(id)) {
+      LOG(ERROR) << "Could not write Keymaster Message: "
+                 << output_->StrError();
+      return false;
+    }
+    to_send_bytes += sizeof(keymaster_message);
+    write_size -= sizeof(keymaster_message);
+  }
   auto written = WriteAll(output_, to_send_bytes, write_size);
   if (written != write_size) {
     LOG(ERROR) << "Could not write Keymaster Message: " << output_->StrError();
@@ -72,7 +119,8 @@ bool KeymasterChannel::SendMessage(
   return written == write_size;
 }
 
-ManagedKeymasterMessage KeymasterChannel::ReceiveMessage() {
+ManagedKeymasterMessage KeymasterChannel::ReceiveMessage(
+    std::optional<uint32_t>* request_id) {
   struct keymaster_message message_header;
   auto read = ReadExactBinary(input_, &message_header);
   if (read != sizeof(keymaster_message)) {
@@ -81,11 +129,26 @@ ManagedKeymasterMessage KeymasterChannel::ReceiveMessage() {
     LOG(ERROR) << "Could not read Keymaster Message: " << input_->StrError();
     return {};
   }
-  LOG(VERBOSE) << "Received message with id: " << message_header.cmd
+  uint32_t command = message_header.cmd;
+  std::optional<uint32_t> received_id;
+  if (command & kKeymasterRequestIdFlag) {
+    command &= ~kKeymasterRequestIdFlag;
+    uint32_t id;
+    if (ReadExactBinary(input_, &id) != sizeof(id)) {
+      LOG(ERROR) << "Could not read Keymaster request id: "
+                 << input_->StrError();
+      return {};
+    }
+    received_id = id;
+  }
+  if (request_id) {
+    *request_id = received_id;
+  }
+  LOG(VERBOSE) << "Received message with id: " << command
                << " and size " << message_header.payload_size;
-  auto message = CreateKeymasterMessage(message_header.cmd,
-                                        message_header.is_response,
-                                        message_header.payload_size);
+  auto message = CreateKeymasterMessage(
+      static_cast<AndroidKeymasterCommand>(command),
+      message_header.is_response, message_header.payload_size);
   auto message_bytes = reinterpret_cast<char*>(message->payload);
   read = ReadExact(input_, message_bytes, message->payload_size);
   if (read != message->payload_size) {
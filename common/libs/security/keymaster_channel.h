@@ -22,6 +22,8 @@
 #include "common/libs/fs/shared_fd.h"
 
 #include <memory>
+#include <mutex>
+#include <optional>
 
 namespace keymaster {
 
@@ -29,6 +31,10 @@ namespace keymaster {
  * keymaster_message - Serial header for communicating with KM server
  * @cmd: the command, one of AndroidKeymasterCommand.
  * @payload: start of the serialized command specific payload
+ *
+ * On the wire, a message whose cmd has kKeymasterRequestIdFlag set carries a
+ * uint32_t request id between the header and the payload. See
+ * KeymasterChannel for when that format may be used.
  */
 struct keymaster_message {
     AndroidKeymasterCommand cmd : 31;
@@ -44,6 +50,9 @@ namespace cuttlefish {
 using keymaster::AndroidKeymasterCommand;
 using keymaster::keymaster_message;
 
+/** Set in the wire `cmd` of messages that carry a request id. */
+constexpr uint32_t kKeymasterRequestIdFlag = 1u << 30;
+
 /**
  * A destroyer for keymaster_message instances created with
  * CreateKeymasterMessage. Wipes memory from the keymaster_message instances.
@@ -64,24 +73,46 @@ using ManagedKeymasterMessage =
 ManagedKeymasterMessage CreateKeymasterMessage(
     AndroidKeymasterCommand command, bool is_response, size_t payload_size);
 
+/*
+ * Payload of the GET_VERSION request that negotiates request ids. It is sent
+ * without a request id. Responders that understand request ids answer it with
+ * request id 0, older ones ignore the payload and answer without an id. Only
+ * after an answer with an id may requests carry one.
+ */
+keymaster::Buffer RequestIdProbe();
+bool IsRequestIdProbe(const keymaster_message& message);
+
 /*
  * Interface for communication channels that synchronously communicate Keymaster
  * IPC/RPC calls. Sends messages over a file descriptor.
+ *
+ * Messages can be sent from several threads at once, but only one thread at a
+ * time may receive.
  */
 class KeymasterChannel {
 public:
   KeymasterChannel(SharedFD input, SharedFD output);
 
+  /*
+   * Messages with a `request_id` are only understood by peers that answered
+   * the RequestIdProbe with one.
+   */
   bool SendRequest(AndroidKeymasterCommand command,
-                   const keymaster::Serializable& message);
+                   const keymaster::Serializable& message,
+                   std::optional<uint32_t> request_id = std::nullopt);
   bool SendResponse(AndroidKeymasterCommand command,
-                    const keymaster::Serializable& message);
-  ManagedKeymasterMessage ReceiveMessage();
+                    const keymaster::Serializable& message,
+                    std::optional<uint32_t> request_id = std::nullopt);
+  /* Receives a message in either format, storing its id in `request_id`. */
+  ManagedKeymasterMessage ReceiveMessage(
+      std::optional<uint32_t>* request_id = nullptr);
 private:
   SharedFD input_;
   SharedFD output_;
+  std::mutex send_mutex_;
   bool SendMessage(AndroidKeymasterCommand command, bool response,
-                   const keymaster::Serializable& message);
+                   const keymaster::Serializable& message,
+                   std::optional<uint32_t> request_id);
 };
 
 } // namespace cuttlefish
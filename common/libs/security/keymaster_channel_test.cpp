@@ -17,10 +17,17 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <optional>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "common/libs/fs/shared_fd.h"
 #include "common/libs/security/keymaster_channel.h"
+#include "common/libs/security/multiplexed_keymaster_channel.h"
 #include "gtest/gtest.h"
 
 namespace cuttlefish {
@@ -75,4 +82,169 @@ TEST(KeymasterChannel, SendAndReceiveResponse) {
   ASSERT_TRUE(std::equal(request.begin(), request.end(), read.begin()));
 }
 
+TEST(KeymasterChannel, SendAndReceiveRequestId) {
+  SharedFD read_fd;
+  SharedFD write_fd;
+  ASSERT_TRUE(SharedFD::Pipe(&read_fd, &write_fd)) << "Failed to create pipe";
+
+  KeymasterChannel channel{read_fd, write_fd};
+
+  ASSERT_TRUE(channel.SendRequest(keymaster::GET_VERSION, RequestIdProbe()));
+  ASSERT_TRUE(channel.SendResponse(keymaster::GET_VERSION, RequestIdProbe(),
+                                   42));
+
+  std::optional<uint32_t> request_id = 7;
+  auto probe = channel.ReceiveMessage(&request_id);
+  ASSERT_TRUE(probe);
+  EXPECT_FALSE(request_id);
+  EXPECT_TRUE(IsRequestIdProbe(*probe));
+
+  auto response = channel.ReceiveMessage(&request_id);
+  ASSERT_TRUE(response);
+  ASSERT_TRUE(request_id);
+  EXPECT_EQ(*request_id, 42u);
+  EXPECT_EQ(response->cmd, keymaster::GET_VERSION);
+  EXPECT_TRUE(response->is_response);
+  EXPECT_FALSE(IsRequestIdProbe(*response));
+}
+
+namespace {
+
+// Echoes the payload of `requests` requests back, after answering the
+// RequestIdProbe. Answers them in reverse order if `request_ids`, otherwise
+// in order and without ids, as older hosts do.
+void Serve(SharedFD read, SharedFD write, int requests, bool request_ids) {
+  KeymasterChannel channel{read, write};
+  auto probe = channel.ReceiveMessage();
+  ASSERT_TRUE(probe);
+  ASSERT_TRUE(IsRequestIdProbe(*probe));
+  keymaster::Buffer empty;
+  if (request_ids) {
+    ASSERT_TRUE(channel.SendResponse(probe->cmd, empty, 0));
+  } else {
+    ASSERT_TRUE(channel.SendResponse(probe->cmd, empty));
+  }
+  std::vector<std::pair<ManagedKeymasterMessage, std::optional<uint32_t>>>
+      received;
+  for (int i = 0; i < requests; i++) {
+    std::optional<uint32_t> request_id;
+    auto request = channel.ReceiveMessage(&request_id);
+    ASSERT_TRUE(request);
+    ASSERT_EQ(request_ids, request_id.has_value());
+    received.emplace_back(std::move(request), request_id);
+  }
+  if (request_ids) {
+    std::reverse(received.begin(), received.end());
+  }
+  for (auto& [request, request_id] : received) {
+    keymaster::Buffer payload;
+    const uint8_t* data = request->payload;
+    ASSERT_TRUE(payload.Deserialize(&data, data + request->payload_size));
+    ASSERT_TRUE(channel.SendResponse(request->cmd, payload, request_id));
+  }
+}
+
+void SendConcurrentRequests(bool request_ids) {
+  SharedFD client_read;
+  SharedFD server_write;
+  ASSERT_TRUE(SharedFD::Pipe(&client_read, &server_write));
+  SharedFD server_read;
+  SharedFD client_write;
+  ASSERT_TRUE(SharedFD::Pipe(&server_read, &client_write));
+
+  constexpr int kRequests = 8;
+  std::thread server(Serve, server_read, server_write, kRequests, request_ids);
+
+  MultiplexedKeymasterChannel channel{client_read, client_write};
+  std::vector<std::thread> clients;
+  std::vector<bool> matched(kRequests, false);
+  for (int i = 0; i < kRequests; i++) {
+    clients.emplace_back([&channel, &matched, i]() {
+      uint8_t contents = i;
+      keymaster::Buffer request(&contents, 1);
+      auto response = channel.Transact(keymaster::GET_VERSION, request);
+      ASSERT_TRUE(response) << "Request " << i << " failed";
+      keymaster::Buffer payload;
+      const uint8_t* data = response->payload;
+      ASSERT_TRUE(payload.Deserialize(&data, data + response->payload_size));
+      ASSERT_EQ(payload.buffer_size(), 1u);
+      matched[i] = *payload.begin() == i;
+    });
+  }
+  for (auto& client : clients) {
+    client.join();
+  }
+  server.join();
+  for (int i = 0; i < kRequests; i++) {
+    EXPECT_TRUE(matched[i]) << "Request " << i << " got another response";
+  }
+}
+
+void DropLateResponse(bool request_ids) {
+  SharedFD client_read;
+  SharedFD server_write;
+  ASSERT_TRUE(SharedFD::Pipe(&client_read, &server_write));
+  SharedFD server_read;
+  SharedFD client_write;
+  ASSERT_TRUE(SharedFD::Pipe(&server_read, &client_write));
+
+  // Only answers once both requests arrived, so the first one has timed out
+  // by the time its response arrives while the second request is waiting.
+  std::thread server(Serve, server_read, server_write, 2, request_ids);
+
+  MultiplexedKeymasterChannel channel{client_read, client_write};
+  uint8_t first_contents = 1;
+  keymaster::Buffer first(&first_contents, 1);
+  EXPECT_FALSE(channel.Transact(keymaster::GET_VERSION, first,
+                                std::chrono::milliseconds(100)));
+
+  uint8_t second_contents = 2;
+  keymaster::Buffer second(&second_contents, 1);
+  auto response = channel.Transact(keymaster::GET_VERSION, second);
+  server.join();
+  ASSERT_TRUE(response);
+  keymaster::Buffer payload;
+  const uint8_t* data = response->payload;
+  ASSERT_TRUE(payload.Deserialize(&data, data + response->payload_size));
+  ASSERT_EQ(payload.buffer_size(), 1u);
+  EXPECT_EQ(*payload.begin(), 2);
+}
+
+} // namespace
+
+TEST(MultiplexedKeymasterChannel, ConcurrentRequestsInOrder) {
+  SendConcurrentRequests(false);
+}
+
+TEST(MultiplexedKeymasterChannel, ConcurrentRequestsWithRequestIds) {
+  SendConcurrentRequests(true);
+}
+
+TEST(MultiplexedKeymasterChannel, DropsLateResponseInOrder) {
+  DropLateResponse(false);
+}
+
+TEST(MultiplexedKeymasterChannel, DropsLateResponseWithRequestIds) {
+  DropLateResponse(true);
+}
+
+TEST(MultiplexedKeymasterChannel, FailsPendingRequestsWhenClosed) {
+  SharedFD client_read;
+  SharedFD server_write;
+  ASSERT_TRUE(SharedFD::Pipe(&client_read, &server_write));
+  SharedFD server_read;
+  SharedFD client_write;
+  ASSERT_TRUE(SharedFD::Pipe(&server_read, &client_write));
+
+  MultiplexedKeymasterChannel channel{client_read, client_write};
+  std::thread server([server_read, server_write]() mutable {
+    KeymasterChannel channel{server_read, server_write};
+    ASSERT_TRUE(channel.ReceiveMessage());
+    server_write->Close();
+  });
+  keymaster::Buffer request;
+  EXPECT_FALSE(channel.Transact(keymaster::GET_VERSION, request));
+  server.join();
+}
+
 }  // namespace cuttlefish
@@ -0,0 +1,240 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/security/multiplexed_keymaster_channel.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
+#include <android-base/logging.h>
+
+namespace cuttlefish {
+
+namespace {
+
+struct Waiter {
+  AndroidKeymasterCommand command;
+  ManagedKeymasterMessage response;
+  bool done = false;
+  // Set when Transact gave up, so the response is dropped on arrival.
+  bool abandoned = false;
+};
+
+enum class Mode { kNegotiating, kRequestIds, kInOrder };
+
+// The probe's answer carries this id, real requests start after it.
+constexpr uint32_t kProbeRequestId = 0;
+
+} // namespace
+
+struct MultiplexedKeymasterChannel::State {
+  State(SharedFD input, SharedFD output) : channel(input, output) {}
+
+  KeymasterChannel channel;
+  // Held while queueing and sending a request to a host that answers in
+  // order, so the queue is in the order the host receives the requests.
+  std::mutex send_mutex;
+  std::mutex mutex;
+  std::condition_variable changed;
+  Mode mode = Mode::kNegotiating;
+  uint32_t next_request_id = kProbeRequestId + 1;
+  // Requests sent and not answered yet, by id.
+  std::unordered_map<uint32_t, std::shared_ptr<Waiter>> by_id;
+  // Requests sent and not answered yet, oldest first, with hosts that answer
+  // in order.
+  std::deque<std::shared_ptr<Waiter>> in_order;
+  bool failed = false;
+
+  // Call with `mutex` held.
+  void Fail() {
+    LOG(ERROR) << "Keymaster channel failed, dropping "
+               << by_id.size() + in_order.size() << " requests in flight";
+    failed = true;
+    for (auto& [id, waiter] : by_id) {
+      waiter->done = true;
+    }
+    by_id.clear();
+    for (auto& waiter : in_order) {
+      waiter->done = true;
+    }
+    in_order.clear();
+    changed.notify_all();
+  }
+
+  bool Negotiate() {
+    if (!channel.SendRequest(keymaster::GET_VERSION, RequestIdProbe())) {
+      return false;
+    }
+    while (true) {
+      std::optional<uint32_t> request_id;
+      auto response = channel.ReceiveMessage(&request_id);
+      if (!response) {
+        return false;
+      }
+      // A host that is still answering the requests of a previous guest
+      // process may send those answers first.
+      if (!response->is_response || response->cmd != keymaster::GET_VERSION ||
+          (request_id && *request_id != kProbeRequestId)) {
+        continue;
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      mode = request_id ? Mode::kRequestIds : Mode::kInOrder;
+      LOG(DEBUG) << "Keymaster host "
+                 << (request_id ? "supports" : "doesn't support")
+                 << " request ids";
+      changed.notify_all();
+      return true;
+    }
+  }
+
+  // Call with `mutex` held. Returns the waiter the response belongs to, if
+  // it is still waiting.
+  std::shared_ptr<Waiter> TakeWaiter(std::optional<uint32_t> request_id) {
+    if (mode == Mode::kRequestIds) {
+      if (!request_id) {
+        return nullptr;
+      }
+      auto it = by_id.find(*request_id);
+      if (it == by_id.end()) {
+        return nullptr;
+      }
+      auto waiter = it->second;
+      by_id.erase(it);
+      return waiter;
+    }
+    if (request_id || in_order.empty()) {
+      return nullptr;
+    }
+    auto waiter = in_order.front();
+    in_order.pop_front();
+    return waiter->abandoned ? nullptr : waiter;
+  }
+};
+
+MultiplexedKeymasterChannel::MultiplexedKeymasterChannel(SharedFD input,
+                                                         SharedFD output)
+    : state_(std::make_shared<State>(input, output)) {
+  auto state = state_;
+  std::thread([state]() {
+    if (!state->Negotiate()) {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->Fail();
+      return;
+    }
+    while (true) {
+      std::optional<uint32_t> request_id;
+      auto response = state->channel.ReceiveMessage(&request_id);
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (!response) {
+        state->Fail();
+        return;
+      }
+      auto waiter =
+          response->is_response ? state->TakeWaiter(request_id) : nullptr;
+      if (!waiter) {
+        LOG(WARNING) << "Dropping unexpected or late message with command "
+                     << response->cmd;
+        continue;
+      }
+      waiter->response = std::move(response);
+      waiter->done = true;
+      state->changed.notify_all();
+    }
+  }).detach();
+}
+
+MultiplexedKeymasterChannel::~MultiplexedKeymasterChannel() = default;
+
+ManagedKeymasterMessage MultiplexedKeymasterChannel::Transact(
+    AndroidKeymasterCommand command, const keymaster::Serializable& request,
+    std::chrono::milliseconds timeout) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  auto waiter = std::make_shared<Waiter>();
+  waiter->command = command;
+  std::optional<uint32_t> request_id;
+  {
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    bool negotiated = state_->changed.wait_until(lock, deadline, [this]() {
+      return state_->mode != Mode::kNegotiating || state_->failed;
+    });
+    if (!negotiated) {
+      LOG(ERROR) << "Timed out negotiating with the keymaster host";
+      return {};
+    }
+    if (state_->failed) {
+      return {};
+    }
+    if (state_->mode == Mode::kRequestIds) {
+      while (state_->by_id.count(state_->next_request_id) > 0 ||
+             state_->next_request_id == kProbeRequestId) {
+        state_->next_request_id++;
+      }
+      request_id = state_->next_request_id++;
+      state_->by_id[*request_id] = waiter;
+    }
+  }
+
+  if (request_id) {
+    if (!state_->channel.SendRequest(command, request, request_id)) {
+      // If part of the request got through, the host may still answer it,
+      // but the id is no longer waited for so the answer is dropped. The
+      // host may not be able to make sense of anything after it either,
+      // which only closing the channel would fix.
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      state_->by_id.erase(*request_id);
+      return {};
+    }
+  } else {
+    std::lock_guard<std::mutex> send_lock(state_->send_mutex);
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      if (state_->failed) {
+        return {};
+      }
+      state_->in_order.push_back(waiter);
+    }
+    if (!state_->channel.SendRequest(command, request)) {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      state_->Fail();
+      return {};
+    }
+  }
+
+  std::unique_lock<std::mutex> lock(state_->mutex);
+  bool done = state_->changed.wait_until(
+      lock, deadline, [&waiter]() { return waiter->done; });
+  if (!done) {
+    LOG(ERROR) << "Timed out waiting for the response to command " << command;
+    waiter->abandoned = true;
+    if (request_id) {
+      state_->by_id.erase(*request_id);
+    }
+    return {};
+  }
+  auto response = std::move(waiter->response);
+  if (response && response->cmd != command) {
+    LOG(ERROR) << "Response to command " << command << " was for command "
+               << response->cmd;
+    return {};
+  }
+  return response;
+}
+
+} // namespace cuttlefish
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/security/keymaster_channel.h"
+
+namespace cuttlefish {
+
+/*
+ * Lets several threads have Keymaster requests in flight over one channel.
+ *
+ * Before the first request, the receiver thread sends the RequestIdProbe. If
+ * the host answers it with a request id, every request is tagged with an id
+ * and a receiver thread hands each response to the request with its id, in
+ * whatever order the host answers. Older hosts answer requests in the order
+ * they arrive, so with those the oldest waiting request gets the response.
+ */
+class MultiplexedKeymasterChannel {
+public:
+  static constexpr std::chrono::seconds kDefaultTimeout{60};
+
+  MultiplexedKeymasterChannel(SharedFD input, SharedFD output);
+  ~MultiplexedKeymasterChannel();
+
+  /*
+   * Sends a request and blocks until its response arrives. Returns null if the
+   * request could not be sent, the channel failed or `timeout` passed before
+   * the response came. The response to a request that timed out is discarded
+   * when it arrives.
+   *
+   * With a host that answers in order, a failed send fails the channel, as
+   * the host may still answer part of the request and there is no telling
+   * which request later responses belong to.
+   */
+  ManagedKeymasterMessage Transact(
+      AndroidKeymasterCommand command, const keymaster::Serializable& request,
+      std::chrono::milliseconds timeout = kDefaultTimeout);
+private:
+  struct State;
+  // Shared with the receiver thread, which may outlive this object while it
+  // is blocked on a read.
+  std::shared_ptr<State> state_;
+};
+
+} // namespace cuttlefish
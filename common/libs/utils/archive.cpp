@@ -16,6 +16,7 @@
 
 #include "common/libs/utils/archive.h"
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -25,14 +26,27 @@
 #include "common/libs/utils/subprocess.h"
 
 namespace cuttlefish {
+namespace {
 
-Archive::Archive(const std::string& file) : file(file) {
+constexpr size_t kMaxExtractionThreads = 16;
+
+} // namespace
+
+Archive::Archive(const std::string& file)
+    : file(file), zip(ZipIndex::Open(file)) {
 }
 
 Archive::~Archive() {
 }
 
 std::vector<std::string> Archive::Contents() {
+  if (zip) {
+    std::vector<std::string> contents;
+    for (const auto& entry : zip->Entries()) {
+      contents.push_back(entry.name);
+    }
+    return contents;
+  }
   Command bsdtar_cmd("/usr/bin/bsdtar");
   bsdtar_cmd.AddParameter("-tf");
   bsdtar_cmd.AddParameter(file);
@@ -47,12 +61,53 @@ std::vector<std::string> Archive::Contents() {
       : std::vector<std::string>();
 }
 
-bool Archive::ExtractAll(const std::string& target_directory) {
-  return ExtractFiles({}, target_directory);
+bool Archive::ExtractAll(const std::string& target_directory, bool sparse) {
+  return ExtractFiles({}, target_directory, sparse);
 }
 
 bool Archive::ExtractFiles(const std::vector<std::string>& to_extract,
-                           const std::string& target_directory) {
+                           const std::string& target_directory, bool sparse) {
+  if (zip) {
+    std::vector<const ZipEntry*> entries;
+    if (to_extract.empty()) {
+      for (const auto& entry : zip->Entries()) {
+        entries.push_back(&entry);
+      }
+    }
+    for (const auto& name : to_extract) {
+      // Like bsdtar, a directory is extracted with everything below it, even
+      // if the archive has no entry for the directory itself.
+      auto entry = zip->Find(name);
+      if (entry && !entry->IsDirectory()) {
+        entries.push_back(entry);
+        continue;
+      }
+      auto prefix = name;
+      while (android::base::EndsWith(prefix, "/")) {
+        prefix.pop_back();
+      }
+      prefix += "/";
+      size_t found = entries.size();
+      for (const auto& entry : zip->Entries()) {
+        if (android::base::StartsWith(entry.name, prefix)) {
+          entries.push_back(&entry);
+        }
+      }
+      if (!entry && entries.size() == found) {
+        LOG(ERROR) << "\"" << name << "\" not found in \"" << file << "\"";
+        return false;
+      }
+    }
+    // Overlapping names mustn't extract a file twice at the same time
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+    bool success = zip->ExtractEntries(entries, target_directory, sparse,
+                                       kMaxExtractionThreads);
+    if (!success) {
+      LOG(ERROR) << "Extraction from \"" << file << "\" failed";
+    }
+    return success;
+  }
   Command bsdtar_cmd("/usr/bin/bsdtar");
   bsdtar_cmd.AddParameter("-x");
   bsdtar_cmd.AddParameter("-v");
@@ -60,7 +115,9 @@ bool Archive::ExtractFiles(const std::vector<std::string>& to_extract,
   bsdtar_cmd.AddParameter(target_directory);
   bsdtar_cmd.AddParameter("-f");
   bsdtar_cmd.AddParameter(file);
-  bsdtar_cmd.AddParameter("-S");
+  if (sparse) {
+    bsdtar_cmd.AddParameter("-S");
+  }
   for (const auto& extract : to_extract) {
     bsdtar_cmd.AddParameter(extract);
   }
@@ -74,6 +131,16 @@ bool Archive::ExtractFiles(const std::vector<std::string>& to_extract,
 }
 
 std::string Archive::ExtractToMemory(const std::string& path) {
+  if (zip) {
+    std::string contents;
+    auto entry = zip->Find(path);
+    if (!entry || !zip->ExtractToMemory(*entry, &contents)) {
+      LOG(ERROR) << "Could not extract \"" << path << "\" from \"" << file
+                 << "\" to memory.";
+      return "";
+    }
+    return contents;
+  }
   Command bsdtar_cmd("/usr/bin/bsdtar");
   bsdtar_cmd.AddParameter("-xf");
   bsdtar_cmd.AddParameter(file);
@@ -15,22 +15,32 @@
  */
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "common/libs/utils/zip_index.h"
+
 namespace cuttlefish {
 
-// Operations on archive files
+// Operations on archive files. Zip archives are read in-process, other formats
+// are handled by bsdtar.
 class Archive {
   std::string file;
+  std::unique_ptr<ZipIndex> zip;
 public:
   Archive(const std::string& file);
   ~Archive();
 
   std::vector<std::string> Contents();
-  bool ExtractAll(const std::string& target_directory = ".");
+  // With `sparse`, like `bsdtar -S`, blocks of zeroes are left as holes.
+  // Otherwise outputs are preallocated and stored zip entries are copied
+  // with copy_file_range.
+  bool ExtractAll(const std::string& target_directory = ".",
+                  bool sparse = true);
   bool ExtractFiles(const std::vector<std::string>& files,
-                    const std::string& target_directory = ".");
+                    const std::string& target_directory = ".",
+                    bool sparse = true);
   std::string ExtractToMemory(const std::string& path);
 };
 
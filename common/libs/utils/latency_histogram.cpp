@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/utils/latency_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace cuttlefish {
+
+void LatencyHistogram::Record(std::chrono::steady_clock::duration latency) {
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(latency);
+  uint64_t value = std::max<int64_t>(us.count(), 0);
+  size_t bucket = 0;
+  for (uint64_t remaining = value; remaining > 0; remaining >>= 1) {
+    bucket++;
+  }
+  bucket = std::min(bucket, kBuckets - 1);
+  buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  total_us_.fetch_add(value, std::memory_order_relaxed);
+  uint64_t max = max_us_.load(std::memory_order_relaxed);
+  while (value > max &&
+         !max_us_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+uint64_t LatencyHistogram::Count() const {
+  return count_.load(std::memory_order_relaxed);
+}
+
+std::chrono::microseconds LatencyHistogram::Mean() const {
+  uint64_t count = Count();
+  if (count == 0) {
+    return std::chrono::microseconds(0);
+  }
+  return std::chrono::microseconds(
+      total_us_.load(std::memory_order_relaxed) / count);
+}
+
+std::chrono::microseconds LatencyHistogram::Max() const {
+  return std::chrono::microseconds(max_us_.load(std::memory_order_relaxed));
+}
+
+std::chrono::microseconds LatencyHistogram::Percentile(
+    double percentile) const {
+  auto buckets = Buckets();
+  uint64_t total = 0;
+  for (auto bucket : buckets) {
+    total += bucket;
+  }
+  if (total == 0) {
+    return std::chrono::microseconds(0);
+  }
+  auto target = static_cast<uint64_t>(std::ceil(total * percentile / 100));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBuckets; i++) {
+    seen += buckets[i];
+    if (seen >= target) {
+      return std::chrono::microseconds(1ull << i);
+    }
+  }
+  return Max();
+}
+
+std::array<uint64_t, LatencyHistogram::kBuckets> LatencyHistogram::Buckets()
+    const {
+  std::array<uint64_t, kBuckets> buckets;
+  for (size_t i = 0; i < kBuckets; i++) {
+    buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+  }
+  return buckets;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+namespace cuttlefish {
+
+// Counts latencies in power of two microsecond buckets. Recording doesn't
+// lock, so it can be done from any thread on hot paths.
+class LatencyHistogram {
+ public:
+  // Bucket 0 counts latencies under 1us, bucket i counts latencies in
+  // [2^(i-1), 2^i) us and the last bucket also counts anything longer.
+  static constexpr size_t kBuckets = 32;
+
+  void Record(std::chrono::steady_clock::duration latency);
+
+  uint64_t Count() const;
+  std::chrono::microseconds Mean() const;
+  std::chrono::microseconds Max() const;
+  // The upper bound of the bucket holding the given percentile, in (0, 100].
+  std::chrono::microseconds Percentile(double percentile) const;
+  std::array<uint64_t, kBuckets> Buckets() const;
+
+ private:
+  std::array<std::atomic<uint64_t>, kBuckets> buckets_ = {};
+  std::atomic<uint64_t> count_ = 0;
+  std::atomic<uint64_t> total_us_ = 0;
+  std::atomic<uint64_t> max_us_ = 0;
+};
+
+}  // namespace cuttlefish
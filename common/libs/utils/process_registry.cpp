@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/utils/process_registry.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+// How often processes are checked for exit when there are no pidfds.
+constexpr std::chrono::milliseconds kExitCheckInterval(10);
+
+bool ReadProcStat(pid_t pid, char* state, pid_t* pgid, uint64_t* start_time) {
+  std::string stat;
+  auto path = "/proc/" + std::to_string(pid) + "/stat";
+  return android::base::ReadFileToString(path, &stat) &&
+         ParseProcStat(stat, state, pgid, start_time);
+}
+
+std::string EntryPath(const std::string& dir, pid_t pid) {
+  return dir + "/" + std::to_string(pid);
+}
+
+}  // namespace
+
+bool ParseProcStat(const std::string& stat, char* state, pid_t* pgid,
+                   uint64_t* start_time) {
+  // The command name may contain spaces and parentheses, the fields that
+  // follow it start after the last ')'. The first of them is the state, the
+  // third the process group and the twentieth the start time.
+  auto comm_end = stat.rfind(')');
+  if (comm_end == std::string::npos || comm_end + 2 > stat.size()) {
+    return false;
+  }
+  auto fields = android::base::Split(stat.substr(comm_end + 2), " ");
+  if (fields.size() < 20 || fields[0].size() != 1) {
+    return false;
+  }
+  *state = fields[0][0];
+  return android::base::ParseInt(fields[2], pgid) &&
+         android::base::ParseUint(fields[19], start_time);
+}
+
+bool ProcessRegistry::Register(pid_t pid, const std::string& name) {
+  RegisteredProcess process = {
+      .pid = pid,
+      .name = name,
+  };
+  char state;
+  if (!ReadProcStat(pid, &state, &process.pgid, &process.start_time)) {
+    LOG(ERROR) << "Unable to read the status of process " << pid;
+    return false;
+  }
+  if (mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST) {
+    PLOG(ERROR) << "Unable to create process registry " << dir_;
+    return false;
+  }
+  std::stringstream entry;
+  entry << process.pgid << " " << process.start_time << " " << process.name;
+  auto path = EntryPath(dir_, pid);
+  auto temp_path = path + ".tmp";
+  if (!android::base::WriteStringToFile(entry.str(), temp_path)) {
+    PLOG(ERROR) << "Unable to write " << temp_path;
+    return false;
+  }
+  return RenameFile(temp_path, path);
+}
+
+bool ProcessRegistry::Unregister(pid_t pid) {
+  auto path = EntryPath(dir_, pid);
+  if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+    PLOG(ERROR) << "Unable to remove " << path;
+    return false;
+  }
+  return true;
+}
+
+std::vector<RegisteredProcess> ProcessRegistry::Processes() const {
+  std::vector<RegisteredProcess> processes;
+  if (!DirectoryExists(dir_)) {
+    return processes;
+  }
+  for (const auto& file : DirectoryContents(dir_)) {
+    RegisteredProcess process;
+    if (!android::base::ParseInt(file, &process.pid)) {
+      continue;  // ".", ".." or a temporary file
+    }
+    std::string contents;
+    if (!android::base::ReadFileToString(EntryPath(dir_, process.pid),
+                                         &contents)) {
+      continue;  // Unregistered while listing
+    }
+    std::stringstream entry(contents);
+    entry >> process.pgid >> process.start_time;
+    std::getline(entry >> std::ws, process.name);
+    if (entry.fail()) {
+      LOG(WARNING) << "Malformed process registry entry for " << process.pid;
+      continue;
+    }
+    processes.push_back(process);
+  }
+  return processes;
+}
+
+bool IsRegisteredProcessRunning(const RegisteredProcess& process) {
+  char state;
+  pid_t pgid;
+  uint64_t start_time;
+  // 'Z' is a zombie and 'X' a process being reaped.
+  return ReadProcStat(process.pid, &state, &pgid, &start_time) &&
+         start_time == process.start_time && state != 'Z' && state != 'X';
+}
+
+SharedFD OpenRegisteredProcess(const RegisteredProcess& process) {
+  auto pidfd = SharedFD::PidFdOpen(process.pid);
+  if (!pidfd->IsOpen()) {
+    return pidfd;
+  }
+  // The start time is checked after opening the pidfd so that it refers to
+  // the process that was checked, even if the pid is reused right after.
+  char state;
+  pid_t pgid;
+  uint64_t start_time;
+  if (!ReadProcStat(process.pid, &state, &pgid, &start_time) ||
+      start_time != process.start_time) {
+    return SharedFD();
+  }
+  return pidfd;
+}
+
+bool KillRegisteredProcesses(const std::vector<RegisteredProcess>& processes,
+                             std::chrono::milliseconds timeout) {
+  // Processes are waited for through their pidfds when the kernel has them,
+  // otherwise by checking /proc periodically.
+  std::vector<PollSharedFd> pidfds;
+  std::vector<RegisteredProcess> unwaitable;
+  for (const auto& process : processes) {
+    auto pidfd = OpenRegisteredProcess(process);
+    if (!pidfd->IsOpen() && (pidfd->GetErrno() != ENOSYS ||
+                             !IsRegisteredProcessRunning(process))) {
+      continue;
+    }
+    // Subprocesses run in their own process groups, which also contain any
+    // processes they started.
+    if (process.pgid == process.pid && process.pgid != getpgrp()) {
+      LOG(INFO) << "Sending SIGKILL to process group " << process.pgid << " ("
+                << process.name << ")";
+      if (killpg(process.pgid, SIGKILL) != 0) {
+        PLOG(ERROR) << "Failed to kill process group " << process.pgid;
+      }
+    } else {
+      LOG(INFO) << "Sending SIGKILL to process " << process.pid << " ("
+                << process.name << ")";
+      if (pidfd->IsOpen() && pidfd->PidFdSendSignal(SIGKILL) != 0) {
+        LOG(ERROR) << "Failed to kill process " << process.pid << ": "
+                   << pidfd->StrError();
+      } else if (!pidfd->IsOpen() && kill(process.pid, SIGKILL) != 0) {
+        PLOG(ERROR) << "Failed to kill process " << process.pid;
+      }
+    }
+    if (pidfd->IsOpen()) {
+      pidfds.push_back({.fd = pidfd, .events = POLLIN});
+    } else {
+      unwaitable.push_back(process);
+    }
+  }
+
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (!pidfds.empty() || !unwaitable.empty()) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if (remaining.count() <= 0) {
+      LOG(ERROR) << pidfds.size() + unwaitable.size()
+                 << " processes still running after " << timeout.count()
+                 << "ms";
+      return false;
+    }
+    if (!unwaitable.empty()) {
+      remaining = std::min(remaining, kExitCheckInterval);
+    }
+    if (SharedFD::Poll(pidfds, remaining.count()) < 0) {
+      PLOG(ERROR) << "Failed to wait for processes to exit";
+      return false;
+    }
+    pidfds.erase(std::remove_if(pidfds.begin(), pidfds.end(),
+                                [](const PollSharedFd& pidfd) {
+                                  return pidfd.revents != 0;
+                                }),
+                 pidfds.end());
+    unwaitable.erase(std::remove_if(unwaitable.begin(), unwaitable.end(),
+                                    [](const RegisteredProcess& process) {
+                                      return !IsRegisteredProcessRunning(
+                                          process);
+                                    }),
+                     unwaitable.end());
+  }
+  return true;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+
+struct RegisteredProcess {
+  pid_t pid;
+  pid_t pgid;
+  // Start time from /proc/<pid>/stat, tells a registered process apart from
+  // an unrelated one that reused its pid.
+  uint64_t start_time;
+  std::string name;
+};
+
+// Records the processes of a device in a directory, one file per process, so
+// they can be found and stopped by other programs without scanning the
+// system. Entries can be added and removed concurrently from several
+// processes.
+class ProcessRegistry {
+ public:
+  ProcessRegistry(const std::string& dir) : dir_(dir) {}
+
+  bool Register(pid_t pid, const std::string& name);
+  bool Unregister(pid_t pid);
+  std::vector<RegisteredProcess> Processes() const;
+
+  const std::string& dir() const { return dir_; }
+
+ private:
+  std::string dir_;
+};
+
+// Parses the contents of /proc/<pid>/stat.
+bool ParseProcStat(const std::string& stat, char* state, pid_t* pgid,
+                   uint64_t* start_time);
+
+// Whether the process is alive, not a zombie, and not another process that
+// reused its pid.
+bool IsRegisteredProcessRunning(const RegisteredProcess& process);
+
+// Returns a pidfd for the process if it's still the one that was registered,
+// otherwise a closed SharedFD. Kernels older than 5.3 don't have pidfds, the
+// SharedFD is then closed with errno ENOSYS, see IsRegisteredProcessRunning.
+SharedFD OpenRegisteredProcess(const RegisteredProcess& process);
+
+// Sends SIGKILL to every process still running, and to its process group if it
+// leads one, then waits for them to exit. Returns false if any is still
+// running after the timeout. Without pidfds, a process could in theory exit
+// and have its pid reused between the start time check and the signal.
+bool KillRegisteredProcesses(const std::vector<RegisteredProcess>& processes,
+                             std::chrono::milliseconds timeout);
+
+}  // namespace cuttlefish
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/utils/process_registry.h"
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+// A child that sleeps until killed, optionally leading its own process group
+// with a grandchild in it.
+pid_t StartSleeper(bool own_group, pid_t* grandchild = nullptr) {
+  int pipe_fds[2];
+  EXPECT_EQ(pipe(pipe_fds), 0);
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (own_group) {
+      setpgid(0, 0);
+      pid_t child = fork();
+      if (child == 0) {
+        pause();
+        _exit(0);
+      }
+      write(pipe_fds[1], &child, sizeof(child));
+    } else {
+      pid_t none = 0;
+      write(pipe_fds[1], &none, sizeof(none));
+    }
+    pause();
+    _exit(0);
+  }
+  // Wait for the child to be set up, so that its process group exists.
+  pid_t child = 0;
+  EXPECT_EQ(read(pipe_fds[0], &child, sizeof(child)), sizeof(child));
+  close(pipe_fds[0]);
+  close(pipe_fds[1]);
+  if (grandchild) {
+    *grandchild = child;
+  }
+  return pid;
+}
+
+// Zombies don't count, the reaper of a reparented process may be slow.
+bool IsAlive(pid_t pid) {
+  std::string stat;
+  char state;
+  pid_t pgid;
+  uint64_t start_time;
+  return android::base::ReadFileToString(
+             "/proc/" + std::to_string(pid) + "/stat", &stat) &&
+         ParseProcStat(stat, &state, &pgid, &start_time) && state != 'Z';
+}
+
+class ProcessRegistryTest : public ::testing::Test {
+ protected:
+  RegisteredProcess RegisterSleeper(const std::string& name, bool own_group,
+                                    pid_t* grandchild = nullptr) {
+    pid_t pid = StartSleeper(own_group, grandchild);
+    children_.push_back(pid);
+    EXPECT_TRUE(registry_.Register(pid, name));
+    for (const auto& process : registry_.Processes()) {
+      if (process.pid == pid) {
+        return process;
+      }
+    }
+    ADD_FAILURE() << "Process " << pid << " was not registered";
+    return {};
+  }
+
+  void TearDown() override {
+    for (auto pid : children_) {
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+    }
+  }
+
+  TemporaryDir dir_;
+  ProcessRegistry registry_{std::string(dir_.path) + "/registry"};
+  std::vector<pid_t> children_;
+};
+
+TEST(ProcStatTest, ParsesFieldsAfterCommandName) {
+  // The command name may contain anything, including ") (".
+  std::string stat =
+      "1234 (a) (b c) S 1 4321 4321 0 -1 4194560 100 0 0 0 1 2 0 0 20 0 1 0 "
+      "98765 1000 100 18446744073709551615\n";
+  char state;
+  pid_t pgid;
+  uint64_t start_time;
+  ASSERT_TRUE(ParseProcStat(stat, &state, &pgid, &start_time));
+  EXPECT_EQ(state, 'S');
+  EXPECT_EQ(pgid, 4321);
+  EXPECT_EQ(start_time, 98765);
+}
+
+TEST(ProcStatTest, RejectsMalformedStat) {
+  char state;
+  pid_t pgid;
+  uint64_t start_time;
+  EXPECT_FALSE(ParseProcStat("", &state, &pgid, &start_time));
+  EXPECT_FALSE(ParseProcStat("1234 (cat)", &state, &pgid, &start_time));
+  EXPECT_FALSE(ParseProcStat("1234 (cat) S 1 2 3", &state, &pgid,
+                             &start_time));
+  EXPECT_FALSE(ParseProcStat(
+      "1234 (cat) S 1 x 4321 0 -1 0 0 0 0 0 0 0 0 0 20 0 1 0 98765",
+      &state, &pgid, &start_time));
+}
+
+TEST(ProcStatTest, ParsesOwnStat) {
+  std::string stat;
+  ASSERT_TRUE(android::base::ReadFileToString("/proc/self/stat", &stat));
+  char state;
+  pid_t pgid;
+  uint64_t start_time;
+  ASSERT_TRUE(ParseProcStat(stat, &state, &pgid, &start_time));
+  EXPECT_EQ(state, 'R');
+  EXPECT_EQ(pgid, getpgrp());
+  EXPECT_GT(start_time, 0);
+}
+
+TEST_F(ProcessRegistryTest, RegistersAndUnregisters) {
+  EXPECT_TRUE(registry_.Processes().empty());
+  ASSERT_TRUE(registry_.Register(getpid(), "test process"));
+  auto processes = registry_.Processes();
+  ASSERT_EQ(processes.size(), 1);
+  EXPECT_EQ(processes[0].pid, getpid());
+  EXPECT_EQ(processes[0].pgid, getpgrp());
+  EXPECT_EQ(processes[0].name, "test process");
+  EXPECT_TRUE(IsRegisteredProcessRunning(processes[0]));
+
+  ASSERT_TRUE(registry_.Unregister(getpid()));
+  EXPECT_TRUE(registry_.Processes().empty());
+  // Unregistering twice is not an error.
+  EXPECT_TRUE(registry_.Unregister(getpid()));
+}
+
+TEST_F(ProcessRegistryTest, KillsProcessesAndTheirGroups) {
+  pid_t grandchild;
+  auto leader = RegisterSleeper("leader", true, &grandchild);
+  auto member = RegisterSleeper("member", false);
+  ASSERT_TRUE(IsAlive(grandchild));
+
+  ASSERT_TRUE(KillRegisteredProcesses(registry_.Processes(),
+                                      std::chrono::seconds(10)));
+  // Exited, but not reaped yet.
+  EXPECT_FALSE(IsRegisteredProcessRunning(leader));
+  EXPECT_FALSE(IsRegisteredProcessRunning(member));
+  int status;
+  ASSERT_EQ(waitpid(leader.pid, &status, 0), leader.pid);
+  EXPECT_TRUE(WIFSIGNALED(status));
+  ASSERT_EQ(waitpid(member.pid, &status, 0), member.pid);
+  EXPECT_TRUE(WIFSIGNALED(status));
+  // The grandchild was killed with its group.
+  for (int i = 0; i < 1000 && IsAlive(grandchild); i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_FALSE(IsAlive(grandchild));
+}
+
+TEST_F(ProcessRegistryTest, IgnoresProcessesThatReusedAPid) {
+  auto process = RegisterSleeper("sleeper", false);
+  // As if the registered process had exited and another one got its pid.
+  process.start_time++;
+  EXPECT_FALSE(IsRegisteredProcessRunning(process));
+  EXPECT_FALSE(OpenRegisteredProcess(process)->IsOpen());
+  EXPECT_TRUE(KillRegisteredProcesses({process}, std::chrono::seconds(10)));
+  EXPECT_TRUE(IsAlive(process.pid));
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/utils/stats_file.h"
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+
+Json::Value HistogramToJson(const LatencyHistogram& histogram) {
+  Json::Value json;
+  json["count"] = Json::UInt64(histogram.Count());
+  json["mean_us"] = Json::Int64(histogram.Mean().count());
+  json["p50_us"] = Json::Int64(histogram.Percentile(50).count());
+  json["p90_us"] = Json::Int64(histogram.Percentile(90).count());
+  json["p99_us"] = Json::Int64(histogram.Percentile(99).count());
+  json["max_us"] = Json::Int64(histogram.Max().count());
+  Json::Value buckets(Json::arrayValue);
+  for (auto bucket : histogram.Buckets()) {
+    buckets.append(Json::UInt64(bucket));
+  }
+  json["log2_us_buckets"] = buckets;
+  return json;
+}
+
+bool WriteStatsFile(const std::string& path, const Json::Value& stats) {
+  Json::StreamWriterBuilder builder;
+  auto contents = Json::writeString(builder, stats);
+  auto temp_path = path + ".tmp";
+  if (!android::base::WriteStringToFile(contents, temp_path)) {
+    PLOG(ERROR) << "Could not write " << temp_path;
+    return false;
+  }
+  return RenameFile(temp_path, path);
+}
+
+StatsFileWriter::StatsFileWriter(std::chrono::milliseconds interval)
+    : interval_(interval) {}
+
+StatsFileWriter::~StatsFileWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  stop_cv_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void StatsFileWriter::AddFile(const std::string& path, Snapshot snapshot) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  files_.emplace_back(path, std::move(snapshot));
+  if (!thread_.joinable()) {
+    thread_ = std::thread([this]() { Loop(); });
+  }
+}
+
+void StatsFileWriter::Loop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_cv_.wait_for(lock, interval_, [this]() { return stopping_; })) {
+    WriteAll();
+  }
+  WriteAll();
+}
+
+void StatsFileWriter::WriteAll() {
+  // Called with mutex_ held, the snapshots are cheap compared to the interval.
+  for (const auto& [path, snapshot] : files_) {
+    WriteStatsFile(path, snapshot());
+  }
+}
+
+}  // namespace cuttlefish
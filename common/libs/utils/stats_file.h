@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <json/json.h>
+
+#include "common/libs/utils/latency_histogram.h"
+
+namespace cuttlefish {
+
+// Summary of a histogram as written to the stats files: count, mean, p50,
+// p90, p99 and max in microseconds and the raw log2_us_buckets.
+Json::Value HistogramToJson(const LatencyHistogram& histogram);
+
+// Replaces path with stats. Readers see either the old or the new contents,
+// never a partially written file.
+bool WriteStatsFile(const std::string& path, const Json::Value& stats);
+
+// Rewrites a set of stats files from one background thread. Each file is
+// written every interval and once more when the writer is destroyed.
+class StatsFileWriter {
+ public:
+  using Snapshot = std::function<Json::Value()>;
+
+  explicit StatsFileWriter(std::chrono::milliseconds interval);
+  ~StatsFileWriter();
+
+  // Starts writing the result of snapshot to path. snapshot is called from
+  // the writer's thread and must stay valid until the writer is destroyed.
+  void AddFile(const std::string& path, Snapshot snapshot);
+
+ private:
+  void Loop();
+  void WriteAll();
+
+  const std::chrono::milliseconds interval_;
+  std::mutex mutex_;
+  std::condition_variable stop_cv_;
+  bool stopping_ = false;
+  std::vector<std::pair<std::string, Snapshot>> files_;
+  std::thread thread_;
+};
+
+}  // namespace cuttlefish
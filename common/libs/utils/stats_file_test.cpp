@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/utils/stats_file.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <json/json.h>
+
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+Json::Value ReadJson(const std::string& path) {
+  std::string contents;
+  EXPECT_TRUE(android::base::ReadFileToString(path, &contents)) << path;
+  Json::Value json;
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  std::string errors;
+  EXPECT_TRUE(reader->parse(contents.data(), contents.data() + contents.size(),
+                            &json, &errors))
+      << errors;
+  return json;
+}
+
+TEST(StatsFileTest, HistogramToJson) {
+  LatencyHistogram histogram;
+  for (int i = 0; i < 99; i++) {
+    histogram.Record(std::chrono::microseconds(3));
+  }
+  histogram.Record(std::chrono::microseconds(1000));
+
+  auto json = HistogramToJson(histogram);
+  EXPECT_EQ(json["count"].asUInt64(), 100);
+  EXPECT_EQ(json["mean_us"].asInt64(), (99 * 3 + 1000) / 100);
+  // 3us lands in the [2, 4) bucket.
+  EXPECT_EQ(json["p50_us"].asInt64(), 4);
+  EXPECT_EQ(json["p90_us"].asInt64(), 4);
+  EXPECT_EQ(json["max_us"].asInt64(), 1000);
+  ASSERT_EQ(json["log2_us_buckets"].size(), LatencyHistogram::kBuckets);
+  EXPECT_EQ(json["log2_us_buckets"][2].asUInt64(), 99);
+  EXPECT_EQ(json["log2_us_buckets"][10].asUInt64(), 1);
+}
+
+TEST(StatsFileTest, WriteStatsFileReplacesContents) {
+  TemporaryDir dir;
+  auto path = std::string(dir.path) + "/stats.json";
+  Json::Value stats;
+  stats["value"] = 1;
+  ASSERT_TRUE(WriteStatsFile(path, stats));
+  stats["value"] = 2;
+  ASSERT_TRUE(WriteStatsFile(path, stats));
+  EXPECT_EQ(ReadJson(path)["value"].asInt(), 2);
+  EXPECT_FALSE(FileExists(path + ".tmp"));
+}
+
+TEST(StatsFileTest, WriterWritesPeriodicallyAndOnDestruction) {
+  TemporaryDir dir;
+  auto first = std::string(dir.path) + "/first.json";
+  auto second = std::string(dir.path) + "/second.json";
+  std::atomic<int> calls = 0;
+  {
+    StatsFileWriter writer(std::chrono::milliseconds(1));
+    writer.AddFile(first, [&calls]() {
+      Json::Value stats;
+      stats["calls"] = ++calls;
+      return stats;
+    });
+    while (calls < 3) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    writer.AddFile(second, []() { return Json::Value("second"); });
+  }
+  int written = ReadJson(first)["calls"].asInt();
+  EXPECT_GE(written, 3);
+  // The last write happened when the writer was destroyed.
+  EXPECT_EQ(written, calls);
+  EXPECT_EQ(ReadJson(second).asString(), "second");
+}
+
+TEST(StatsFileTest, WriterDestructionDoesNotWaitForInterval) {
+  TemporaryDir dir;
+  auto path = std::string(dir.path) + "/stats.json";
+  auto start = std::chrono::steady_clock::now();
+  {
+    StatsFileWriter writer(std::chrono::hours(1));
+    writer.AddFile(path, []() { return Json::Value(1); });
+  }
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+  EXPECT_EQ(ReadJson(path).asInt(), 1);
+}
+
+}  // namespace
+}  // namespace cuttlefish
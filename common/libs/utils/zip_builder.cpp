@@ -0,0 +1,428 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/utils/zip_builder.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <android-base/logging.h>
+
+#include "common/libs/fs/shared_buf.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr uint32_t kLocalHeaderSignature = 0x04034b50;
+constexpr uint32_t kDataDescriptorSignature = 0x08074b50;
+constexpr uint32_t kCentralDirHeaderSignature = 0x02014b50;
+constexpr uint32_t kEndOfCentralDirSignature = 0x06054b50;
+constexpr uint32_t kZip64EndOfCentralDirSignature = 0x06064b50;
+constexpr uint32_t kZip64EndOfCentralDirLocatorSignature = 0x07064b50;
+constexpr uint16_t kZip64ExtraFieldId = 0x0001;
+constexpr uint16_t kVersionDeflate = 20;
+constexpr uint16_t kVersionZip64 = 45;
+constexpr uint16_t kMadeByUnix = 3 << 8;
+// Sizes and CRC are in the data descriptor that follows the entry data.
+constexpr uint16_t kFlagDataDescriptor = 1 << 3;
+constexpr uint16_t kMethodDeflate = 8;
+constexpr uint32_t kMax32 = 0xffffffff;
+constexpr uint16_t kMax16 = 0xffff;
+
+// Big enough for deflate to work well, small enough to spread a single file
+// over all threads.
+constexpr size_t kChunkSize = 4 << 20;
+
+void Put16(std::string* out, uint16_t value) {
+  out->push_back(value & 0xff);
+  out->push_back(value >> 8);
+}
+
+void Put32(std::string* out, uint32_t value) {
+  Put16(out, value & 0xffff);
+  Put16(out, value >> 16);
+}
+
+void Put64(std::string* out, uint64_t value) {
+  Put32(out, value & 0xffffffff);
+  Put32(out, value >> 32);
+}
+
+uint32_t Clamp32(uint64_t value) {
+  return value >= kMax32 ? kMax32 : value;
+}
+
+void DosDateTime(time_t mtime, uint16_t* date, uint16_t* time) {
+  struct tm tm;
+  localtime_r(&mtime, &tm);
+  if (tm.tm_year < 80) {  // The DOS epoch is 1980
+    *date = (1 << 5) | 1;
+    *time = 0;
+    return;
+  }
+  *date = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+  *time = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec >> 1);
+}
+
+// Compresses `in` as raw deflate data. Chunks other than the last end with a
+// sync flush, which leaves the stream byte aligned without marking it final,
+// so the chunks of an entry can be concatenated.
+bool DeflateChunk(const char* in, size_t size, bool last, std::string* out) {
+  z_stream stream = {};
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    LOG(ERROR) << "deflateInit2 failed";
+    return false;
+  }
+  // The bound assumes Z_FINISH, a sync flush adds an empty stored block.
+  out->resize(deflateBound(&stream, size) + 16);
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+  stream.avail_in = size;
+  stream.next_out = reinterpret_cast<Bytef*>(out->data());
+  stream.avail_out = out->size();
+  int ret = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+  bool complete = last ? ret == Z_STREAM_END : ret == Z_OK;
+  if (!complete || stream.avail_in != 0) {
+    LOG(ERROR) << "deflate failed: " << ret;
+    deflateEnd(&stream);
+    return false;
+  }
+  out->resize(stream.total_out);
+  deflateEnd(&stream);
+  return true;
+}
+
+struct Chunk {
+  size_t entry;
+  off_t offset;
+  size_t length;
+  bool first;
+  bool last;
+  // Filled in by the worker threads.
+  bool done = false;
+  bool failed = false;
+  size_t bytes_read = 0;
+  uint32_t crc = 0;
+  std::string data;
+};
+
+}  // namespace
+
+ZipBuilder::ZipBuilder(SharedFD out, size_t max_threads,
+                       uint64_t zip64_threshold)
+    : out_(out),
+      max_threads_(std::max<size_t>(max_threads, 1)),
+      zip64_threshold_(zip64_threshold) {}
+
+bool ZipBuilder::AddFile(const std::string& zip_path,
+                         const std::string& file_path, uint64_t max_size,
+                         bool tail) {
+  auto file = SharedFD::Open(file_path, O_RDONLY);
+  if (!file->IsOpen()) {
+    LOG(ERROR) << "Unable to open \"" << file_path
+               << "\": " << file->StrError();
+    return false;
+  }
+  struct stat st;
+  if (file->Fstat(&st) != 0) {
+    LOG(ERROR) << "Unable to stat \"" << file_path
+               << "\": " << file->StrError();
+    return false;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    LOG(ERROR) << "\"" << file_path << "\" is not a regular file";
+    return false;
+  }
+  Entry entry = {
+      .name = zip_path,
+      .file = file,
+      .offset = 0,
+      .length = static_cast<uint64_t>(st.st_size),
+      .mode = st.st_mode,
+      .mtime = st.st_mtime,
+  };
+  if (max_size > 0 && entry.length > max_size) {
+    LOG(INFO) << "Keeping only the " << (tail ? "last " : "first ") << max_size
+              << " of " << entry.length << " bytes of \"" << file_path << "\"";
+    if (tail) {
+      entry.offset = entry.length - max_size;
+    }
+    entry.length = max_size;
+  }
+  entries_.push_back(entry);
+  return true;
+}
+
+bool ZipBuilder::Finish() {
+  std::vector<Chunk> chunks;
+  for (size_t i = 0; i < entries_.size(); i++) {
+    const auto& entry = entries_[i];
+    uint64_t done = 0;
+    do {
+      size_t length = std::min<uint64_t>(kChunkSize, entry.length - done);
+      chunks.push_back(Chunk{
+          .entry = i,
+          .offset = static_cast<off_t>(entry.offset + done),
+          .length = length,
+          .first = done == 0,
+          .last = done + length == entry.length,
+      });
+      done += length;
+    } while (done < entry.length);
+  }
+
+  // Chunks are compressed in any order but written in order, workers don't
+  // get too far ahead of the writer to bound the memory used.
+  size_t max_in_flight = max_threads_ * 4;
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t written = 0;
+  bool aborted = false;
+  std::atomic<size_t> next_chunk = 0;
+
+  auto worker = [&]() {
+    std::vector<char> buffer(kChunkSize);
+    for (size_t i = next_chunk++; i < chunks.size(); i = next_chunk++) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return aborted || i < written + max_in_flight; });
+        if (aborted) {
+          return;
+        }
+      }
+      auto& chunk = chunks[i];
+      auto file = entries_[chunk.entry].file;
+      bool ok = true;
+      // The file may have been truncated since it was added, whatever is
+      // still there is compressed.
+      while (chunk.bytes_read < chunk.length) {
+        auto read = file->PRead(buffer.data() + chunk.bytes_read,
+                                chunk.length - chunk.bytes_read,
+                                chunk.offset + chunk.bytes_read);
+        if (read < 0) {
+          LOG(ERROR) << "Failed to read \"" << entries_[chunk.entry].name
+                     << "\": " << file->StrError();
+          ok = false;
+          break;
+        }
+        if (read == 0) {
+          break;
+        }
+        chunk.bytes_read += read;
+      }
+      if (ok) {
+        chunk.crc = crc32(0, reinterpret_cast<Bytef*>(buffer.data()),
+                          chunk.bytes_read);
+        ok = DeflateChunk(buffer.data(), chunk.bytes_read, chunk.last,
+                          &chunk.data);
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      chunk.done = true;
+      chunk.failed = !ok;
+      cv.notify_all();
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < std::min(max_threads_, chunks.size()); i++) {
+    workers.emplace_back(worker);
+  }
+
+  struct Written {
+    uint64_t local_header_offset;
+    uint64_t compressed_size;
+    uint64_t uncompressed_size;
+    uint32_t crc;
+    bool zip64;
+  };
+  std::vector<Written> written_entries(entries_.size());
+  uint64_t out_offset = 0;
+  bool ok = true;
+  auto write = [this, &out_offset](const std::string& data) {
+    if (WriteAll(out_, data) != static_cast<ssize_t>(data.size())) {
+      LOG(ERROR) << "Failed to write the zip archive: " << out_->StrError();
+      return false;
+    }
+    out_offset += data.size();
+    return true;
+  };
+
+  for (size_t i = 0; ok && i < chunks.size(); i++) {
+    auto& chunk = chunks[i];
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&chunk] { return chunk.done; });
+    }
+    if (chunk.failed) {
+      ok = false;
+      break;
+    }
+    const auto& entry = entries_[chunk.entry];
+    auto& out_entry = written_entries[chunk.entry];
+    if (chunk.first) {
+      out_entry = {
+          .local_header_offset = out_offset,
+          .compressed_size = 0,
+          .uncompressed_size = 0,
+          .crc = static_cast<uint32_t>(crc32(0, nullptr, 0)),
+          .zip64 = entry.length >= zip64_threshold_,
+      };
+      uint16_t date, time;
+      DosDateTime(entry.mtime, &date, &time);
+      std::string header;
+      Put32(&header, kLocalHeaderSignature);
+      Put16(&header, out_entry.zip64 ? kVersionZip64 : kVersionDeflate);
+      Put16(&header, kFlagDataDescriptor);
+      Put16(&header, kMethodDeflate);
+      Put16(&header, time);
+      Put16(&header, date);
+      Put32(&header, 0);  // crc32
+      // A zip64 extra field in the local header tells readers the data
+      // descriptor has 64 bit sizes.
+      Put32(&header, out_entry.zip64 ? kMax32 : 0);
+      Put32(&header, out_entry.zip64 ? kMax32 : 0);
+      Put16(&header, entry.name.size());
+      Put16(&header, out_entry.zip64 ? 20 : 0);
+      header += entry.name;
+      if (out_entry.zip64) {
+        Put16(&header, kZip64ExtraFieldId);
+        Put16(&header, 16);
+        Put64(&header, 0);
+        Put64(&header, 0);
+      }
+      ok = write(header);
+    }
+    ok = ok && write(chunk.data);
+    out_entry.crc = crc32_combine(out_entry.crc, chunk.crc, chunk.bytes_read);
+    out_entry.compressed_size += chunk.data.size();
+    out_entry.uncompressed_size += chunk.bytes_read;
+    if (ok && chunk.last) {
+      std::string descriptor;
+      Put32(&descriptor, kDataDescriptorSignature);
+      Put32(&descriptor, out_entry.crc);
+      if (out_entry.zip64) {
+        Put64(&descriptor, out_entry.compressed_size);
+        Put64(&descriptor, out_entry.uncompressed_size);
+      } else {
+        Put32(&descriptor, out_entry.compressed_size);
+        Put32(&descriptor, out_entry.uncompressed_size);
+      }
+      ok = write(descriptor);
+    }
+    std::string().swap(chunk.data);
+    std::lock_guard<std::mutex> lock(mutex);
+    written = i + 1;
+    cv.notify_all();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    aborted = !ok;
+    cv.notify_all();
+  }
+  for (auto& thread : workers) {
+    thread.join();
+  }
+  if (!ok) {
+    return false;
+  }
+
+  uint64_t central_dir_offset = out_offset;
+  std::string central_dir;
+  for (size_t i = 0; i < entries_.size(); i++) {
+    const auto& entry = entries_[i];
+    const auto& out_entry = written_entries[i];
+    // Readers use the central directory to tell the size of the data
+    // descriptor. When it has 64 bit sizes they must be in the zip64 extra
+    // field, even if they would fit in 32 bits.
+    bool sizes64 = out_entry.zip64;
+    bool offset64 = out_entry.local_header_offset >= kMax32;
+    std::string extra;
+    if (sizes64) {
+      Put64(&extra, out_entry.uncompressed_size);
+      Put64(&extra, out_entry.compressed_size);
+    }
+    if (offset64) {
+      Put64(&extra, out_entry.local_header_offset);
+    }
+    bool zip64 = sizes64 || offset64;
+    uint16_t version = zip64 ? kVersionZip64 : kVersionDeflate;
+    uint16_t date, time;
+    DosDateTime(entry.mtime, &date, &time);
+    Put32(&central_dir, kCentralDirHeaderSignature);
+    Put16(&central_dir, kMadeByUnix | version);
+    Put16(&central_dir, version);
+    Put16(&central_dir, kFlagDataDescriptor);
+    Put16(&central_dir, kMethodDeflate);
+    Put16(&central_dir, time);
+    Put16(&central_dir, date);
+    Put32(&central_dir, out_entry.crc);
+    Put32(&central_dir, sizes64 ? kMax32 : out_entry.compressed_size);
+    Put32(&central_dir, sizes64 ? kMax32 : out_entry.uncompressed_size);
+    Put16(&central_dir, entry.name.size());
+    Put16(&central_dir, zip64 ? extra.size() + 4 : 0);
+    Put16(&central_dir, 0);  // comment length
+    Put16(&central_dir, 0);  // disk number
+    Put16(&central_dir, 0);  // internal attributes
+    Put32(&central_dir, entry.mode << 16);
+    Put32(&central_dir, offset64 ? kMax32 : out_entry.local_header_offset);
+    central_dir += entry.name;
+    if (zip64) {
+      Put16(&central_dir, kZip64ExtraFieldId);
+      Put16(&central_dir, extra.size());
+      central_dir += extra;
+    }
+  }
+  uint64_t central_dir_size = central_dir.size();
+
+  std::string end;
+  if (entries_.size() >= kMax16 || central_dir_offset >= kMax32 ||
+      central_dir_size >= kMax32) {
+    uint64_t zip64_end_offset = central_dir_offset + central_dir_size;
+    Put32(&end, kZip64EndOfCentralDirSignature);
+    Put64(&end, 44);  // Size of the rest of this record
+    Put16(&end, kMadeByUnix | kVersionZip64);
+    Put16(&end, kVersionZip64);
+    Put32(&end, 0);  // disk number
+    Put32(&end, 0);  // disk with the central directory
+    Put64(&end, entries_.size());
+    Put64(&end, entries_.size());
+    Put64(&end, central_dir_size);
+    Put64(&end, central_dir_offset);
+    Put32(&end, kZip64EndOfCentralDirLocatorSignature);
+    Put32(&end, 0);  // disk with the zip64 end of central directory
+    Put64(&end, zip64_end_offset);
+    Put32(&end, 1);  // number of disks
+  }
+  Put32(&end, kEndOfCentralDirSignature);
+  Put16(&end, 0);  // disk number
+  Put16(&end, 0);  // disk with the central directory
+  Put16(&end, std::min<size_t>(entries_.size(), kMax16));
+  Put16(&end, std::min<size_t>(entries_.size(), kMax16));
+  Put32(&end, Clamp32(central_dir_size));
+  Put32(&end, Clamp32(central_dir_offset));
+  Put16(&end, 0);  // comment length
+  return write(central_dir) && write(end);
+}
+
+}  // namespace cuttlefish
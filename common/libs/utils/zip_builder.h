@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+
+/**
+ * Writes a zip archive of files, deflating them on several threads.
+ *
+ * Files are split into chunks that are compressed as independent deflate
+ * streams and concatenated in order, so a single large file is compressed as
+ * fast as many small ones. The archive is written sequentially with data
+ * descriptors, so the output doesn't need to be seekable and can be a pipe.
+ * Archives over 4GiB use the zip64 extensions.
+ */
+class ZipBuilder {
+ public:
+  // Entries whose compressed size could reach 4GiB, deflate may grow
+  // incompressible data a little.
+  static constexpr uint64_t kZip64Threshold = 0xf0000000;
+
+  // Entries of at least `zip64_threshold` bytes have 64 bit sizes in their
+  // data descriptor, as the size of the compressed data isn't known when
+  // their header is written.
+  ZipBuilder(SharedFD out, size_t max_threads,
+             uint64_t zip64_threshold = kZip64Threshold);
+
+  // Adds the contents of `file_path` as `zip_path`. With a non-zero
+  // `max_size` only that many bytes are added, from the end of the file when
+  // `tail` is set and from its beginning otherwise. The size is sampled now,
+  // data appended to the file later is not added.
+  bool AddFile(const std::string& zip_path, const std::string& file_path,
+               uint64_t max_size = 0, bool tail = false);
+
+  // Compresses the files and writes the whole archive.
+  bool Finish();
+
+ private:
+  struct Entry {
+    std::string name;
+    SharedFD file;
+    off_t offset;
+    uint64_t length;
+    uint32_t mode;
+    time_t mtime;
+  };
+
+  SharedFD out_;
+  size_t max_threads_;
+  uint64_t zip64_threshold_;
+  std::vector<Entry> entries_;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/utils/zip_builder.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/utils/zip_index.h"
+
+namespace cuttlefish {
+namespace {
+
+uint16_t Read16(const std::string& data, size_t pos) {
+  return static_cast<uint8_t>(data[pos]) |
+         (static_cast<uint8_t>(data[pos + 1]) << 8);
+}
+
+uint32_t Read32(const std::string& data, size_t pos) {
+  return Read16(data, pos) |
+         (static_cast<uint32_t>(Read16(data, pos + 2)) << 16);
+}
+
+uint64_t Read64(const std::string& data, size_t pos) {
+  return Read32(data, pos) |
+         (static_cast<uint64_t>(Read32(data, pos + 4)) << 32);
+}
+
+// Random bytes deflate doesn't shrink, repeated text it does.
+std::string RandomData(size_t size) {
+  std::mt19937 random(size);
+  std::string data(size, '\0');
+  for (auto& c : data) {
+    c = random();
+  }
+  return data;
+}
+
+std::string TextData(size_t size) {
+  std::string data;
+  while (data.size() < size) {
+    data += "The quick brown fox jumps over the lazy dog " +
+            std::to_string(data.size()) + "\n";
+  }
+  data.resize(size);
+  return data;
+}
+
+class ZipBuilderTest : public ::testing::Test {
+ protected:
+  std::string AddInput(const std::string& name, const std::string& contents,
+                       mode_t mode = 0644) {
+    auto path = std::string(dir_.path) + "/" + name;
+    EXPECT_TRUE(android::base::WriteStringToFile(contents, path));
+    EXPECT_EQ(chmod(path.c_str(), mode), 0);
+    return path;
+  }
+
+  std::string OutputPath(const std::string& name) {
+    return std::string(dir_.path) + "/" + name;
+  }
+
+  std::string ReadContents(const ZipIndex& index, const std::string& name) {
+    auto entry = index.Find(name);
+    EXPECT_NE(entry, nullptr) << name;
+    std::string contents;
+    if (entry) {
+      EXPECT_TRUE(index.ExtractToMemory(*entry, &contents)) << name;
+    }
+    return contents;
+  }
+
+  TemporaryDir dir_;
+};
+
+TEST_F(ZipBuilderTest, RoundTrip) {
+  // Several chunks each, on more threads than there are chunks.
+  auto random = RandomData(9 << 20);
+  auto text = TextData(13 << 20);
+  auto archive = OutputPath("archive.zip");
+  ZipBuilder builder(SharedFD::Creat(archive, 0644), 8);
+  ASSERT_TRUE(builder.AddFile("empty", AddInput("empty", "")));
+  ASSERT_TRUE(builder.AddFile("small.txt", AddInput("small", "hello\n")));
+  ASSERT_TRUE(builder.AddFile("dir/random", AddInput("random", random, 0600)));
+  ASSERT_TRUE(builder.AddFile("dir/text", AddInput("text", text, 0755)));
+  ASSERT_TRUE(builder.Finish());
+
+  auto index = ZipIndex::Open(archive);
+  ASSERT_NE(index, nullptr);
+  ASSERT_EQ(index->Entries().size(), 4);
+  EXPECT_EQ(index->Entries()[0].name, "empty");
+  EXPECT_EQ(index->Entries()[3].name, "dir/text");
+  EXPECT_EQ(ReadContents(*index, "empty"), "");
+  EXPECT_EQ(ReadContents(*index, "small.txt"), "hello\n");
+  EXPECT_EQ(ReadContents(*index, "dir/random"), random);
+  EXPECT_EQ(ReadContents(*index, "dir/text"), text);
+  EXPECT_EQ(index->Find("dir/random")->mode, S_IFREG | 0600);
+  EXPECT_EQ(index->Find("dir/text")->mode, S_IFREG | 0755);
+  EXPECT_LT(index->Find("dir/text")->compressed_size, text.size() / 4);
+}
+
+TEST_F(ZipBuilderTest, OutputDoesNotDependOnThreads) {
+  auto input = AddInput("text", TextData(11 << 20));
+  std::string archives[2];
+  for (int i = 0; i < 2; i++) {
+    auto path = OutputPath("archive" + std::to_string(i));
+    ZipBuilder builder(SharedFD::Creat(path, 0644), i == 0 ? 1 : 16);
+    ASSERT_TRUE(builder.AddFile("text", input));
+    ASSERT_TRUE(builder.AddFile("again", input));
+    ASSERT_TRUE(builder.Finish());
+    ASSERT_TRUE(android::base::ReadFileToString(path, &archives[i]));
+  }
+  EXPECT_EQ(archives[0], archives[1]);
+}
+
+TEST_F(ZipBuilderTest, KeepsHeadOrTail) {
+  auto data = TextData(100000);
+  auto input = AddInput("log", data);
+  auto archive = OutputPath("archive.zip");
+  ZipBuilder builder(SharedFD::Creat(archive, 0644), 2);
+  ASSERT_TRUE(builder.AddFile("head", input, 1000, /* tail */ false));
+  ASSERT_TRUE(builder.AddFile("tail", input, 1000, /* tail */ true));
+  ASSERT_TRUE(builder.AddFile("whole", input, data.size(), true));
+  ASSERT_TRUE(builder.Finish());
+
+  auto index = ZipIndex::Open(archive);
+  ASSERT_NE(index, nullptr);
+  EXPECT_EQ(ReadContents(*index, "head"), data.substr(0, 1000));
+  EXPECT_EQ(ReadContents(*index, "tail"), data.substr(data.size() - 1000));
+  EXPECT_EQ(ReadContents(*index, "whole"), data);
+}
+
+TEST_F(ZipBuilderTest, RejectsDirectories) {
+  ZipBuilder builder(SharedFD::Creat(OutputPath("archive.zip"), 0644), 1);
+  EXPECT_FALSE(builder.AddFile("dir", dir_.path));
+  EXPECT_FALSE(builder.AddFile("missing", OutputPath("missing")));
+}
+
+// Entries announced as zip64 in their local header, because they could have
+// grown over 4GiB, must say so in the central directory too, even when they
+// ended up smaller. Readers use it to tell the size of the data descriptor.
+TEST_F(ZipBuilderTest, Zip64EntriesAreConsistent) {
+  auto small = TextData(1000);
+  auto large = RandomData(5 << 20);
+  auto archive = OutputPath("archive.zip");
+  // As if the 4GiB threshold were 4096 bytes.
+  ZipBuilder builder(SharedFD::Creat(archive, 0644), 4, 4096);
+  ASSERT_TRUE(builder.AddFile("small", AddInput("small", small)));
+  ASSERT_TRUE(builder.AddFile("large", AddInput("large", large)));
+  ASSERT_TRUE(builder.Finish());
+
+  auto index = ZipIndex::Open(archive);
+  ASSERT_NE(index, nullptr);
+  EXPECT_EQ(ReadContents(*index, "small"), small);
+  EXPECT_EQ(ReadContents(*index, "large"), large);
+
+  std::string data;
+  ASSERT_TRUE(android::base::ReadFileToString(archive, &data));
+  for (const auto& entry : index->Entries()) {
+    bool zip64 = entry.name == "large";
+    size_t pos = entry.local_header_offset;
+    ASSERT_EQ(Read32(data, pos), 0x04034b50) << entry.name;
+    uint16_t name_size = Read16(data, pos + 26);
+    uint16_t extra_size = Read16(data, pos + 28);
+    EXPECT_EQ(extra_size, zip64 ? 20 : 0) << entry.name;
+    if (zip64) {
+      EXPECT_EQ(Read16(data, pos + 30 + name_size), 0x0001);
+    }
+
+    size_t descriptor = pos + 30 + name_size + extra_size +
+                        entry.compressed_size;
+    ASSERT_EQ(Read32(data, descriptor), 0x08074b50) << entry.name;
+    EXPECT_EQ(Read32(data, descriptor + 4), entry.crc32);
+    if (zip64) {
+      EXPECT_EQ(Read64(data, descriptor + 8), entry.compressed_size);
+      EXPECT_EQ(Read64(data, descriptor + 16), entry.uncompressed_size);
+    } else {
+      EXPECT_EQ(Read32(data, descriptor + 8), entry.compressed_size);
+      EXPECT_EQ(Read32(data, descriptor + 12), entry.uncompressed_size);
+    }
+    // The next local header or the central directory follows.
+    size_t next = descriptor + (zip64 ? 24 : 16);
+    auto signature = Read32(data, next);
+    EXPECT_TRUE(signature == 0x04034b50 || signature == 0x02014b50)
+        << entry.name;
+  }
+
+  // The end of central directory record, without a comment, points at the
+  // central directory.
+  size_t central_dir = Read32(data, data.size() - 6);
+  for (size_t i = 0; i < index->Entries().size(); i++) {
+    const auto& entry = index->Entries()[i];
+    bool zip64 = entry.name == "large";
+    ASSERT_EQ(Read32(data, central_dir), 0x02014b50);
+    EXPECT_EQ(Read16(data, central_dir + 6), zip64 ? 45 : 20);
+    uint32_t size_field = zip64 ? 0xffffffff : entry.compressed_size;
+    EXPECT_EQ(Read32(data, central_dir + 20), size_field) << entry.name;
+    uint16_t name_size = Read16(data, central_dir + 28);
+    uint16_t extra_size = Read16(data, central_dir + 30);
+    EXPECT_EQ(extra_size, zip64 ? 20 : 0) << entry.name;
+    central_dir += 46 + name_size + extra_size;
+  }
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,550 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/utils/zip_index.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <thread>
+
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+
+namespace cuttlefish {
+namespace {
+
+constexpr uint32_t kEndOfCentralDirSignature = 0x06054b50;
+constexpr uint32_t kZip64EndOfCentralDirSignature = 0x06064b50;
+constexpr uint32_t kZip64LocatorSignature = 0x07064b50;
+constexpr uint32_t kCentralDirHeaderSignature = 0x02014b50;
+constexpr uint32_t kLocalHeaderSignature = 0x04034b50;
+
+constexpr size_t kEndOfCentralDirSize = 22;
+constexpr size_t kZip64LocatorSize = 20;
+constexpr size_t kZip64EndOfCentralDirSize = 56;
+constexpr size_t kCentralDirHeaderSize = 46;
+constexpr size_t kLocalHeaderSize = 30;
+constexpr size_t kMaxCommentSize = 0xffff;
+
+constexpr uint16_t kZip64ExtraFieldId = 0x0001;
+constexpr uint16_t kFlagEncrypted = 1 << 0;
+constexpr uint16_t kMethodStored = 0;
+constexpr uint16_t kMethodDeflated = 8;
+// Upper byte of "version made by" for archives created on unix systems.
+constexpr uint8_t kHostUnix = 3;
+
+constexpr size_t kBufferSize = 1 << 20;
+constexpr size_t kSparseBlockSize = 4096;
+
+uint16_t Read16(const char* data) {
+  auto bytes = reinterpret_cast<const uint8_t*>(data);
+  return bytes[0] | (bytes[1] << 8);
+}
+
+uint32_t Read32(const char* data) {
+  return Read16(data) | (static_cast<uint32_t>(Read16(data + 2)) << 16);
+}
+
+uint64_t Read64(const char* data) {
+  return Read32(data) | (static_cast<uint64_t>(Read32(data + 4)) << 32);
+}
+
+bool PReadAll(const SharedFD& fd, char* buf, size_t count, off_t offset) {
+  while (count > 0) {
+    ssize_t num_read = fd->PRead(buf, count, offset);
+    if (num_read <= 0) {
+      return false;
+    }
+    buf += num_read;
+    count -= num_read;
+    offset += num_read;
+  }
+  return true;
+}
+
+bool PWriteAll(const SharedFD& fd, const char* buf, size_t count,
+               off_t offset) {
+  while (count > 0) {
+    ssize_t written = fd->PWrite(buf, count, offset);
+    if (written <= 0) {
+      return false;
+    }
+    buf += written;
+    count -= written;
+    offset += written;
+  }
+  return true;
+}
+
+// Writes `data` at `offset`, skipping whole blocks of zeroes when `sparse`.
+// Skipped blocks read back as zeroes once the file is truncated to its final
+// size.
+bool WriteMaybeSparse(const SharedFD& fd, const char* data, size_t count,
+                      off_t offset, bool sparse) {
+  if (!sparse) {
+    return PWriteAll(fd, data, count, offset);
+  }
+  static const char kZeroes[kSparseBlockSize] = {};
+  size_t pos = 0;
+  while (pos < count) {
+    size_t run_start = pos;
+    while (pos < count) {
+      size_t block = std::min(kSparseBlockSize, count - pos);
+      if (block == kSparseBlockSize &&
+          memcmp(data + pos, kZeroes, kSparseBlockSize) == 0) {
+        break;
+      }
+      pos += block;
+    }
+    if (pos > run_start &&
+        !PWriteAll(fd, data + run_start, pos - run_start, offset + run_start)) {
+      return false;
+    }
+    while (pos + kSparseBlockSize <= count &&
+           memcmp(data + pos, kZeroes, kSparseBlockSize) == 0) {
+      pos += kSparseBlockSize;
+    }
+  }
+  return true;
+}
+
+// Rejects names that would escape the target directory, like bsdtar does by
+// default.
+bool IsSafePath(const std::string& name) {
+  if (name.empty() || name[0] == '/') {
+    return false;
+  }
+  for (const auto& component : android::base::Split(name, "/")) {
+    if (component == "..") {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool MakeDirectories(const std::string& path) {
+  size_t pos = 0;
+  while (pos != std::string::npos) {
+    pos = path.find('/', pos + 1);
+    auto prefix = path.substr(0, pos);
+    if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+      PLOG(ERROR) << "Could not create directory \"" << prefix << "\"";
+      return false;
+    }
+  }
+  return true;
+}
+
+// Calls `output` with consecutive chunks of the entry's uncompressed data.
+template <typename F>
+bool InflateEntry(const SharedFD& fd, off_t offset, const ZipEntry& entry,
+                  F output) {
+  z_stream stream = {};
+  // Negative window bits: raw deflate data without a zlib header.
+  if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+    LOG(ERROR) << "inflateInit2 failed";
+    return false;
+  }
+  std::unique_ptr<char[]> in(new char[kBufferSize]);
+  std::unique_ptr<char[]> out(new char[kBufferSize]);
+  uint64_t remaining_in = entry.compressed_size;
+  uint64_t total_out = 0;
+  uint32_t crc = crc32(0, nullptr, 0);
+  int ret = Z_OK;
+  while (ret != Z_STREAM_END) {
+    if (stream.avail_in == 0) {
+      size_t chunk = std::min<uint64_t>(kBufferSize, remaining_in);
+      if (chunk == 0 || !PReadAll(fd, in.get(), chunk, offset)) {
+        LOG(ERROR) << "Truncated data for \"" << entry.name << "\"";
+        inflateEnd(&stream);
+        return false;
+      }
+      offset += chunk;
+      remaining_in -= chunk;
+      stream.next_in = reinterpret_cast<Bytef*>(in.get());
+      stream.avail_in = chunk;
+    }
+    stream.next_out = reinterpret_cast<Bytef*>(out.get());
+    stream.avail_out = kBufferSize;
+    ret = inflate(&stream, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END) {
+      LOG(ERROR) << "Corrupt deflate data for \"" << entry.name
+                 << "\": " << ret;
+      inflateEnd(&stream);
+      return false;
+    }
+    size_t produced = kBufferSize - stream.avail_out;
+    crc = crc32(crc, reinterpret_cast<Bytef*>(out.get()), produced);
+    if (!output(out.get(), produced, total_out)) {
+      inflateEnd(&stream);
+      return false;
+    }
+    total_out += produced;
+  }
+  inflateEnd(&stream);
+  if (total_out != entry.uncompressed_size || crc != entry.crc32) {
+    LOG(ERROR) << "Size or checksum mismatch for \"" << entry.name << "\"";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool ZipEntry::IsDirectory() const {
+  return android::base::EndsWith(name, "/") || S_ISDIR(mode);
+}
+
+bool ZipEntry::IsSymlink() const { return S_ISLNK(mode); }
+
+ZipIndex::ZipIndex(const std::string& path, SharedFD fd)
+    : path_(path), fd_(fd), file_size_(0) {}
+
+std::unique_ptr<ZipIndex> ZipIndex::Open(const std::string& path) {
+  // Callers fall back to other archive formats, so only archives that look
+  // like zips but can't be read are errors.
+  auto fd = SharedFD::Open(path, O_RDONLY);
+  if (!fd->IsOpen()) {
+    LOG(DEBUG) << "Could not open \"" << path << "\": " << fd->StrError();
+    return {};
+  }
+  std::unique_ptr<ZipIndex> index(new ZipIndex(path, fd));
+  if (!index->ReadCentralDirectory()) {
+    return {};
+  }
+  return index;
+}
+
+bool ZipIndex::ReadCentralDirectory() {
+  file_size_ = fd_->LSeek(0, SEEK_END);
+  if (file_size_ < 0) {
+    LOG(ERROR) << "Could not seek in \"" << path_ << "\": " << fd_->StrError();
+    return false;
+  }
+  // The end of central directory record is followed by a variable length
+  // comment, so search backwards for its signature.
+  size_t tail_size = std::min<off_t>(
+      file_size_, kEndOfCentralDirSize + kMaxCommentSize + kZip64LocatorSize);
+  std::string tail(tail_size, '\0');
+  if (!PReadAll(fd_, tail.data(), tail_size, file_size_ - tail_size)) {
+    LOG(DEBUG) << "Could not read \"" << path_ << "\": " << fd_->StrError();
+    return false;
+  }
+  ssize_t eocd = -1;
+  for (ssize_t i = tail_size - kEndOfCentralDirSize; i >= 0; i--) {
+    if (Read32(tail.data() + i) == kEndOfCentralDirSignature) {
+      eocd = i;
+      break;
+    }
+  }
+  if (eocd < 0) {
+    LOG(DEBUG) << "\"" << path_ << "\" is not a zip archive";
+    return false;
+  }
+  uint64_t num_entries = Read16(tail.data() + eocd + 10);
+  uint64_t cd_size = Read32(tail.data() + eocd + 12);
+  uint64_t cd_offset = Read32(tail.data() + eocd + 16);
+  ssize_t locator = eocd - kZip64LocatorSize;
+  if (locator >= 0 && Read32(tail.data() + locator) == kZip64LocatorSignature) {
+    off_t eocd64_offset = Read64(tail.data() + locator + 8);
+    char eocd64[kZip64EndOfCentralDirSize];
+    if (!PReadAll(fd_, eocd64, sizeof(eocd64), eocd64_offset) ||
+        Read32(eocd64) != kZip64EndOfCentralDirSignature) {
+      LOG(ERROR) << "Invalid zip64 end of central directory in \"" << path_
+                 << "\"";
+      return false;
+    }
+    num_entries = Read64(eocd64 + 32);
+    cd_size = Read64(eocd64 + 40);
+    cd_offset = Read64(eocd64 + 48);
+  }
+  if (cd_offset + cd_size > static_cast<uint64_t>(file_size_)) {
+    LOG(ERROR) << "Central directory of \"" << path_ << "\" is out of bounds";
+    return false;
+  }
+
+  std::string cd(cd_size, '\0');
+  if (!PReadAll(fd_, cd.data(), cd_size, cd_offset)) {
+    LOG(ERROR) << "Could not read the central directory of \"" << path_
+               << "\": " << fd_->StrError();
+    return false;
+  }
+  entries_.reserve(num_entries);
+  size_t pos = 0;
+  for (uint64_t i = 0; i < num_entries; i++) {
+    if (pos + kCentralDirHeaderSize > cd.size() ||
+        Read32(cd.data() + pos) != kCentralDirHeaderSignature) {
+      LOG(ERROR) << "Invalid central directory entry " << i << " in \""
+                 << path_ << "\"";
+      return false;
+    }
+    const char* header = cd.data() + pos;
+    uint16_t name_size = Read16(header + 28);
+    uint16_t extra_size = Read16(header + 30);
+    uint16_t comment_size = Read16(header + 32);
+    size_t next = pos + kCentralDirHeaderSize + name_size + extra_size +
+                  comment_size;
+    if (next > cd.size()) {
+      LOG(ERROR) << "Truncated central directory entry " << i << " in \""
+                 << path_ << "\"";
+      return false;
+    }
+    ZipEntry entry;
+    entry.name = std::string(header + kCentralDirHeaderSize, name_size);
+    entry.flags = Read16(header + 8);
+    entry.method = Read16(header + 10);
+    entry.crc32 = Read32(header + 16);
+    entry.compressed_size = Read32(header + 20);
+    entry.uncompressed_size = Read32(header + 24);
+    entry.local_header_offset = Read32(header + 42);
+    bool unix_mode = static_cast<uint8_t>(header[5]) == kHostUnix;
+    entry.mode = unix_mode ? Read32(header + 38) >> 16 : 0;
+
+    // Values that don't fit in 32 bits are stored in the zip64 extra field,
+    // in this order, only if their 32 bit field is saturated.
+    const char* extra = header + kCentralDirHeaderSize + name_size;
+    const char* extra_end = extra + extra_size;
+    while (extra + 4 <= extra_end) {
+      uint16_t id = Read16(extra);
+      uint16_t size = Read16(extra + 2);
+      const char* field = extra + 4;
+      const char* field_end = std::min(field + size, extra_end);
+      if (id == kZip64ExtraFieldId) {
+        for (uint64_t* value : {&entry.uncompressed_size,
+                                &entry.compressed_size,
+                                &entry.local_header_offset}) {
+          if (*value == 0xffffffff && field + 8 <= field_end) {
+            *value = Read64(field);
+            field += 8;
+          }
+        }
+      }
+      extra += 4 + size;
+    }
+    entries_by_name_[entry.name] = entries_.size();
+    entries_.emplace_back(std::move(entry));
+    pos = next;
+  }
+  return true;
+}
+
+const ZipEntry* ZipIndex::Find(const std::string& name) const {
+  auto it = entries_by_name_.find(name);
+  return it == entries_by_name_.end() ? nullptr : &entries_[it->second];
+}
+
+bool ZipIndex::DataOffset(const ZipEntry& entry, off_t* offset) const {
+  if (entry.flags & kFlagEncrypted) {
+    LOG(ERROR) << "\"" << entry.name << "\" is encrypted";
+    return false;
+  }
+  if (entry.method != kMethodStored && entry.method != kMethodDeflated) {
+    LOG(ERROR) << "\"" << entry.name << "\" uses unsupported compression "
+               << "method " << entry.method;
+    return false;
+  }
+  // The local header's extra field may differ from the central directory's.
+  char header[kLocalHeaderSize];
+  if (!PReadAll(fd_, header, sizeof(header), entry.local_header_offset) ||
+      Read32(header) != kLocalHeaderSignature) {
+    LOG(ERROR) << "Invalid local header for \"" << entry.name << "\" in \""
+               << path_ << "\"";
+    return false;
+  }
+  *offset = entry.local_header_offset + kLocalHeaderSize + Read16(header + 26) +
+            Read16(header + 28);
+  if (*offset + entry.compressed_size > static_cast<uint64_t>(file_size_)) {
+    LOG(ERROR) << "Data for \"" << entry.name << "\" is out of bounds";
+    return false;
+  }
+  return true;
+}
+
+bool ZipIndex::ExtractToMemory(const ZipEntry& entry,
+                               std::string* contents) const {
+  off_t offset;
+  if (!DataOffset(entry, &offset)) {
+    return false;
+  }
+  contents->resize(entry.uncompressed_size);
+  if (entry.method == kMethodStored) {
+    return entry.compressed_size == entry.uncompressed_size &&
+           PReadAll(fd_, contents->data(), contents->size(), offset);
+  }
+  return InflateEntry(
+      fd_, offset, entry,
+      [contents](const char* data, size_t size, uint64_t pos) {
+        if (pos + size > contents->size()) {
+          return false;
+        }
+        memcpy(contents->data() + pos, data, size);
+        return true;
+      });
+}
+
+bool ZipIndex::ExtractToFile(const ZipEntry& entry, SharedFD out,
+                             bool sparse) const {
+  off_t offset;
+  if (!DataOffset(entry, &offset)) {
+    return false;
+  }
+  if (entry.method == kMethodStored) {
+    if (entry.compressed_size != entry.uncompressed_size) {
+      LOG(ERROR) << "Size mismatch for stored entry \"" << entry.name << "\"";
+      return false;
+    }
+    SharedFD in = fd_;
+    off_t out_offset = 0;
+    uint64_t remaining = entry.uncompressed_size;
+    // copy_file_range can't leave holes, sparse outputs are written through
+    // userspace.
+    while (!sparse && remaining > 0) {
+      size_t chunk = std::min<uint64_t>(remaining, 1 << 30);
+      ssize_t copied = out->CopyFileRange(*in, &offset, &out_offset, chunk);
+      if (copied < 0 && out_offset == 0 &&
+          (out->GetErrno() == EXDEV || out->GetErrno() == ENOSYS ||
+           out->GetErrno() == EINVAL || out->GetErrno() == EOPNOTSUPP)) {
+        // Not supported between these files, copy through userspace instead.
+        break;
+      }
+      if (copied <= 0) {
+        LOG(ERROR) << "Could not copy \"" << entry.name
+                   << "\": " << out->StrError();
+        return false;
+      }
+      remaining -= copied;
+    }
+    std::unique_ptr<char[]> buffer;
+    while (remaining > 0) {
+      if (!buffer) {
+        buffer.reset(new char[kBufferSize]);
+      }
+      size_t chunk = std::min<uint64_t>(kBufferSize, remaining);
+      if (!PReadAll(fd_, buffer.get(), chunk, offset) ||
+          !WriteMaybeSparse(out, buffer.get(), chunk, out_offset, sparse)) {
+        LOG(ERROR) << "Could not copy \"" << entry.name << "\"";
+        return false;
+      }
+      offset += chunk;
+      out_offset += chunk;
+      remaining -= chunk;
+    }
+  } else if (!InflateEntry(fd_, offset, entry,
+                           [&out, sparse](const char* data, size_t size,
+                                          uint64_t pos) {
+                             return WriteMaybeSparse(out, data, size, pos,
+                                                     sparse);
+                           })) {
+    return false;
+  }
+  // Extends the file over any trailing holes.
+  if (out->Truncate(entry.uncompressed_size) != 0) {
+    LOG(ERROR) << "Could not resize output for \"" << entry.name
+               << "\": " << out->StrError();
+    return false;
+  }
+  return true;
+}
+
+bool ZipIndex::ExtractFile(const ZipEntry& entry, const std::string& path,
+                           bool sparse) const {
+  // Replace rather than overwrite, in case the old file is linked elsewhere.
+  unlink(path.c_str());
+  mode_t mode = (entry.mode & 0777) ? (entry.mode & 0777) : 0644;
+  auto out = SharedFD::Open(path, O_WRONLY | O_CREAT | O_EXCL, mode);
+  if (!out->IsOpen()) {
+    LOG(ERROR) << "Could not create \"" << path << "\": " << out->StrError();
+    return false;
+  }
+  // Preallocating the non-sparse outputs keeps them contiguous even when
+  // several are written at once.
+  if (!sparse && entry.uncompressed_size > 0 &&
+      out->Fallocate(0, 0, entry.uncompressed_size) != 0) {
+    LOG(DEBUG) << "Could not preallocate \"" << path
+               << "\": " << out->StrError();
+  }
+  return ExtractToFile(entry, out, sparse);
+}
+
+bool ZipIndex::ExtractEntries(const std::vector<const ZipEntry*>& entries,
+                              const std::string& target_directory, bool sparse,
+                              size_t max_threads) const {
+  std::set<std::string> directories = {target_directory};
+  std::vector<const ZipEntry*> files;
+  for (const auto& entry : entries) {
+    if (!IsSafePath(entry->name)) {
+      LOG(ERROR) << "Refusing to extract \"" << entry->name << "\"";
+      return false;
+    }
+    auto path = target_directory + "/" + entry->name;
+    if (entry->IsDirectory()) {
+      directories.insert(path);
+      continue;
+    }
+    directories.insert(path.substr(0, path.rfind('/')));
+    files.push_back(entry);
+  }
+  for (const auto& directory : directories) {
+    if (!MakeDirectories(directory)) {
+      return false;
+    }
+  }
+
+  // Largest first, so that a big image doesn't start last and serialize the
+  // tail of the extraction.
+  std::sort(files.begin(), files.end(), [](auto a, auto b) {
+    return a->uncompressed_size > b->uncompressed_size;
+  });
+  std::atomic<size_t> next_file = 0;
+  std::atomic<bool> success = true;
+  auto worker = [&]() {
+    for (size_t i = next_file++; i < files.size() && success; i = next_file++) {
+      const auto& entry = *files[i];
+      auto path = target_directory + "/" + entry.name;
+      if (entry.IsSymlink()) {
+        std::string target;
+        unlink(path.c_str());
+        if (!ExtractToMemory(entry, &target) ||
+            symlink(target.c_str(), path.c_str()) != 0) {
+          PLOG(ERROR) << "Could not create symlink \"" << path << "\"";
+          success = false;
+        }
+      } else if (!ExtractFile(entry, path, sparse)) {
+        success = false;
+      }
+    }
+  };
+  size_t num_threads = std::max<size_t>(
+      1, std::min({max_threads, files.size(),
+                   static_cast<size_t>(std::thread::hardware_concurrency())}));
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return success;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+
+struct ZipEntry {
+  std::string name;
+  uint16_t method;
+  uint16_t flags;
+  uint32_t crc32;
+  uint64_t compressed_size;
+  uint64_t uncompressed_size;
+  uint64_t local_header_offset;
+  // Unix file type and permissions, 0 if the archive didn't record them.
+  uint32_t mode;
+
+  bool IsDirectory() const;
+  bool IsSymlink() const;
+};
+
+/**
+ * Reads a zip archive without external tools.
+ *
+ * The central directory is parsed once when the archive is opened, after which
+ * entries are located by name in constant time. All reads go through pread, so
+ * a single ZipIndex can extract several entries concurrently.
+ */
+class ZipIndex {
+ public:
+  // Returns nullptr if `path` can't be read as a zip archive. Only archives
+  // that look like zips but are malformed are logged as errors.
+  static std::unique_ptr<ZipIndex> Open(const std::string& path);
+
+  const std::vector<ZipEntry>& Entries() const { return entries_; }
+  const ZipEntry* Find(const std::string& name) const;
+
+  bool ExtractToMemory(const ZipEntry& entry, std::string* contents) const;
+  // Writes the entry contents to the start of `out`, which must be empty.
+  // With `sparse`, blocks of zeroes are left as holes instead of being
+  // written. Otherwise stored entries are copied with copy_file_range.
+  bool ExtractToFile(const ZipEntry& entry, SharedFD out, bool sparse) const;
+
+  /**
+   * Extracts `entries` below `target_directory`, recreating their paths,
+   * permissions and symlinks. Files are extracted in parallel on up to
+   * `max_threads` threads, each writing into a preallocated output.
+   */
+  bool ExtractEntries(const std::vector<const ZipEntry*>& entries,
+                      const std::string& target_directory, bool sparse,
+                      size_t max_threads) const;
+
+ private:
+  ZipIndex(const std::string& path, SharedFD fd);
+
+  bool ReadCentralDirectory();
+  bool DataOffset(const ZipEntry& entry, off_t* offset) const;
+  bool ExtractFile(const ZipEntry& entry, const std::string& path,
+                   bool sparse) const;
+
+  std::string path_;
+  SharedFD fd_;
+  off_t file_size_;
+  std::vector<ZipEntry> entries_;
+  std::unordered_map<std::string, size_t> entries_by_name_;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/utils/zip_index.h"
+
+#include <ftw.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/utils/archive.h"
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+struct TestEntry {
+  std::string name;
+  std::string data;
+  bool deflate;
+  uint32_t mode;
+};
+
+void Put16(std::string* out, uint16_t value) {
+  out->push_back(value & 0xff);
+  out->push_back(value >> 8);
+}
+
+void Put32(std::string* out, uint32_t value) {
+  Put16(out, value & 0xffff);
+  Put16(out, value >> 16);
+}
+
+void Put64(std::string* out, uint64_t value) {
+  Put32(out, value & 0xffffffff);
+  Put32(out, value >> 32);
+}
+
+std::string RawDeflate(const std::string& data) {
+  z_stream stream = {};
+  deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+               Z_DEFAULT_STRATEGY);
+  std::string out(deflateBound(&stream, data.size()), '\0');
+  stream.next_in = (Bytef*)data.data();
+  stream.avail_in = data.size();
+  stream.next_out = (Bytef*)out.data();
+  stream.avail_out = out.size();
+  deflate(&stream, Z_FINISH);
+  out.resize(stream.total_out);
+  deflateEnd(&stream);
+  return out;
+}
+
+/*
+ * Writes a zip archive the way the format documents it, independently of
+ * ZipBuilder. With `zip64` every size and offset is moved to the zip64 extra
+ * fields and the zip64 end of central directory records are added, as tools
+ * do for archives over 4GiB.
+ */
+std::string MakeZip(const std::vector<TestEntry>& entries, bool zip64) {
+  std::string archive, central_directory;
+  for (const auto& entry : entries) {
+    auto data = entry.deflate ? RawDeflate(entry.data) : entry.data;
+    uint32_t crc =
+        crc32(0, (const Bytef*)entry.data.data(), entry.data.size());
+    uint64_t offset = archive.size();
+
+    std::string local_extra;
+    if (zip64) {
+      Put16(&local_extra, 0x0001);
+      Put16(&local_extra, 16);
+      Put64(&local_extra, entry.data.size());
+      Put64(&local_extra, data.size());
+    }
+    Put32(&archive, 0x04034b50);
+    Put16(&archive, zip64 ? 45 : 20);
+    Put16(&archive, 0);  // flags
+    Put16(&archive, entry.deflate ? 8 : 0);
+    Put32(&archive, 0);  // time and date
+    Put32(&archive, crc);
+    Put32(&archive, zip64 ? 0xffffffff : data.size());
+    Put32(&archive, zip64 ? 0xffffffff : entry.data.size());
+    Put16(&archive, entry.name.size());
+    Put16(&archive, local_extra.size());
+    archive += entry.name + local_extra + data;
+
+    std::string central_extra;
+    if (zip64) {
+      Put16(&central_extra, 0x0001);
+      Put16(&central_extra, 24);
+      Put64(&central_extra, entry.data.size());
+      Put64(&central_extra, data.size());
+      Put64(&central_extra, offset);
+    }
+    Put32(&central_directory, 0x02014b50);
+    Put16(&central_directory, (3 << 8) | 45);  // made by unix
+    Put16(&central_directory, zip64 ? 45 : 20);
+    Put16(&central_directory, 0);
+    Put16(&central_directory, entry.deflate ? 8 : 0);
+    Put32(&central_directory, 0);
+    Put32(&central_directory, crc);
+    Put32(&central_directory, zip64 ? 0xffffffff : data.size());
+    Put32(&central_directory, zip64 ? 0xffffffff : entry.data.size());
+    Put16(&central_directory, entry.name.size());
+    Put16(&central_directory, central_extra.size());
+    Put16(&central_directory, 0);  // comment
+    Put16(&central_directory, 0);  // disk
+    Put16(&central_directory, 0);  // internal attributes
+    Put32(&central_directory, entry.mode << 16);
+    Put32(&central_directory, zip64 ? 0xffffffff : offset);
+    central_directory += entry.name + central_extra;
+  }
+  uint64_t cd_offset = archive.size();
+  archive += central_directory;
+  if (zip64) {
+    uint64_t eocd64_offset = archive.size();
+    Put32(&archive, 0x06064b50);
+    Put64(&archive, 44);
+    Put16(&archive, 45);
+    Put16(&archive, 45);
+    Put32(&archive, 0);
+    Put32(&archive, 0);
+    Put64(&archive, entries.size());
+    Put64(&archive, entries.size());
+    Put64(&archive, central_directory.size());
+    Put64(&archive, cd_offset);
+    Put32(&archive, 0x07064b50);
+    Put32(&archive, 0);
+    Put64(&archive, eocd64_offset);
+    Put32(&archive, 1);
+  }
+  Put32(&archive, 0x06054b50);
+  Put16(&archive, 0);
+  Put16(&archive, 0);
+  Put16(&archive, zip64 ? 0xffff : entries.size());
+  Put16(&archive, zip64 ? 0xffff : entries.size());
+  Put32(&archive, zip64 ? 0xffffffff : central_directory.size());
+  Put32(&archive, zip64 ? 0xffffffff : cd_offset);
+  Put16(&archive, 7);
+  archive += "comment";
+  return archive;
+}
+
+void RemoveTree(const std::string& path) {
+  nftw(path.c_str(),
+       [](const char* path, const struct stat*, int, struct FTW*) {
+         return remove(path);
+       },
+       16, FTW_DEPTH | FTW_PHYS);
+}
+
+class ZipIndexTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char dir[] = "/tmp/zip_index_test.XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    dir_ = dir;
+  }
+
+  void TearDown() override {
+    RemoveTree(dir_);
+  }
+
+  std::string WriteZip(const std::vector<TestEntry>& entries,
+                       bool zip64 = false) {
+    auto path = dir_ + "/archive.zip";
+    auto fd = SharedFD::Creat(path, 0644);
+    EXPECT_EQ(WriteAll(fd, MakeZip(entries, zip64)),
+              MakeZip(entries, zip64).size());
+    return path;
+  }
+
+  std::string dir_;
+};
+
+const std::string kText = "The quick brown fox jumps over the lazy dog\n";
+
+std::vector<TestEntry> SampleEntries() {
+  std::string repeated;
+  for (int i = 0; i < 10000; i++) {
+    repeated += kText;
+  }
+  return {
+      {"stored.txt", kText, false, S_IFREG | 0644},
+      {"dir/", "", false, S_IFDIR | 0755},
+      {"dir/deflated.txt", repeated, true, S_IFREG | 0755},
+      {"dir/link", "../stored.txt", false, S_IFLNK | 0777},
+      {"other/empty", "", true, S_IFREG | 0600},
+  };
+}
+
+TEST_F(ZipIndexTest, ReadsEntries) {
+  for (bool zip64 : {false, true}) {
+    auto index = ZipIndex::Open(WriteZip(SampleEntries(), zip64));
+    ASSERT_NE(index, nullptr);
+    ASSERT_EQ(index->Entries().size(), 5);
+
+    for (const auto& expected : SampleEntries()) {
+      auto entry = index->Find(expected.name);
+      ASSERT_NE(entry, nullptr) << expected.name;
+      EXPECT_EQ(entry->mode, expected.mode);
+      EXPECT_EQ(entry->uncompressed_size, expected.data.size());
+      std::string contents;
+      EXPECT_TRUE(index->ExtractToMemory(*entry, &contents)) << expected.name;
+      EXPECT_EQ(contents, expected.data);
+    }
+    EXPECT_TRUE(index->Find("dir/")->IsDirectory());
+    EXPECT_TRUE(index->Find("dir/link")->IsSymlink());
+    EXPECT_EQ(index->Find("missing"), nullptr);
+  }
+}
+
+TEST_F(ZipIndexTest, ReturnsNullForOtherFiles) {
+  auto path = dir_ + "/not_a_zip";
+  auto fd = SharedFD::Creat(path, 0644);
+  WriteAll(fd, std::string(1000, 'x'));
+  EXPECT_EQ(ZipIndex::Open(path), nullptr);
+  EXPECT_EQ(ZipIndex::Open(dir_ + "/missing"), nullptr);
+}
+
+TEST_F(ZipIndexTest, DetectsCorruptData) {
+  auto entries = SampleEntries();
+  auto data = MakeZip(entries, false);
+  // Flip a byte of the deflated entry, after its local header and name
+  auto pos = data.find("dir/deflated.txt") + 20;
+  data[pos] ^= 0xff;
+  auto path = dir_ + "/corrupt.zip";
+  WriteAll(SharedFD::Creat(path, 0644), data);
+
+  auto index = ZipIndex::Open(path);
+  ASSERT_NE(index, nullptr);
+  std::string contents;
+  EXPECT_FALSE(
+      index->ExtractToMemory(*index->Find("dir/deflated.txt"), &contents));
+}
+
+TEST_F(ZipIndexTest, ExtractsEntries) {
+  auto index = ZipIndex::Open(WriteZip(SampleEntries()));
+  ASSERT_NE(index, nullptr);
+  std::vector<const ZipEntry*> entries;
+  for (const auto& entry : index->Entries()) {
+    entries.push_back(&entry);
+  }
+  auto out = dir_ + "/out";
+  ASSERT_TRUE(index->ExtractEntries(entries, out, /* sparse */ false, 4));
+
+  EXPECT_EQ(ReadFile(out + "/stored.txt"), kText);
+  EXPECT_EQ(ReadFile(out + "/dir/deflated.txt"),
+            SampleEntries()[2].data);
+  EXPECT_EQ(ReadFile(out + "/dir/link"), kText);
+  EXPECT_TRUE(FileExists(out + "/other/empty"));
+  struct stat st;
+  ASSERT_EQ(stat((out + "/dir/deflated.txt").c_str(), &st), 0);
+  EXPECT_EQ(st.st_mode & 0777, 0755);
+  ASSERT_EQ(lstat((out + "/dir/link").c_str(), &st), 0);
+  EXPECT_TRUE(S_ISLNK(st.st_mode));
+}
+
+TEST_F(ZipIndexTest, RefusesToEscapeTarget) {
+  auto index = ZipIndex::Open(
+      WriteZip({{"../escaped", kText, false, S_IFREG | 0644}}));
+  ASSERT_NE(index, nullptr);
+  EXPECT_FALSE(index->ExtractEntries({&index->Entries()[0]}, dir_ + "/out",
+                                     false, 1));
+  EXPECT_FALSE(FileExists(dir_ + "/escaped"));
+}
+
+TEST_F(ZipIndexTest, LeavesHolesInSparseOutputs) {
+  std::string data = kText + std::string(64 * 4096, '\0') + kText;
+  for (bool deflate : {false, true}) {
+    auto index =
+        ZipIndex::Open(WriteZip({{"image", data, deflate, S_IFREG | 0644}}));
+    ASSERT_NE(index, nullptr);
+    auto path = dir_ + "/image";
+    unlink(path.c_str());
+    auto out = SharedFD::Open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ASSERT_TRUE(index->ExtractToFile(index->Entries()[0], out,
+                                     /* sparse */ true));
+    EXPECT_EQ(ReadFile(path), data);
+    struct stat st;
+    ASSERT_EQ(stat(path.c_str(), &st), 0);
+    EXPECT_LT(st.st_blocks * 512, data.size() / 2) << deflate;
+  }
+}
+
+TEST_F(ZipIndexTest, WritesNonSparseOutputsInFull) {
+  std::string data = kText + std::string(64 * 4096, '\0') + kText;
+  for (bool deflate : {false, true}) {
+    auto index =
+        ZipIndex::Open(WriteZip({{"image", data, deflate, S_IFREG | 0644}}));
+    ASSERT_NE(index, nullptr);
+    auto path = dir_ + "/image";
+    unlink(path.c_str());
+    auto out = SharedFD::Open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    // Stored entries go through copy_file_range
+    ASSERT_TRUE(index->ExtractToFile(index->Entries()[0], out,
+                                     /* sparse */ false));
+    EXPECT_EQ(ReadFile(path), data);
+    struct stat st;
+    ASSERT_EQ(stat(path.c_str(), &st), 0);
+    EXPECT_GE(st.st_blocks * 512, data.size()) << deflate;
+  }
+}
+
+TEST_F(ZipIndexTest, ArchiveExtractsSparseOnlyWhenAsked) {
+  std::string data = kText + std::string(64 * 4096, '\0') + kText;
+  Archive archive(WriteZip({{"stored", data, false, S_IFREG | 0644},
+                            {"deflated", data, true, S_IFREG | 0644}}));
+  for (bool sparse : {false, true}) {
+    auto out = dir_ + (sparse ? "/sparse" : "/full");
+    ASSERT_TRUE(archive.ExtractAll(out, sparse));
+    for (const auto& name : {"stored", "deflated"}) {
+      auto path = out + "/" + name;
+      EXPECT_EQ(ReadFile(path), data) << path;
+      struct stat st;
+      ASSERT_EQ(stat(path.c_str(), &st), 0);
+      if (sparse) {
+        EXPECT_LT(st.st_blocks * 512, data.size() / 2) << path;
+      } else {
+        EXPECT_GE(st.st_blocks * 512, data.size()) << path;
+      }
+    }
+  }
+}
+
+TEST_F(ZipIndexTest, ArchiveExtractsDirectoriesRecursively) {
+  // No entry for "dir/" itself, only for what's below it
+  auto path = WriteZip({
+      {"dir/a", "a", false, S_IFREG | 0644},
+      {"dir/sub/b", "b", true, S_IFREG | 0644},
+      {"dir2/c", "c", false, S_IFREG | 0644},
+  });
+  Archive archive(path);
+  auto out = dir_ + "/out";
+  ASSERT_TRUE(archive.ExtractFiles({"dir", "dir/a"}, out));
+  EXPECT_EQ(ReadFile(out + "/dir/a"), "a");
+  EXPECT_EQ(ReadFile(out + "/dir/sub/b"), "b");
+  EXPECT_FALSE(FileExists(out + "/dir2/c"));
+
+  EXPECT_FALSE(archive.ExtractFiles({"di"}, out));
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -22,8 +22,8 @@
 
 namespace keymaster {
 
-RemoteKeymaster::RemoteKeymaster(cuttlefish::KeymasterChannel* channel,
-                                 uint32_t message_version)
+RemoteKeymaster::RemoteKeymaster(
+    cuttlefish::MultiplexedKeymasterChannel* channel, uint32_t message_version)
     : channel_(channel), message_version_(message_version) {}
 
 RemoteKeymaster::~RemoteKeymaster() {}
@@ -31,14 +31,10 @@ RemoteKeymaster::~RemoteKeymaster() {}
 void RemoteKeymaster::ForwardCommand(AndroidKeymasterCommand command,
                                      const Serializable& req,
                                      KeymasterResponse* rsp) {
-  if (!channel_->SendRequest(command, req)) {
-    LOG(ERROR) << "Failed to send keymaster message: " << command;
-    rsp->error = KM_ERROR_UNKNOWN_ERROR;
-    return;
-  }
-  auto response = channel_->ReceiveMessage();
+  // Other binder threads can have their own requests in flight meanwhile.
+  auto response = channel_->Transact(command, req);
   if (!response) {
-    LOG(ERROR) << "Failed to receive keymaster response: " << command;
+    LOG(ERROR) << "Failed to forward keymaster message: " << command;
     rsp->error = KM_ERROR_UNKNOWN_ERROR;
     return;
   }
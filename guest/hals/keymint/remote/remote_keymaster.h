@@ -19,20 +19,20 @@
 
 #include <keymaster/android_keymaster_messages.h>
 
-#include "common/libs/security/keymaster_channel.h"
+#include "common/libs/security/multiplexed_keymaster_channel.h"
 
 namespace keymaster {
 
 class RemoteKeymaster {
  private:
-  cuttlefish::KeymasterChannel* channel_;
+  cuttlefish::MultiplexedKeymasterChannel* channel_;
   const uint32_t message_version_;
 
   void ForwardCommand(AndroidKeymasterCommand command, const Serializable& req,
                       KeymasterResponse* rsp);
 
  public:
-  RemoteKeymaster(cuttlefish::KeymasterChannel*,
+  RemoteKeymaster(cuttlefish::MultiplexedKeymasterChannel*,
                   uint32_t message_version = kDefaultMessageVersion);
   ~RemoteKeymaster();
   bool Initialize();
@@ -30,9 +30,12 @@
 #include <guest/hals/keymint/remote/remote_secure_clock.h>
 #include <guest/hals/keymint/remote/remote_shared_secret.h>
 #include "common/libs/fs/shared_fd.h"
-#include "common/libs/security/keymaster_channel.h"
+#include "common/libs/security/multiplexed_keymaster_channel.h"
 
 static const char device[] = "/dev/hvc3";
+// Requests from these threads are multiplexed over the device, so a thread
+// doesn't wait for another one's round trip before sending its request.
+static const uint32_t kBinderThreads = 4;
 
 using aidl::android::hardware::security::keymint::RemoteKeyMintDevice;
 using aidl::android::hardware::security::keymint::SecurityLevel;
@@ -53,9 +56,8 @@ static std::shared_ptr<T> addService(Args&&... args) {
 
 int main(int, char** argv) {
   android::base::InitLogging(argv, android::base::KernelLogger);
-  // Zero threads seems like a useless pool, but below we'll join this thread to
-  // it, increasing the pool size to 1.
-  ABinderProcess_setThreadPoolMaxThreadCount(0);
+  // The main thread joins the pool below, making up the last binder thread.
+  ABinderProcess_setThreadPoolMaxThreadCount(kBinderThreads - 1);
   // Add Keymint Service
   auto fd = cuttlefish::SharedFD::Open(device, O_RDWR);
   if (!fd->IsOpen()) {
@@ -67,7 +69,7 @@ int main(int, char** argv) {
                << " a raw terminal: " << fd->StrError();
   }
 
-  cuttlefish::KeymasterChannel keymasterChannel(fd, fd);
+  cuttlefish::MultiplexedKeymasterChannel keymasterChannel(fd, fd);
 
   keymaster::RemoteKeymaster remote_keymaster(
       &keymasterChannel, keymaster::MessageVersion(
@@ -78,6 +80,7 @@ int main(int, char** argv) {
   addService<RemoteSecureClock>(remote_keymaster);
   addService<RemoteSharedSecret>(remote_keymaster);
 
+  ABinderProcess_startThreadPool();
   ABinderProcess_joinThreadPool();
   return EXIT_FAILURE;  // should not reach
 }
@@ -24,9 +24,13 @@
 #include <utils/Log.h>
 #include <ril_event.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/time.h>
 #include <time.h>
 
+#include <algorithm>
+#include <vector>
+
 #include <pthread.h>
 static pthread_mutex_t listMutex;
 #define MUTEX_ACQUIRE() pthread_mutex_lock(&listMutex)
@@ -65,11 +69,17 @@ static pthread_mutex_t listMutex;
     } while(0);
 #endif
 
-static fd_set readFds;
-static int nfds = 0;
-
-static struct ril_event * watch_table[MAX_FD_EVENTS];
-static struct ril_event timer_list;
+static int epollFd = -1;
+
+// Timers are kept in a binary min-heap ordered by expiration. Timers that
+// expire at the same time fire in the order they were added.
+struct TimerEntry {
+    struct timeval timeout;
+    unsigned long long seq;
+    struct ril_event * ev;
+};
+static std::vector<TimerEntry> timer_heap;
+static unsigned long long timer_seq = 0;
 static struct ril_event pending_list;
 
 #define DEBUG 0
@@ -93,7 +103,7 @@ static void dump_event(struct ril_event * ev)
 #define dump_event(x) do {} while(0)
 #endif
 
-static void getNow(struct timeval * tv)
+static void getMonotonicNow(struct timeval * tv)
 {
     struct timespec ts;
     clock_gettime(CLOCK_MONOTONIC, &ts);
@@ -101,6 +111,18 @@ static void getNow(struct timeval * tv)
     tv->tv_usec = ts.tv_nsec/1000;
 }
 
+static void (*getNow)(struct timeval * tv) = getMonotonicNow;
+
+// std::push_heap and std::pop_heap build a max-heap, so "less" means "expires
+// later" here.
+static bool expiresLater(const TimerEntry & a, const TimerEntry & b)
+{
+    if (timercmp(&a.timeout, &b.timeout, !=)) {
+        return timercmp(&a.timeout, &b.timeout, >);
+    }
+    return a.seq > b.seq;
+}
+
 static void init_list(struct ril_event * list)
 {
     memset(list, 0, sizeof(struct ril_event));
@@ -131,26 +153,12 @@ static void removeFromList(struct ril_event * ev)
 }
 
 
-static void removeWatch(struct ril_event * ev, int index)
+static void removeWatch(struct ril_event * ev)
 {
     dlog("~~~~ +removeWatch ~~~~");
-    watch_table[index] = NULL;
     ev->index = -1;
-
-    FD_CLR(ev->fd, &readFds);
-
-    if (ev->fd+1 == nfds) {
-        int n = 0;
-
-        for (int i = 0; i < MAX_FD_EVENTS; i++) {
-            struct ril_event * rev = watch_table[i];
-
-            if ((rev != NULL) && (rev->fd > n)) {
-                n = rev->fd;
-            }
-        }
-        nfds = n + 1;
-        dlog("~~~~ nfds = %d ~~~~", nfds);
+    if (epoll_ctl(epollFd, EPOLL_CTL_DEL, ev->fd, NULL) < 0 && errno != EBADF) {
+        RLOGE("ril_event: failed to stop watching fd %d (%d)", ev->fd, errno);
     }
     dlog("~~~~ -removeWatch ~~~~");
 }
@@ -160,38 +168,37 @@ static void processTimeouts()
     dlog("~~~~ +processTimeouts ~~~~");
     MUTEX_ACQUIRE();
     struct timeval now;
-    struct ril_event * tev = timer_list.next;
-    struct ril_event * next;
 
     getNow(&now);
-    // walk list, see if now >= ev->timeout for any events
+    // pop timers while now >= ev->timeout, they come out in expiration order
 
     dlog("~~~~ Looking for timers <= %ds + %dus ~~~~", (int)now.tv_sec, (int)now.tv_usec);
-    while ((tev != &timer_list) && (timercmp(&now, &tev->timeout, >))) {
+    while (!timer_heap.empty() && !timercmp(&timer_heap.front().timeout, &now, >)) {
         // Timer expired
         dlog("~~~~ firing timer ~~~~");
-        next = tev->next;
-        removeFromList(tev);
+        struct ril_event * tev = timer_heap.front().ev;
+        std::pop_heap(timer_heap.begin(), timer_heap.end(), expiresLater);
+        timer_heap.pop_back();
         addToList(tev, &pending_list);
-        tev = next;
     }
     MUTEX_RELEASE();
     dlog("~~~~ -processTimeouts ~~~~");
 }
 
-static void processReadReadies(fd_set * rfds, int n)
+static void processReadReadies(struct epoll_event * events, int n)
 {
     dlog("~~~~ +processReadReadies (%d) ~~~~", n);
     MUTEX_ACQUIRE();
 
-    for (int i = 0; (i < MAX_FD_EVENTS) && (n > 0); i++) {
-        struct ril_event * rev = watch_table[i];
-        if (rev != NULL && FD_ISSET(rev->fd, rfds)) {
-            addToList(rev, &pending_list);
-            if (rev->persist == false) {
-                removeWatch(rev, i);
-            }
-            n--;
+    for (int i = 0; i < n; i++) {
+        struct ril_event * rev = (struct ril_event *) events[i].data.ptr;
+        if (rev->index < 0) {
+            // deleted on another thread after epoll_wait returned
+            continue;
+        }
+        addToList(rev, &pending_list);
+        if (rev->persist == false) {
+            removeWatch(rev);
         }
     }
 
@@ -212,29 +219,32 @@ static void firePending()
     dlog("~~~~ -firePending ~~~~");
 }
 
-static int calcNextTimeout(struct timeval * tv)
+// Returns the time until the next timer expires in milliseconds, rounded up,
+// or -1 if there are no timers.
+static int calcNextTimeout()
 {
-    struct ril_event * tev = timer_list.next;
-    struct timeval now;
-
-    getNow(&now);
-
-    // Sorted list, so calc based on first node
-    if (tev == &timer_list) {
+    MUTEX_ACQUIRE();
+    if (timer_heap.empty()) {
         // no pending timers
+        MUTEX_RELEASE();
         return -1;
     }
+    struct timeval next = timer_heap.front().timeout;
+    MUTEX_RELEASE();
+
+    struct timeval now;
+    getNow(&now);
 
     dlog("~~~~ now = %ds + %dus ~~~~", (int)now.tv_sec, (int)now.tv_usec);
-    dlog("~~~~ next = %ds + %dus ~~~~",
-            (int)tev->timeout.tv_sec, (int)tev->timeout.tv_usec);
-    if (timercmp(&tev->timeout, &now, >)) {
-        timersub(&tev->timeout, &now, tv);
-    } else {
+    dlog("~~~~ next = %ds + %dus ~~~~", (int)next.tv_sec, (int)next.tv_usec);
+    if (!timercmp(&next, &now, >)) {
         // timer already expired.
-        tv->tv_sec = tv->tv_usec = 0;
+        return 0;
     }
-    return 0;
+    struct timeval tv;
+    timersub(&next, &now, &tv);
+    long long ms = tv.tv_sec * 1000LL + (tv.tv_usec + 999) / 1000;
+    return ms > INT32_MAX ? INT32_MAX : (int) ms;
 }
 
 // Initialize internal data structs
@@ -242,10 +252,15 @@ void ril_event_init()
 {
     MUTEX_INIT();
 
-    FD_ZERO(&readFds);
-    init_list(&timer_list);
+    if (epollFd >= 0) {
+        close(epollFd);
+    }
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        RLOGE("ril_event: epoll_create1 error (%d)", errno);
+    }
+    timer_heap.clear();
     init_list(&pending_list);
-    memset(watch_table, 0, sizeof(watch_table));
 }
 
 // Initialize an event
@@ -266,17 +281,15 @@ void ril_event_add(struct ril_event * ev)
 {
     dlog("~~~~ +ril_event_add ~~~~");
     MUTEX_ACQUIRE();
-    for (int i = 0; i < MAX_FD_EVENTS; i++) {
-        if (watch_table[i] == NULL) {
-            watch_table[i] = ev;
-            ev->index = i;
-            dlog("~~~~ added at %d ~~~~", i);
-            dump_event(ev);
-            FD_SET(ev->fd, &readFds);
-            if (ev->fd >= nfds) nfds = ev->fd+1;
-            dlog("~~~~ nfds = %d ~~~~", nfds);
-            break;
-        }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = ev;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, ev->fd, &event) < 0) {
+        RLOGE("ril_event: failed to watch fd %d (%d)", ev->fd, errno);
+    } else {
+        ev->index = 0;
+        dump_event(ev);
     }
     MUTEX_RELEASE();
     dlog("~~~~ -ril_event_add ~~~~");
@@ -288,97 +301,78 @@ void ril_timer_add(struct ril_event * ev, struct timeval * tv)
     dlog("~~~~ +ril_timer_add ~~~~");
     MUTEX_ACQUIRE();
 
-    struct ril_event * list;
     if (tv != NULL) {
-        // add to timer list
-        list = timer_list.next;
+        // add to timer heap
         ev->fd = -1; // make sure fd is invalid
 
         struct timeval now;
         getNow(&now);
         timeradd(&now, tv, &ev->timeout);
 
-        // keep list sorted
-        while (timercmp(&list->timeout, &ev->timeout, < )
-                && (list != &timer_list)) {
-            list = list->next;
-        }
-        // list now points to the first event older than ev
-        addToList(ev, list);
+        timer_heap.push_back({ev->timeout, timer_seq++, ev});
+        std::push_heap(timer_heap.begin(), timer_heap.end(), expiresLater);
     }
 
     MUTEX_RELEASE();
     dlog("~~~~ -ril_timer_add ~~~~");
 }
 
-// Remove event from watch or timer list
+// Remove event from watch list
 void ril_event_del(struct ril_event * ev)
 {
     dlog("~~~~ +ril_event_del ~~~~");
     MUTEX_ACQUIRE();
 
-    if (ev->index < 0 || ev->index >= MAX_FD_EVENTS) {
+    if (ev->index < 0) {
         MUTEX_RELEASE();
         return;
     }
 
-    removeWatch(ev, ev->index);
+    removeWatch(ev);
 
     MUTEX_RELEASE();
     dlog("~~~~ -ril_event_del ~~~~");
 }
 
-#if DEBUG
-static void printReadies(fd_set * rfds)
+void ril_event_set_clock_for_testing(void (*get_now)(struct timeval *tv))
 {
-    for (int i = 0; (i < MAX_FD_EVENTS); i++) {
-        struct ril_event * rev = watch_table[i];
-        if (rev != NULL && FD_ISSET(rev->fd, rfds)) {
-          dlog("DON: fd=%d is ready", rev->fd);
-        }
-    }
+    getNow = get_now != NULL ? get_now : getMonotonicNow;
 }
-#else
-#define printReadies(rfds) do {} while(0)
-#endif
 
-void ril_event_loop()
+int ril_event_loop_once()
 {
-    int n;
-    fd_set rfds;
-    struct timeval tv;
-    struct timeval * ptv;
+    struct epoll_event events[MAX_FD_EVENTS];
 
+    int timeout = calcNextTimeout();
+    if (timeout < 0) {
+        dlog("~~~~ no timers; blocking indefinitely ~~~~");
+    } else {
+        dlog("~~~~ blocking for %dms ~~~~", timeout);
+    }
+    int n = epoll_wait(epollFd, events, MAX_FD_EVENTS, timeout);
+    dlog("~~~~ %d events fired ~~~~", n);
+    if (n < 0) {
+        if (errno == EINTR) return 0;
 
-    for (;;) {
+        RLOGE("ril_event: epoll_wait error (%d)", errno);
+        return -1;
+    }
 
-        // make local copy of read fd_set
-        memcpy(&rfds, &readFds, sizeof(fd_set));
-        if (-1 == calcNextTimeout(&tv)) {
-            // no pending timers; block indefinitely
-            dlog("~~~~ no timers; blocking indefinitely ~~~~");
-            ptv = NULL;
-        } else {
-            dlog("~~~~ blocking for %ds + %dus ~~~~", (int)tv.tv_sec, (int)tv.tv_usec);
-            ptv = &tv;
-        }
-        printReadies(&rfds);
-        n = select(nfds, &rfds, NULL, NULL, ptv);
-        printReadies(&rfds);
-        dlog("~~~~ %d events fired ~~~~", n);
-        if (n < 0) {
-            if (errno == EINTR) continue;
-
-            RLOGE("ril_event: select error (%d)", errno);
+    // Check for timeouts
+    processTimeouts();
+    // Check for read-ready
+    processReadReadies(events, n);
+    // Fire away
+    firePending();
+    return 0;
+}
+
+void ril_event_loop()
+{
+    for (;;) {
+        if (ril_event_loop_once() < 0) {
             // bail?
             return;
         }
-
-        // Check for timeouts
-        processTimeouts();
-        // Check for read-ready
-        processReadReadies(&rfds, n);
-        // Fire away
-        firePending();
     }
 }
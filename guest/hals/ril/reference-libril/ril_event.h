@@ -15,7 +15,8 @@
 ** limitations under the License.
 */
 
-// Max number of fd's we watch at any one time.  Increase if necessary.
+// Max number of fd's we used to watch at any one time. The fds are now
+// watched with epoll, which has no such limit.
 #define MAX_FD_EVENTS 8
 
 typedef void (*ril_event_cb)(int fd, short events, void *userdata);
@@ -25,6 +26,7 @@ struct ril_event {
     struct ril_event *prev;
 
     int fd;
+    // Non-negative while the fd is being watched.
     int index;
     bool persist;
     struct timeval timeout;
@@ -50,3 +52,12 @@ void ril_event_del(struct ril_event * ev);
 // Event loop
 void ril_event_loop();
 
+// Waits until a watched fd is readable or the next timer expires, then fires
+// the ready events. Returns -1 on error. ril_event_loop() calls it forever,
+// tests call it directly.
+int ril_event_loop_once();
+
+// Replaces the monotonic clock used for timers, tests use it to control time.
+// NULL restores the default.
+void ril_event_set_clock_for_testing(void (*get_now)(struct timeval *tv));
+
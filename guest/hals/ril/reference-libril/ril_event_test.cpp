@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <ril_event.h>
+
+namespace {
+
+struct timeval fake_now;
+
+void GetFakeNow(struct timeval* tv) { *tv = fake_now; }
+
+void AdvanceFakeClock(int ms) {
+  struct timeval delta = {.tv_sec = ms / 1000, .tv_usec = (ms % 1000) * 1000};
+  timeradd(&fake_now, &delta, &fake_now);
+}
+
+struct Socketpair {
+  Socketpair() { socketpair(AF_UNIX, SOCK_STREAM, 0, fds); }
+  ~Socketpair() {
+    close(fds[0]);
+    close(fds[1]);
+  }
+  int fds[2];
+};
+
+class RilEventTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    fake_now = {.tv_sec = 1000, .tv_usec = 0};
+    ril_event_set_clock_for_testing(GetFakeNow);
+    ril_event_init();
+  }
+
+  void TearDown() override { ril_event_set_clock_for_testing(NULL); }
+
+  static void Record(int fd, short events, void* param) {
+    auto self = static_cast<RilEventTest*>(param);
+    self->fired_.push_back(fd);
+  }
+
+  static void RecordAndRead(int fd, short events, void* param) {
+    char c;
+    read(fd, &c, 1);
+    Record(fd, events, param);
+  }
+
+  std::vector<int> fired_;
+};
+
+struct NamedTimer {
+  struct ril_event event;
+  std::string name;
+  std::vector<std::string>* fired;
+};
+
+void RecordTimer(int fd, short events, void* param) {
+  auto timer = static_cast<NamedTimer*>(param);
+  timer->fired->push_back(timer->name);
+}
+
+TEST_F(RilEventTest, ReadableFdFires) {
+  Socketpair sp;
+  struct ril_event ev;
+  ril_event_set(&ev, sp.fds[0], false, RecordAndRead, this);
+  ril_event_add(&ev);
+
+  ASSERT_EQ(1, write(sp.fds[1], "x", 1));
+  ASSERT_EQ(0, ril_event_loop_once());
+  ASSERT_EQ(std::vector<int>({sp.fds[0]}), fired_);
+}
+
+TEST_F(RilEventTest, NonPersistentEventIsRemovedAfterFiring) {
+  Socketpair sp;
+  struct ril_event ev;
+  ril_event_set(&ev, sp.fds[0], false, Record, this);
+  ril_event_add(&ev);
+
+  // The byte is never read so the fd stays readable, only the first
+  // iteration should fire the event. The timer keeps the second iteration
+  // from blocking.
+  ASSERT_EQ(1, write(sp.fds[1], "x", 1));
+  ASSERT_EQ(0, ril_event_loop_once());
+  struct ril_event timer;
+  ril_event_set(&timer, -1, false, Record, this);
+  struct timeval tv = {.tv_sec = 0, .tv_usec = 0};
+  ril_timer_add(&timer, &tv);
+  ASSERT_EQ(0, ril_event_loop_once());
+  ASSERT_EQ(std::vector<int>({sp.fds[0], -1}), fired_);
+  ASSERT_LT(ev.index, 0);
+}
+
+TEST_F(RilEventTest, PersistentEventFiresRepeatedly) {
+  Socketpair sp;
+  struct ril_event ev;
+  ril_event_set(&ev, sp.fds[0], true, RecordAndRead, this);
+  ril_event_add(&ev);
+
+  for (int i = 0; i < 3; i++) {
+    ASSERT_EQ(1, write(sp.fds[1], "x", 1));
+    ASSERT_EQ(0, ril_event_loop_once());
+  }
+  ASSERT_EQ(3u, fired_.size());
+  ril_event_del(&ev);
+}
+
+TEST_F(RilEventTest, DeletedEventDoesNotFire) {
+  Socketpair sp;
+  struct ril_event ev;
+  ril_event_set(&ev, sp.fds[0], true, Record, this);
+  ril_event_add(&ev);
+  ril_event_del(&ev);
+  // Deleting twice is harmless.
+  ril_event_del(&ev);
+
+  ASSERT_EQ(1, write(sp.fds[1], "x", 1));
+  struct ril_event timer;
+  ril_event_set(&timer, -1, false, Record, this);
+  struct timeval tv = {.tv_sec = 0, .tv_usec = 0};
+  ril_timer_add(&timer, &tv);
+  ASSERT_EQ(0, ril_event_loop_once());
+  ASSERT_EQ(std::vector<int>({-1}), fired_);
+}
+
+TEST_F(RilEventTest, TimersFireInExpirationOrder) {
+  std::vector<std::string> fired;
+  std::vector<NamedTimer> timers(4);
+  const char* names[] = {"c", "a", "d", "b"};
+  int delays_ms[] = {300, 100, 300, 200};
+  for (size_t i = 0; i < timers.size(); i++) {
+    timers[i].name = names[i];
+    timers[i].fired = &fired;
+    ril_event_set(&timers[i].event, -1, false, RecordTimer, &timers[i]);
+    struct timeval tv = {.tv_sec = 0, .tv_usec = delays_ms[i] * 1000};
+    ril_timer_add(&timers[i].event, &tv);
+  }
+
+  // Nothing has expired yet, but the fake clock doesn't move by itself so
+  // epoll_wait has to actually time out. Keep the waits short.
+  AdvanceFakeClock(99);
+  ASSERT_EQ(0, ril_event_loop_once());
+  ASSERT_TRUE(fired.empty());
+
+  AdvanceFakeClock(1);
+  ASSERT_EQ(0, ril_event_loop_once());
+  ASSERT_EQ(std::vector<std::string>({"a"}), fired);
+
+  AdvanceFakeClock(200);
+  ASSERT_EQ(0, ril_event_loop_once());
+  // Timers expiring at the same time fire in the order they were added.
+  ASSERT_EQ(std::vector<std::string>({"a", "b", "c", "d"}), fired);
+}
+
+TEST_F(RilEventTest, WatchesMoreThanMaxFdEvents) {
+  constexpr int kPairs = MAX_FD_EVENTS * 4;
+  std::vector<Socketpair> pairs(kPairs);
+  std::vector<struct ril_event> events(kPairs);
+  for (int i = 0; i < kPairs; i++) {
+    ril_event_set(&events[i], pairs[i].fds[0], false, RecordAndRead, this);
+    ril_event_add(&events[i]);
+    ASSERT_EQ(1, write(pairs[i].fds[1], "x", 1));
+  }
+
+  while (fired_.size() < kPairs) {
+    ASSERT_EQ(0, ril_event_loop_once());
+  }
+  ASSERT_EQ(static_cast<size_t>(kPairs), fired_.size());
+}
+
+}  // namespace
@@ -21,18 +21,16 @@
 namespace cuttlefish {
 bool RepackBootImage(const std::string& new_kernel_path,
                      const std::string& boot_image_path,
-                     const std::string& new_boot_image_path,
-                     const std::string& tmp_artifact_dir);
+                     const std::string& new_boot_image_path);
 bool RepackVendorBootImage(const std::string& new_ramdisk_path,
                            const std::string& vendor_boot_image_path,
                            const std::string& new_vendor_boot_image_path,
                            const std::string& unpack_dir,
-                           const std::string& repack_dir,
                            const std::vector<std::string>& bootconfig_args,
                            bool bootconfig_supported);
 bool RepackVendorBootImageWithEmptyRamdisk(
     const std::string& vendor_boot_image_path,
     const std::string& new_vendor_boot_image_path,
-    const std::string& unpack_dir, const std::string& repack_dir,
+    const std::string& unpack_dir,
     const std::vector<std::string>& bootconfig_args, bool bootconfig_supported);
 }
@@ -18,7 +18,12 @@
 
 #include <sys/statvfs.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <thread>
+#include <vector>
 
 #include <android-base/logging.h>
 #include <android-base/strings.h>
@@ -381,7 +386,52 @@ bool CreatePersistentCompositeDisk(
   return true;
 }
 
-static void RepackAllBootImages(const CuttlefishConfig* config) {
+static bool RepackInstanceVendorBootImage(
+    const CuttlefishConfig& config,
+    const CuttlefishConfig::InstanceSpecific& instance) {
+  const std::string new_vendor_boot_image_path =
+      instance.vendor_boot_image_path();
+  const std::vector<std::string> boot_config_vector =
+      BootconfigArgsFromConfig(config, instance);
+  if (FLAGS_kernel_path.size() || FLAGS_initramfs_path.size()) {
+    // Repack the vendor boot images if kernels and/or ramdisks are passed in.
+    if (FLAGS_initramfs_path.size()) {
+      if (!RepackVendorBootImage(FLAGS_initramfs_path, FLAGS_vendor_boot_image,
+                                 new_vendor_boot_image_path,
+                                 config.assembly_dir(), boot_config_vector,
+                                 config.bootconfig_supported())) {
+        LOG(ERROR) << "Failed to regenerate the vendor boot image with the "
+                      "new ramdisk";
+        return false;
+      }
+    } else {
+      // This control flow implies a kernel with all configs built in.
+      // If it's just the kernel, repack the vendor boot image without a
+      // ramdisk.
+      if (!RepackVendorBootImageWithEmptyRamdisk(
+              FLAGS_vendor_boot_image, new_vendor_boot_image_path,
+              config.assembly_dir(), boot_config_vector,
+              config.bootconfig_supported())) {
+        LOG(ERROR)
+            << "Failed to regenerate the vendor boot image without a ramdisk";
+        return false;
+      }
+    }
+  } else {
+    // Repack the vendor boot image to add the instance specific bootconfig
+    // parameters
+    if (!RepackVendorBootImage(std::string(), FLAGS_vendor_boot_image,
+                               new_vendor_boot_image_path,
+                               config.assembly_dir(), boot_config_vector,
+                               config.bootconfig_supported())) {
+      LOG(ERROR) << "Failed to regenerate the vendor boot image";
+      return false;
+    }
+  }
+  return true;
+}
+
+static void RepackSharedBootImages(const CuttlefishConfig* config) {
   CHECK(FileHasContent(FLAGS_boot_image))
       << "File not found: " << FLAGS_boot_image;
 
@@ -392,52 +442,163 @@ static void RepackAllBootImages(const CuttlefishConfig* config) {
     const std::string new_boot_image_path =
         config->AssemblyPath("boot_repacked.img");
     bool success = RepackBootImage(FLAGS_kernel_path, FLAGS_boot_image,
-                                   new_boot_image_path, config->assembly_dir());
+                                   new_boot_image_path);
     CHECK(success) << "Failed to regenerate the boot image with the new kernel";
     SetCommandLineOptionWithMode("boot_image", new_boot_image_path.c_str(),
                                  google::FlagSettingMode::SET_FLAGS_DEFAULT);
   }
 
-  for (auto instance : config->Instances()) {
-    const std::string new_vendor_boot_image_path =
-        instance.vendor_boot_image_path();
-    const std::vector<std::string> boot_config_vector =
-        BootconfigArgsFromConfig(*config, instance);
-    if (FLAGS_kernel_path.size() || FLAGS_initramfs_path.size()) {
-      // Repack the vendor boot images if kernels and/or ramdisks are passed in.
-      if (FLAGS_initramfs_path.size()) {
-        bool success = RepackVendorBootImage(
-            FLAGS_initramfs_path, FLAGS_vendor_boot_image,
-            new_vendor_boot_image_path, config->assembly_dir(),
-            instance.instance_dir(), boot_config_vector,
-            config->bootconfig_supported());
-        CHECK(success) << "Failed to regenerate the vendor boot image with the "
-                          "new ramdisk";
-      } else {
-        // This control flow implies a kernel with all configs built in.
-        // If it's just the kernel, repack the vendor boot image without a
-        // ramdisk.
-        bool success = RepackVendorBootImageWithEmptyRamdisk(
-            FLAGS_vendor_boot_image, new_vendor_boot_image_path,
-            config->assembly_dir(), instance.instance_dir(), boot_config_vector,
-            config->bootconfig_supported());
-        CHECK(success)
-            << "Failed to regenerate the vendor boot image without a ramdisk";
-      }
-    } else {
-      // Repack the vendor boot image to add the instance specific bootconfig
-      // parameters
-      bool success = RepackVendorBootImage(
-          std::string(), FLAGS_vendor_boot_image, new_vendor_boot_image_path,
-          config->assembly_dir(), instance.instance_dir(), boot_config_vector,
-          config->bootconfig_supported());
-      CHECK(success) << "Failed to regenerate the vendor boot image";
+  // The vendor ramdisk repacked for the first instance is kept in the
+  // assembly directory and reused by the others, so it's built before the
+  // instances are set up in parallel.
+  CHECK(RepackInstanceVendorBootImage(*config, config->Instances()[0]));
+}
+
+static bool CreateBootconfigPartition(
+    const CuttlefishConfig& config,
+    const CuttlefishConfig::InstanceSpecific& instance) {
+  const auto bootconfig_path = instance.persistent_bootconfig_path();
+  if (!FileExists(bootconfig_path)) {
+    CreateBlankImage(bootconfig_path, 1 /* mb */, "none");
+  }
+
+  auto bootconfig_fd = SharedFD::Open(bootconfig_path, O_RDWR);
+  if (!bootconfig_fd->IsOpen()) {
+    LOG(ERROR) << "Unable to open bootconfig file: "
+               << bootconfig_fd->StrError();
+    return false;
+  }
+
+  const std::string bootconfig =
+      android::base::Join(BootconfigArgsFromConfig(config, instance), "\n") +
+      "\n";
+  ssize_t bytesWritten = WriteAll(bootconfig_fd, bootconfig);
+  if (bytesWritten != bootconfig.size()) {
+    LOG(ERROR) << "Unable to write " << bootconfig_path << ": "
+               << bootconfig_fd->StrError();
+    return false;
+  }
+  LOG(DEBUG) << "Bootconfig parameters from vendor boot image and config are "
+             << ReadFile(bootconfig_path);
+
+  const off_t bootconfig_size_bytes =
+      AlignToPowerOf2(bootconfig.size(), PARTITION_SIZE_SHIFT);
+  if (bootconfig_fd->Truncate(bootconfig_size_bytes) != 0) {
+    LOG(ERROR) << "`truncate --size=" << bootconfig_size_bytes << " bytes "
+               << bootconfig_path << "` failed:" << bootconfig_fd->StrError();
+    return false;
+  }
+  return true;
+}
+
+// Everything in the disk setup that belongs to a single instance. This only
+// reads the shared images, so it can run for several instances at once.
+static bool CreateInstanceDiskFiles(
+    const CuttlefishConfig& config,
+    const CuttlefishConfig::InstanceSpecific& instance, bool newDataImage) {
+  // See the comment about protected VMs in CreateDynamicDiskFiles
+  if (!FLAGS_protected_vm) {
+    if (instance.instance_name() != config.Instances()[0].instance_name() &&
+        !RepackInstanceVendorBootImage(config, instance)) {
+      return false;
+    }
+
+    if (!FileExists(instance.access_kregistry_path())) {
+      CreateBlankImage(instance.access_kregistry_path(), 2 /* mb */, "none");
+    }
+
+    if (!FileExists(instance.pstore_path())) {
+      CreateBlankImage(instance.pstore_path(), 2 /* mb */, "none");
+    }
+
+    if (FLAGS_use_sdcard && !FileExists(instance.sdcard_path())) {
+      CreateBlankImage(instance.sdcard_path(),
+                       FLAGS_blank_sdcard_image_mb, "sdcard");
+    }
+
+    if (!InitBootloaderEnvPartition(config, instance)) {
+      LOG(ERROR) << "Failed to create bootloader environment partition";
+      return false;
+    }
+
+    const auto frp = instance.factory_reset_protected_path();
+    if (!FileExists(frp)) {
+      CreateBlankImage(frp, 1 /* mb */, "none");
+    }
+
+    if (!CreateBootconfigPartition(config, instance)) {
+      return false;
     }
   }
+
+  bool compositeMatchesDiskConfig = DoesCompositeMatchCurrentDiskConfig(
+      instance.PerInstancePath("persistent_composite_disk_config.txt"),
+      persistent_composite_disk_config(instance));
+  bool oldCompositeDisk =
+      ShouldCreateCompositeDisk(instance.persistent_composite_disk_path(),
+                                persistent_composite_disk_config(instance));
+  if (!compositeMatchesDiskConfig || oldCompositeDisk) {
+    if (!CreatePersistentCompositeDisk(config, instance)) {
+      LOG(ERROR) << "Failed to create persistent composite disk";
+      return false;
+    }
+  }
+
+  compositeMatchesDiskConfig = DoesCompositeMatchCurrentDiskConfig(
+      instance.PerInstancePath("os_composite_disk_config.txt"),
+      os_composite_disk_config(instance));
+  oldCompositeDisk = ShouldCreateCompositeDisk(
+      instance.os_composite_disk_path(), os_composite_disk_config(instance));
+  if (!compositeMatchesDiskConfig || oldCompositeDisk || !FLAGS_resume || newDataImage) {
+    if (FLAGS_resume) {
+      LOG(INFO) << "Requested to continue an existing session, (the default) "
+                << "but the disk files have become out of date. Wiping the "
+                << "old session files and starting a new session for device "
+                << instance.serial_number();
+    }
+    if (!CreateCompositeDisk(config, instance)) {
+      LOG(ERROR) << "Failed to create composite disk";
+      return false;
+    }
+    if (FileExists(instance.access_kregistry_path())) {
+      CreateBlankImage(instance.access_kregistry_path(), 2 /* mb */, "none");
+    }
+    if (FileExists(instance.pstore_path())) {
+      CreateBlankImage(instance.pstore_path(), 2 /* mb */, "none");
+    }
+  }
+
+  if (!FLAGS_protected_vm) {
+    auto overlay_path = instance.PerInstancePath("overlay.img");
+    bool missingOverlay = !FileExists(overlay_path);
+    bool newOverlay = FileModificationTime(overlay_path) <
+                      FileModificationTime(instance.os_composite_disk_path());
+    if (missingOverlay || !FLAGS_resume || newOverlay) {
+      CreateQcowOverlay(config.crosvm_binary(),
+                        instance.os_composite_disk_path(), overlay_path);
+    }
+  }
+
+  // Check that the files exist
+  for (const auto& file : instance.virtual_disk_paths()) {
+    if (!file.empty() && !FileHasContent(file)) {
+      LOG(ERROR) << "File not found: " << file;
+      return false;
+    }
+  }
+  return true;
+}
+
+static std::chrono::milliseconds MillisecondsSince(
+    std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start);
 }
 
 void CreateDynamicDiskFiles(const FetcherConfig& fetcher_config,
                             const CuttlefishConfig* config) {
+  const auto start = std::chrono::steady_clock::now();
+
   // Create misc if necessary
   CHECK(InitializeMiscImage(FLAGS_misc_image)) << "Failed to create misc image";
 
@@ -455,69 +616,7 @@ void CreateDynamicDiskFiles(const FetcherConfig& fetcher_config,
   // support. We can also assume that image repacking isn't trusted. Repacking
   // requires resigning the image and keys from an android host aren't trusted.
   if (!FLAGS_protected_vm) {
-    RepackAllBootImages(config);
-
-    for (const auto& instance : config->Instances()) {
-      if (!FileExists(instance.access_kregistry_path())) {
-        CreateBlankImage(instance.access_kregistry_path(), 2 /* mb */, "none");
-      }
-
-      if (!FileExists(instance.pstore_path())) {
-        CreateBlankImage(instance.pstore_path(), 2 /* mb */, "none");
-      }
-
-      if (FLAGS_use_sdcard && !FileExists(instance.sdcard_path())) {
-        CreateBlankImage(instance.sdcard_path(),
-                         FLAGS_blank_sdcard_image_mb, "sdcard");
-      }
-
-      CHECK(InitBootloaderEnvPartition(*config, instance))
-          << "Failed to create bootloader environment partition";
-
-      const auto frp = instance.factory_reset_protected_path();
-      if (!FileExists(frp)) {
-        CreateBlankImage(frp, 1 /* mb */, "none");
-      }
-
-      const auto bootconfig_path = instance.persistent_bootconfig_path();
-      if (!FileExists(bootconfig_path)) {
-        CreateBlankImage(bootconfig_path, 1 /* mb */, "none");
-      }
-
-      auto bootconfig_fd = SharedFD::Open(bootconfig_path, O_RDWR);
-      CHECK(bootconfig_fd->IsOpen())
-          << "Unable to open bootconfig file: " << bootconfig_fd->StrError();
-
-      const std::string bootconfig =
-          android::base::Join(BootconfigArgsFromConfig(*config, instance),
-                              "\n") +
-          "\n";
-      ssize_t bytesWritten = WriteAll(bootconfig_fd, bootconfig);
-      CHECK(bytesWritten == bootconfig.size());
-      LOG(DEBUG)
-          << "Bootconfig parameters from vendor boot image and config are "
-          << ReadFile(bootconfig_path);
-
-      const off_t bootconfig_size_bytes =
-          AlignToPowerOf2(bootconfig.size(), PARTITION_SIZE_SHIFT);
-      CHECK(bootconfig_fd->Truncate(bootconfig_size_bytes) == 0)
-          << "`truncate --size=" << bootconfig_size_bytes << " bytes "
-          << bootconfig_path << "` failed:" << bootconfig_fd->StrError();
-    }
-  }
-
-  for (const auto& instance : config->Instances()) {
-    bool compositeMatchesDiskConfig = DoesCompositeMatchCurrentDiskConfig(
-        instance.PerInstancePath("persistent_composite_disk_config.txt"),
-        persistent_composite_disk_config(instance));
-    bool oldCompositeDisk =
-        ShouldCreateCompositeDisk(instance.persistent_composite_disk_path(),
-                                  persistent_composite_disk_config(instance));
-
-    if (!compositeMatchesDiskConfig || oldCompositeDisk) {
-      CHECK(CreatePersistentCompositeDisk(*config, instance))
-          << "Failed to create persistent composite disk";
-    }
+    RepackSharedBootImages(config);
   }
 
   // libavb expects to be able to read the maximum vbmeta size, so we must
@@ -545,52 +644,47 @@ void CreateDynamicDiskFiles(const FetcherConfig& fetcher_config,
   }
 
   bool newDataImage = dataImageResult == DataImageResult::FileUpdated;
-
-  for (auto instance : config->Instances()) {
-    bool compositeMatchesDiskConfig = DoesCompositeMatchCurrentDiskConfig(
-        instance.PerInstancePath("os_composite_disk_config.txt"),
-        os_composite_disk_config(instance));
-    bool oldCompositeDisk = ShouldCreateCompositeDisk(
-        instance.os_composite_disk_path(), os_composite_disk_config(instance));
-    if (!compositeMatchesDiskConfig || oldCompositeDisk || !FLAGS_resume || newDataImage) {
-      if (FLAGS_resume) {
-        LOG(INFO) << "Requested to continue an existing session, (the default) "
-                  << "but the disk files have become out of date. Wiping the "
-                  << "old session files and starting a new session for device "
-                  << instance.serial_number();
-      }
-      CHECK(CreateCompositeDisk(*config, instance))
-          << "Failed to create composite disk";
-      if (FileExists(instance.access_kregistry_path())) {
-        CreateBlankImage(instance.access_kregistry_path(), 2 /* mb */, "none");
-      }
-      if (FileExists(instance.pstore_path())) {
-        CreateBlankImage(instance.pstore_path(), 2 /* mb */, "none");
+  LOG(DEBUG) << "Shared disk files took " << MillisecondsSince(start).count()
+             << "ms";
+
+  // The instances only share read-only inputs from here on, set them up in
+  // parallel. Most of this is waiting on disk and on the qcow2 tool.
+  const auto instances = config->Instances();
+  const auto instances_start = std::chrono::steady_clock::now();
+  std::atomic<size_t> next_instance = 0;
+  std::atomic<bool> success = true;
+  auto worker = [&]() {
+    for (size_t i = next_instance++; i < instances.size() && success;
+         i = next_instance++) {
+      const auto instance_start = std::chrono::steady_clock::now();
+      if (!CreateInstanceDiskFiles(*config, instances[i], newDataImage)) {
+        LOG(ERROR) << "Failed to create the disk files for "
+                   << instances[i].instance_name();
+        success = false;
+        return;
       }
+      LOG(DEBUG) << "Disk files for " << instances[i].instance_name()
+                 << " took " << MillisecondsSince(instance_start).count()
+                 << "ms";
     }
+  };
+  const auto num_threads = std::max<size_t>(
+      1, std::min<size_t>(instances.size(),
+                          std::thread::hardware_concurrency()));
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; i++) {
+    threads.emplace_back(worker);
   }
-
-  if (!FLAGS_protected_vm) {
-    for (auto instance : config->Instances()) {
-      auto overlay_path = instance.PerInstancePath("overlay.img");
-      bool missingOverlay = !FileExists(overlay_path);
-      bool newOverlay = FileModificationTime(overlay_path) <
-                        FileModificationTime(instance.os_composite_disk_path());
-      if (missingOverlay || !FLAGS_resume || newOverlay) {
-        CreateQcowOverlay(config->crosvm_binary(),
-                          instance.os_composite_disk_path(), overlay_path);
-      }
-    }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
   }
+  CHECK(success) << "Failed to create the per-instance disk files";
 
-  for (auto instance : config->Instances()) {
-    // Check that the files exist
-    for (const auto& file : instance.virtual_disk_paths()) {
-      if (!file.empty()) {
-        CHECK(FileHasContent(file)) << "File not found: " << file;
-      }
-    }
-  }
+  LOG(INFO) << "Disk files for " << instances.size() << " instance(s) took "
+            << MillisecondsSince(start).count() << "ms, "
+            << MillisecondsSince(instances_start).count()
+            << "ms of it per instance on " << num_threads << " thread(s)";
 }
 
 } // namespace cuttlefish
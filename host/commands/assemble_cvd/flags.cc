@@ -26,6 +26,7 @@
 #include "host/libs/config/host_tools_version.h"
 #include "host/libs/graphics_detector/graphics_detector.h"
 #include "host/libs/vm_manager/crosvm_manager.h"
+#include "host/libs/vm_manager/placement_planner.h"
 #include "host/libs/vm_manager/qemu_manager.h"
 #include "host/libs/vm_manager/vm_manager.h"
 
@@ -272,6 +273,12 @@ DEFINE_bool(ethernet, false, "Enable Ethernet network interface");
 
 DEFINE_bool(smt, false, "Enable simultaneous multithreading (SMT/HT)");
 
+DEFINE_bool(numa_placement, false,
+            "On hosts with more than one NUMA node, bind each instance and "
+            "its host processes to the cpus and memory of a single node. "
+            "With crosvm, vCPUs are pinned to cores of their own when there "
+            "are enough cores for every instance.");
+
 DEFINE_int32(vsock_guest_cid,
              cuttlefish::GetDefaultVsockCid(),
              "vsock_guest_cid is used to determine the guest vsock cid as well as all the ports"
@@ -628,6 +635,26 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
   }
   std::vector<std::string> gnss_file_paths = android::base::Split(FLAGS_gnss_file_path, ",");
 
+  std::vector<vm_manager::InstancePlacement> placements;
+  std::optional<vm_manager::HostTopology> topology;
+  if (FLAGS_numa_placement) {
+    topology = vm_manager::HostTopology::FromSysfs("/sys");
+  }
+  if (topology && topology->nodes.size() > 1) {
+    vm_manager::PlacementOptions placement_options = {
+        .num_instances = FLAGS_num_instances,
+        .cpus_per_instance = FLAGS_cpus,
+        .memory_mb = FLAGS_memory_mb,
+        .hugetlbfs = FLAGS_vm_manager == QemuManager::name(),
+        // qemu has no way to pin its vCPU threads.
+        .pin_vcpus = FLAGS_vm_manager == CrosvmManager::name(),
+        .smt = FLAGS_smt,
+        .taken_cpus = vm_manager::CpusPinnedByRunningVms("/proc"),
+    };
+    placements = vm_manager::PlanPlacement(*topology, placement_options);
+  }
+  std::vector<std::string> instance_names;
+
   bool is_first_instance = true;
   for (const auto& num : num_instances) {
     IfaceConfig iface_config;
@@ -763,8 +790,26 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
     } else {
       instance.set_modem_simulator_ports("");
     }
+
+    instance.set_numa_node(-1);
+    if (!placements.empty()) {
+      const auto& placement = placements[instance_names.size()];
+      instance.set_numa_node(placement.node);
+      instance.set_cpu_affinity(vm_manager::FormatCpuList(placement.cpus));
+      instance.set_host_cpu_affinity(
+          vm_manager::FormatCpuList(placement.host_cpus));
+      instance.set_exclusive_cpus(placement.exclusive);
+      instance.set_hugepages(placement.hugepages);
+    }
+    instance_names.push_back(const_instance.instance_name());
   } // end of num_instances loop
 
+  if (!placements.empty()) {
+    LOG(INFO) << "Host placement:\n"
+              << vm_manager::PlacementReport(*topology, placements,
+                                             instance_names);
+  }
+
   tmp_config_obj.set_enable_sandbox(FLAGS_enable_sandbox);
 
   // Audio is not available for VNC server
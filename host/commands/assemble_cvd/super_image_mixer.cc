@@ -158,6 +158,9 @@ bool CombineTargetZipFiles(const std::string& default_target_zip,
     return false;
   }
 
+  // Each archive is extracted with a single call so that its entries are
+  // written in parallel from one parsed central directory.
+  std::vector<std::string> default_target_files;
   for (const auto& name : default_target_contents) {
     if (!android::base::StartsWith(name, "IMAGES/")) {
       continue;
@@ -167,10 +170,7 @@ bool CombineTargetZipFiles(const std::string& default_target_zip,
       continue;
     }
     LOG(INFO) << "Writing " << name;
-    if (!default_target_archive.ExtractFiles({name}, output_path)) {
-      LOG(ERROR) << "Failed to extract " << name << " from the default target zip";
-      return false;
-    }
+    default_target_files.push_back(name);
   }
   for (const auto& name : default_target_contents) {
     if (!android::base::EndsWith(name, "build.prop")) {
@@ -180,12 +180,15 @@ bool CombineTargetZipFiles(const std::string& default_target_zip,
     }
     FindImports(&default_target_archive, name);
     LOG(INFO) << "Writing " << name;
-    if (!default_target_archive.ExtractFiles({name}, output_path)) {
-      LOG(ERROR) << "Failed to extract " << name << " from the default target zip";
-      return false;
-    }
+    default_target_files.push_back(name);
+  }
+  if (default_target_files.size() > 0 &&
+      !default_target_archive.ExtractFiles(default_target_files, output_path)) {
+    LOG(ERROR) << "Failed to extract files from the default target zip";
+    return false;
   }
 
+  std::vector<std::string> system_target_files;
   for (const auto& name : system_target_contents) {
     if (!android::base::StartsWith(name, "IMAGES/")) {
       continue;
@@ -195,10 +198,7 @@ bool CombineTargetZipFiles(const std::string& default_target_zip,
       continue;
     }
     LOG(INFO) << "Writing " << name;
-    if (!system_target_archive.ExtractFiles({name}, output_path)) {
-      LOG(ERROR) << "Failed to extract " << name << " from the system target zip";
-      return false;
-    }
+    system_target_files.push_back(name);
   }
   for (const auto& name : system_target_contents) {
     if (!android::base::EndsWith(name, "build.prop")) {
@@ -208,10 +208,12 @@ bool CombineTargetZipFiles(const std::string& default_target_zip,
     }
     FindImports(&system_target_archive, name);
     LOG(INFO) << "Writing " << name;
-    if (!system_target_archive.ExtractFiles({name}, output_path)) {
-      LOG(ERROR) << "Failed to extract " << name << " from the default target zip";
-      return false;
-    }
+    system_target_files.push_back(name);
+  }
+  if (system_target_files.size() > 0 &&
+      !system_target_archive.ExtractFiles(system_target_files, output_path)) {
+    LOG(ERROR) << "Failed to extract files from the system target zip";
+    return false;
   }
 
   return true;
@@ -14,17 +14,23 @@
  */
 
 #include <fcntl.h>
-#include <sys/poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
-#include <ios>
-#include <mutex>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <optional>
 
 #include <android-base/logging.h>
 #include <gflags/gflags.h>
-#include <thread>
+#include <json/json.h>
 
-#include "common/libs/fs/shared_buf.h"
 #include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/latency_histogram.h"
+#include "common/libs/utils/stats_file.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/config/logging.h"
 
@@ -41,17 +47,393 @@ DEFINE_int32(bt_out, -1, "A pipe for bt communication");
 DEFINE_int32(hci_port, -1, "A port for bt hci command");
 DEFINE_int32(link_port, -1, "A pipe for bt link layer command");
 DEFINE_int32(test_port, -1, "A pipe for rootcanal test channel");
+DEFINE_string(stats_file, "",
+              "Where to periodically write the forwarding statistics");
 
-void openSocket(cuttlefish::SharedFD* fd, int port) {
-  static std::mutex mutex;
-  std::unique_lock<std::mutex> lock(mutex);
-  *fd = cuttlefish::SharedFD::SocketLocalClient(port, SOCK_STREAM);
-}
+namespace cuttlefish {
+namespace {
 
-int main(int argc, char** argv) {
-  cuttlefish::DefaultSubprocessLogging(argv);
+using Clock = std::chrono::steady_clock;
+
+constexpr auto kMinReconnectDelay = std::chrono::milliseconds(50);
+constexpr auto kMaxReconnectDelay = std::chrono::seconds(1);
+constexpr auto kStatsInterval = std::chrono::seconds(10);
+
+// Identifies the fds in the epoll set.
+enum class Source : uint64_t {
+  kGuest,
+  kHost,
+  kGuestOut,
+  kReconnectTimer,
+  kStatsTimer,
+};
+
+// Moves data in one direction, with splice when the kernel supports it for
+// the two fds and through a fixed size buffer otherwise. The data is left in
+// the source while the destination is full, so a slow side pushes back on the
+// other instead of data piling up here.
+class Forwarder {
+ public:
+  enum class Result {
+    kDrained,  // Nothing left to read from the source
+    kBlocked,  // The destination can't take more data now
+    kSourceClosed,
+    kSourceError,
+    kDestinationError,
+  };
+
+  Forwarder(const char* name) : name_(name) {}
+
+  // Called when the source is readable or the destination writable.
+  Result Transfer(SharedFD from, SharedFD to) {
+    if (!pending_since_) {
+      pending_since_ = Clock::now();
+    }
+    auto result = use_splice_ ? Splice(from, to) : Copy(from, to);
+    if (result == Result::kBlocked) {
+      stalls_++;
+    } else {
+      latency_.Record(Clock::now() - *pending_since_);
+      pending_since_.reset();
+    }
+    return result;
+  }
+
+  // Returns whether data is waiting for the destination.
+  bool HasPendingData() const { return buffered_ > 0; }
+
+  Json::Value ToJson(std::chrono::seconds interval) {
+    Json::Value json;
+    json["bytes"] = Json::UInt64(bytes_);
+    json["transfers"] = Json::UInt64(transfers_);
+    json["stalls"] = Json::UInt64(stalls_);
+    json["bytes_per_second"] =
+        Json::UInt64((bytes_ - last_bytes_) / interval.count());
+    json["splice"] = use_splice_;
+    json["latency"] = HistogramToJson(latency_);
+    last_bytes_ = bytes_;
+    return json;
+  }
+
+ private:
+  Result Splice(SharedFD from, SharedFD to) {
+    while (true) {
+      auto spliced =
+          to->SpliceFrom(*from, kBufferSize, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (spliced > 0) {
+        bytes_ += spliced;
+        transfers_++;
+        continue;
+      }
+      if (spliced == 0) {
+        return Result::kSourceClosed;
+      }
+      if (to->GetErrno() == EINVAL) {
+        LOG(INFO) << name_ << ": splice not supported, copying instead";
+        use_splice_ = false;
+        return Copy(from, to);
+      }
+      if (to->GetErrno() != EAGAIN) {
+        // splice doesn't tell which side failed.
+        LOG(ERROR) << name_ << ": splice failed: " << to->StrError();
+        return Result::kDestinationError;
+      }
+      // EAGAIN doesn't tell which side isn't ready either, but data left in
+      // the source means it's the destination.
+      int available = 0;
+      if (from->Ioctl(FIONREAD, &available) == 0 && available > 0) {
+        return Result::kBlocked;
+      }
+      return Result::kDrained;
+    }
+  }
+
+  Result Copy(SharedFD from, SharedFD to) {
+    while (true) {
+      if (buffered_ == 0) {
+        auto read = from->Read(buffer_.data(), buffer_.size());
+        if (read == 0) {
+          return Result::kSourceClosed;
+        }
+        if (read < 0) {
+          if (from->GetErrno() == EAGAIN) {
+            return Result::kDrained;
+          }
+          LOG(ERROR) << name_ << ": read failed: " << from->StrError();
+          return Result::kSourceError;
+        }
+        buffered_ = read;
+        offset_ = 0;
+      }
+      auto written = to->Write(buffer_.data() + offset_, buffered_ - offset_);
+      if (written < 0) {
+        if (to->GetErrno() == EAGAIN) {
+          return Result::kBlocked;
+        }
+        // Keep the data, it will be sent once the destination is back.
+        LOG(ERROR) << name_ << ": write failed: " << to->StrError();
+        return Result::kDestinationError;
+      }
+      bytes_ += written;
+      offset_ += written;
+      if (offset_ == buffered_) {
+        transfers_++;
+        buffered_ = 0;
+      }
+    }
+  }
+
+  const char* name_;
+  bool use_splice_ = true;
+  std::array<char, kBufferSize> buffer_;
+  size_t buffered_ = 0;
+  size_t offset_ = 0;
+  // When the source became readable while no data was waiting.
+  std::optional<Clock::time_point> pending_since_;
+  uint64_t bytes_ = 0;
+  uint64_t last_bytes_ = 0;
+  uint64_t transfers_ = 0;
+  uint64_t stalls_ = 0;
+  // Time from the source becoming readable until it's drained, including the
+  // time spent waiting for the destination.
+  LatencyHistogram latency_;
+};
+
+class BtConnector {
+ public:
+  BtConnector(SharedFD guest_in, SharedFD guest_out)
+      : guest_in_(guest_in), guest_out_(guest_out) {}
+
+  bool Run() {
+    epoll_ = SharedFD::Epoll(EPOLL_CLOEXEC);
+    reconnect_timer_ = SharedFD::TimerFd(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (!epoll_->IsOpen() || !reconnect_timer_->IsOpen()) {
+      LOG(ERROR) << "Unable to create the event loop";
+      return false;
+    }
+    for (auto fd : {guest_in_, guest_out_}) {
+      if (fd->Fcntl(F_SETFL, O_NONBLOCK) != 0) {
+        LOG(ERROR) << "Unable to make fd non blocking: " << fd->StrError();
+        return false;
+      }
+    }
+    if (!Watch(reconnect_timer_, Source::kReconnectTimer, EPOLLIN)) {
+      return false;
+    }
+    if (!FLAGS_stats_file.empty()) {
+      stats_timer_ = SharedFD::TimerFd(CLOCK_MONOTONIC, TFD_NONBLOCK);
+      struct itimerspec interval = {
+          .it_interval = {.tv_sec = kStatsInterval.count()},
+          .it_value = {.tv_sec = kStatsInterval.count()},
+      };
+      if (stats_timer_->TimerSet(0, &interval, nullptr) != 0 ||
+          !Watch(stats_timer_, Source::kStatsTimer, EPOLLIN)) {
+        LOG(ERROR) << "Unable to set up the stats timer";
+        return false;
+      }
+    }
+    Connect();
+
+    while (true) {
+      if (!UpdateInterest()) {
+        return false;
+      }
+      struct epoll_event events[8];
+      int count = epoll_->EpollWait(events, 8, -1);
+      if (count < 0) {
+        LOG(ERROR) << "epoll_wait failed: " << epoll_->StrError();
+        return false;
+      }
+      for (int i = 0; i < count; i++) {
+        if (!HandleEvent(static_cast<Source>(events[i].data.u64))) {
+          return false;
+        }
+      }
+    }
+  }
+
+ private:
+  bool Watch(SharedFD fd, Source source, uint32_t events) {
+    struct epoll_event event = {.events = events};
+    event.data.u64 = static_cast<uint64_t>(source);
+    if (epoll_->EpollCtl(EPOLL_CTL_ADD, *fd, &event) != 0) {
+      LOG(ERROR) << "epoll_ctl failed: " << epoll_->StrError();
+      return false;
+    }
+    return true;
+  }
+
+  // The guest side is read only while there is a host to write to and
+  // neither side is read while its destination is full.
+  bool UpdateInterest() {
+    bool connected = host_->IsOpen();
+    uint32_t guest_in = connected && !guest_to_host_blocked_ ? EPOLLIN : 0;
+    uint32_t guest_out = host_to_guest_blocked_ ? EPOLLOUT : 0;
+    uint32_t host = (host_to_guest_blocked_ ? 0 : EPOLLIN) |
+                    (guest_to_host_blocked_ ? EPOLLOUT : 0);
+    return SetInterest(guest_in_, Source::kGuest, guest_in, &guest_in_events_) &&
+           SetInterest(guest_out_, Source::kGuestOut, guest_out,
+                       &guest_out_events_) &&
+           (!connected ||
+            SetInterest(host_, Source::kHost, host, &host_events_));
+  }
+
+  bool SetInterest(SharedFD fd, Source source, uint32_t events,
+                   std::optional<uint32_t>* current) {
+    if (*current == events) {
+      return true;
+    }
+    struct epoll_event event = {.events = events};
+    event.data.u64 = static_cast<uint64_t>(source);
+    int op = current->has_value() ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_->EpollCtl(op, *fd, &event) != 0) {
+      LOG(ERROR) << "epoll_ctl failed: " << epoll_->StrError();
+      return false;
+    }
+    *current = events;
+    return true;
+  }
+
+  bool HandleEvent(Source source) {
+    switch (source) {
+      case Source::kGuest:
+        return GuestToHost();
+      case Source::kGuestOut:
+        return HostToGuest();
+      case Source::kHost:
+        // Either direction may be waiting on the host socket.
+        return (!guest_to_host_blocked_ || GuestToHost()) &&
+               (!host_->IsOpen() || host_to_guest_blocked_ || HostToGuest());
+      case Source::kReconnectTimer: {
+        uint64_t expirations;
+        reconnect_timer_->Read(&expirations, sizeof(expirations));
+        Connect();
+        return true;
+      }
+      case Source::kStatsTimer: {
+        uint64_t expirations;
+        stats_timer_->Read(&expirations, sizeof(expirations));
+        WriteStats();
+        return true;
+      }
+    }
+    return true;
+  }
+
+  bool GuestToHost() {
+    if (!host_->IsOpen()) {
+      return true;
+    }
+    auto result = guest_to_host_.Transfer(guest_in_, host_);
+    guest_to_host_blocked_ = result == Forwarder::Result::kBlocked;
+    switch (result) {
+      case Forwarder::Result::kSourceClosed:
+      case Forwarder::Result::kSourceError:
+        LOG(ERROR) << "Lost the connection with the guest";
+        return false;
+      case Forwarder::Result::kDestinationError:
+        Disconnect();
+        return true;
+      default:
+        return true;
+    }
+  }
+
+  bool HostToGuest() {
+    auto result = host_to_guest_.Transfer(host_, guest_out_);
+    host_to_guest_blocked_ = result == Forwarder::Result::kBlocked;
+    switch (result) {
+      case Forwarder::Result::kSourceClosed:
+      case Forwarder::Result::kSourceError:
+        Disconnect();
+        return true;
+      case Forwarder::Result::kDestinationError:
+        LOG(ERROR) << "Lost the connection with the guest";
+        return false;
+      default:
+        return true;
+    }
+  }
+
+  void Connect() {
+    auto host = SharedFD::SocketLocalClient(FLAGS_hci_port, SOCK_STREAM);
+    if (!host->IsOpen() || host->Fcntl(F_SETFL, O_NONBLOCK) != 0) {
+      // The host process may not be ready yet, try again later.
+      LOG(DEBUG) << "Unable to connect to port " << FLAGS_hci_port << ": "
+                 << host->StrError();
+      ScheduleReconnect();
+      return;
+    }
+    LOG(INFO) << "Connected to port " << FLAGS_hci_port;
+    host_ = host;
+    host_events_.reset();
+    reconnect_delay_ = kMinReconnectDelay;
+    // Data read from the guest before the disconnection goes first.
+    if (guest_to_host_.HasPendingData()) {
+      GuestToHost();
+    }
+  }
+
+  void Disconnect() {
+    LOG(ERROR) << "Lost the connection to port " << FLAGS_hci_port
+               << ", reconnecting";
+    // Closing the fd also removes it from the epoll set.
+    host_->Close();
+    host_ = SharedFD();
+    host_events_.reset();
+    guest_to_host_blocked_ = false;
+    host_to_guest_blocked_ = false;
+    ScheduleReconnect();
+  }
+
+  void ScheduleReconnect() {
+    auto delay_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        reconnect_delay_)
+                        .count();
+    struct itimerspec timeout = {
+        .it_value = {.tv_sec = delay_ns / 1000000000,
+                     .tv_nsec = delay_ns % 1000000000},
+    };
+    if (reconnect_timer_->TimerSet(0, &timeout, nullptr) != 0) {
+      LOG(ERROR) << "Unable to set the reconnection timer: "
+                 << reconnect_timer_->StrError();
+    }
+    reconnect_delay_ = std::min<std::chrono::milliseconds>(
+        reconnect_delay_ * 2, kMaxReconnectDelay);
+  }
+
+  void WriteStats() {
+    Json::Value stats;
+    stats["connected"] = host_->IsOpen();
+    stats["guest_to_host"] = guest_to_host_.ToJson(kStatsInterval);
+    stats["host_to_guest"] = host_to_guest_.ToJson(kStatsInterval);
+    WriteStatsFile(FLAGS_stats_file, stats);
+  }
+
+  SharedFD guest_in_;
+  SharedFD guest_out_;
+  SharedFD host_;
+  SharedFD epoll_;
+  SharedFD reconnect_timer_;
+  SharedFD stats_timer_;
+  // What each fd is registered for in the epoll set, if it is.
+  std::optional<uint32_t> guest_in_events_;
+  std::optional<uint32_t> guest_out_events_;
+  std::optional<uint32_t> host_events_;
+  Forwarder guest_to_host_{"guest to host"};
+  Forwarder host_to_guest_{"host to guest"};
+  bool guest_to_host_blocked_ = false;
+  bool host_to_guest_blocked_ = false;
+  std::chrono::milliseconds reconnect_delay_ = kMinReconnectDelay;
+};
+
+int BtConnectorMain(int argc, char** argv) {
+  DefaultSubprocessLogging(argv);
   gflags::ParseCommandLineFlags(&argc, &argv, true);
-  auto bt_in = cuttlefish::SharedFD::Dup(FLAGS_bt_in);
+  // A host disconnection is detected from the write errors instead.
+  signal(SIGPIPE, SIG_IGN);
+
+  auto bt_in = SharedFD::Dup(FLAGS_bt_in);
   if (!bt_in->IsOpen()) {
     LOG(ERROR) << "Error dupping fd " << FLAGS_bt_in << ": "
                << bt_in->StrError();
@@ -59,43 +441,21 @@ int main(int argc, char** argv) {
   }
   close(FLAGS_bt_in);
 
-  auto bt_out = cuttlefish::SharedFD::Dup(FLAGS_bt_out);
+  auto bt_out = SharedFD::Dup(FLAGS_bt_out);
   if (!bt_out->IsOpen()) {
     LOG(ERROR) << "Error dupping fd " << FLAGS_bt_out << ": "
                << bt_out->StrError();
     return 1;
   }
   close(FLAGS_bt_out);
-  cuttlefish::SharedFD sock;
-  openSocket(&sock, FLAGS_hci_port);
 
-  auto guest_to_host = std::thread([&]() {
-    while (true) {
-      char buf[kBufferSize];
-      auto read = bt_in->Read(buf, sizeof(buf));
-      while (cuttlefish::WriteAll(sock, buf, read) == -1) {
-        LOG(ERROR) << "failed to write to socket, retry.";
-        // Wait for the host process to be ready
-        sleep(1);
-        openSocket(&sock, FLAGS_hci_port);
-      }
-    }
-  });
+  BtConnector connector(bt_in, bt_out);
+  return connector.Run() ? 0 : 1;
+}
 
-  auto host_to_guest = std::thread([&]() {
-    while (true) {
-      char buf[kBufferSize];
-      auto read = sock->Read(buf, sizeof(buf));
-      if (read == -1) {
-        LOG(ERROR) << "failed to read from socket, retry.";
-        // Wait for the host process to be ready
-        sleep(1);
-        openSocket(&sock, FLAGS_hci_port);
-        continue;
-      }
-      cuttlefish::WriteAll(bt_out, buf, read);
-    }
-  });
-  guest_to_host.join();
-  host_to_guest.join();
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  return cuttlefish::BtConnectorMain(argc, argv);
 }
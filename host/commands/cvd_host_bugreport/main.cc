@@ -14,36 +14,44 @@
  * limitations under the License.
  */
 
-#include <stdio.h>
-#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <string>
+#include <thread>
 
 #include <android-base/logging.h>
 #include <android-base/strings.h>
 #include <gflags/gflags.h>
 
 #include "common/libs/fs/shared_fd.h"
-#include "common/libs/fs/shared_select.h"
 #include "common/libs/utils/files.h"
+#include "common/libs/utils/zip_builder.h"
 #include "host/libs/config/cuttlefish_config.h"
-#include "ziparchive/zip_writer.h"
 
-DEFINE_string(output, "host_bugreport.zip", "Where to write the output");
+DEFINE_string(output, "host_bugreport.zip",
+              "Where to write the output, \"-\" writes it to stdout");
+DEFINE_uint64(max_file_size, 0,
+              "Files larger than this many bytes are truncated to it in the "
+              "bugreport. A value of zero means no limit");
+DEFINE_bool(keep_tail, true,
+            "Keep the end of files truncated by --max_file_size instead of "
+            "their beginning");
+DEFINE_int32(threads, 0,
+             "How many threads compress the files. A value of zero uses one "
+             "per CPU");
 
 namespace cuttlefish {
 namespace {
 
-void SaveFile(ZipWriter& writer, const std::string& zip_path,
+void SaveFile(ZipBuilder& builder, const std::string& zip_path,
               const std::string& file_path) {
-  writer.StartEntry(zip_path, ZipWriter::kCompress | ZipWriter::kAlign32);
-  std::fstream file(file_path, std::fstream::in | std::fstream::binary);
-  do {
-    char data[1024 * 10];
-    file.read(data, sizeof(data));
-    writer.WriteBytes(data, file.gcount());
-  } while (file);
-  writer.FinishEntry();
-  if (file.bad()) {
+  if (!FileExists(file_path)) {
+    LOG(DEBUG) << "Skipping missing file " << file_path;
+    return;
+  }
+  if (!builder.AddFile(zip_path, file_path, FLAGS_max_file_size,
+                       FLAGS_keep_tail)) {
     LOG(ERROR) << "Error in logging " << file_path << " to " << zip_path;
   }
 }
@@ -55,21 +63,30 @@ int CvdHostBugreportMain(int argc, char** argv) {
   auto config = CuttlefishConfig::Get();
   CHECK(config) << "Unable to find the config";
 
-  auto out_path = FLAGS_output.c_str();
-  std::unique_ptr<FILE, decltype(&fclose)> out(fopen(out_path, "wb"), &fclose);
-  ZipWriter writer(out.get());
-
-  auto save = [&writer, config](const std::string& path) {
-    SaveFile(writer, "cuttlefish_assembly/" + path, config->AssemblyPath(path));
+  SharedFD out;
+  if (FLAGS_output == "-") {
+    out = SharedFD::Dup(STDOUT_FILENO);
+  } else {
+    out = SharedFD::Open(FLAGS_output, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  }
+  CHECK(out->IsOpen()) << "Unable to open \"" << FLAGS_output
+                       << "\": " << out->StrError();
+  size_t threads = FLAGS_threads > 0 ? FLAGS_threads
+                                     : std::thread::hardware_concurrency();
+  ZipBuilder builder(out, threads);
+
+  auto save = [&builder, config](const std::string& path) {
+    SaveFile(builder, "cuttlefish_assembly/" + path,
+             config->AssemblyPath(path));
   };
   save("assemble_cvd.log");
   save("cuttlefish_config.json");
 
   for (const auto& instance : config->Instances()) {
-    auto save = [&writer, instance](const std::string& path) {
+    auto save = [&builder, instance](const std::string& path) {
       const auto& zip_name = instance.instance_name() + "/" + path;
       const auto& file_name = instance.PerInstancePath(path.c_str());
-      SaveFile(writer, zip_name, file_name);
+      SaveFile(builder, zip_name, file_name);
     };
     save("cuttlefish_config.json");
     save("disk_config.txt");
@@ -77,23 +94,30 @@ int CvdHostBugreportMain(int argc, char** argv) {
     save("launcher.log");
     save("logcat");
     save("metrics.log");
-    auto tombstones = DirectoryContents(instance.PerInstancePath("tombstones"));
-    for (const auto& tombstone : tombstones) {
-      if (tombstone == "." || tombstone == "..") {
-        continue;
+    auto tombstones_dir = instance.PerInstancePath("tombstones");
+    if (DirectoryExists(tombstones_dir)) {
+      for (const auto& tombstone : DirectoryContents(tombstones_dir)) {
+        if (tombstone == "." || tombstone == "..") {
+          continue;
+        }
+        save("tombstones/" + tombstone);
       }
-      save("tombstones/" + tombstone);
     }
-    auto recordings = DirectoryContents(instance.PerInstancePath("recording"));
-    for (const auto& recording : recordings) {
-      if (recording == "." || recording == "..") {
-        continue;
+    auto recordings_dir = instance.PerInstancePath("recording");
+    if (DirectoryExists(recordings_dir)) {
+      for (const auto& recording : DirectoryContents(recordings_dir)) {
+        if (recording == "." || recording == "..") {
+          continue;
+        }
+        save("recording/" + recording);
       }
-      save("recording/" + recording);
     }
   }
 
-  writer.Finish();
+  if (!builder.Finish()) {
+    LOG(ERROR) << "Failed to write \"" << FLAGS_output << "\"";
+    return 1;
+  }
 
   LOG(INFO) << "Saved to \"" << FLAGS_output << "\"";
 
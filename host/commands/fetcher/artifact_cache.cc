@@ -0,0 +1,319 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "artifact_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
+#include <openssl/sha.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+std::string SanitizeComponent(std::string component) {
+  std::replace(component.begin(), component.end(), '/', '_');
+  if (component == "." || component == "..") {
+    component = "_" + component;
+  }
+  return component;
+}
+
+// Creates a directory the users of its group can add entries to, without
+// being able to remove or replace entries of other users. Refuses existing
+// directories that would let someone else replace entries.
+bool MakeSharedDirectory(const std::string& path) {
+  if (mkdir(path.c_str(), 0775) == 0) {
+    // Not affected by the umask. Setgid keeps the group of the parent.
+    chmod(path.c_str(), 03775);
+  } else if (errno != EEXIST) {
+    int error_num = errno;
+    LOG(ERROR) << "Could not create " << path << ": " << strerror(error_num);
+    return false;
+  }
+  struct stat st;
+  if (lstat(path.c_str(), &st) != 0) {
+    int error_num = errno;
+    LOG(ERROR) << "Could not stat " << path << ": " << strerror(error_num);
+    return false;
+  }
+  bool shared_writable = (st.st_mode & (S_IWGRP | S_IWOTH)) != 0;
+  if (!S_ISDIR(st.st_mode) || (shared_writable && !(st.st_mode & S_ISVTX))) {
+    LOG(ERROR) << path << " is not a directory, or others can write to it "
+               << "without the sticky bit";
+    return false;
+  }
+  return true;
+}
+
+// Returns the hex SHA-256 digest of the file at `path`, or an empty string if
+// it could not be read.
+std::string Sha256File(const std::string& path) {
+  auto fd = SharedFD::Open(path, O_RDONLY);
+  if (!fd->IsOpen()) {
+    return "";
+  }
+  SHA256_CTX ctx;
+  SHA256_Init(&ctx);
+  std::vector<char> buffer(1 << 20);
+  ssize_t bytes;
+  while ((bytes = fd->Read(buffer.data(), buffer.size())) > 0) {
+    SHA256_Update(&ctx, buffer.data(), bytes);
+  }
+  if (bytes < 0) {
+    LOG(ERROR) << "Could not read " << path << ": " << fd->StrError();
+    return "";
+  }
+  uint8_t digest[SHA256_DIGEST_LENGTH];
+  SHA256_Final(digest, &ctx);
+  static constexpr char kHex[] = "0123456789abcdef";
+  std::string hex;
+  for (auto byte : digest) {
+    hex += kHex[byte >> 4];
+    hex += kHex[byte & 0xf];
+  }
+  return hex;
+}
+
+// What the digest file records about an entry: its digest, and the size and
+// modification time it had when the digest was taken.
+struct EntryStamp {
+  std::string digest;
+  std::string file_state;
+};
+
+std::string FileState(const struct stat& st) {
+  return std::to_string(st.st_size) + " " + std::to_string(st.st_mtim.tv_sec) +
+         "." + std::to_string(st.st_mtim.tv_nsec);
+}
+
+bool IsReadOnlyFile(const struct stat& st) {
+  return S_ISREG(st.st_mode) && (st.st_mode & 0222) == 0;
+}
+
+// Reads the digest file, which must be read-only and belong to the owner of
+// the entry.
+bool ReadStamp(const std::string& path, uid_t owner, EntryStamp* stamp) {
+  struct stat st;
+  if (lstat(path.c_str(), &st) != 0 || !IsReadOnlyFile(st) ||
+      st.st_uid != owner) {
+    return false;
+  }
+  std::string contents;
+  if (!android::base::ReadFileToString(path, &contents)) {
+    return false;
+  }
+  auto fields = android::base::Split(android::base::Trim(contents), " ");
+  if (fields.size() != 3 || fields[0].empty()) {
+    return false;
+  }
+  stamp->digest = fields[0];
+  stamp->file_state = fields[1] + " " + fields[2];
+  return true;
+}
+
+bool WriteStamp(const std::string& path, const EntryStamp& stamp) {
+  // Unique, other users' leftovers can't be truncated in a sticky directory
+  std::string tmp_path = path + "." + std::to_string(getpid()) + ".tmp";
+  unlink(tmp_path.c_str());
+  auto fd = SharedFD::Open(tmp_path, O_WRONLY | O_CREAT | O_EXCL, 0444);
+  if (!fd->IsOpen() ||
+      WriteAll(fd, stamp.digest + " " + stamp.file_state + "\n") < 0) {
+    LOG(ERROR) << "Could not write " << tmp_path << ": " << fd->StrError();
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  fd->Close();
+  chmod(tmp_path.c_str(), 0444);
+  if (!RenameFile(tmp_path, path)) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Makes a freshly downloaded entry read-only and records its digest.
+bool SealEntry(const std::string& entry, const std::string& stamp_path) {
+  if (chmod(entry.c_str(), 0444) != 0) {
+    int error_num = errno;
+    LOG(ERROR) << "Could not make " << entry << " read-only: "
+               << strerror(error_num);
+    return false;
+  }
+  EntryStamp stamp;
+  stamp.digest = Sha256File(entry);
+  struct stat st;
+  if (stamp.digest.empty() || lstat(entry.c_str(), &st) != 0) {
+    return false;
+  }
+  stamp.file_state = FileState(st);
+  return WriteStamp(stamp_path, stamp);
+}
+
+// Opens the lock file read-only, which is enough for flock, so any user of
+// the group can lock an entry whoever created its lock file.
+int OpenLockFile(const std::string& path) {
+  for (int attempt = 0; attempt < 2; attempt++) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0 || errno != ENOENT) {
+      return fd;
+    }
+    fd = open(path.c_str(), O_RDONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0444);
+    if (fd >= 0 || errno != EEXIST) {
+      return fd;
+    }
+  }
+  return -1;
+}
+
+bool CopyFile(const std::string& source, const std::string& destination) {
+  auto in = SharedFD::Open(source, O_RDONLY);
+  auto out = SharedFD::Open(destination, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (!in->IsOpen() || !out->IsOpen()) {
+    LOG(ERROR) << "Could not open " << source << " or " << destination;
+    return false;
+  }
+  off_t size = FileSize(source);
+  off_t in_offset = 0;
+  off_t out_offset = 0;
+  while (in_offset < size) {
+    ssize_t copied = out->CopyFileRange(*in, &in_offset, &out_offset,
+                                        size - in_offset);
+    if (copied <= 0) {
+      LOG(ERROR) << "Could not copy " << source << " to " << destination
+                 << ": " << out->StrError();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool LinkOrCopy(const std::string& entry, const std::string& destination) {
+  unlink(destination.c_str());
+  if (link(entry.c_str(), destination.c_str()) == 0) {
+    return true;
+  }
+  // EPERM comes from protected_hardlinks for entries of other users
+  if (errno != EXDEV && errno != EPERM) {
+    int error_num = errno;
+    LOG(ERROR) << "Could not link " << entry << " to " << destination << ": "
+               << strerror(error_num);
+    return false;
+  }
+  return CopyFile(entry, destination);
+}
+
+} // namespace
+
+ArtifactCache::ArtifactCache(const std::string& directory)
+    : directory_(directory) {}
+
+std::string ArtifactCache::EntryPath(const std::string& build_id,
+                                     const std::string& target,
+                                     const std::string& artifact) {
+  return directory_ + "/" + SanitizeComponent(build_id) + "/" +
+         SanitizeComponent(target) + "/" + SanitizeComponent(artifact);
+}
+
+bool ArtifactCache::Fetch(const std::string& build_id,
+                          const std::string& target,
+                          const std::string& artifact,
+                          const std::string& destination,
+                          const Downloader& download) {
+  std::string entry = EntryPath(build_id, target, artifact);
+  std::string build_dir = directory_ + "/" + SanitizeComponent(build_id);
+  if (!MakeSharedDirectory(directory_) || !MakeSharedDirectory(build_dir) ||
+      !MakeSharedDirectory(cpp_dirname(entry))) {
+    LOG(WARNING) << "Not using the artifact cache for " << artifact;
+    return download(destination);
+  }
+
+  std::string lock_path = entry + ".lock";
+  android::base::unique_fd lock_fd(OpenLockFile(lock_path));
+  if (lock_fd.get() < 0 || flock(lock_fd.get(), LOCK_EX) != 0) {
+    int error_num = errno;
+    LOG(WARNING) << "Could not lock " << lock_path << ": "
+                 << strerror(error_num) << ", not using the artifact cache";
+    return download(destination);
+  }
+
+  std::string stamp_path = entry + ".sha256";
+  struct stat st;
+  if (lstat(entry.c_str(), &st) == 0) {
+    EntryStamp stamp;
+    bool verified = false;
+    if (IsReadOnlyFile(st) && ReadStamp(stamp_path, st.st_uid, &stamp)) {
+      // Unchanged since it was hashed, no need to read gigabytes again
+      verified = stamp.file_state == FileState(st) ||
+                 Sha256File(entry) == stamp.digest;
+      if (verified && stamp.file_state != FileState(st) &&
+          st.st_uid == getuid()) {
+        stamp.file_state = FileState(st);
+        WriteStamp(stamp_path, stamp);
+      }
+    }
+    if (verified) {
+      LOG(INFO) << "Using cached " << build_id << "/" << target << ":"
+                << artifact;
+      return LinkOrCopy(entry, destination);
+    }
+    if (st.st_uid != getuid()) {
+      LOG(WARNING) << "Cached " << entry << " of uid " << st.st_uid
+                   << " does not match its digest, downloading " << artifact
+                   << " without the cache";
+      return download(destination);
+    }
+    LOG(WARNING) << "Cached " << entry << " does not match its digest, "
+                 << "downloading it again";
+  }
+  // An interrupted download of another user can't be resumed or replaced.
+  for (const auto& partial : {entry + ".partial", entry + ".partial.chunks"}) {
+    if (lstat(partial.c_str(), &st) == 0 && st.st_uid != getuid()) {
+      LOG(WARNING) << partial << " belongs to uid " << st.st_uid
+                   << ", downloading " << artifact << " without the cache";
+      return download(destination);
+    }
+  }
+
+  // The entry may still be linked elsewhere, so replace it rather than
+  // writing over the shared inode.
+  unlink(stamp_path.c_str());
+  unlink(entry.c_str());
+  if (!download(entry)) {
+    return false;
+  }
+  if (!SealEntry(entry, stamp_path)) {
+    LOG(WARNING) << "Could not record the digest of " << entry
+                 << ", it will be downloaded again next time";
+  }
+  return LinkOrCopy(entry, destination);
+}
+
+} // namespace cuttlefish
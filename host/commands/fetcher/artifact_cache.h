@@ -0,0 +1,66 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+namespace cuttlefish {
+
+/**
+ * A directory of downloaded build artifacts shared between fetch_cvd
+ * invocations, possibly running at the same time for different instances and
+ * different users.
+ *
+ * Entries are keyed by build id, target and artifact name, which never change
+ * contents once a build is complete. Each entry is guarded by a lock file so
+ * only one process downloads it, while the others wait and reuse the result.
+ *
+ * The directories are setgid, sticky and group writable, so the users of one
+ * group share the entries but can only replace their own. Entries are made
+ * read-only once downloaded, and their SHA-256 digest is recorded next to
+ * them with the size and modification time they had. An entry that still has
+ * that size and time is reused as is; otherwise it is hashed again, and one
+ * that no longer matches its digest is downloaded again. When the cache can't
+ * be used, for example because another user's entry is damaged, the artifact
+ * is downloaded straight to the destination instead.
+ *
+ * Entries are hard linked into the destination, so destinations are read-only
+ * as well. They are copied instead when the destination is on another
+ * filesystem or the kernel refuses to link another user's file.
+ */
+class ArtifactCache {
+public:
+  using Downloader = std::function<bool(const std::string& path)>;
+
+  ArtifactCache(const std::string& directory);
+
+  /**
+   * Places the artifact at `destination`, calling `download` with a path in
+   * the cache to populate it if it is not present yet.
+   */
+  bool Fetch(const std::string& build_id, const std::string& target,
+             const std::string& artifact, const std::string& destination,
+             const Downloader& download);
+
+private:
+  std::string EntryPath(const std::string& build_id, const std::string& target,
+                        const std::string& artifact);
+
+  std::string directory_;
+};
+
+} // namespace cuttlefish
@@ -80,8 +80,10 @@ DirectoryBuild::DirectoryBuild(const std::vector<std::string>& paths,
   product = StringFromEnv("TARGET_PRODUCT", "");
 }
 
-BuildApi::BuildApi(std::unique_ptr<CredentialSource> credential_source)
-    : credential_source(std::move(credential_source)) {}
+BuildApi::BuildApi(std::unique_ptr<CredentialSource> credential_source,
+                   std::unique_ptr<ArtifactCache> artifact_cache)
+    : credential_source(std::move(credential_source)),
+      artifact_cache(std::move(artifact_cache)) {}
 
 std::vector<std::string> BuildApi::Headers() {
   std::vector<std::string> headers;
@@ -93,6 +95,7 @@ std::vector<std::string> BuildApi::Headers() {
 
 std::string BuildApi::LatestBuildId(const std::string& branch,
                                     const std::string& target) {
+  std::lock_guard<std::mutex> lock(api_mutex);
   std::string url = BUILD_API + "/builds?branch=" + branch
       + "&buildAttemptStatus=complete"
       + "&buildType=submitted&maxResults=1&successful=true&target=" + target;
@@ -110,6 +113,7 @@ std::string BuildApi::LatestBuildId(const std::string& branch,
 }
 
 std::string BuildApi::BuildStatus(const DeviceBuild& build) {
+  std::lock_guard<std::mutex> lock(api_mutex);
   std::string url = BUILD_API + "/builds/" + build.id + "/" + build.target;
   auto response_json = curl.DownloadToJson(url, Headers());
   CHECK(!response_json.isMember("error")) << "Error fetching the status of "
@@ -119,6 +123,7 @@ std::string BuildApi::BuildStatus(const DeviceBuild& build) {
 }
 
 std::string BuildApi::ProductName(const DeviceBuild& build) {
+  std::lock_guard<std::mutex> lock(api_mutex);
   std::string url = BUILD_API + "/builds/" + build.id + "/" + build.target;
   auto response_json = curl.DownloadToJson(url, Headers());
   CHECK(!response_json.isMember("error")) << "Error fetching the status of "
@@ -128,6 +133,13 @@ std::string BuildApi::ProductName(const DeviceBuild& build) {
 }
 
 std::vector<Artifact> BuildApi::Artifacts(const DeviceBuild& build) {
+  std::lock_guard<std::mutex> lock(api_mutex);
+  // Complete builds don't change, and the listing is requested once per
+  // artifact type.
+  auto cached = artifacts_by_build.find({build.id, build.target});
+  if (cached != artifacts_by_build.end()) {
+    return cached->second;
+  }
   std::string page_token = "";
   std::vector<Artifact> artifacts;
   do {
@@ -149,6 +161,7 @@ std::vector<Artifact> BuildApi::Artifacts(const DeviceBuild& build) {
       artifacts.emplace_back(artifact_json);
     }
   } while (page_token != "");
+  artifacts_by_build[{build.id, build.target}] = artifacts;
   return artifacts;
 }
 
@@ -175,11 +188,27 @@ std::vector<Artifact> BuildApi::Artifacts(const DirectoryBuild& build) {
 bool BuildApi::ArtifactToFile(const DeviceBuild& build,
                               const std::string& artifact,
                               const std::string& path) {
+  if (!artifact_cache) {
+    return DownloadArtifact(build, artifact, path);
+  }
+  return artifact_cache->Fetch(
+      build.id, build.target, artifact, path,
+      [this, &build, &artifact](const std::string& cache_path) {
+        return DownloadArtifact(build, artifact, cache_path);
+      });
+}
+
+bool BuildApi::DownloadArtifact(const DeviceBuild& build,
+                                const std::string& artifact,
+                                const std::string& path) {
   std::string download_url_endpoint =
       BUILD_API + "/builds/" + build.id + "/" + build.target +
       "/attempts/latest/artifacts/" + artifact + "/url";
-  auto download_url_json =
-      curl.DownloadToJson(download_url_endpoint, Headers());
+  Json::Value download_url_json;
+  {
+    std::lock_guard<std::mutex> lock(api_mutex);
+    download_url_json = curl.DownloadToJson(download_url_endpoint, Headers());
+  }
   if (!download_url_json.isMember("signedUrl")) {
     LOG(ERROR) << "URL endpoint did not have json path: " << download_url_json;
     return false;
@@ -17,11 +17,14 @@
 
 #include <chrono>
 #include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <variant>
 
+#include "artifact_cache.h"
 #include "credential_source.h"
 #include "curl_wrapper.h"
 
@@ -80,13 +83,24 @@ using Build = std::variant<DeviceBuild, DirectoryBuild>;
 
 std::ostream& operator<<(std::ostream&, const Build&);
 
+/**
+ * Safe to use from multiple threads. Calls to the build API are serialized,
+ * while artifact downloads run in parallel on their own connections.
+ */
 class BuildApi {
+  std::mutex api_mutex;
   CurlWrapper curl;
   std::unique_ptr<CredentialSource> credential_source;
+  std::unique_ptr<ArtifactCache> artifact_cache;
+  std::map<std::pair<std::string, std::string>, std::vector<Artifact>>
+      artifacts_by_build;
 
   std::vector<std::string> Headers();
+  bool DownloadArtifact(const DeviceBuild& build, const std::string& artifact,
+                        const std::string& path);
 public:
-  BuildApi(std::unique_ptr<CredentialSource> credential_source);
+  BuildApi(std::unique_ptr<CredentialSource> credential_source,
+           std::unique_ptr<ArtifactCache> artifact_cache = nullptr);
   ~BuildApi() = default;
 
   std::string LatestBuildId(const std::string& branch,
@@ -24,6 +24,8 @@
 #include <curl/curl.h>
 #include <json/json.h>
 
+#include "ranged_downloader.h"
+
 namespace cuttlefish {
 namespace {
 
@@ -69,38 +71,9 @@ bool CurlWrapper::DownloadToFile(const std::string& url, const std::string& path
 
 bool CurlWrapper::DownloadToFile(const std::string& url, const std::string& path,
                                  const std::vector<std::string>& headers) {
-  LOG(INFO) << "Attempting to save \"" << url << "\" to \"" << path << "\"";
-  if (!curl) {
-    LOG(ERROR) << "curl was not initialized\n";
-    return false;
-  }
-  curl_slist* curl_headers = build_slist(headers);
-  curl_easy_reset(curl);
-  curl_easy_setopt(curl, CURLOPT_CAINFO, "/etc/ssl/certs/ca-certificates.crt");
-  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, curl_headers);
-  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-  char error_buf[CURL_ERROR_SIZE];
-  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error_buf);
-  curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-  FILE* file = fopen(path.c_str(), "w");
-  if (!file) {
-    LOG(ERROR) << "could not open file " << path;
-    return false;
-  }
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*) file);
-  CURLcode res = curl_easy_perform(curl);
-  if (curl_headers) {
-    curl_slist_free_all(curl_headers);
-  }
-  fclose(file);
-  if (res != CURLE_OK) {
-    LOG(ERROR) << "curl_easy_perform() failed. "
-        << "Code was \"" << res << "\". "
-        << "Strerror was \"" << curl_easy_strerror(res) << "\". "
-        << "Error buffer was \"" << error_buf << "\".";
-    return false;
-  }
-  return true;
+  // Uses its own connections, so file downloads can run in parallel with each
+  // other and with requests through this wrapper.
+  return RangedDownloader().DownloadToFile(url, path, headers);
 }
 
 std::string CurlWrapper::DownloadToString(const std::string& url) {
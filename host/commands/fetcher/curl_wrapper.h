@@ -22,6 +22,11 @@
 
 namespace cuttlefish {
 
+/**
+ * Requests through one wrapper share a connection and must not overlap.
+ * DownloadToFile is the exception: it opens its own connections, possibly
+ * several for large files, and can run from any thread.
+ */
 class CurlWrapper {
   CURL* curl;
 public:
@@ -13,8 +13,12 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <future>
 #include <iostream>
 #include <iterator>
+#include <map>
+#include <optional>
+#include <sstream>
 #include <string>
 
 #include <sys/stat.h>
@@ -31,6 +35,7 @@
 
 #include "host/libs/config/fetcher_config.h"
 
+#include "artifact_cache.h"
 #include "build_api.h"
 #include "credential_source.h"
 #include "install_zip.h"
@@ -55,6 +60,9 @@ DEFINE_bool(download_target_files_zip, false, "Whether to fetch the "
                                               "-target_files-*.zip file.");
 
 DEFINE_string(credential_source, "", "Build API credential source");
+DEFINE_string(artifact_cache, "", "Directory to keep downloaded artifacts in, "
+                                  "shared between fetch_cvd runs. Unused if "
+                                  "empty.");
 DEFINE_string(directory, CurrentDirectory(), "Target directory to fetch "
                                              "files into");
 DEFINE_bool(run_next_stage, false, "Continue running the device through the next stage.");
@@ -87,51 +95,163 @@ std::string TargetBuildZipFromArtifacts(
   return "";
 }
 
-std::vector<std::string> download_images(BuildApi* build_api,
+/**
+ * Starts artifact downloads in the background so they overlap with each other
+ * and with the installation of artifacts that already arrived. Installation
+ * still happens in order, by waiting on the download for each path.
+ *
+ * Two builds can need the same artifact at the same path, like the img zip
+ * when the system build is the default build. The download is shared, and
+ * Release tells the last of them that it may delete the file.
+ */
+class ArtifactFetcher {
+public:
+  ArtifactFetcher(BuildApi* build_api) : build_api_(build_api) {}
+
+  std::vector<Artifact> Artifacts(const Build& build) {
+    return build_api_->Artifacts(build);
+  }
+
+  void Prefetch(const Build& build, const std::string& artifact,
+                const std::string& path) {
+    auto key = Key(build, artifact);
+    auto existing = downloads_.find(path);
+    if (existing != downloads_.end()) {
+      // A different artifact at the same path is downloaded when it is
+      // needed, rather than over this one.
+      if (existing->second.key == key) {
+        existing->second.users++;
+      }
+      return;
+    }
+    auto download = std::async(std::launch::async,
+                               [this, build, artifact, path]() {
+      return build_api_->ArtifactToFile(build, artifact, path);
+    });
+    downloads_.emplace(path, PendingDownload{key, 1, download.share()});
+  }
+
+  bool ArtifactToFile(const Build& build, const std::string& artifact,
+                      const std::string& path) {
+    auto pending = downloads_.find(path);
+    if (pending == downloads_.end()) {
+      return build_api_->ArtifactToFile(build, artifact, path);
+    }
+    if (pending->second.key != Key(build, artifact)) {
+      LOG(WARNING) << "Both " << pending->second.key << " and "
+                   << Key(build, artifact) << " are fetched to " << path;
+      pending->second.result.wait();
+      return build_api_->ArtifactToFile(build, artifact, path);
+    }
+    return pending->second.result.get();
+  }
+
+  /**
+   * Returns whether `path` may be deleted once `build` is done with it, which
+   * is when no other prefetched use of the same download is left.
+   */
+  bool Release(const Build& build, const std::string& artifact,
+               const std::string& path) {
+    auto pending = downloads_.find(path);
+    if (pending == downloads_.end() ||
+        pending->second.key != Key(build, artifact)) {
+      return true;
+    }
+    if (--pending->second.users > 0) {
+      return false;
+    }
+    downloads_.erase(pending);
+    return true;
+  }
+
+private:
+  struct PendingDownload {
+    std::string key;
+    int users;
+    std::shared_future<bool> result;
+  };
+
+  static std::string Key(const Build& build, const std::string& artifact) {
+    std::stringstream key;
+    key << build << ":" << artifact;
+    return key.str();
+  }
+
+  BuildApi* build_api_;
+  std::map<std::string, PendingDownload> downloads_;
+};
+
+/** Returns the first of `names` that `build` has as an artifact. */
+std::string FirstPresentArtifact(ArtifactFetcher* fetcher, const Build& build,
+                                 const std::vector<std::string>& names) {
+  auto artifacts = fetcher->Artifacts(build);
+  for (const auto& name : names) {
+    for (const auto& artifact : artifacts) {
+      if (artifact.Name() == name) {
+        return name;
+      }
+    }
+  }
+  return "";
+}
+
+void PrefetchTargetBuildZip(ArtifactFetcher* fetcher, const Build& build,
+                            const std::string& name,
+                            const std::string& target_directory) {
+  auto artifacts = fetcher->Artifacts(build);
+  std::string zip_name = TargetBuildZipFromArtifacts(build, name, artifacts);
+  if (zip_name.size() > 0) {
+    fetcher->Prefetch(build, zip_name, target_directory + "/" + zip_name);
+  }
+}
+
+std::vector<std::string> download_images(ArtifactFetcher* fetcher,
                                          const Build& build,
                                          const std::string& target_directory,
                                          const std::vector<std::string>& images) {
-  auto artifacts = build_api->Artifacts(build);
+  auto artifacts = fetcher->Artifacts(build);
   std::string img_zip_name = TargetBuildZipFromArtifacts(build, "img", artifacts);
   if (img_zip_name.size() == 0) {
     LOG(ERROR) << "Target " << build << " did not have an img zip";
     return {};
   }
   std::string local_path = target_directory + "/" + img_zip_name;
-  if (!build_api->ArtifactToFile(build, img_zip_name, local_path)) {
+  if (!fetcher->ArtifactToFile(build, img_zip_name, local_path)) {
     LOG(ERROR) << "Unable to download " << build << ":" << img_zip_name << " to "
                << local_path;
     return {};
   }
 
   std::vector<std::string> files = ExtractImages(local_path, target_directory, images);
+  // Another build may still extract its images from the same zip
+  bool last_use = fetcher->Release(build, img_zip_name, local_path);
   if (files.empty()) {
     LOG(ERROR) << "Could not extract " << local_path;
     return {};
   }
-  if (unlink(local_path.c_str()) != 0) {
+  if (last_use && unlink(local_path.c_str()) != 0) {
     LOG(ERROR) << "Could not delete " << local_path;
     files.push_back(local_path);
   }
   return files;
 }
-std::vector<std::string> download_images(BuildApi* build_api,
+std::vector<std::string> download_images(ArtifactFetcher* fetcher,
                                          const Build& build,
                                          const std::string& target_directory) {
-  return download_images(build_api, build, target_directory, {});
+  return download_images(fetcher, build, target_directory, {});
 }
 
-std::vector<std::string> download_target_files(BuildApi* build_api,
+std::vector<std::string> download_target_files(ArtifactFetcher* fetcher,
                                                const Build& build,
                                                const std::string& target_directory) {
-  auto artifacts = build_api->Artifacts(build);
+  auto artifacts = fetcher->Artifacts(build);
   std::string target_zip = TargetBuildZipFromArtifacts(build, "target_files", artifacts);
   if (target_zip.size() == 0) {
     LOG(ERROR) << "Target " << build << " did not have a target files zip";
     return {};
   }
   std::string local_path = target_directory + "/" + target_zip;
-  if (!build_api->ArtifactToFile(build, target_zip, local_path)) {
+  if (!fetcher->ArtifactToFile(build, target_zip, local_path)) {
     LOG(ERROR) << "Unable to download " << build << ":" << target_zip << " to "
                << local_path;
     return {};
@@ -139,10 +259,10 @@ std::vector<std::string> download_target_files(BuildApi* build_api,
   return {local_path};
 }
 
-std::vector<std::string> download_host_package(BuildApi* build_api,
+std::vector<std::string> download_host_package(ArtifactFetcher* fetcher,
                                                const Build& build,
                                                const std::string& target_directory) {
-  auto artifacts = build_api->Artifacts(build);
+  auto artifacts = fetcher->Artifacts(build);
   bool has_host_package = false;
   for (const auto& artifact : artifacts) {
     has_host_package |= artifact.Name() == HOST_TOOLS;
@@ -153,7 +273,7 @@ std::vector<std::string> download_host_package(BuildApi* build_api,
   }
   std::string local_path = target_directory + "/" + HOST_TOOLS;
 
-  if (!build_api->ArtifactToFile(build, HOST_TOOLS, local_path)) {
+  if (!fetcher->ArtifactToFile(build, HOST_TOOLS, local_path)) {
     LOG(ERROR) << "Unable to download " << build << ":" << HOST_TOOLS << " to "
                << local_path;
     return {};
@@ -175,10 +295,10 @@ std::vector<std::string> download_host_package(BuildApi* build_api,
   return files;
 }
 
-std::vector<std::string> download_ota_tools(BuildApi* build_api,
+std::vector<std::string> download_ota_tools(ArtifactFetcher* fetcher,
                                             const Build& build,
                                             const std::string& target_directory) {
-  auto artifacts = build_api->Artifacts(build);
+  auto artifacts = fetcher->Artifacts(build);
   bool has_host_package = false;
   for (const auto& artifact : artifacts) {
     has_host_package |= artifact.Name() == OTA_TOOLS;
@@ -189,7 +309,7 @@ std::vector<std::string> download_ota_tools(BuildApi* build_api,
   }
   std::string local_path = target_directory + "/" + OTA_TOOLS;
 
-  if (!build_api->ArtifactToFile(build, OTA_TOOLS, local_path)) {
+  if (!fetcher->ArtifactToFile(build, OTA_TOOLS, local_path)) {
     LOG(ERROR) << "Unable to download " << build << ":" << OTA_TOOLS << " to "
         << local_path;
     return {};
@@ -274,37 +394,117 @@ int FetchCvdMain(int argc, char** argv) {
     } else if (FLAGS_credential_source != "") {
       credential_source = FixedCredentialSource::make(FLAGS_credential_source);
     }
-    BuildApi build_api(std::move(credential_source));
+    std::unique_ptr<ArtifactCache> artifact_cache;
+    if (FLAGS_artifact_cache != "") {
+      artifact_cache.reset(
+          new ArtifactCache(AbsolutePath(FLAGS_artifact_cache)));
+    }
+    BuildApi build_api(std::move(credential_source), std::move(artifact_cache));
+    ArtifactFetcher fetcher(&build_api);
 
+    // Every build is resolved and its downloads started before anything is
+    // installed, so the downloads overlap. Each build starts downloading as
+    // soon as it is resolved, rather than after waiting on the later ones.
     auto default_build = ArgumentToBuild(&build_api, FLAGS_default_build,
                                          DEFAULT_BUILD_TARGET,
                                          retry_period);
+    fetcher.Prefetch(default_build, HOST_TOOLS, target_dir + "/" + HOST_TOOLS);
+
+    std::optional<Build> ota_build;
+    if (FLAGS_system_build != "" || FLAGS_kernel_build != "" || FLAGS_otatools_build != "") {
+      ota_build = default_build;
+      if (FLAGS_otatools_build != "") {
+        ota_build = ArgumentToBuild(&build_api, FLAGS_otatools_build,
+                                    DEFAULT_BUILD_TARGET, retry_period);
+      }
+      fetcher.Prefetch(*ota_build, OTA_TOOLS, target_dir + "/" + OTA_TOOLS);
+    }
+    if (FLAGS_download_img_zip) {
+      PrefetchTargetBuildZip(&fetcher, default_build, "img", target_dir);
+    }
+    std::string default_target_dir = target_dir + "/default";
+    if (FLAGS_system_build != "" || FLAGS_download_target_files_zip) {
+      if (mkdir(default_target_dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) < 0) {
+        LOG(FATAL) << "Could not create " << default_target_dir;
+      }
+      PrefetchTargetBuildZip(&fetcher, default_build, "target_files",
+                             default_target_dir);
+    }
+
+    std::optional<Build> system_build;
+    std::string system_target_dir = target_dir + "/system";
+    if (FLAGS_system_build != "") {
+      system_build = ArgumentToBuild(&build_api, FLAGS_system_build,
+                                     DEFAULT_BUILD_TARGET,
+                                     retry_period);
+      if (FLAGS_download_img_zip) {
+        PrefetchTargetBuildZip(&fetcher, *system_build, "img", target_dir);
+      }
+      if (mkdir(system_target_dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) < 0) {
+        LOG(FATAL) << "Could not create " << system_target_dir;
+      }
+      PrefetchTargetBuildZip(&fetcher, *system_build, "target_files",
+                             system_target_dir);
+    }
+
+    std::optional<Build> kernel_build;
+    std::string kernel_artifact;
+    bool has_initramfs = false;
+    if (FLAGS_kernel_build != "") {
+      kernel_build = ArgumentToBuild(&build_api, FLAGS_kernel_build,
+                                     "kernel", retry_period);
+      // If the kernel is from an arm/aarch64 build, the artifact will be called
+      // Image.
+      kernel_artifact =
+          FirstPresentArtifact(&fetcher, *kernel_build, {"bzImage", "Image"});
+      if (kernel_artifact != "") {
+        fetcher.Prefetch(*kernel_build, kernel_artifact, target_dir + "/kernel");
+      }
+      has_initramfs =
+          FirstPresentArtifact(&fetcher, *kernel_build, {"initramfs.img"}) != "";
+      if (has_initramfs) {
+        fetcher.Prefetch(*kernel_build, "initramfs.img",
+                         target_dir + "/initramfs.img");
+      }
+    }
+
+    std::optional<Build> bootloader_build;
+    std::string bootloader_artifact;
+    if (FLAGS_bootloader_build != "") {
+      bootloader_build = ArgumentToBuild(&build_api,
+                                         FLAGS_bootloader_build,
+                                         "u-boot_crosvm_x86_64",
+                                         retry_period);
+      // If the bootloader is from an arm/aarch64 build, the artifact will be of
+      // filetype bin.
+      bootloader_artifact = FirstPresentArtifact(
+          &fetcher, *bootloader_build, {"u-boot.rom", "u-boot.bin"});
+      if (bootloader_artifact != "") {
+        fetcher.Prefetch(*bootloader_build, bootloader_artifact,
+                         target_dir + "/bootloader");
+      }
+    }
 
     std::vector<std::string> host_package_files =
-        download_host_package(&build_api, default_build, target_dir);
+        download_host_package(&fetcher, default_build, target_dir);
     if (host_package_files.empty()) {
       LOG(FATAL) << "Could not download host package for " << default_build;
     }
     AddFilesToConfig(FileSource::DEFAULT_BUILD, default_build,
                      host_package_files, &config, target_dir);
 
-    if (FLAGS_system_build != "" || FLAGS_kernel_build != "" || FLAGS_otatools_build != "") {
-      auto ota_build = default_build;
-      if (FLAGS_otatools_build != "") {
-        ota_build = ArgumentToBuild(&build_api, FLAGS_otatools_build,
-                                    DEFAULT_BUILD_TARGET, retry_period);
-      }
+    if (ota_build) {
       std::vector<std::string> ota_tools_files =
-          download_ota_tools(&build_api, ota_build, target_dir);
+          download_ota_tools(&fetcher, *ota_build, target_dir);
       if (ota_tools_files.empty()) {
-        LOG(FATAL) << "Could not download ota tools for " << ota_build;
+        LOG(FATAL) << "Could not download ota tools for " << *ota_build;
       }
       AddFilesToConfig(FileSource::DEFAULT_BUILD, default_build,
                        ota_tools_files, &config, target_dir);
     }
     if (FLAGS_download_img_zip) {
       std::vector<std::string> image_files =
-          download_images(&build_api, default_build, target_dir);
+          download_images(&fetcher, default_build, target_dir);
       if (image_files.empty()) {
         LOG(FATAL) << "Could not download images for " << default_build;
       }
@@ -316,12 +516,8 @@ int FetchCvdMain(int argc, char** argv) {
                        &config, target_dir);
     }
     if (FLAGS_system_build != "" || FLAGS_download_target_files_zip) {
-      std::string default_target_dir = target_dir + "/default";
-      if (mkdir(default_target_dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) < 0) {
-        LOG(FATAL) << "Could not create " << default_target_dir;
-      }
       std::vector<std::string> target_files =
-          download_target_files(&build_api, default_build, default_target_dir);
+          download_target_files(&fetcher, default_build, default_target_dir);
       if (target_files.empty()) {
         LOG(FATAL) << "Could not download target files for " << default_build;
       }
@@ -330,37 +526,30 @@ int FetchCvdMain(int argc, char** argv) {
                        &config, target_dir);
     }
 
-    if (FLAGS_system_build != "") {
-      auto system_build = ArgumentToBuild(&build_api, FLAGS_system_build,
-                                          DEFAULT_BUILD_TARGET,
-                                          retry_period);
+    if (system_build) {
       bool system_in_img_zip = true;
       if (FLAGS_download_img_zip) {
         std::vector<std::string> image_files =
-            download_images(&build_api, system_build, target_dir,
+            download_images(&fetcher, *system_build, target_dir,
                             {"system.img", "product.img"});
         if (image_files.empty()) {
-          LOG(INFO) << "Could not find system image for " << system_build
+          LOG(INFO) << "Could not find system image for " << *system_build
                     << "in the img zip. Assuming a super image build, which will "
                     << "get the system image from the target zip.";
           system_in_img_zip = false;
         } else {
           LOG(INFO) << "Adding img-zip files for system build";
-          AddFilesToConfig(FileSource::SYSTEM_BUILD, system_build, image_files,
+          AddFilesToConfig(FileSource::SYSTEM_BUILD, *system_build, image_files,
                            &config, target_dir, true);
         }
       }
-      std::string system_target_dir = target_dir + "/system";
-      if (mkdir(system_target_dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) < 0) {
-        LOG(FATAL) << "Could not create " << system_target_dir;
-      }
       std::vector<std::string> target_files =
-          download_target_files(&build_api, system_build, system_target_dir);
+          download_target_files(&fetcher, *system_build, system_target_dir);
       if (target_files.empty()) {
-        LOG(FATAL) << "Could not download target files for " << system_build;
+        LOG(FATAL) << "Could not download target files for " << *system_build;
         return -1;
       }
-      AddFilesToConfig(FileSource::SYSTEM_BUILD, system_build, target_files,
+      AddFilesToConfig(FileSource::SYSTEM_BUILD, *system_build, target_files,
                        &config, target_dir);
       if (!system_in_img_zip) {
         if (ExtractImages(target_files[0], target_dir, {"IMAGES/system.img"})
@@ -416,59 +605,37 @@ int FetchCvdMain(int argc, char** argv) {
       }
     }
 
-    if (FLAGS_kernel_build != "") {
-      auto kernel_build = ArgumentToBuild(&build_api, FLAGS_kernel_build,
-                                          "kernel", retry_period);
-
+    if (kernel_build) {
       std::string local_path = target_dir + "/kernel";
-      if (build_api.ArtifactToFile(kernel_build, "bzImage", local_path)) {
-        AddFilesToConfig(FileSource::KERNEL_BUILD, kernel_build, {local_path},
-                         &config, target_dir);
-      }
-      // If the kernel is from an arm/aarch64 build, the artifact will be called
-      // Image.
-      else if (build_api.ArtifactToFile(kernel_build, "Image", local_path)) {
-        AddFilesToConfig(FileSource::KERNEL_BUILD, kernel_build, {local_path},
+      if (kernel_artifact != "" &&
+          fetcher.ArtifactToFile(*kernel_build, kernel_artifact, local_path)) {
+        AddFilesToConfig(FileSource::KERNEL_BUILD, *kernel_build, {local_path},
                          &config, target_dir);
       } else {
-        LOG(FATAL) << "Could not download " << kernel_build << ":bzImage to "
+        LOG(FATAL) << "Could not download " << *kernel_build << ":bzImage to "
             << local_path;
       }
-      std::vector<Artifact> kernel_artifacts = build_api.Artifacts(kernel_build);
-      for (const auto& artifact : kernel_artifacts) {
-        if (artifact.Name() != "initramfs.img") {
-          continue;
-        }
-        bool downloaded = build_api.ArtifactToFile(
-            kernel_build, "initramfs.img", target_dir + "/initramfs.img");
+      if (has_initramfs) {
+        bool downloaded = fetcher.ArtifactToFile(
+            *kernel_build, "initramfs.img", target_dir + "/initramfs.img");
         if (!downloaded) {
-          LOG(FATAL) << "Could not download " << kernel_build << ":initramfs.img to "
+          LOG(FATAL) << "Could not download " << *kernel_build << ":initramfs.img to "
                      << target_dir + "/initramfs.img";
         }
-        AddFilesToConfig(FileSource::KERNEL_BUILD, kernel_build,
+        AddFilesToConfig(FileSource::KERNEL_BUILD, *kernel_build,
                          {target_dir + "/initramfs.img"}, &config, target_dir);
       }
     }
 
-    if (FLAGS_bootloader_build != "") {
-      auto bootloader_build = ArgumentToBuild(&build_api,
-                                              FLAGS_bootloader_build,
-                                              "u-boot_crosvm_x86_64",
-					      retry_period);
-
+    if (bootloader_build) {
       std::string local_path = target_dir + "/bootloader";
-      if (build_api.ArtifactToFile(bootloader_build, "u-boot.rom", local_path)) {
-        AddFilesToConfig(FileSource::BOOTLOADER_BUILD, bootloader_build,
-                         {local_path}, &config, target_dir, true);
-      }
-      // If the bootloader is from an arm/aarch64 build, the artifact will be of
-      // filetype bin.
-      else if (build_api.ArtifactToFile(bootloader_build, "u-boot.bin",
-                                        local_path)) {
-        AddFilesToConfig(FileSource::BOOTLOADER_BUILD, bootloader_build,
+      if (bootloader_artifact != "" &&
+          fetcher.ArtifactToFile(*bootloader_build, bootloader_artifact,
+                                 local_path)) {
+        AddFilesToConfig(FileSource::BOOTLOADER_BUILD, *bootloader_build,
                          {local_path}, &config, target_dir, true);
       } else {
-        LOG(FATAL) << "Could not download " << bootloader_build << ":u-boot.rom to "
+        LOG(FATAL) << "Could not download " << *bootloader_build << ":u-boot.rom to "
             << local_path;
       }
     }
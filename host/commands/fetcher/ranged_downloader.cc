@@ -0,0 +1,398 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ranged_downloader.h"
+
+#include <stdlib.h>
+#include <strings.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+#include <curl/curl.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+const std::string PARTIAL_EXTENSION = ".partial";
+const std::string CHUNKS_EXTENSION = ".chunks";
+
+struct CurlDeleter {
+  void operator()(CURL* curl) { curl_easy_cleanup(curl); }
+};
+using CurlHandle = std::unique_ptr<CURL, CurlDeleter>;
+
+struct SlistDeleter {
+  void operator()(curl_slist* list) { curl_slist_free_all(list); }
+};
+using CurlSlist = std::unique_ptr<curl_slist, SlistDeleter>;
+
+CurlSlist BuildSlist(const std::vector<std::string>& strings) {
+  curl_slist* list = nullptr;
+  for (const auto& str : strings) {
+    curl_slist* temp = curl_slist_append(list, str.c_str());
+    if (temp == nullptr) {
+      LOG(ERROR) << "curl_slist_append failed to add " << str;
+      curl_slist_free_all(list);
+      return CurlSlist();
+    }
+    list = temp;
+  }
+  return CurlSlist(list);
+}
+
+// Writes a response body into a file starting at `offset`. With `end` set, a
+// body running past it is treated as an error rather than corrupting the
+// neighbouring range.
+struct RangeWriter {
+  SharedFD fd;
+  off_t offset;
+  off_t end;
+};
+
+size_t RangeWriteCallback(char* ptr, size_t size, size_t nmemb,
+                          void* userdata) {
+  auto writer = reinterpret_cast<RangeWriter*>(userdata);
+  size_t length = size * nmemb;
+  if (writer->end >= 0 &&
+      writer->offset + static_cast<off_t>(length) > writer->end) {
+    return 0;
+  }
+  size_t written = 0;
+  while (written < length) {
+    ssize_t ret = writer->fd->PWrite(ptr + written, length - written,
+                                     writer->offset + written);
+    if (ret <= 0) {
+      return 0;
+    }
+    written += ret;
+  }
+  writer->offset += length;
+  return length;
+}
+
+size_t HeaderCallback(char* ptr, size_t size, size_t nmemb, void* userdata) {
+  reinterpret_cast<std::string*>(userdata)->append(ptr, size * nmemb);
+  return size * nmemb;
+}
+
+// Accepts the single byte asked for by the probe, and aborts the transfer if
+// the server ignores the range and starts sending the whole body.
+size_t ProbeWriteCallback(char*, size_t size, size_t nmemb, void* userdata) {
+  auto received = reinterpret_cast<size_t*>(userdata);
+  *received += size * nmemb;
+  return *received > 1 ? 0 : size * nmemb;
+}
+
+// Returns the total length from a "Content-Range: bytes 0-0/<total>" header.
+long long ParseContentRangeTotal(const std::string& headers) {
+  for (const auto& line : android::base::Split(headers, "\n")) {
+    const std::string kContentRange = "content-range:";
+    if (strncasecmp(line.c_str(), kContentRange.c_str(),
+                    kContentRange.size()) != 0) {
+      continue;
+    }
+    auto slash = line.rfind('/');
+    if (slash == std::string::npos) {
+      return -1;
+    }
+    char* end = nullptr;
+    long long total = strtoll(line.c_str() + slash + 1, &end, 10);
+    return end == line.c_str() + slash + 1 ? -1 : total;
+  }
+  return -1;
+}
+
+void SetCommonOptions(CURL* curl, const std::string& url,
+                      const std::string& ca_info, curl_slist* headers,
+                      char* error_buf) {
+  curl_easy_reset(curl);
+  curl_easy_setopt(curl, CURLOPT_CAINFO, ca_info.c_str());
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error_buf);
+  curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+  error_buf[0] = '\0';
+}
+
+std::vector<std::string> WithRange(std::vector<std::string> headers,
+                                   size_t begin, size_t end) {
+  headers.push_back("Range: bytes=" + std::to_string(begin) + "-" +
+                    std::to_string(end - 1));
+  return headers;
+}
+
+// Reads the set of chunks completed by an earlier attempt. The first line
+// records the layout, which has to match for the chunks to be reused.
+std::vector<bool> LoadCompletedChunks(const std::string& chunks_path,
+                                      const std::string& layout,
+                                      size_t num_chunks) {
+  std::vector<bool> completed(num_chunks, false);
+  if (!FileExists(chunks_path)) {
+    return completed;
+  }
+  auto lines = android::base::Split(ReadFile(chunks_path), "\n");
+  if (lines.empty() || lines[0] != layout) {
+    LOG(INFO) << "Discarding partial download with a different layout";
+    return completed;
+  }
+  for (size_t i = 1; i < lines.size(); i++) {
+    char* end = nullptr;
+    unsigned long index = strtoul(lines[i].c_str(), &end, 10);
+    // Only fully written lines count, a torn last line is ignored.
+    if (end != lines[i].c_str() && *end == '\0' && index < num_chunks &&
+        i + 1 < lines.size()) {
+      completed[index] = true;
+    }
+  }
+  return completed;
+}
+
+} // namespace
+
+RangedDownloader::RangedDownloader(RangedDownloadOptions options)
+    : options_(std::move(options)) {}
+
+bool RangedDownloader::DownloadToFile(const std::string& url,
+                                      const std::string& path,
+                                      const std::vector<std::string>& headers) {
+  LOG(INFO) << "Attempting to save \"" << url << "\" to \"" << path << "\"";
+  auto start = std::chrono::steady_clock::now();
+  long long size = ProbeRangedSize(url, headers);
+  bool success;
+  if (size >= 0 && static_cast<size_t>(size) >= options_.min_ranged_size) {
+    success = DownloadRanges(url, path, headers, size);
+  } else {
+    success = DownloadSingleStream(url, path, headers);
+  }
+  if (success) {
+    auto elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start);
+    LOG(INFO) << "Downloaded \"" << path << "\" (" << FileSize(path)
+              << " bytes) in " << elapsed.count() << "s";
+  }
+  return success;
+}
+
+long long RangedDownloader::ProbeRangedSize(
+    const std::string& url, const std::vector<std::string>& headers) {
+  CurlHandle curl(curl_easy_init());
+  if (!curl) {
+    LOG(ERROR) << "failed to initialize curl";
+    return -1;
+  }
+  auto curl_headers = BuildSlist(WithRange(headers, 0, 1));
+  char error_buf[CURL_ERROR_SIZE];
+  SetCommonOptions(curl.get(), url, options_.ca_info, curl_headers.get(),
+                   error_buf);
+  std::string response_headers;
+  size_t received = 0;
+  curl_easy_setopt(curl.get(), CURLOPT_HEADERFUNCTION, HeaderCallback);
+  curl_easy_setopt(curl.get(), CURLOPT_HEADERDATA, &response_headers);
+  curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, ProbeWriteCallback);
+  curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &received);
+  curl_easy_perform(curl.get());
+  long response_code = 0;
+  curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &response_code);
+  if (response_code != 206) {
+    LOG(DEBUG) << "Range requests not supported for \"" << url
+               << "\", response code was " << response_code;
+    return -1;
+  }
+  return ParseContentRangeTotal(response_headers);
+}
+
+bool RangedDownloader::DownloadSingleStream(
+    const std::string& url, const std::string& path,
+    const std::vector<std::string>& headers) {
+  CurlHandle curl(curl_easy_init());
+  if (!curl) {
+    LOG(ERROR) << "failed to initialize curl";
+    return false;
+  }
+  auto partial_path = path + PARTIAL_EXTENSION;
+  auto fd = SharedFD::Open(partial_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (!fd->IsOpen()) {
+    LOG(ERROR) << "could not open file " << partial_path << ": "
+               << fd->StrError();
+    return false;
+  }
+  auto curl_headers = BuildSlist(headers);
+  char error_buf[CURL_ERROR_SIZE];
+  SetCommonOptions(curl.get(), url, options_.ca_info, curl_headers.get(),
+                   error_buf);
+  RangeWriter writer{fd, 0, -1};
+  curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, RangeWriteCallback);
+  curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &writer);
+  curl_easy_setopt(curl.get(), CURLOPT_FAILONERROR, 1L);
+  CURLcode res = curl_easy_perform(curl.get());
+  if (res != CURLE_OK) {
+    LOG(ERROR) << "curl_easy_perform() failed. "
+        << "Code was \"" << res << "\". "
+        << "Strerror was \"" << curl_easy_strerror(res) << "\". "
+        << "Error buffer was \"" << error_buf << "\".";
+    return false;
+  }
+  fd->Close();
+  return RenameFile(partial_path, path);
+}
+
+bool RangedDownloader::DownloadRanges(const std::string& url,
+                                      const std::string& path,
+                                      const std::vector<std::string>& headers,
+                                      size_t size) {
+  auto partial_path = path + PARTIAL_EXTENSION;
+  auto chunks_path = partial_path + CHUNKS_EXTENSION;
+  size_t chunk_size = options_.chunk_size;
+  size_t num_chunks = (size + chunk_size - 1) / chunk_size;
+  std::string layout =
+      "size=" + std::to_string(size) + " chunk=" + std::to_string(chunk_size);
+
+  std::vector<bool> completed;
+  if (FileExists(partial_path)) {
+    completed = LoadCompletedChunks(chunks_path, layout, num_chunks);
+  } else {
+    completed.assign(num_chunks, false);
+  }
+  std::vector<size_t> pending;
+  for (size_t i = 0; i < num_chunks; i++) {
+    if (!completed[i]) {
+      pending.push_back(i);
+    }
+  }
+  if (pending.size() < num_chunks) {
+    LOG(INFO) << "Resuming \"" << path << "\", " << num_chunks - pending.size()
+              << " of " << num_chunks << " chunks already downloaded";
+  }
+
+  auto fd = SharedFD::Open(partial_path, O_RDWR | O_CREAT, 0644);
+  if (!fd->IsOpen() || fd->Truncate(size) != 0) {
+    LOG(ERROR) << "could not prepare file " << partial_path << ": "
+               << fd->StrError();
+    return false;
+  }
+  int chunks_flags = O_WRONLY | O_CREAT | O_APPEND;
+  if (pending.size() == num_chunks) {
+    chunks_flags |= O_TRUNC;
+  }
+  auto chunks_fd = SharedFD::Open(chunks_path, chunks_flags, 0644);
+  if (!chunks_fd->IsOpen()) {
+    LOG(ERROR) << "could not open file " << chunks_path << ": "
+               << chunks_fd->StrError();
+    return false;
+  }
+  if (pending.size() == num_chunks && WriteAll(chunks_fd, layout + "\n") < 0) {
+    LOG(ERROR) << "could not write " << chunks_path << ": "
+               << chunks_fd->StrError();
+    return false;
+  }
+
+  std::mutex chunks_mutex;
+  std::atomic<size_t> next_pending = 0;
+  std::atomic<bool> failed = false;
+  auto worker = [&]() {
+    // One handle per thread, so its connection is reused between chunks.
+    CurlHandle curl(curl_easy_init());
+    if (!curl) {
+      LOG(ERROR) << "failed to initialize curl";
+      failed = true;
+      return;
+    }
+    char error_buf[CURL_ERROR_SIZE];
+    for (size_t i = next_pending++; i < pending.size() && !failed;
+         i = next_pending++) {
+      size_t chunk = pending[i];
+      size_t begin = chunk * chunk_size;
+      size_t end = std::min(size, begin + chunk_size);
+      auto curl_headers = BuildSlist(WithRange(headers, begin, end));
+      bool chunk_done = false;
+      for (int attempt = 1; attempt <= options_.max_attempts && !chunk_done;
+           attempt++) {
+        SetCommonOptions(curl.get(), url, options_.ca_info, curl_headers.get(),
+                         error_buf);
+        RangeWriter writer{fd, static_cast<off_t>(begin),
+                           static_cast<off_t>(end)};
+        curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, RangeWriteCallback);
+        curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &writer);
+        CURLcode res = curl_easy_perform(curl.get());
+        long response_code = 0;
+        curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &response_code);
+        chunk_done = res == CURLE_OK && response_code == 206 &&
+                     writer.offset == static_cast<off_t>(end);
+        if (!chunk_done) {
+          LOG(WARNING) << "Chunk " << chunk << " of \"" << path
+                       << "\" failed (attempt " << attempt << "): code "
+                       << res << ", response " << response_code << ", \""
+                       << error_buf << "\"";
+        }
+      }
+      if (!chunk_done) {
+        failed = true;
+        return;
+      }
+      // The chunk has to be on disk before the index says so, or a crash
+      // could resume over data that was never written.
+      if (fd->Fdatasync() != 0) {
+        LOG(ERROR) << "could not sync " << partial_path << ": "
+                   << fd->StrError();
+        failed = true;
+        return;
+      }
+      std::lock_guard<std::mutex> lock(chunks_mutex);
+      if (WriteAll(chunks_fd, std::to_string(chunk) + "\n") < 0) {
+        LOG(ERROR) << "could not record progress in " << chunks_path << ": "
+                   << chunks_fd->StrError();
+        failed = true;
+        return;
+      }
+    }
+  };
+  size_t num_threads =
+      std::max<size_t>(1, std::min(options_.max_connections, pending.size()));
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < num_threads; i++) {
+    threads.emplace_back(worker);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  if (failed) {
+    LOG(ERROR) << "Download of \"" << url << "\" failed, progress was kept in "
+               << partial_path << " for the next attempt";
+    return false;
+  }
+  fd->Close();
+  chunks_fd->Close();
+  if (!RenameFile(partial_path, path)) {
+    LOG(ERROR) << "Could not move " << partial_path << " to " << path;
+    return false;
+  }
+  RemoveFile(chunks_path);
+  return true;
+}
+
+} // namespace cuttlefish
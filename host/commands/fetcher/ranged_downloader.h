@@ -0,0 +1,65 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+namespace cuttlefish {
+
+struct RangedDownloadOptions {
+  // Size of each HTTP range request, and the unit of resumption.
+  size_t chunk_size = 64 << 20;
+  // Maximum number of concurrent range requests for one file.
+  size_t max_connections = 8;
+  // Files smaller than this are fetched with a single request.
+  size_t min_ranged_size = 128 << 20;
+  // Attempts per chunk before giving up on the whole download.
+  int max_attempts = 3;
+  std::string ca_info = "/etc/ssl/certs/ca-certificates.crt";
+};
+
+/**
+ * Downloads a URL to a file using concurrent HTTP range requests when the
+ * server supports them.
+ *
+ * Data is written to `path + ".partial"` and the completed chunks are recorded
+ * in `path + ".partial.chunks"`, so an interrupted download of the same file
+ * resumes where it stopped. The file only appears at `path` once complete.
+ */
+class RangedDownloader {
+public:
+  RangedDownloader(RangedDownloadOptions options = {});
+
+  bool DownloadToFile(const std::string& url, const std::string& path,
+                      const std::vector<std::string>& headers = {});
+
+private:
+  // Returns the size of the resource, or -1 if the server doesn't support
+  // range requests.
+  long long ProbeRangedSize(const std::string& url,
+                            const std::vector<std::string>& headers);
+  bool DownloadSingleStream(const std::string& url, const std::string& path,
+                            const std::vector<std::string>& headers);
+  bool DownloadRanges(const std::string& url, const std::string& path,
+                      const std::vector<std::string>& headers, size_t size);
+
+  RangedDownloadOptions options_;
+};
+
+} // namespace cuttlefish
@@ -0,0 +1,362 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/fetcher/ranged_downloader.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/strings.h>
+#include <curl/curl.h>
+#include <gtest/gtest.h>
+
+#include "common/libs/utils/files.h"
+#include "host/commands/fetcher/artifact_cache.h"
+
+namespace cuttlefish {
+namespace {
+
+/**
+ * A minimal HTTP/1.1 server on the loopback interface, standing in for the
+ * artifact storage servers. It serves one body, honoring single byte ranges
+ * when `ranges` is set, and fails range requests starting at or after
+ * `fail_from` when that is set.
+ */
+class LocalHttpServer {
+public:
+  LocalHttpServer(std::string body) : body_(std::move(body)) {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    socklen_t addr_len = sizeof(addr);
+    getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &addr_len);
+    port_ = ntohs(addr.sin_port);
+    listen(listen_fd_, 16);
+    accept_thread_ = std::thread([this]() { AcceptLoop(); });
+  }
+
+  ~LocalHttpServer() {
+    shutdown(listen_fd_, SHUT_RDWR);
+    close(listen_fd_);
+    accept_thread_.join();
+    for (auto& thread : connection_threads_) {
+      thread.join();
+    }
+  }
+
+  std::string Url() const {
+    return "http://127.0.0.1:" + std::to_string(port_) + "/artifact";
+  }
+
+  std::atomic<bool> ranges = true;
+  std::atomic<long long> fail_from = -1;
+  std::atomic<size_t> body_bytes_sent = 0;
+
+private:
+  void AcceptLoop() {
+    while (true) {
+      int fd = accept(listen_fd_, nullptr, nullptr);
+      if (fd < 0) {
+        return;
+      }
+      connection_threads_.emplace_back([this, fd]() {
+        Serve(fd);
+        close(fd);
+      });
+    }
+  }
+
+  void Serve(int fd) {
+    std::string buffer;
+    char data[4096];
+    while (true) {
+      auto end_of_headers = buffer.find("\r\n\r\n");
+      if (end_of_headers == std::string::npos) {
+        ssize_t read_size = read(fd, data, sizeof(data));
+        if (read_size <= 0) {
+          return;
+        }
+        buffer.append(data, read_size);
+        continue;
+      }
+      std::string request = buffer.substr(0, end_of_headers);
+      buffer.erase(0, end_of_headers + 4);
+      if (!Respond(fd, request)) {
+        return;
+      }
+    }
+  }
+
+  bool Respond(int fd, const std::string& request) {
+    size_t begin = 0;
+    size_t end = body_.size();
+    bool ranged = false;
+    for (const auto& line : android::base::Split(request, "\r\n")) {
+      if (ranges && android::base::StartsWithIgnoreCase(line, "range:")) {
+        auto spec = line.substr(line.find('=') + 1);
+        begin = std::stoull(spec.substr(0, spec.find('-')));
+        end = std::stoull(spec.substr(spec.find('-') + 1)) + 1;
+        ranged = true;
+      }
+    }
+    std::string response;
+    if (ranged && fail_from >= 0 && static_cast<long long>(begin) >= fail_from) {
+      response = "HTTP/1.1 503 Service Unavailable\r\n"
+                 "Content-Length: 0\r\n\r\n";
+      return WriteString(fd, response);
+    }
+    if (ranged) {
+      response = "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes " +
+                 std::to_string(begin) + "-" + std::to_string(end - 1) + "/" +
+                 std::to_string(body_.size()) + "\r\n";
+    } else {
+      response = "HTTP/1.1 200 OK\r\n";
+    }
+    response += "Content-Length: " + std::to_string(end - begin) + "\r\n\r\n";
+    if (!WriteString(fd, response)) {
+      return false;
+    }
+    if (!WriteString(fd, body_.substr(begin, end - begin))) {
+      return false;
+    }
+    body_bytes_sent += end - begin;
+    return true;
+  }
+
+  bool WriteString(int fd, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+      ssize_t ret = send(fd, data.data() + written, data.size() - written,
+                         MSG_NOSIGNAL);
+      if (ret <= 0) {
+        return false;
+      }
+      written += ret;
+    }
+    return true;
+  }
+
+  std::string body_;
+  int listen_fd_;
+  int port_;
+  std::thread accept_thread_;
+  std::vector<std::thread> connection_threads_;
+};
+
+std::string RandomBody(size_t size) {
+  std::mt19937 generator(size);
+  std::string body(size, '\0');
+  for (auto& c : body) {
+    c = static_cast<char>(generator());
+  }
+  return body;
+}
+
+RangedDownloadOptions TestOptions() {
+  RangedDownloadOptions options;
+  options.chunk_size = 64 << 10;
+  options.max_connections = 4;
+  options.min_ranged_size = 0;
+  options.max_attempts = 1;
+  return options;
+}
+
+class RangedDownloaderTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    path_ = std::string(temp_dir_.path) + "/artifact";
+  }
+  void TearDown() override { curl_global_cleanup(); }
+
+  TemporaryDir temp_dir_;
+  std::string path_;
+};
+
+TEST_F(RangedDownloaderTest, DownloadsInRanges) {
+  auto body = RandomBody((1 << 20) + 123);
+  LocalHttpServer server(body);
+
+  ASSERT_TRUE(RangedDownloader(TestOptions()).DownloadToFile(server.Url(),
+                                                             path_));
+  ASSERT_EQ(ReadFile(path_), body);
+  ASSERT_FALSE(FileExists(path_ + ".partial"));
+  ASSERT_FALSE(FileExists(path_ + ".partial.chunks"));
+}
+
+TEST_F(RangedDownloaderTest, FallsBackWithoutRangeSupport) {
+  auto body = RandomBody(300 << 10);
+  LocalHttpServer server(body);
+  server.ranges = false;
+
+  ASSERT_TRUE(RangedDownloader(TestOptions()).DownloadToFile(server.Url(),
+                                                             path_));
+  ASSERT_EQ(ReadFile(path_), body);
+}
+
+TEST_F(RangedDownloaderTest, ResumesInterruptedDownload) {
+  auto body = RandomBody(1 << 20);
+  LocalHttpServer server(body);
+  server.fail_from = body.size() / 2;
+
+  ASSERT_FALSE(RangedDownloader(TestOptions()).DownloadToFile(server.Url(),
+                                                              path_));
+  ASSERT_FALSE(FileExists(path_));
+  ASSERT_TRUE(FileExists(path_ + ".partial.chunks"));
+
+  server.fail_from = -1;
+  size_t sent_before_resume = server.body_bytes_sent;
+  ASSERT_TRUE(RangedDownloader(TestOptions()).DownloadToFile(server.Url(),
+                                                             path_));
+  ASSERT_EQ(ReadFile(path_), body);
+  // The chunks below the failure point were not requested again.
+  ASSERT_LE(server.body_bytes_sent - sent_before_resume,
+            body.size() / 2 + 1);
+}
+
+TEST_F(RangedDownloaderTest, ArtifactCacheDownloadsOnce) {
+  auto body = RandomBody(200 << 10);
+  LocalHttpServer server(body);
+  ArtifactCache cache(std::string(temp_dir_.path) + "/cache");
+  int downloads = 0;
+  auto download = [&server, &downloads](const std::string& path) {
+    downloads++;
+    return RangedDownloader(TestOptions()).DownloadToFile(server.Url(), path);
+  };
+
+  std::string first = std::string(temp_dir_.path) + "/first";
+  std::string second = std::string(temp_dir_.path) + "/second";
+  ASSERT_TRUE(cache.Fetch("1234", "target", "artifact.zip", first, download));
+  ASSERT_TRUE(cache.Fetch("1234", "target", "artifact.zip", second, download));
+  ASSERT_EQ(downloads, 1);
+  ASSERT_EQ(ReadFile(first), body);
+  ASSERT_EQ(ReadFile(second), body);
+}
+
+TEST_F(RangedDownloaderTest, ArtifactCacheRedownloadsModifiedEntry) {
+  auto body = RandomBody(64 << 10);
+  LocalHttpServer server(body);
+  ArtifactCache cache(std::string(temp_dir_.path) + "/cache");
+  int downloads = 0;
+  auto download = [&server, &downloads](const std::string& path) {
+    downloads++;
+    return RangedDownloader(TestOptions()).DownloadToFile(server.Url(), path);
+  };
+
+  std::string first = std::string(temp_dir_.path) + "/first";
+  std::string second = std::string(temp_dir_.path) + "/second";
+  ASSERT_TRUE(cache.Fetch("1234", "target", "artifact.zip", first, download));
+  // The owner can still make the destination writable, and writing to it
+  // reaches the entry.
+  ASSERT_EQ(chmod(first.c_str(), 0644), 0);
+  ASSERT_TRUE(android::base::WriteStringToFile("changed", first));
+  ASSERT_TRUE(cache.Fetch("1234", "target", "artifact.zip", second, download));
+  ASSERT_EQ(downloads, 2);
+  ASSERT_EQ(ReadFile(first), "changed");
+  ASSERT_EQ(ReadFile(second), body);
+}
+
+TEST_F(RangedDownloaderTest, ArtifactCacheHashesOnlyChangedEntries) {
+  LocalHttpServer server(RandomBody(64 << 10));
+  std::string cache_dir = std::string(temp_dir_.path) + "/cache";
+  ArtifactCache cache(cache_dir);
+  int downloads = 0;
+  auto download = [&server, &downloads](const std::string& path) {
+    downloads++;
+    return RangedDownloader(TestOptions()).DownloadToFile(server.Url(), path);
+  };
+
+  std::string destination = std::string(temp_dir_.path) + "/artifact";
+  ASSERT_TRUE(
+      cache.Fetch("1234", "target", "artifact.zip", destination, download));
+  // A wrong digest goes unnoticed while the entry keeps its size and time,
+  // showing it isn't hashed again.
+  std::string entry = cache_dir + "/1234/target/artifact.zip";
+  std::string stamp_path = entry + ".sha256";
+  std::string stamp;
+  ASSERT_TRUE(android::base::ReadFileToString(stamp_path, &stamp));
+  stamp.replace(0, 64, std::string(64, '0'));
+  ASSERT_EQ(unlink(stamp_path.c_str()), 0);
+  ASSERT_TRUE(android::base::WriteStringToFile(stamp, stamp_path));
+  ASSERT_EQ(chmod(stamp_path.c_str(), 0444), 0);
+  ASSERT_TRUE(
+      cache.Fetch("1234", "target", "artifact.zip", destination, download));
+  ASSERT_EQ(downloads, 1);
+
+  // Once the time changes it is, and doesn't match.
+  struct timespec times[2] = {{0, UTIME_OMIT}, {12345, 0}};
+  ASSERT_EQ(utimensat(AT_FDCWD, entry.c_str(), times, 0), 0);
+  ASSERT_TRUE(
+      cache.Fetch("1234", "target", "artifact.zip", destination, download));
+  ASSERT_EQ(downloads, 2);
+}
+
+TEST_F(RangedDownloaderTest, ArtifactCacheEntriesAreSharedReadOnly) {
+  LocalHttpServer server(RandomBody(1 << 10));
+  std::string cache_dir = std::string(temp_dir_.path) + "/cache";
+  ArtifactCache cache(cache_dir);
+  auto download = [&server](const std::string& path) {
+    return RangedDownloader(TestOptions()).DownloadToFile(server.Url(), path);
+  };
+
+  std::string destination = std::string(temp_dir_.path) + "/artifact";
+  ASSERT_TRUE(
+      cache.Fetch("1234", "target", "artifact.zip", destination, download));
+  struct stat st;
+  for (const auto& dir : {cache_dir, cache_dir + "/1234",
+                          cache_dir + "/1234/target"}) {
+    ASSERT_EQ(stat(dir.c_str(), &st), 0);
+    ASSERT_EQ(st.st_mode & 07777, 03775) << dir;
+  }
+  std::string entry = cache_dir + "/1234/target/artifact.zip";
+  for (const auto& file : {entry, entry + ".sha256", destination}) {
+    ASSERT_EQ(stat(file.c_str(), &st), 0);
+    ASSERT_EQ(st.st_mode & 0777, 0444) << file;
+  }
+}
+
+TEST_F(RangedDownloaderTest, ArtifactCacheBypassesUnsafeDirectory) {
+  std::string cache_dir = std::string(temp_dir_.path) + "/cache";
+  ASSERT_EQ(mkdir(cache_dir.c_str(), 0700), 0);
+  ASSERT_EQ(chmod(cache_dir.c_str(), 0777), 0);
+  ArtifactCache cache(cache_dir);
+  std::vector<std::string> download_paths;
+  auto download = [&download_paths](const std::string& path) {
+    download_paths.push_back(path);
+    return true;
+  };
+
+  std::string destination = std::string(temp_dir_.path) + "/artifact";
+  ASSERT_TRUE(
+      cache.Fetch("1234", "target", "artifact.zip", destination, download));
+  ASSERT_EQ(download_paths, std::vector<std::string>{destination});
+}
+
+} // namespace
+} // namespace cuttlefish
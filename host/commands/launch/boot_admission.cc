@@ -0,0 +1,136 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/launch/boot_admission.h"
+
+#include <sched.h>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <android-base/logging.h>
+
+namespace {
+
+// procfs files report no size, so they can't go through ReadFile
+std::string ReadProcFile(const std::string& path) {
+  std::ifstream file(path);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+}  // namespace
+
+std::optional<BootAdmission::CpuTimes> ParseProcStatCpuTimes(
+    const std::string& proc_stat) {
+  // cpu  user nice system idle iowait irq softirq steal ...
+  std::istringstream stat(proc_stat);
+  std::string label;
+  stat >> label;
+  if (label != "cpu") {
+    return {};
+  }
+  std::uint64_t total = 0;
+  std::uint64_t idle = 0;
+  std::uint64_t value;
+  int field = 0;
+  for (; field < 8 && stat >> value; field++) {
+    total += value;
+    // iowait counts as idle, IO is throttled on its own
+    if (field == 3 || field == 4) {
+      idle += value;
+    }
+  }
+  // Kernels since 2.6.11 have all of these
+  if (field < 8) {
+    return {};
+  }
+  return BootAdmission::CpuTimes{total - idle, total};
+}
+
+std::optional<double> ParseIoPressure(const std::string& pressure) {
+  // some avg10=1.23 avg60=0.45 avg300=0.10 total=123456
+  // full avg10=0.50 avg60=0.20 avg300=0.05 total=65432
+  std::istringstream lines(pressure);
+  std::string kind, field;
+  while (lines >> kind >> field) {
+    if (kind == "some" && field.rfind("avg10=", 0) == 0) {
+      std::istringstream avg10(field.substr(6));
+      double percent;
+      if (avg10 >> percent) {
+        return percent;
+      }
+      return {};
+    }
+    lines.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+  }
+  return {};
+}
+
+int UsableCores() {
+  cpu_set_t cpus;
+  if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+    return CPU_COUNT(&cpus);
+  }
+  PLOG(WARNING) << "Could not get the CPU affinity, counting all host cores";
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+BootAdmission::BootAdmission(Limits limits) : limits_(limits) {
+  // Start measuring the CPU from here rather than from boot
+  CpuBusy();
+}
+
+std::optional<double> BootAdmission::CpuBusy() {
+  auto current = ParseProcStatCpuTimes(ReadProcFile("/proc/stat"));
+  if (!current) {
+    return {};
+  }
+  auto previous = last_cpu_times_;
+  last_cpu_times_ = current;
+  if (!previous || current->total <= previous->total) {
+    return {};
+  }
+  return static_cast<double>(current->busy - previous->busy) /
+         (current->total - previous->total);
+}
+
+bool BootAdmission::MayAdmit(int booting) {
+  // Sample even when the answer is known, so the next reading covers only
+  // the time since this one
+  auto cpu_busy = CpuBusy();
+  if (booting == 0) {
+    return true;
+  }
+  if (booting >= limits_.max_concurrent_boots) {
+    return false;
+  }
+  if (cpu_busy && *cpu_busy > limits_.max_cpu_busy) {
+    LOG(DEBUG) << "Holding back boots, the CPU is " << (*cpu_busy * 100)
+               << "% busy";
+    return false;
+  }
+  auto io_pressure = ParseIoPressure(ReadProcFile("/proc/pressure/io"));
+  if (io_pressure && *io_pressure > limits_.max_io_pressure) {
+    LOG(DEBUG) << "Holding back boots, IO pressure is " << *io_pressure << "%";
+    return false;
+  }
+  return true;
+}
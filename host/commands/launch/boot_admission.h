@@ -0,0 +1,70 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+/**
+ * Decides when launch_cvd may start booting one more instance.
+ *
+ * Booting guests all at once makes every one of them wait on the same disks
+ * and cores, so instances are let in while fewer than a fixed number are
+ * booting and the host isn't already saturated. The load is sampled from
+ * /proc/stat and, on kernels with PSI, /proc/pressure/io.
+ */
+class BootAdmission {
+public:
+  struct CpuTimes {
+    std::uint64_t busy;
+    std::uint64_t total;
+  };
+
+  struct Limits {
+    // instances allowed to boot at the same time
+    int max_concurrent_boots;
+    // fraction of the CPU time spent busy since the previous check, 0 to 1
+    double max_cpu_busy;
+    // percentage of time tasks were stalled on IO over the last 10 seconds
+    double max_io_pressure;
+  };
+
+  BootAdmission(Limits limits);
+
+  // Whether another instance may start booting while `booting` others are.
+  // An instance is always let in when none is booting, so a busy host slows
+  // the launch down but never stalls it.
+  bool MayAdmit(int booting);
+
+private:
+  std::optional<double> CpuBusy();
+
+  Limits limits_;
+  std::optional<CpuTimes> last_cpu_times_;
+};
+
+// The aggregate "cpu" line of /proc/stat contents. iowait counts as idle.
+std::optional<BootAdmission::CpuTimes> ParseProcStatCpuTimes(
+    const std::string& proc_stat);
+
+// The "some avg10" figure of /proc/pressure/io contents, the percentage of the
+// last 10 seconds in which at least one task waited on IO.
+std::optional<double> ParseIoPressure(const std::string& pressure);
+
+// The cores this process may run on, which is less than the host has under
+// taskset or a cgroup cpuset.
+int UsableCores();
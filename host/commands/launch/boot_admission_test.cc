@@ -0,0 +1,62 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/launch/boot_admission.h"
+
+#include <gtest/gtest.h>
+
+TEST(ParseProcStatCpuTimes, CountsIowaitAsIdle) {
+  auto times = ParseProcStatCpuTimes(
+      "cpu  100 20 30 400 50 6 7 8 9 10\n"
+      "cpu0 50 10 15 200 25 3 3 4 4 5\n"
+      "intr 123456\n");
+  ASSERT_TRUE(times);
+  // user nice system irq softirq steal, guest time is already in user
+  EXPECT_EQ(times->busy, 100u + 20 + 30 + 6 + 7 + 8);
+  EXPECT_EQ(times->total, 100u + 20 + 30 + 400 + 50 + 6 + 7 + 8);
+}
+
+TEST(ParseProcStatCpuTimes, RejectsOtherContents) {
+  EXPECT_FALSE(ParseProcStatCpuTimes(""));
+  EXPECT_FALSE(ParseProcStatCpuTimes("cpu0 1 2 3 4 5 6 7 8\n"));
+  EXPECT_FALSE(ParseProcStatCpuTimes("cpu  1 2 3 4\n"));
+  EXPECT_FALSE(ParseProcStatCpuTimes("cpu  1 2 3 4 five 6 7 8\n"));
+}
+
+TEST(ParseIoPressure, ReadsSomeAvg10) {
+  auto pressure = ParseIoPressure(
+      "some avg10=12.34 avg60=5.00 avg300=1.00 total=123456\n"
+      "full avg10=3.21 avg60=1.00 avg300=0.50 total=65432\n");
+  ASSERT_TRUE(pressure);
+  EXPECT_DOUBLE_EQ(*pressure, 12.34);
+
+  pressure = ParseIoPressure(
+      "full avg10=3.21 avg60=1.00 avg300=0.50 total=65432\n"
+      "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+  ASSERT_TRUE(pressure);
+  EXPECT_DOUBLE_EQ(*pressure, 0);
+}
+
+TEST(ParseIoPressure, RejectsOtherContents) {
+  // Kernels without PSI have no file to read
+  EXPECT_FALSE(ParseIoPressure(""));
+  EXPECT_FALSE(ParseIoPressure("full avg10=3.21 avg60=1.00\n"));
+  EXPECT_FALSE(ParseIoPressure("some avg60=1.00 avg10=3.21\n"));
+  EXPECT_FALSE(ParseIoPressure("some avg10=high avg60=1.00\n"));
+}
+
+TEST(UsableCores, CountsAtLeastOne) {
+  EXPECT_GE(UsableCores(), 1);
+}
@@ -13,7 +13,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <fstream>
 
@@ -22,8 +25,11 @@
 
 #include "common/libs/fs/shared_buf.h"
 #include "common/libs/fs/shared_fd.h"
+#include "common/libs/fs/shared_select.h"
 #include "common/libs/utils/subprocess.h"
+#include "host/commands/launch/boot_admission.h"
 #include "host/commands/launch/filesystem_explorer.h"
+#include "host/commands/run_cvd/runner_defs.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/config/host_tools_version.h"
 #include "host/libs/config/fetcher_config.h"
@@ -54,6 +60,24 @@ DEFINE_string(verbosity, "INFO", "Console logging verbosity. Options are VERBOSE
 DEFINE_string(file_verbosity, "DEBUG",
               "Log file logging verbosity. Options are VERBOSE,DEBUG,INFO,"
               "WARNING,ERROR");
+DEFINE_bool(boot_admission, false,
+            "Start booting the `-num_instances` devices as the host can take "
+            "them, rather than all at once. Fewer devices boot at the same "
+            "time, so the first ones are up sooner, at the cost of holding "
+            "the rest back while the host is busy.");
+DEFINE_int32(max_concurrent_boots, 0,
+             "With `-boot_admission`, how many devices may boot at the same "
+             "time. 0 allows one for every 4 cores launch_cvd may run on.");
+DEFINE_double(boot_admission_max_cpu, 0.8,
+              "With `-boot_admission`, don't start booting another device "
+              "while the host CPUs are busier than this fraction of the time.");
+DEFINE_double(boot_admission_max_io_pressure, 40,
+              "With `-boot_admission`, don't start booting another device "
+              "while tasks have been stalled on IO for more than this "
+              "percentage of the last 10 seconds.");
+DEFINE_int32(boot_admission_timeout, 1000,
+             "How many seconds launch_cvd waits for a device to boot. With "
+             "`-boot_admission`, its slot is then given to the next one.");
 
 namespace {
 
@@ -75,15 +99,81 @@ cuttlefish::Subprocess StartAssembler(cuttlefish::SharedFD assembler_stdin,
 }
 
 cuttlefish::Subprocess StartRunner(cuttlefish::SharedFD runner_stdin,
+                            cuttlefish::SharedFD boot_notification,
                             const std::vector<std::string>& argv) {
   cuttlefish::Command run_cmd(kRunnerBin);
   for (const auto& arg : argv) {
     run_cmd.AddParameter(arg);
   }
+  run_cmd.AddParameter("--reboot_notification_fd=", boot_notification);
   run_cmd.RedirectStdIO(cuttlefish::Subprocess::StdIOChannel::kStdIn, runner_stdin);
   return run_cmd.Start();
 }
 
+using Clock = std::chrono::steady_clock;
+
+struct InstanceLaunch {
+  std::string instance_num;
+  // read end of the pipe run_cvd writes its boot result to
+  cuttlefish::SharedFD boot_notification;
+  Clock::time_point started;
+  Clock::time_point finished;
+  bool booted = false;
+};
+
+long long Milliseconds(Clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(duration)
+      .count();
+}
+
+void LogTimingSummary(const std::string& phase,
+                      std::vector<Clock::duration> durations) {
+  if (durations.empty()) {
+    return;
+  }
+  std::sort(durations.begin(), durations.end());
+  LOG(INFO) << phase << ": min " << Milliseconds(durations.front())
+            << "ms, median " << Milliseconds(durations[durations.size() / 2])
+            << "ms, max " << Milliseconds(durations.back()) << "ms";
+}
+
+// Reports where the time of a multi device launch went
+void LogLaunchTimings(Clock::time_point assembly_start,
+                      Clock::time_point queued,
+                      const std::vector<InstanceLaunch>& launches) {
+  LOG(INFO) << "Assembling the devices took "
+            << Milliseconds(queued - assembly_start) << "ms";
+  std::vector<Clock::duration> waits, boots;
+  for (const auto& launch : launches) {
+    waits.push_back(launch.started - queued);
+    boots.push_back(launch.finished - launch.started);
+    LOG(DEBUG) << "Device " << launch.instance_num << " waited "
+               << Milliseconds(waits.back()) << "ms to start booting and "
+               << (launch.booted ? "booted" : "failed to boot") << " in "
+               << Milliseconds(boots.back()) << "ms";
+  }
+  LogTimingSummary("Waiting to boot", waits);
+  LogTimingSummary("Booting", boots);
+  LOG(INFO) << "Launching " << launches.size() << " device(s) took "
+            << Milliseconds(Clock::now() - assembly_start) << "ms";
+}
+
+BootAdmission::Limits BootAdmissionLimits() {
+  if (!FLAGS_boot_admission) {
+    constexpr auto kNoLimit = std::numeric_limits<double>::infinity();
+    return {FLAGS_num_instances, kNoLimit, kNoLimit};
+  }
+  int max_concurrent_boots = FLAGS_max_concurrent_boots;
+  if (max_concurrent_boots <= 0) {
+    max_concurrent_boots = std::max(1, UsableCores() / 4);
+  }
+  return {
+      max_concurrent_boots,
+      FLAGS_boot_admission_max_cpu,
+      FLAGS_boot_admission_max_io_pressure,
+  };
+}
+
 void WriteFiles(cuttlefish::FetcherConfig fetcher_config, cuttlefish::SharedFD out) {
   std::stringstream output_streambuf;
   for (const auto& file : fetcher_config.get_cvd_files()) {
@@ -205,6 +295,7 @@ int main(int argc, char** argv) {
 
   // SharedFDs are std::move-d in to avoid dangling references.
   // Removing the std::move will probably make run_cvd hang as its stdin never closes.
+  auto assembly_start = Clock::now();
   auto assemble_proc = StartAssembler(std::move(assembler_stdin),
                                       std::move(assembler_stdout),
                                       forwarder.ArgvForSubprocess(kAssemblerBin));
@@ -227,22 +318,81 @@ int main(int argc, char** argv) {
   } else {
     LOG(DEBUG) << "assemble_cvd exited successfully.";
   }
+  auto queued = Clock::now();
 
+  // The devices are started in instance order as the host can take them. A
+  // boot slot is given back once run_cvd reports the boot as done or failed.
+  BootAdmission admission(BootAdmissionLimits());
+  const auto boot_timeout = std::chrono::seconds(FLAGS_boot_admission_timeout);
   std::vector<cuttlefish::Subprocess> runners;
-  for (int i = 0; i < FLAGS_num_instances; i++) {
-    cuttlefish::SharedFD runner_stdin_in, runner_stdin_out;
-    cuttlefish::SharedFD::Pipe(&runner_stdin_out, &runner_stdin_in);
-    std::string instance_name = std::to_string(i + FLAGS_base_instance_num);
-    setenv("CUTTLEFISH_INSTANCE", instance_name.c_str(), /* overwrite */ 1);
-
-    auto run_proc = StartRunner(std::move(runner_stdin_out),
-                                forwarder.ArgvForSubprocess(kRunnerBin));
-    runners.push_back(std::move(run_proc));
-    if (cuttlefish::WriteAll(runner_stdin_in, assembler_output) < 0) {
-      int error_num = errno;
-      LOG(ERROR) << "Could not write to run_cvd: " << strerror(error_num);
-      return -1;
+  std::vector<InstanceLaunch> launches;
+  std::vector<size_t> booting;
+  while (static_cast<int>(launches.size()) < FLAGS_num_instances ||
+         !booting.empty()) {
+    while (static_cast<int>(launches.size()) < FLAGS_num_instances &&
+           admission.MayAdmit(booting.size())) {
+      cuttlefish::SharedFD runner_stdin_in, runner_stdin_out;
+      cuttlefish::SharedFD::Pipe(&runner_stdin_out, &runner_stdin_in);
+      cuttlefish::SharedFD notification_in, notification_out;
+      cuttlefish::SharedFD::Pipe(&notification_out, &notification_in);
+      InstanceLaunch launch;
+      launch.instance_num =
+          std::to_string(launches.size() + FLAGS_base_instance_num);
+      setenv("CUTTLEFISH_INSTANCE", launch.instance_num.c_str(),
+             /* overwrite */ 1);
+
+      auto run_proc = StartRunner(std::move(runner_stdin_out),
+                                  std::move(notification_in),
+                                  forwarder.ArgvForSubprocess(kRunnerBin));
+      runners.push_back(std::move(run_proc));
+      if (cuttlefish::WriteAll(runner_stdin_in, assembler_output) < 0) {
+        int error_num = errno;
+        LOG(ERROR) << "Could not write to run_cvd: " << strerror(error_num);
+        return -1;
+      }
+      launch.boot_notification = notification_out;
+      launch.started = Clock::now();
+      booting.push_back(launches.size());
+      launches.push_back(std::move(launch));
+      LOG(DEBUG) << "Started booting device " << launches.back().instance_num;
+    }
+
+    cuttlefish::SharedFDSet notifications;
+    for (auto i : booting) {
+      notifications.Set(launches[i].boot_notification);
     }
+    struct timeval poll_interval = {1, 0};
+    cuttlefish::Select(&notifications, nullptr, nullptr, &poll_interval);
+
+    auto now = Clock::now();
+    auto still_booting = booting.begin();
+    for (auto i : booting) {
+      auto& launch = launches[i];
+      if (notifications.IsSet(launch.boot_notification)) {
+        // run_cvd closes the pipe without a result if it dies first
+        cuttlefish::RunnerExitCodes exit_code;
+        auto bytes_read =
+            launch.boot_notification->Read(&exit_code, sizeof(exit_code));
+        launch.booted = bytes_read == sizeof(exit_code) &&
+                        exit_code == cuttlefish::RunnerExitCodes::kSuccess;
+        if (!launch.booted) {
+          LOG(ERROR) << "Device " << launch.instance_num << " failed to boot";
+        }
+      } else if (now - launch.started > boot_timeout) {
+        LOG(WARNING) << "Device " << launch.instance_num << " didn't boot in "
+                     << FLAGS_boot_admission_timeout
+                     << " seconds, starting the next one";
+      } else {
+        *still_booting++ = i;
+        continue;
+      }
+      launch.finished = now;
+      launch.boot_notification->Close();
+    }
+    booting.erase(still_booting, booting.end());
+  }
+  if (FLAGS_num_instances > 1) {
+    LogLaunchTimings(assembly_start, queued, launches);
   }
 
   bool run_cvd_failure = false;
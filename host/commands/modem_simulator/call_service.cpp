@@ -189,26 +189,21 @@ void CallService::HandleDial(const Client& client, const std::string& command) {
     std::stringstream ss;
     ss << port;
     auto remote_port = ss.str();
-    auto remote_client = ConnectToRemoteCvd(remote_port);
-    if (!remote_client->IsOpen()) {
-      client.SendCommandResponse(kCmeErrorNoNetworkService);
-      return;
-    }
     auto local_host_port = GetHostPort();
     if (local_host_port == remote_port) {
       client.SendCommandResponse(kCmeErrorOperationNotAllowed);
       return;
     }
-
-    if (channel_monitor_) {
-      channel_monitor_->SetRemoteClient(remote_client, false);
+    auto remote_client = ConnectToRemoteCvd(remote_port);
+    if (!remote_client->IsOpen()) {
+      client.SendCommandResponse(kCmeErrorNoNetworkService);
+      return;
     }
 
     ss.clear();
     ss.str("");
     ss << "AT+REMOTECALL=4,0,0,\"" << local_host_port << "\",129";
 
-    SendCommandToRemote(remote_client, "REM0");
     SendCommandToRemote(remote_client, ss.str());
 
     CallStatus call_status(remote_port);
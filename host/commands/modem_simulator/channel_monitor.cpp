@@ -20,12 +20,35 @@
 #include <android-base/strings.h>
 
 #include <algorithm>
+#include <chrono>
 
 #include "host/commands/modem_simulator/modem_simulator.h"
 
 namespace cuttlefish {
 
 constexpr int32_t kMaxCommandLength = 4096;
+// Unused connections to other instances are kept open this long.
+constexpr auto kRemoteConnectionIdleTimeout = std::chrono::seconds(30);
+
+static cuttlefish::SharedFD ConnectToRemoteCvd(const std::string& port) {
+  std::string remote_sock_name = "modem_simulator" + port;
+  auto remote_sock = cuttlefish::SharedFD::SocketLocalClient(
+      remote_sock_name.c_str(), true, SOCK_STREAM);
+  if (!remote_sock->IsOpen()) {
+    LOG(ERROR) << "Failed to connect to remote cuttlefish: " << port
+               << ", error: " << remote_sock->StrError();
+    return remote_sock;
+  }
+  // Always talk to the first modem of the remote instance
+  std::string token = "REM0";
+  if (remote_sock->Write(token.data(), token.size()) !=
+      static_cast<ssize_t>(token.size())) {
+    LOG(ERROR) << "Failed to greet remote cuttlefish: " << port
+               << ", error: " << remote_sock->StrError();
+    remote_sock->Close();
+  }
+  return remote_sock;
+}
 
 Client::Client(cuttlefish::SharedFD fd) : client_fd(fd) {}
 
@@ -60,7 +83,9 @@ void Client::SendCommandResponse(
 
 ChannelMonitor::ChannelMonitor(ModemSimulator* modem,
                                cuttlefish::SharedFD server)
-    : modem_(modem), server_(server) {
+    : modem_(modem),
+      server_(server),
+      remote_pool_(ConnectToRemoteCvd, kRemoteConnectionIdleTimeout) {
   if (!cuttlefish::SharedFD::Pipe(&read_pipe_, &write_pipe_)) {
     LOG(ERROR) << "Unable to create pipe, ignore";
   }
@@ -84,7 +109,20 @@ void ChannelMonitor::SetRemoteClient(cuttlefish::SharedFD client, bool is_accept
     LOG(DEBUG) << "added one remote client";
   }
 
-  // Trigger monitor loop
+  TriggerMonitorLoop();
+}
+
+cuttlefish::SharedFD ChannelMonitor::ConnectToRemote(const std::string& port) {
+  bool is_new = false;
+  auto connection = remote_pool_.Acquire(port, &is_new);
+  if (is_new) {
+    // The remote instance answers on the same connection
+    SetRemoteClient(connection, false);
+  }
+  return connection;
+}
+
+void ChannelMonitor::TriggerMonitorLoop() {
   if (write_pipe_->IsOpen()) {
     write_pipe_->Write("OK", sizeof("OK"));
   } else {
@@ -120,6 +158,9 @@ void ChannelMonitor::ReadCommand(Client& client) {
     LOG(DEBUG) << "Error reading from client fd: "
                << client.client_fd->StrError();
     client.client_fd->Close();  // Ignore errors here
+    if (client.type == Client::REMOTE) {
+      remote_pool_.Remove(client.client_fd);
+    }
     // Erase client from the vector clients
     auto& clients = client.type == Client::REMOTE ? remote_clients_ : clients_;
     auto iter = std::find_if(
@@ -186,23 +227,16 @@ void ChannelMonitor::SendRemoteCommand(cuttlefish::SharedFD client, std::string&
 }
 
 void ChannelMonitor::CloseRemoteConnection(cuttlefish::SharedFD client) {
-  auto iter = remote_clients_.begin();
-  for (; iter != remote_clients_.end(); ++iter) {
-    if (iter->get()->client_fd == client) {
-      iter->get()->client_fd->Close();
-      iter->get()->is_valid = false;
-
-      // Trigger monitor loop
-      if (write_pipe_->IsOpen()) {
-        write_pipe_->Write("OK", sizeof("OK"));
-        LOG(DEBUG) << "asking to remove clients";
-      } else {
-        LOG(ERROR) << "Pipe created fail, can't trigger monitor loop";
-      }
-      return;
-    }
+  // Pooled connections stay open for the next call or SMS, they are closed
+  // once idle. The monitor loop recomputes its timeout to notice that.
+  if (remote_pool_.Release(client)) {
+    TriggerMonitorLoop();
+    return;
   }
-  LOG(DEBUG) << "Remote client has been erased.";
+  // Connections accepted from other instances are owned by their pools, which
+  // close them. Closing them here would make the next call to or from that
+  // instance connect again.
+  LOG(DEBUG) << "Leaving accepted remote connection open.";
 }
 
 ChannelMonitor::~ChannelMonitor() {
@@ -228,6 +262,21 @@ static void removeInvalidClients(std::vector<std::unique_ptr<Client>>& clients)
   }
 }
 
+void ChannelMonitor::CloseIdleRemoteConnections() {
+  auto idle = remote_pool_.TakeIdle(RemoteConnectionPool::Clock::now());
+  for (auto& connection : idle) {
+    for (auto& client : remote_clients_) {
+      if (client->client_fd == connection) {
+        client->is_valid = false;
+      }
+    }
+    connection->Close();
+  }
+  if (!idle.empty()) {
+    removeInvalidClients(remote_clients_);
+  }
+}
+
 void ChannelMonitor::MonitorLoop() {
   do {
     cuttlefish::SharedFDSet read_set;
@@ -239,7 +288,19 @@ void ChannelMonitor::MonitorLoop() {
     for (auto& client: remote_clients_) {
       if (client->is_valid) read_set.Set(client->client_fd);
     }
-    int num_fds = cuttlefish::Select(&read_set, nullptr, nullptr, nullptr);
+    // Wake up in time to close idle connections to other instances
+    struct timeval timeout;
+    struct timeval* timeout_ptr = nullptr;
+    auto idle_deadline = remote_pool_.NextIdleDeadline();
+    if (idle_deadline) {
+      auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+          *idle_deadline - RemoteConnectionPool::Clock::now());
+      auto remaining_us = std::max<int64_t>(remaining.count(), 0);
+      timeout.tv_sec = remaining_us / 1000000;
+      timeout.tv_usec = remaining_us % 1000000;
+      timeout_ptr = &timeout;
+    }
+    int num_fds = cuttlefish::Select(&read_set, nullptr, nullptr, timeout_ptr);
     if (num_fds < 0) {
       LOG(ERROR) << "Select call returned error : " << strerror(errno);
       // std::exit(kSelectError);
@@ -269,10 +330,14 @@ void ChannelMonitor::MonitorLoop() {
           ReadCommand(*client);
         }
       }
-    } else {
+    } else if (!idle_deadline) {
       // Ignore errors here
       LOG(ERROR) << "Select call returned error : " << strerror(errno);
     }
+    if (idle_deadline &&
+        RemoteConnectionPool::Clock::now() >= *idle_deadline) {
+      CloseIdleRemoteConnections();
+    }
   } while (true);
 }
 
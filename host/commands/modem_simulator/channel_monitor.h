@@ -20,6 +20,7 @@
 #include <vector>
 
 #include "common/libs/fs/shared_select.h"
+#include "host/commands/modem_simulator/remote_connection_pool.h"
 
 namespace cuttlefish {
 
@@ -72,6 +73,9 @@ class ChannelMonitor {
   ChannelMonitor& operator=(const ChannelMonitor&) = delete;
 
   void SetRemoteClient(cuttlefish::SharedFD client,  bool is_accepted);
+  // Returns a pooled connection to the modem simulator of the instance at
+  // `port`, to be given back with CloseRemoteConnection.
+  cuttlefish::SharedFD ConnectToRemote(const std::string& port);
   void SendRemoteCommand(cuttlefish::SharedFD client, std::string& response);
   void CloseRemoteConnection(cuttlefish::SharedFD client);
 
@@ -86,7 +90,10 @@ class ChannelMonitor {
   cuttlefish::SharedFD write_pipe_;
   std::vector<std::unique_ptr<Client>> clients_;
   std::vector<std::unique_ptr<Client>> remote_clients_;
+  RemoteConnectionPool remote_pool_;
 
+  void TriggerMonitorLoop();
+  void CloseIdleRemoteConnections();
   void AcceptIncomingConnection();
   void OnClientSocketClosed(int sock);
   void ReadCommand(Client& client);
@@ -83,8 +83,9 @@ int main(int argc, char** argv) {
 
   cuttlefish::NvramConfig::InitNvramConfigService(server_fds.size(), FLAGS_sim_type);
 
-  // Don't get a SIGPIPE from the clients
-  if (sigaction(SIGPIPE, nullptr, nullptr) != 0) {
+  // Don't get a SIGPIPE from the clients, or from pooled connections to other
+  // instances that went away
+  if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
     LOG(ERROR) << "Failed to set SIGPIPE to be ignored: " << strerror(errno);
   }
 
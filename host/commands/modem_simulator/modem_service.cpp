@@ -113,14 +113,10 @@ void ModemService::SendUnsolicitedCommand(std::string unsol_command) {
 }
 
 cuttlefish::SharedFD ModemService::ConnectToRemoteCvd(std::string port) {
-  std::string remote_sock_name = "modem_simulator" + port;
-  auto remote_sock = cuttlefish::SharedFD::SocketLocalClient(
-      remote_sock_name.c_str(), true, SOCK_STREAM);
-  if (!remote_sock->IsOpen()) {
-    LOG(ERROR) << "Failed to connect to remote cuttlefish: " << port
-               << ", error: " << strerror(errno);
+  if (!channel_monitor_) {
+    return cuttlefish::SharedFD();
   }
-  return remote_sock;
+  return channel_monitor_->ConnectToRemote(port);
 }
 
 void ModemService::SendCommandToRemote(cuttlefish::SharedFD remote_client, std::string response) {
@@ -0,0 +1,146 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/modem_simulator/remote_connection_pool.h"
+
+#include <sys/socket.h>
+
+#include <android-base/logging.h>
+
+namespace cuttlefish {
+
+RemoteConnectionPool::RemoteConnectionPool(Connector connector,
+                                           Clock::duration idle_timeout)
+    : connector_(std::move(connector)), idle_timeout_(idle_timeout) {}
+
+bool RemoteConnectionPool::IsHealthy(cuttlefish::SharedFD connection) {
+  if (!connection->IsOpen()) {
+    return false;
+  }
+  // Pending data is left for the channel monitor, only a closed connection
+  // or an error matter here.
+  char unused;
+  auto peeked = connection->Recv(&unused, sizeof(unused),
+                                 MSG_PEEK | MSG_DONTWAIT);
+  if (peeked > 0) {
+    return true;
+  }
+  return peeked < 0 && (connection->GetErrno() == EAGAIN ||
+                        connection->GetErrno() == EWOULDBLOCK);
+}
+
+cuttlefish::SharedFD RemoteConnectionPool::Acquire(const std::string& port,
+                                                   bool* is_new) {
+  *is_new = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = connections_.find(port);
+    if (iter != connections_.end()) {
+      if (IsHealthy(iter->second.fd)) {
+        iter->second.users++;
+        return iter->second.fd;
+      }
+      LOG(DEBUG) << "Dropping broken connection to remote cuttlefish: "
+                 << port;
+      connections_.erase(iter);
+    }
+  }
+
+  // Connect without the lock, connections to other ports shouldn't wait.
+  auto connection = connector_(port);
+  if (!connection->IsOpen()) {
+    return connection;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto [iter, inserted] = connections_.emplace(
+      port, Connection{.fd = connection, .users = 0, .last_released = {}});
+  if (!inserted) {
+    // Another thread connected first, share its connection.
+    connection->Close();
+  } else {
+    *is_new = true;
+  }
+  iter->second.users++;
+  return iter->second.fd;
+}
+
+bool RemoteConnectionPool::Release(cuttlefish::SharedFD connection) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& [port, pooled] : connections_) {
+    if (pooled.fd == connection) {
+      if (pooled.users > 0 && --pooled.users == 0) {
+        pooled.last_released = Clock::now();
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+bool RemoteConnectionPool::Contains(cuttlefish::SharedFD connection) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& [port, pooled] : connections_) {
+    if (pooled.fd == connection) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void RemoteConnectionPool::Remove(cuttlefish::SharedFD connection) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto iter = connections_.begin(); iter != connections_.end(); ++iter) {
+    if (iter->second.fd == connection) {
+      connections_.erase(iter);
+      return;
+    }
+  }
+}
+
+std::vector<cuttlefish::SharedFD> RemoteConnectionPool::TakeIdle(
+    Clock::time_point now) {
+  std::vector<cuttlefish::SharedFD> idle;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto iter = connections_.begin(); iter != connections_.end();) {
+    auto& pooled = iter->second;
+    if (pooled.users == 0 && now - pooled.last_released >= idle_timeout_) {
+      LOG(DEBUG) << "Closing idle connection to remote cuttlefish: "
+                 << iter->first;
+      idle.push_back(pooled.fd);
+      iter = connections_.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+  return idle;
+}
+
+std::optional<RemoteConnectionPool::Clock::time_point>
+RemoteConnectionPool::NextIdleDeadline() {
+  std::optional<Clock::time_point> deadline;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& [port, pooled] : connections_) {
+    if (pooled.users == 0) {
+      auto idle_at = pooled.last_released + idle_timeout_;
+      if (!deadline || idle_at < *deadline) {
+        deadline = idle_at;
+      }
+    }
+  }
+  return deadline;
+}
+
+}  // namespace cuttlefish
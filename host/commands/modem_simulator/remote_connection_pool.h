@@ -0,0 +1,81 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+
+/**
+ * Long lived connections to the modem simulators of other cuttlefish
+ * instances, one per remote port.
+ *
+ * Calls and SMS to the same instance share a connection instead of connecting
+ * for every message. A connection is in use from Acquire() to Release(), and
+ * is closed once it has been unused for the idle timeout.
+ */
+class RemoteConnectionPool {
+ public:
+  using Clock = std::chrono::steady_clock;
+  // Opens a connection and performs the handshake with the remote instance.
+  using Connector = std::function<cuttlefish::SharedFD(const std::string&)>;
+
+  RemoteConnectionPool(Connector connector, Clock::duration idle_timeout);
+
+  // Returns a connection to the instance at `port`, reusing a healthy one if
+  // possible. `is_new` is set when the connection was just opened and needs
+  // to be monitored for incoming commands.
+  cuttlefish::SharedFD Acquire(const std::string& port, bool* is_new);
+
+  // Returns false if the connection doesn't belong to the pool.
+  bool Release(cuttlefish::SharedFD connection);
+
+  bool Contains(cuttlefish::SharedFD connection);
+
+  // Forgets a connection closed by the other side.
+  void Remove(cuttlefish::SharedFD connection);
+
+  // Removes the connections that have been unused for the idle timeout at
+  // `now` and returns them so they can be closed.
+  std::vector<cuttlefish::SharedFD> TakeIdle(Clock::time_point now);
+
+  // When the next unused connection becomes idle, if any.
+  std::optional<Clock::time_point> NextIdleDeadline();
+
+ private:
+  struct Connection {
+    cuttlefish::SharedFD fd;
+    int users;
+    Clock::time_point last_released;
+  };
+
+  static bool IsHealthy(cuttlefish::SharedFD connection);
+
+  Connector connector_;
+  Clock::duration idle_timeout_;
+  std::mutex mutex_;
+  std::map<std::string, Connection> connections_;
+};
+
+}  // namespace cuttlefish
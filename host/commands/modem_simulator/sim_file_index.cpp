@@ -0,0 +1,171 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/modem_simulator/sim_file_index.h"
+
+namespace cuttlefish {
+
+using tinyxml2::XMLAttribute;
+using tinyxml2::XMLElement;
+
+namespace {
+
+std::string FileKey(const std::string& path, const std::string& file_id) {
+  return path + "|" + file_id;
+}
+
+std::string ReadKey(const std::string& command, const std::string& p1,
+                    const std::string& p2, const std::string& p3,
+                    const std::string& data) {
+  return command + "," + p1 + "," + p2 + "," + p3 + "," + data;
+}
+
+std::string UpdateKey(const std::string& p1, const std::string& p2,
+                      const std::string& p3) {
+  return p1 + "," + p2 + "," + p3;
+}
+
+bool IsUpdateCommand(const std::string& command) {
+  return command == "DC" || command == "D6";  // UPDATE RECORD, UPDATE BINARY
+}
+
+std::string AttributeValue(const XMLAttribute* attr) {
+  return attr ? attr->Value() : "";
+}
+
+}  // namespace
+
+void SimFileIndex::Record::Update(const std::string& new_response) {
+  response = new_response;
+  element->SetText(response.c_str());
+}
+
+void SimFileIndex::Build(XMLElement* root) {
+  files_.clear();
+  if (root) {
+    IndexElement(root, "");
+  }
+}
+
+// Mirrors the lookup of the profile: the first child with a matching "path"
+// is the dedicated file, the first one with a matching "id" the elementary
+// file.
+void SimFileIndex::IndexElement(XMLElement* element, const std::string& path) {
+  for (auto child = element->FirstChildElement(); child;
+       child = child->NextSiblingElement()) {
+    auto sub_path = child->FindAttribute("path");
+    if (sub_path) {
+      auto child_path = path + sub_path->Value();
+      // Shadowed by an earlier sibling with the same path
+      if (FindAttributeChild(element, "path", sub_path->Value()) == child) {
+        IndexElement(child, child_path);
+      }
+      continue;
+    }
+    auto id = child->FindAttribute("id");
+    if (id) {
+      auto [iter, inserted] = files_.try_emplace(FileKey(path, id->Value()));
+      if (inserted) {
+        IndexFile(child, &iter->second);
+      }
+    }
+  }
+}
+
+XMLElement* SimFileIndex::FindAttributeChild(XMLElement* parent,
+                                             const char* attr_name,
+                                             const char* attr_value) {
+  for (auto child = parent->FirstChildElement(); child;
+       child = child->NextSiblingElement()) {
+    auto attr = child->FindAttribute(attr_name);
+    if (attr && std::string(attr->Value()) == attr_value) {
+      return child;
+    }
+  }
+  return nullptr;
+}
+
+void SimFileIndex::IndexFile(XMLElement* element, ElementaryFile* file) {
+  for (auto sim_io = element->FirstChildElement("SIMIO"); sim_io;
+       sim_io = sim_io->NextSiblingElement("SIMIO")) {
+    auto attr_cmd = sim_io->FindAttribute("cmd");
+    auto attr_p1 = sim_io->FindAttribute("p1");
+    auto attr_p2 = sim_io->FindAttribute("p2");
+    auto attr_p3 = sim_io->FindAttribute("p3");
+    auto attr_data = sim_io->FindAttribute("data");
+    auto text = sim_io->GetText();
+
+    Record record{
+        .cmd = AttributeValue(attr_cmd),
+        .p1 = AttributeValue(attr_p1),
+        .p2 = AttributeValue(attr_p2),
+        .p3 = AttributeValue(attr_p3),
+        .data = AttributeValue(attr_data),
+        .has_cmd = attr_cmd != nullptr,
+        .has_data = attr_data != nullptr,
+        .has_p1_p2_p3 = attr_p1 && attr_p2 && attr_p3,
+        .response = text ? text : "",
+        .element = sim_io,
+    };
+    if (!record.has_cmd || !record.has_data) {
+      file->has_wildcards = true;
+    }
+    if (record.has_p1_p2_p3) {
+      auto index = file->records.size();
+      file->reads.try_emplace(
+          ReadKey(record.cmd, record.p1, record.p2, record.p3, record.data),
+          index);
+      file->updates.try_emplace(UpdateKey(record.p1, record.p2, record.p3),
+                                index);
+    }
+    file->records.emplace_back(std::move(record));
+  }
+}
+
+SimFileIndex::Record* SimFileIndex::Find(
+    const std::string& path, const std::string& file_id,
+    const std::string& command, const std::string& p1, const std::string& p2,
+    const std::string& p3, const std::string& data) {
+  auto file_iter = files_.find(FileKey(path, file_id));
+  if (file_iter == files_.end()) {
+    return nullptr;
+  }
+  auto& file = file_iter->second;
+
+  if (IsUpdateCommand(command)) {
+    auto iter = file.updates.find(UpdateKey(p1, p2, p3));
+    return iter == file.updates.end() ? nullptr : &file.records[iter->second];
+  }
+
+  if (!file.has_wildcards) {
+    auto iter = file.reads.find(ReadKey(command, p1, p2, p3, data));
+    return iter == file.reads.end() ? nullptr : &file.records[iter->second];
+  }
+
+  // Records without cmd or data match several keys, keep document order.
+  for (auto& record : file.records) {
+    if ((record.has_cmd && record.cmd != command) ||
+        (record.has_data && record.data != data)) {
+      continue;
+    }
+    if (record.has_p1_p2_p3 && record.p1 == p1 && record.p2 == p2 &&
+        record.p3 == p3) {
+      return &record;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,86 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <tinyxml2.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cuttlefish {
+
+/**
+ * Flat index of the SIMIO records of an ICC profile, keyed by the path of the
+ * dedicated file and the id of the elementary file.
+ *
+ * Built once when the profile is loaded so AT+CRSM requests don't have to walk
+ * the XML tree and compare attribute strings. The XML document still holds
+ * the profile that is saved to disk, updates are applied to both.
+ */
+class SimFileIndex {
+ public:
+  struct Record {
+    // Attributes of the SIMIO element, cmd and data match anything when
+    // absent.
+    std::string cmd;
+    std::string p1;
+    std::string p2;
+    std::string p3;
+    std::string data;
+    bool has_cmd;
+    bool has_data;
+    bool has_p1_p2_p3;
+    // The response, e.g. "144,0,FFFF"
+    std::string response;
+    tinyxml2::XMLElement* element;
+
+    void Update(const std::string& new_response);
+  };
+
+  void Build(tinyxml2::XMLElement* root);
+
+  // Returns the record that answers a SIM IO command, nullptr if there is
+  // none. Update commands (UPDATE BINARY, UPDATE RECORD) only match the
+  // parameters.
+  Record* Find(const std::string& path, const std::string& file_id,
+               const std::string& command, const std::string& p1,
+               const std::string& p2, const std::string& p3,
+               const std::string& data);
+
+  size_t FileCount() const { return files_.size(); }
+
+ private:
+  struct ElementaryFile {
+    std::vector<Record> records;
+    // Some record lacks a cmd or data attribute, it must be scanned
+    bool has_wildcards = false;
+    // First record for every cmd, p1, p2, p3 and data
+    std::unordered_map<std::string, size_t> reads;
+    // First record for every p1, p2 and p3
+    std::unordered_map<std::string, size_t> updates;
+  };
+
+  void IndexElement(tinyxml2::XMLElement* element, const std::string& path);
+  static tinyxml2::XMLElement* FindAttributeChild(
+      tinyxml2::XMLElement* parent, const char* attr_name,
+      const char* attr_value);
+  static void IndexFile(tinyxml2::XMLElement* element, ElementaryFile* file);
+
+  std::unordered_map<std::string, ElementaryFile> files_;
+};
+
+}  // namespace cuttlefish
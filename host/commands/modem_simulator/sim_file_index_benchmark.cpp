@@ -0,0 +1,214 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+#include <tinyxml2.h>
+
+#include "host/commands/modem_simulator/sim_file_index.h"
+
+namespace cuttlefish {
+namespace {
+
+using tinyxml2::XMLAttribute;
+using tinyxml2::XMLDocument;
+using tinyxml2::XMLElement;
+
+struct SimIoRequest {
+  std::string path;
+  std::string id;
+  std::string cmd;
+  std::string p1;
+  std::string p2;
+  std::string p3;
+  std::string data;
+};
+
+std::string ProfilePath() {
+  return android::base::GetExecutableDirectory() +
+         "/files/iccprofile_for_sim0.xml";
+}
+
+// While loading the SIM records the framework reads the attributes (C0) and
+// the contents of every file it knows about, which is close to every record
+// the profile answers, in profile order.
+void CollectReads(XMLElement* element, const std::string& path,
+                  std::vector<SimIoRequest>* requests) {
+  for (auto child = element->FirstChildElement(); child;
+       child = child->NextSiblingElement()) {
+    auto sub_path = child->FindAttribute("path");
+    if (sub_path) {
+      CollectReads(child, path + sub_path->Value(), requests);
+      continue;
+    }
+    auto id = child->FindAttribute("id");
+    if (!id) {
+      continue;
+    }
+    for (auto sim_io = child->FirstChildElement("SIMIO"); sim_io;
+         sim_io = sim_io->NextSiblingElement("SIMIO")) {
+      auto value = [sim_io](const char* name) -> std::string {
+        auto attr = sim_io->FindAttribute(name);
+        return attr ? attr->Value() : "";
+      };
+      requests->push_back(SimIoRequest{
+          .path = path,
+          .id = id->Value(),
+          .cmd = value("cmd"),
+          .p1 = value("p1"),
+          .p2 = value("p2"),
+          .p3 = value("p3"),
+          .data = value("data"),
+      });
+    }
+  }
+}
+
+XMLElement* FindAttribute(XMLElement* parent, const std::string& attr_name,
+                          const std::string& attr_value) {
+  XMLElement* child = parent->FirstChildElement();
+  while (child) {
+    const XMLAttribute* attr = child->FindAttribute(attr_name.c_str());
+    if (attr && attr->Value() == attr_value) {
+      break;
+    }
+    child = child->NextSiblingElement();
+  }
+  return child;
+}
+
+// How AT+CRSM requests were answered before the index: walking the tree and
+// comparing attributes on every request.
+const char* TreeWalk(XMLElement* root, const SimIoRequest& request) {
+  auto parent = root;
+  for (size_t pos = 0; pos < request.path.length(); pos += 4) {
+    parent = FindAttribute(parent, "path", request.path.substr(pos, 4));
+    if (!parent) {
+      return nullptr;
+    }
+  }
+  auto ef = FindAttribute(parent, "id", request.id);
+  if (!ef) {
+    return nullptr;
+  }
+  for (auto sim_io = ef->FirstChildElement("SIMIO"); sim_io;
+       sim_io = sim_io->NextSiblingElement("SIMIO")) {
+    auto attr_cmd = sim_io->FindAttribute("cmd");
+    auto attr_p1 = sim_io->FindAttribute("p1");
+    auto attr_p2 = sim_io->FindAttribute("p2");
+    auto attr_p3 = sim_io->FindAttribute("p3");
+    auto attr_data = sim_io->FindAttribute("data");
+    if ((attr_cmd && attr_cmd->Value() != request.cmd) ||
+        (attr_data && attr_data->Value() != request.data)) {
+      continue;
+    }
+    if (attr_p1 && attr_p1->Value() == request.p1 && attr_p2 &&
+        attr_p2->Value() == request.p2 && attr_p3 &&
+        attr_p3->Value() == request.p3) {
+      return sim_io->GetText();
+    }
+  }
+  return nullptr;
+}
+
+// The index must give the same answer as the tree walk it replaces, for the
+// requests the profile answers and for requests it doesn't.
+void CheckIndexMatchesTreeWalk(XMLElement* root, SimFileIndex* index,
+                               const std::vector<SimIoRequest>& requests) {
+  auto check = [root, index](const SimIoRequest& request) {
+    auto expected = TreeWalk(root, request);
+    auto record = index->Find(request.path, request.id, request.cmd,
+                              request.p1, request.p2, request.p3,
+                              request.data);
+    std::string what = request.path + "/" + request.id + " " + request.cmd +
+                       "," + request.p1 + "," + request.p2 + "," + request.p3;
+    if (!expected) {
+      CHECK(!record) << "Index answers " << what;
+      return;
+    }
+    CHECK(record) << "Index doesn't answer " << what;
+    CHECK(record->element->GetText() == expected) << "Mismatch for " << what;
+    CHECK_EQ(record->response, expected) << "Mismatch for " << what;
+  };
+  for (const auto& request : requests) {
+    check(request);
+    auto unknown_file = request;
+    unknown_file.id = "0000";
+    check(unknown_file);
+    auto unknown_params = request;
+    unknown_params.p1 = "FFFF";
+    check(unknown_params);
+  }
+}
+
+class SimBoot : public benchmark::Fixture {
+ public:
+  void SetUp(const benchmark::State&) override {
+    CHECK(doc_.LoadFile(ProfilePath().c_str()) == tinyxml2::XML_SUCCESS)
+        << "Unable to load " << ProfilePath();
+    requests_.clear();
+    CollectReads(doc_.RootElement(), "", &requests_);
+    CHECK(!requests_.empty());
+  }
+
+ protected:
+  XMLDocument doc_;
+  std::vector<SimIoRequest> requests_;
+};
+
+BENCHMARK_F(SimBoot, TreeWalk)(benchmark::State& state) {
+  for (auto _ : state) {
+    for (const auto& request : requests_) {
+      auto response = TreeWalk(doc_.RootElement(), request);
+      CHECK(response);
+      benchmark::DoNotOptimize(response);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * requests_.size());
+}
+
+BENCHMARK_F(SimBoot, Index)(benchmark::State& state) {
+  SimFileIndex index;
+  index.Build(doc_.RootElement());
+  CheckIndexMatchesTreeWalk(doc_.RootElement(), &index, requests_);
+  for (auto _ : state) {
+    for (const auto& request : requests_) {
+      auto record = index.Find(request.path, request.id, request.cmd,
+                               request.p1, request.p2, request.p3,
+                               request.data);
+      CHECK(record);
+      benchmark::DoNotOptimize(record->response.data());
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * requests_.size());
+}
+
+// Compiling the index is paid once, when the profile is loaded.
+BENCHMARK_F(SimBoot, BuildIndex)(benchmark::State& state) {
+  for (auto _ : state) {
+    SimFileIndex index;
+    index.Build(doc_.RootElement());
+    benchmark::DoNotOptimize(index.FileCount());
+  }
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
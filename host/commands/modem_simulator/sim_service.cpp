@@ -365,6 +365,7 @@ void SimService::InitializeServiceState() {
 }
 
 void SimService::InitializeSimFileSystemAndSimState() {
+  std::lock_guard<std::recursive_mutex> lock(sim_file_system_.mutex);
   auto nvram_config = NvramConfig::Get();
   auto sim_type = nvram_config->sim_type();
   std::stringstream ss;
@@ -402,6 +403,10 @@ void SimService::InitializeSimFileSystemAndSimState() {
 
   sim_file_system_.file_path = icc_profile_path;
   auto err = sim_file_system_.doc.LoadFile(file.c_str());
+  // The old elements are gone even if loading failed
+  sim_file_system_.index.Build(err == tinyxml2::XML_SUCCESS
+                                   ? sim_file_system_.GetRootElement()
+                                   : nullptr);
   if (err != tinyxml2::XML_SUCCESS) {
     LOG(ERROR) << "Unable to load XML file '" << file << " ', error " << err;
     sim_status_ = SIM_STATUS_ABSENT;
@@ -474,6 +479,7 @@ void SimService::InitializeSimFileSystemAndSimState() {
 }
 
 void SimService::InitializeFacilityLock() {
+  std::lock_guard<std::recursive_mutex> lock(sim_file_system_.mutex);
   /* Default disable */
   facility_lock_ = {
       {"SC", FacilityLock(FacilityLock::LockStatus::DISABLE)},
@@ -513,6 +519,7 @@ void SimService::InitializeFacilityLock() {
 }
 
 void SimService::SavePinStateToIccProfile() {
+  std::lock_guard<std::recursive_mutex> lock(sim_file_system_.mutex);
   XMLElement *root = sim_file_system_.GetRootElement();
   if (!root) {
     LOG(ERROR) << "Unable to find root element: IccProfile";
@@ -629,6 +636,7 @@ void SimService::SavePinStateToIccProfile() {
 }
 
 void SimService::SaveFacilityLockToIccProfile() {
+  std::lock_guard<std::recursive_mutex> lock(sim_file_system_.mutex);
   XMLElement *root = sim_file_system_.GetRootElement();
   if (!root) {
     LOG(ERROR) << "Unable to find root element: IccProfile";
@@ -674,6 +682,7 @@ bool SimService::IsFDNEnabled() {
 }
 
 bool SimService::IsFixedDialNumber(std::string_view number) {
+  std::lock_guard<std::recursive_mutex> lock(sim_file_system_.mutex);
   XMLElement *root = sim_file_system_.GetRootElement();
   if (!root) return false;
 
@@ -724,7 +733,12 @@ XMLElement* SimService::GetIccProfile() {
   return sim_file_system_.GetRootElement();
 }
 
+std::unique_lock<std::recursive_mutex> SimService::LockIccProfile() {
+  return std::unique_lock<std::recursive_mutex>(sim_file_system_.mutex);
+}
+
 std::string SimService::GetPhoneNumber() {
+  std::lock_guard<std::recursive_mutex> lock(sim_file_system_.mutex);
   XMLElement *root = sim_file_system_.GetRootElement();
   if (!root) return "";
 
@@ -769,6 +783,7 @@ SimService::SimStatus SimService::GetSimStatus() const {
 }
 
 std::string SimService::GetSimOperator() {
+  std::lock_guard<std::recursive_mutex> lock(sim_file_system_.mutex);
   XMLElement *root = sim_file_system_.GetRootElement();
   if (!root) return "";
 
@@ -882,6 +897,7 @@ void SimService::HandleSIMStatusReq(const Client& client) {
  */
 void SimService::HandleSIM_IO(const Client& client,
                               const std::string& command) {
+  std::lock_guard<std::recursive_mutex> lock(sim_file_system_.mutex);
   std::vector<std::string> kFileNotFoud = {"+CRSM: 106,130", "OK"};
   std::vector<std::string> responses;
 
@@ -901,7 +917,7 @@ void SimService::HandleSIM_IO(const Client& client,
   auto p2 = cmd.GetNextStrDeciToHex();
   auto p3 = cmd.GetNextStrDeciToHex();
 
-  auto data = cmd.GetNextStr(',');
+  std::string data(cmd.GetNextStr(','));
   std::string path(cmd.GetNextStr());
 
   XMLElement *root = sim_file_system_.GetRootElement();
@@ -923,62 +939,19 @@ void SimService::HandleSIM_IO(const Client& client,
     path = MF_SIM + DF_TELECOM + DF_PHONEBOOK;
   }
 
-  size_t pos = 0;
-  auto parent = root;
-  while (pos < path.length()) {
-    std::string sub_path(path.substr(pos, 4));
-    auto app = SimFileSystem::FindAttribute(parent, "path", sub_path);
-    if (!app) {
-      client.SendCommandResponse(kFileNotFoud);
-      return;
-    }
-    pos += 4;
-    parent = app;
-  }
-
-  XMLElement* ef = SimFileSystem::FindAttribute(parent, "id", id);
-  if (!ef) {
-    client.SendCommandResponse(kFileNotFoud);
-    return;
-  }
-
-  XMLElement *final = ef->FirstChildElement("SIMIO");
-  while (final) {
-    const XMLAttribute *attr_cmd = final->FindAttribute("cmd");
-    const XMLAttribute *attr_p1 = final->FindAttribute("p1");
-    const XMLAttribute *attr_p2 = final->FindAttribute("p2");
-    const XMLAttribute *attr_p3 = final->FindAttribute("p3");
-    const XMLAttribute *attr_data = final->FindAttribute("data");
-
-    if (c != "DC" && c != "D6") {  // Except UPDATE RECORD or UPDATE BINARY
-      if ((attr_cmd && attr_cmd->Value() != c) ||
-          (attr_data && attr_data->Value() != data)) {
-        final = final->NextSiblingElement("SIMIO");
-        continue;
-      }
-    }
-    if (attr_p1 && attr_p1->Value() == p1 &&
-        attr_p2 && attr_p2->Value() == p2 &&
-        attr_p3 && attr_p3->Value() == p3) {
-      break;
-    }
-    final = final->NextSiblingElement("SIMIO");
-  }
-
-  if (!final) {
+  auto record = sim_file_system_.index.Find(path, id, c, p1, p2, p3, data);
+  if (!record) {
     client.SendCommandResponse(kFileNotFoud);
     return;
   }
 
   std::string response = "+CRSM: ";
   if (c == "DC" || c == "D6") {
-    std::string temp = "144,0,";
-    temp += data;
-    final->SetText(temp.c_str());
-    sim_file_system_.doc.SaveFile(sim_file_system_.file_path.c_str());
+    record->Update("144,0," + data);
+    ScheduleIccProfileSave();
     response.append("144,0");
   } else {
-    response.append(final->GetText());
+    response.append(record->response);
   }
 
   responses.push_back(response);
@@ -986,6 +959,23 @@ void SimService::HandleSIM_IO(const Client& client,
   client.SendCommandResponse(responses);
 }
 
+// Saving the whole profile takes longer than answering the request, updates
+// are written back from the thread looper and coalesced until then.
+void SimService::ScheduleIccProfileSave() {
+  std::lock_guard<std::recursive_mutex> lock(sim_file_system_.mutex);
+  if (sim_file_system_.save_pending) {
+    return;
+  }
+  sim_file_system_.save_pending = true;
+  thread_looper_->Post(makeSafeCallback(this, &SimService::SaveIccProfile));
+}
+
+void SimService::SaveIccProfile() {
+  std::lock_guard<std::recursive_mutex> lock(sim_file_system_.mutex);
+  sim_file_system_.save_pending = false;
+  sim_file_system_.doc.SaveFile(sim_file_system_.file_path.c_str());
+}
+
 void SimService::OnSimStatusChanged() {
   auto ptr = network_service_;
   if (ptr) {
@@ -1011,6 +1001,7 @@ bool SimService::checkPin1AndAdjustSimStatus(std::string_view pin) {
 /* AT+CSIM */
 void SimService::HandleCSIM_IO(const Client& client,
                               const std::string& command) {
+  std::lock_guard<std::recursive_mutex> lock(sim_file_system_.mutex);
   std::vector<std::string> responses;
 
   CommandParser cmd(command);
@@ -1172,6 +1163,7 @@ void SimService::HandleChangeOrEnterPIN(const Client& client,
  * see RIL_REQUEST_GET_IMSI in RIL
  */
 void SimService::HandleGetIMSI(const Client& client) {
+  std::lock_guard<std::recursive_mutex> lock(sim_file_system_.mutex);
   std::vector<std::string> responses;
 
   XMLElement *root = sim_file_system_.GetRootElement();
@@ -1217,6 +1209,7 @@ void SimService::HandleGetIMSI(const Client& client) {
  * see RIL_REQUEST_GET_SIM_STATUS in RIL
  */
 void SimService::HandleGetIccId(const Client& client) {
+  std::lock_guard<std::recursive_mutex> lock(sim_file_system_.mutex);
   std::vector<std::string> responses;
 
   XMLElement *root = sim_file_system_.GetRootElement();
@@ -1361,6 +1354,7 @@ void SimService::HandleFacilityLock(const Client& client,
  */
 void SimService::HandleOpenLogicalChannel(const Client& client,
                                           const std::string& command) {
+  std::lock_guard<std::recursive_mutex> lock(sim_file_system_.mutex);
   std::vector<std::string> responses;
 
   CommandParser cmd(command);
@@ -1461,6 +1455,7 @@ void SimService::HandleCloseLogicalChannel(const Client& client,
  */
 void SimService::HandleTransmitLogicalChannel(const Client& client,
                                               const std::string& command) {
+  std::lock_guard<std::recursive_mutex> lock(sim_file_system_.mutex);
   std::vector<std::string> responses;
 
   CommandParser cmd(command);
@@ -17,7 +17,10 @@
 
 #include <tinyxml2.h>
 
+#include <mutex>
+
 #include "host/commands/modem_simulator/modem_service.h"
+#include "host/commands/modem_simulator/sim_file_index.h"
 
 namespace cuttlefish {
 
@@ -62,7 +65,10 @@ class SimService : public ModemService, public std::enable_shared_from_this<SimS
   void SaveFacilityLockToIccProfile();
   bool IsFDNEnabled();
   bool IsFixedDialNumber(std::string_view number);
+  // The profile can be reloaded or saved from other threads, hold the lock
+  // from LockIccProfile while using the elements this returns.
   XMLElement* GetIccProfile();
+  std::unique_lock<std::recursive_mutex> LockIccProfile();
   std::string GetPhoneNumber();
 
   enum SimStatus {
@@ -82,6 +88,8 @@ class SimService : public ModemService, public std::enable_shared_from_this<SimS
   void InitializeSimFileSystemAndSimState();
   void InitializeFacilityLock();
   void OnSimStatusChanged();
+  void ScheduleIccProfileSave();
+  void SaveIccProfile();
 
   NetworkService* network_service_;
 
@@ -183,6 +191,13 @@ class SimService : public ModemService, public std::enable_shared_from_this<SimS
 
     XMLDocument doc;
     std::string file_path;
+    // SIMIO records of doc, rebuilt whenever doc is loaded
+    SimFileIndex index;
+    // Guards doc and index. Commands are handled on the channel monitor
+    // thread, while the modem state is saved from the main thread and
+    // updates are written back from the thread looper.
+    std::recursive_mutex mutex;
+    bool save_pending = false;
   };
   SimFileSystem sim_file_system_;
 
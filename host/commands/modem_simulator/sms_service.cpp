@@ -259,10 +259,9 @@ void SmsService::SendSmsToRemote(std::string remote_port, PDUParser& sms_pdu) {
   auto local_host_port = GetHostPort();
   auto pdu = sms_pdu.CreateRemotePDU(local_host_port);
 
-  std::string command = "AT+REMOTESMS=" + pdu + "\r";
-  std::string token = "REM0";
-  remote_client->Write(token.data(), token.size());
-  remote_client->Write(command.data(), command.size());
+  std::string command = "AT+REMOTESMS=" + pdu;
+  SendCommandToRemote(remote_client, command);
+  CloseRemoteConnection(remote_client);
 }
 
 /* process AT+CMGS PDU */
@@ -68,6 +68,7 @@ void StkService::HandleReportStkServiceIsRunning(const Client& client) {
 
   if (!sim_service_) return;
 
+  auto profile_lock = sim_service_->LockIccProfile();
   XMLElement *root = sim_service_->GetIccProfile();
   if (!root) return;
 
@@ -110,6 +111,7 @@ void StkService::HandleSendEnvelope(const Client& client , std::string& command)
   auto data = cmd.GetNextStr();
   std::string menu_id(data.substr(data.size() - 2));  // get the last two char
 
+  auto profile_lock = sim_service_->LockIccProfile();
   XMLElement *root = sim_service_->GetIccProfile();
   if (!root) return;
 
@@ -221,6 +223,11 @@ void StkService::OnUnsolicitedCommandForTR(std::string& command) {
     return;
   }
 
+  // The select items found below belong to the ICC profile
+  std::unique_lock<std::recursive_mutex> profile_lock;
+  if (sim_service_) {
+    profile_lock = sim_service_->LockIccProfile();
+  }
   XMLElement *select_item = GetCurrentSelectItem();
   if (!select_item) {
     current_select_item_menu_ids_.clear();
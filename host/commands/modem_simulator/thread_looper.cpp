@@ -15,21 +15,84 @@
 
 #include "host/commands/modem_simulator/thread_looper.h"
 
+#include <algorithm>
+
 #include <android-base/logging.h>
 
 namespace cuttlefish {
 
-ThreadLooper::ThreadLooper()
-  :   stopped_(false), next_serial_(1) {
-  looper_thread_ = std::thread([this]() { ThreadLoop(); });
+/* TimerQueue */
+bool TimerQueue::DueLater(const Entry& a, const Entry& b) {
+  if (a.when != b.when) {
+    return a.when > b.when;
+  }
+  return a.sequence > b.sequence;
 }
 
-ThreadLooper::~ThreadLooper() { Stop(); }
+void TimerQueue::Push(Clock::time_point when, Serial serial, Callback cb) {
+  heap_.push_back({when, next_sequence_++, serial, std::move(cb)});
+  std::push_heap(heap_.begin(), heap_.end(), DueLater);
+  pending_.insert(serial);
+}
+
+bool TimerQueue::Cancel(Serial serial) {
+  if (pending_.erase(serial) == 0) {
+    return false;
+  }
+  metrics_.canceled++;
+  // Canceled entries stay in the heap until they reach the top, unless they
+  // would keep it more than twice as large as needed.
+  if (heap_.size() > 2 * pending_.size() + 16) {
+    heap_.erase(std::remove_if(heap_.begin(), heap_.end(),
+                               [this](const Entry& entry) {
+                                 return pending_.count(entry.serial) == 0;
+                               }),
+                heap_.end());
+    std::make_heap(heap_.begin(), heap_.end(), DueLater);
+  }
+  return true;
+}
+
+void TimerQueue::DropCanceledTop() {
+  while (!heap_.empty() && pending_.count(heap_.front().serial) == 0) {
+    std::pop_heap(heap_.begin(), heap_.end(), DueLater);
+    heap_.pop_back();
+  }
+}
+
+std::optional<TimerQueue::Clock::time_point> TimerQueue::NextDeadline() {
+  DropCanceledTop();
+  if (heap_.empty()) {
+    return std::nullopt;
+  }
+  return heap_.front().when;
+}
 
-bool ThreadLooper::Event::operator<=(const Event &other) const {
-  return when <= other.when;
+std::optional<TimerQueue::Callback> TimerQueue::PopDue(Clock::time_point now) {
+  DropCanceledTop();
+  if (heap_.empty() || heap_.front().when > now) {
+    return std::nullopt;
+  }
+  std::pop_heap(heap_.begin(), heap_.end(), DueLater);
+  auto entry = std::move(heap_.back());
+  heap_.pop_back();
+  pending_.erase(entry.serial);
+
+  auto lag = now - entry.when;
+  metrics_.dispatched++;
+  metrics_.total_lag += lag;
+  metrics_.max_lag = std::max(metrics_.max_lag, lag);
+  return std::move(entry.cb);
+}
+
+/* ThreadLooper */
+ThreadLooper::ThreadLooper(std::function<Clock::time_point()> now)
+  :   now_(std::move(now)), stopped_(false), next_serial_(1) {
+  looper_thread_ = std::thread([this]() { ThreadLoop(); });
 }
 
+ThreadLooper::~ThreadLooper() { Stop(); }
+
 ThreadLooper::Serial ThreadLooper::Post(Callback cb) {
   CHECK(cb != nullptr);
 
@@ -37,7 +100,7 @@ ThreadLooper::Serial ThreadLooper::Post(Callback cb) {
   // If it's the time to process event with delay exactly when posting
   // a event without delay. Looper would process the event without delay firstly
   // if when set to be std::nullptr. so set when_ to be now.
-  Insert({ std::chrono::steady_clock::now(), cb, serial });
+  Insert(now_(), serial, std::move(cb));
 
   return serial;
 }
@@ -47,7 +110,7 @@ ThreadLooper::Serial ThreadLooper::PostWithDelay(
   CHECK(cb != nullptr);
 
   auto serial = next_serial_++;
-  Insert({ std::chrono::steady_clock::now() + delay, cb, serial });
+  Insert(now_() + delay, serial, std::move(cb));
 
   return serial;
 }
@@ -55,29 +118,22 @@ ThreadLooper::Serial ThreadLooper::PostWithDelay(
 bool ThreadLooper::CancelSerial(Serial serial) {
   std::lock_guard<std::mutex> autolock(lock_);
 
-  bool found = false;
-  for (auto iter = queue_.begin(); iter != queue_.end(); ++iter) {
-    if (iter->serial == serial) {
-      queue_.erase(iter);
-      cond_.notify_all();
-
-      found = true;
-      break;
-    }
+  if (!queue_.Cancel(serial)) {
+    return false;
   }
-
-  return found;
+  cond_.notify_all();
+  return true;
 }
 
-void ThreadLooper::Insert(const Event &event) {
+TimerQueue::Metrics ThreadLooper::GetMetrics() {
   std::lock_guard<std::mutex> autolock(lock_);
+  return queue_.GetMetrics();
+}
 
-  auto iter = queue_.begin();
-  while (iter != queue_.end() && *iter <= event) {
-    ++iter;
-  }
+void ThreadLooper::Insert(Clock::time_point when, Serial serial, Callback cb) {
+  std::lock_guard<std::mutex> autolock(lock_);
 
-  queue_.insert(iter, event);
+  queue_.Push(when, serial, std::move(cb));
   cond_.notify_all();
 }
 
@@ -91,21 +147,21 @@ void ThreadLooper::ThreadLoop() {
         break;
       }
 
-      if (queue_.empty()) {
+      auto deadline = queue_.NextDeadline();
+      if (!deadline) {
         cond_.wait(lock);
         continue;
       }
 
-      auto time_to_wait = queue_.front().when - std::chrono::steady_clock::now();
-      if (time_to_wait.count() > 0) {
-        // wait with timeout
-        auto durationMs =
-            std::chrono::duration_cast<std::chrono::milliseconds>(time_to_wait);
-        cond_.wait_for(lock, durationMs);
+      auto now = now_();
+      auto due = queue_.PopDue(now);
+      if (!due) {
+        // Not truncated to milliseconds, which made the loop spin during the
+        // last millisecond before an event.
+        cond_.wait_for(lock, *deadline - now);
         continue;
       }
-      cb = queue_.front().cb; // callback at front of queue
-      queue_.pop_front();
+      cb = std::move(*due);
     }
     cb();
   }
@@ -125,6 +181,19 @@ void ThreadLooper::Stop() {
   if (looper_thread_.joinable()) {
     looper_thread_.join();
   }
+
+  auto metrics = queue_.GetMetrics();
+  if (metrics.dispatched > 0) {
+    using std::chrono::microseconds;
+    auto average_lag = metrics.total_lag / metrics.dispatched;
+    LOG(DEBUG) << "Looper dispatched " << metrics.dispatched << " events, "
+               << metrics.canceled << " canceled, average lag "
+               << std::chrono::duration_cast<microseconds>(average_lag).count()
+               << "us, max lag "
+               << std::chrono::duration_cast<microseconds>(metrics.max_lag)
+                      .count()
+               << "us";
+  }
 }
 
 }  // namespace cuttlefish
@@ -18,10 +18,12 @@
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
-#include <deque>
 #include <functional>
 #include <mutex>
+#include <optional>
 #include <thread>
+#include <unordered_set>
+#include <vector>
 
 namespace cuttlefish {
 
@@ -48,16 +50,71 @@ std::function<void()> makeSafeCallback(
                              [f, params...](T *me) { (me->*f)(params...); });
 }
 
+/**
+ * Callbacks ordered by due time in a binary min-heap, first posted first among
+ * equal due times.
+ *
+ * Canceled callbacks are dropped when they reach the top of the heap, or all
+ * at once when they make up most of it. Not thread safe.
+ */
+class TimerQueue {
+ public:
+  using Clock = std::chrono::steady_clock;
+  typedef std::function<void()> Callback;
+  typedef int32_t Serial;
+
+  struct Metrics {
+    uint64_t dispatched = 0;
+    uint64_t canceled = 0;
+    // How late callbacks were taken off the queue compared to their due time
+    Clock::duration total_lag = Clock::duration::zero();
+    Clock::duration max_lag = Clock::duration::zero();
+  };
+
+  void Push(Clock::time_point when, Serial serial, Callback cb);
+
+  // Returns true if the callback was still pending.
+  bool Cancel(Serial serial);
+
+  // Due time of the earliest pending callback, if any.
+  std::optional<Clock::time_point> NextDeadline();
+
+  // Removes and returns the earliest callback if it is due at `now`.
+  std::optional<Callback> PopDue(Clock::time_point now);
+
+  size_t Size() const { return pending_.size(); }
+  const Metrics& GetMetrics() const { return metrics_; }
+
+ private:
+  struct Entry {
+    Clock::time_point when;
+    uint64_t sequence;
+    Serial serial;
+    Callback cb;
+  };
+
+  static bool DueLater(const Entry& a, const Entry& b);
+  void DropCanceledTop();
+
+  std::vector<Entry> heap_;
+  std::unordered_set<Serial> pending_;
+  uint64_t next_sequence_ = 0;
+  Metrics metrics_;
+};
+
 class ThreadLooper {
  public:
-  ThreadLooper();
+  using Clock = TimerQueue::Clock;
+
+  // `now` is only replaced by tests.
+  explicit ThreadLooper(std::function<Clock::time_point()> now = Clock::now);
   ~ThreadLooper();
 
   ThreadLooper(const ThreadLooper &) = delete;
   ThreadLooper &operator=(const ThreadLooper &) = delete;
 
-  typedef std::function<void()> Callback;
-  typedef int32_t Serial;
+  typedef TimerQueue::Callback Callback;
+  typedef TimerQueue::Serial Serial;
 
   Serial Post(Callback cb);
   Serial PostWithDelay(std::chrono::steady_clock::duration delay, Callback cb);
@@ -67,26 +124,21 @@ class ThreadLooper {
   // Returns true if matching event was canceled.
   bool CancelSerial(Serial serial);
 
- private:
-  struct Event {
-      std::chrono::steady_clock::time_point when;
-      Callback cb;
-      Serial serial;
-
-      bool operator<=(const Event &other) const;
-  };
+  TimerQueue::Metrics GetMetrics();
 
+ private:
+  std::function<Clock::time_point()> now_;
   bool stopped_;
   std::thread looper_thread_;
 
   std::mutex lock_;
   std::condition_variable cond_;
-  std::deque<Event> queue_;
+  TimerQueue queue_;
   std::atomic<Serial> next_serial_;
 
   void ThreadLoop();
 
-  void Insert(const Event &event);
+  void Insert(Clock::time_point when, Serial serial, Callback cb);
 };
 
 };  // namespace cuttlefish
@@ -0,0 +1,132 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/modem_simulator/remote_connection_pool.h"
+
+#include <sys/socket.h>
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+
+class RemoteConnectionPoolTest : public ::testing::Test {
+ protected:
+  RemoteConnectionPoolTest()
+      : pool_([this](const std::string& port) { return Connect(port); },
+              std::chrono::seconds(30)) {}
+
+  // Stands in for the remote instances, keeping their ends of the
+  // connections.
+  cuttlefish::SharedFD Connect(const std::string& port) {
+    connects_.push_back(port);
+    cuttlefish::SharedFD local, remote;
+    if (!cuttlefish::SharedFD::SocketPair(AF_UNIX, SOCK_STREAM, 0, &local,
+                                          &remote)) {
+      return cuttlefish::SharedFD();
+    }
+    remotes_.push_back(remote);
+    return local;
+  }
+
+  std::vector<std::string> connects_;
+  std::vector<cuttlefish::SharedFD> remotes_;
+  RemoteConnectionPool pool_;
+};
+
+TEST_F(RemoteConnectionPoolTest, ReusesConnectionToSamePort) {
+  bool is_new = false;
+  auto first = pool_.Acquire("6520", &is_new);
+  ASSERT_TRUE(first->IsOpen());
+  ASSERT_TRUE(is_new);
+  ASSERT_TRUE(pool_.Release(first));
+
+  auto second = pool_.Acquire("6520", &is_new);
+  ASSERT_FALSE(is_new);
+  ASSERT_EQ(first, second);
+  ASSERT_EQ(std::vector<std::string>{"6520"}, connects_);
+}
+
+TEST_F(RemoteConnectionPoolTest, ConnectsOncePerPort) {
+  bool is_new = false;
+  auto first = pool_.Acquire("6520", &is_new);
+  auto second = pool_.Acquire("6521", &is_new);
+  ASSERT_TRUE(is_new);
+  ASSERT_FALSE(first == second);
+  // Connections are shared by concurrent users
+  ASSERT_EQ(first, pool_.Acquire("6520", &is_new));
+  ASSERT_EQ(2u, connects_.size());
+}
+
+TEST_F(RemoteConnectionPoolTest, ReplacesConnectionClosedByRemote) {
+  bool is_new = false;
+  auto first = pool_.Acquire("6520", &is_new);
+  pool_.Release(first);
+  remotes_[0]->Close();
+
+  auto second = pool_.Acquire("6520", &is_new);
+  ASSERT_TRUE(is_new);
+  ASSERT_FALSE(first == second);
+  ASSERT_EQ(2u, connects_.size());
+}
+
+TEST_F(RemoteConnectionPoolTest, PendingDataDoesNotMakeConnectionUnhealthy) {
+  bool is_new = false;
+  auto first = pool_.Acquire("6520", &is_new);
+  pool_.Release(first);
+  ASSERT_EQ(3, remotes_[0]->Write("OK\r", 3));
+
+  ASSERT_EQ(first, pool_.Acquire("6520", &is_new));
+  ASSERT_FALSE(is_new);
+}
+
+TEST_F(RemoteConnectionPoolTest, ReleaseIgnoresOtherConnections) {
+  cuttlefish::SharedFD local, remote;
+  ASSERT_TRUE(cuttlefish::SharedFD::SocketPair(AF_UNIX, SOCK_STREAM, 0, &local,
+                                               &remote));
+  ASSERT_FALSE(pool_.Release(local));
+  ASSERT_FALSE(pool_.Contains(local));
+}
+
+TEST_F(RemoteConnectionPoolTest, OnlyUnusedConnectionsBecomeIdle) {
+  bool is_new = false;
+  auto busy = pool_.Acquire("6520", &is_new);
+  auto unused = pool_.Acquire("6521", &is_new);
+  ASSERT_FALSE(pool_.NextIdleDeadline());
+  pool_.Release(unused);
+
+  auto deadline = pool_.NextIdleDeadline();
+  ASSERT_TRUE(deadline);
+  ASSERT_TRUE(pool_.TakeIdle(*deadline - std::chrono::seconds(1)).empty());
+
+  auto idle = pool_.TakeIdle(*deadline);
+  ASSERT_EQ(1u, idle.size());
+  ASSERT_EQ(unused, idle[0]);
+  ASSERT_FALSE(pool_.Contains(unused));
+  ASSERT_TRUE(pool_.Contains(busy));
+  ASSERT_TRUE(pool_.TakeIdle(*deadline + std::chrono::hours(1)).empty());
+}
+
+TEST_F(RemoteConnectionPoolTest, RemovedConnectionIsNotReused) {
+  bool is_new = false;
+  auto first = pool_.Acquire("6520", &is_new);
+  pool_.Remove(first);
+  ASSERT_FALSE(pool_.Contains(first));
+
+  auto second = pool_.Acquire("6520", &is_new);
+  ASSERT_TRUE(is_new);
+  ASSERT_FALSE(first == second);
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,138 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/modem_simulator/sim_file_index.h"
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+
+namespace {
+
+constexpr char kProfile[] = R"(
+<IccProfile>
+<MF path="3F00">
+    <EF name="EF_ICCID" id="2FE2">
+        <SIMIO cmd="C0" p1="0" p2="0" p3="F" data="">144,0,ICCID_HEADER</SIMIO>
+        <SIMIO cmd="B0" p1="0" p2="0" p3="A" data="">144,0,ICCID</SIMIO>
+        <SIMIO cmd="B0" p1="0" p2="0" p3="A" data="">144,0,SHADOWED</SIMIO>
+    </EF>
+    <EF name="EF_ICCID_COPY" id="2FE2">
+        <SIMIO cmd="B0" p1="0" p2="0" p3="A" data="">144,0,SECOND_FILE</SIMIO>
+    </EF>
+    <DF name="TELECOM" path="7F10">
+        <EF name="EF_ADN" id="6F3A">
+            <SIMIO cmd="B2" p1="1" p2="4" p3="1C" data="">144,0,ADN1</SIMIO>
+            <SIMIO cmd="B2" p1="2" p2="4" p3="1C" data="">144,0,ADN2</SIMIO>
+        </EF>
+        <DF name="PHONEBOOK" path="5F3A">
+            <EF name="EF_PBR" id="4F30">
+                <SIMIO cmd="B2" p1="1" p2="4" p3="40" data="">144,0,PBR</SIMIO>
+            </EF>
+        </DF>
+    </DF>
+    <DF name="TELECOM_COPY" path="7F10">
+        <EF name="EF_ADN" id="6F3A">
+            <SIMIO cmd="B2" p1="1" p2="4" p3="1C" data="">144,0,SHADOWED_DF</SIMIO>
+        </EF>
+    </DF>
+    <DF name="ADF" path="7FFF">
+        <EF name="EF_AUTH" id="6F00">
+            <SIMIO p1="0" p2="0" p3="4" data="AB">144,0,ANY_CMD</SIMIO>
+            <SIMIO cmd="B0" p1="0" p2="0" p3="4">144,0,ANY_DATA</SIMIO>
+            <SIMIO cmd="B0" p1="0" p2="0" p3="4" data="CD">144,0,NEVER</SIMIO>
+        </EF>
+    </DF>
+</MF>
+</IccProfile>
+)";
+
+}  // namespace
+
+class SimFileIndexTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_EQ(doc_.Parse(kProfile), tinyxml2::XML_SUCCESS);
+    index_.Build(doc_.RootElement());
+  }
+
+  std::string Response(const std::string& path, const std::string& file_id,
+                       const std::string& command, const std::string& p1,
+                       const std::string& p2, const std::string& p3,
+                       const std::string& data) {
+    auto record = index_.Find(path, file_id, command, p1, p2, p3, data);
+    return record ? record->response : "";
+  }
+
+  tinyxml2::XMLDocument doc_;
+  SimFileIndex index_;
+};
+
+TEST_F(SimFileIndexTest, FindsRecordsByPathAndFileId) {
+  EXPECT_EQ(Response("3F00", "2FE2", "C0", "0", "0", "F", ""),
+            "144,0,ICCID_HEADER");
+  EXPECT_EQ(Response("3F007F10", "6F3A", "B2", "2", "4", "1C", ""),
+            "144,0,ADN2");
+  EXPECT_EQ(Response("3F007F105F3A", "4F30", "B2", "1", "4", "40", ""),
+            "144,0,PBR");
+
+  EXPECT_EQ(index_.Find("3F00", "6F3A", "B2", "1", "4", "1C", ""), nullptr);
+  EXPECT_EQ(index_.Find("3F007F10", "6F3A", "B2", "3", "4", "1C", ""),
+            nullptr);
+  EXPECT_EQ(index_.Find("3F00", "2FE2", "B0", "0", "0", "A", "00"), nullptr);
+}
+
+TEST_F(SimFileIndexTest, EarlierElementsShadowLaterOnes) {
+  // Same record twice, same file id twice and same path twice: the tree walk
+  // this replaced stopped at the first match.
+  EXPECT_EQ(Response("3F00", "2FE2", "B0", "0", "0", "A", ""), "144,0,ICCID");
+  EXPECT_EQ(Response("3F007F10", "6F3A", "B2", "1", "4", "1C", ""),
+            "144,0,ADN1");
+}
+
+TEST_F(SimFileIndexTest, MissingCommandOrDataMatchesAnything) {
+  EXPECT_EQ(Response("3F007FFF", "6F00", "88", "0", "0", "4", "AB"),
+            "144,0,ANY_CMD");
+  EXPECT_EQ(Response("3F007FFF", "6F00", "B0", "0", "0", "4", "CD"),
+            "144,0,ANY_DATA");
+  EXPECT_EQ(index_.Find("3F007FFF", "6F00", "88", "0", "0", "4", "CD"),
+            nullptr);
+}
+
+TEST_F(SimFileIndexTest, UpdatesMatchParametersAndChangeTheDocument) {
+  auto record = index_.Find("3F007F10", "6F3A", "DC", "2", "4", "1C", "FFFF");
+  ASSERT_NE(record, nullptr);
+  record->Update("144,0,FFFF");
+
+  EXPECT_EQ(Response("3F007F10", "6F3A", "B2", "2", "4", "1C", ""),
+            "144,0,FFFF");
+  EXPECT_STREQ(record->element->GetText(), "144,0,FFFF");
+
+  // Rebuilding from the document keeps the update
+  index_.Build(doc_.RootElement());
+  EXPECT_EQ(Response("3F007F10", "6F3A", "B2", "2", "4", "1C", ""),
+            "144,0,FFFF");
+}
+
+TEST_F(SimFileIndexTest, BuildingWithoutRootClearsTheIndex) {
+  ASSERT_GT(index_.FileCount(), 0u);
+  index_.Build(nullptr);
+  EXPECT_EQ(index_.FileCount(), 0u);
+  EXPECT_EQ(index_.Find("3F00", "2FE2", "C0", "0", "0", "F", ""), nullptr);
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,180 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/modem_simulator/thread_looper.h"
+
+#include <future>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+class TimerQueueTest : public ::testing::Test {
+ protected:
+  TimerQueue::Callback Record(const std::string& name) {
+    return [this, name]() { order_.push_back(name); };
+  }
+
+  // Runs everything due at `now`
+  void RunDue(TimerQueue::Clock::time_point now) {
+    while (auto cb = queue_.PopDue(now)) {
+      (*cb)();
+    }
+  }
+
+  const TimerQueue::Clock::time_point start_;
+  TimerQueue queue_;
+  std::vector<std::string> order_;
+};
+
+TEST_F(TimerQueueTest, RunsInDueOrder) {
+  queue_.Push(start_ + seconds(3), 1, Record("c"));
+  queue_.Push(start_ + seconds(1), 2, Record("a"));
+  queue_.Push(start_ + seconds(2), 3, Record("b"));
+
+  ASSERT_EQ(start_ + seconds(1), queue_.NextDeadline());
+  RunDue(start_);
+  ASSERT_TRUE(order_.empty());
+
+  RunDue(start_ + seconds(2));
+  ASSERT_EQ((std::vector<std::string>{"a", "b"}), order_);
+  ASSERT_EQ(start_ + seconds(3), queue_.NextDeadline());
+
+  RunDue(start_ + seconds(10));
+  ASSERT_EQ((std::vector<std::string>{"a", "b", "c"}), order_);
+  ASSERT_FALSE(queue_.NextDeadline());
+  ASSERT_EQ(0, queue_.Size());
+}
+
+TEST_F(TimerQueueTest, EqualDueTimesRunInPostOrder) {
+  for (int i = 0; i < 20; i++) {
+    queue_.Push(start_, i, Record(std::to_string(i)));
+  }
+  RunDue(start_);
+  ASSERT_EQ(20, order_.size());
+  for (int i = 0; i < 20; i++) {
+    ASSERT_EQ(std::to_string(i), order_[i]);
+  }
+}
+
+TEST_F(TimerQueueTest, CanceledCallbacksDontRun) {
+  queue_.Push(start_ + seconds(1), 1, Record("a"));
+  queue_.Push(start_ + seconds(2), 2, Record("b"));
+
+  ASSERT_TRUE(queue_.Cancel(1));
+  ASSERT_FALSE(queue_.Cancel(1));
+  ASSERT_EQ(1, queue_.Size());
+  ASSERT_EQ(start_ + seconds(2), queue_.NextDeadline());
+
+  RunDue(start_ + seconds(2));
+  ASSERT_EQ(std::vector<std::string>{"b"}, order_);
+  ASSERT_FALSE(queue_.Cancel(2));
+  ASSERT_EQ(1, queue_.GetMetrics().canceled);
+}
+
+TEST_F(TimerQueueTest, ManyCancellationsKeepOrder) {
+  // Enough canceled entries to compact the heap
+  for (int i = 0; i < 1000; i++) {
+    queue_.Push(start_ + milliseconds(1000 - i), i, Record(std::to_string(i)));
+  }
+  for (int i = 0; i < 1000; i++) {
+    if (i % 10 != 0) {
+      ASSERT_TRUE(queue_.Cancel(i));
+    }
+  }
+  ASSERT_EQ(100, queue_.Size());
+
+  RunDue(start_ + seconds(2));
+  ASSERT_EQ(100, order_.size());
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(std::to_string(990 - i * 10), order_[i]);
+  }
+}
+
+TEST_F(TimerQueueTest, RecordsSchedulingLag) {
+  queue_.Push(start_ + seconds(1), 1, Record("a"));
+  queue_.Push(start_ + seconds(2), 2, Record("b"));
+
+  RunDue(start_ + milliseconds(2500));
+
+  auto metrics = queue_.GetMetrics();
+  ASSERT_EQ(2, metrics.dispatched);
+  ASSERT_EQ(milliseconds(2000), metrics.total_lag);
+  ASSERT_EQ(milliseconds(1500), metrics.max_lag);
+}
+
+// The looper reads its time from a clock that only moves when told to.
+class ThreadLooperTest : public ::testing::Test {
+ protected:
+  ThreadLooperTest()
+      : looper_([this]() { return Now(); }) {}
+
+  ThreadLooper::Clock::time_point Now() {
+    return ThreadLooper::Clock::time_point(milliseconds(now_ms_.load()));
+  }
+
+  // Waits until everything posted before now has run.
+  void Sync() {
+    std::promise<void> done;
+    looper_.Post([&done]() { done.set_value(); });
+    ASSERT_EQ(std::future_status::ready,
+              done.get_future().wait_for(seconds(10)));
+  }
+
+  std::atomic<int64_t> now_ms_ = 1000;
+  ThreadLooper looper_;
+};
+
+TEST_F(ThreadLooperTest, DelayedEventsWaitForTheClock) {
+  std::atomic<int> ran = 0;
+  looper_.PostWithDelay(seconds(5), [&ran]() { ran++; });
+  Sync();
+  ASSERT_EQ(0, ran);
+
+  now_ms_ += 5000;
+  Sync();
+  ASSERT_EQ(1, ran);
+}
+
+TEST_F(ThreadLooperTest, CancelSerial) {
+  std::atomic<int> ran = 0;
+  auto serial = looper_.PostWithDelay(seconds(1), [&ran]() { ran++; });
+  ASSERT_TRUE(looper_.CancelSerial(serial));
+  ASSERT_FALSE(looper_.CancelSerial(serial));
+
+  now_ms_ += 1000;
+  Sync();
+  ASSERT_EQ(0, ran);
+  ASSERT_EQ(1, looper_.GetMetrics().canceled);
+}
+
+TEST(ThreadLooperRealClockTest, RunsDelayedEventAfterDelay) {
+  ThreadLooper looper;
+  std::promise<ThreadLooper::Clock::time_point> ran;
+  auto posted = ThreadLooper::Clock::now();
+  looper.PostWithDelay(milliseconds(20), [&ran]() {
+    ran.set_value(ThreadLooper::Clock::now());
+  });
+  auto future = ran.get_future();
+  ASSERT_EQ(std::future_status::ready, future.wait_for(seconds(10)));
+  ASSERT_GE(future.get() - posted, milliseconds(20));
+}
+
+}  // namespace cuttlefish
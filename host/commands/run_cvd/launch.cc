@@ -256,6 +256,8 @@ std::vector<Command> LaunchBluetoothConnector(const CuttlefishConfig& config) {
   command.AddParameter("-hci_port=", instance.rootcanal_hci_port());
   command.AddParameter("-link_port=", instance.rootcanal_link_port());
   command.AddParameter("-test_port=", instance.rootcanal_test_port());
+  command.AddParameter("-stats_file=",
+                       instance.PerInstancePath("bt_connector_stats.json"));
   return single_element_emplace(std::move(command));
 }
 
@@ -294,6 +296,8 @@ std::vector<Command> LaunchSecureEnvironment(const CuttlefishConfig& config) {
   bool secure_gatekeeper = secure_hals.count(SecureHal::Gatekeeper) > 0;
   auto gatekeeper_impl = secure_gatekeeper ? "tpm" : "software";
   command.AddParameter("-gatekeeper_impl=", gatekeeper_impl);
+  command.AddParameter("-stats_file=",
+                       instance.PerInstancePath("secure_env_stats.json"));
 
   return single_element_emplace(std::move(command));
 }
@@ -32,7 +32,7 @@ struct KernelLogMonitorData {
 KernelLogMonitorData LaunchKernelLogMonitor(const CuttlefishConfig& config,
                                             unsigned int number_of_event_pipes);
 std::vector<Command> LaunchAdbConnectorIfEnabled(
-    const CuttlefishConfig& config);
+    const CuttlefishConfig& config, SharedFD adbd_events_pipe);
 std::vector<Command> LaunchSocketVsockProxyIfEnabled(
     const CuttlefishConfig& config, SharedFD adbd_events_pipe);
 std::vector<Command> LaunchModemSimulatorIfEnabled(
@@ -70,7 +70,7 @@ bool AdbVsockConnectorEnabled(const CuttlefishConfig& config) {
 }  // namespace
 
 std::vector<Command> LaunchAdbConnectorIfEnabled(
-    const CuttlefishConfig& config) {
+    const CuttlefishConfig& config, SharedFD adbd_events_pipe) {
   Command adb_connector(AdbConnectorBinary());
   std::set<std::string> addresses;
 
@@ -90,6 +90,7 @@ std::vector<Command> LaunchAdbConnectorIfEnabled(
   }
   address_arg.pop_back();
   adb_connector.AddParameter(address_arg);
+  adb_connector.AddParameter("-adbd_events_fd=", adbd_events_pipe);
   std::vector<Command> commands;
   commands.emplace_back(std::move(adb_connector));
   return std::move(commands);
@@ -206,6 +206,17 @@ std::vector<Command> LaunchWebRTC(const CuttlefishConfig& config,
   webrtc.UnsetFromEnvironment({"http_proxy"});
 
   CreateStreamerServers(&webrtc, config);
+  webrtc.AddParameter(
+      "--input_stats_file=",
+      config.ForDefaultInstance().PerInstancePath("webrtc_input_stats.json"));
+  webrtc.AddParameter(
+      "--video_stats_file=",
+      config.ForDefaultInstance().PerInstancePath("webrtc_video_stats.json"));
+  if (config.enable_audio()) {
+    webrtc.AddParameter(
+        "--audio_stats_file=",
+        config.ForDefaultInstance().PerInstancePath("webrtc_audio_stats.json"));
+  }
 
   webrtc.AddParameter("--command_fd=", client_socket);
   webrtc.AddParameter("-kernel_log_events_fd=", kernel_log_events_pipe);
@@ -31,6 +31,7 @@
 #include "common/libs/utils/environment.h"
 #include "common/libs/utils/files.h"
 #include "common/libs/utils/network.h"
+#include "common/libs/utils/process_registry.h"
 #include "common/libs/utils/size_utils.h"
 #include "common/libs/utils/subprocess.h"
 #include "common/libs/utils/tee_logging.h"
@@ -41,6 +42,7 @@
 #include "host/commands/run_cvd/server_loop.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/vm_manager/host_configuration.h"
+#include "host/libs/vm_manager/placement_planner.h"
 #include "host/libs/vm_manager/vm_manager.h"
 
 DEFINE_int32(reboot_notification_fd, -1,
@@ -231,6 +233,19 @@ int RunCvdMain(int argc, char** argv) {
     return RunnerExitCodes::kInstanceDirCreationError;
   }
 
+  // Keep the host processes of this instance on the same NUMA node as its
+  // vCPUs and memory, off the cores any instance is pinned to. Every process
+  // launched from here inherits the binding, crosvm then pins the vCPU
+  // threads to their own cores.
+  if (instance.numa_node() >= 0) {
+    auto host_cpus = vm_manager::ParseCpuList(instance.host_cpu_affinity());
+    if (!host_cpus || host_cpus->empty() ||
+        !vm_manager::BindCurrentProcess(*host_cpus, instance.numa_node())) {
+      LOG(WARNING) << "Unable to bind to NUMA node " << instance.numa_node()
+                   << ", host processes will not be placed";
+    }
+  }
+
   auto used_tap_devices = TapInterfacesInUse();
   if (used_tap_devices.count(instance.wifi_tap_name())) {
     LOG(ERROR) << "Wifi TAP device already in use";
@@ -326,18 +341,28 @@ int RunCvdMain(int argc, char** argv) {
     close(FLAGS_reboot_notification_fd);
   }
 
+  // Register the launcher only now, daemonizing changes its pid. stop_cvd
+  // finds the processes of the device through the registry.
+  ProcessRegistry process_registry(
+      instance.PerInstanceInternalPath(kProcessRegistryDirName));
+  if (!process_registry.Register(getpid(), "run_cvd")) {
+    LOG(WARNING) << "Unable to register the launcher, stop_cvd may not find it";
+  }
+
   // Monitor and restart host processes supporting the CVD
-  ProcessMonitor process_monitor(config->restart_subprocesses());
+  ProcessMonitor process_monitor(config->restart_subprocesses(),
+                                 process_registry);
 
   if (config->enable_metrics() == CuttlefishConfig::kYes) {
     process_monitor.AddCommands(LaunchMetrics());
   }
   process_monitor.AddCommands(LaunchModemSimulatorIfEnabled(*config));
 
-  auto kernel_log_monitor = LaunchKernelLogMonitor(*config, 3);
+  auto kernel_log_monitor = LaunchKernelLogMonitor(*config, 4);
   SharedFD boot_events_pipe = kernel_log_monitor.pipes[0];
   SharedFD adbd_events_pipe = kernel_log_monitor.pipes[1];
   SharedFD webrtc_events_pipe = kernel_log_monitor.pipes[2];
+  SharedFD adb_connector_events_pipe = kernel_log_monitor.pipes[3];
   kernel_log_monitor.pipes.clear();
   process_monitor.AddCommands(std::move(kernel_log_monitor.commands));
 
@@ -371,7 +396,8 @@ int RunCvdMain(int argc, char** argv) {
   // Start other host processes
   process_monitor.AddCommands(
       LaunchSocketVsockProxyIfEnabled(*config, adbd_events_pipe));
-  process_monitor.AddCommands(LaunchAdbConnectorIfEnabled(*config));
+  process_monitor.AddCommands(
+      LaunchAdbConnectorIfEnabled(*config, adb_connector_events_pipe));
 
   CHECK(process_monitor.StartAndMonitorProcesses())
       << "Could not start subprocesses";
@@ -24,6 +24,7 @@
 #include <errno.h>
 #include <signal.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <thread>
@@ -39,9 +40,11 @@ struct ParentToChildMessage {
   bool stop;
 };
 
-ProcessMonitor::ProcessMonitor(bool restart_subprocesses)
-    : restart_subprocesses_(restart_subprocesses), monitor_(-1) {
-}
+ProcessMonitor::ProcessMonitor(bool restart_subprocesses,
+                               ProcessRegistry registry)
+    : restart_subprocesses_(restart_subprocesses),
+      registry_(std::move(registry)),
+      monitor_(-1) {}
 
 void ProcessMonitor::AddCommand(Command cmd) {
   CHECK(monitor_ == -1) << "The monitor process is already running.";
@@ -131,18 +134,34 @@ static void LogSubprocessExit(const std::string& name, pid_t pid, int wstatus) {
   }
 }
 
+// Starts `cmd` as the leader of its own process group.
+static Subprocess StartInGroup(const Command& cmd) {
+  cuttlefish::SubprocessOptions options;
+  options.InGroup(true);
+  auto proc = cmd.Start(options);
+  // The child moves itself into the group, but may not have done so yet when
+  // the registry reads its pgid. EACCES means it has already exec'd, and so
+  // already moved.
+  if (proc.Started() && setpgid(proc.pid(), proc.pid()) != 0 &&
+      errno != EACCES) {
+    PLOG(WARNING) << "setpgid failed for " << cmd.GetShortName();
+  }
+  return proc;
+}
+
 bool ProcessMonitor::MonitorRoutine() {
   // Make this process a subreaper to reliably catch subprocess exits.
   // See https://man7.org/linux/man-pages/man2/prctl.2.html
   prctl(PR_SET_CHILD_SUBREAPER, 1);
   prctl(PR_SET_PDEATHSIG, SIGHUP); // Die when parent dies
 
+  registry_.Register(getpid(), "process_monitor");
+
   LOG(DEBUG) << "Starting monitoring subprocesses";
   for (auto& monitored : monitored_processes_) {
-    cuttlefish::SubprocessOptions options;
-    options.InGroup(true);
-    monitored.proc.reset(new Subprocess(monitored.cmd->Start(options)));
+    monitored.proc.reset(new Subprocess(StartInGroup(*monitored.cmd)));
     CHECK(monitored.proc->Started()) << "Failed to start process";
+    registry_.Register(monitored.proc->pid(), monitored.cmd->GetShortName());
   }
 
   bool running = true;
@@ -184,10 +203,10 @@ bool ProcessMonitor::MonitorRoutine() {
       LogSubprocessExit("(unknown)", pid, wstatus);
     } else {
       LogSubprocessExit(it->cmd->GetShortName(), it->proc->pid(), wstatus);
+      registry_.Unregister(pid);
       if (restart_subprocesses_) {
-        cuttlefish::SubprocessOptions options;
-        options.InGroup(true);
-        it->proc.reset(new Subprocess(it->cmd->Start(options)));
+        it->proc.reset(new Subprocess(StartInGroup(*it->cmd)));
+        registry_.Register(it->proc->pid(), it->cmd->GetShortName());
       } else {
         monitored_processes_.erase(it);
       }
@@ -197,7 +216,7 @@ bool ProcessMonitor::MonitorRoutine() {
   parent_comms_thread.join(); // Should have exited if `running` is false
   // Processes were started in the order they appear in the vector, stop them in
   // reverse order for symmetry.
-  auto stop = [](const auto& it) {
+  auto stop = [this](const auto& it) {
     if (!it.proc->Stop()) {
       LOG(WARNING) << "Error in stopping \"" << it.cmd->GetShortName() << "\"";
       return false;
@@ -208,9 +227,11 @@ bool ProcessMonitor::MonitorRoutine() {
       LOG(WARNING) << "Failed to wait for process " << it.cmd->GetShortName();
       return false;
     }
+    registry_.Unregister(it.proc->pid());
     return true;
   };
   size_t stopped = std::count_if(monitored.rbegin(), monitored.rend(), stop);
+  registry_.Unregister(getpid());
   LOG(DEBUG) << "Done monitoring subprocesses";
   return stopped == monitored.size();
 }
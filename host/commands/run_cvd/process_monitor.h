@@ -20,6 +20,7 @@
 #include <thread>
 #include <vector>
 
+#include <common/libs/utils/process_registry.h>
 #include <common/libs/utils/subprocess.h>
 
 namespace cuttlefish {
@@ -32,10 +33,11 @@ struct MonitorEntry {
   std::unique_ptr<Subprocess> proc;
 };
 
-// Keeps track of launched subprocesses, restarts them if they unexpectedly exit
+// Keeps track of launched subprocesses, restarts them if they unexpectedly exit.
+// The monitor process and the running subprocesses are kept in the registry.
 class ProcessMonitor {
  public:
-  ProcessMonitor(bool restart_subprocesses);
+  ProcessMonitor(bool restart_subprocesses, ProcessRegistry registry);
   // Adds a command to the list of commands to be run and monitored. The
   // callback will be called when the subprocess has ended.  If the callback
   // returns false the subprocess will no longer be monitored. Can only be
@@ -57,6 +59,7 @@ class ProcessMonitor {
   bool MonitorRoutine();
 
   bool restart_subprocesses_;
+  ProcessRegistry registry_;
   std::vector<MonitorEntry> monitored_processes_;
   pid_t monitor_;
   SharedFD monitor_socket_;
@@ -17,6 +17,10 @@
 
 namespace cuttlefish {
 
+// Directory under the instance internal directory where the launcher and its
+// subprocesses are registered, see ProcessRegistry.
+constexpr char kProcessRegistryDirName[] = "processes";
+
 enum RunnerExitCodes : int {
   kSuccess = 0,
   kArgumentParsingError = 1,
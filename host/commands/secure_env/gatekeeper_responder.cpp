@@ -15,12 +15,16 @@
 
 #include "gatekeeper_responder.h"
 
+#include <chrono>
+
 #include <android-base/logging.h>
 #include <gatekeeper/gatekeeper_messages.h>
 
 GatekeeperResponder::GatekeeperResponder(
-    cuttlefish::GatekeeperChannel& channel, gatekeeper::GateKeeper& gatekeeper)
-    : channel_(channel), gatekeeper_(gatekeeper) {
+    cuttlefish::GatekeeperChannel& channel, gatekeeper::GateKeeper& gatekeeper,
+    std::mutex& tpm_lock, LatencyStats& stats)
+    : channel_(channel), gatekeeper_(gatekeeper), tpm_lock_(tpm_lock),
+      stats_(stats) {
 }
 
 bool GatekeeperResponder::ProcessMessage() {
@@ -29,6 +33,7 @@ bool GatekeeperResponder::ProcessMessage() {
     LOG(ERROR) << "Could not receive message";
     return false;
   }
+  auto received = std::chrono::steady_clock::now();
   const uint8_t* buffer = request->payload;
   const uint8_t* buffer_end = request->payload + request->payload_size;
   switch(request->cmd) {
@@ -41,8 +46,14 @@ bool GatekeeperResponder::ProcessMessage() {
         return false;
       }
       EnrollResponse response;
-      gatekeeper_.Enroll(enroll_request, &response);
-      return channel_.SendResponse(ENROLL, response);
+      {
+        std::lock_guard<std::mutex> lock(tpm_lock_);
+        gatekeeper_.Enroll(enroll_request, &response);
+      }
+      bool sent = channel_.SendResponse(ENROLL, response);
+      stats_.Record("gatekeeper/Enroll",
+                    std::chrono::steady_clock::now() - received);
+      return sent;
     }
     case VERIFY: {
       VerifyRequest verify_request;
@@ -52,8 +63,14 @@ bool GatekeeperResponder::ProcessMessage() {
         return false;
       }
       VerifyResponse response;
-      gatekeeper_.Verify(verify_request, &response);
-      return channel_.SendResponse(VERIFY, response);
+      {
+        std::lock_guard<std::mutex> lock(tpm_lock_);
+        gatekeeper_.Verify(verify_request, &response);
+      }
+      bool sent = channel_.SendResponse(VERIFY, response);
+      stats_.Record("gatekeeper/Verify",
+                    std::chrono::steady_clock::now() - received);
+      return sent;
     }
     default:
       LOG(ERROR) << "Unrecognized message id " << request->cmd;
@@ -15,17 +15,27 @@
 
 #pragma once
 
+#include <mutex>
+
 #include <gatekeeper/gatekeeper.h>
 
 #include "common/libs/security/gatekeeper_channel.h"
+#include "host/commands/secure_env/latency_stats.h"
 
+/**
+ * Serves Gatekeeper requests one at a time. Calls into the gatekeeper hold
+ * `tpm_lock`, as the TPM gatekeeper shares its TPM context with Keymaster.
+ */
 class GatekeeperResponder {
 private:
   cuttlefish::GatekeeperChannel& channel_;
   gatekeeper::GateKeeper& gatekeeper_;
+  std::mutex& tpm_lock_;
+  LatencyStats& stats_;
 public:
   GatekeeperResponder(cuttlefish::GatekeeperChannel& channel,
-                      gatekeeper::GateKeeper& gatekeeper);
+                      gatekeeper::GateKeeper& gatekeeper,
+                      std::mutex& tpm_lock, LatencyStats& stats);
 
   bool ProcessMessage();
 };
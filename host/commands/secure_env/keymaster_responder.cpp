@@ -15,34 +15,182 @@
 
 #include "keymaster_responder.h"
 
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string_view>
+
 #include <android-base/logging.h>
 #include <keymaster/android_keymaster_messages.h>
+#include <keymaster/serializable.h>
+
+using keymaster::AndroidKeymasterCommand;
+
+namespace {
+
+enum class Ordering { kOperation, kKey, kUnordered, kBarrier };
+
+Ordering CommandOrdering(AndroidKeymasterCommand command) {
+  switch (command) {
+    using namespace keymaster;
+    case UPDATE_OPERATION:
+    case FINISH_OPERATION:
+    case ABORT_OPERATION:
+      return Ordering::kOperation;
+    case BEGIN_OPERATION:
+    case EXPORT_KEY:
+    case GET_KEY_CHARACTERISTICS:
+    case ATTEST_KEY:
+    case UPGRADE_KEY:
+    case DELETE_KEY:
+      return Ordering::kKey;
+    // These change state that every other request depends on.
+    case ADD_RNG_ENTROPY:
+    case CONFIGURE:
+    case DELETE_ALL_KEYS:
+    case GET_HMAC_SHARING_PARAMETERS:
+    case COMPUTE_SHARED_HMAC:
+    case DEVICE_LOCKED:
+    case EARLY_BOOT_ENDED:
+      return Ordering::kBarrier;
+    default:
+      return Ordering::kUnordered;
+  }
+}
+
+template <typename Request>
+bool KeyBlobLane(const cuttlefish::keymaster_message& message,
+                 int32_t message_version, uint64_t* lane) {
+  Request request(message_version);
+  const uint8_t* buffer = message.payload;
+  if (!request.Deserialize(&buffer, buffer + message.payload_size)) {
+    return false;
+  }
+  std::string_view key_blob(
+      reinterpret_cast<const char*>(request.key_blob.key_material),
+      request.key_blob.key_material_size);
+  *lane = std::hash<std::string_view>()(key_blob);
+  return true;
+}
+
+} // namespace
 
 KeymasterResponder::KeymasterResponder(
-    cuttlefish::KeymasterChannel& channel, keymaster::AndroidKeymaster& keymaster)
-    : channel_(channel), keymaster_(keymaster) {
+    cuttlefish::KeymasterChannel& channel, keymaster::AndroidKeymaster& keymaster,
+    std::mutex& keymaster_lock, OrderedTaskPool& pool, LatencyStats& stats)
+    : channel_(channel), keymaster_(keymaster), keymaster_lock_(keymaster_lock),
+      pool_(pool), stats_(stats) {
 }
 
 bool KeymasterResponder::ProcessMessage() {
-  auto request = channel_.ReceiveMessage();
+  std::optional<uint32_t> request_id;
+  auto request = channel_.ReceiveMessage(&request_id);
   if (!request) {
     LOG(ERROR) << "Could not receive message";
     return false;
   }
-  const uint8_t* buffer = request->payload;
-  const uint8_t* end = request->payload + request->payload_size;
-  switch(request->cmd) {
+  auto received = std::chrono::steady_clock::now();
+  if (!request_id) {
+    // The guest expects the response before any later one, so the request is
+    // handled before reading the next. The probe is answered with an id to
+    // tell the guest request ids are understood.
+    if (cuttlefish::IsRequestIdProbe(*request)) {
+      request_id = 0;
+    }
+    const char* command_name = "Unknown";
+    bool handled = HandleMessage(*request, request_id, &command_name);
+    stats_.Record(std::string("keymaster/") + command_name,
+                  std::chrono::steady_clock::now() - received);
+    return handled;
+  }
+  uint64_t lane = 0;
+  auto ordering = CommandOrdering(request->cmd);
+  if (ordering == Ordering::kOperation) {
+    // Update, finish and abort requests start with the operation handle.
+    const uint8_t* buffer = request->payload;
+    const uint8_t* end = buffer + request->payload_size;
+    if (!keymaster::copy_uint64_from_buf(&buffer, end, &lane)) {
+      ordering = Ordering::kBarrier;
+    }
+  } else if (ordering == Ordering::kKey) {
+    using namespace keymaster;
+    auto version = keymaster_.message_version();
+    bool found = false;
+    switch (request->cmd) {
+      case BEGIN_OPERATION:
+        found = KeyBlobLane<BeginOperationRequest>(*request, version, &lane);
+        break;
+      case EXPORT_KEY:
+        found = KeyBlobLane<ExportKeyRequest>(*request, version, &lane);
+        break;
+      case GET_KEY_CHARACTERISTICS:
+        found = KeyBlobLane<GetKeyCharacteristicsRequest>(*request, version,
+                                                          &lane);
+        break;
+      case ATTEST_KEY:
+        found = KeyBlobLane<AttestKeyRequest>(*request, version, &lane);
+        break;
+      case UPGRADE_KEY:
+        found = KeyBlobLane<UpgradeKeyRequest>(*request, version, &lane);
+        break;
+      case DELETE_KEY:
+        found = KeyBlobLane<DeleteKeyRequest>(*request, version, &lane);
+        break;
+      default:
+        break;
+    }
+    if (!found) {
+      ordering = Ordering::kBarrier;
+    }
+  }
+  // std::function needs a copyable callable.
+  std::shared_ptr<cuttlefish::keymaster_message> shared_request(
+      request.release(), cuttlefish::KeymasterCommandDestroyer());
+  auto task = [this, shared_request, request_id, received]() {
+    const char* command_name = "Unknown";
+    if (!HandleMessage(*shared_request, request_id, &command_name)) {
+      LOG(ERROR) << "Failed to handle request " << *request_id << " for "
+                 << command_name;
+    }
+    stats_.Record(std::string("keymaster/") + command_name,
+                  std::chrono::steady_clock::now() - received);
+  };
+  switch (ordering) {
+    case Ordering::kOperation:
+    case Ordering::kKey:
+      pool_.SubmitOnLane(lane, std::move(task));
+      break;
+    case Ordering::kBarrier:
+      pool_.SubmitBarrier(std::move(task));
+      break;
+    case Ordering::kUnordered:
+      pool_.SubmitUnordered(std::move(task));
+      break;
+  }
+  return true;
+}
+
+bool KeymasterResponder::HandleMessage(
+    const cuttlefish::keymaster_message& message,
+    std::optional<uint32_t> request_id, const char** command_name) {
+  const uint8_t* buffer = message.payload;
+  const uint8_t* end = message.payload + message.payload_size;
+  switch(message.cmd) {
     using namespace keymaster;
 #define HANDLE_MESSAGE(ENUM_NAME, METHOD_NAME) \
     case ENUM_NAME: {\
+      *command_name = #METHOD_NAME; \
       METHOD_NAME##Request request(keymaster_.message_version()); \
       if (!request.Deserialize(&buffer, end)) { \
         LOG(ERROR) << "Failed to deserialize " #METHOD_NAME "Request"; \
         return false; \
       } \
       METHOD_NAME##Response response(keymaster_.message_version()); \
-      keymaster_.METHOD_NAME(request, &response); \
-      return channel_.SendResponse(ENUM_NAME, response); \
+      { \
+        std::lock_guard<std::mutex> lock(keymaster_lock_); \
+        keymaster_.METHOD_NAME(request, &response); \
+      } \
+      return channel_.SendResponse(ENUM_NAME, response, request_id); \
     }
     HANDLE_MESSAGE(GENERATE_KEY, GenerateKey)
     HANDLE_MESSAGE(BEGIN_OPERATION, BeginOperation)
@@ -69,13 +217,16 @@ bool KeymasterResponder::ProcessMessage() {
 #undef HANDLE_MESSAGE
 #define HANDLE_MESSAGE_W_RETURN(ENUM_NAME, METHOD_NAME) \
     case ENUM_NAME: {\
+      *command_name = #METHOD_NAME; \
     METHOD_NAME##Request request(keymaster_.message_version());     \
       if (!request.Deserialize(&buffer, end)) { \
         LOG(ERROR) << "Failed to deserialize " #METHOD_NAME "Request"; \
         return false; \
       } \
+      std::unique_lock<std::mutex> lock(keymaster_lock_); \
       auto response = keymaster_.METHOD_NAME(request); \
-      return channel_.SendResponse(ENUM_NAME, response); \
+      lock.unlock(); \
+      return channel_.SendResponse(ENUM_NAME, response, request_id); \
     }
     HANDLE_MESSAGE_W_RETURN(COMPUTE_SHARED_HMAC, ComputeSharedHmac)
     HANDLE_MESSAGE_W_RETURN(VERIFY_AUTHORIZATION, VerifyAuthorization)
@@ -84,26 +235,33 @@ bool KeymasterResponder::ProcessMessage() {
 #undef HANDLE_MESSAGE
 #define HANDLE_MESSAGE_W_RETURN_NO_ARG(ENUM_NAME, METHOD_NAME) \
     case ENUM_NAME: {\
+      *command_name = #METHOD_NAME; \
+      std::unique_lock<std::mutex> lock(keymaster_lock_); \
       auto response = keymaster_.METHOD_NAME(); \
-      return channel_.SendResponse(ENUM_NAME, response); \
+      lock.unlock(); \
+      return channel_.SendResponse(ENUM_NAME, response, request_id); \
     }
     HANDLE_MESSAGE_W_RETURN_NO_ARG(GET_HMAC_SHARING_PARAMETERS, GetHmacSharingParameters)
     HANDLE_MESSAGE_W_RETURN_NO_ARG(EARLY_BOOT_ENDED, EarlyBootEnded)
 #undef HANDLE_MESSAGE
     case ADD_RNG_ENTROPY: {
+      *command_name = "AddRngEntropy";
       AddEntropyRequest request(keymaster_.message_version());
       if (!request.Deserialize(&buffer, end)) {
         LOG(ERROR) << "Failed to deserialize AddEntropyRequest";
         return false;
       }
       AddEntropyResponse response(keymaster_.message_version());;
-      keymaster_.AddRngEntropy(request, &response);
-      return channel_.SendResponse(ADD_RNG_ENTROPY, response);
+      {
+        std::lock_guard<std::mutex> lock(keymaster_lock_);
+        keymaster_.AddRngEntropy(request, &response);
+      }
+      return channel_.SendResponse(ADD_RNG_ENTROPY, response, request_id);
     }
     case DESTROY_ATTESTATION_IDS:
       // Cuttlefish doesn't support ID attestation.
     default:
-      LOG(ERROR) << "Unknown request type: " << request->cmd;
+      LOG(ERROR) << "Unknown request type: " << message.cmd;
       return false;
   }
 }
@@ -15,17 +15,46 @@
 
 #pragma once
 
+#include <mutex>
+#include <optional>
+
 #include <keymaster/android_keymaster.h>
 
 #include "common/libs/security/keymaster_channel.h"
+#include "host/commands/secure_env/latency_stats.h"
+#include "host/commands/secure_env/ordered_task_pool.h"
 
+/**
+ * Serves Keymaster requests that carry a request id on a pool of worker
+ * threads, sending each response tagged with that id as soon as it is ready.
+ * Requests without an id come from guests that expect responses in request
+ * order, and are served one at a time.
+ *
+ * Requests on the same operation, or on the same key blob, run in the order
+ * they arrived. Requests that change state shared by all keys run alone.
+ * AndroidKeymaster and the TPM context behind it are not thread-safe, so the
+ * calls into it still happen under `keymaster_lock`; decoding, encoding and
+ * the transport overlap.
+ */
 class KeymasterResponder {
 private:
   cuttlefish::KeymasterChannel& channel_;
   keymaster::AndroidKeymaster& keymaster_;
+  std::mutex& keymaster_lock_;
+  OrderedTaskPool& pool_;
+  LatencyStats& stats_;
+
+  bool HandleMessage(const cuttlefish::keymaster_message& request,
+                     std::optional<uint32_t> request_id,
+                     const char** command_name);
 public:
   KeymasterResponder(cuttlefish::KeymasterChannel& channel,
-                     keymaster::AndroidKeymaster& keymaster);
+                     keymaster::AndroidKeymaster& keymaster,
+                     std::mutex& keymaster_lock, OrderedTaskPool& pool,
+                     LatencyStats& stats);
 
+  /**
+   * Receives one request, and either answers it or schedules it on the pool.
+   */
   bool ProcessMessage();
 };
@@ -0,0 +1,38 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "latency_stats.h"
+
+#include "common/libs/utils/stats_file.h"
+
+void LatencyStats::Record(const std::string& command,
+                          std::chrono::steady_clock::duration latency) {
+  cuttlefish::LatencyHistogram* histogram;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Map nodes never move, so the histogram can be updated without the lock.
+    histogram = &histograms_[command];
+  }
+  histogram->Record(latency);
+}
+
+Json::Value LatencyStats::ToJson() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Json::Value json(Json::objectValue);
+  for (const auto& [command, histogram] : histograms_) {
+    json[command] = cuttlefish::HistogramToJson(histogram);
+  }
+  return json;
+}
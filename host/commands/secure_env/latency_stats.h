@@ -0,0 +1,41 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <json/json.h>
+
+#include "common/libs/utils/latency_histogram.h"
+
+/**
+ * Latency histograms of the commands served by secure_env, by command name.
+ * Latencies run from receiving a request to sending its response, so they
+ * include the time spent waiting behind other requests.
+ */
+class LatencyStats {
+public:
+  void Record(const std::string& command,
+              std::chrono::steady_clock::duration latency);
+
+  Json::Value ToJson();
+private:
+  std::mutex mutex_;
+  std::map<std::string, cuttlefish::LatencyHistogram> histograms_;
+};
@@ -0,0 +1,108 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ordered_task_pool.h"
+
+#include <algorithm>
+
+OrderedTaskPool::OrderedTaskPool(size_t num_threads) {
+  for (size_t i = 0; i < std::max<size_t>(num_threads, 1); i++) {
+    workers_.emplace_back([this]() { Work(); });
+  }
+}
+
+OrderedTaskPool::~OrderedTaskPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  changed_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void OrderedTaskPool::SubmitOnLane(uint64_t lane, Task task) {
+  Submit(Entry{Kind::kLane, lane, std::move(task)});
+}
+
+void OrderedTaskPool::SubmitUnordered(Task task) {
+  Submit(Entry{Kind::kUnordered, 0, std::move(task)});
+}
+
+void OrderedTaskPool::SubmitBarrier(Task task) {
+  Submit(Entry{Kind::kBarrier, 0, std::move(task)});
+}
+
+void OrderedTaskPool::Submit(Entry entry) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(std::move(entry));
+  }
+  changed_.notify_all();
+}
+
+bool OrderedTaskPool::TakeRunnable(Entry* entry) {
+  if (barrier_running_) {
+    return false;
+  }
+  // Lanes seen earlier in the queue, whose later entries have to wait.
+  std::set<uint64_t> blocked_lanes;
+  for (auto it = queue_.begin(); it != queue_.end(); it++) {
+    if (it->kind == Kind::kBarrier) {
+      if (it != queue_.begin() || running_ > 0) {
+        return false;
+      }
+    } else if (it->kind == Kind::kLane) {
+      if (busy_lanes_.count(it->lane) > 0 || blocked_lanes.count(it->lane)) {
+        blocked_lanes.insert(it->lane);
+        continue;
+      }
+    }
+    *entry = std::move(*it);
+    queue_.erase(it);
+    return true;
+  }
+  return false;
+}
+
+void OrderedTaskPool::Work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    Entry entry;
+    changed_.wait(lock, [this, &entry]() {
+      return TakeRunnable(&entry) || (stopping_ && queue_.empty());
+    });
+    if (!entry.task) {
+      return;
+    }
+    running_++;
+    if (entry.kind == Kind::kBarrier) {
+      barrier_running_ = true;
+    } else if (entry.kind == Kind::kLane) {
+      busy_lanes_.insert(entry.lane);
+    }
+    lock.unlock();
+    entry.task();
+    lock.lock();
+    running_--;
+    if (entry.kind == Kind::kBarrier) {
+      barrier_running_ = false;
+    } else if (entry.kind == Kind::kLane) {
+      busy_lanes_.erase(entry.lane);
+    }
+    changed_.notify_all();
+  }
+}
@@ -0,0 +1,69 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+/**
+ * A pool of worker threads that runs independent tasks concurrently while
+ * keeping the order between related ones.
+ *
+ * Tasks submitted on the same lane run one at a time, in submission order.
+ * Unordered tasks can run at any time. A barrier task waits for every task
+ * submitted before it to finish, and holds back every task submitted after it
+ * until it finishes itself.
+ */
+class OrderedTaskPool {
+public:
+  using Task = std::function<void()>;
+
+  OrderedTaskPool(size_t num_threads);
+  /** Runs the tasks already submitted, then stops the workers. */
+  ~OrderedTaskPool();
+
+  void SubmitOnLane(uint64_t lane, Task task);
+  void SubmitUnordered(Task task);
+  void SubmitBarrier(Task task);
+
+private:
+  enum class Kind { kLane, kUnordered, kBarrier };
+  struct Entry {
+    Kind kind;
+    uint64_t lane;
+    Task task;
+  };
+
+  void Submit(Entry entry);
+  void Work();
+  // Removes and returns the first queued entry that may run now.
+  bool TakeRunnable(Entry* entry);
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::deque<Entry> queue_;
+  std::set<uint64_t> busy_lanes_;
+  size_t running_ = 0;
+  bool barrier_running_ = false;
+  bool stopping_ = false;
+  std::vector<std::thread> workers_;
+};
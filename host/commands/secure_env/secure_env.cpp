@@ -13,6 +13,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <chrono>
+#include <mutex>
 #include <thread>
 
 #include <android-base/logging.h>
@@ -26,12 +28,15 @@
 #include "common/libs/fs/shared_fd.h"
 #include "common/libs/security/gatekeeper_channel.h"
 #include "common/libs/security/keymaster_channel.h"
+#include "common/libs/utils/stats_file.h"
 #include "host/commands/secure_env/device_tpm.h"
 #include "host/commands/secure_env/fragile_tpm_storage.h"
 #include "host/commands/secure_env/gatekeeper_responder.h"
 #include "host/commands/secure_env/insecure_fallback_storage.h"
 #include "host/commands/secure_env/in_process_tpm.h"
 #include "host/commands/secure_env/keymaster_responder.h"
+#include "host/commands/secure_env/latency_stats.h"
+#include "host/commands/secure_env/ordered_task_pool.h"
 #include "host/commands/secure_env/soft_gatekeeper.h"
 #include "host/commands/secure_env/tpm_gatekeeper.h"
 #include "host/commands/secure_env/tpm_keymaster_context.h"
@@ -57,6 +62,14 @@ DEFINE_string(keymint_impl, "tpm",
 DEFINE_string(gatekeeper_impl, "tpm",
               "The gatekeeper implementation. \"tpm\" or \"software\"");
 
+DEFINE_int32(keymaster_threads, 4,
+             "Number of threads serving keymaster requests concurrently");
+DEFINE_string(stats_file, "",
+              "If set, per-command latency histograms are written to this "
+              "file as json every few seconds");
+
+constexpr std::chrono::seconds kStatsInterval(10);
+
 int main(int argc, char** argv) {
   cuttlefish::DefaultSubprocessLogging(argv);
   gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -153,30 +166,47 @@ int main(int argc, char** argv) {
                                   << keymaster_out->StrError();
   close(FLAGS_gatekeeper_fd_out);
 
-  std::thread keymaster_thread([keymaster_in, keymaster_out, &keymaster]() {
+  // The keymaster and the gatekeeper share the TPM context, and neither they
+  // nor the context are thread-safe.
+  std::mutex core_lock;
+  LatencyStats stats;
+  OrderedTaskPool keymaster_pool(FLAGS_keymaster_threads);
+
+  std::thread keymaster_thread([keymaster_in, keymaster_out, &keymaster,
+                                &core_lock, &keymaster_pool, &stats]() {
+    // Responses can still be in flight on the pool, so the channel is kept
+    // for the lifetime of the thread.
+    cuttlefish::KeymasterChannel keymaster_channel(
+        keymaster_in, keymaster_out);
+
+    KeymasterResponder keymaster_responder(keymaster_channel, keymaster,
+                                           core_lock, keymaster_pool, stats);
     while (true) {
-      cuttlefish::KeymasterChannel keymaster_channel(
-          keymaster_in, keymaster_out);
-
-      KeymasterResponder keymaster_responder(keymaster_channel, keymaster);
-
       while (keymaster_responder.ProcessMessage()) {
       }
     }
   });
 
-  std::thread gatekeeper_thread([gatekeeper_in, gatekeeper_out, &gatekeeper]() {
+  std::thread gatekeeper_thread([gatekeeper_in, gatekeeper_out, &gatekeeper,
+                                 &core_lock, &stats]() {
     while (true) {
       cuttlefish::GatekeeperChannel gatekeeper_channel(
           gatekeeper_in, gatekeeper_out);
 
-      GatekeeperResponder gatekeeper_responder(gatekeeper_channel, *gatekeeper);
+      GatekeeperResponder gatekeeper_responder(gatekeeper_channel, *gatekeeper,
+                                               core_lock, stats);
 
       while (gatekeeper_responder.ProcessMessage()) {
       }
     }
   });
 
+  cuttlefish::StatsFileWriter stats_writer(kStatsInterval);
+  if (FLAGS_stats_file != "") {
+    stats_writer.AddFile(FLAGS_stats_file,
+                         [&stats]() { return stats.ToJson(); });
+  }
+
   keymaster_thread.join();
   gatekeeper_thread.join();
 }
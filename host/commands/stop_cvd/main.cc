@@ -28,8 +28,10 @@
 #include <signal.h>
 
 #include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <fstream>
+#include <future>
 #include <iomanip>
 #include <memory>
 #include <sstream>
@@ -43,6 +45,7 @@
 #include "common/libs/fs/shared_fd.h"
 #include "common/libs/fs/shared_select.h"
 #include "common/libs/utils/environment.h"
+#include "common/libs/utils/process_registry.h"
 #include "host/commands/run_cvd/runner_defs.h"
 #include "host/libs/allocd/request.h"
 #include "host/libs/allocd/utils.h"
@@ -56,6 +59,29 @@ DEFINE_int32(wait_for_launcher, 5,
 namespace cuttlefish {
 namespace {
 
+// How long to wait for killed processes to exit.
+constexpr std::chrono::seconds kKillTimeout(5);
+
+std::string RegistryDir(const std::string& instance_dir) {
+  return instance_dir + "/" + kInternalDirName + "/" + kProcessRegistryDirName;
+}
+
+std::vector<RegisteredProcess> FallbackProcesses() {
+  std::vector<RegisteredProcess> processes;
+  std::string parent_path = StringFromEnv("HOME", ".");
+  std::unique_ptr<DIR, int(*)(DIR*)> dir(opendir(parent_path.c_str()), closedir);
+  for (auto entity = readdir(dir.get()); entity != nullptr; entity = readdir(dir.get())) {
+    std::string subdir(entity->d_name);
+    if (!android::base::StartsWith(subdir, "cuttlefish_runtime.")) {
+      continue;
+    }
+    auto registered =
+        ProcessRegistry(RegistryDir(parent_path + "/" + subdir)).Processes();
+    processes.insert(processes.end(), registered.begin(), registered.end());
+  }
+  return processes;
+}
+
 std::set<std::string> FallbackPaths() {
   std::set<std::string> paths;
   std::string parent_path = StringFromEnv("HOME", ".");
@@ -128,9 +154,18 @@ std::set<pid_t> GetCandidateProcessGroups(const std::set<std::string>& paths) {
   return ret;
 }
 
-int FallBackStop(const std::set<std::string>& paths) {
+int FallBackStop(const std::vector<RegisteredProcess>& processes,
+                 const std::set<std::string>& paths) {
   auto exit_code = 1; // Having to fallback is an error
 
+  if (!processes.empty() &&
+      !KillRegisteredProcesses(processes, kKillTimeout)) {
+    exit_code |= 4;
+  }
+
+  // Processes that weren't registered, such as those of devices launched
+  // before the process registry existed or children that left their group,
+  // can only be found through their open files.
   auto process_groups = GetCandidateProcessGroups(paths);
   for (auto pgid: process_groups) {
     LOG(INFO) << "Sending SIGKILL to process group " << pgid;
@@ -145,7 +180,22 @@ int FallBackStop(const std::set<std::string>& paths) {
   return exit_code;
 }
 
-bool CleanStopInstance(const CuttlefishConfig::InstanceSpecific& instance) {
+bool CleanStopInstance(const CuttlefishConfig::InstanceSpecific& instance,
+                       const std::vector<RegisteredProcess>& processes) {
+  // When the launcher is registered its exit can be waited for, there is no
+  // need to wait for the timeout if it dies instead of responding.
+  SharedFD launcher;
+  for (const auto& process : processes) {
+    if (process.name == "run_cvd") {
+      if (!IsRegisteredProcessRunning(process)) {
+        LOG(ERROR) << "The launcher is not running";
+        return false;
+      }
+      // Stays closed on kernels without pidfds, only the monitor's response
+      // is waited for then.
+      launcher = OpenRegisteredProcess(process);
+    }
+  }
   auto monitor_path = instance.launcher_monitor_socket_path();
   if (monitor_path.empty()) {
     LOG(ERROR) << "No path to launcher monitor found";
@@ -168,6 +218,9 @@ bool CleanStopInstance(const CuttlefishConfig::InstanceSpecific& instance) {
   // Perform a select with a timeout to guard against launcher hanging
   SharedFDSet read_set;
   read_set.Set(monitor_socket);
+  if (launcher->IsOpen()) {
+    read_set.Set(launcher);
+  }
   struct timeval timeout = {FLAGS_wait_for_launcher, 0};
   int selected = Select(&read_set, nullptr, nullptr,
                         FLAGS_wait_for_launcher <= 0 ? nullptr : &timeout);
@@ -180,6 +233,10 @@ bool CleanStopInstance(const CuttlefishConfig::InstanceSpecific& instance) {
     LOG(ERROR) << "Timeout expired waiting for launcher monitor to respond";
     return false;
   }
+  if (!read_set.IsSet(monitor_socket)) {
+    LOG(ERROR) << "The launcher exited without responding";
+    return false;
+  }
   LauncherResponse response;
   auto bytes_recv = monitor_socket->Recv(&response, sizeof(response), 0);
   if (bytes_recv < 0) {
@@ -198,9 +255,12 @@ bool CleanStopInstance(const CuttlefishConfig::InstanceSpecific& instance) {
 
 int StopInstance(const CuttlefishConfig& config,
                  const CuttlefishConfig::InstanceSpecific& instance) {
-  bool res = CleanStopInstance(instance);
+  auto processes =
+      ProcessRegistry(instance.PerInstanceInternalPath(kProcessRegistryDirName))
+          .Processes();
+  bool res = CleanStopInstance(instance, processes);
   if (!res) {
-    return FallBackStop(PathsForInstance(config, instance));
+    return FallBackStop(processes, PathsForInstance(config, instance));
   }
   return 0;
 }
@@ -235,28 +295,35 @@ int StopCvdMain(int argc, char** argv) {
   auto config = CuttlefishConfig::Get();
   if (!config) {
     LOG(ERROR) << "Failed to obtain config object";
-    return FallBackStop(FallbackPaths());
+    return FallBackStop(FallbackProcesses(), FallbackPaths());
   }
 
-  int ret = 0;
+  // The instances are independent, stop them all at once.
+  std::vector<std::future<int>> stops;
   for (const auto& instance : config->Instances()) {
-    auto session_id = instance.session_id();
-    int exit_status = StopInstance(*config, instance);
-    if (exit_status == 0 && instance.use_allocd()) {
-      // only release session resources if the instance was stopped
-      SharedFD allocd_sock =
-          SharedFD::SocketLocalClient(kDefaultLocation, false, SOCK_STREAM);
-      if (!allocd_sock->IsOpen()) {
-        LOG(ERROR) << "Unable to connect to allocd on "
-                   << kDefaultLocation << ": "
-                   << allocd_sock->StrError();
-      }
+    stops.push_back(std::async(std::launch::async, [&config, instance]() {
+      auto session_id = instance.session_id();
+      int exit_status = StopInstance(*config, instance);
+      if (exit_status == 0 && instance.use_allocd()) {
+        // only release session resources if the instance was stopped
+        SharedFD allocd_sock =
+            SharedFD::SocketLocalClient(kDefaultLocation, false, SOCK_STREAM);
+        if (!allocd_sock->IsOpen()) {
+          LOG(ERROR) << "Unable to connect to allocd on "
+                     << kDefaultLocation << ": "
+                     << allocd_sock->StrError();
+        }
 
-      ReleaseAllocdResources(allocd_sock, session_id);
-    }
-    ret |= exit_status;
+        ReleaseAllocdResources(allocd_sock, session_id);
+      }
+      return exit_status;
+    }));
   }
 
+  int ret = 0;
+  for (auto& stop : stops) {
+    ret |= stop.get();
+  }
   return ret;
 }
 
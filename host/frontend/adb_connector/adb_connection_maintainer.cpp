@@ -14,17 +14,23 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cctype>
 #include <iomanip>
+#include <map>
+#include <optional>
 #include <sstream>
 #include <string>
 #include <memory>
 #include <vector>
 #include <android-base/logging.h>
+#include <android-base/strings.h>
 
 #include <unistd.h>
 
 #include "common/libs/fs/shared_fd.h"
+#include "common/libs/fs/shared_select.h"
+#include "host/commands/kernel_log_monitor/utils.h"
 #include "host/frontend/adb_connector/adb_connection_maintainer.h"
 
 namespace {
@@ -36,14 +42,6 @@ std::string MakeMessage(const std::string& user_message) {
   return ss.str();
 }
 
-std::string MakeShellUptimeMessage() {
-  return MakeMessage("shell,raw:cut -d. -f1 /proc/uptime");
-}
-
-std::string MakeTransportMessage(const std::string& address) {
-  return MakeMessage("host:transport:" + address);
-}
-
 std::string MakeConnectMessage(const std::string& address) {
   return MakeMessage("host:connect:" + address);
 }
@@ -52,6 +50,10 @@ std::string MakeDisconnectMessage(const std::string& address) {
   return MakeMessage("host:disconnect:" + address);
 }
 
+std::string MakeTrackDevicesMessage() {
+  return MakeMessage("host:track-devices");
+}
+
 // returns true if successfully sent the whole message
 bool SendAll(cuttlefish::SharedFD sock, const std::string& msg) {
   ssize_t total_written{};
@@ -104,113 +106,231 @@ bool AdbSendMessage(cuttlefish::SharedFD sock, const std::string& message) {
   return RecvAll(sock, kAdbStatusResponseLength) == kAdbOkayStatusResponse;
 }
 
-bool AdbSendMessage(const std::string& message) {
-  auto sock = cuttlefish::SharedFD::SocketLocalClient(kAdbDaemonPort, SOCK_STREAM);
-  return AdbSendMessage(sock, message);
-}
-
-bool AdbConnect(const std::string& address) {
-  return AdbSendMessage(MakeConnectMessage(address));
-}
-
-bool AdbDisconnect(const std::string& address) {
-  return AdbSendMessage(MakeDisconnectMessage(address));
-}
-
-bool IsInteger(const std::string& str) {
+bool IsHex(const std::string& str) {
   return !str.empty() && std::all_of(str.begin(), str.end(),
-                                     [](char c) { return std::isdigit(c); });
+                                     [](char c) { return std::isxdigit(c); });
 }
 
 // assumes the OKAY/FAIL status has already been read
-std::string RecvAdbResponse(cuttlefish::SharedFD sock) {
+std::optional<std::string> RecvAdbResponse(cuttlefish::SharedFD sock) {
   auto length_as_hex_str = RecvAll(sock, kAdbMessageLengthLength);
-  if (!IsInteger(length_as_hex_str)) {
+  if (!IsHex(length_as_hex_str)) {
     return {};
   }
   auto length = std::stoi(length_as_hex_str, nullptr, 16);
-  return RecvAll(sock, length);
+  if (length == 0) {
+    return "";
+  }
+  auto response = RecvAll(sock, length);
+  if (response.empty()) {
+    return {};
+  }
+  return response;
 }
 
-// Returns a negative value if uptime result couldn't be read for
-// any reason.
-int RecvUptimeResult(cuttlefish::SharedFD sock) {
-  std::vector<char> uptime_vec{};
-  std::vector<char> just_read(16);
-  do {
-    auto count = sock->Read(just_read.data(), just_read.size());
-    if (count < 0) {
-      LOG(WARNING) << "couldn't receive adb shell output";
-      return -1;
-    }
-    just_read.resize(count);
-    uptime_vec.insert(uptime_vec.end(), just_read.begin(), just_read.end());
-  } while (!just_read.empty());
+// The adb server answers host:connect with OKAY even when it couldn't connect,
+// the outcome is in the message that follows.
+bool AdbConnect(const std::string& address) {
+  auto sock =
+      cuttlefish::SharedFD::SocketLocalClient(kAdbDaemonPort, SOCK_STREAM);
+  if (!AdbSendMessage(sock, MakeConnectMessage(address))) {
+    return false;
+  }
+  auto response = RecvAdbResponse(sock);
+  if (!response) {
+    return false;
+  }
+  LOG(DEBUG) << "adb connect " << address << ": " << *response;
+  return android::base::StartsWith(*response, "connected to") ||
+         android::base::StartsWith(*response, "already connected to");
+}
 
-  if (uptime_vec.empty()) {
-    LOG(WARNING) << "empty adb shell result";
-    return -1;
+bool AdbDisconnect(const std::string& address) {
+  auto sock =
+      cuttlefish::SharedFD::SocketLocalClient(kAdbDaemonPort, SOCK_STREAM);
+  return AdbSendMessage(sock, MakeDisconnectMessage(address));
+}
+
+// A device list from host:track-devices, one "<serial>\t<state>" per line.
+std::map<std::string, std::string> ParseDeviceList(const std::string& list) {
+  std::map<std::string, std::string> devices;
+  for (const auto& line : android::base::Split(list, "\n")) {
+    auto fields = android::base::Split(line, "\t");
+    if (fields.size() >= 2) {
+      devices[fields[0]] = fields[1];
+    }
   }
+  return devices;
+}
+
+timeval ToTimeval(std::chrono::steady_clock::duration duration) {
+  auto usec =
+      std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+  usec = std::max<decltype(usec)>(usec, 0);
+  return timeval{.tv_sec = static_cast<time_t>(usec / 1000000),
+                 .tv_usec = static_cast<suseconds_t>(usec % 1000000)};
+}
 
-  uptime_vec.pop_back();
+}  // namespace
 
-  auto uptime_str = std::string{uptime_vec.data(), uptime_vec.size()};
-  if (!IsInteger(uptime_str)) {
-    LOG(WARNING) << "non-numeric: uptime result: " << uptime_str;
-    return -1;
+namespace cuttlefish {
+
+AdbConnectionMaintainer::AdbConnectionMaintainer(
+    const std::vector<std::string>& addresses, SharedFD adbd_events)
+    : adbd_events_(adbd_events) {
+  for (const auto& address : addresses) {
+    devices_[address] = Device{.online = false, .retry = {}};
   }
+}
 
-  return std::stoi(uptime_str);
+void AdbConnectionMaintainer::Retry::Schedule() {
+  next_attempt = Clock::now() + backoff;
+  backoff = std::min(backoff * 2, kMaxBackoff);
 }
 
-// There needs to be a gap between the adb commands, the daemon isn't able to
-// handle the avalanche of requests we would be sending without a sleep. Five
-// seconds is much larger than seems necessary so we should be more than okay.
-static constexpr int kAdbCommandGapTime = 5;
+void AdbConnectionMaintainer::Retry::Reset() {
+  backoff = kMinBackoff;
+  next_attempt = Clock::now();
+}
 
-void EstablishConnection(const std::string& address) {
-  LOG(DEBUG) << "Attempting to connect to device with address " << address;
-  while (!AdbConnect(address)) {
-    sleep(kAdbCommandGapTime);
+bool AdbConnectionMaintainer::OpenTracker() {
+  auto sock = SharedFD::SocketLocalClient(kAdbDaemonPort, SOCK_STREAM);
+  if (!AdbSendMessage(sock, MakeTrackDevicesMessage())) {
+    return false;
   }
-  LOG(DEBUG) << "adb connect message for " << address << " successfully sent";
-  sleep(kAdbCommandGapTime);
+  LOG(DEBUG) << "Tracking devices of the adb server";
+  tracker_ = sock;
+  // A new adb server doesn't know about the devices, the first list tells
+  // which ones are still connected.
+  for (auto& [address, device] : devices_) {
+    device.online = false;
+    device.retry.Reset();
+  }
+  return true;
 }
 
-void WaitForAdbDisconnection(const std::string& address) {
-  // adb daemon doesn't seem to handle quick, successive messages well. The
-  // sleeps stabilize the communication.
-  LOG(DEBUG) << "Watching for disconnect on " << address;
-  while (true) {
-    auto sock = cuttlefish::SharedFD::SocketLocalClient(kAdbDaemonPort, SOCK_STREAM);
-    if (!AdbSendMessage(sock, MakeTransportMessage(address))) {
-      LOG(WARNING) << "transport message failed, response body: "
-                   << RecvAdbResponse(sock);
-      break;
+void AdbConnectionMaintainer::ReadDeviceList() {
+  auto list = RecvAdbResponse(tracker_);
+  if (!list) {
+    LOG(WARNING) << "Lost the device tracking stream of the adb server";
+    tracker_->Close();
+    tracker_ = SharedFD();
+    tracker_retry_.Reset();
+    return;
+  }
+  auto states = ParseDeviceList(*list);
+  for (auto& [address, device] : devices_) {
+    auto iter = states.find(address);
+    bool online = iter != states.end() && iter->second == "device";
+    if (online && !device.online) {
+      LOG(DEBUG) << "adb reports " << address << " as online";
+      device.retry.Reset();
+    } else if (!online && device.online) {
+      LOG(DEBUG) << "adb reports " << address << " as "
+                 << (iter == states.end() ? "gone" : iter->second);
+      // Drop the stale transport before connecting again
+      AdbDisconnect(address);
+      device.retry.Reset();
     }
-    if (!AdbSendMessage(sock, MakeShellUptimeMessage())) {
-      LOG(WARNING) << "adb shell uptime message failed";
-      break;
+    device.online = online;
+  }
+}
+
+void AdbConnectionMaintainer::ReadAdbdEvent() {
+  auto event = monitor::ReadEvent(adbd_events_);
+  if (!event) {
+    LOG(ERROR) << "Failed to read a kernel log event, ignoring boot events";
+    adbd_events_ = SharedFD();
+    return;
+  }
+  if (event->event != monitor::Event::AdbdStarted) {
+    return;
+  }
+  LOG(DEBUG) << "Adbd has started in the guest, connecting now";
+  for (auto& [address, device] : devices_) {
+    if (!device.online) {
+      device.retry.Reset();
     }
+  }
+}
 
-    auto uptime = RecvUptimeResult(sock);
-    if (uptime < 0) {
-      LOG(WARNING) << "couldn't read uptime result";
-      break;
+void AdbConnectionMaintainer::ConnectDueDevices() {
+  auto now = Clock::now();
+  for (auto& [address, device] : devices_) {
+    if (device.online || device.retry.next_attempt > now) {
+      continue;
+    }
+    // A successful connect is confirmed by the tracker, if that doesn't
+    // happen before the backoff expires try again.
+    if (!AdbConnect(address)) {
+      LOG(VERBOSE) << "Unable to connect to " << address << ", retrying in "
+                   << std::chrono::duration_cast<std::chrono::milliseconds>(
+                          device.retry.backoff)
+                          .count()
+                   << "ms";
     }
-    LOG(VERBOSE) << "device on " << address << " uptime " << uptime;
-    sleep(kAdbCommandGapTime);
+    device.retry.Schedule();
   }
-  LOG(DEBUG) << "Sending adb disconnect";
-  AdbDisconnect(address);
-  sleep(kAdbCommandGapTime);
 }
 
-}  // namespace
+AdbConnectionMaintainer::Clock::time_point
+AdbConnectionMaintainer::NextDeadline() const {
+  auto deadline = Clock::time_point::max();
+  if (!tracker_->IsOpen()) {
+    deadline = tracker_retry_.next_attempt;
+  } else {
+    for (const auto& [address, device] : devices_) {
+      if (!device.online) {
+        deadline = std::min(deadline, device.retry.next_attempt);
+      }
+    }
+  }
+  return deadline;
+}
 
-[[noreturn]] void cuttlefish::EstablishAndMaintainConnection(std::string address) {
+[[noreturn]] void AdbConnectionMaintainer::Run() {
+  for (const auto& [address, device] : devices_) {
+    LOG(DEBUG) << "Maintaining adb connection to " << address;
+  }
   while (true) {
-    EstablishConnection(address);
-    WaitForAdbDisconnection(address);
+    if (!tracker_->IsOpen() && tracker_retry_.next_attempt <= Clock::now()) {
+      if (!OpenTracker()) {
+        tracker_retry_.Schedule();
+      }
+    }
+    if (tracker_->IsOpen()) {
+      ConnectDueDevices();
+    }
+
+    SharedFDSet read_set;
+    if (tracker_->IsOpen()) {
+      read_set.Set(tracker_);
+    }
+    if (adbd_events_->IsOpen()) {
+      read_set.Set(adbd_events_);
+    }
+    auto deadline = NextDeadline();
+    timeval timeout;
+    timeval* timeout_ptr = nullptr;
+    if (deadline != Clock::time_point::max()) {
+      timeout = ToTimeval(deadline - Clock::now());
+      timeout_ptr = &timeout;
+    }
+    int ready = Select(&read_set, nullptr, nullptr, timeout_ptr);
+    if (ready < 0) {
+      if (errno != EINTR) {
+        PLOG(ERROR) << "select failed";
+        sleep(1);
+      }
+      continue;
+    }
+    if (tracker_->IsOpen() && read_set.IsSet(tracker_)) {
+      ReadDeviceList();
+    }
+    if (adbd_events_->IsOpen() && read_set.IsSet(adbd_events_)) {
+      ReadAdbdEvent();
+    }
   }
 }
+
+}  // namespace cuttlefish
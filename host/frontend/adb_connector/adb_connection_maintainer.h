@@ -15,8 +15,61 @@
  */
 #pragma once
 
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+
 namespace cuttlefish {
 
-[[noreturn]] void EstablishAndMaintainConnection(std::string address);
+/**
+ * Keeps the host adb server connected to the devices at the given addresses.
+ *
+ * Device states come from a single host:track-devices stream, so a device
+ * that goes away is reconnected as soon as the adb server notices. Failed
+ * connection attempts are retried with exponential backoff, which restarts
+ * from the minimum when the guest starts adbd.
+ */
+class AdbConnectionMaintainer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // `adbd_events` is a kernel log monitor subscription, it may be closed.
+  AdbConnectionMaintainer(const std::vector<std::string>& addresses,
+                          SharedFD adbd_events);
+
+  [[noreturn]] void Run();
+
+ private:
+  static constexpr Clock::duration kMinBackoff = std::chrono::milliseconds(500);
+  // The fixed gap between adb commands used to be five seconds.
+  static constexpr Clock::duration kMaxBackoff = std::chrono::seconds(5);
+
+  struct Retry {
+    Clock::duration backoff = kMinBackoff;
+    Clock::time_point next_attempt = {};
+
+    void Schedule();
+    void Reset();
+  };
+
+  struct Device {
+    bool online;
+    Retry retry;
+  };
+
+  bool OpenTracker();
+  void ReadDeviceList();
+  void ReadAdbdEvent();
+  void ConnectDueDevices();
+  Clock::time_point NextDeadline() const;
+
+  std::map<std::string, Device> devices_;
+  SharedFD tracker_;
+  Retry tracker_retry_;
+  SharedFD adbd_events_;
+};
 
 }  // namespace cuttlefish
@@ -16,9 +16,7 @@
 
 #include <algorithm>
 #include <iterator>
-#include <limits>
 #include <sstream>
-#include <thread>
 #include <vector>
 
 #include <android-base/logging.h>
@@ -35,12 +33,11 @@
 
 DEFINE_string(addresses, "", "Comma-separated list of addresses to "
                              "'adb connect' to");
+DEFINE_int32(adbd_events_fd, -1, "A file descriptor. If set, connection "
+                                 "attempts are retried right away when the "
+                                 "kernel log reports that adbd started");
 
 namespace {
-void LaunchConnectionMaintainerThread(const std::string& address) {
-  std::thread(cuttlefish::EstablishAndMaintainConnection, address).detach();
-}
-
 std::vector<std::string> ParseAddressList(std::string ports) {
   std::replace(ports.begin(), ports.end(), ',', ' ');
   std::istringstream port_stream{ports};
@@ -48,12 +45,6 @@ std::vector<std::string> ParseAddressList(std::string ports) {
           std::istream_iterator<std::string>{}};
 }
 
-[[noreturn]] void SleepForever() {
-  while (true) {
-    sleep(std::numeric_limits<unsigned int>::max());
-  }
-}
-
 }  // namespace
 
 int main(int argc, char* argv[]) {
@@ -61,9 +52,13 @@ int main(int argc, char* argv[]) {
   gflags::ParseCommandLineFlags(&argc, &argv, true);
   CHECK(!FLAGS_addresses.empty()) << "Must specify --addresses flag";
 
-  for (auto address : ParseAddressList(FLAGS_addresses)) {
-    LaunchConnectionMaintainerThread(address);
+  cuttlefish::SharedFD adbd_events;
+  if (FLAGS_adbd_events_fd >= 0) {
+    adbd_events = cuttlefish::SharedFD::Dup(FLAGS_adbd_events_fd);
+    close(FLAGS_adbd_events_fd);
   }
 
-  SleepForever();
+  cuttlefish::AdbConnectionMaintainer maintainer(
+      ParseAddressList(FLAGS_addresses), adbd_events);
+  maintainer.Run();
 }
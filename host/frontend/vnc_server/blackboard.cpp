@@ -17,6 +17,7 @@
 #include "host/frontend/vnc_server/blackboard.h"
 
 #include <algorithm>
+#include <string>
 #include <utility>
 
 #include <gflags/gflags.h>
@@ -144,20 +145,26 @@ void BlackBoard::set_frame_buffer_watcher(
   frame_buffer_watcher_ = frame_buffer_watcher;
 }
 
-void BlackBoard::set_jpeg_quality_level(int quality_level) {
-  // NOTE all vnc clients share a common jpeg quality level because the
-  // server doesn't compress per-client. The quality level for all clients
-  // will be whatever the most recent set was by any client.
+void BlackBoard::SetJpegQuality(const VncClientConnection* conn,
+                                std::optional<int> jpeg_quality) {
   std::lock_guard<std::mutex> guard(m_);
-  if (quality_level < kJpegMinQualityEncoding ||
-      quality_level > kJpegMaxQualityEncoding) {
-    LOG(WARNING) << "Bogus jpeg quality level: " << quality_level
-                 << ". Quality must be in range [" << kJpegMinQualityEncoding
-                 << ", " << kJpegMaxQualityEncoding << "]";
-    return;
+  GetStateForClient(conn).jpeg_quality = jpeg_quality;
+  DLOG(INFO) << "jpeg quality set to "
+             << (jpeg_quality ? std::to_string(*jpeg_quality) : "none");
+}
+
+std::vector<int> BlackBoard::JpegQualitiesInUse(
+    ScreenOrientation orientation) const {
+  std::lock_guard<std::mutex> guard(m_);
+  std::vector<int> qualities;
+  for (const auto& [conn, state] : clients_) {
+    if (state.orientation == orientation && state.jpeg_quality &&
+        std::find(qualities.begin(), qualities.end(), *state.jpeg_quality) ==
+            qualities.end()) {
+      qualities.push_back(*state.jpeg_quality);
+    }
   }
-  jpeg_quality_level_ = 55 + (5 * (quality_level + 32));
-  DLOG(INFO) << "jpeg quality level set to " << jpeg_quality_level_ << "%";
+  return qualities;
 }
 
 BlackBoard::ClientFBUState& BlackBoard::GetStateForClient(
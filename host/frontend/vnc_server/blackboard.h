@@ -20,7 +20,9 @@
 #include <condition_variable>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <unordered_map>
+#include <vector>
 
 #include "common/libs/concurrency/thread_annotations.h"
 #include "host/frontend/vnc_server/vnc_utils.h"
@@ -30,7 +32,6 @@ namespace vnc {
 
 class VncClientConnection;
 class FrameBufferWatcher;
-using StripePtrVec = std::vector<std::shared_ptr<const Stripe>>;
 using SeqNumberVec = std::vector<StripeSeqNumber>;
 
 SeqNumberVec MakeSeqNumberVec();
@@ -43,6 +44,8 @@ class BlackBoard {
     std::condition_variable new_frame_cv;
     SeqNumberVec stripe_seq_nums = MakeSeqNumberVec();
     bool closed{};
+    // The libjpeg quality if the client receives jpeg stripes.
+    std::optional<int> jpeg_quality{};
   };
 
  public:
@@ -84,14 +87,13 @@ class BlackBoard {
 
   void set_frame_buffer_watcher(FrameBufferWatcher* frame_buffer_watcher);
 
-  // quality_level must be the value received from the client, in the range
-  // [kJpegMinQualityEncoding, kJpegMaxQualityEncoding], else it is ignored.
-  void set_jpeg_quality_level(int quality_level);
-
-  int jpeg_quality_level() const {
-    std::lock_guard<std::mutex> guard(m_);
-    return jpeg_quality_level_;
-  }
+  // The libjpeg quality of the stripes sent to the client, nullopt if it
+  // doesn't receive jpeg stripes.
+  void SetJpegQuality(const VncClientConnection* conn,
+                      std::optional<int> jpeg_quality);
+  // The jpeg qualities wanted by the clients in the given orientation, which
+  // are worth compressing the new stripes to right away.
+  std::vector<int> JpegQualitiesInUse(ScreenOrientation orientation) const;
 
  private:
   ClientFBUState& GetStateForClient(const VncClientConnection* conn)
@@ -102,7 +104,6 @@ class BlackBoard {
   SeqNumberVec most_recent_stripe_seq_nums_ GUARDED_BY(m_) = MakeSeqNumberVec();
   std::unordered_map<const VncClientConnection*, ClientFBUState> clients_
       GUARDED_BY(m_);
-  int jpeg_quality_level_ GUARDED_BY(m_) = 100;
   std::condition_variable new_client_cv_;
   // NOTE the FrameBufferWatcher pointer itself should be
   // guarded, but not the pointee.
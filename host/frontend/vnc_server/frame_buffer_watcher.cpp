@@ -26,6 +26,7 @@
 #include <utility>
 
 #include <android-base/logging.h>
+#include "host/frontend/vnc_server/scroll_copy.h"
 #include "host/frontend/vnc_server/vnc_utils.h"
 
 using cuttlefish::vnc::FrameBufferWatcher;
@@ -136,11 +137,14 @@ bool FrameBufferWatcher::UpdateStripeIfStripeIsNew(
   return false;
 }
 
+// The stripes are compressed here, in parallel, for the clients known to want
+// them. Clients with other needs encode the stripes when sending them, the
+// results are shared through the stripe either way.
 void FrameBufferWatcher::CompressStripe(JpegCompressor* jpeg_compressor,
-                                        Stripe* stripe) {
-  stripe->jpeg_data = jpeg_compressor->Compress(
-      stripe->raw_data, bb_->jpeg_quality_level(), 0, 0, stripe->width,
-      stripe->height, stripe->stride);
+                                        const Stripe& stripe) {
+  for (auto quality : bb_->JpegQualitiesInUse(stripe.orientation)) {
+    jpeg_compressor->CompressStripe(stripe, quality);
+  }
 }
 
 void FrameBufferWatcher::Worker() {
@@ -167,15 +171,17 @@ void FrameBufferWatcher::Worker() {
     auto seq_num = portrait_stripe.seq_number;
     auto index = portrait_stripe.index;
     auto landscape_stripe = Rotated(portrait_stripe);
+    ComputeRowHashes(&portrait_stripe);
     auto stripes = {std::make_shared<Stripe>(std::move(portrait_stripe)),
                     std::make_shared<Stripe>(std::move(landscape_stripe))};
     for (auto& stripe : stripes) {
+      stripe->encodings = std::make_shared<StripeEncodings>();
 #ifdef FUZZ_TEST_VNC
       if (random(e)) {
         usleep(10000);
       }
 #endif
-      CompressStripe(&jpeg_compressor, stripe.get());
+      CompressStripe(&jpeg_compressor, *stripe);
     }
     bool any_new_stripes = false;
     for (auto& stripe : stripes) {
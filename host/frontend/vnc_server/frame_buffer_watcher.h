@@ -57,8 +57,8 @@ class FrameBufferWatcher {
   // returns true if stripe is still considered new and was updated
   bool UpdateStripeIfStripeIsNew(const std::shared_ptr<const Stripe>& stripe)
       EXCLUDES(stripes_lock_);
-  // Compresses stripe->raw_data to stripe->jpeg_data
-  void CompressStripe(JpegCompressor* jpeg_compressor, Stripe* stripe);
+  // Compresses the stripe to the jpeg qualities its clients want
+  void CompressStripe(JpegCompressor* jpeg_compressor, const Stripe& stripe);
   void Worker();
   void Updater();
 
@@ -68,6 +68,17 @@ cuttlefish::Message JpegCompressor::Compress(const Message& frame,
   return {compression_buffer, compression_buffer + compression_buffer_size};
 }
 
+std::shared_ptr<const cuttlefish::Message> JpegCompressor::CompressStripe(
+    const Stripe& stripe, int jpeg_quality) {
+  return stripe.encodings->Get(
+      {cuttlefish::vnc::kTightEncoding,
+       static_cast<std::uint32_t>(jpeg_quality)},
+      [this, &stripe, jpeg_quality]() {
+        return Compress(stripe.raw_data, jpeg_quality, 0, 0, stripe.width,
+                        stripe.height, stripe.stride);
+      });
+}
+
 void JpegCompressor::UpdateBuffer(std::uint8_t* compression_buffer,
                                   unsigned long compression_buffer_size) {
   if (buffer_.get() != compression_buffer) {
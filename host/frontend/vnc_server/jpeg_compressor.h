@@ -37,6 +37,11 @@ class JpegCompressor {
                    std::uint16_t y, std::uint16_t width, std::uint16_t height,
                    int screen_width);
 
+  // Compresses a published stripe, unless it was already compressed with
+  // the same quality.
+  std::shared_ptr<const Message> CompressStripe(const Stripe& stripe,
+                                                int jpeg_quality);
+
  private:
   void UpdateBuffer(std::uint8_t* compression_buffer,
                     unsigned long compression_buffer_size);
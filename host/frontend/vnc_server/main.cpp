@@ -37,7 +37,8 @@ int main(int argc, char* argv[]) {
 
   auto& host_mode_ctrl = cuttlefish::HostModeCtrl::Get();
   auto screen_connector_ptr = cuttlefish::vnc::ScreenConnector::Get(
-      FLAGS_frame_server_fd, host_mode_ctrl);
+      FLAGS_frame_server_fd, host_mode_ctrl,
+      cuttlefish::kVncFrameRingSocketName);
   auto& screen_connector = *(screen_connector_ptr.get());
 
   // create confirmation UI service, giving host_mode_ctrl and
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/vnc_server/scroll_copy.h"
+
+#include <cstring>
+#include <unordered_map>
+
+namespace cuttlefish {
+namespace vnc {
+
+void ComputeRowHashes(Stripe* stripe) {
+  constexpr std::uint64_t kMultiplier = 0x9e3779b97f4a7c15ull;
+  size_t row_size = stripe->width * ScreenConnectorInfo::BytesPerPixel();
+  stripe->row_hashes.resize(stripe->height);
+  for (std::uint16_t y = 0; y < stripe->height; ++y) {
+    const auto* row = &stripe->raw_data[y * stripe->stride];
+    std::uint64_t hash = row_size;
+    size_t i = 0;
+    for (; i + sizeof(std::uint64_t) <= row_size; i += sizeof(std::uint64_t)) {
+      std::uint64_t word;
+      std::memcpy(&word, row + i, sizeof(word));
+      hash = (hash ^ word) * kMultiplier;
+      hash ^= hash >> 29;
+    }
+    // The last pixel of rows with an odd width
+    for (; i < row_size; ++i) {
+      hash = (hash ^ row[i]) * kMultiplier;
+    }
+    // 0 stands for unknown rows
+    stripe->row_hashes[y] = hash | 1;
+  }
+}
+
+std::optional<ScrollCopy> FindScroll(
+    const std::vector<std::uint64_t>& client_rows,
+    const StripePtrVec& stripes) {
+  // Smaller moves aren't worth an extra rectangle.
+  constexpr int kMinScrollRows = 32;
+  const int height = static_cast<int>(client_rows.size());
+  // The rows of the client screen once the stripes are shown
+  auto rows = client_rows;
+  std::vector<int> changed_rows;
+  for (const auto& stripe : stripes) {
+    if (stripe->row_hashes.size() != stripe->height ||
+        stripe->y + stripe->height > height) {
+      return std::nullopt;
+    }
+    for (int i = 0; i < stripe->height; ++i) {
+      int y = stripe->y + i;
+      if (rows[y] != stripe->row_hashes[i]) {
+        rows[y] = stripe->row_hashes[i];
+        changed_rows.push_back(y);
+      }
+    }
+  }
+  if (changed_rows.size() < kMinScrollRows) {
+    return std::nullopt;
+  }
+
+  // Only rows found once on the client screen tell how far the content
+  // moved, blank rows are everywhere.
+  std::unordered_map<std::uint64_t, int> client_row_positions;
+  for (int y = 0; y < height; ++y) {
+    if (client_rows[y] == 0) {
+      continue;
+    }
+    auto [it, inserted] = client_row_positions.emplace(client_rows[y], y);
+    if (!inserted) {
+      it->second = -1;
+    }
+  }
+  std::unordered_map<int, int> votes;
+  for (auto y : changed_rows) {
+    auto it = client_row_positions.find(rows[y]);
+    if (it != client_row_positions.end() && it->second >= 0) {
+      ++votes[y - it->second];
+    }
+  }
+  int dy = 0;
+  int dy_votes = 0;
+  for (const auto& [candidate, count] : votes) {
+    if (candidate != 0 && count > dy_votes) {
+      dy = candidate;
+      dy_votes = count;
+    }
+  }
+  if (dy_votes < kMinScrollRows) {
+    return std::nullopt;
+  }
+
+  // The longest band of the new screen the client already shows dy rows away
+  int band_start = 0;
+  int band_height = 0;
+  int run_start = 0;
+  for (int y = 0; y <= height; ++y) {
+    int src_y = y - dy;
+    bool moved = y < height && 0 <= src_y && src_y < height &&
+                 client_rows[src_y] != 0 && rows[y] == client_rows[src_y];
+    if (moved) {
+      continue;
+    }
+    if (y - run_start > band_height) {
+      band_start = run_start;
+      band_height = y - run_start;
+    }
+    run_start = y + 1;
+  }
+  if (band_height < kMinScrollRows) {
+    return std::nullopt;
+  }
+  ScrollCopy copy{static_cast<std::uint16_t>(band_start - dy),
+                  static_cast<std::uint16_t>(band_start),
+                  static_cast<std::uint16_t>(band_height)};
+  // Pointless unless it saves sending a stripe
+  for (const auto& stripe : stripes) {
+    if (copy.Covers(*stripe)) {
+      return copy;
+    }
+  }
+  return std::nullopt;
+}
+
+}  // namespace vnc
+}  // namespace cuttlefish
@@ -0,0 +1,49 @@
+#pragma once
+
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "host/frontend/vnc_server/vnc_utils.h"
+
+namespace cuttlefish {
+namespace vnc {
+
+// Rows moved up or down on the client screen with a CopyRect rectangle.
+struct ScrollCopy {
+  std::uint16_t src_y;
+  std::uint16_t dst_y;
+  std::uint16_t height;
+
+  bool Covers(const Stripe& stripe) const {
+    return dst_y <= stripe.y && stripe.y + stripe.height <= dst_y + height;
+  }
+};
+
+// Fills the row hashes of a portrait stripe.
+void ComputeRowHashes(Stripe* stripe);
+
+// Finds content of the client screen that the stripes show scrolled.
+// client_rows has the hash of every row the client shows, 0 if unknown.
+std::optional<ScrollCopy> FindScroll(
+    const std::vector<std::uint64_t>& client_rows,
+    const StripePtrVec& stripes);
+
+}  // namespace vnc
+}  // namespace cuttlefish
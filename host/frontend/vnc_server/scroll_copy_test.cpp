@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/vnc_server/scroll_copy.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace vnc {
+namespace {
+
+constexpr int kHeight = 320;
+constexpr int kStripeHeight = 16;
+
+// A screen of distinct rows, which are never 0.
+std::vector<std::uint64_t> Screen(std::uint64_t first_row) {
+  std::vector<std::uint64_t> rows;
+  for (int y = 0; y < kHeight; y++) {
+    rows.push_back((first_row + y) * 2 + 1);
+  }
+  return rows;
+}
+
+// The stripes showing the given rows.
+StripePtrVec Stripes(const std::vector<std::uint64_t>& rows) {
+  StripePtrVec stripes;
+  for (int y = 0; y < kHeight; y += kStripeHeight) {
+    auto stripe = std::make_shared<Stripe>();
+    stripe->y = y;
+    stripe->height = kStripeHeight;
+    stripe->row_hashes.assign(rows.begin() + y,
+                              rows.begin() + y + kStripeHeight);
+    stripes.push_back(stripe);
+  }
+  return stripes;
+}
+
+TEST(FindScroll, FindsContentScrolledUp) {
+  auto client_rows = Screen(0);
+  // The content moved up by 48 rows, new rows appear at the bottom.
+  auto rows = Screen(48);
+  auto copy = FindScroll(client_rows, Stripes(rows));
+  ASSERT_TRUE(copy);
+  EXPECT_EQ(copy->src_y, 48);
+  EXPECT_EQ(copy->dst_y, 0);
+  EXPECT_EQ(copy->height, kHeight - 48);
+}
+
+TEST(FindScroll, FindsContentScrolledDown) {
+  auto client_rows = Screen(100);
+  auto rows = Screen(60);
+  auto copy = FindScroll(client_rows, Stripes(rows));
+  ASSERT_TRUE(copy);
+  EXPECT_EQ(copy->src_y, 0);
+  EXPECT_EQ(copy->dst_y, 40);
+  EXPECT_EQ(copy->height, kHeight - 40);
+}
+
+TEST(FindScroll, FindsTheScrolledBand) {
+  // A fixed header and footer around scrolling content
+  auto client_rows = Screen(0);
+  auto rows = client_rows;
+  for (int y = 64; y < 256; y++) {
+    rows[y] = client_rows[y + 32];
+  }
+  for (int y = 256; y < 288; y++) {
+    rows[y] = 1000000 + y * 2 + 1;
+  }
+  auto copy = FindScroll(client_rows, Stripes(rows));
+  ASSERT_TRUE(copy);
+  EXPECT_EQ(copy->src_y, 96);
+  EXPECT_EQ(copy->dst_y, 64);
+  EXPECT_EQ(copy->height, 192);
+  EXPECT_TRUE(copy->Covers(*Stripes(rows)[4]));
+  EXPECT_FALSE(copy->Covers(*Stripes(rows)[16]));
+}
+
+TEST(FindScroll, IgnoresSmallChanges) {
+  auto client_rows = Screen(0);
+  auto rows = client_rows;
+  // Fewer changed rows than worth a rectangle
+  for (int y = 0; y < 16; y++) {
+    rows[y] = client_rows[y + 100];
+  }
+  EXPECT_FALSE(FindScroll(client_rows, Stripes(rows)));
+  // A short move isn't either
+  rows = client_rows;
+  for (int y = 0; y < 24; y++) {
+    rows[y] = client_rows[y + 8];
+  }
+  for (int y = 24; y < 200; y++) {
+    rows[y] = 5000000 + y * 2 + 1;
+  }
+  EXPECT_FALSE(FindScroll(client_rows, Stripes(rows)));
+}
+
+TEST(FindScroll, IgnoresRepeatedRows) {
+  // A blank screen scrolling still looks blank, no row tells the distance.
+  std::vector<std::uint64_t> client_rows(kHeight, 7);
+  for (int y = 0; y < kHeight; y += 2) {
+    client_rows[y] = 9;
+  }
+  std::vector<std::uint64_t> rows(kHeight, 9);
+  for (int y = 0; y < kHeight; y += 2) {
+    rows[y] = 7;
+  }
+  EXPECT_FALSE(FindScroll(client_rows, Stripes(rows)));
+}
+
+TEST(FindScroll, NeedsRowHashesAndKnownClientRows) {
+  auto rows = Screen(48);
+  auto stripes = Stripes(rows);
+  EXPECT_FALSE(FindScroll(std::vector<std::uint64_t>(kHeight, 0), stripes));
+
+  auto without_hashes = std::make_shared<Stripe>(*stripes[3]);
+  without_hashes->row_hashes.clear();
+  stripes[3] = without_hashes;
+  EXPECT_FALSE(FindScroll(Screen(0), stripes));
+}
+
+TEST(ComputeRowHashes, HashesWholeRows) {
+  constexpr int kWidth = 3;
+  Stripe stripe;
+  stripe.width = kWidth;
+  stripe.height = 4;
+  stripe.stride = 16;
+  stripe.raw_data.assign(stripe.stride * stripe.height, 0);
+  // Rows 0 and 1 only differ in the last pixel, past the last whole word.
+  stripe.raw_data[1 * stripe.stride + (kWidth - 1) * 4] = 1;
+  // Rows 2 and 3 only differ in the padding after the row.
+  stripe.raw_data[2 * stripe.stride + kWidth * 4] = 1;
+  ComputeRowHashes(&stripe);
+  ASSERT_EQ(stripe.row_hashes.size(), 4u);
+  for (auto hash : stripe.row_hashes) {
+    EXPECT_NE(hash, 0u);
+  }
+  EXPECT_NE(stripe.row_hashes[0], stripe.row_hashes[1]);
+  EXPECT_EQ(stripe.row_hashes[2], stripe.row_hashes[3]);
+  EXPECT_EQ(stripe.row_hashes[0], stripe.row_hashes[2]);
+}
+
+}  // namespace
+}  // namespace vnc
+}  // namespace cuttlefish
@@ -76,15 +76,11 @@ SimulatedHWComposer::GetScreenConnectorCallback() {
   return [](std::uint32_t display_number, std::uint8_t* frame_pixels,
             cuttlefish::vnc::VncScProcessedFrame& processed_frame) {
     processed_frame.display_number_ = display_number;
-    // TODO(171305898): handle multiple displays.
+    // TODO(171305898): handle multiple displays. Only the primary display is
+    // served over VNC, don't spend time on the others.
     if (display_number != 0) {
-      // BUG 186580833: display_number comes from surface_id in crosvm
-      // create_surface from virtio_gpu.rs set_scanout.  We cannot use it as
-      // the display number. Either crosvm virtio-gpu is incorrectly ignoring
-      // scanout id and instead using a monotonically increasing surface id
-      // number as the scanout resource is replaced over time, or frontend code
-      // here is incorrectly assuming  surface id == display id.
-      display_number = 0;
+      processed_frame.is_success_ = false;
+      return;
     }
     const std::uint32_t display_w =
         ScreenConnector::ScreenWidth(display_number);
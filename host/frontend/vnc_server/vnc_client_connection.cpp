@@ -25,6 +25,7 @@
 #include <cstring>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <thread>
 #include <utility>
@@ -42,6 +43,7 @@
 using cuttlefish::Message;
 using cuttlefish::vnc::Stripe;
 using cuttlefish::vnc::StripePtrVec;
+using cuttlefish::vnc::ZrlePixelFormat;
 using cuttlefish::vnc::VncClientConnection;
 
 struct ScreenRegionView {
@@ -76,7 +78,6 @@ class BigEndianChecker {
 const BigEndianChecker ImBigEndian;
 
 constexpr int32_t kDesktopSizeEncoding = -223;
-constexpr int32_t kTightEncoding = 7;
 
 // These are the lengths not counting the first byte. The first byte
 // indicates the message type.
@@ -340,45 +341,134 @@ void VncClientConnection::AppendRawStripe(Message* frame_buffer_update,
   }
 }
 
-Message VncClientConnection::MakeRawFrameBufferUpdate(
-    const StripePtrVec& stripes) const {
-  auto fbu =
-      MakeFrameBufferUpdateHeader(static_cast<std::uint16_t>(stripes.size()));
-  for (auto& stripe : stripes) {
-    AppendRawStripe(&fbu, *stripe);
-  }
-  return fbu;
-}
-
 void VncClientConnection::AppendJpegStripeHeader(Message* frame_buffer_update,
-                                                 const Stripe& stripe) {
+                                                 const Stripe& stripe,
+                                                 size_t jpeg_size) {
   static constexpr std::uint8_t kJpegEncoding = 0x90;
   cuttlefish::AppendToMessage(frame_buffer_update, stripe.x, stripe.y, stripe.width,
                        stripe.height, kTightEncoding, kJpegEncoding);
-  AppendJpegSize(frame_buffer_update, stripe.jpeg_data.size());
+  AppendJpegSize(frame_buffer_update, jpeg_size);
 }
 
 void VncClientConnection::AppendJpegStripe(Message* frame_buffer_update,
                                            const Stripe& stripe) {
-  AppendJpegStripeHeader(frame_buffer_update, stripe);
-  frame_buffer_update->insert(frame_buffer_update->end(),
-                              stripe.jpeg_data.begin(), stripe.jpeg_data.end());
+  auto jpeg_data = jpeg_compressor_.CompressStripe(stripe, jpeg_quality_);
+  AppendJpegStripeHeader(frame_buffer_update, stripe, jpeg_data->size());
+  frame_buffer_update->insert(frame_buffer_update->end(), jpeg_data->begin(),
+                              jpeg_data->end());
+}
+
+std::optional<cuttlefish::vnc::ZrlePixelFormat>
+VncClientConnection::GetZrlePixelFormat() const {
+  if (pixel_format_.bits_per_pixel != 32 || !pixel_format_.true_color ||
+      pixel_format_.red_max != 0xff || pixel_format_.green_max != 0xff ||
+      pixel_format_.blue_max != 0xff) {
+    return std::nullopt;
+  }
+  ZrlePixelFormat format{};
+  format.red_shift = pixel_format_.red_shift;
+  format.green_shift = pixel_format_.green_shift;
+  format.blue_shift = pixel_format_.blue_shift;
+  format.big_endian = pixel_format_.big_endian != 0;
+  if (!format.Supported()) {
+    return std::nullopt;
+  }
+  return format;
+}
+
+void VncClientConnection::AppendZrleStripe(Message* frame_buffer_update,
+                                           const Stripe& stripe,
+                                           const ZrlePixelFormat& format) {
+  auto zrle_data = stripe.encodings->Get(
+      {kZrleEncoding, format.Id()},
+      [&stripe, &format]() { return ZrleEncode(stripe, format); });
+  auto length = static_cast<std::uint32_t>(zrle_data->size());
+  if (!zlib_stream_started_) {
+    length += sizeof kZlibStreamHeader;
+  }
+  cuttlefish::AppendToMessage(frame_buffer_update, stripe.x, stripe.y,
+                              stripe.width, stripe.height, kZrleEncoding,
+                              length);
+  auto& fbu = *frame_buffer_update;
+  if (!zlib_stream_started_) {
+    fbu.insert(fbu.end(), std::begin(kZlibStreamHeader),
+               std::end(kZlibStreamHeader));
+    zlib_stream_started_ = true;
+  }
+  fbu.insert(fbu.end(), zrle_data->begin(), zrle_data->end());
 }
 
-Message VncClientConnection::MakeJpegFrameBufferUpdate(
-    const StripePtrVec& stripes) {
-  auto fbu =
-      MakeFrameBufferUpdateHeader(static_cast<std::uint16_t>(stripes.size()));
-  for (auto& stripe : stripes) {
-    AppendJpegStripe(&fbu, *stripe);
+void VncClientConnection::AppendCopyRect(Message* frame_buffer_update,
+                                         const ScrollCopy& copy,
+                                         std::uint16_t width) {
+  cuttlefish::AppendToMessage(frame_buffer_update, std::uint16_t{0}, copy.dst_y,
+                              width, copy.height, kCopyRectEncoding,
+                              std::uint16_t{0}, copy.src_y);
+}
+
+std::optional<cuttlefish::vnc::ScrollCopy> VncClientConnection::FindScroll(
+    const StripePtrVec& stripes) const {
+  if (!supports_copy_rect_ ||
+      current_orientation_ != ScreenOrientation::Portrait ||
+      client_rows_.size() != static_cast<size_t>(ScreenHeight())) {
+    return std::nullopt;
   }
-  return fbu;
+  return cuttlefish::vnc::FindScroll(client_rows_, stripes);
 }
 
+void VncClientConnection::UpdateClientRows(
+    const std::optional<ScrollCopy>& copy, const StripePtrVec& sent_stripes) {
+  if (current_orientation_ != ScreenOrientation::Portrait) {
+    client_rows_.clear();
+    return;
+  }
+  client_rows_.resize(ScreenHeight());
+  if (copy) {
+    std::vector<std::uint64_t> moved_rows(
+        client_rows_.begin() + copy->src_y,
+        client_rows_.begin() + copy->src_y + copy->height);
+    std::copy(moved_rows.begin(), moved_rows.end(),
+              client_rows_.begin() + copy->dst_y);
+  }
+  for (const auto& stripe : sent_stripes) {
+    auto first_row = client_rows_.begin() + stripe->y;
+    if (stripe->row_hashes.size() == stripe->height) {
+      std::copy(stripe->row_hashes.begin(), stripe->row_hashes.end(),
+                first_row);
+    } else {
+      std::fill_n(first_row, stripe->height, 0);
+    }
+  }
+}
+
+// Scrolled content is moved on the client screen with a CopyRect rectangle
+// first, then the stripes it doesn't cover follow.
 Message VncClientConnection::MakeFrameBufferUpdate(
     const StripePtrVec& stripes) {
-  return use_jpeg_compression_ ? MakeJpegFrameBufferUpdate(stripes)
-                               : MakeRawFrameBufferUpdate(stripes);
+  auto copy = FindScroll(stripes);
+  StripePtrVec sent_stripes;
+  for (const auto& stripe : stripes) {
+    if (!copy || !copy->Covers(*stripe)) {
+      sent_stripes.push_back(stripe);
+    }
+  }
+  auto fbu = MakeFrameBufferUpdateHeader(
+      static_cast<std::uint16_t>(sent_stripes.size() + (copy ? 1 : 0)));
+  if (copy) {
+    AppendCopyRect(&fbu, *copy, static_cast<std::uint16_t>(ScreenWidth()));
+  }
+  auto zrle_format = GetZrlePixelFormat();
+  for (const auto& stripe : sent_stripes) {
+    if (stripe_encoding_ == StripeEncoding::Jpeg) {
+      AppendJpegStripe(&fbu, *stripe);
+    } else if (stripe_encoding_ == StripeEncoding::Zrle && zrle_format) {
+      AppendZrleStripe(&fbu, *stripe, *zrle_format);
+    } else {
+      AppendRawStripe(&fbu, *stripe);
+    }
+  }
+  UpdateClientRows(copy, sent_stripes);
+  return fbu;
 }
 
 void VncClientConnection::FrameBufferUpdateRequestHandler(bool aggressive) {
@@ -451,27 +541,46 @@ void VncClientConnection::HandleSetEncodings() {
   if (encodings.size() % sizeof(int32_t) != 0) {
     return;
   }
-  {
-    std::lock_guard<std::mutex> guard(m_);
-    use_jpeg_compression_ = false;
-  }
+  // Clients list encodings in order of preference, the first one of Tight
+  // and ZRLE is used for the stripes.
+  std::optional<StripeEncoding> stripe_encoding;
+  std::optional<int> jpeg_quality;
+  bool supports_copy_rect = false;
   for (size_t i = 0; i < encodings.size(); i += sizeof(int32_t)) {
     auto enc = int32_tAt(&encodings[i]);
     DLOG(INFO) << "client requesting encoding: " << enc;
-    if (enc == kTightEncoding) {
+    if (enc == kTightEncoding && !stripe_encoding) {
       // This is a deviation from the spec which says that if a jpeg quality
       // level is not specified, tight encoding won't use jpeg.
-      std::lock_guard<std::mutex> guard(m_);
-      use_jpeg_compression_ = true;
+      stripe_encoding = StripeEncoding::Jpeg;
+    }
+    if (enc == kZrleEncoding && !stripe_encoding) {
+      stripe_encoding = StripeEncoding::Zrle;
+    }
+    if (enc == kCopyRectEncoding) {
+      supports_copy_rect = true;
     }
     if (kJpegMinQualityEncoding <= enc && enc <= kJpegMaxQualityEncoding) {
       DLOG(INFO) << "jpeg compression level: " << enc;
-      bb_->set_jpeg_quality_level(enc);
+      jpeg_quality = JpegQualityForEncoding(enc);
     }
     if (enc == kDesktopSizeEncoding) {
       supports_desktop_size_encoding_ = true;
     }
   }
+  bool use_jpeg = stripe_encoding == StripeEncoding::Jpeg;
+  int quality{};
+  {
+    std::lock_guard<std::mutex> guard(m_);
+    stripe_encoding_ = stripe_encoding.value_or(StripeEncoding::Raw);
+    supports_copy_rect_ = supports_copy_rect;
+    if (jpeg_quality) {
+      jpeg_quality_ = *jpeg_quality;
+    }
+    quality = jpeg_quality_;
+  }
+  bb_->SetJpegQuality(this, use_jpeg ? std::optional<int>(quality)
+                                     : std::nullopt);
 }
 
 void VncClientConnection::HandleSetPixelFormat() {
@@ -554,6 +663,8 @@ void VncClientConnection::SetScreenOrientation(ScreenOrientation orientation) {
     if (current_orientation_ != previous_orientation &&
         supports_desktop_size_encoding_) {
       SendDesktopSizeUpdate();
+      // The client's screen content is gone after a resize
+      client_rows_.clear();
       bb_->SetOrientation(this, current_orientation_);
       // TODO not sure if I should be sending a frame update along with this,
       // or just letting the next FBUR handle it. This seems to me like it's
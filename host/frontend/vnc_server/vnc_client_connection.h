@@ -22,13 +22,17 @@
 #include <cstdint>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <thread>
 #include <vector>
 
 #include "common/libs/utils/tcp_socket.h"
 #include "host/frontend/vnc_server/blackboard.h"
+#include "host/frontend/vnc_server/jpeg_compressor.h"
+#include "host/frontend/vnc_server/scroll_copy.h"
 #include "host/frontend/vnc_server/virtual_inputs.h"
 #include "host/frontend/vnc_server/vnc_utils.h"
+#include "host/frontend/vnc_server/zrle_encoder.h"
 
 namespace cuttlefish {
 namespace vnc {
@@ -58,6 +62,8 @@ class VncClientConnection {
     std::uint8_t blue_shift;
   };
 
+  enum class StripeEncoding { Raw, Jpeg, Zrle };
+
   struct FrameBufferUpdateRequest {
     bool incremental;
     std::uint16_t x_pos;
@@ -84,15 +90,24 @@ class VncClientConnection {
                                     const Stripe& stripe);
   void AppendRawStripe(Message* frame_buffer_update, const Stripe& stripe) const
       REQUIRES(m_);
-  Message MakeRawFrameBufferUpdate(const StripePtrVec& stripes) const
-      REQUIRES(m_);
 
   static void AppendJpegSize(Message* frame_buffer_update, size_t jpeg_size);
   static void AppendJpegStripeHeader(Message* frame_buffer_update,
-                                     const Stripe& stripe);
-  static void AppendJpegStripe(Message* frame_buffer_update,
-                               const Stripe& stripe);
-  static Message MakeJpegFrameBufferUpdate(const StripePtrVec& stripes);
+                                     const Stripe& stripe, size_t jpeg_size);
+  void AppendJpegStripe(Message* frame_buffer_update, const Stripe& stripe)
+      REQUIRES(m_);
+
+  std::optional<ZrlePixelFormat> GetZrlePixelFormat() const REQUIRES(m_);
+  void AppendZrleStripe(Message* frame_buffer_update, const Stripe& stripe,
+                        const ZrlePixelFormat& format) REQUIRES(m_);
+
+  static void AppendCopyRect(Message* frame_buffer_update,
+                             const ScrollCopy& copy, std::uint16_t width);
+  // Finds content of the client screen that the stripes show scrolled.
+  std::optional<ScrollCopy> FindScroll(const StripePtrVec& stripes) const
+      REQUIRES(m_);
+  void UpdateClientRows(const std::optional<ScrollCopy>& copy,
+                        const StripePtrVec& sent_stripes) REQUIRES(m_);
 
   Message MakeFrameBufferUpdate(const StripePtrVec& frame) REQUIRES(m_);
 
@@ -144,7 +159,16 @@ class VncClientConnection {
 
   FrameBufferUpdateRequest previous_update_request_{};
   BlackBoard* bb_;
-  bool use_jpeg_compression_ GUARDED_BY(m_) = false;
+  StripeEncoding stripe_encoding_ GUARDED_BY(m_) = StripeEncoding::Raw;
+  int jpeg_quality_ GUARDED_BY(m_) = 100;
+  bool supports_copy_rect_ GUARDED_BY(m_) = false;
+  // ZRLE data of all rectangles makes a single zlib stream.
+  bool zlib_stream_started_ GUARDED_BY(m_) = false;
+  // Only used for stripes nobody compressed with the client's quality yet.
+  JpegCompressor jpeg_compressor_ GUARDED_BY(m_);
+  // Hashes of the rows the client shows, 0 for unknown ones. Only kept in
+  // portrait orientation.
+  std::vector<std::uint64_t> client_rows_ GUARDED_BY(m_);
 
   std::thread frame_buffer_request_handler_tid_;
   bool closed_ GUARDED_BY(m_){};
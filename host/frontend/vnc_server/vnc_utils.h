@@ -18,7 +18,11 @@
 
 #include <array>
 #include <cstdint>
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <tuple>
 #include <utility>
 #include <vector>
 
@@ -45,12 +49,67 @@ class StripeSeqNumber {
   std::uint64_t t_{};
 };
 
+constexpr int32_t kCopyRectEncoding = 1;
+constexpr int32_t kTightEncoding = 7;
+constexpr int32_t kZrleEncoding = 16;
 constexpr int32_t kJpegMaxQualityEncoding = -23;
 constexpr int32_t kJpegMinQualityEncoding = -32;
 
+// The libjpeg quality for a quality level pseudo encoding from a client.
+inline int JpegQualityForEncoding(int32_t quality_level) {
+  return 55 + (5 * (quality_level + 32));
+}
+
 enum class ScreenOrientation { Portrait, Landscape };
 constexpr int kNumOrientations = 2;
 
+/**
+ * The encoded forms of a stripe, shared by every client that wants the same
+ * one. Each form is made once, by the first client or worker that needs it,
+ * the others wait for it instead of encoding the stripe again.
+ */
+class StripeEncodings {
+ public:
+  struct Key {
+    std::int32_t encoding;
+    // Encoding specific, e.g. the jpeg quality or the client pixel format.
+    std::uint32_t parameter;
+
+    bool operator<(const Key& other) const {
+      return std::tie(encoding, parameter) <
+             std::tie(other.encoding, other.parameter);
+    }
+  };
+
+  std::shared_ptr<const Message> Get(const Key& key,
+                                     const std::function<Message()>& encode) {
+    std::shared_ptr<Encoding> encoding;
+    {
+      std::lock_guard<std::mutex> guard(m_);
+      auto& entry = encodings_[key];
+      if (!entry) {
+        entry = std::make_shared<Encoding>();
+      }
+      encoding = entry;
+    }
+    // Only the users of the same form wait for each other.
+    std::lock_guard<std::mutex> guard(encoding->m);
+    if (!encoding->encoded) {
+      encoding->encoded = std::make_shared<const Message>(encode());
+    }
+    return encoding->encoded;
+  }
+
+ private:
+  struct Encoding {
+    std::mutex m;
+    std::shared_ptr<const Message> encoded;
+  };
+
+  std::mutex m_;
+  std::map<Key, std::shared_ptr<Encoding>> encodings_;
+};
+
 struct Stripe {
   int index = -1;
   std::uint64_t frame_id{};
@@ -60,10 +119,15 @@ struct Stripe {
   std::uint16_t stride{};
   std::uint16_t height{};
   Message raw_data{};
-  Message jpeg_data{};
   StripeSeqNumber seq_number{};
   ScreenOrientation orientation{};
+  // Hashes of the rows, never 0, for finding scrolled content. Only for
+  // portrait stripes, which span whole rows.
+  std::vector<std::uint64_t> row_hashes{};
+  // Set once the stripe is published by the FrameBufferWatcher.
+  std::shared_ptr<StripeEncodings> encodings{};
 };
+using StripePtrVec = std::vector<std::shared_ptr<const Stripe>>;
 
 /**
  * ScreenConnectorImpl will generate this, and enqueue
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/vnc_server/zrle_encoder.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <android-base/logging.h>
+
+#include "host/libs/screen_connector/screen_connector.h"
+
+namespace cuttlefish {
+namespace vnc {
+namespace {
+
+constexpr int kTileSize = 64;
+constexpr std::uint8_t kRawSubencoding = 0;
+constexpr std::uint8_t kSolidSubencoding = 1;
+constexpr std::uint8_t kPlainRleSubencoding = 128;
+constexpr std::uint8_t kPaletteRleSubencoding = 128;  // + palette size
+constexpr size_t kMaxPackedPaletteSize = 16;
+constexpr size_t kMaxRlePaletteSize = 127;
+constexpr size_t kCPixelSize = 3;
+
+// The channels of the guest pixels, as in the stripes
+constexpr int kGuestRedShift = 0;
+constexpr int kGuestGreenShift = 8;
+constexpr int kGuestBlueShift = 16;
+
+class TileWriter {
+ public:
+  TileWriter(const ZrlePixelFormat& format, Message* out)
+      : format_(format), out_(*out) {
+    std::uint32_t max_shift = std::max(
+        {format.red_shift, format.green_shift, format.blue_shift});
+    // Whether the channels are in the 3 least significant bytes.
+    bool low_bytes = max_shift <= 16;
+    // Offset of the CPIXEL bytes in the pixel as sent in client byte order.
+    cpixel_offset_ = low_bytes == format.big_endian ? 1 : 0;
+  }
+
+  // Converts the guest pixel to a CPIXEL value, packed in 3 bytes.
+  std::uint32_t CPixel(std::uint32_t guest_pixel) const {
+    std::uint32_t red = (guest_pixel >> kGuestRedShift) & 0xff;
+    std::uint32_t green = (guest_pixel >> kGuestGreenShift) & 0xff;
+    std::uint32_t blue = (guest_pixel >> kGuestBlueShift) & 0xff;
+    std::uint32_t pixel = red << format_.red_shift |
+                          green << format_.green_shift |
+                          blue << format_.blue_shift;
+    std::uint8_t bytes[4];
+    for (int i = 0; i < 4; i++) {
+      int shift = format_.big_endian ? 8 * (3 - i) : 8 * i;
+      bytes[i] = (pixel >> shift) & 0xff;
+    }
+    return bytes[cpixel_offset_] | bytes[cpixel_offset_ + 1] << 8 |
+           bytes[cpixel_offset_ + 2] << 16;
+  }
+
+  void AppendCPixel(std::uint32_t cpixel) {
+    out_.push_back(cpixel & 0xff);
+    out_.push_back((cpixel >> 8) & 0xff);
+    out_.push_back((cpixel >> 16) & 0xff);
+  }
+
+  void AppendRunLength(size_t run) {
+    // 255s then the remainder, the length is one more than the sum
+    run--;
+    while (run >= 255) {
+      out_.push_back(255);
+      run -= 255;
+    }
+    out_.push_back(static_cast<std::uint8_t>(run));
+  }
+
+  // pixels are the CPIXEL values of a tile, row by row.
+  void WriteTile(const std::vector<std::uint32_t>& pixels, int width,
+                 int height) {
+    std::vector<std::uint32_t> palette;
+    size_t runs = 1;
+    for (size_t i = 0; i < pixels.size(); i++) {
+      if (i > 0 && pixels[i] != pixels[i - 1]) {
+        runs++;
+      }
+      if (palette.size() <= kMaxRlePaletteSize &&
+          std::find(palette.begin(), palette.end(), pixels[i]) ==
+              palette.end()) {
+        palette.push_back(pixels[i]);
+      }
+    }
+    if (palette.size() == 1) {
+      out_.push_back(kSolidSubencoding);
+      AppendCPixel(palette[0]);
+      return;
+    }
+
+    size_t raw_size = pixels.size() * kCPixelSize;
+    // Run lengths mostly take one byte for UI content.
+    size_t plain_rle_size = runs * (kCPixelSize + 1);
+    size_t packed_size = SIZE_MAX;
+    size_t palette_rle_size = SIZE_MAX;
+    if (palette.size() <= kMaxPackedPaletteSize) {
+      packed_size = palette.size() * kCPixelSize +
+                    ((width * BitsPerIndex(palette.size()) + 7) / 8) * height;
+    }
+    if (palette.size() <= kMaxRlePaletteSize) {
+      palette_rle_size = palette.size() * kCPixelSize + runs * 2;
+    }
+    auto best = std::min({raw_size, plain_rle_size, packed_size,
+                          palette_rle_size});
+    if (best == packed_size) {
+      WritePackedPalette(pixels, width, height, palette);
+    } else if (best == palette_rle_size) {
+      WritePaletteRle(pixels, palette);
+    } else if (best == plain_rle_size) {
+      WritePlainRle(pixels);
+    } else {
+      out_.push_back(kRawSubencoding);
+      for (auto pixel : pixels) {
+        AppendCPixel(pixel);
+      }
+    }
+  }
+
+ private:
+  static int BitsPerIndex(size_t palette_size) {
+    return palette_size <= 2 ? 1 : palette_size <= 4 ? 2 : 4;
+  }
+
+  static size_t IndexOf(const std::vector<std::uint32_t>& palette,
+                        std::uint32_t pixel) {
+    return std::find(palette.begin(), palette.end(), pixel) - palette.begin();
+  }
+
+  void WritePackedPalette(const std::vector<std::uint32_t>& pixels, int width,
+                          int height,
+                          const std::vector<std::uint32_t>& palette) {
+    out_.push_back(static_cast<std::uint8_t>(palette.size()));
+    for (auto color : palette) {
+      AppendCPixel(color);
+    }
+    int bits = BitsPerIndex(palette.size());
+    // Rows are padded to a byte, most significant bits first.
+    for (int y = 0; y < height; y++) {
+      std::uint8_t byte = 0;
+      int used = 0;
+      for (int x = 0; x < width; x++) {
+        byte = (byte << bits) | IndexOf(palette, pixels[y * width + x]);
+        used += bits;
+        if (used == 8) {
+          out_.push_back(byte);
+          byte = 0;
+          used = 0;
+        }
+      }
+      if (used > 0) {
+        out_.push_back(byte << (8 - used));
+      }
+    }
+  }
+
+  template <typename F>
+  static void ForEachRun(const std::vector<std::uint32_t>& pixels, F f) {
+    size_t start = 0;
+    for (size_t i = 1; i <= pixels.size(); i++) {
+      if (i == pixels.size() || pixels[i] != pixels[start]) {
+        f(pixels[start], i - start);
+        start = i;
+      }
+    }
+  }
+
+  void WritePaletteRle(const std::vector<std::uint32_t>& pixels,
+                       const std::vector<std::uint32_t>& palette) {
+    out_.push_back(kPaletteRleSubencoding + palette.size());
+    for (auto color : palette) {
+      AppendCPixel(color);
+    }
+    ForEachRun(pixels, [this, &palette](std::uint32_t pixel, size_t run) {
+      auto index = static_cast<std::uint8_t>(IndexOf(palette, pixel));
+      if (run == 1) {
+        out_.push_back(index);
+      } else {
+        out_.push_back(index | 0x80);
+        AppendRunLength(run);
+      }
+    });
+  }
+
+  void WritePlainRle(const std::vector<std::uint32_t>& pixels) {
+    out_.push_back(kPlainRleSubencoding);
+    ForEachRun(pixels, [this](std::uint32_t pixel, size_t run) {
+      AppendCPixel(pixel);
+      AppendRunLength(run);
+    });
+  }
+
+  const ZrlePixelFormat& format_;
+  Message& out_;
+  int cpixel_offset_;
+};
+
+Message Deflate(const Message& data) {
+  z_stream stream{};
+  // Raw deflate, the zlib header is sent once per connection.
+  CHECK(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                     8, Z_DEFAULT_STRATEGY) == Z_OK);
+  Message out(deflateBound(&stream, data.size()) + 16);
+  stream.next_in = const_cast<Bytef*>(data.data());
+  stream.avail_in = data.size();
+  stream.next_out = out.data();
+  stream.avail_out = out.size();
+  // A full flush ends on a byte boundary and resets the dictionary.
+  CHECK(deflate(&stream, Z_FULL_FLUSH) == Z_OK);
+  CHECK(stream.avail_in == 0);
+  out.resize(out.size() - stream.avail_out);
+  deflateEnd(&stream);
+  return out;
+}
+
+}  // namespace
+
+bool ZrlePixelFormat::Supported() const {
+  std::uint8_t shifts[] = {red_shift, green_shift, blue_shift};
+  std::sort(std::begin(shifts), std::end(shifts));
+  if (shifts[2] > 24) {
+    return false;
+  }
+  for (auto shift : shifts) {
+    if (shift % 8 != 0) {
+      return false;
+    }
+  }
+  // The channels take 3 different bytes, all in the low or the high ones
+  return shifts[0] != shifts[1] && shifts[1] != shifts[2] &&
+         (shifts[2] <= 16 || shifts[0] >= 8);
+}
+
+std::uint32_t ZrlePixelFormat::Id() const {
+  return red_shift | green_shift << 8 | blue_shift << 16 |
+         static_cast<std::uint32_t>(big_endian) << 24;
+}
+
+Message ZrleEncode(const Stripe& stripe, const ZrlePixelFormat& format) {
+  constexpr auto kBpp = ScreenConnectorInfo::BytesPerPixel();
+  Message tiles;
+  TileWriter writer(format, &tiles);
+  std::vector<std::uint32_t> pixels;
+  for (int tile_y = 0; tile_y < stripe.height; tile_y += kTileSize) {
+    int height = std::min(kTileSize, stripe.height - tile_y);
+    for (int tile_x = 0; tile_x < stripe.width; tile_x += kTileSize) {
+      int width = std::min(kTileSize, stripe.width - tile_x);
+      pixels.clear();
+      for (int y = tile_y; y < tile_y + height; y++) {
+        const auto* row = &stripe.raw_data[y * stripe.stride + tile_x * kBpp];
+        for (int x = 0; x < width; x++) {
+          std::uint32_t guest_pixel;
+          std::memcpy(&guest_pixel, row + x * kBpp, sizeof(guest_pixel));
+          pixels.push_back(writer.CPixel(guest_pixel));
+        }
+      }
+      writer.WriteTile(pixels, width, height);
+    }
+  }
+  return Deflate(tiles);
+}
+
+}  // namespace vnc
+}  // namespace cuttlefish
@@ -0,0 +1,53 @@
+#pragma once
+
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+
+#include "host/frontend/vnc_server/vnc_utils.h"
+
+namespace cuttlefish {
+namespace vnc {
+
+// Where the 8 bit channels go in the 32 bit pixels of a client.
+struct ZrlePixelFormat {
+  std::uint8_t red_shift;
+  std::uint8_t green_shift;
+  std::uint8_t blue_shift;
+  bool big_endian;
+
+  // ZRLE sends the 3 bytes holding the channels, which must be contiguous.
+  bool Supported() const;
+  // Identifies the format in the stripe encoding caches.
+  std::uint32_t Id() const;
+};
+
+// The zlib stream header that must precede the first ZRLE rectangle of a
+// connection.
+constexpr std::uint8_t kZlibStreamHeader[] = {0x78, 0x01};
+
+// Encodes a stripe as the data of a ZRLE rectangle (RFC 6143 7.7.6): 64x64
+// tiles, each solid, palette packed, RLE or raw, whatever is smallest.
+//
+// The tiles are compressed as raw deflate blocks ending in a full flush,
+// which don't refer to any data before them. The same bytes can then be
+// spliced into the zlib stream of any connection, which lets all clients
+// share the encoded stripe.
+Message ZrleEncode(const Stripe& stripe, const ZrlePixelFormat& format);
+
+}  // namespace vnc
+}  // namespace cuttlefish
@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/vnc_server/zrle_encoder.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace vnc {
+namespace {
+
+constexpr int kTileSize = 64;
+
+using Rgb = std::array<std::uint8_t, 3>;
+using Image = std::vector<Rgb>;
+
+// A guest stripe, with a stride wider than its rows.
+Stripe MakeStripe(int width, int height, const Image& image) {
+  Stripe stripe;
+  stripe.width = width;
+  stripe.height = height;
+  stripe.stride = width * 4 + 8;
+  stripe.raw_data.assign(stripe.stride * height, 0xee);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      auto* pixel = &stripe.raw_data[y * stripe.stride + x * 4];
+      std::copy_n(image[y * width + x].begin(), 3, pixel);
+    }
+  }
+  return stripe;
+}
+
+Image MakeImage(int width, int height, const std::function<Rgb(int, int)>& f) {
+  Image image;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      image.push_back(f(x, y));
+    }
+  }
+  return image;
+}
+
+// Inflates the data of consecutive ZRLE rectangles of one connection.
+class ZlibStream {
+ public:
+  ZlibStream() { EXPECT_EQ(inflateInit(&stream_), Z_OK); }
+  ~ZlibStream() { inflateEnd(&stream_); }
+
+  Message Inflate(Message data) {
+    Message out;
+    stream_.next_in = data.data();
+    stream_.avail_in = data.size();
+    while (stream_.avail_in > 0) {
+      std::uint8_t buffer[4096];
+      stream_.next_out = buffer;
+      stream_.avail_out = sizeof(buffer);
+      int ret = inflate(&stream_, Z_SYNC_FLUSH);
+      EXPECT_TRUE(ret == Z_OK || ret == Z_BUF_ERROR) << ret;
+      out.insert(out.end(), buffer, stream_.next_out);
+      if (ret != Z_OK) {
+        break;
+      }
+    }
+    EXPECT_EQ(stream_.avail_in, 0u);
+    return out;
+  }
+
+ private:
+  z_stream stream_{};
+};
+
+// Decodes the tiles of a ZRLE rectangle (RFC 6143 7.7.6). rgb_offsets are
+// where the channels are in the CPIXEL bytes of the client format.
+class ZrleDecoder {
+ public:
+  ZrleDecoder(const Message& data, std::array<int, 3> rgb_offsets)
+      : data_(data), rgb_offsets_(rgb_offsets) {}
+
+  Image Decode(int width, int height) {
+    Image image(width * height);
+    for (int tile_y = 0; tile_y < height; tile_y += kTileSize) {
+      int tile_height = std::min(kTileSize, height - tile_y);
+      for (int tile_x = 0; tile_x < width; tile_x += kTileSize) {
+        int tile_width = std::min(kTileSize, width - tile_x);
+        auto tile = DecodeTile(tile_width, tile_height);
+        for (int y = 0; y < tile_height; y++) {
+          std::copy_n(&tile[y * tile_width], tile_width,
+                      &image[(tile_y + y) * width + tile_x]);
+        }
+      }
+    }
+    EXPECT_EQ(pos_, data_.size()) << "Trailing data";
+    return image;
+  }
+
+ private:
+  std::uint8_t Byte() {
+    EXPECT_LT(pos_, data_.size());
+    return pos_ < data_.size() ? data_[pos_++] : 0;
+  }
+
+  Rgb CPixel() {
+    std::uint8_t bytes[3] = {Byte(), Byte(), Byte()};
+    return {bytes[rgb_offsets_[0]], bytes[rgb_offsets_[1]],
+            bytes[rgb_offsets_[2]]};
+  }
+
+  size_t RunLength() {
+    size_t run = 1;
+    std::uint8_t byte;
+    do {
+      byte = Byte();
+      run += byte;
+    } while (byte == 255);
+    return run;
+  }
+
+  Image DecodeTile(int width, int height) {
+    size_t size = width * height;
+    Image tile;
+    std::uint8_t subencoding = Byte();
+    if (subencoding == 0) {
+      for (size_t i = 0; i < size; i++) {
+        tile.push_back(CPixel());
+      }
+    } else if (subencoding == 1) {
+      tile.assign(size, CPixel());
+    } else if (subencoding <= 16) {
+      Image palette;
+      for (int i = 0; i < subencoding; i++) {
+        palette.push_back(CPixel());
+      }
+      int bits = subencoding == 2 ? 1 : subencoding <= 4 ? 2 : 4;
+      for (int y = 0; y < height; y++) {
+        int used = 8;
+        std::uint8_t byte = 0;
+        for (int x = 0; x < width; x++) {
+          if (used == 8) {
+            byte = Byte();
+            used = 0;
+          }
+          used += bits;
+          tile.push_back(palette.at((byte >> (8 - used)) & ((1 << bits) - 1)));
+        }
+      }
+    } else if (subencoding == 128) {
+      while (tile.size() < size) {
+        auto pixel = CPixel();
+        tile.insert(tile.end(), RunLength(), pixel);
+      }
+    } else if (subencoding >= 130) {
+      Image palette;
+      for (int i = 0; i < subencoding - 128; i++) {
+        palette.push_back(CPixel());
+      }
+      while (tile.size() < size) {
+        std::uint8_t index = Byte();
+        size_t run = index & 0x80 ? RunLength() : 1;
+        tile.insert(tile.end(), run, palette.at(index & 0x7f));
+      }
+    } else {
+      ADD_FAILURE() << "Unexpected subencoding " << int{subencoding};
+      tile.resize(size);
+    }
+    EXPECT_EQ(tile.size(), size);
+    tile.resize(size);
+    return tile;
+  }
+
+  const Message& data_;
+  size_t pos_ = 0;
+  std::array<int, 3> rgb_offsets_;
+};
+
+// RGB888 as most clients ask for it, the CPIXEL bytes are red, green, blue.
+constexpr ZrlePixelFormat kRgbx{0, 8, 16, false};
+
+Image EncodeAndDecode(const Image& image, int width, int height,
+                      const ZrlePixelFormat& format = kRgbx,
+                      std::array<int, 3> rgb_offsets = {0, 1, 2}) {
+  auto encoded = ZrleEncode(MakeStripe(width, height, image), format);
+  Message data(std::begin(kZlibStreamHeader), std::end(kZlibStreamHeader));
+  data.insert(data.end(), encoded.begin(), encoded.end());
+  ZlibStream stream;
+  return ZrleDecoder(stream.Inflate(data), rgb_offsets).Decode(width, height);
+}
+
+TEST(ZrleEncoder, SolidTiles) {
+  auto image = MakeImage(130, 70, [](int, int) { return Rgb{10, 20, 30}; });
+  EXPECT_EQ(EncodeAndDecode(image, 130, 70), image);
+}
+
+TEST(ZrleEncoder, PackedPaletteTiles) {
+  for (int colors : {2, 3, 4, 5, 16}) {
+    auto image = MakeImage(100, 64, [colors](int x, int y) {
+      std::uint8_t c = (x * 7 + y * 3) % colors;
+      return Rgb{c, static_cast<std::uint8_t>(c * 2), 0};
+    });
+    EXPECT_EQ(EncodeAndDecode(image, 100, 64), image) << colors << " colors";
+  }
+}
+
+TEST(ZrleEncoder, RleTiles) {
+  // Long runs of many colors, plain RLE
+  auto plain = MakeImage(64, 64, [](int x, int y) {
+    return Rgb{static_cast<std::uint8_t>(y * 4 + (x >= 32)), 1, 2};
+  });
+  EXPECT_EQ(EncodeAndDecode(plain, 64, 64), plain);
+  // Runs of a few colors, palette RLE, some longer than 255 pixels
+  auto palette = MakeImage(64, 64, [](int x, int y) {
+    int bump = x == 63 && y % 7 == 3;
+    return Rgb{static_cast<std::uint8_t>(y / 5 % 20 + bump), 0, 0};
+  });
+  EXPECT_EQ(EncodeAndDecode(palette, 64, 64), palette);
+}
+
+TEST(ZrleEncoder, RawTiles) {
+  auto image = MakeImage(67, 65, [](int x, int y) {
+    return Rgb{static_cast<std::uint8_t>(x * 3), static_cast<std::uint8_t>(y),
+               static_cast<std::uint8_t>(x ^ y)};
+  });
+  EXPECT_EQ(EncodeAndDecode(image, 67, 65), image);
+}
+
+TEST(ZrleEncoder, ClientPixelFormats) {
+  auto image = MakeImage(64, 16, [](int x, int y) {
+    return Rgb{static_cast<std::uint8_t>(x), static_cast<std::uint8_t>(y),
+               static_cast<std::uint8_t>(x + y)};
+  });
+  // BGRX, little endian
+  EXPECT_EQ(EncodeAndDecode(image, 64, 16, {16, 8, 0, false}, {2, 1, 0}),
+            image);
+  // XRGB, big endian
+  EXPECT_EQ(EncodeAndDecode(image, 64, 16, {16, 8, 0, true}, {0, 1, 2}),
+            image);
+  // RGBX, big endian
+  EXPECT_EQ(EncodeAndDecode(image, 64, 16, {24, 16, 8, true}, {0, 1, 2}),
+            image);
+}
+
+TEST(ZrleEncoder, StripesShareOneStream) {
+  auto first = MakeImage(64, 8, [](int x, int) {
+    return Rgb{static_cast<std::uint8_t>(x), 0, 0};
+  });
+  auto second = MakeImage(64, 8, [](int x, int y) {
+    return Rgb{0, static_cast<std::uint8_t>(x * y), 0};
+  });
+  auto encoded_first = ZrleEncode(MakeStripe(64, 8, first), kRgbx);
+  auto encoded_second = ZrleEncode(MakeStripe(64, 8, second), kRgbx);
+
+  // The stripes can be sent in any order, after the stream header.
+  ZlibStream stream;
+  Message header(std::begin(kZlibStreamHeader), std::end(kZlibStreamHeader));
+  EXPECT_TRUE(stream.Inflate(header).empty());
+  for (int i = 0; i < 2; i++) {
+    auto second_data = stream.Inflate(encoded_second);
+    EXPECT_EQ(ZrleDecoder(second_data, {0, 1, 2}).Decode(64, 8), second);
+    auto first_data = stream.Inflate(encoded_first);
+    EXPECT_EQ(ZrleDecoder(first_data, {0, 1, 2}).Decode(64, 8), first);
+  }
+}
+
+TEST(ZrleEncoder, SupportedPixelFormats) {
+  EXPECT_TRUE(kRgbx.Supported());
+  EXPECT_TRUE((ZrlePixelFormat{24, 16, 8, true}.Supported()));
+  // Channels that aren't whole bytes
+  EXPECT_FALSE((ZrlePixelFormat{0, 5, 11, false}.Supported()));
+  // Channels in the first and last bytes
+  EXPECT_FALSE((ZrlePixelFormat{0, 8, 24, false}.Supported()));
+  EXPECT_NE(kRgbx.Id(), (ZrlePixelFormat{0, 8, 16, true}.Id()));
+}
+
+}  // namespace
+}  // namespace vnc
+}  // namespace cuttlefish
@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/audio_converter.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <type_traits>
+
+#include <android-base/logging.h>
+
+namespace cuttlefish {
+namespace {
+
+// Taps per phase when upsampling. Downsampling needs proportionally more to
+// keep the same transition band relative to the lower rate.
+constexpr int kBaseTaps = 32;
+// Fraction of the lower Nyquist frequency that is kept.
+constexpr double kRolloff = 0.92;
+constexpr double kKaiserBeta = 8.0;
+
+// Loads and stores through memcpy compile to plain (vectorizable) moves and
+// don't make assumptions about the alignment of the shared memory buffers.
+template <typename T>
+T Load(const uint8_t* ptr) {
+  T value;
+  memcpy(&value, ptr, sizeof(T));
+  return value;
+}
+
+template <typename T>
+void Store(uint8_t* ptr, T value) {
+  memcpy(ptr, &value, sizeof(T));
+}
+
+// Integer formats hold kBits significant bits in the low bits of Stored.
+// Unsigned formats are offset binary, which is turned into two's complement
+// by flipping the top bit.
+template <typename Stored, int kBits, bool kUnsigned>
+void IntToFloat(const uint8_t* __restrict in, float* __restrict out,
+                size_t samples) {
+  constexpr int kShift = 32 - kBits;
+  constexpr uint32_t kSignBit = 1u << (kBits - 1);
+  constexpr float kScale = 1.0f / kSignBit;
+  for (size_t i = 0; i < samples; i++) {
+    uint32_t raw = static_cast<std::make_unsigned_t<Stored>>(
+        Load<Stored>(in + i * sizeof(Stored)));
+    if (kUnsigned) {
+      raw ^= kSignBit;
+    }
+    int32_t value = static_cast<int32_t>(raw << kShift) >> kShift;
+    out[i] = value * kScale;
+  }
+}
+
+template <typename Stored, int kBits, bool kUnsigned>
+void FloatToInt(const float* __restrict in, uint8_t* __restrict out,
+                size_t samples) {
+  constexpr uint32_t kSignBit = 1u << (kBits - 1);
+  constexpr uint32_t kMask =
+      kBits == 32 ? 0xFFFFFFFFu : (uint32_t)((1ull << kBits) - 1);
+  constexpr float kScale = kSignBit;
+  // 2^31 - 1 isn't representable as a float, use the largest one below it.
+  constexpr float kMax = kBits == 32 ? 2147483520.0f : kSignBit - 1.0f;
+  constexpr float kMin = -kScale;
+  for (size_t i = 0; i < samples; i++) {
+    float scaled = in[i] * kScale;
+    scaled += scaled >= 0 ? 0.5f : -0.5f;
+    scaled = std::min(std::max(scaled, kMin), kMax);
+    uint32_t raw = static_cast<uint32_t>(static_cast<int32_t>(scaled));
+    if (kUnsigned) {
+      raw ^= kSignBit;
+    }
+    Store<Stored>(out + i * sizeof(Stored), static_cast<Stored>(raw & kMask));
+  }
+}
+
+// Sums four interleaved partial products so that the reduction doesn't
+// depend on the compiler being allowed to reassociate float additions.
+float DotProduct(const float* __restrict a, const float* __restrict b,
+                 size_t len) {
+  typedef float Float4 __attribute__((vector_size(16)));
+  Float4 acc0 = {0, 0, 0, 0};
+  Float4 acc1 = {0, 0, 0, 0};
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    Float4 a0, a1, b0, b1;
+    memcpy(&a0, a + i, sizeof(a0));
+    memcpy(&a1, a + i + 4, sizeof(a1));
+    memcpy(&b0, b + i, sizeof(b0));
+    memcpy(&b1, b + i + 4, sizeof(b1));
+    acc0 += a0 * b0;
+    acc1 += a1 * b1;
+  }
+  Float4 acc = acc0 + acc1;
+  float sum = acc[0] + acc[1] + acc[2] + acc[3];
+  for (; i < len; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+// Zeroth order modified Bessel function of the first kind.
+double BesselI0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 50; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+    if (term < sum * 1e-12) {
+      break;
+    }
+  }
+  return sum;
+}
+
+}  // namespace
+
+bool IsConvertibleFormat(AudioStreamFormat format) {
+  switch (format) {
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_U8:
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16:
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_U16:
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_S24:
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_U24:
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_S32:
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_U32:
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_FLOAT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+size_t BytesPerSample(AudioStreamFormat format) {
+  switch (format) {
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_U8:
+      return 1;
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16:
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_U16:
+      return 2;
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_S24:
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_U24:
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_S32:
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_U32:
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_FLOAT:
+      return 4;
+    default:
+      LOG(FATAL) << "Unsupported format: " << (int)format;
+      return 0;
+  }
+}
+
+void SamplesToFloat(AudioStreamFormat format, const uint8_t* in, float* out,
+                    size_t samples) {
+  switch (format) {
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_U8:
+      return IntToFloat<uint8_t, 8, true>(in, out, samples);
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16:
+      return IntToFloat<int16_t, 16, false>(in, out, samples);
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_U16:
+      return IntToFloat<uint16_t, 16, true>(in, out, samples);
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_S24:
+      return IntToFloat<int32_t, 24, false>(in, out, samples);
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_U24:
+      return IntToFloat<uint32_t, 24, true>(in, out, samples);
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_S32:
+      return IntToFloat<int32_t, 32, false>(in, out, samples);
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_U32:
+      return IntToFloat<uint32_t, 32, true>(in, out, samples);
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_FLOAT:
+      memcpy(out, in, samples * sizeof(float));
+      return;
+    default:
+      LOG(FATAL) << "Unsupported format: " << (int)format;
+  }
+}
+
+void FloatToSamples(AudioStreamFormat format, const float* in, uint8_t* out,
+                    size_t samples) {
+  switch (format) {
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_U8:
+      return FloatToInt<uint8_t, 8, true>(in, out, samples);
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16:
+      return FloatToInt<int16_t, 16, false>(in, out, samples);
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_U16:
+      return FloatToInt<uint16_t, 16, true>(in, out, samples);
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_S24:
+      return FloatToInt<int32_t, 24, false>(in, out, samples);
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_U24:
+      return FloatToInt<uint32_t, 24, true>(in, out, samples);
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_S32:
+      return FloatToInt<int32_t, 32, false>(in, out, samples);
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_U32:
+      return FloatToInt<uint32_t, 32, true>(in, out, samples);
+    case AudioStreamFormat::VIRTIO_SND_PCM_FMT_FLOAT:
+      memcpy(out, in, samples * sizeof(float));
+      return;
+    default:
+      LOG(FATAL) << "Unsupported format: " << (int)format;
+  }
+}
+
+PolyphaseResampler::PolyphaseResampler(int in_rate, int out_rate, int channels)
+    : channels_(channels) {
+  CHECK(in_rate > 0 && out_rate > 0) << "Invalid rates: " << in_rate << " -> "
+                                     << out_rate;
+  auto divisor = std::gcd(in_rate, out_rate);
+  interpolation_ = out_rate / divisor;
+  decimation_ = in_rate / divisor;
+  auto factor = std::max(interpolation_, decimation_);
+  // Rounded up to a multiple of 8 to match the DotProduct stride.
+  taps_ = (kBaseTaps * factor / interpolation_ + 7) & ~7;
+
+  // Prototype filter at the interpolated rate. Its cutoff is at the lower of
+  // the two Nyquist frequencies.
+  size_t length = (size_t)taps_ * interpolation_;
+  double cutoff = 0.5 * kRolloff / factor;
+  double center = (length - 1) / 2.0;
+  double window_norm = BesselI0(kKaiserBeta);
+  std::vector<double> prototype(length);
+  for (size_t j = 0; j < length; j++) {
+    double t = j - center;
+    double x = 2.0 * M_PI * cutoff * t;
+    double sinc = t == 0 ? 1.0 : std::sin(x) / x;
+    double r = t / (center + 1);
+    double window = BesselI0(kKaiserBeta * std::sqrt(1.0 - r * r)) /
+                    window_norm;
+    prototype[j] = 2.0 * cutoff * sinc * window;
+  }
+
+  coefficients_.resize(length);
+  for (int phase = 0; phase < interpolation_; phase++) {
+    // Each phase is normalized to unity gain so that constant input produces
+    // constant output regardless of the phase.
+    double sum = 0;
+    for (int k = 0; k < taps_; k++) {
+      sum += prototype[(size_t)k * interpolation_ + phase];
+    }
+    float* phase_coefficients = &coefficients_[(size_t)phase * taps_];
+    for (int k = 0; k < taps_; k++) {
+      phase_coefficients[taps_ - 1 - k] =
+          prototype[(size_t)k * interpolation_ + phase] / sum;
+    }
+  }
+
+  history_.assign(channels_, std::vector<float>(taps_ - 1, 0.0f));
+  position_ = (uint64_t)(taps_ - 1) * interpolation_;
+}
+
+void PolyphaseResampler::Process(const float* in, size_t frames,
+                                 std::vector<float>* out) {
+  for (int channel = 0; channel < channels_; channel++) {
+    auto& history = history_[channel];
+    auto start = history.size();
+    history.resize(start + frames);
+    for (size_t i = 0; i < frames; i++) {
+      history[start + i] = in[i * channels_ + channel];
+    }
+  }
+  uint64_t available = history_[0].size();
+  uint64_t end = available * interpolation_;
+  size_t out_frames = 0;
+  if (position_ < end) {
+    out_frames = (end - position_ + decimation_ - 1) / decimation_;
+  }
+  auto out_start = out->size();
+  out->resize(out_start + out_frames * channels_);
+  float* out_ptr = out->data() + out_start;
+  for (size_t frame = 0; frame < out_frames; frame++) {
+    auto index = position_ / interpolation_;
+    auto phase = position_ % interpolation_;
+    const float* phase_coefficients = &coefficients_[phase * taps_];
+    for (int channel = 0; channel < channels_; channel++) {
+      *out_ptr++ = DotProduct(phase_coefficients,
+                              &history_[channel][index + 1 - taps_], taps_);
+    }
+    position_ += decimation_;
+  }
+  // Drop the input that no future output frame depends on.
+  auto consumed =
+      std::min(position_ / interpolation_, available) - (taps_ - 1);
+  for (auto& history : history_) {
+    history.erase(history.begin(), history.begin() + consumed);
+  }
+  position_ -= consumed * interpolation_;
+}
+
+PcmConverter::PcmConverter(AudioStreamFormat in_format, int in_rate,
+                           AudioStreamFormat out_format, int out_rate,
+                           int channels)
+    : in_format_(in_format),
+      out_format_(out_format),
+      channels_(channels),
+      in_frame_size_(BytesPerSample(in_format) * channels),
+      out_frame_size_(BytesPerSample(out_format) * channels) {
+  if (in_rate != out_rate) {
+    resampler_.reset(new PolyphaseResampler(in_rate, out_rate, channels));
+  }
+}
+
+bool PcmConverter::IsPassthrough() const {
+  return in_format_ == out_format_ && !resampler_;
+}
+
+void PcmConverter::Convert(const uint8_t* in, size_t len,
+                           std::vector<uint8_t>* out) {
+  auto frames = len / in_frame_size_;
+  samples_.resize(frames * channels_);
+  SamplesToFloat(in_format_, in, samples_.data(), samples_.size());
+  const float* converted = samples_.data();
+  auto out_frames = frames;
+  if (resampler_) {
+    resampled_.clear();
+    resampler_->Process(samples_.data(), frames, &resampled_);
+    converted = resampled_.data();
+    out_frames = resampled_.size() / channels_;
+  }
+  auto out_start = out->size();
+  out->resize(out_start + out_frames * out_frame_size_);
+  FloatToSamples(out_format_, converted, out->data() + out_start,
+                 out_frames * channels_);
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "host/libs/audio_connector/shm_layout.h"
+
+namespace cuttlefish {
+
+// Whether the converter can read and write samples in this virtio-snd format.
+bool IsConvertibleFormat(AudioStreamFormat format);
+// Size in bytes of a single sample (one channel) in the given format.
+size_t BytesPerSample(AudioStreamFormat format);
+
+// Converts interleaved samples to floats in [-1, 1) and back. These are plain
+// loops over restrict pointers without branches in their bodies so that the
+// compiler vectorizes them.
+void SamplesToFloat(AudioStreamFormat format, const uint8_t* in, float* out,
+                    size_t samples);
+void FloatToSamples(AudioStreamFormat format, const float* in, uint8_t* out,
+                    size_t samples);
+
+// Streaming sample rate converter for interleaved float audio. The ratio
+// between the rates is reduced to L/M and the input is filtered with the L
+// phases of a Kaiser windowed sinc low pass filter, so only the taps that
+// contribute to an output sample are computed. State is kept between calls,
+// input can be fed in buffers of any size.
+class PolyphaseResampler {
+ public:
+  PolyphaseResampler(int in_rate, int out_rate, int channels);
+
+  // Resamples |frames| interleaved frames from |in| and appends the produced
+  // frames to |out|.
+  void Process(const float* in, size_t frames, std::vector<float>* out);
+
+  int taps() const { return taps_; }
+
+ private:
+  int interpolation_;  // L
+  int decimation_;     // M
+  int channels_;
+  int taps_;
+  // Coefficients of each phase, stored reversed so that they can be
+  // multiplied with the input history in memory order.
+  std::vector<float> coefficients_;
+  // One buffer per channel, starting with the taps_ - 1 frames of history.
+  std::vector<std::vector<float>> history_;
+  // Position of the next output frame in the history buffers, in units of
+  // 1/L input frames.
+  uint64_t position_;
+};
+
+// Converts interleaved PCM between two virtio-snd formats and sample rates
+// with the same number of channels.
+class PcmConverter {
+ public:
+  PcmConverter(AudioStreamFormat in_format, int in_rate,
+               AudioStreamFormat out_format, int out_rate, int channels);
+
+  // When true the input can be used as is and Convert shouldn't be called.
+  bool IsPassthrough() const;
+
+  size_t in_frame_size() const { return in_frame_size_; }
+  size_t out_frame_size() const { return out_frame_size_; }
+
+  // Converts the whole frames in the first |len| bytes of |in| and appends
+  // the result to |out|.
+  void Convert(const uint8_t* in, size_t len, std::vector<uint8_t>* out);
+
+ private:
+  AudioStreamFormat in_format_;
+  AudioStreamFormat out_format_;
+  int channels_;
+  size_t in_frame_size_;
+  size_t out_frame_size_;
+  std::unique_ptr<PolyphaseResampler> resampler_;
+  std::vector<float> samples_;
+  std::vector<float> resampled_;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures each conversion path the AudioHandler can take, one 10ms stereo
+// buffer per iteration, as the guest would send or receive them.
+
+#include <cmath>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "host/frontend/webrtc/audio_converter.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr int kChannels = 2;
+constexpr int kWebrtcRate = 48000;
+constexpr auto kWebrtcFormat = AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16;
+
+// 10ms of a 1kHz tone in the given format and rate.
+std::vector<uint8_t> Tone(AudioStreamFormat format, int rate) {
+  std::vector<float> samples((rate / 100) * kChannels);
+  for (size_t i = 0; i < samples.size(); i++) {
+    samples[i] = 0.5f * std::sin(2 * M_PI * 1000 * (i / kChannels) / rate);
+  }
+  std::vector<uint8_t> data(samples.size() * BytesPerSample(format));
+  FloatToSamples(format, samples.data(), data.data(), samples.size());
+  return data;
+}
+
+void RunConversion(benchmark::State& state, AudioStreamFormat in_format,
+                   int in_rate, AudioStreamFormat out_format, int out_rate) {
+  PcmConverter converter(in_format, in_rate, out_format, out_rate, kChannels);
+  auto input = Tone(in_format, in_rate);
+  std::vector<uint8_t> output;
+  for (auto _ : state) {
+    output.clear();
+    converter.Convert(input.data(), input.size(), &output);
+    benchmark::DoNotOptimize(output.data());
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+// Playback: guest format at 48kHz to webrtc's S16.
+void BM_PlaybackFormat(benchmark::State& state) {
+  RunConversion(state, (AudioStreamFormat)state.range(0), kWebrtcRate,
+                kWebrtcFormat, kWebrtcRate);
+}
+BENCHMARK(BM_PlaybackFormat)
+    ->Arg((int)AudioStreamFormat::VIRTIO_SND_PCM_FMT_U8)
+    ->Arg((int)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16)
+    ->Arg((int)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S24)
+    ->Arg((int)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S32)
+    ->Arg((int)AudioStreamFormat::VIRTIO_SND_PCM_FMT_FLOAT);
+
+// Playback: guest S16 at other rates to 48kHz.
+void BM_PlaybackRate(benchmark::State& state) {
+  RunConversion(state, kWebrtcFormat, state.range(0), kWebrtcFormat,
+                kWebrtcRate);
+}
+BENCHMARK(BM_PlaybackRate)
+    ->Arg(8000)
+    ->Arg(16000)
+    ->Arg(44100)
+    ->Arg(96000)
+    ->Arg(192000);
+
+// Playback: guest float at 44.1kHz, both stages at once.
+void BM_PlaybackFloat44100(benchmark::State& state) {
+  RunConversion(state, AudioStreamFormat::VIRTIO_SND_PCM_FMT_FLOAT, 44100,
+                kWebrtcFormat, kWebrtcRate);
+}
+BENCHMARK(BM_PlaybackFloat44100);
+
+// Capture: webrtc's S16 to the guest format at 48kHz.
+void BM_CaptureFormat(benchmark::State& state) {
+  RunConversion(state, kWebrtcFormat, kWebrtcRate,
+                (AudioStreamFormat)state.range(0), kWebrtcRate);
+}
+BENCHMARK(BM_CaptureFormat)
+    ->Arg((int)AudioStreamFormat::VIRTIO_SND_PCM_FMT_U8)
+    ->Arg((int)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S24)
+    ->Arg((int)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S32)
+    ->Arg((int)AudioStreamFormat::VIRTIO_SND_PCM_FMT_FLOAT);
+
+// Capture: 48kHz to the guest rate.
+void BM_CaptureRate(benchmark::State& state) {
+  RunConversion(state, kWebrtcFormat, kWebrtcRate, kWebrtcFormat,
+                state.range(0));
+}
+BENCHMARK(BM_CaptureRate)->Arg(8000)->Arg(16000)->Arg(44100)->Arg(96000);
+
+}  // namespace
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/audio_converter.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+constexpr int kChannels = 2;
+
+template <typename T>
+std::vector<uint8_t> ToBytes(const std::vector<T>& values) {
+  std::vector<uint8_t> bytes(values.size() * sizeof(T));
+  memcpy(bytes.data(), values.data(), bytes.size());
+  return bytes;
+}
+
+template <typename T>
+std::vector<T> FromBytes(const std::vector<uint8_t>& bytes) {
+  std::vector<T> values(bytes.size() / sizeof(T));
+  memcpy(values.data(), bytes.data(), values.size() * sizeof(T));
+  return values;
+}
+
+std::vector<float> ToFloat(AudioStreamFormat format,
+                           const std::vector<uint8_t>& bytes) {
+  std::vector<float> out(bytes.size() / BytesPerSample(format));
+  SamplesToFloat(format, bytes.data(), out.data(), out.size());
+  return out;
+}
+
+template <typename T>
+std::vector<T> FromFloat(AudioStreamFormat format,
+                         const std::vector<float>& samples) {
+  std::vector<uint8_t> bytes(samples.size() * BytesPerSample(format));
+  FloatToSamples(format, samples.data(), bytes.data(), samples.size());
+  return FromBytes<T>(bytes);
+}
+
+// Interleaved stereo sine wave, the same tone on both channels.
+std::vector<float> Sine(double frequency, int rate, size_t frames) {
+  std::vector<float> samples(frames * kChannels);
+  for (size_t i = 0; i < samples.size(); i++) {
+    samples[i] = 0.5 * std::sin(2 * M_PI * frequency * (i / kChannels) / rate);
+  }
+  return samples;
+}
+
+TEST(AudioConverter, S16RoundTrip) {
+  std::vector<int16_t> values = {-32768, -12345, -1, 0, 1, 12345, 32767};
+  auto format = AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16;
+  auto floats = ToFloat(format, ToBytes(values));
+  EXPECT_EQ(floats[0], -1.0f);
+  EXPECT_EQ(floats[3], 0.0f);
+  EXPECT_EQ(FromFloat<int16_t>(format, floats), values);
+}
+
+TEST(AudioConverter, UnsignedFormatsAreOffset) {
+  auto u8 = ToFloat(AudioStreamFormat::VIRTIO_SND_PCM_FMT_U8,
+                    ToBytes(std::vector<uint8_t>{0, 128, 255}));
+  EXPECT_EQ(u8[0], -1.0f);
+  EXPECT_EQ(u8[1], 0.0f);
+  EXPECT_EQ(u8[2], 127.0f / 128);
+
+  auto u16 = ToFloat(AudioStreamFormat::VIRTIO_SND_PCM_FMT_U16,
+                     ToBytes(std::vector<uint16_t>{0, 0x8000, 0xffff}));
+  EXPECT_EQ(u16[0], -1.0f);
+  EXPECT_EQ(u16[1], 0.0f);
+  EXPECT_EQ(u16[2], 32767.0f / 32768);
+
+  EXPECT_EQ(FromFloat<uint8_t>(AudioStreamFormat::VIRTIO_SND_PCM_FMT_U8,
+                               {-1.0f, 0.0f}),
+            (std::vector<uint8_t>{0, 128}));
+}
+
+TEST(AudioConverter, S24UsesLowBitsAndSignExtends) {
+  auto format = AudioStreamFormat::VIRTIO_SND_PCM_FMT_S24;
+  // The top byte of each container is ignored on input.
+  std::vector<int32_t> values = {0x00800000, 0x7f400000, 0x003fffff};
+  auto floats = ToFloat(format, ToBytes(values));
+  EXPECT_EQ(floats[0], -1.0f);
+  EXPECT_EQ(floats[1], 0.5f);
+  EXPECT_EQ(floats[2], 4194303.0f / 8388608);
+  EXPECT_EQ(FromFloat<int32_t>(format, {-1.0f, 0.5f}),
+            (std::vector<int32_t>{0x00800000, 0x00400000}));
+}
+
+TEST(AudioConverter, ClampsOutOfRangeFloats) {
+  EXPECT_EQ(FromFloat<int16_t>(AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16,
+                               {2.0f, 1.0f, -1.0f, -2.0f}),
+            (std::vector<int16_t>{32767, 32767, -32768, -32768}));
+  auto s32 = FromFloat<int32_t>(AudioStreamFormat::VIRTIO_SND_PCM_FMT_S32,
+                                {1.0f, -1.0f});
+  EXPECT_GT(s32[0], 0x7fffff00);
+  EXPECT_EQ(s32[1], INT32_MIN);
+}
+
+TEST(AudioConverter, ResamplerKeepsConstantInput) {
+  PolyphaseResampler resampler(44100, 48000, kChannels);
+  std::vector<float> in(4410 * kChannels, 0.25f);
+  std::vector<float> out;
+  resampler.Process(in.data(), in.size() / kChannels, &out);
+  ASSERT_GT(out.size(), (size_t)(resampler.taps() * 2 * kChannels));
+  // Skip the frames that still depend on the silent initial history.
+  for (size_t i = resampler.taps() * 2 * kChannels; i < out.size(); i++) {
+    ASSERT_NEAR(out[i], 0.25f, 1e-4) << "at sample " << i;
+  }
+}
+
+TEST(AudioConverter, ResamplerProducesRateRatio) {
+  for (auto rates : std::vector<std::pair<int, int>>{
+           {44100, 48000}, {48000, 44100}, {16000, 48000}, {48000, 8000}}) {
+    PolyphaseResampler resampler(rates.first, rates.second, kChannels);
+    std::vector<float> out;
+    // One second in 10ms buffers.
+    auto in = Sine(1000, rates.first, rates.first / 100);
+    for (int i = 0; i < 100; i++) {
+      resampler.Process(in.data(), in.size() / kChannels, &out);
+    }
+    double frames = out.size() / kChannels;
+    EXPECT_NEAR(frames, rates.second, resampler.taps())
+        << rates.first << " -> " << rates.second;
+  }
+}
+
+TEST(AudioConverter, ResamplerKeepsToneFrequencyAndLevel) {
+  constexpr int kInRate = 44100;
+  constexpr int kOutRate = 48000;
+  PolyphaseResampler resampler(kInRate, kOutRate, kChannels);
+  auto in = Sine(1000, kInRate, kInRate);
+  std::vector<float> out;
+  resampler.Process(in.data(), kInRate, &out);
+
+  size_t skip = resampler.taps() * 2;
+  size_t frames = out.size() / kChannels;
+  int crossings = 0;
+  double energy = 0;
+  for (size_t frame = skip; frame < frames; frame++) {
+    float left = out[frame * kChannels];
+    EXPECT_EQ(left, out[frame * kChannels + 1]);
+    energy += left * left;
+    if (frame > skip && (out[(frame - 1) * kChannels] < 0) != (left < 0)) {
+      crossings++;
+    }
+  }
+  double seconds = (frames - skip) / (double)kOutRate;
+  // Two zero crossings per period.
+  EXPECT_NEAR(crossings / seconds, 2000, 10);
+  // RMS of a sine with amplitude 0.5.
+  EXPECT_NEAR(std::sqrt(energy / (frames - skip)), 0.5 / std::sqrt(2), 0.01);
+}
+
+TEST(AudioConverter, ResamplerOutputDoesNotDependOnBufferSizes) {
+  auto in = Sine(440, 48000, 4800);
+  PolyphaseResampler whole(48000, 44100, kChannels);
+  std::vector<float> whole_out;
+  whole.Process(in.data(), in.size() / kChannels, &whole_out);
+
+  PolyphaseResampler pieces(48000, 44100, kChannels);
+  std::vector<float> pieces_out;
+  size_t frame = 0;
+  size_t size = 1;
+  while (frame < in.size() / kChannels) {
+    size = std::min(size, in.size() / kChannels - frame);
+    pieces.Process(in.data() + frame * kChannels, size, &pieces_out);
+    frame += size;
+    size = size * 3 % 509 + 1;
+  }
+  EXPECT_EQ(whole_out, pieces_out);
+}
+
+TEST(AudioConverter, PcmConverterPassthrough) {
+  auto s16 = AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16;
+  auto u8 = AudioStreamFormat::VIRTIO_SND_PCM_FMT_U8;
+  EXPECT_TRUE(PcmConverter(s16, 48000, s16, 48000, kChannels).IsPassthrough());
+  EXPECT_FALSE(PcmConverter(u8, 48000, s16, 48000, kChannels).IsPassthrough());
+  EXPECT_FALSE(
+      PcmConverter(s16, 44100, s16, 48000, kChannels).IsPassthrough());
+}
+
+TEST(AudioConverter, PcmConverterConvertsFormatAndRate) {
+  auto in_format = AudioStreamFormat::VIRTIO_SND_PCM_FMT_FLOAT;
+  auto out_format = AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16;
+  PcmConverter converter(in_format, 44100, out_format, 48000, kChannels);
+  EXPECT_EQ(converter.in_frame_size(), 4u * kChannels);
+  EXPECT_EQ(converter.out_frame_size(), 2u * kChannels);
+
+  auto tone = Sine(1000, 44100, 441);
+  auto in = ToBytes(tone);
+  // A trailing partial frame is ignored.
+  in.push_back(0);
+  std::vector<uint8_t> out;
+  for (int i = 0; i < 100; i++) {
+    converter.Convert(in.data(), in.size(), &out);
+  }
+  ASSERT_EQ(out.size() % converter.out_frame_size(), 0u);
+  auto samples = FromBytes<int16_t>(out);
+  EXPECT_NEAR(samples.size() / kChannels, 48000, 64);
+  int16_t peak = 0;
+  for (auto sample : samples) {
+    peak = std::max<int16_t>(peak, std::abs(sample));
+  }
+  EXPECT_NEAR(peak, 16384, 400);
+}
+
+}  // namespace
+}  // namespace cuttlefish
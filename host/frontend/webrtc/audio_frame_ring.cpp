@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/audio_frame_ring.h"
+
+#include <android-base/logging.h>
+
+namespace cuttlefish {
+
+AudioFrameRing::AudioFrameRing(size_t capacity, size_t max_frame_size)
+    : max_frame_size_(max_frame_size) {
+  CHECK(capacity > 0) << "Audio frame ring needs at least one slot";
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  slots_.resize(size);
+  for (auto& slot : slots_) {
+    slot.data.resize(max_frame_size);
+  }
+  mask_ = size - 1;
+}
+
+AudioFrameSlot* AudioFrameRing::WriteSlot() {
+  auto head = head_.load(std::memory_order_relaxed);
+  if (head - tail_.load(std::memory_order_acquire) == slots_.size()) {
+    return nullptr;
+  }
+  return &slots_[head & mask_];
+}
+
+void AudioFrameRing::CommitWrite() {
+  head_.store(head_.load(std::memory_order_relaxed) + 1,
+              std::memory_order_release);
+}
+
+AudioFrameSlot* AudioFrameRing::ReadSlot() {
+  auto tail = tail_.load(std::memory_order_relaxed);
+  if (head_.load(std::memory_order_acquire) == tail) {
+    return nullptr;
+  }
+  return &slots_[tail & mask_];
+}
+
+void AudioFrameRing::CommitRead() {
+  tail_.store(tail_.load(std::memory_order_relaxed) + 1,
+              std::memory_order_release);
+}
+
+size_t AudioFrameRing::Size() const {
+  auto tail = tail_.load(std::memory_order_acquire);
+  return head_.load(std::memory_order_acquire) - tail;
+}
+
+}  // namespace cuttlefish
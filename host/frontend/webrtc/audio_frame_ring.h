@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+namespace cuttlefish {
+
+struct AudioFrameSlot {
+  // Allocated once, with room for the largest frame.
+  std::vector<uint8_t> data;
+  int channels = 0;
+  // When the last byte of the frame was received from the guest.
+  std::chrono::steady_clock::time_point arrival;
+};
+
+// Fixed capacity single producer single consumer queue of audio frames. All
+// memory is allocated on construction, producer and consumer synchronize only
+// through the head and tail indices.
+class AudioFrameRing {
+ public:
+  // The capacity is rounded up to a power of two.
+  AudioFrameRing(size_t capacity, size_t max_frame_size);
+
+  // Producer side. Returns the slot to fill next or nullptr if the ring is
+  // full. The slot becomes visible to the consumer on CommitWrite.
+  AudioFrameSlot* WriteSlot();
+  void CommitWrite();
+
+  // Consumer side. Returns the oldest frame or nullptr if the ring is empty.
+  // The slot is returned to the producer on CommitRead.
+  AudioFrameSlot* ReadSlot();
+  void CommitRead();
+
+  // Number of committed frames not read yet. Exact when called from the
+  // producer or consumer, a snapshot otherwise.
+  size_t Size() const;
+  size_t Capacity() const { return slots_.size(); }
+  size_t MaxFrameSize() const { return max_frame_size_; }
+
+ private:
+  std::vector<AudioFrameSlot> slots_;
+  size_t mask_;
+  size_t max_frame_size_;
+  // Kept on separate cache lines so that producer and consumer don't contend.
+  alignas(64) std::atomic<uint64_t> head_ = 0;  // Next slot to write
+  alignas(64) std::atomic<uint64_t> tail_ = 0;  // Next slot to read
+};
+
+}  // namespace cuttlefish
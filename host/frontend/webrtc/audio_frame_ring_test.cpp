@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/audio_frame_ring.h"
+
+#include <string.h>
+
+#include <thread>
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+constexpr size_t kFrameSize = 16;
+
+bool Push(AudioFrameRing& ring, uint32_t value) {
+  auto slot = ring.WriteSlot();
+  if (!slot) {
+    return false;
+  }
+  memcpy(slot->data.data(), &value, sizeof(value));
+  ring.CommitWrite();
+  return true;
+}
+
+bool Pop(AudioFrameRing& ring, uint32_t* value) {
+  auto slot = ring.ReadSlot();
+  if (!slot) {
+    return false;
+  }
+  memcpy(value, slot->data.data(), sizeof(*value));
+  ring.CommitRead();
+  return true;
+}
+
+TEST(AudioFrameRing, RoundsCapacityAndPreallocates) {
+  AudioFrameRing ring(5, kFrameSize);
+  EXPECT_EQ(ring.Capacity(), 8u);
+  EXPECT_EQ(ring.MaxFrameSize(), kFrameSize);
+  auto slot = ring.WriteSlot();
+  ASSERT_NE(slot, nullptr);
+  EXPECT_EQ(slot->data.size(), kFrameSize);
+}
+
+TEST(AudioFrameRing, EmptyRingHasNothingToRead) {
+  AudioFrameRing ring(4, kFrameSize);
+  EXPECT_EQ(ring.ReadSlot(), nullptr);
+  EXPECT_EQ(ring.Size(), 0u);
+  // A slot handed out but not committed isn't visible to the reader.
+  ASSERT_NE(ring.WriteSlot(), nullptr);
+  EXPECT_EQ(ring.ReadSlot(), nullptr);
+}
+
+TEST(AudioFrameRing, FullRingRefusesWrites) {
+  AudioFrameRing ring(4, kFrameSize);
+  for (uint32_t i = 0; i < 4; i++) {
+    ASSERT_TRUE(Push(ring, i));
+  }
+  EXPECT_EQ(ring.Size(), 4u);
+  EXPECT_EQ(ring.WriteSlot(), nullptr);
+  uint32_t value;
+  ASSERT_TRUE(Pop(ring, &value));
+  EXPECT_EQ(value, 0u);
+  EXPECT_TRUE(Push(ring, 4));
+  EXPECT_EQ(ring.WriteSlot(), nullptr);
+}
+
+TEST(AudioFrameRing, KeepsOrderAcrossWraparound) {
+  AudioFrameRing ring(4, kFrameSize);
+  uint32_t next_write = 0;
+  uint32_t next_read = 0;
+  for (int round = 0; round < 10; round++) {
+    for (int i = 0; i < 3; i++) {
+      ASSERT_TRUE(Push(ring, next_write++));
+    }
+    for (int i = 0; i < 3; i++) {
+      uint32_t value;
+      ASSERT_TRUE(Pop(ring, &value));
+      ASSERT_EQ(value, next_read++);
+    }
+  }
+  EXPECT_EQ(ring.Size(), 0u);
+}
+
+TEST(AudioFrameRing, ConcurrentProducerAndConsumer) {
+  constexpr uint32_t kFrames = 100000;
+  AudioFrameRing ring(8, kFrameSize);
+  std::thread producer([&ring]() {
+    for (uint32_t i = 0; i < kFrames;) {
+      if (Push(ring, i)) {
+        i++;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+  uint32_t expected = 0;
+  uint32_t out_of_order = 0;
+  while (expected < kFrames) {
+    uint32_t value;
+    if (!Pop(ring, &value)) {
+      std::this_thread::yield();
+      continue;
+    }
+    out_of_order += value != expected;
+    expected++;
+  }
+  producer.join();
+  EXPECT_EQ(out_of_order, 0u);
+  EXPECT_EQ(ring.ReadSlot(), nullptr);
+}
+
+}  // namespace
+}  // namespace cuttlefish
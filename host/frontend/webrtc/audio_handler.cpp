@@ -20,25 +20,37 @@
 #include <chrono>
 
 #include <android-base/logging.h>
-#include <rtc_base/time_utils.h>
 
 namespace cuttlefish {
 namespace {
 
+constexpr uint64_t kConvertibleFormats =
+    (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_U8) |
+    (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16) |
+    (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_U16) |
+    (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S24) |
+    (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_U24) |
+    (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S32) |
+    (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_U32) |
+    (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_FLOAT);
+
+// The format webrtc takes on playback and provides on capture. Other rates
+// would be accepted too but would make webrtc resample again.
+constexpr auto kWebrtcFormat = AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16;
+constexpr int kWebrtcBitsPerSample = 16;
+constexpr int kWebrtcSampleRate = 48000;
+// Number of frames in the 10ms buffers webrtc works with.
+constexpr int kWebrtcFrames = kWebrtcSampleRate / 100;
+
 const virtio_snd_pcm_info STREAMS[] = {{
     .hdr =
         {
             .hda_fn_nid = Le32(0),
         },
     .features = Le32(0),
-    // webrtc's api is quite primitive and doesn't allow for many different
-    // formats: It only takes the bits_per_sample as a parameter and assumes
-    // the underlying format to be one of the following:
-    .formats = Le64(
-        (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_U8) |
-        (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_U16) |
-        (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_U24) |
-        (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_U32)),
+    // Streams in any of these formats are converted to and from the 48kHz
+    // S16 that webrtc works with internally.
+    .formats = Le64(kConvertibleFormats),
     .rates = Le64(
         (((uint64_t)1) << (uint8_t)AudioStreamRate::VIRTIO_SND_PCM_RATE_5512) |
         (((uint64_t)1) << (uint8_t)AudioStreamRate::VIRTIO_SND_PCM_RATE_8000) |
@@ -66,14 +78,9 @@ const virtio_snd_pcm_info STREAMS[] = {{
             .hda_fn_nid = Le32(0),
         },
     .features = Le32(0),
-    // webrtc's api is quite primitive and doesn't allow for many different
-    // formats: It only takes the bits_per_sample as a parameter and assumes
-    // the underlying format to be one of the following:
-    .formats = Le64(
-        (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_U8) |
-        (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_U16) |
-        (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_U24) |
-        (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_U32)),
+    // Streams in any of these formats are converted to and from the 48kHz
+    // S16 that webrtc works with internally.
+    .formats = Le64(kConvertibleFormats),
     .rates = Le64(
         (((uint64_t)1) << (uint8_t)AudioStreamRate::VIRTIO_SND_PCM_RATE_5512) |
         (((uint64_t)1) << (uint8_t)AudioStreamRate::VIRTIO_SND_PCM_RATE_8000) |
@@ -104,34 +111,6 @@ bool IsCapture(uint32_t stream_id) {
          (uint8_t)AudioStreamDirection::VIRTIO_SND_D_INPUT;
 }
 
-class CvdAudioFrameBuffer : public webrtc_streaming::AudioFrameBuffer {
- public:
-  CvdAudioFrameBuffer(const uint8_t* buffer, int bits_per_sample,
-                      int sample_rate, int channels, int frames)
-      : buffer_(buffer),
-        bits_per_sample_(bits_per_sample),
-        sample_rate_(sample_rate),
-        channels_(channels),
-        frames_(frames) {}
-
-  int bits_per_sample() const override { return bits_per_sample_; }
-
-  int sample_rate() const override { return sample_rate_; }
-
-  int channels() const override { return channels_; }
-
-  int frames() const override { return frames_; }
-
-  const uint8_t* data() const override { return buffer_; }
-
- private:
-  const uint8_t* buffer_;
-  int bits_per_sample_;
-  int sample_rate_;
-  int channels_;
-  int frames_;
-};
-
 int BitsPerSample(uint8_t virtio_format) {
   switch (virtio_format) {
     /* analog formats (width / physical width) */
@@ -262,12 +241,38 @@ AudioHandler::AudioHandler(
     : audio_sink_(audio_sink),
       audio_server_(std::move(audio_server)),
       stream_descs_(NUM_STREAMS),
-      audio_source_(audio_source) {}
+      audio_source_(audio_source) {
+  for (uint32_t stream_id = 0; stream_id < NUM_STREAMS; stream_id++) {
+    if (!IsCapture(stream_id)) {
+      stream_descs_[stream_id].jitter_buffer.reset(
+          new AudioJitterBuffer(audio_sink_));
+    }
+  }
+}
 
 void AudioHandler::Start() {
+  for (auto& stream_desc : stream_descs_) {
+    if (stream_desc.jitter_buffer) {
+      stream_desc.jitter_buffer->Start();
+    }
+  }
   server_thread_ = std::thread([this]() { Loop(); });
 }
 
+Json::Value AudioHandler::Stats() const {
+  Json::Value stats;
+  Json::Value playback(Json::arrayValue);
+  for (const auto& stream_desc : stream_descs_) {
+    if (stream_desc.jitter_buffer) {
+      playback.append(stream_desc.jitter_buffer->Stats());
+    }
+  }
+  stats["playback"] = playback;
+  stats["capture"]["errors"] = Json::UInt64(capture_errors_);
+  stats["capture"]["delay_ms"] = capture_delay_ms_.load();
+  return stats;
+}
+
 [[noreturn]] void AudioHandler::Loop() {
   for (;;) {
     auto audio_client = audio_server_->AcceptClient(
@@ -308,22 +313,36 @@ void AudioHandler::SetStreamParameters(StreamSetParamsCommand& cmd) {
     return;
   }
   const auto& stream_info = STREAMS[cmd.stream_id()];
+  auto format = (AudioStreamFormat)cmd.format();
   auto bits_per_sample = BitsPerSample(cmd.format());
   auto sample_rate = SampleRate(cmd.rate());
   auto channels = cmd.channels();
   if (bits_per_sample < 0 || sample_rate < 0 ||
+      !(stream_info.formats.as_uint64_t() & (((uint64_t)1) << cmd.format())) ||
       channels < stream_info.channels_min ||
       channels > stream_info.channels_max) {
     cmd.Reply(AudioStatus::VIRTIO_SND_S_BAD_MSG);
     return;
   }
   {
-    std::lock_guard<std::mutex> lock(stream_descs_[cmd.stream_id()].mtx);
-    stream_descs_[cmd.stream_id()].bits_per_sample = bits_per_sample;
-    stream_descs_[cmd.stream_id()].sample_rate = sample_rate;
-    stream_descs_[cmd.stream_id()].channels = channels;
-    auto len10ms = (channels * (sample_rate / 100) * bits_per_sample) / 8;
-    stream_descs_[cmd.stream_id()].buffer.Reset(len10ms);
+    auto& stream_desc = stream_descs_[cmd.stream_id()];
+    std::lock_guard<std::mutex> lock(stream_desc.mtx);
+    stream_desc.bits_per_sample = bits_per_sample;
+    stream_desc.sample_rate = sample_rate;
+    stream_desc.channels = channels;
+    if (IsCapture(cmd.stream_id())) {
+      stream_desc.converter.reset(new PcmConverter(
+          kWebrtcFormat, kWebrtcSampleRate, format, sample_rate, channels));
+    } else {
+      stream_desc.converter.reset(new PcmConverter(
+          format, sample_rate, kWebrtcFormat, kWebrtcSampleRate, channels));
+    }
+    stream_desc.converted.clear();
+    if (stream_desc.jitter_buffer) {
+      stream_desc.jitter_buffer->DiscardPartialFrame();
+    }
+    auto len10ms = (channels * kWebrtcFrames * kWebrtcBitsPerSample) / 8;
+    stream_desc.capture_buffer.resize(len10ms);
   }
   cmd.Reply(AudioStatus::VIRTIO_SND_S_OK);
 }
@@ -349,7 +368,18 @@ void AudioHandler::StartStream(StreamControlCommand& cmd) {
     cmd.Reply(AudioStatus::VIRTIO_SND_S_BAD_MSG);
     return;
   }
-  stream_descs_[cmd.stream_id()].active = true;
+  {
+    auto& stream_desc = stream_descs_[cmd.stream_id()];
+    std::lock_guard<std::mutex> lock(stream_desc.mtx);
+    // The converter is only created when the parameters are set.
+    if (!stream_desc.converter) {
+      LOG(ERROR) << "Stream " << cmd.stream_id()
+                 << " started before its parameters were set";
+      cmd.Reply(AudioStatus::VIRTIO_SND_S_BAD_MSG);
+      return;
+    }
+    stream_desc.active = true;
+  }
   cmd.Reply(AudioStatus::VIRTIO_SND_S_OK);
 }
 
@@ -358,7 +388,11 @@ void AudioHandler::StopStream(StreamControlCommand& cmd) {
     cmd.Reply(AudioStatus::VIRTIO_SND_S_BAD_MSG);
     return;
   }
-  stream_descs_[cmd.stream_id()].active = false;
+  {
+    auto& stream_desc = stream_descs_[cmd.stream_id()];
+    std::lock_guard<std::mutex> lock(stream_desc.mtx);
+    stream_desc.active = false;
+  }
   cmd.Reply(AudioStatus::VIRTIO_SND_S_OK);
 }
 
@@ -367,7 +401,6 @@ void AudioHandler::OnPlaybackBuffer(TxBuffer buffer) {
   auto& stream_desc = stream_descs_[stream_id];
   {
     std::lock_guard<std::mutex> lock(stream_desc.mtx);
-    auto& holding_buffer = stream_descs_[stream_id].buffer;
     // Invalid or capture streams shouldn't send tx buffers
     if (stream_id >= NUM_STREAMS || IsCapture(stream_id)) {
       buffer.SendStatus(AudioStatus::VIRTIO_SND_S_BAD_MSG, 0, 0);
@@ -380,43 +413,23 @@ void AudioHandler::OnPlaybackBuffer(TxBuffer buffer) {
       buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
       return;
     }
-    // Webrtc will silently ignore any buffer with a length different than 10ms,
-    // so we must split any buffer bigger than that and temporarily store any
-    // remaining frames that are less than that size.
-    auto current_time = rtc::TimeMillis();
-    // The timestamp of the first 10ms chunk to be sent so that the last one
-    // will have the current time
-    auto base_time =
-        current_time - ((buffer.len() - 1) / holding_buffer.buffer.size()) * 10;
-    // number of frames in a 10 ms buffer
-    const int frames = stream_desc.sample_rate / 100;
-    size_t pos = 0;
-    while (pos < buffer.len()) {
-      if (holding_buffer.empty() &&
-          buffer.len() - pos >= holding_buffer.buffer.size()) {
-        // Avoid the extra copy into holding buffer
-        // This casts away volatility of the pointer, necessary because the
-        // webrtc api doesn't expect volatile memory. This should be safe though
-        // because webrtc will use the contents of the buffer before returning
-        // and only then we release it.
-        auto audio_frame_buffer = std::make_shared<CvdAudioFrameBuffer>(
-            const_cast<const uint8_t*>(&buffer.get()[pos]),
-            stream_desc.bits_per_sample, stream_desc.sample_rate,
-            stream_desc.channels, frames);
-        audio_sink_->OnFrame(audio_frame_buffer, base_time);
-        pos += holding_buffer.buffer.size();
-      } else {
-        pos += holding_buffer.Add(buffer.get() + pos, buffer.len() - pos);
-        if (holding_buffer.full()) {
-          auto buffer_ptr = const_cast<const uint8_t*>(holding_buffer.data());
-          auto audio_frame_buffer = std::make_shared<CvdAudioFrameBuffer>(
-              buffer_ptr, stream_desc.bits_per_sample,
-              stream_desc.sample_rate, stream_desc.channels, frames);
-          audio_sink_->OnFrame(audio_frame_buffer, base_time);
-          holding_buffer.count = 0;
-        }
-      }
-      base_time += 10;
+    // StartStream rejects streams without parameters, this is a backstop.
+    if (!stream_desc.converter || !stream_desc.jitter_buffer) {
+      buffer.SendStatus(AudioStatus::VIRTIO_SND_S_BAD_MSG, 0, 0);
+      return;
+    }
+    // This casts away volatility of the pointer, which is safe because the
+    // contents are copied out before the buffer is released.
+    auto data = const_cast<const uint8_t*>(buffer.get());
+    auto& jitter_buffer = *stream_desc.jitter_buffer;
+    if (stream_desc.converter->IsPassthrough()) {
+      jitter_buffer.Write(data, buffer.len(), stream_desc.channels);
+    } else {
+      stream_desc.converted.clear();
+      stream_desc.converter->Convert(data, buffer.len(),
+                                     &stream_desc.converted);
+      jitter_buffer.Write(stream_desc.converted.data(),
+                          stream_desc.converted.size(), stream_desc.channels);
     }
   }
   buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
@@ -440,42 +453,63 @@ void AudioHandler::OnCaptureBuffer(RxBuffer buffer) {
       buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
       return;
     }
-    auto bytes_per_sample = stream_desc.bits_per_sample / 8;
-    auto samples_per_channel =
-        buffer.len() / stream_desc.channels / bytes_per_sample;
+    // StartStream rejects streams without parameters, this is a backstop.
+    if (!stream_desc.converter) {
+      buffer.SendStatus(AudioStatus::VIRTIO_SND_S_BAD_MSG, 0, 0);
+      return;
+    }
+    if (stream_desc.converter->IsPassthrough()) {
+      auto bytes_per_sample = stream_desc.bits_per_sample / 8;
+      auto samples_per_channel =
+          buffer.len() / stream_desc.channels / bytes_per_sample;
+      bool muted = false;
+      auto res = audio_source_->GetMoreAudioData(
+          const_cast<uint8_t*>(buffer.get()), bytes_per_sample,
+          samples_per_channel, stream_desc.channels, stream_desc.sample_rate,
+          muted);
+      if (res < 0) {
+        // This is likely a recoverable error, log the error but don't let the
+        // VMM know about it so that it doesn't crash.
+        LOG(ERROR) << "Failed to receive audio data from client";
+        capture_errors_++;
+      }
+    } else {
+      ReadCaptureFrames(stream_desc, buffer.get(), buffer.len());
+    }
+    // The guest consumes the buffer just returned and whatever was left over
+    // before it gets to newer audio.
+    auto buffered = buffer.len() + stream_desc.converted.size();
+    auto frame_size = stream_desc.channels * stream_desc.bits_per_sample / 8;
+    int delay_ms = buffered * 1000 / (frame_size * stream_desc.sample_rate);
+    capture_delay_ms_ = delay_ms;
+    audio_source_->SetPlayoutDelay(delay_ms);
+  }
+  buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
+}
+
+void AudioHandler::ReadCaptureFrames(StreamDesc& stream_desc,
+                                     volatile uint8_t* data, size_t len) {
+  auto& capture_buffer = stream_desc.capture_buffer;
+  auto& converted = stream_desc.converted;
+  // Pull audio from webrtc in 10ms chunks and keep whatever the guest didn't
+  // ask for yet for the next buffer.
+  while (converted.size() < len) {
+    std::fill(capture_buffer.begin(), capture_buffer.end(), 0);
     bool muted = false;
     auto res = audio_source_->GetMoreAudioData(
-        const_cast<uint8_t*>(buffer.get()), bytes_per_sample,
-        samples_per_channel, stream_desc.channels, stream_desc.sample_rate,
-        muted);
+        capture_buffer.data(), kWebrtcBitsPerSample / 8, kWebrtcFrames,
+        stream_desc.channels, kWebrtcSampleRate, muted);
     if (res < 0) {
-      // This is likely a recoverable error, log the error but don't let the VMM
-      // know about it so that it doesn't crash.
+      // This is likely a recoverable error, log the error but don't let the
+      // VMM know about it so that it doesn't crash.
       LOG(ERROR) << "Failed to receive audio data from client";
+      capture_errors_++;
     }
+    stream_desc.converter->Convert(capture_buffer.data(),
+                                   capture_buffer.size(), &converted);
   }
-  buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
-}
-
-void AudioHandler::HoldingBuffer::Reset(size_t size) {
-  buffer.resize(size);
-  count = 0;
+  std::copy(converted.begin(), converted.begin() + len, data);
+  converted.erase(converted.begin(), converted.begin() + len);
 }
 
-size_t AudioHandler::HoldingBuffer::Add(const volatile uint8_t* data,
-                                        size_t max_len) {
-  auto added_len = std::min(max_len, buffer.size() - count);
-  std::copy(data, data + added_len, &buffer[count]);
-  count += added_len;
-  return added_len;
-}
-
-bool AudioHandler::HoldingBuffer::empty() const { return count == 0; }
-
-bool AudioHandler::HoldingBuffer::full() const {
-  return count == buffer.size();
-}
-
-uint8_t* AudioHandler::HoldingBuffer::data() { return buffer.data(); }
-
 }  // namespace cuttlefish
@@ -16,36 +16,39 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 
+#include <json/json.h>
+
+#include "host/frontend/webrtc/audio_converter.h"
+#include "host/frontend/webrtc/audio_jitter_buffer.h"
 #include "host/frontend/webrtc/lib/audio_sink.h"
 #include "host/frontend/webrtc/lib/audio_source.h"
 #include "host/libs/audio_connector/server.h"
 
 namespace cuttlefish {
 class AudioHandler : public AudioServerExecutor {
-  // TODO(jemoreira): This can probably be avoided if playback goes through the
-  // audio device instead.
-  struct HoldingBuffer {
-    std::vector<uint8_t> buffer;
-    size_t count;
-
-    void Reset(size_t size);
-    size_t Add(const volatile uint8_t* data, size_t max_len);
-    bool empty() const;
-    bool full() const;
-    uint8_t* data();
-  };
   struct StreamDesc {
     std::mutex mtx;
     int bits_per_sample = -1;
     int sample_rate = -1;
     int channels = -1;
     bool active = false;
-    HoldingBuffer buffer;
+    // Holds 10ms of captured audio in webrtc's format.
+    std::vector<uint8_t> capture_buffer;
+    // Converts between the guest's format and webrtc's, in the direction of
+    // the stream.
+    std::unique_ptr<PcmConverter> converter;
+    // Converted audio: playback buffers on their way to the jitter buffer or
+    // captured audio waiting to be read by the guest.
+    std::vector<uint8_t> converted;
+    // Paces playback streams' frames into the audio sink.
+    std::unique_ptr<AudioJitterBuffer> jitter_buffer;
   };
 
  public:
@@ -56,6 +59,8 @@ class AudioHandler : public AudioServerExecutor {
 
   void Start();
 
+  Json::Value Stats() const;
+
   // AudioServerExecutor implementation
   void StreamsInfo(StreamInfoCommand& cmd) override;
   void SetStreamParameters(StreamSetParamsCommand& cmd) override;
@@ -69,11 +74,15 @@ class AudioHandler : public AudioServerExecutor {
 
  private:
   [[noreturn]] void Loop();
+  void ReadCaptureFrames(StreamDesc& stream_desc, volatile uint8_t* data,
+                         size_t len);
 
   std::shared_ptr<webrtc_streaming::AudioSink> audio_sink_;
   std::unique_ptr<AudioServer> audio_server_;
   std::thread server_thread_;
   std::vector<StreamDesc> stream_descs_ = {};
   std::shared_ptr<webrtc_streaming::AudioSource> audio_source_;
+  std::atomic<uint64_t> capture_errors_ = 0;
+  std::atomic<int> capture_delay_ms_ = 0;
 };
 }  // namespace cuttlefish
@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/audio_jitter_buffer.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+
+#include <android-base/logging.h>
+#include <rtc_base/time_utils.h>
+
+#include "common/libs/utils/stats_file.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::chrono::milliseconds kFrameDuration(10);
+// How much audio is buffered before playback starts.
+constexpr int kTargetFrames = 3;
+constexpr size_t kRingFrames = 64;
+// Consecutive frames of silence played before going back to waiting for the
+// guest, which is what happens when it stops playing.
+constexpr int kMaxConcealedFrames = 10;
+// If the ring never drained below the target during this many frames the
+// guest is producing faster than the sink consumes, drop a frame to recover.
+constexpr int kDriftWindowFrames = 100;
+
+constexpr size_t kMaxFrameSize = AudioJitterBuffer::kFrameSamples *
+                                 AudioJitterBuffer::kMaxChannels *
+                                 AudioJitterBuffer::kBitsPerSample / 8;
+
+size_t FrameSize(int channels) {
+  return AudioJitterBuffer::kFrameSamples * channels *
+         AudioJitterBuffer::kBitsPerSample / 8;
+}
+
+}  // namespace
+
+// Owns a copy of the frame, so the ring slot it came from can be reused as
+// soon as the sink returns.
+class AudioJitterBuffer::FrameBuffer
+    : public webrtc_streaming::AudioFrameBuffer {
+ public:
+  FrameBuffer() : data_(kMaxFrameSize) {}
+
+  void Set(const uint8_t* data, int channels) {
+    memcpy(data_.data(), data, FrameSize(channels));
+    channels_ = channels;
+  }
+
+  int bits_per_sample() const override { return kBitsPerSample; }
+  int sample_rate() const override { return kSampleRate; }
+  int channels() const override { return channels_; }
+  int frames() const override { return kFrameSamples; }
+  const uint8_t* data() const override { return data_.data(); }
+
+ private:
+  std::vector<uint8_t> data_;
+  int channels_ = 0;
+};
+
+AudioJitterBuffer::AudioJitterBuffer(
+    std::shared_ptr<webrtc_streaming::AudioSink> audio_sink)
+    : audio_sink_(audio_sink),
+      ring_(kRingFrames, kMaxFrameSize),
+      frame_buffer_(std::make_shared<FrameBuffer>()),
+      silence_(kMaxFrameSize, 0) {}
+
+AudioJitterBuffer::~AudioJitterBuffer() {
+  stop_ = true;
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+    wake_cv_.notify_one();
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void AudioJitterBuffer::Start() {
+  thread_ = std::thread([this]() { Loop(); });
+}
+
+void AudioJitterBuffer::Write(const uint8_t* data, size_t len, int channels) {
+  CHECK(channels > 0 && channels <= kMaxChannels)
+      << "Unsupported channel count: " << channels;
+  auto frame_size = FrameSize(channels);
+  size_t pos = 0;
+  while (pos < len) {
+    if (partial_len_ == 0) {
+      partial_slot_ = ring_.WriteSlot();
+      if (!partial_slot_) {
+        overruns_++;
+      }
+    }
+    auto count = std::min(len - pos, frame_size - partial_len_);
+    // The rest of the frame is skipped when there was no slot for it.
+    if (partial_slot_) {
+      memcpy(partial_slot_->data.data() + partial_len_, data + pos, count);
+    }
+    partial_len_ += count;
+    pos += count;
+    if (partial_len_ < frame_size) {
+      break;
+    }
+    if (partial_slot_) {
+      partial_slot_->channels = channels;
+      partial_slot_->arrival = std::chrono::steady_clock::now();
+      ring_.CommitWrite();
+      // Pairs with the fence in WaitForFrames: either the consumer sees the
+      // new frame or this sees it waiting.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (waiting_) {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        wake_cv_.notify_one();
+      }
+    }
+    partial_slot_ = nullptr;
+    partial_len_ = 0;
+  }
+}
+
+void AudioJitterBuffer::DiscardPartialFrame() {
+  partial_slot_ = nullptr;
+  partial_len_ = 0;
+}
+
+bool AudioJitterBuffer::WaitForFrames() {
+  {
+    std::unique_lock<std::mutex> lock(wake_mutex_);
+    waiting_ = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wake_cv_.wait(lock, [this]() { return stop_ || ring_.Size() > 0; });
+    waiting_ = false;
+  }
+  if (stop_) {
+    return false;
+  }
+  // Give the guest time to fill the buffer up to the target delay.
+  auto first = ring_.ReadSlot();
+  std::this_thread::sleep_until(first->arrival +
+                                kTargetFrames * kFrameDuration);
+  return !stop_;
+}
+
+void AudioJitterBuffer::Play(const uint8_t* data, int channels,
+                             int64_t timestamp_ms) {
+  // A sink that kept the previous frame gets a new buffer rather than seeing
+  // it overwritten.
+  if (frame_buffer_.use_count() > 1) {
+    frame_buffer_ = std::make_shared<FrameBuffer>();
+  }
+  frame_buffer_->Set(data, channels);
+  audio_sink_->OnFrame(frame_buffer_, timestamp_ms);
+  frames_played_++;
+}
+
+void AudioJitterBuffer::Loop() {
+  while (WaitForFrames()) {
+    // The playback clock: frame n is due at start + n * 10ms.
+    auto start = std::chrono::steady_clock::now();
+    auto start_ms = rtc::TimeMillis();
+    uint64_t frames = 0;
+    int concealed = 0;
+    int channels = kMaxChannels;
+    size_t min_depth = std::numeric_limits<size_t>::max();
+    int window = 0;
+    while (!stop_) {
+      auto timestamp_ms =
+          start_ms + static_cast<int64_t>(frames) * kFrameDuration.count();
+      auto slot = ring_.ReadSlot();
+      if (slot) {
+        // Silence played just before the guest resumed was an underrun, not
+        // the guest stopping.
+        underruns_ += concealed;
+        concealed = 0;
+        channels = slot->channels;
+        latency_.Record(std::chrono::steady_clock::now() - slot->arrival);
+        Play(slot->data.data(), channels, timestamp_ms);
+        ring_.CommitRead();
+      } else {
+        if (++concealed > kMaxConcealedFrames) {
+          break;
+        }
+        Play(silence_.data(), channels, timestamp_ms);
+      }
+      frames++;
+
+      min_depth = std::min(min_depth, ring_.Size());
+      if (++window == kDriftWindowFrames) {
+        if (min_depth > (size_t)kTargetFrames && ring_.ReadSlot()) {
+          ring_.CommitRead();
+          drift_drops_++;
+        }
+        min_depth = std::numeric_limits<size_t>::max();
+        window = 0;
+      }
+      std::this_thread::sleep_until(start + (int64_t)frames * kFrameDuration);
+    }
+  }
+}
+
+Json::Value AudioJitterBuffer::Stats() const {
+  Json::Value stats;
+  stats["frames_played"] = Json::UInt64(frames_played_);
+  stats["buffered_frames"] = Json::UInt64(ring_.Size());
+  stats["underruns"] = Json::UInt64(underruns_);
+  stats["overruns"] = Json::UInt64(overruns_);
+  stats["drift_drops"] = Json::UInt64(drift_drops_);
+  stats["latency"] = HistogramToJson(latency_);
+  return stats;
+}
+
+}  // namespace cuttlefish
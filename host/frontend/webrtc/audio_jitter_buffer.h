@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <json/json.h>
+
+#include "common/libs/utils/latency_histogram.h"
+#include "host/frontend/webrtc/audio_frame_ring.h"
+#include "host/frontend/webrtc/lib/audio_sink.h"
+
+namespace cuttlefish {
+
+// Decouples the guest's playback buffers from the audio sink. The guest side
+// splits its buffers in 10ms frames into a preallocated ring and a dedicated
+// thread hands them to the sink one every 10ms. Playback starts a fixed delay
+// after the first frame arrives, which absorbs the burstiness of the guest's
+// period sized buffers and of host scheduling. Timestamps are derived from the
+// number of frames played rather than from arrival times.
+class AudioJitterBuffer {
+ public:
+  // Frames are always 10ms of 48kHz S16 audio, with up to kMaxChannels.
+  static constexpr int kSampleRate = 48000;
+  static constexpr int kBitsPerSample = 16;
+  static constexpr int kFrameSamples = kSampleRate / 100;
+  static constexpr int kMaxChannels = 2;
+
+  AudioJitterBuffer(std::shared_ptr<webrtc_streaming::AudioSink> audio_sink);
+  ~AudioJitterBuffer();
+
+  void Start();
+
+  // Producer side. Calls to these must not overlap. Audio that doesn't fit in
+  // the ring is dropped and counted as an overrun.
+  void Write(const uint8_t* data, size_t len, int channels);
+  // Drops a partially written frame, e.g. when the stream parameters change.
+  void DiscardPartialFrame();
+
+  Json::Value Stats() const;
+
+ private:
+  void Loop();
+  // Waits until there is something to play. Returns false when stopping.
+  bool WaitForFrames();
+  void Play(const uint8_t* data, int channels, int64_t timestamp_ms);
+
+  std::shared_ptr<webrtc_streaming::AudioSink> audio_sink_;
+  AudioFrameRing ring_;
+  std::thread thread_;
+  std::atomic<bool> stop_ = false;
+
+  // Producer state
+  AudioFrameSlot* partial_slot_ = nullptr;
+  size_t partial_len_ = 0;
+
+  // Lets the playback thread sleep while the ring is empty. The producer only
+  // takes the mutex when the consumer is actually waiting.
+  std::mutex wake_mutex_;
+  std::condition_variable wake_cv_;
+  std::atomic<bool> waiting_ = false;
+
+  // Reused for every frame handed to the sink unless the sink holds on to it.
+  class FrameBuffer;
+  std::shared_ptr<FrameBuffer> frame_buffer_;
+  std::vector<uint8_t> silence_;
+
+  // Time between a frame being received and being handed to the sink.
+  LatencyHistogram latency_;
+  std::atomic<uint64_t> frames_played_ = 0;
+  // Frames of silence played because the ring was empty.
+  std::atomic<uint64_t> underruns_ = 0;
+  // Frames dropped because the ring was full.
+  std::atomic<uint64_t> overruns_ = 0;
+  // Frames dropped to bring the buffered audio back to the target delay.
+  std::atomic<uint64_t> drift_drops_ = 0;
+};
+
+}  // namespace cuttlefish
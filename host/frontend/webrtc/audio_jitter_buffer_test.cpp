@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/audio_jitter_buffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+constexpr int kChannels = 2;
+constexpr size_t kFrameSize = AudioJitterBuffer::kFrameSamples * kChannels *
+                              AudioJitterBuffer::kBitsPerSample / 8;
+constexpr auto kTimeout = std::chrono::seconds(5);
+
+// Records the first byte of every frame handed to it, 0 for silence.
+class RecordingSink : public webrtc_streaming::AudioSink {
+ public:
+  void OnFrame(std::shared_ptr<webrtc_streaming::AudioFrameBuffer> frame,
+               int64_t) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    EXPECT_EQ(frame->frames(), AudioJitterBuffer::kFrameSamples);
+    EXPECT_EQ(frame->channels(), kChannels);
+    frames_.push_back(frame->data()[0]);
+    changed_.notify_all();
+  }
+
+  // Waits until `count` frames that aren't silence have been played.
+  std::vector<uint8_t> WaitForAudio(size_t count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait_for(lock, kTimeout,
+                      [this, count]() { return Audio().size() >= count; });
+    return Audio();
+  }
+
+  size_t FramesPlayed() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return frames_.size();
+  }
+
+ private:
+  std::vector<uint8_t> Audio() const {
+    std::vector<uint8_t> audio;
+    for (auto frame : frames_) {
+      if (frame != 0) {
+        audio.push_back(frame);
+      }
+    }
+    return audio;
+  }
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::vector<uint8_t> frames_;
+};
+
+// Keeps every frame handed to it, as a sink that processes them later would.
+class RetainingSink : public webrtc_streaming::AudioSink {
+ public:
+  void OnFrame(std::shared_ptr<webrtc_streaming::AudioFrameBuffer> frame,
+               int64_t) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    frames_.push_back(frame);
+    changed_.notify_all();
+  }
+
+  // Waits until `count` frames that aren't silence have been played and
+  // returns the first byte of each, read now rather than when it was played.
+  std::vector<uint8_t> WaitForAudio(size_t count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait_for(lock, kTimeout,
+                      [this, count]() { return Audio().size() >= count; });
+    return Audio();
+  }
+
+ private:
+  std::vector<uint8_t> Audio() const {
+    std::vector<uint8_t> audio;
+    for (const auto& frame : frames_) {
+      if (frame->data()[0] != 0) {
+        audio.push_back(frame->data()[0]);
+      }
+    }
+    return audio;
+  }
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::vector<std::shared_ptr<webrtc_streaming::AudioFrameBuffer>> frames_;
+};
+
+// Frames filled with their number, starting at 1 so they differ from silence.
+std::vector<uint8_t> Frames(uint8_t first, size_t count) {
+  std::vector<uint8_t> data;
+  for (size_t i = 0; i < count; i++) {
+    data.insert(data.end(), kFrameSize, first + i);
+  }
+  return data;
+}
+
+std::vector<uint8_t> Sequence(uint8_t first, size_t count) {
+  std::vector<uint8_t> sequence;
+  for (size_t i = 0; i < count; i++) {
+    sequence.push_back(first + i);
+  }
+  return sequence;
+}
+
+TEST(AudioJitterBuffer, PlaysFramesSplitAcrossWritesInOrder) {
+  auto sink = std::make_shared<RecordingSink>();
+  AudioJitterBuffer buffer(sink);
+  buffer.Start();
+  auto data = Frames(1, 8);
+  // Guest buffers don't line up with the 10ms frames.
+  size_t chunk = kFrameSize * 3 / 2 + 7;
+  for (size_t pos = 0; pos < data.size(); pos += chunk) {
+    buffer.Write(data.data() + pos, std::min(chunk, data.size() - pos),
+                 kChannels);
+  }
+  EXPECT_EQ(sink->WaitForAudio(8), Sequence(1, 8));
+}
+
+TEST(AudioJitterBuffer, CountsOverrunsWhenFull) {
+  auto sink = std::make_shared<RecordingSink>();
+  AudioJitterBuffer buffer(sink);
+  // Nothing is consumed before Start, so the ring fills up.
+  auto data = Frames(1, 70);
+  buffer.Write(data.data(), data.size(), kChannels);
+  auto stats = buffer.Stats();
+  EXPECT_EQ(stats["buffered_frames"].asUInt64(), 64u);
+  EXPECT_EQ(stats["overruns"].asUInt64(), 6u);
+
+  // The frames that fit are played in order, the rest are lost.
+  buffer.Start();
+  EXPECT_EQ(sink->WaitForAudio(64), Sequence(1, 64));
+}
+
+TEST(AudioJitterBuffer, ConcealsAndCountsUnderruns) {
+  auto sink = std::make_shared<RecordingSink>();
+  AudioJitterBuffer buffer(sink);
+  buffer.Start();
+  auto first = Frames(1, 2);
+  buffer.Write(first.data(), first.size(), kChannels);
+  ASSERT_EQ(sink->WaitForAudio(2), Sequence(1, 2));
+  // Let a few frames of silence play, fewer than the playback thread
+  // tolerates before it treats the guest as stopped.
+  auto deadline = std::chrono::steady_clock::now() + kTimeout;
+  while (sink->FramesPlayed() < 4 &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  auto second = Frames(3, 2);
+  buffer.Write(second.data(), second.size(), kChannels);
+  EXPECT_EQ(sink->WaitForAudio(4), Sequence(1, 4));
+  EXPECT_GE(buffer.Stats()["underruns"].asUInt64(), 1u);
+}
+
+TEST(AudioJitterBuffer, DiscardsPartialFrame) {
+  auto sink = std::make_shared<RecordingSink>();
+  AudioJitterBuffer buffer(sink);
+  auto partial = Frames(9, 1);
+  buffer.Write(partial.data(), kFrameSize / 2, kChannels);
+  buffer.DiscardPartialFrame();
+  auto data = Frames(1, 2);
+  buffer.Write(data.data(), data.size(), kChannels);
+  EXPECT_EQ(buffer.Stats()["buffered_frames"].asUInt64(), 2u);
+  buffer.Start();
+  EXPECT_EQ(sink->WaitForAudio(2), Sequence(1, 2));
+}
+
+TEST(AudioJitterBuffer, FramesOutliveTheirRingSlot) {
+  auto sink = std::make_shared<RetainingSink>();
+  AudioJitterBuffer buffer(sink);
+  buffer.Start();
+  // More frames than the ring holds, so every slot is reused while the sink
+  // still has the frames played from it.
+  for (uint8_t first = 1; first <= 97; first += 32) {
+    auto data = Frames(first, 32);
+    buffer.Write(data.data(), data.size(), kChannels);
+    ASSERT_EQ(sink->WaitForAudio(first + 31), Sequence(1, first + 31));
+  }
+}
+
+}  // namespace
+}  // namespace cuttlefish
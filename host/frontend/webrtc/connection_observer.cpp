@@ -22,6 +22,7 @@
 
 #include <chrono>
 #include <map>
+#include <optional>
 #include <set>
 #include <thread>
 #include <vector>
@@ -103,11 +104,13 @@ class ConnectionObserverForAndroid
       cuttlefish::KernelLogEventsHandler *kernel_log_events_handler,
       std::map<std::string, cuttlefish::SharedFD>
           commands_to_custom_action_servers,
-      std::weak_ptr<DisplayHandler> display_handler)
+      std::weak_ptr<DisplayHandlers> display_handler,
+      std::shared_ptr<InputStats> input_stats)
       : input_sockets_(input_sockets),
         kernel_log_events_handler_(kernel_log_events_handler),
         commands_to_custom_action_servers_(commands_to_custom_action_servers),
-        weak_display_handler_(display_handler) {}
+        weak_display_handler_(display_handler),
+        input_stats_(input_stats) {}
   virtual ~ConnectionObserverForAndroid() {
     auto display_handler = weak_display_handler_.lock();
     if (display_handler) {
@@ -143,28 +146,46 @@ class ConnectionObserverForAndroid
 
   void OnTouchEvent(const std::string & /*display_label*/, int x, int y,
                     bool down) override {
-
-    auto buffer = GetEventBuffer();
+    StartEvent();
+    if (down && touch_down_) {
+      // A drag, only the last position before the flush matters.
+      pending_touch_move_ = {x, y};
+      pending_move_events_++;
+      return;
+    }
+    EmitPendingMoves();
+    touch_down_ = down;
+    auto buffer = NewEventBuffer(touch_writes_);
     if (!buffer) {
-      LOG(ERROR) << "Failed to allocate event buffer";
       return;
     }
     buffer->AddEvent(EV_ABS, ABS_X, x);
     buffer->AddEvent(EV_ABS, ABS_Y, y);
     buffer->AddEvent(EV_KEY, BTN_TOUCH, down);
     buffer->AddEvent(EV_SYN, SYN_REPORT, 0);
-    cuttlefish::WriteAll(input_sockets_.touch_client,
-                         reinterpret_cast<const char *>(buffer->data()),
-                         buffer->size());
   }
 
   void OnMultiTouchEvent(const std::string & /*display_label*/, Json::Value id,
                          Json::Value slot, Json::Value x, Json::Value y,
                          bool down, int size) override {
+    StartEvent();
+    bool is_move = down && size > 0;
+    for (int i = 0; i < size && is_move; i++) {
+      is_move = active_touch_slots_.count(slot[i].asInt());
+    }
+    if (is_move) {
+      // Every touch is already down, only the last position of each one
+      // before the flush matters.
+      for (int i = 0; i < size; i++) {
+        pending_touch_moves_[slot[i].asInt()] = {x[i].asInt(), y[i].asInt()};
+      }
+      pending_move_events_++;
+      return;
+    }
+    EmitPendingMoves();
 
-    auto buffer = GetEventBuffer();
+    auto buffer = NewEventBuffer(touch_writes_);
     if (!buffer) {
-      LOG(ERROR) << "Failed to allocate event buffer";
       return;
     }
 
@@ -198,35 +219,42 @@ class ConnectionObserverForAndroid
     }
 
     buffer->AddEvent(EV_SYN, SYN_REPORT, 0);
-    cuttlefish::WriteAll(input_sockets_.touch_client,
-                         reinterpret_cast<const char *>(buffer->data()),
-                         buffer->size());
   }
 
   void OnKeyboardEvent(uint16_t code, bool down) override {
-    auto buffer = GetEventBuffer();
+    StartEvent();
+    auto buffer = NewEventBuffer(keyboard_writes_);
     if (!buffer) {
-      LOG(ERROR) << "Failed to allocate event buffer";
       return;
     }
     buffer->AddEvent(EV_KEY, code, down);
     buffer->AddEvent(EV_SYN, SYN_REPORT, 0);
-    cuttlefish::WriteAll(input_sockets_.keyboard_client,
-                         reinterpret_cast<const char *>(buffer->data()),
-                         buffer->size());
   }
 
   void OnSwitchEvent(uint16_t code, bool state) override {
-    auto buffer = GetEventBuffer();
+    StartEvent();
+    auto buffer = NewEventBuffer(switches_writes_);
     if (!buffer) {
-      LOG(ERROR) << "Failed to allocate event buffer";
       return;
     }
     buffer->AddEvent(EV_SW, code, state);
     buffer->AddEvent(EV_SYN, SYN_REPORT, 0);
-    cuttlefish::WriteAll(input_sockets_.switches_client,
-                         reinterpret_cast<const char *>(buffer->data()),
-                         buffer->size());
+  }
+
+  void FlushInputEvents() override {
+    if (batch_events_ == 0) {
+      return;
+    }
+    EmitPendingMoves();
+    WritePending(input_sockets_.touch_client, touch_writes_);
+    WritePending(input_sockets_.keyboard_client, keyboard_writes_);
+    WritePending(input_sockets_.switches_client, switches_writes_);
+    if (input_stats_) {
+      input_stats_->OnEventsWritten(batch_start_, batch_events_,
+                                    batch_coalesced_);
+    }
+    batch_events_ = 0;
+    batch_coalesced_ = 0;
   }
 
   void OnAdbChannelOpen(std::function<bool(const uint8_t *, size_t)>
@@ -248,6 +276,12 @@ class ConnectionObserverForAndroid
         kernel_log_events_handler_->AddSubscriber(control_message_sender);
   }
   void OnControlMessage(const uint8_t* msg, size_t size) override {
+    HandleControlMessage(msg, size);
+    // Buttons and switches are written right away.
+    FlushInputEvents();
+  }
+
+  void HandleControlMessage(const uint8_t* msg, size_t size) {
     Json::Value evt;
     const char* msg_str = reinterpret_cast<const char*>(msg);
     Json::CharReaderBuilder builder;
@@ -338,8 +372,88 @@ class ConnectionObserverForAndroid
   std::shared_ptr<cuttlefish::webrtc_streaming::BluetoothHandler>
       bluetooth_handler_;
   std::map<std::string, cuttlefish::SharedFD> commands_to_custom_action_servers_;
-  std::weak_ptr<DisplayHandler> weak_display_handler_;
+  std::weak_ptr<DisplayHandlers> weak_display_handler_;
+  std::shared_ptr<InputStats> input_stats_;
   std::set<int32_t> active_touch_slots_;
+
+  // Events received since the last flush, one buffer per input report, to be
+  // written to each device with a single writev.
+  using PendingWrites = std::vector<std::unique_ptr<InputEventBuffer>>;
+  PendingWrites touch_writes_;
+  PendingWrites keyboard_writes_;
+  PendingWrites switches_writes_;
+  InputStats::TimePoint batch_start_;
+  size_t batch_events_ = 0;
+  size_t batch_coalesced_ = 0;
+
+  // Coalesced touch moves, by slot for multi-touch
+  struct TouchPosition {
+    int32_t x;
+    int32_t y;
+  };
+  bool touch_down_ = false;
+  std::optional<TouchPosition> pending_touch_move_;
+  std::map<int32_t, TouchPosition> pending_touch_moves_;
+  size_t pending_move_events_ = 0;
+
+  void StartEvent() {
+    if (batch_events_++ == 0) {
+      batch_start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  InputEventBuffer *NewEventBuffer(PendingWrites &writes) {
+    auto buffer = GetEventBuffer();
+    if (!buffer) {
+      LOG(ERROR) << "Failed to allocate event buffer";
+      return nullptr;
+    }
+    writes.push_back(std::move(buffer));
+    return writes.back().get();
+  }
+
+  // Queues a single report with the latest position of every moved touch.
+  void EmitPendingMoves() {
+    if (pending_move_events_ == 0) {
+      return;
+    }
+    batch_coalesced_ += pending_move_events_ - 1;
+    pending_move_events_ = 0;
+    auto buffer = NewEventBuffer(touch_writes_);
+    if (!buffer) {
+      return;
+    }
+    for (const auto &[slot, position] : pending_touch_moves_) {
+      buffer->AddEvent(EV_ABS, ABS_MT_SLOT, slot);
+      buffer->AddEvent(EV_ABS, ABS_MT_POSITION_X, position.x);
+      buffer->AddEvent(EV_ABS, ABS_MT_POSITION_Y, position.y);
+      buffer->AddEvent(EV_ABS, ABS_X, position.x);
+      buffer->AddEvent(EV_ABS, ABS_Y, position.y);
+    }
+    if (pending_touch_move_) {
+      buffer->AddEvent(EV_ABS, ABS_X, pending_touch_move_->x);
+      buffer->AddEvent(EV_ABS, ABS_Y, pending_touch_move_->y);
+      buffer->AddEvent(EV_KEY, BTN_TOUCH, 1);
+    }
+    buffer->AddEvent(EV_SYN, SYN_REPORT, 0);
+    pending_touch_moves_.clear();
+    pending_touch_move_.reset();
+  }
+
+  void WritePending(SharedFD socket, PendingWrites &writes) {
+    if (writes.empty()) {
+      return;
+    }
+    std::vector<struct iovec> iov;
+    iov.reserve(writes.size());
+    for (const auto &buffer : writes) {
+      iov.push_back({const_cast<void *>(buffer->data()), buffer->size()});
+    }
+    if (WriteAll(socket, std::move(iov)) < 0) {
+      LOG(ERROR) << "Failed to write input events: " << socket->StrError();
+    }
+    writes.clear();
+  }
 };
 
 class ConnectionObserverDemuxer
@@ -351,11 +465,13 @@ class ConnectionObserverDemuxer
       cuttlefish::KernelLogEventsHandler *kernel_log_events_handler,
       std::map<std::string, cuttlefish::SharedFD>
           commands_to_custom_action_servers,
-      std::weak_ptr<DisplayHandler> display_handler,
+      std::weak_ptr<DisplayHandlers> display_handler,
+      std::shared_ptr<InputStats> input_stats,
       /* params for this class */
       cuttlefish::confui::HostVirtualInput &confui_input)
       : android_input_(input_sockets, kernel_log_events_handler,
-                       commands_to_custom_action_servers, display_handler),
+                       commands_to_custom_action_servers, display_handler,
+                       input_stats),
         confui_input_{confui_input} {}
   virtual ~ConnectionObserverDemuxer() = default;
 
@@ -406,6 +522,8 @@ class ConnectionObserverDemuxer
     android_input_.OnSwitchEvent(code, state);
   }
 
+  void FlushInputEvents() override { android_input_.FlushInputEvents(); }
+
   void OnAdbChannelOpen(std::function<bool(const uint8_t *, size_t)>
                             adb_message_sender) override {
     android_input_.OnAdbChannelOpen(adb_message_sender);
@@ -441,17 +559,20 @@ class ConnectionObserverDemuxer
 CfConnectionObserverFactory::CfConnectionObserverFactory(
     cuttlefish::InputSockets &input_sockets,
     cuttlefish::KernelLogEventsHandler* kernel_log_events_handler,
-    cuttlefish::confui::HostVirtualInput &confui_input)
+    cuttlefish::confui::HostVirtualInput &confui_input,
+    std::shared_ptr<InputStats> input_stats)
     : input_sockets_(input_sockets),
       kernel_log_events_handler_(kernel_log_events_handler),
-      confui_input_{confui_input} {}
+      confui_input_{confui_input},
+      input_stats_(input_stats) {}
 
 std::shared_ptr<cuttlefish::webrtc_streaming::ConnectionObserver>
 CfConnectionObserverFactory::CreateObserver() {
   return std::shared_ptr<cuttlefish::webrtc_streaming::ConnectionObserver>(
       new ConnectionObserverDemuxer(input_sockets_, kernel_log_events_handler_,
                                     commands_to_custom_action_servers_,
-                                    weak_display_handler_, confui_input_));
+                                    weak_display_handler_, input_stats_,
+                                    confui_input_));
 }
 
 void CfConnectionObserverFactory::AddCustomActionServer(
@@ -464,7 +585,7 @@ void CfConnectionObserverFactory::AddCustomActionServer(
 }
 
 void CfConnectionObserverFactory::SetDisplayHandler(
-    std::weak_ptr<DisplayHandler> display_handler) {
+    std::weak_ptr<DisplayHandlers> display_handler) {
   weak_display_handler_ = display_handler;
 }
 }  // namespace cuttlefish
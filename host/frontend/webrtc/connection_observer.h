@@ -21,6 +21,7 @@
 
 #include "common/libs/fs/shared_fd.h"
 #include "host/frontend/webrtc/display_handler.h"
+#include "host/frontend/webrtc/input_stats.h"
 #include "host/frontend/webrtc/kernel_log_events_handler.h"
 #include "host/frontend/webrtc/lib/connection_observer.h"
 #include "host/libs/confui/host_virtual_input.h"
@@ -42,7 +43,8 @@ class CfConnectionObserverFactory
   CfConnectionObserverFactory(
       cuttlefish::InputSockets& input_sockets,
       KernelLogEventsHandler* kernel_log_events_handler,
-      cuttlefish::confui::HostVirtualInput& confui_input);
+      cuttlefish::confui::HostVirtualInput& confui_input,
+      std::shared_ptr<InputStats> input_stats);
   ~CfConnectionObserverFactory() override = default;
 
   std::shared_ptr<webrtc_streaming::ConnectionObserver> CreateObserver()
@@ -51,15 +53,16 @@ class CfConnectionObserverFactory
   void AddCustomActionServer(SharedFD custom_action_server_fd,
                              const std::vector<std::string>& commands);
 
-  void SetDisplayHandler(std::weak_ptr<DisplayHandler> display_handler);
+  void SetDisplayHandler(std::weak_ptr<DisplayHandlers> display_handler);
 
  private:
   InputSockets& input_sockets_;
   KernelLogEventsHandler* kernel_log_events_handler_;
   std::map<std::string, SharedFD>
       commands_to_custom_action_servers_;
-  std::weak_ptr<DisplayHandler> weak_display_handler_;
+  std::weak_ptr<DisplayHandlers> weak_display_handler_;
   cuttlefish::confui::HostVirtualInput& confui_input_;
+  std::shared_ptr<InputStats> input_stats_;
 };
 
 }  // namespace cuttlefish
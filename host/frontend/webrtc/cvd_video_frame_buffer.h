@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <vector>
 
 #include "host/frontend/webrtc/lib/video_frame_buffer.h"
@@ -48,12 +49,28 @@ class CvdVideoFrameBuffer : public webrtc_streaming::VideoFrameBuffer {
   uint8_t *DataU() { return u_.data(); }
   uint8_t *DataV() { return v_.data(); }
 
+  // When the guest committed the frame and when it was converted to I420, on
+  // the monotonic clock.
+  std::chrono::steady_clock::time_point capture_time() const {
+    return capture_time_;
+  }
+  std::chrono::steady_clock::time_point convert_time() const {
+    return convert_time_;
+  }
+  void SetTimes(std::chrono::steady_clock::time_point capture_time,
+                std::chrono::steady_clock::time_point convert_time) {
+    capture_time_ = capture_time;
+    convert_time_ = convert_time;
+  }
+
  private:
   const int width_;
   const int height_;
   std::vector<std::uint8_t> y_;
   std::vector<std::uint8_t> u_;
   std::vector<std::uint8_t> v_;
+  std::chrono::steady_clock::time_point capture_time_;
+  std::chrono::steady_clock::time_point convert_time_;
 };
 
 }
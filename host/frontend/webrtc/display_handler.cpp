@@ -16,73 +16,177 @@
 
 #include "host/frontend/webrtc/display_handler.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <functional>
 #include <memory>
 
+#include <android-base/logging.h>
 #include <libyuv.h>
 
 namespace cuttlefish {
+namespace {
+
+// How often the last frame is sent while the screen doesn't change.
+constexpr auto kIdleFrameInterval = std::chrono::seconds(1);
+
+// A fast hash of the frame pixels, much cheaper than converting and encoding
+// the frame. Four independent lanes keep the multiplies pipelined.
+std::uint64_t HashFrame(const std::uint8_t* pixels, std::size_t size) {
+  constexpr std::uint64_t kMultiplier = 0x9e3779b97f4a7c15ull;
+  std::uint64_t lanes[4] = {1, 2, 3, 4};
+  std::size_t words = size / sizeof(std::uint64_t);
+  std::size_t i = 0;
+  for (; i + 4 <= words; i += 4) {
+    for (int lane = 0; lane < 4; lane++) {
+      std::uint64_t word;
+      std::memcpy(&word, pixels + (i + lane) * sizeof(word), sizeof(word));
+      lanes[lane] = (lanes[lane] ^ word) * kMultiplier;
+      lanes[lane] ^= lanes[lane] >> 29;
+    }
+  }
+  std::uint64_t hash = size;
+  for (auto lane : lanes) {
+    hash = (hash ^ lane) * kMultiplier;
+  }
+  for (std::size_t offset = i * sizeof(std::uint64_t); offset < size;
+       offset++) {
+    hash = (hash ^ pixels[offset]) * kMultiplier;
+  }
+  return hash ^ (hash >> 32);
+}
+
+}  // namespace
+
+// Conversion buffers of a display, reused once the sink releases them.
+class DisplayHandler::BufferPool {
+ public:
+  BufferPool(int width, int height) : width_(width), height_(height) {}
+
+  std::unique_ptr<CvdVideoFrameBuffer> Acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_buffers_.empty()) {
+      return std::make_unique<CvdVideoFrameBuffer>(width_, height_);
+    }
+    auto buffer = std::move(free_buffers_.back());
+    free_buffers_.pop_back();
+    return buffer;
+  }
+
+  void Release(std::unique_ptr<CvdVideoFrameBuffer> buffer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_buffers_.size() < kMaxFreeBuffers) {
+      free_buffers_.push_back(std::move(buffer));
+    }
+  }
+
+ private:
+  // The last frame, one in the encoder and one being converted.
+  static constexpr std::size_t kMaxFreeBuffers = 3;
+
+  const int width_;
+  const int height_;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<CvdVideoFrameBuffer>> free_buffers_;
+};
+
 DisplayHandler::DisplayHandler(
+    std::uint32_t display_number,
     std::shared_ptr<webrtc_streaming::VideoSink> display_sink,
-    ScreenConnector& screen_connector)
-    : display_sink_(display_sink), screen_connector_(screen_connector) {
-  screen_connector_.SetCallback(std::move(GetScreenConnectorCallback()));
+    std::shared_ptr<VideoStats> video_stats)
+    : display_number_(display_number),
+      width_(ScreenConnectorInfo::ScreenWidth(display_number)),
+      height_(ScreenConnectorInfo::ScreenHeight(display_number)),
+      stride_bytes_(ScreenConnectorInfo::ScreenStrideBytes(display_number)),
+      display_sink_(display_sink),
+      video_stats_(video_stats),
+      buffer_pool_(std::make_shared<BufferPool>(width_, height_)) {
+  send_thread_ = std::thread([this]() { SendLoop(); });
 }
 
-DisplayHandler::GenerateProcessedFrameCallback DisplayHandler::GetScreenConnectorCallback() {
-    // only to tell the producer how to create a ProcessedFrame to cache into the queue
-    DisplayHandler::GenerateProcessedFrameCallback callback =
-        [](std::uint32_t display_number, std::uint8_t* frame_pixels,
-           WebRtcScProcessedFrame& processed_frame) {
-          processed_frame.display_number_ = display_number;
-          // TODO(171305898): handle multiple displays.
-          if (display_number != 0) {
-            // BUG 186580833: display_number comes from surface_id in crosvm
-            // create_surface from virtio_gpu.rs set_scanout.  We cannot use it as
-            // the display number. Either crosvm virtio-gpu is incorrectly ignoring
-            // scanout id and instead using a monotonically increasing surface id
-            // number as the scanout resource is replaced over time, or frontend code
-            // here is incorrectly assuming  surface id == display id.
-            display_number = 0;
-          }
-          const int display_w =
-              ScreenConnectorInfo::ScreenWidth(display_number);
-          const int display_h =
-              ScreenConnectorInfo::ScreenHeight(display_number);
-          const int display_stride_bytes =
-              ScreenConnectorInfo::ScreenStrideBytes(display_number);
-          processed_frame.display_number_ = display_number;
-          processed_frame.buf_ =
-              std::make_unique<CvdVideoFrameBuffer>(display_w, display_h);
-          libyuv::ABGRToI420(
-              frame_pixels, display_stride_bytes, processed_frame.buf_->DataY(),
-              processed_frame.buf_->StrideY(), processed_frame.buf_->DataU(),
-              processed_frame.buf_->StrideU(), processed_frame.buf_->DataV(),
-              processed_frame.buf_->StrideV(), display_w, display_h);
-          processed_frame.is_success_ = true;
-        };
-    return callback;
+DisplayHandler::~DisplayHandler() {
+  {
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    stopped_ = true;
+  }
+  send_cv_.notify_all();
+  send_thread_.join();
+}
+
+void DisplayHandler::ConvertFrame(std::uint8_t* frame_pixels,
+                                  WebRtcScProcessedFrame& processed_frame) {
+  processed_frame.display_number_ = display_number_;
+  if (!FrameChanged(frame_pixels)) {
+    video_stats_->OnFrameUnchanged();
+    processed_frame.is_success_ = false;
+    return;
+  }
+  processed_frame.buf_ = buffer_pool_->Acquire();
+  libyuv::ABGRToI420(
+      frame_pixels, stride_bytes_, processed_frame.buf_->DataY(),
+      processed_frame.buf_->StrideY(), processed_frame.buf_->DataU(),
+      processed_frame.buf_->StrideU(), processed_frame.buf_->DataV(),
+      processed_frame.buf_->StrideV(), width_, height_);
+  auto convert_time = std::chrono::steady_clock::now();
+  processed_frame.buf_->SetTimes(processed_frame.capture_time_, convert_time);
+  video_stats_->OnFrameConverted(processed_frame.capture_time_, convert_time);
+  processed_frame.is_success_ = true;
+}
+
+bool DisplayHandler::FrameChanged(const std::uint8_t* frame_pixels) {
+  auto hash = HashFrame(frame_pixels,
+                        static_cast<std::size_t>(stride_bytes_) * height_);
+  if (last_frame_hash_ == hash) {
+    return false;
+  }
+  last_frame_hash_ = hash;
+  return true;
+}
+
+void DisplayHandler::OnFrame(std::unique_ptr<CvdVideoFrameBuffer> buffer) {
+  std::weak_ptr<BufferPool> weak_pool = buffer_pool_;
+  std::shared_ptr<CvdVideoFrameBuffer> shared_buffer(
+      buffer.release(), [weak_pool](CvdVideoFrameBuffer* released) {
+        std::unique_ptr<CvdVideoFrameBuffer> owned(released);
+        if (auto pool = weak_pool.lock()) {
+          pool->Release(std::move(owned));
+        }
+      });
+  {
+    std::lock_guard<std::mutex> lock(last_buffer_mutex_);
+    last_buffer_ = shared_buffer;
+  }
+  SendLastFrame();
+}
+
+void DisplayHandler::SendLastFrame() {
+  {
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    frame_pending_ = true;
+  }
+  send_cv_.notify_one();
 }
 
-[[noreturn]] void DisplayHandler::Loop() {
+// Frames arriving while the sink is busy replace each other, only the newest
+// one is sent. Without new frames the last one is sent again now and then.
+void DisplayHandler::SendLoop() {
   for (;;) {
-    auto processed_frame = screen_connector_.OnNextFrame();
-    // processed_frame has display number from the guest
     {
-      std::lock_guard<std::mutex> lock(last_buffer_mutex_);
-      std::shared_ptr<CvdVideoFrameBuffer> buffer = std::move(processed_frame.buf_);
-      last_buffer_ =
-          std::static_pointer_cast<webrtc_streaming::VideoFrameBuffer>(buffer);
-    }
-    if (processed_frame.is_success_) {
-      SendLastFrame();
+      std::unique_lock<std::mutex> lock(send_mutex_);
+      send_cv_.wait_for(lock, kIdleFrameInterval,
+                        [this]() { return frame_pending_ || stopped_; });
+      if (stopped_) {
+        return;
+      }
+      frame_pending_ = false;
     }
+    SendFrame();
   }
 }
 
-void DisplayHandler::SendLastFrame() {
-  std::shared_ptr<webrtc_streaming::VideoFrameBuffer> buffer;
+void DisplayHandler::SendFrame() {
+  std::shared_ptr<CvdVideoFrameBuffer> buffer;
   {
     std::lock_guard<std::mutex> lock(last_buffer_mutex_);
     buffer = last_buffer_;
@@ -92,26 +196,81 @@ void DisplayHandler::SendLastFrame() {
     // send any frame.
     return;
   }
-  {
-    // SendLastFrame can be called from multiple threads simultaneously, locking
-    // here avoids injecting frames with the timestamps in the wrong order.
-    std::lock_guard<std::mutex> lock(next_frame_mutex_);
-    int64_t time_stamp =
-        std::chrono::duration_cast<std::chrono::microseconds>(
-            std::chrono::system_clock::now().time_since_epoch())
-            .count();
-    display_sink_->OnFrame(buffer, time_stamp);
+  // Frames are stamped with the time the guest committed them, the encoder
+  // then sees the guest's frame pacing rather than our scheduling. It drops
+  // frames that don't move its clock forward, so a frame sent again is
+  // stamped as captured now.
+  int64_t time_stamp = VideoStats::ToTimestampUs(buffer->capture_time());
+  if (time_stamp > last_timestamp_us_) {
+    video_stats_->OnFrameSent(buffer->convert_time());
+  } else {
+    video_stats_->OnFrameResent();
+    time_stamp = std::max(
+        VideoStats::ToTimestampUs(std::chrono::steady_clock::now()),
+        last_timestamp_us_ + 1000);
+  }
+  last_timestamp_us_ = time_stamp;
+  display_sink_->OnFrame(buffer, time_stamp);
+}
+
+DisplayHandlers::DisplayHandlers(
+    std::vector<std::shared_ptr<webrtc_streaming::VideoSink>> display_sinks,
+    ScreenConnector& screen_connector,
+    std::shared_ptr<InputStats> input_stats,
+    std::shared_ptr<VideoStats> video_stats)
+    : screen_connector_(screen_connector), input_stats_(input_stats) {
+  for (std::uint32_t i = 0; i < display_sinks.size(); i++) {
+    handlers_.emplace_back(
+        new DisplayHandler(i, display_sinks[i], video_stats));
+  }
+  screen_connector_.SetCallback(std::move(GetScreenConnectorCallback()));
+}
+
+DisplayHandlers::GenerateProcessedFrameCallback DisplayHandlers::GetScreenConnectorCallback() {
+    // only to tell the producer how to create a ProcessedFrame to cache into the queue
+    DisplayHandlers::GenerateProcessedFrameCallback callback =
+        [this](std::uint32_t display_number, std::uint8_t* frame_pixels,
+               WebRtcScProcessedFrame& processed_frame) {
+          processed_frame.display_number_ = display_number;
+          if (display_number >= handlers_.size()) {
+            LOG(ERROR) << "No video track for display " << display_number;
+            processed_frame.is_success_ = false;
+            return;
+          }
+          handlers_[display_number]->ConvertFrame(frame_pixels,
+                                                  processed_frame);
+        };
+    return callback;
+}
+
+[[noreturn]] void DisplayHandlers::Loop() {
+  for (;;) {
+    auto processed_frame = screen_connector_.OnNextFrame();
+    // processed_frame has display number from the guest
+    if (!processed_frame.is_success_ || !processed_frame.buf_ ||
+        processed_frame.display_number_ >= handlers_.size()) {
+      continue;
+    }
+    handlers_[processed_frame.display_number_]->OnFrame(
+        std::move(processed_frame.buf_));
+    input_stats_->OnFrame();
+  }
+}
+
+void DisplayHandlers::SendLastFrame() {
+  for (auto& handler : handlers_) {
+    handler->SendLastFrame();
   }
 }
 
-void DisplayHandler::IncClientCount() {
+void DisplayHandlers::IncClientCount() {
   client_count_++;
   if (client_count_ == 1) {
     screen_connector_.ReportClientsConnected(true);
   }
 }
 
-void DisplayHandler::DecClientCount() {
+void DisplayHandlers::DecClientCount() {
   client_count_--;
   if (client_count_ == 0) {
     screen_connector_.ReportClientsConnected(false);
@@ -16,11 +16,17 @@
 
 #pragma once
 
+#include <condition_variable>
 #include <mutex>
 #include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
 
 #include "host/frontend/webrtc/cvd_video_frame_buffer.h"
+#include "host/frontend/webrtc/input_stats.h"
 #include "host/frontend/webrtc/lib/video_sink.h"
+#include "host/frontend/webrtc/video_stats.h"
 #include "host/libs/screen_connector/screen_connector.h"
 
 namespace cuttlefish {
@@ -46,16 +52,80 @@ struct WebRtcScProcessedFrame : public ScreenConnectorFrameInfo {
   }
 };
 
+/**
+ * Streams the frames of one display to its video track.
+ *
+ * Frames are converted into buffers from a pool owned by the display and
+ * handed to the sink from a thread of its own, so a slow encoder on one
+ * display doesn't hold back the others. Only that thread gives frames to the
+ * sink.
+ *
+ * Frames identical to the previous one aren't converted or sent. While the
+ * screen doesn't change the last frame is sent at a low rate instead, so
+ * the encoders can still answer key frame requests.
+ */
 class DisplayHandler {
+ public:
+  DisplayHandler(std::uint32_t display_number,
+                 std::shared_ptr<webrtc_streaming::VideoSink> display_sink,
+                 std::shared_ptr<VideoStats> video_stats);
+  ~DisplayHandler();
+
+  // Converts a guest frame of this display to I420, fails if the frame didn't
+  // change.
+  void ConvertFrame(std::uint8_t* frame_pixels,
+                    WebRtcScProcessedFrame& processed_frame);
+  // Makes the converted frame the last one and sends it.
+  void OnFrame(std::unique_ptr<CvdVideoFrameBuffer> buffer);
+  // Has the send thread send the last frame again.
+  void SendLastFrame();
+
+ private:
+  class BufferPool;
+
+  void SendLoop();
+  void SendFrame();
+  // Whether the frame differs from the previous one of the display.
+  bool FrameChanged(const std::uint8_t* frame_pixels);
+
+  const std::uint32_t display_number_;
+  const int width_;
+  const int height_;
+  const int stride_bytes_;
+  std::shared_ptr<webrtc_streaming::VideoSink> display_sink_;
+  std::shared_ptr<VideoStats> video_stats_;
+  std::shared_ptr<BufferPool> buffer_pool_;
+  std::shared_ptr<CvdVideoFrameBuffer> last_buffer_;
+  // Only accessed by the thread converting the frames.
+  std::optional<std::uint64_t> last_frame_hash_;
+  std::mutex last_buffer_mutex_;
+  // The timestamp of the last frame given to the sink, only accessed by the
+  // send thread.
+  int64_t last_timestamp_us_ = 0;
+
+  std::mutex send_mutex_;
+  std::condition_variable send_cv_;
+  bool frame_pending_ = false;
+  bool stopped_ = false;
+  std::thread send_thread_;
+};
+
+// Hands the frames of the screen connector to the handler of their display.
+class DisplayHandlers {
  public:
   using ScreenConnector = cuttlefish::ScreenConnector<WebRtcScProcessedFrame>;
   using GenerateProcessedFrameCallback = ScreenConnector::GenerateProcessedFrameCallback;
 
-  DisplayHandler(std::shared_ptr<webrtc_streaming::VideoSink> display_sink,
-                 ScreenConnector& screen_connector);
-  ~DisplayHandler() = default;
+  // `display_sinks` has one sink per display, in display order.
+  DisplayHandlers(
+      std::vector<std::shared_ptr<webrtc_streaming::VideoSink>> display_sinks,
+      ScreenConnector& screen_connector,
+      std::shared_ptr<InputStats> input_stats,
+      std::shared_ptr<VideoStats> video_stats);
+  ~DisplayHandlers() = default;
 
   [[noreturn]] void Loop();
+  // Sends the last frame of every display.
   void SendLastFrame();
 
   void IncClientCount();
@@ -63,11 +133,9 @@ class DisplayHandler {
 
  private:
   GenerateProcessedFrameCallback GetScreenConnectorCallback();
-  std::shared_ptr<webrtc_streaming::VideoSink> display_sink_;
+  std::vector<std::unique_ptr<DisplayHandler>> handlers_;
   ScreenConnector& screen_connector_;
-  std::shared_ptr<webrtc_streaming::VideoFrameBuffer> last_buffer_;
-  std::mutex last_buffer_mutex_;
-  std::mutex next_frame_mutex_;
+  std::shared_ptr<InputStats> input_stats_;
   int client_count_ = 0;
 };
 }  // namespace cuttlefish
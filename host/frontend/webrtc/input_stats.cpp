@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/input_stats.h"
+
+#include "common/libs/utils/stats_file.h"
+
+namespace cuttlefish {
+
+void InputStats::OnEventsWritten(TimePoint received, size_t events,
+                                 size_t coalesced) {
+  processing_latency_.Record(std::chrono::steady_clock::now() - received);
+  batches_++;
+  events_ += events;
+  coalesced_ += coalesced;
+  int64_t received_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            received.time_since_epoch())
+                            .count();
+  // Only the oldest input waiting for a frame is measured.
+  int64_t none = 0;
+  pending_input_ns_.compare_exchange_strong(none, received_ns);
+}
+
+void InputStats::OnFrame() {
+  auto received_ns = pending_input_ns_.exchange(0);
+  if (received_ns == 0) {
+    return;
+  }
+  TimePoint received(std::chrono::nanoseconds{received_ns});
+  input_to_frame_latency_.Record(std::chrono::steady_clock::now() - received);
+}
+
+Json::Value InputStats::ToJson() const {
+  Json::Value stats;
+  stats["batches"] = Json::UInt64(batches_);
+  stats["events"] = Json::UInt64(events_);
+  stats["coalesced_events"] = Json::UInt64(coalesced_);
+  stats["processing_latency"] = HistogramToJson(processing_latency_);
+  stats["input_to_frame_latency"] = HistogramToJson(input_to_frame_latency_);
+  return stats;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include <json/json.h>
+
+#include "common/libs/utils/latency_histogram.h"
+
+namespace cuttlefish {
+
+// Input latency as seen from the host. The input to photon latency is
+// approximated by the time between the input events being received from a
+// client and the next frame from the guest being sent to the clients, which
+// is the earliest the effect of the input can be seen.
+class InputStats {
+ public:
+  using TimePoint = std::chrono::steady_clock::time_point;
+
+  // Called after writing a batch of input events to the input devices.
+  // received is when the first of them arrived from the client.
+  void OnEventsWritten(TimePoint received, size_t events, size_t coalesced);
+  // Called for every new frame from the guest.
+  void OnFrame();
+
+  Json::Value ToJson() const;
+
+ private:
+  // Arrival of the oldest input not followed by a frame yet, in steady clock
+  // nanoseconds, or 0.
+  std::atomic<int64_t> pending_input_ns_ = 0;
+  LatencyHistogram processing_latency_;
+  LatencyHistogram input_to_frame_latency_;
+  std::atomic<uint64_t> batches_ = 0;
+  std::atomic<uint64_t> events_ = 0;
+  // Touch move events merged into a later one from the same batch.
+  std::atomic<uint64_t> coalesced_ = 0;
+};
+
+}  // namespace cuttlefish
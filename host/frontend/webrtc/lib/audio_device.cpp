@@ -20,7 +20,9 @@
 
 #include <android-base/logging.h>
 
+#include <algorithm>
 #include <chrono>
+#include <limits>
 #include <thread>
 
 namespace cuttlefish {
@@ -49,6 +51,10 @@ int CfAudioDeviceModule::GetMoreAudioData(void* data, int bytes_per_sample,
   return read_samples / num_channels;
 }
 
+void CfAudioDeviceModule::SetPlayoutDelay(int delay_ms) {
+  playout_delay_ms_ = delay_ms;
+}
+
 // Retrieve the currently utilized audio layer
 int32_t CfAudioDeviceModule::ActiveAudioLayer(AudioLayer* audioLayer) const {
   return -1;
@@ -224,10 +230,8 @@ int32_t CfAudioDeviceModule::StereoRecording(bool* enabled) const {
 
 // Playout delay
 int32_t CfAudioDeviceModule::PlayoutDelay(uint16_t* delayMS) const {
-  // There is currently no way to estimate the real delay for thiese streams.
-  // Given that 10ms buffers are used almost everywhere in the pipeline we know
-  // the delay is at least 10ms, so that's the best guess here.
-  *delayMS = 10;
+  *delayMS = std::min<int>(playout_delay_ms_,
+                           std::numeric_limits<uint16_t>::max());
   return 0;
 }
 
@@ -35,6 +35,7 @@ class CfAudioDeviceModule : public webrtc::AudioDeviceModule,
   // playing (no clients or the streams are muted), -1 on error.
   int GetMoreAudioData(void* data, int bytes_per_samples, int samples_per_channel,
                        int num_channels, int sample_rate, bool& muted) override;
+  void SetPlayoutDelay(int delay_ms) override;
 
   // Retrieve the currently utilized audio layer
   int32_t ActiveAudioLayer(AudioLayer* audioLayer) const override;
@@ -139,6 +140,9 @@ class CfAudioDeviceModule : public webrtc::AudioDeviceModule,
   bool stereo_recording_enabled_ = true;
   std::atomic<bool> playing_ = false;
   std::atomic<bool> recording_ = false;
+  // Given that 10ms buffers are used almost everywhere in the pipeline the
+  // delay is at least 10ms, that's the best guess until one is reported.
+  std::atomic<int> playout_delay_ms_ = 10;
 };
 }  // namespace webrtc_streaming
 }  // namespace cuttlefish
@@ -31,6 +31,9 @@ class AudioSource {
   virtual int GetMoreAudioData(void* data, int bytes_per_sample,
                                int samples_per_channel, int num_channels,
                                int sample_rate, bool& muted) = 0;
+  // Reports how long audio returned by GetMoreAudioData takes to be consumed
+  // after it's returned.
+  virtual void SetPlayoutDelay(int delay_ms) = 0;
 
  protected:
   virtual ~AudioSource() = default;
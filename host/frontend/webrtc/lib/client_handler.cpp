@@ -27,6 +27,7 @@
 
 #include <android-base/logging.h>
 
+#include "host/frontend/webrtc/lib/input_protocol.h"
 #include "host/frontend/webrtc/lib/keyboard.h"
 #include "host/frontend/webrtc/lib/utils.h"
 #include "host/libs/config/cuttlefish_config.h"
@@ -112,8 +113,12 @@ class InputChannelHandler : public webrtc::DataChannelObserver {
   void OnMessage(const webrtc::DataBuffer &msg) override;
 
  private:
+  void HandleBinaryBatch(const webrtc::DataBuffer &msg);
+  void HandleJsonEvent(const webrtc::DataBuffer &msg);
+
   rtc::scoped_refptr<webrtc::DataChannelInterface> input_channel_;
   std::shared_ptr<ConnectionObserver> observer_;
+  std::unique_ptr<Json::CharReader> json_reader_;
 };
 
 class AdbChannelHandler : public webrtc::DataChannelObserver {
@@ -169,7 +174,9 @@ class BluetoothChannelHandler : public webrtc::DataChannelObserver {
 InputChannelHandler::InputChannelHandler(
     rtc::scoped_refptr<webrtc::DataChannelInterface> input_channel,
     std::shared_ptr<ConnectionObserver> observer)
-    : input_channel_(input_channel), observer_(observer) {
+    : input_channel_(input_channel),
+      observer_(observer),
+      json_reader_(Json::CharReaderBuilder().newCharReader()) {
   input_channel->RegisterObserver(this);
 }
 
@@ -185,18 +192,57 @@ void InputChannelHandler::OnStateChange() {
 
 void InputChannelHandler::OnMessage(const webrtc::DataBuffer &msg) {
   if (msg.binary) {
-    // TODO (jemoreira) consider binary protocol to avoid JSON parsing overhead
-    LOG(ERROR) << "Received invalid (binary) data on input channel";
+    HandleBinaryBatch(msg);
+  } else {
+    HandleJsonEvent(msg);
+  }
+  // Write everything received in this message to the input devices at once.
+  observer_->FlushInputEvents();
+}
+
+void InputChannelHandler::HandleBinaryBatch(const webrtc::DataBuffer &msg) {
+  auto batch = ParseInputBatch(msg.data.cdata(), msg.size());
+  if (!batch) {
+    LOG(ERROR) << "Received malformed binary input batch of " << msg.size()
+               << " bytes";
     return;
   }
+  const auto &label = batch->display_label;
+  for (const auto &event : batch->events) {
+    switch (event.type) {
+      case InputEventType::kMouse:
+        observer_->OnTouchEvent(label, event.x, event.y, event.down);
+        break;
+      case InputEventType::kMultiTouch: {
+        Json::Value id(Json::arrayValue);
+        Json::Value slot(Json::arrayValue);
+        Json::Value x(Json::arrayValue);
+        Json::Value y(Json::arrayValue);
+        for (const auto &touch : event.touches) {
+          id.append(touch.id);
+          slot.append(touch.slot);
+          x.append(touch.x);
+          y.append(touch.y);
+        }
+        observer_->OnMultiTouchEvent(label, id, slot, x, y, event.down,
+                                     event.touches.size());
+        break;
+      }
+      case InputEventType::kKeyboard:
+        observer_->OnKeyboardEvent(DomKeyCodeToLinux(event.key_code),
+                                   event.down);
+        break;
+    }
+  }
+}
+
+void InputChannelHandler::HandleJsonEvent(const webrtc::DataBuffer &msg) {
   auto size = msg.size();
 
   Json::Value evt;
-  Json::CharReaderBuilder builder;
-  std::unique_ptr<Json::CharReader> json_reader(builder.newCharReader());
   std::string errorMessage;
   auto str = msg.data.cdata<char>();
-  if (!json_reader->parse(str, str + size, &evt, &errorMessage) < 0) {
+  if (!json_reader_->parse(str, str + size, &evt, &errorMessage)) {
     LOG(ERROR) << "Received invalid JSON object over input channel: "
                << errorMessage;
     return;
@@ -424,7 +470,7 @@ bool ClientHandler::SetPeerConnection(
 
 bool ClientHandler::AddDisplay(
     rtc::scoped_refptr<webrtc::VideoTrackInterface> video_track,
-    const std::string &label) {
+    const std::string &label, int max_framerate) {
   // Send each track as part of a different stream with the label as id
   auto err_or_sender =
       peer_connection_->AddTrack(video_track, {label} /* stream_id */);
@@ -432,6 +478,23 @@ bool ClientHandler::AddDisplay(
     LOG(ERROR) << "Failed to add video track to the peer connection";
     return false;
   }
+  // Each client has its own encoder, which adapts to the bandwidth webrtc
+  // estimates for that client. Blurry text is worse than a lower frame rate
+  // on a device screen, so the encoder drops frames rather than resolution.
+  auto sender = err_or_sender.value();
+  auto parameters = sender->GetParameters();
+  parameters.degradation_preference =
+      webrtc::DegradationPreference::MAINTAIN_RESOLUTION;
+  if (max_framerate > 0) {
+    for (auto &encoding : parameters.encodings) {
+      encoding.max_framerate = max_framerate;
+    }
+  }
+  auto result = sender->SetParameters(parameters);
+  if (!result.ok()) {
+    LOG(WARNING) << "Failed to set the video encoding parameters: "
+                 << result.message();
+  }
   // TODO (b/154138394): use the returned sender (err_or_sender.value()) to
   // remove the display from the connection.
   return true;
@@ -50,8 +50,9 @@ class ClientHandler : public webrtc::PeerConnectionObserver,
   bool SetPeerConnection(
       rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection);
 
+  // A positive max_framerate caps the frame rate sent to this client.
   bool AddDisplay(rtc::scoped_refptr<webrtc::VideoTrackInterface> track,
-                  const std::string& label);
+                  const std::string& label, int max_framerate);
 
   bool AddAudio(rtc::scoped_refptr<webrtc::AudioTrackInterface> track,
                   const std::string& label);
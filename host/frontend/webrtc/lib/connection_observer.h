@@ -36,6 +36,9 @@ class ConnectionObserver {
                                  Json::Value x, Json::Value y, bool down, int size) = 0;
   virtual void OnKeyboardEvent(uint16_t keycode, bool down) = 0;
   virtual void OnSwitchEvent(uint16_t code, bool state) = 0;
+  // Input events may be buffered, possibly coalescing touch moves, until this
+  // is called at the end of each message from the input channel.
+  virtual void FlushInputEvents() = 0;
   virtual void OnAdbChannelOpen(
       std::function<bool(const uint8_t*, size_t)> adb_message_sender) = 0;
   virtual void OnAdbMessage(const uint8_t* msg, size_t size) = 0;
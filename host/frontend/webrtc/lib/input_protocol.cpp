@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/lib/input_protocol.h"
+
+#include <string.h>
+
+#include <android-base/logging.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+namespace {
+
+class Reader {
+ public:
+  Reader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+  bool ReadU8(uint8_t* value) {
+    if (size_ < 1) {
+      return false;
+    }
+    *value = data_[0];
+    Skip(1);
+    return true;
+  }
+
+  bool ReadU16(uint16_t* value) {
+    if (size_ < 2) {
+      return false;
+    }
+    *value = data_[0] | (data_[1] << 8);
+    Skip(2);
+    return true;
+  }
+
+  bool ReadI32(int32_t* value) {
+    if (size_ < 4) {
+      return false;
+    }
+    uint32_t bits = data_[0] | (data_[1] << 8) | (data_[2] << 16) |
+                    (static_cast<uint32_t>(data_[3]) << 24);
+    memcpy(value, &bits, sizeof(bits));
+    Skip(4);
+    return true;
+  }
+
+  bool ReadString(std::string* value) {
+    uint8_t length;
+    if (!ReadU8(&length) || size_ < length) {
+      return false;
+    }
+    value->assign(reinterpret_cast<const char*>(data_), length);
+    Skip(length);
+    return true;
+  }
+
+  size_t remaining() const { return size_; }
+
+ private:
+  void Skip(size_t count) {
+    data_ += count;
+    size_ -= count;
+  }
+
+  const uint8_t* data_;
+  size_t size_;
+};
+
+bool ReadEvent(Reader& reader, InputEvent* event) {
+  uint8_t type;
+  uint8_t down;
+  if (!reader.ReadU8(&type) || !reader.ReadU8(&down) || down > 1) {
+    return false;
+  }
+  event->type = static_cast<InputEventType>(type);
+  event->down = down;
+  switch (event->type) {
+    case InputEventType::kMouse:
+      return reader.ReadI32(&event->x) && reader.ReadI32(&event->y);
+    case InputEventType::kMultiTouch: {
+      uint8_t count;
+      if (!reader.ReadU8(&count)) {
+        return false;
+      }
+      event->touches.resize(count);
+      for (auto& touch : event->touches) {
+        if (!reader.ReadI32(&touch.id) || !reader.ReadI32(&touch.slot) ||
+            !reader.ReadI32(&touch.x) || !reader.ReadI32(&touch.y)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    case InputEventType::kKeyboard:
+      return reader.ReadString(&event->key_code);
+  }
+  LOG(ERROR) << "Unknown input event type: " << (int)type;
+  return false;
+}
+
+}  // namespace
+
+std::optional<InputBatch> ParseInputBatch(const uint8_t* data, size_t size) {
+  Reader reader(data, size);
+  uint8_t version;
+  if (!reader.ReadU8(&version)) {
+    return {};
+  }
+  if (version != kBinaryInputProtocolVersion) {
+    LOG(ERROR) << "Unsupported input protocol version: " << (int)version;
+    return {};
+  }
+  InputBatch batch;
+  uint16_t count;
+  // Every event takes at least two bytes, don't allocate for more events than
+  // the message could hold.
+  if (!reader.ReadString(&batch.display_label) || !reader.ReadU16(&count) ||
+      count > reader.remaining() / 2) {
+    return {};
+  }
+  batch.events.resize(count);
+  for (auto& event : batch.events) {
+    if (!ReadEvent(reader, &event)) {
+      return {};
+    }
+  }
+  if (reader.remaining() > 0) {
+    return {};
+  }
+  return batch;
+}
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+// Binary framing for the input data channel, used instead of one JSON object
+// per event by clients that find kBinaryInputProtocol in the device info.
+// Each binary message carries a batch of events for one display: the pointer
+// motion the client collected over a few milliseconds, ending with at most one
+// press, release or key event, which clients send right away. All integers
+// are little endian.
+//
+//   batch:       u8 version (kBinaryInputProtocolVersion)
+//                u8 label_length, label_length bytes of display label
+//                u16 event_count, event_count events
+//   event:       u8 type (InputEventType), u8 down (0 or 1), payload
+//   mouse:       i32 x, i32 y
+//   multi-touch: u8 count, count times (i32 id, i32 slot, i32 x, i32 y)
+//   keyboard:    u8 code_length, code_length bytes of DOM key code
+constexpr auto kBinaryInputProtocol = "cf-input-v1";
+constexpr uint8_t kBinaryInputProtocolVersion = 1;
+
+enum class InputEventType : uint8_t {
+  kMouse = 1,
+  kMultiTouch = 2,
+  kKeyboard = 3,
+};
+
+struct TouchPoint {
+  int32_t id;
+  int32_t slot;
+  int32_t x;
+  int32_t y;
+};
+
+struct InputEvent {
+  InputEventType type;
+  bool down;
+  // kMouse
+  int32_t x = 0;
+  int32_t y = 0;
+  // kMultiTouch
+  std::vector<TouchPoint> touches;
+  // kKeyboard
+  std::string key_code;
+};
+
+struct InputBatch {
+  std::string display_label;
+  std::vector<InputEvent> events;
+};
+
+// Returns nothing if the message is truncated, has trailing bytes or contains
+// unknown event types. No event of a malformed batch should be delivered.
+std::optional<InputBatch> ParseInputBatch(const uint8_t* data, size_t size);
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/lib/input_protocol.h"
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+namespace {
+
+// Builds messages the way cf_webrtc.js encodes them.
+class BatchWriter {
+ public:
+  BatchWriter(const std::string& label, uint16_t count) {
+    U8(kBinaryInputProtocolVersion);
+    String(label);
+    U16(count);
+  }
+
+  BatchWriter& Mouse(bool down, int32_t x, int32_t y) {
+    Header(InputEventType::kMouse, down);
+    I32(x);
+    I32(y);
+    return *this;
+  }
+
+  BatchWriter& Touch(bool down, const std::vector<TouchPoint>& touches) {
+    Header(InputEventType::kMultiTouch, down);
+    U8(touches.size());
+    for (const auto& touch : touches) {
+      I32(touch.id);
+      I32(touch.slot);
+      I32(touch.x);
+      I32(touch.y);
+    }
+    return *this;
+  }
+
+  BatchWriter& Key(bool down, const std::string& code) {
+    Header(InputEventType::kKeyboard, down);
+    String(code);
+    return *this;
+  }
+
+  BatchWriter& U8(uint8_t value) {
+    bytes_.push_back(value);
+    return *this;
+  }
+
+  std::optional<InputBatch> Parse() const {
+    return ParseInputBatch(bytes_.data(), bytes_.size());
+  }
+
+  std::vector<uint8_t>& bytes() { return bytes_; }
+
+ private:
+  void Header(InputEventType type, bool down) {
+    U8(static_cast<uint8_t>(type));
+    U8(down);
+  }
+
+  void U16(uint16_t value) {
+    U8(value & 0xff);
+    U8(value >> 8);
+  }
+
+  void I32(int32_t value) {
+    auto bits = static_cast<uint32_t>(value);
+    for (int shift = 0; shift < 32; shift += 8) {
+      U8(bits >> shift);
+    }
+  }
+
+  void String(const std::string& value) {
+    U8(value.size());
+    bytes_.insert(bytes_.end(), value.begin(), value.end());
+  }
+
+  std::vector<uint8_t> bytes_;
+};
+
+TEST(InputProtocolTest, ParsesEveryEventType) {
+  auto batch = BatchWriter("display_0", 3)
+                   .Mouse(true, 100, -5)
+                   .Touch(false, {{7, 0, 10, 20}, {-1, 1, 0x12345678, 0}})
+                   .Key(true, "KeyA")
+                   .Parse();
+  ASSERT_TRUE(batch);
+  EXPECT_EQ(batch->display_label, "display_0");
+  ASSERT_EQ(batch->events.size(), 3);
+
+  const auto& mouse = batch->events[0];
+  EXPECT_EQ(mouse.type, InputEventType::kMouse);
+  EXPECT_TRUE(mouse.down);
+  EXPECT_EQ(mouse.x, 100);
+  EXPECT_EQ(mouse.y, -5);
+
+  const auto& touch = batch->events[1];
+  EXPECT_EQ(touch.type, InputEventType::kMultiTouch);
+  EXPECT_FALSE(touch.down);
+  ASSERT_EQ(touch.touches.size(), 2);
+  EXPECT_EQ(touch.touches[0].id, 7);
+  EXPECT_EQ(touch.touches[0].slot, 0);
+  EXPECT_EQ(touch.touches[0].x, 10);
+  EXPECT_EQ(touch.touches[0].y, 20);
+  EXPECT_EQ(touch.touches[1].id, -1);
+  EXPECT_EQ(touch.touches[1].slot, 1);
+  EXPECT_EQ(touch.touches[1].x, 0x12345678);
+
+  const auto& key = batch->events[2];
+  EXPECT_EQ(key.type, InputEventType::kKeyboard);
+  EXPECT_TRUE(key.down);
+  EXPECT_EQ(key.key_code, "KeyA");
+}
+
+TEST(InputProtocolTest, AcceptsEmptyBatch) {
+  auto batch = BatchWriter("", 0).Parse();
+  ASSERT_TRUE(batch);
+  EXPECT_EQ(batch->display_label, "");
+  EXPECT_TRUE(batch->events.empty());
+}
+
+TEST(InputProtocolTest, RejectsEveryTruncation) {
+  auto writer = BatchWriter("display_0", 2)
+                    .Touch(true, {{1, 0, 5, 6}})
+                    .Key(false, "Enter");
+  const auto& bytes = writer.bytes();
+  ASSERT_TRUE(writer.Parse());
+  for (size_t size = 0; size < bytes.size(); size++) {
+    EXPECT_FALSE(ParseInputBatch(bytes.data(), size)) << "size " << size;
+  }
+}
+
+TEST(InputProtocolTest, RejectsTrailingBytes) {
+  auto writer = BatchWriter("display_0", 1).Mouse(false, 1, 2);
+  writer.U8(0);
+  EXPECT_FALSE(writer.Parse());
+}
+
+TEST(InputProtocolTest, RejectsWrongVersion) {
+  auto writer = BatchWriter("display_0", 1).Mouse(false, 1, 2);
+  writer.bytes()[0] = kBinaryInputProtocolVersion + 1;
+  EXPECT_FALSE(writer.Parse());
+}
+
+TEST(InputProtocolTest, RejectsUnknownEventType) {
+  auto writer = BatchWriter("display_0", 1).U8(4).U8(1);
+  EXPECT_FALSE(writer.Parse());
+}
+
+TEST(InputProtocolTest, RejectsInvalidDownFlag) {
+  auto writer = BatchWriter("display_0", 1).Mouse(false, 1, 2);
+  // The down byte follows the version, the label and the count.
+  writer.bytes()[1 + 1 + 9 + 2 + 1] = 2;
+  EXPECT_FALSE(writer.Parse());
+}
+
+TEST(InputProtocolTest, RejectsCountLargerThanMessage) {
+  // Claims 0xffff events but holds one, the parser must not trust the count.
+  auto writer = BatchWriter("", 0xffff).Mouse(true, 0, 0);
+  EXPECT_FALSE(writer.Parse());
+}
+
+TEST(InputProtocolTest, RejectsMalformedEventAfterValidOnes) {
+  // No event of a malformed batch is delivered.
+  auto writer = BatchWriter("display_0", 2).Key(true, "KeyA").U8(9).U8(0);
+  EXPECT_FALSE(writer.Parse());
+}
+
+}  // namespace
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
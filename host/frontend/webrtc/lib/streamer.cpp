@@ -35,6 +35,7 @@
 #include "host/frontend/webrtc/lib/audio_device.h"
 #include "host/frontend/webrtc/lib/audio_track_source_impl.h"
 #include "host/frontend/webrtc/lib/client_handler.h"
+#include "host/frontend/webrtc/lib/input_protocol.h"
 #include "host/frontend/webrtc/lib/port_range_socket_factory.h"
 #include "host/frontend/webrtc/lib/video_track_source_impl.h"
 #include "host/frontend/webrtc/lib/vp8only_encoder_factory.h"
@@ -60,6 +61,7 @@ constexpr auto kControlPanelButtonDeviceStates = "device_states";
 constexpr auto kControlPanelButtonLidSwitchOpen = "lid_switch_open";
 constexpr auto kControlPanelButtonHingeAngleValue = "hinge_angle_value";
 constexpr auto kCustomControlPanelButtonsField = "custom_control_panel_buttons";
+constexpr auto kInputProtocolsField = "input_protocols";
 
 void SendJson(WsConnection* ws_conn, const Json::Value& data) {
   Json::StreamWriterBuilder factory;
@@ -124,6 +126,9 @@ class AudioDeviceModuleWrapper : public AudioSource {
                                             samples_per_channel, num_channels,
                                             sample_rate, muted);
   }
+  void SetPlayoutDelay(int delay_ms) override {
+    device_module_->SetPlayoutDelay(delay_ms);
+  }
 
   rtc::scoped_refptr<CfAudioDeviceModule> device_module() {
     return device_module_;
@@ -204,7 +209,7 @@ std::unique_ptr<Streamer> Streamer::Create(
       webrtc::CreateBuiltinAudioEncoderFactory(),
       webrtc::CreateBuiltinAudioDecoderFactory(),
       std::make_unique<VP8OnlyEncoderFactory>(
-          webrtc::CreateBuiltinVideoEncoderFactory()),
+          webrtc::CreateBuiltinVideoEncoderFactory(), cfg.encode_observer),
       webrtc::CreateBuiltinVideoDecoderFactory(), nullptr /* audio_mixer */,
       nullptr /* audio_processing */);
 
@@ -400,6 +405,11 @@ void Streamer::Impl::OnOpen() {
       custom_control_panel_buttons.append(button_entry);
     }
     device_info[kCustomControlPanelButtonsField] = custom_control_panel_buttons;
+    // Clients that don't know the binary protocol keep sending JSON.
+    Json::Value input_protocols(Json::arrayValue);
+    input_protocols.append("json");
+    input_protocols.append(kBinaryInputProtocol);
+    device_info[kInputProtocolsField] = input_protocols;
     register_obj[cuttlefish::webrtc_signaling::kDeviceInfoField] = device_info;
     SendJson(server_connection_.get(), register_obj);
     // Do this last as OnRegistered() is user code and may take some time to
@@ -596,7 +606,12 @@ std::shared_ptr<ClientHandler> Streamer::Impl::CreateClientHandler(
 
     auto video_track =
         peer_connection_factory_->CreateVideoTrack(label, video_source.get());
-    client_handler->AddDisplay(video_track, label);
+    // Screen content: the encoders favor detail over motion and skip the
+    // parts of the screen that don't change.
+    video_track->set_content_hint(
+        webrtc::VideoTrackInterface::ContentHint::kDetailed);
+    client_handler->AddDisplay(video_track, label,
+                               config_.max_video_framerate);
   }
 
   for (auto& entry : audio_sources_) {
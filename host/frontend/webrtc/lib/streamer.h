@@ -30,6 +30,7 @@
 #include "host/frontend/webrtc/lib/audio_source.h"
 #include "host/frontend/webrtc/lib/connection_observer.h"
 #include "host/frontend/webrtc/lib/local_recorder.h"
+#include "host/frontend/webrtc/lib/video_encode_observer.h"
 #include "host/frontend/webrtc/lib/video_sink.h"
 #include "host/frontend/webrtc/lib/ws_connection.h"
 
@@ -57,6 +58,10 @@ struct StreamerConfig {
   // [0,0] means all ports
   std::pair<uint16_t, uint16_t> udp_port_range = {15550, 15558};
   std::pair<uint16_t, uint16_t> tcp_port_range = {15550, 15558};
+  // The highest frame rate sent to a client, 0 for no limit.
+  int max_video_framerate = 0;
+  // Told about every encoded video frame, optional.
+  std::shared_ptr<VideoEncodeObserver> encode_observer;
 };
 
 class OperatorObserver {
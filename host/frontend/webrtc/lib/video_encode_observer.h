@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+// Notified by the video encoders, which run on webrtc threads, of the frames
+// they encode. There is an encoder per client and display, so the same frame
+// can be reported several times.
+class VideoEncodeObserver {
+ public:
+  virtual ~VideoEncodeObserver() = default;
+  // timestamp_us is the one the frame was given to the VideoSink with.
+  virtual void OnFrameEncoded(
+      int64_t timestamp_us,
+      std::chrono::steady_clock::duration encode_time) = 0;
+};
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
@@ -16,11 +16,132 @@
 
 #include "host/frontend/webrtc/lib/vp8only_encoder_factory.h"
 
+#include <chrono>
+#include <deque>
+#include <mutex>
+
 namespace cuttlefish {
 namespace webrtc_streaming {
+
+namespace {
+
+// Forwards everything to the real encoder, timing the frames on their way.
+class ObservedVideoEncoder : public webrtc::VideoEncoder,
+                             public webrtc::EncodedImageCallback {
+ public:
+  ObservedVideoEncoder(std::unique_ptr<webrtc::VideoEncoder> inner,
+                       std::shared_ptr<VideoEncodeObserver> observer)
+      : inner_(std::move(inner)), observer_(observer) {}
+
+  // From VideoEncoder
+  void SetFecControllerOverride(
+      webrtc::FecControllerOverride* fec_controller_override) override {
+    inner_->SetFecControllerOverride(fec_controller_override);
+  }
+  int InitEncode(const webrtc::VideoCodec* codec_settings,
+                 const Settings& settings) override {
+    return inner_->InitEncode(codec_settings, settings);
+  }
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      callback_ = callback;
+    }
+    return inner_->RegisterEncodeCompleteCallback(callback ? this : nullptr);
+  }
+  int32_t Release() override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      in_flight_.clear();
+    }
+    return inner_->Release();
+  }
+  int32_t Encode(
+      const webrtc::VideoFrame& frame,
+      const std::vector<webrtc::VideoFrameType>* frame_types) override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      // Frames the encoder drops never come back, don't let them pile up.
+      if (in_flight_.size() >= kMaxInFlight) {
+        in_flight_.pop_front();
+      }
+      in_flight_.push_back(InFlightFrame{
+          .rtp_timestamp = frame.timestamp(),
+          .timestamp_us = frame.timestamp_us(),
+          .encode_start = std::chrono::steady_clock::now(),
+      });
+    }
+    return inner_->Encode(frame, frame_types);
+  }
+  void SetRates(const RateControlParameters& parameters) override {
+    inner_->SetRates(parameters);
+  }
+  void OnPacketLossRateUpdate(float packet_loss_rate) override {
+    inner_->OnPacketLossRateUpdate(packet_loss_rate);
+  }
+  void OnRttUpdate(int64_t rtt_ms) override { inner_->OnRttUpdate(rtt_ms); }
+  void OnLossNotification(const LossNotification& loss_notification) override {
+    inner_->OnLossNotification(loss_notification);
+  }
+  EncoderInfo GetEncoderInfo() const override {
+    return inner_->GetEncoderInfo();
+  }
+
+  // From EncodedImageCallback
+  Result OnEncodedImage(
+      const webrtc::EncodedImage& encoded_image,
+      const webrtc::CodecSpecificInfo* codec_specific_info) override {
+    webrtc::EncodedImageCallback* callback;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      callback = callback_;
+      // Frames before this one were dropped, the layers of a frame after
+      // the first one find nothing.
+      while (!in_flight_.empty() &&
+             in_flight_.front().rtp_timestamp != encoded_image.Timestamp()) {
+        in_flight_.pop_front();
+      }
+      if (!in_flight_.empty()) {
+        auto& frame = in_flight_.front();
+        observer_->OnFrameEncoded(
+            frame.timestamp_us,
+            std::chrono::steady_clock::now() - frame.encode_start);
+        in_flight_.pop_front();
+      }
+    }
+    return callback->OnEncodedImage(encoded_image, codec_specific_info);
+  }
+  void OnDroppedFrame(DropReason reason) override {
+    webrtc::EncodedImageCallback* callback;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      callback = callback_;
+    }
+    callback->OnDroppedFrame(reason);
+  }
+
+ private:
+  struct InFlightFrame {
+    uint32_t rtp_timestamp;
+    int64_t timestamp_us;
+    std::chrono::steady_clock::time_point encode_start;
+  };
+  static constexpr size_t kMaxInFlight = 16;
+
+  std::unique_ptr<webrtc::VideoEncoder> inner_;
+  std::shared_ptr<VideoEncodeObserver> observer_;
+  std::mutex mutex_;
+  webrtc::EncodedImageCallback* callback_ = nullptr;
+  std::deque<InFlightFrame> in_flight_;
+};
+
+}  // namespace
+
 VP8OnlyEncoderFactory::VP8OnlyEncoderFactory(
-    std::unique_ptr<webrtc::VideoEncoderFactory> inner)
-    : inner_(std::move(inner)) {}
+    std::unique_ptr<webrtc::VideoEncoderFactory> inner,
+    std::shared_ptr<VideoEncodeObserver> observer)
+    : inner_(std::move(inner)), observer_(observer) {}
 
 std::vector<webrtc::SdpVideoFormat> VP8OnlyEncoderFactory::GetSupportedFormats()
     const {
@@ -41,7 +162,11 @@ webrtc::VideoEncoderFactory::CodecInfo VP8OnlyEncoderFactory::QueryVideoEncoder(
 
 std::unique_ptr<webrtc::VideoEncoder> VP8OnlyEncoderFactory::CreateVideoEncoder(
     const webrtc::SdpVideoFormat& format) {
-  return inner_->CreateVideoEncoder(format);
+  auto encoder = inner_->CreateVideoEncoder(format);
+  if (!encoder || !observer_) {
+    return encoder;
+  }
+  return std::make_unique<ObservedVideoEncoder>(std::move(encoder), observer_);
 }
 
 std::unique_ptr<webrtc::VideoEncoderFactory::EncoderSelectorInterface>
@@ -19,12 +19,18 @@
 #include <api/video_codecs/video_encoder_factory.h>
 #include <api/video_codecs/video_encoder.h>
 
+#include <memory>
+
+#include "host/frontend/webrtc/lib/video_encode_observer.h"
+
 namespace cuttlefish {
 namespace webrtc_streaming {
 
 class VP8OnlyEncoderFactory : public webrtc::VideoEncoderFactory {
  public:
-  VP8OnlyEncoderFactory(std::unique_ptr<webrtc::VideoEncoderFactory> inner);
+  // The encoders report their frames to the observer, if there is one.
+  VP8OnlyEncoderFactory(std::unique_ptr<webrtc::VideoEncoderFactory> inner,
+                        std::shared_ptr<VideoEncodeObserver> observer);
 
   std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
 
@@ -38,6 +44,7 @@ class VP8OnlyEncoderFactory : public webrtc::VideoEncoderFactory {
 
  private:
   std::unique_ptr<webrtc::VideoEncoderFactory> inner_;
+  std::shared_ptr<VideoEncodeObserver> observer_;
 };
 
 }  // namespace webrtc_streaming
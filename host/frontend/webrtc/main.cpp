@@ -16,8 +16,10 @@
 
 #include <linux/input.h>
 
+#include <chrono>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -29,12 +31,14 @@
 #include "common/libs/fs/shared_buf.h"
 #include "common/libs/fs/shared_fd.h"
 #include "common/libs/utils/files.h"
+#include "common/libs/utils/stats_file.h"
 #include "host/frontend/webrtc/audio_handler.h"
 #include "host/frontend/webrtc/connection_observer.h"
 #include "host/frontend/webrtc/display_handler.h"
 #include "host/frontend/webrtc/kernel_log_events_handler.h"
 #include "host/frontend/webrtc/lib/local_recorder.h"
 #include "host/frontend/webrtc/lib/streamer.h"
+#include "host/frontend/webrtc/video_stats.h"
 #include "host/libs/audio_connector/server.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/config/logging.h"
@@ -55,10 +59,16 @@ DEFINE_string(action_servers, "",
 DEFINE_bool(write_virtio_input, true,
             "Whether to send input events in virtio format.");
 DEFINE_int32(audio_server_fd, -1, "An fd to listen on for audio frames");
+DEFINE_string(audio_stats_file, "",
+              "Where to periodically write audio latency and buffer stats.");
+DEFINE_string(input_stats_file, "",
+              "Where to periodically write input event and latency stats.");
+DEFINE_string(video_stats_file, "",
+              "Where to periodically write video frame latency stats.");
 
 using cuttlefish::AudioHandler;
 using cuttlefish::CfConnectionObserverFactory;
-using cuttlefish::DisplayHandler;
+using cuttlefish::DisplayHandlers;
 using cuttlefish::KernelLogEventsHandler;
 using cuttlefish::webrtc_streaming::LocalRecorder;
 using cuttlefish::webrtc_streaming::Streamer;
@@ -178,8 +188,9 @@ int main(int argc, char** argv) {
   auto cvd_config = cuttlefish::CuttlefishConfig::Get();
   auto instance = cvd_config->ForDefaultInstance();
   auto& host_mode_ctrl = cuttlefish::HostModeCtrl::Get();
-  auto screen_connector_ptr = cuttlefish::DisplayHandler::ScreenConnector::Get(
-      FLAGS_frame_server_fd, host_mode_ctrl);
+  auto screen_connector_ptr = cuttlefish::DisplayHandlers::ScreenConnector::Get(
+      FLAGS_frame_server_fd, host_mode_ctrl,
+      cuttlefish::kWebRtcFrameRingSocketName);
   auto& screen_connector = *(screen_connector_ptr.get());
 
   // create confirmation UI service, giving host_mode_ctrl and
@@ -206,18 +217,29 @@ int main(int argc, char** argv) {
         ParseHttpHeaders(cvd_config->sig_server_headers_path());
   }
 
+  auto video_stats = std::make_shared<cuttlefish::VideoStats>();
+  streamer_config.encode_observer = video_stats;
+  streamer_config.max_video_framerate = cvd_config->refresh_rate_hz();
+
   KernelLogEventsHandler kernel_logs_event_handler(kernel_log_events_client);
+  auto input_stats = std::make_shared<cuttlefish::InputStats>();
   auto observer_factory = std::make_shared<CfConnectionObserverFactory>(
-      input_sockets, &kernel_logs_event_handler, host_confui_server);
+      input_sockets, &kernel_logs_event_handler, host_confui_server,
+      input_stats);
 
   auto streamer = Streamer::Create(streamer_config, observer_factory);
   CHECK(streamer) << "Could not create streamer";
 
-  auto display_0 = streamer->AddDisplay(
-      "display_0", screen_connector.ScreenWidth(0),
-      screen_connector.ScreenHeight(0), cvd_config->dpi(), true);
-  auto display_handler = std::shared_ptr<DisplayHandler>(
-      new DisplayHandler(display_0, screen_connector));
+  std::vector<std::shared_ptr<cuttlefish::webrtc_streaming::VideoSink>>
+      displays;
+  for (std::uint32_t i = 0; i < screen_connector.ScreenCount(); i++) {
+    displays.push_back(streamer->AddDisplay(
+        "display_" + std::to_string(i), screen_connector.ScreenWidth(i),
+        screen_connector.ScreenHeight(i), cvd_config->dpi(), true));
+  }
+  auto display_handler = std::shared_ptr<DisplayHandlers>(
+      new DisplayHandlers(displays, screen_connector, input_stats,
+                          video_stats));
 
   std::unique_ptr<cuttlefish::webrtc_streaming::LocalRecorder> local_recorder;
   if (cvd_config->record_screen()) {
@@ -350,8 +372,21 @@ int main(int argc, char** argv) {
     LOG(DEBUG) << "control socket closed";
   });
 
+  cuttlefish::StatsFileWriter stats_writer(std::chrono::seconds(10));
   if (audio_handler) {
     audio_handler->Start();
+    if (!FLAGS_audio_stats_file.empty()) {
+      stats_writer.AddFile(FLAGS_audio_stats_file,
+                           [audio_handler]() { return audio_handler->Stats(); });
+    }
+  }
+  if (!FLAGS_input_stats_file.empty()) {
+    stats_writer.AddFile(FLAGS_input_stats_file,
+                         [input_stats]() { return input_stats->ToJson(); });
+  }
+  if (!FLAGS_video_stats_file.empty()) {
+    stats_writer.AddFile(FLAGS_video_stats_file,
+                         [video_stats]() { return video_stats->ToJson(); });
   }
   host_confui_server.Start();
   display_handler->Loop();
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/video_stats.h"
+
+#include "common/libs/utils/stats_file.h"
+
+namespace cuttlefish {
+
+int64_t VideoStats::ToTimestampUs(TimePoint time_point) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             time_point.time_since_epoch())
+      .count();
+}
+
+void VideoStats::OnFrameConverted(TimePoint capture_time,
+                                  TimePoint convert_time) {
+  frames_++;
+  commit_to_convert_.Record(convert_time - capture_time);
+}
+
+void VideoStats::OnFrameSent(TimePoint convert_time) {
+  convert_to_send_.Record(std::chrono::steady_clock::now() - convert_time);
+}
+
+void VideoStats::OnFrameResent() { resent_frames_++; }
+
+void VideoStats::OnFrameUnchanged() { unchanged_frames_++; }
+
+void VideoStats::OnFrameEncoded(
+    int64_t timestamp_us, std::chrono::steady_clock::duration encode_time) {
+  encode_.Record(encode_time);
+  TimePoint capture_time{std::chrono::microseconds(timestamp_us)};
+  commit_to_encoded_.Record(std::chrono::steady_clock::now() - capture_time);
+}
+
+Json::Value VideoStats::ToJson() const {
+  Json::Value stats;
+  stats["frames"] = Json::UInt64(frames_);
+  stats["resent_frames"] = Json::UInt64(resent_frames_);
+  stats["unchanged_frames"] = Json::UInt64(unchanged_frames_);
+  stats["commit_to_convert_latency"] = HistogramToJson(commit_to_convert_);
+  stats["convert_to_send_latency"] = HistogramToJson(convert_to_send_);
+  stats["encode_latency"] = HistogramToJson(encode_);
+  stats["commit_to_encoded_latency"] = HistogramToJson(commit_to_encoded_);
+  return stats;
+}
+
+}  // namespace cuttlefish
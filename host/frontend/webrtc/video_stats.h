@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include <json/json.h>
+
+#include "common/libs/utils/latency_histogram.h"
+#include "host/frontend/webrtc/lib/video_encode_observer.h"
+
+namespace cuttlefish {
+
+// Latency of the guest frames through the stages of the host side of the
+// streaming pipeline, measured from when the guest committed them:
+//   commit -> converted to I420 -> sent to webrtc -> encoded
+class VideoStats : public webrtc_streaming::VideoEncodeObserver {
+ public:
+  using TimePoint = std::chrono::steady_clock::time_point;
+
+  // The frame timestamps given to webrtc, in microseconds of the monotonic
+  // clock webrtc also uses.
+  static int64_t ToTimestampUs(TimePoint time_point);
+
+  void OnFrameConverted(TimePoint capture_time, TimePoint convert_time);
+  void OnFrameSent(TimePoint convert_time);
+  // A frame sent again, e.g. to a new client or while the screen doesn't
+  // change, its latency isn't measured.
+  void OnFrameResent();
+  // A frame identical to the previous one, which isn't sent.
+  void OnFrameUnchanged();
+
+  void OnFrameEncoded(int64_t timestamp_us,
+                      std::chrono::steady_clock::duration encode_time) override;
+
+  Json::Value ToJson() const;
+
+ private:
+  LatencyHistogram commit_to_convert_;
+  LatencyHistogram convert_to_send_;
+  LatencyHistogram encode_;
+  LatencyHistogram commit_to_encoded_;
+  std::atomic<uint64_t> frames_ = 0;
+  std::atomic<uint64_t> resent_frames_ = 0;
+  std::atomic<uint64_t> unchanged_frames_ = 0;
+};
+
+}  // namespace cuttlefish
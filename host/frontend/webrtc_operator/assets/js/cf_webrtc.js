@@ -81,6 +81,66 @@ function awaitDataChannel(pc, label, onMessage) {
   };
 }
 
+// Binary input protocol, see host/frontend/webrtc/lib/input_protocol.h
+const BINARY_INPUT_PROTOCOL = 'cf-input-v1';
+const BINARY_INPUT_PROTOCOL_VERSION = 1;
+const INPUT_EVENT_MOUSE = 1;
+const INPUT_EVENT_MULTI_TOUCH = 2;
+const INPUT_EVENT_KEYBOARD = 3;
+// How long pointer motion is collected before it's sent.
+const INPUT_MOTION_BATCH_MS = 8;
+
+function encodeInputBatch(display_label, events) {
+  let encoder = new TextEncoder();
+  let label = encoder.encode(display_label);
+  let codes = events.map(
+      evt => evt.type == INPUT_EVENT_KEYBOARD ? encoder.encode(evt.code) : null);
+  let size = 2 + label.length + 2;
+  events.forEach((evt, i) => {
+    size += 2;
+    if (evt.type == INPUT_EVENT_MOUSE) {
+      size += 8;
+    } else if (evt.type == INPUT_EVENT_MULTI_TOUCH) {
+      size += 1 + 16 * evt.touches.length;
+    } else {
+      size += 1 + codes[i].length;
+    }
+  });
+  let buffer = new ArrayBuffer(size);
+  let view = new DataView(buffer);
+  let bytes = new Uint8Array(buffer);
+  let pos = 0;
+  view.setUint8(pos++, BINARY_INPUT_PROTOCOL_VERSION);
+  view.setUint8(pos++, label.length);
+  bytes.set(label, pos);
+  pos += label.length;
+  view.setUint16(pos, events.length, true);
+  pos += 2;
+  events.forEach((evt, i) => {
+    view.setUint8(pos++, evt.type);
+    view.setUint8(pos++, evt.down ? 1 : 0);
+    if (evt.type == INPUT_EVENT_MOUSE) {
+      view.setInt32(pos, evt.x, true);
+      view.setInt32(pos + 4, evt.y, true);
+      pos += 8;
+    } else if (evt.type == INPUT_EVENT_MULTI_TOUCH) {
+      view.setUint8(pos++, evt.touches.length);
+      for (const touch of evt.touches) {
+        view.setInt32(pos, touch.id, true);
+        view.setInt32(pos + 4, touch.slot, true);
+        view.setInt32(pos + 8, touch.x, true);
+        view.setInt32(pos + 12, touch.y, true);
+        pos += 16;
+      }
+    } else {
+      view.setUint8(pos++, codes[i].length);
+      bytes.set(codes[i], pos);
+      pos += codes[i].length;
+    }
+  });
+  return buffer;
+}
+
 class DeviceConnection {
   constructor(pc, control, audio_stream) {
     this._pc = pc;
@@ -112,6 +172,12 @@ class DeviceConnection {
     });
     this._streams = {};
     this._streamPromiseResolvers = {};
+    this._binaryInput = false;
+    this._inputQueue = [];
+    this._inputFlushTimer = null;
+    // Per display label, whether the mouse is down and which touch slots are.
+    this._mouseDown = {};
+    this._touchSlotsDown = {};
 
     pc.addEventListener('track', e => {
       console.log('Got remote stream: ', e);
@@ -129,6 +195,8 @@ class DeviceConnection {
 
   set description(desc) {
     this._description = desc;
+    this._binaryInput =
+        (desc.input_protocols || []).includes(BINARY_INPUT_PROTOCOL);
   }
 
   get description() {
@@ -152,7 +220,72 @@ class DeviceConnection {
     this._inputChannel.send(JSON.stringify(evt));
   }
 
+  // Whether the event only moves pointers that are already down. Presses,
+  // releases and key events are transitions.
+  _isMotion(display_label, evt) {
+    if (evt.type == INPUT_EVENT_MOUSE) {
+      let motion = evt.down && this._mouseDown[display_label];
+      this._mouseDown[display_label] = evt.down;
+      return motion;
+    }
+    if (evt.type == INPUT_EVENT_MULTI_TOUCH) {
+      let slots = this._touchSlotsDown[display_label] || new Set();
+      this._touchSlotsDown[display_label] = slots;
+      let motion = evt.down && evt.touches.every(t => slots.has(t.slot));
+      for (const touch of evt.touches) {
+        if (evt.down) {
+          slots.add(touch.slot);
+        } else {
+          slots.delete(touch.slot);
+        }
+      }
+      return motion;
+    }
+    return false;
+  }
+
+  // When the device understands the binary protocol, pointer motion is
+  // collected for a few milliseconds and sent together. Transitions are sent
+  // right away, after any motion queued before them.
+  _queueBinaryInput(display_label, evt) {
+    this._inputQueue.push({display_label, evt});
+    if (!this._isMotion(display_label, evt)) {
+      this._flushBinaryInput();
+    } else if (this._inputFlushTimer === null) {
+      this._inputFlushTimer = setTimeout(
+          () => this._flushBinaryInput(), INPUT_MOTION_BATCH_MS);
+    }
+  }
+
+  _flushBinaryInput() {
+    if (this._inputFlushTimer !== null) {
+      clearTimeout(this._inputFlushTimer);
+      this._inputFlushTimer = null;
+    }
+    let queue = this._inputQueue;
+    this._inputQueue = [];
+    // One batch per run of events for the same display.
+    let start = 0;
+    while (start < queue.length) {
+      let end = start + 1;
+      while (end < queue.length &&
+             queue[end].display_label == queue[start].display_label &&
+             end - start < 0xffff) {
+        end++;
+      }
+      this._inputChannel.send(encodeInputBatch(
+          queue[start].display_label,
+          queue.slice(start, end).map(entry => entry.evt)));
+      start = end;
+    }
+  }
+
   sendMousePosition({x, y, down, display_label}) {
+    if (this._binaryInput) {
+      this._queueBinaryInput(
+          display_label, {type: INPUT_EVENT_MOUSE, down, x, y});
+      return;
+    }
     this._sendJsonInput({
       type: 'mouse',
       down: down ? 1 : 0,
@@ -165,6 +298,14 @@ class DeviceConnection {
   // TODO (b/124121375): This should probably be an array of pointer events and
   // have different properties.
   sendMultiTouch({idArr, xArr, yArr, down, slotArr, display_label}) {
+    if (this._binaryInput) {
+      let touches = idArr.map((id, i) => {
+        return {id, slot: slotArr[i], x: xArr[i], y: yArr[i]};
+      });
+      this._queueBinaryInput(
+          display_label, {type: INPUT_EVENT_MULTI_TOUCH, down, touches});
+      return;
+    }
     this._sendJsonInput({
       type: 'multi-touch',
       id: idArr,
@@ -177,6 +318,11 @@ class DeviceConnection {
   }
 
   sendKeyEvent(code, type) {
+    if (this._binaryInput) {
+      this._queueBinaryInput(
+          '', {type: INPUT_EVENT_KEYBOARD, down: type == 'keydown', code});
+      return;
+    }
     this._sendJsonInput({type: 'keyboard', keycode: code, event_type: type});
   }
 
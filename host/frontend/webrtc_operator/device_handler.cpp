@@ -44,6 +44,8 @@ void DeviceHandler::handleMessage(const std::string& type,
     HandleRegistrationRequest(message);
   } else if (type == webrtc_signaling::kForwardType) {
     HandleForward(message);
+  } else if (type == webrtc_signaling::kDeviceInfoType) {
+    HandleDeviceInfoUpdate(message);
   } else {
     LogAndReplyError("Unknown message type: " + type);
   }
@@ -66,7 +68,7 @@ void DeviceHandler::HandleRegistrationRequest(const Json::Value& message) {
   if (message.isMember(webrtc_signaling::kDeviceInfoField)) {
     device_info_ = message[webrtc_signaling::kDeviceInfoField];
   }
-  if (!registry_->RegisterDevice(device_id_, weak_from_this())) {
+  if (!registry_->RegisterDevice(device_id_, weak_from_this(), device_info_)) {
     LOG(ERROR) << "Device registration failed";
     Close();
     return;
@@ -75,6 +77,20 @@ void DeviceHandler::HandleRegistrationRequest(const Json::Value& message) {
   SendServerConfig();
 }
 
+void DeviceHandler::HandleDeviceInfoUpdate(const Json::Value& message) {
+  if (device_id_.empty()) {
+    LogAndReplyError("Device info update before registration");
+    Close();
+    return;
+  }
+  if (!message.isMember(webrtc_signaling::kDeviceInfoField)) {
+    LogAndReplyError("Missing device info in update");
+    return;
+  }
+  device_info_ = message[webrtc_signaling::kDeviceInfoField];
+  registry_->UpdateDeviceInfo(device_id_, device_info_);
+}
+
 void DeviceHandler::HandleForward(const Json::Value& message) {
   if (!message.isMember(webrtc_signaling::kClientIdField) ||
       !message[webrtc_signaling::kClientIdField].isInt()) {
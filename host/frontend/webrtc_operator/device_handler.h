@@ -50,6 +50,7 @@ class DeviceHandler : public SignalHandler,
 
  private:
   void HandleRegistrationRequest(const Json::Value& message);
+  void HandleDeviceInfoUpdate(const Json::Value& message);
   void HandleForward(const Json::Value& message);
 
   std::string device_id_;
@@ -15,18 +15,49 @@
 
 #include "host/frontend/webrtc_operator/device_list_handler.h"
 
+#include <android-base/logging.h>
+
+#include "host/frontend/webrtc_operator/constants/signaling_constants.h"
+
 namespace cuttlefish {
+namespace {
+
+constexpr auto kSubscribeType = "subscribe";
+constexpr auto kEpochField = "epoch";
+constexpr auto kVersionField = "version";
 
-DeviceListHandler::DeviceListHandler(struct lws* wsi,
-                                     const DeviceRegistry& registry)
+}  // namespace
+
+DeviceListHandler::DeviceListHandler(struct lws* wsi, DeviceRegistry* registry)
     : WebSocketHandler(wsi), registry_(registry) {}
 
-void DeviceListHandler::OnReceive(const uint8_t* /*msg*/, size_t /*len*/,
-                                  bool /*binary*/) {
-  // Ignore the message, just send the reply
+DeviceListHandler::~DeviceListHandler() {
+  if (subscribed_) {
+    registry_->Unsubscribe(this);
+  }
+}
+
+void DeviceListHandler::OnReceive(const uint8_t* msg, size_t len,
+                                  bool binary) {
+  Json::Value message;
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> json_reader(builder.newCharReader());
+  std::string error_message;
+  auto str = reinterpret_cast<const char*>(msg);
+  if (binary || !json_reader->parse(str, str + len, &message, &error_message) ||
+      !message.isObject() ||
+      message.get(webrtc_signaling::kTypeField, "") != kSubscribeType) {
+    // Ignore the message, just send the reply
+    SendDeviceIds();
+    return;
+  }
+  Subscribe(message);
+}
+
+void DeviceListHandler::SendDeviceIds() {
   Json::Value reply(Json::ValueType::arrayValue);
 
-  for (const auto& id : registry_.ListDeviceIds()) {
+  for (const auto& id : registry_->ListDeviceIds()) {
     reply.append(id);
   }
   Json::StreamWriterBuilder json_factory;
@@ -35,11 +66,38 @@ void DeviceListHandler::OnReceive(const uint8_t* /*msg*/, size_t /*len*/,
   Close();
 }
 
+void DeviceListHandler::Subscribe(const Json::Value& message) {
+  if (subscribed_) {
+    LOG(WARNING) << "Device list subscriber subscribed again";
+    return;
+  }
+  const auto& epoch = message[kEpochField];
+  const auto& version = message[kVersionField];
+  if (epoch.isString() && version.isUInt64()) {
+    auto reply = registry_->ChangesSince(epoch.asString(), version.asUInt64());
+    EnqueueMessage(reply.c_str(), reply.size());
+  } else {
+    const auto& reply = registry_->DeviceListMessage();
+    EnqueueMessage(reply.c_str(), reply.size());
+  }
+  registry_->Subscribe(this);
+  subscribed_ = true;
+}
+
+void DeviceListHandler::OnDeviceListDelta(const std::string& delta_message) {
+  EnqueueMessage(delta_message.c_str(), delta_message.size());
+}
+
 void DeviceListHandler::OnConnected() {}
 
-void DeviceListHandler::OnClosed() {}
+void DeviceListHandler::OnClosed() {
+  if (subscribed_) {
+    registry_->Unsubscribe(this);
+    subscribed_ = false;
+  }
+}
 
-DeviceListHandlerFactory::DeviceListHandlerFactory(const DeviceRegistry& registry)
+DeviceListHandlerFactory::DeviceListHandlerFactory(DeviceRegistry* registry)
   : registry_(registry) {}
 
 std::shared_ptr<WebSocketHandler> DeviceListHandlerFactory::Build(struct lws* wsi) {
@@ -25,24 +25,39 @@
 
 namespace cuttlefish {
 
-class DeviceListHandler : public WebSocketHandler {
+// Replies to any message other than a subscription with the ids of the
+// registered devices and closes the connection. After a
+// {"message_type": "subscribe", "epoch": <String>, "version": <Integer>}
+// message it sends the changes since that version, or the whole list when the
+// epoch doesn't match or the version is missing or too old, and then every
+// change to the registry as it happens. See DeviceRegistry for the format of
+// those messages.
+class DeviceListHandler : public WebSocketHandler,
+                          public DeviceRegistry::Subscriber {
  public:
-  DeviceListHandler(struct lws* wsi, const DeviceRegistry& registry);
+  DeviceListHandler(struct lws* wsi, DeviceRegistry* registry);
+  ~DeviceListHandler() override;
 
   void OnReceive(const uint8_t* msg, size_t len, bool binary) override;
   void OnConnected() override;
   void OnClosed() override;
 
+  void OnDeviceListDelta(const std::string& delta_message) override;
+
  private:
-  const DeviceRegistry& registry_;
+  void SendDeviceIds();
+  void Subscribe(const Json::Value& message);
+
+  DeviceRegistry* registry_;
+  bool subscribed_ = false;
 };
 
 class DeviceListHandlerFactory : public WebSocketHandlerFactory {
  public:
-  DeviceListHandlerFactory(const DeviceRegistry& registry);
+  DeviceListHandlerFactory(DeviceRegistry* registry);
   std::shared_ptr<WebSocketHandler> Build(struct lws* wsi) override;
 
  private:
-  const DeviceRegistry& registry_;
+  DeviceRegistry* registry_;
 };
 }  // namespace cuttlefish
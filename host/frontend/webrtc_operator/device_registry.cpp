@@ -15,21 +15,65 @@
 
 #include "host/frontend/webrtc_operator/device_registry.h"
 
+#include <algorithm>
+#include <iomanip>
+#include <random>
+#include <sstream>
+
 #include <android-base/logging.h>
 
+#include "host/frontend/webrtc_operator/constants/signaling_constants.h"
 #include "host/frontend/webrtc_operator/device_handler.h"
 
 namespace cuttlefish {
+namespace {
+
+// Enough for subscribers to catch up after reconnecting, older versions get
+// the whole list.
+constexpr size_t kMaxLoggedChanges = 1024;
+
+constexpr auto kDeviceListType = "device_list";
+constexpr auto kDeviceListDeltaType = "device_list_delta";
+constexpr auto kEpochField = "epoch";
+constexpr auto kVersionField = "version";
+constexpr auto kFromVersionField = "from_version";
+constexpr auto kDevicesField = "devices";
+constexpr auto kChangesField = "changes";
+constexpr auto kChangeField = "change";
+constexpr auto kDeviceField = "device";
+
+std::string Quoted(const std::string& str) {
+  return "\"" + str + "\"";
+}
+
+// 64 random bits in hex, a string so javascript clients compare it exactly.
+std::string RandomEpoch() {
+  std::random_device random;
+  std::uint64_t bits = static_cast<std::uint64_t>(random()) << 32 | random();
+  std::stringstream epoch;
+  epoch << std::hex << std::setw(16) << std::setfill('0') << bits;
+  return epoch.str();
+}
+
+}  // namespace
+
+DeviceRegistry::DeviceRegistry() : epoch_(RandomEpoch()) {}
 
 bool DeviceRegistry::RegisterDevice(
     const std::string& device_id,
-    std::weak_ptr<DeviceHandler> device_handler) {
+    std::weak_ptr<DeviceHandler> device_handler,
+    const Json::Value& device_info) {
   if (devices_.count(device_id) > 0) {
     LOG(ERROR) << "Device '" << device_id << "' is already registered";
     return false;
   }
 
-  devices_.try_emplace(device_id, device_handler);
+  Json::Value descriptor;
+  descriptor[webrtc_signaling::kDeviceIdField] = device_id;
+  descriptor[webrtc_signaling::kDeviceInfoField] = device_info;
+  devices_.try_emplace(device_id,
+                       DeviceRecord{device_handler, Serialize(descriptor)});
+  RecordChange(device_id, ChangeType::kAdded);
   LOG(INFO) << "Registered device: '" << device_id << "'";
   return true;
 }
@@ -42,16 +86,36 @@ void DeviceRegistry::UnRegisterDevice(const std::string& device_id) {
     return;
   }
   devices_.erase(record);
+  RecordChange(device_id, ChangeType::kRemoved);
   LOG(INFO) << "Unregistered device: '" << device_id << "'";
 }
 
+void DeviceRegistry::UpdateDeviceInfo(const std::string& device_id,
+                                      const Json::Value& device_info) {
+  auto record = devices_.find(device_id);
+  if (record == devices_.end()) {
+    LOG(WARNING) << "Requested to update an unkwnown device: '" << device_id
+                 << "'";
+    return;
+  }
+  Json::Value descriptor;
+  descriptor[webrtc_signaling::kDeviceIdField] = device_id;
+  descriptor[webrtc_signaling::kDeviceInfoField] = device_info;
+  auto serialized = Serialize(descriptor);
+  if (serialized == record->second.descriptor) {
+    return;
+  }
+  record->second.descriptor = std::move(serialized);
+  RecordChange(device_id, ChangeType::kUpdated);
+}
+
 std::shared_ptr<DeviceHandler> DeviceRegistry::GetDevice(
     const std::string& device_id) {
   if (devices_.count(device_id) == 0) {
     LOG(INFO) << "Requested device (" << device_id << ") is not registered";
     return nullptr;
   }
-  auto device_handler = devices_[device_id].lock();
+  auto device_handler = devices_[device_id].handler.lock();
   if (!device_handler) {
     LOG(WARNING) << "Destroyed device handler detected for device '"
                  << device_id << "'";
@@ -68,4 +132,132 @@ std::vector<std::string> DeviceRegistry::ListDeviceIds() const {
   return ret;
 }
 
+const std::string& DeviceRegistry::DeviceListMessage() {
+  if (device_list_message_.empty()) {
+    // Built from the serialized devices, without parsing them again
+    device_list_message_ = "{" + Quoted(webrtc_signaling::kTypeField) + ":" +
+                           Quoted(kDeviceListType) + "," +
+                           Quoted(kEpochField) + ":" + Quoted(epoch_) + "," +
+                           Quoted(kVersionField) + ":" +
+                           std::to_string(version_) + "," +
+                           Quoted(kDevicesField) + ":[";
+    bool first = true;
+    for (const auto& [id, record] : devices_) {
+      if (!first) {
+        device_list_message_ += ",";
+      }
+      first = false;
+      device_list_message_ += record.descriptor;
+    }
+    device_list_message_ += "]}";
+  }
+  return device_list_message_;
+}
+
+std::string DeviceRegistry::ChangesSince(const std::string& epoch,
+                                         std::uint64_t version) {
+  if (epoch != epoch_) {
+    return DeviceListMessage();
+  }
+  if (version == version_) {
+    return DeltaMessage(version, {});
+  }
+  if (version > version_ || changes_.empty() ||
+      version + 1 < changes_.front().version) {
+    return DeviceListMessage();
+  }
+  // Only the latest state of each device is sent, a device that was added
+  // after the given version is reported as added even if it changed since.
+  auto first_change = std::find_if(
+      changes_.begin(), changes_.end(),
+      [version](const Change& change) { return change.version > version; });
+  std::vector<std::string> device_ids;
+  std::map<std::string, bool> added_since;
+  for (auto it = first_change; it != changes_.end(); ++it) {
+    auto [entry, inserted] =
+        added_since.try_emplace(it->device_id, it->type == ChangeType::kAdded);
+    if (inserted) {
+      device_ids.push_back(it->device_id);
+    }
+  }
+  std::vector<std::string> entries;
+  for (const auto& device_id : device_ids) {
+    ChangeType type = ChangeType::kRemoved;
+    if (devices_.count(device_id) > 0) {
+      type = added_since[device_id] ? ChangeType::kAdded : ChangeType::kUpdated;
+    }
+    entries.push_back(ChangeEntry(device_id, type));
+  }
+  return DeltaMessage(version, entries);
+}
+
+void DeviceRegistry::Subscribe(Subscriber* subscriber) {
+  subscribers_.push_back(subscriber);
+}
+
+void DeviceRegistry::Unsubscribe(Subscriber* subscriber) {
+  subscribers_.erase(
+      std::remove(subscribers_.begin(), subscribers_.end(), subscriber),
+      subscribers_.end());
+}
+
+std::string DeviceRegistry::Serialize(const Json::Value& json) {
+  Json::StreamWriterBuilder factory;
+  factory["indentation"] = "";
+  return Json::writeString(factory, json);
+}
+
+std::string DeviceRegistry::ChangeEntry(const std::string& device_id,
+                                        ChangeType type) const {
+  if (type == ChangeType::kRemoved) {
+    Json::Value entry;
+    entry[kChangeField] = "removed";
+    entry[webrtc_signaling::kDeviceIdField] = device_id;
+    return Serialize(entry);
+  }
+  return "{" + Quoted(kChangeField) + ":" +
+         Quoted(type == ChangeType::kAdded ? "added" : "updated") + "," +
+         Quoted(webrtc_signaling::kDeviceIdField) + ":" +
+         Serialize(Json::Value(device_id)) + "," + Quoted(kDeviceField) + ":" +
+         devices_.at(device_id).descriptor + "}";
+}
+
+std::string DeviceRegistry::DeltaMessage(
+    std::uint64_t from_version, const std::vector<std::string>& entries) const {
+  std::string message = "{" + Quoted(webrtc_signaling::kTypeField) + ":" +
+                        Quoted(kDeviceListDeltaType) + "," +
+                        Quoted(kEpochField) + ":" + Quoted(epoch_) + "," +
+                        Quoted(kFromVersionField) + ":" +
+                        std::to_string(from_version) + "," +
+                        Quoted(kVersionField) + ":" +
+                        std::to_string(version_) + "," +
+                        Quoted(kChangesField) + ":[";
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (i > 0) {
+      message += ",";
+    }
+    message += entries[i];
+  }
+  message += "]}";
+  return message;
+}
+
+void DeviceRegistry::RecordChange(const std::string& device_id,
+                                  ChangeType type) {
+  version_++;
+  changes_.push_back({version_, device_id, type});
+  if (changes_.size() > kMaxLoggedChanges) {
+    changes_.pop_front();
+  }
+  device_list_message_.clear();
+  if (subscribers_.empty()) {
+    return;
+  }
+  // Serialized once for all subscribers
+  auto message = DeltaMessage(version_ - 1, {ChangeEntry(device_id, type)});
+  for (auto subscriber : subscribers_) {
+    subscriber->OnDeviceListDelta(message);
+  }
+}
+
 }  // namespace cuttlefish
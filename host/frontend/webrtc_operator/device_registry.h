@@ -17,6 +17,7 @@
 
 #include <cinttypes>
 
+#include <deque>
 #include <map>
 #include <memory>
 #include <string>
@@ -28,18 +29,87 @@ namespace cuttlefish {
 
 class DeviceHandler;
 
+// Keeps the registered devices and a log of the changes to them, every change
+// bumps the registry version. Subscribers get each change as it happens, as a
+// device_list_delta message:
+//
+// {"message_type": "device_list_delta", "epoch": <String>,
+//  "from_version": <Integer>, "version": <Integer>, "changes": [<Change>, ...]}
+//
+// where changes are {"change": "added" | "updated", "device_id": <String>,
+// "device": <Device>} or {"change": "removed", "device_id": <String>}. The
+// whole list is sent in a device_list message:
+//
+// {"message_type": "device_list", "epoch": <String>, "version": <Integer>,
+//  "devices": [<Device>, ...]}
+//
+// Versions start over when the server restarts, the epoch is chosen at random
+// for every registry so subscribers can't mistake the versions of another one
+// for theirs.
+//
+// Devices are {"device_id": <String>, "device_info": <Any>}, serialized once
+// when registered or updated.
 class DeviceRegistry {
  public:
+  class Subscriber {
+   public:
+    virtual ~Subscriber() = default;
+    virtual void OnDeviceListDelta(const std::string& delta_message) = 0;
+  };
+
+  DeviceRegistry();
+
   bool RegisterDevice(const std::string& device_id,
-                      std::weak_ptr<DeviceHandler> device_handler);
+                      std::weak_ptr<DeviceHandler> device_handler,
+                      const Json::Value& device_info);
   void UnRegisterDevice(const std::string& device_id);
+  void UpdateDeviceInfo(const std::string& device_id,
+                        const Json::Value& device_info);
 
   std::shared_ptr<DeviceHandler> GetDevice(const std::string& device_id);
 
   std::vector<std::string> ListDeviceIds() const;
 
+  const std::string& epoch() const { return epoch_; }
+  std::uint64_t version() const { return version_; }
+  // The device_list message for the current version
+  const std::string& DeviceListMessage();
+  // A device_list_delta message from the given version to the current one,
+  // or the device_list message if the version is from another epoch or the
+  // changes since then aren't all logged.
+  std::string ChangesSince(const std::string& epoch, std::uint64_t version);
+
+  void Subscribe(Subscriber* subscriber);
+  void Unsubscribe(Subscriber* subscriber);
+
  private:
-  std::map<std::string, std::weak_ptr<DeviceHandler>> devices_;
+  enum class ChangeType { kAdded, kRemoved, kUpdated };
+
+  struct DeviceRecord {
+    std::weak_ptr<DeviceHandler> handler;
+    std::string descriptor;
+  };
+
+  struct Change {
+    std::uint64_t version;
+    std::string device_id;
+    ChangeType type;
+  };
+
+  static std::string Serialize(const Json::Value& json);
+  std::string ChangeEntry(const std::string& device_id, ChangeType type) const;
+  std::string DeltaMessage(std::uint64_t from_version,
+                           const std::vector<std::string>& entries) const;
+  void RecordChange(const std::string& device_id, ChangeType type);
+
+  std::map<std::string, DeviceRecord> devices_;
+  const std::string epoch_;
+  std::uint64_t version_ = 0;
+  // Oldest first, bounded
+  std::deque<Change> changes_;
+  // Empty when out of date
+  std::string device_list_message_;
+  std::vector<Subscriber*> subscribers_;
 };
 
 }  // namespace cuttlefish
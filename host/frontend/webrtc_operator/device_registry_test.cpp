@@ -0,0 +1,208 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/frontend/webrtc_operator/device_registry.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <json/json.h>
+
+namespace cuttlefish {
+namespace {
+
+Json::Value Parse(const std::string& message) {
+  Json::Value json;
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  std::string error;
+  EXPECT_TRUE(reader->parse(message.data(), message.data() + message.size(),
+                            &json, &error))
+      << error << ": " << message;
+  return json;
+}
+
+Json::Value Info(const std::string& name) {
+  Json::Value info;
+  info["name"] = name;
+  return info;
+}
+
+void Register(DeviceRegistry* registry, const std::string& device_id) {
+  ASSERT_TRUE(registry->RegisterDevice(device_id, {}, Info(device_id)));
+}
+
+// The change type of every device in a delta, in order.
+std::vector<std::string> Changes(const Json::Value& delta) {
+  std::vector<std::string> changes;
+  for (const auto& change : delta["changes"]) {
+    changes.push_back(change["device_id"].asString() + " " +
+                      change["change"].asString());
+  }
+  return changes;
+}
+
+class RecordingSubscriber : public DeviceRegistry::Subscriber {
+ public:
+  void OnDeviceListDelta(const std::string& delta_message) override {
+    deltas.push_back(Parse(delta_message));
+  }
+  std::vector<Json::Value> deltas;
+};
+
+TEST(DeviceRegistry, ListsDevices) {
+  DeviceRegistry registry;
+  Register(&registry, "b");
+  Register(&registry, "a");
+  EXPECT_FALSE(registry.RegisterDevice("a", {}, Info("again")));
+  EXPECT_EQ(registry.ListDeviceIds(), (std::vector<std::string>{"a", "b"}));
+
+  auto list = Parse(registry.DeviceListMessage());
+  EXPECT_EQ(list["message_type"], "device_list");
+  EXPECT_EQ(list["epoch"], registry.epoch());
+  EXPECT_EQ(list["version"], 2);
+  ASSERT_EQ(list["devices"].size(), 2u);
+  EXPECT_EQ(list["devices"][0]["device_id"], "a");
+  EXPECT_EQ(list["devices"][0]["device_info"], Info("a"));
+
+  registry.UnRegisterDevice("b");
+  list = Parse(registry.DeviceListMessage());
+  EXPECT_EQ(list["version"], 3);
+  EXPECT_EQ(list["devices"].size(), 1u);
+}
+
+TEST(DeviceRegistry, EpochsDiffer) {
+  DeviceRegistry first;
+  DeviceRegistry second;
+  EXPECT_EQ(first.epoch().size(), 16u);
+  EXPECT_NE(first.epoch(), second.epoch());
+}
+
+TEST(DeviceRegistry, UnchangedInfoKeepsTheVersion) {
+  DeviceRegistry registry;
+  Register(&registry, "a");
+  registry.UpdateDeviceInfo("a", Info("a"));
+  registry.UpdateDeviceInfo("unknown", Info("a"));
+  EXPECT_EQ(registry.version(), 1u);
+  registry.UpdateDeviceInfo("a", Info("renamed"));
+  EXPECT_EQ(registry.version(), 2u);
+}
+
+TEST(DeviceRegistry, CoalescesChangesSinceAVersion) {
+  DeviceRegistry registry;
+  Register(&registry, "a");  // 1
+  Register(&registry, "b");  // 2
+  registry.UpdateDeviceInfo("a", Info("a2"));  // 3
+  registry.UnRegisterDevice("b");  // 4
+  Register(&registry, "c");  // 5
+  registry.UpdateDeviceInfo("c", Info("c2"));  // 6
+  registry.UpdateDeviceInfo("a", Info("a3"));  // 7
+
+  auto delta = Parse(registry.ChangesSince(registry.epoch(), 1));
+  EXPECT_EQ(delta["message_type"], "device_list_delta");
+  EXPECT_EQ(delta["epoch"], registry.epoch());
+  EXPECT_EQ(delta["from_version"], 1);
+  EXPECT_EQ(delta["version"], 7);
+  // One change per device, in the order they first changed, with its latest
+  // state. c was added after version 1, so it is still added.
+  EXPECT_EQ(Changes(delta), (std::vector<std::string>{
+                                "b removed", "a updated", "c added"}));
+  EXPECT_EQ(delta["changes"][1]["device"]["device_info"], Info("a3"));
+  EXPECT_EQ(delta["changes"][2]["device"]["device_info"], Info("c2"));
+  EXPECT_FALSE(delta["changes"][0].isMember("device"));
+
+  delta = Parse(registry.ChangesSince(registry.epoch(), 5));
+  EXPECT_EQ(Changes(delta),
+            (std::vector<std::string>{"c updated", "a updated"}));
+
+  delta = Parse(registry.ChangesSince(registry.epoch(), 0));
+  EXPECT_EQ(Changes(delta), (std::vector<std::string>{
+                                "a added", "b removed", "c added"}));
+
+  delta = Parse(registry.ChangesSince(registry.epoch(), 7));
+  EXPECT_EQ(delta["message_type"], "device_list_delta");
+  EXPECT_EQ(delta["changes"].size(), 0u);
+}
+
+TEST(DeviceRegistry, SendsTheListForOtherEpochsAndVersions) {
+  DeviceRegistry registry;
+  Register(&registry, "a");
+  Register(&registry, "b");
+  for (const auto& [epoch, version] :
+       std::vector<std::pair<std::string, std::uint64_t>>{
+           {"", 1}, {"0000000000000000", 1}, {registry.epoch(), 3}}) {
+    auto reply = Parse(registry.ChangesSince(epoch, version));
+    EXPECT_EQ(reply["message_type"], "device_list")
+        << epoch << " " << version;
+    EXPECT_EQ(reply["devices"].size(), 2u);
+  }
+}
+
+TEST(DeviceRegistry, SendsTheListOnceChangesAreTruncated) {
+  // More changes than logged
+  constexpr std::uint64_t kChanges = 1031;
+  DeviceRegistry registry;
+  Register(&registry, "kept");
+  for (std::uint64_t i = 1; i < kChanges; i++) {
+    if (i % 2) {
+      Register(&registry, "flapping");
+    } else {
+      registry.UnRegisterDevice("flapping");
+    }
+  }
+  ASSERT_EQ(registry.version(), kChanges);
+
+  // The oldest change still logged is version kChanges - 1023
+  auto reply = Parse(registry.ChangesSince(registry.epoch(), kChanges - 1024));
+  EXPECT_EQ(reply["message_type"], "device_list_delta");
+  EXPECT_EQ(Changes(reply), (std::vector<std::string>{"flapping removed"}));
+
+  reply = Parse(registry.ChangesSince(registry.epoch(), kChanges - 1025));
+  EXPECT_EQ(reply["message_type"], "device_list");
+  EXPECT_EQ(reply["version"].asUInt64(), kChanges);
+  ASSERT_EQ(reply["devices"].size(), 1u);
+  EXPECT_EQ(reply["devices"][0]["device_id"], "kept");
+}
+
+TEST(DeviceRegistry, NotifiesSubscribers) {
+  DeviceRegistry registry;
+  RecordingSubscriber subscriber;
+  registry.Subscribe(&subscriber);
+  Register(&registry, "a");
+  registry.UpdateDeviceInfo("a", Info("a2"));
+  registry.UnRegisterDevice("a");
+  registry.Unsubscribe(&subscriber);
+  Register(&registry, "b");
+
+  ASSERT_EQ(subscriber.deltas.size(), 3u);
+  for (std::uint64_t i = 0; i < subscriber.deltas.size(); i++) {
+    EXPECT_EQ(subscriber.deltas[i]["epoch"], registry.epoch());
+    EXPECT_EQ(subscriber.deltas[i]["from_version"].asUInt64(), i);
+    EXPECT_EQ(subscriber.deltas[i]["version"].asUInt64(), i + 1);
+  }
+  EXPECT_EQ(Changes(subscriber.deltas[0]),
+            (std::vector<std::string>{"a added"}));
+  EXPECT_EQ(Changes(subscriber.deltas[1]),
+            (std::vector<std::string>{"a updated"}));
+  EXPECT_EQ(Changes(subscriber.deltas[2]),
+            (std::vector<std::string>{"a removed"}));
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -63,7 +63,7 @@ int main(int argc, char** argv) {
   wss.RegisterHandlerFactory(kConnectClientUriPath, std::move(client_handler_factory_p));
   auto device_list_handler_factory_p =
       std::unique_ptr<cuttlefish::WebSocketHandlerFactory>(
-          new cuttlefish::DeviceListHandlerFactory(device_registry));
+          new cuttlefish::DeviceListHandlerFactory(&device_registry));
   wss.RegisterHandlerFactory(kListDevicesUriPath, std::move(device_list_handler_factory_p));
 
   wss.Serve();
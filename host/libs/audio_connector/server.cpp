@@ -20,7 +20,9 @@
 #include <strings.h>
 #include <unistd.h>
 
+#include <mutex>
 #include <utility>
+#include <vector>
 
 #include <android-base/logging.h>
 
@@ -63,35 +65,95 @@ bool CreateSocketPair(SharedFD* local, SharedFD* remote) {
   return ret;
 }
 
-std::function<void(AudioStatus, uint32_t, uint32_t)> SendStatusCallback(
-    uint32_t buffer_offset, SharedFD socket) {
-  // Consumption of an audio buffer is an asynchronous event, which could
-  // trigger after the client disconnected. A WeakFD ensures that the response
-  // will only be sent if there is still a client available.
-  auto weak_socket = WeakFD(socket);
-  return
-      [buffer_offset, weak_socket](AudioStatus status, uint32_t latency_bytes,
-                                   uint32_t consumed_length) {
-        auto socket = weak_socket.lock();
-        if (!socket->IsOpen()) {
-          return;
-        }
-        IoStatusMsg reply;
-        reply.status.status = Le32(static_cast<uint32_t>(status));
-        reply.status.latency_bytes = Le32(latency_bytes);
-        reply.buffer_offset = buffer_offset;
-        reply.consumed_length = consumed_length;
-        // Send the acknowledgment non-blockingly to avoid a slow client from
-        // blocking the server.
-        auto sent = socket->Send(&reply, sizeof(reply), MSG_DONTWAIT);
-        if (sent < sizeof(reply)) {
-          LOG(ERROR) << "Failed to send entire reply: " << socket->StrError();
-        }
-      };
-}
+// The most transfer messages received with a single system call. The client
+// enqueues one message per period and stream, so this is rarely reached.
+constexpr size_t kMaxIoMsgBatch = 16;
 
 }  // namespace
 
+// Sends the status replies of the IO buffers back to the client. While a batch
+// of transfer messages is being handled the replies are queued and then sent
+// with a single system call, at other times they are sent immediately.
+class AudioClientConnection::StatusSender
+    : public std::enable_shared_from_this<StatusSender> {
+ public:
+  StatusSender(SharedFD socket) : socket_(socket) {}
+
+  std::function<void(AudioStatus, uint32_t, uint32_t)> Callback(
+      uint32_t buffer_offset) {
+    return [buffer_offset, self = shared_from_this()](
+               AudioStatus status, uint32_t latency_bytes,
+               uint32_t consumed_length) {
+      IoStatusMsg reply;
+      reply.status.status = Le32(static_cast<uint32_t>(status));
+      reply.status.latency_bytes = Le32(latency_bytes);
+      reply.buffer_offset = buffer_offset;
+      reply.consumed_length = consumed_length;
+      self->Send(reply);
+    };
+  }
+
+  void Send(const IoStatusMsg& reply) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (in_batch_) {
+      pending_.push_back(reply);
+      return;
+    }
+    SendLocked(&reply, 1);
+  }
+
+  void BeginBatch() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    in_batch_ = true;
+  }
+
+  void EndBatch() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    in_batch_ = false;
+    SendLocked(pending_.data(), pending_.size());
+    pending_.clear();
+  }
+
+ private:
+  void SendLocked(const IoStatusMsg* replies, size_t count) {
+    if (count == 0) {
+      return;
+    }
+    // Consumption of an audio buffer is an asynchronous event, which could
+    // trigger after the client disconnected. A WeakFD ensures that the
+    // response will only be sent if there is still a client available.
+    auto socket = socket_.lock();
+    if (!socket->IsOpen()) {
+      return;
+    }
+    // Each reply still goes in its own message, the client expects them that
+    // way.
+    std::vector<struct iovec> iovs(count);
+    std::vector<struct mmsghdr> msgs(count);
+    for (size_t i = 0; i < count; i++) {
+      iovs[i] = {
+          .iov_base = const_cast<IoStatusMsg*>(&replies[i]),
+          .iov_len = sizeof(IoStatusMsg),
+      };
+      msgs[i] = {};
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    // Send the acknowledgments non-blockingly to avoid a slow client from
+    // blocking the server.
+    auto sent = socket->SendMMsg(msgs.data(), count, MSG_DONTWAIT);
+    if (sent < 0 || static_cast<size_t>(sent) < count) {
+      LOG(ERROR) << "Failed to send " << count << " replies, sent " << sent
+                 << ": " << socket->StrError();
+    }
+  }
+
+  WeakFD socket_;
+  std::mutex mutex_;
+  bool in_batch_ = false;
+  std::vector<IoStatusMsg> pending_;
+};
+
 std::unique_ptr<AudioClientConnection> AudioServer::AcceptClient(
     uint32_t num_streams, uint32_t num_jacks, uint32_t num_chmaps,
     size_t tx_shm_len, size_t rx_shm_len) {
@@ -153,6 +215,21 @@ std::unique_ptr<AudioClientConnection> AudioClientConnection::Create(
       event_socket, tx_socket, rx_socket));
 }
 
+AudioClientConnection::AudioClientConnection(ScopedMMap tx_shm,
+                                             ScopedMMap rx_shm,
+                                             SharedFD control_socket,
+                                             SharedFD event_socket,
+                                             SharedFD tx_socket,
+                                             SharedFD rx_socket)
+    : tx_shm_(std::move(tx_shm)),
+      rx_shm_(std::move(rx_shm)),
+      control_socket_(control_socket),
+      event_socket_(event_socket),
+      tx_socket_(tx_socket),
+      rx_socket_(rx_socket),
+      tx_status_sender_(std::make_shared<StatusSender>(tx_socket)),
+      rx_status_sender_(std::make_shared<StatusSender>(rx_socket)) {}
+
 bool AudioClientConnection::ReceiveCommands(AudioServerExecutor& executor) {
   // The largest msg the client will send is 24 bytes long, using uint64_t
   // guarantees it's aligned to 64 bits.
@@ -257,43 +334,38 @@ bool AudioClientConnection::ReceiveCommands(AudioServerExecutor& executor) {
 }
 
 bool AudioClientConnection::ReceivePlayback(AudioServerExecutor& executor) {
-  // The largest msg the client will send is 12 bytes long, using uint32_t
-  // guarantees it's aligned to 32 bits.
-  uint32_t recv_buffer[3];
-  auto recv_size = ReceiveMsg(tx_socket_, &recv_buffer, sizeof(recv_buffer));
-  if (recv_size <= 0) {
+  IoTransferMsg msgs[kMaxIoMsgBatch];
+  auto count = ReceiveIoMsgs(tx_socket_, msgs, kMaxIoMsgBatch);
+  if (count <= 0) {
     return false;
   }
-  const auto msg_hdr = reinterpret_cast<const IoTransferMsg*>(&recv_buffer[0]);
-
-  if (recv_size < sizeof(IoTransferMsg)) {
-    LOG(ERROR) << "Received PCM_XFER message is too small: " << recv_size;
-    return false;
+  tx_status_sender_->BeginBatch();
+  for (int i = 0; i < count; i++) {
+    const auto& msg = msgs[i];
+    TxBuffer buffer(msg.io_xfer, TxBufferAt(msg.buffer_offset, msg.buffer_len),
+                    msg.buffer_len,
+                    tx_status_sender_->Callback(msg.buffer_offset));
+    executor.OnPlaybackBuffer(std::move(buffer));
   }
-  TxBuffer buffer(msg_hdr->io_xfer,
-                  TxBufferAt(msg_hdr->buffer_offset, msg_hdr->buffer_len),
-                  msg_hdr->buffer_len,
-                  SendStatusCallback(msg_hdr->buffer_offset, tx_socket_));
-  executor.OnPlaybackBuffer(std::move(buffer));
+  tx_status_sender_->EndBatch();
   return true;
 }
 
 bool AudioClientConnection::ReceiveCapture(AudioServerExecutor& executor) {
-  uint32_t recv_buffer[3];
-  auto recv_size = ReceiveMsg(rx_socket_, &recv_buffer, sizeof(recv_buffer));
-  if (recv_size <= 0) {
+  IoTransferMsg msgs[kMaxIoMsgBatch];
+  auto count = ReceiveIoMsgs(rx_socket_, msgs, kMaxIoMsgBatch);
+  if (count <= 0) {
     return false;
   }
-  const auto msg_hdr = reinterpret_cast<const IoTransferMsg*>(&recv_buffer[0]);
-  if (recv_size < sizeof(IoTransferMsg)) {
-    LOG(ERROR) << "Received PCM_XFER message is too small: " << recv_size;
-    return false;
+  rx_status_sender_->BeginBatch();
+  for (int i = 0; i < count; i++) {
+    const auto& msg = msgs[i];
+    RxBuffer buffer(msg.io_xfer, RxBufferAt(msg.buffer_offset, msg.buffer_len),
+                    msg.buffer_len,
+                    rx_status_sender_->Callback(msg.buffer_offset));
+    executor.OnCaptureBuffer(std::move(buffer));
   }
-  RxBuffer buffer(msg_hdr->io_xfer,
-                  RxBufferAt(msg_hdr->buffer_offset, msg_hdr->buffer_len),
-                  msg_hdr->buffer_len,
-                  SendStatusCallback(msg_hdr->buffer_offset, rx_socket_));
-  executor.OnCaptureBuffer(std::move(buffer));
+  rx_status_sender_->EndBatch();
   return true;
 }
 
@@ -354,4 +426,43 @@ ssize_t AudioClientConnection::ReceiveMsg(SharedFD socket, void* buffer,
   return read;
 }
 
+int AudioClientConnection::ReceiveIoMsgs(SharedFD socket, IoTransferMsg* msgs,
+                                         size_t max_msgs) {
+  std::vector<struct iovec> iovs(max_msgs);
+  std::vector<struct mmsghdr> hdrs(max_msgs);
+  for (size_t i = 0; i < max_msgs; i++) {
+    iovs[i] = {
+        .iov_base = &msgs[i],
+        .iov_len = sizeof(IoTransferMsg),
+    };
+    hdrs[i] = {};
+    hdrs[i].msg_hdr.msg_iov = &iovs[i];
+    hdrs[i].msg_hdr.msg_iovlen = 1;
+  }
+  // MSG_WAITFORONE blocks until the first message arrives and then takes only
+  // those already queued, so latency is the same as receiving one at a time.
+  auto count =
+      socket->RecvMMsg(hdrs.data(), max_msgs, MSG_WAITFORONE, nullptr);
+  if (count < 0) {
+    LOG(ERROR) << "Error receiving messages from client: "
+               << socket->StrError();
+    return -1;
+  }
+  for (int i = 0; i < count; i++) {
+    CHECK(!(hdrs[i].msg_hdr.msg_flags & MSG_TRUNC))
+        << "Received a msg bigger than the buffer, msg was truncated";
+    if (hdrs[i].msg_len == 0) {
+      // A closed connection looks like an empty message.
+      LOG(ERROR) << "Client closed the connection";
+      return i;
+    }
+    if (hdrs[i].msg_len < sizeof(IoTransferMsg)) {
+      LOG(ERROR) << "Received PCM_XFER message is too small: "
+                 << hdrs[i].msg_len;
+      return -1;
+    }
+  }
+  return count;
+}
+
 }  // namespace cuttlefish
@@ -62,22 +62,21 @@ class AudioClientConnection {
 
   // Allows the caller to react to commands sent by the client.
   bool ReceiveCommands(AudioServerExecutor& executor);
-  // Allows the caller to react to IO buffers sent by the client.
+  // Allows the caller to react to IO buffers sent by the client. Every
+  // transfer message already queued on the socket is received at once and the
+  // status replies of the buffers released while handling them are sent back
+  // together at the end.
   bool ReceivePlayback(AudioServerExecutor& executor);
   bool ReceiveCapture(AudioServerExecutor& executor);
 
   bool SendEvent(/*TODO*/);
 
  private:
+  class StatusSender;
+
   AudioClientConnection(ScopedMMap tx_shm, ScopedMMap rx_shm,
                         SharedFD control_socket, SharedFD event_socket,
-                        SharedFD tx_socket, SharedFD rx_socket)
-      : tx_shm_(std::move(tx_shm)),
-        rx_shm_(std::move(rx_shm)),
-        control_socket_(control_socket),
-        event_socket_(event_socket),
-        tx_socket_(tx_socket),
-        rx_socket_(rx_socket) {}
+                        SharedFD tx_socket, SharedFD rx_socket);
 
   bool CmdReply(AudioStatus status, const void* data = nullptr,
                 size_t size = 0);
@@ -85,6 +84,9 @@ class AudioClientConnection {
                    AudioServerExecutor& executor);
 
   ssize_t ReceiveMsg(SharedFD socket, void* buffer, size_t size);
+  // Receives up to max_msgs transfer messages, blocking only until the first
+  // one arrives. Returns the number of messages received or -1.
+  int ReceiveIoMsgs(SharedFD socket, IoTransferMsg* msgs, size_t max_msgs);
   const volatile uint8_t* TxBufferAt(size_t offset, size_t len) const;
   volatile uint8_t* RxBufferAt(size_t offset, size_t len);
 
@@ -94,6 +96,10 @@ class AudioClientConnection {
   SharedFD event_socket_;
   SharedFD tx_socket_;
   SharedFD rx_socket_;
+  // Shared with the status callbacks of the buffers, which may outlive the
+  // connection.
+  std::shared_ptr<StatusSender> tx_status_sender_;
+  std::shared_ptr<StatusSender> rx_status_sender_;
 };
 
 class AudioServer {
@@ -0,0 +1,106 @@
+//
+// Copyright (C) 2021 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the cost of handling playback buffers through a loopback
+// connection with a fake client. Each iteration the client queues a burst of
+// transfer messages, as many streams would in the same period, the server
+// handles and releases them and the client reads back the status replies.
+// A burst of one is the cost every buffer paid before batching.
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <android-base/cmsg.h>
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+
+#include "host/libs/audio_connector/server.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr size_t kShmLen = 1 << 20;
+// 10ms of 48kHz stereo S16 audio.
+constexpr uint32_t kBufferLen = 480 * 4;
+
+class ReleasingExecutor : public AudioServerExecutor {
+ public:
+  void StreamsInfo(StreamInfoCommand&) override {}
+  void SetStreamParameters(StreamSetParamsCommand&) override {}
+  void PrepareStream(StreamControlCommand&) override {}
+  void ReleaseStream(StreamControlCommand&) override {}
+  void StartStream(StreamControlCommand&) override {}
+  void StopStream(StreamControlCommand&) override {}
+
+  void OnPlaybackBuffer(TxBuffer buffer) override {
+    buffers_++;
+    buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
+  }
+  void OnCaptureBuffer(RxBuffer buffer) override {
+    buffers_++;
+    buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
+  }
+
+  size_t buffers_ = 0;
+};
+
+void BM_PlaybackBurst(benchmark::State& state) {
+  size_t burst = state.range(0);
+  int fds_pair[2];
+  CHECK(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds_pair) == 0);
+  android::base::unique_fd client_fd(fds_pair[1]);
+  auto connection = AudioClientConnection::Create(
+      SharedFD::Dup(fds_pair[0]), 1, 0, 0, kShmLen, kShmLen);
+  close(fds_pair[0]);
+  CHECK(connection);
+
+  // Same order the server sends them: event, tx, rx, tx shm, rx shm.
+  VioSConfig config;
+  std::vector<android::base::unique_fd> fds;
+  CHECK(android::base::ReceiveFileDescriptorVector(
+            client_fd.get(), &config, sizeof(config), 5, &fds) > 0);
+  CHECK(fds.size() == 5);
+  int tx_fd = fds[1].get();
+
+  std::vector<IoTransferMsg> msgs(burst);
+  for (size_t i = 0; i < burst; i++) {
+    msgs[i].io_xfer.stream_id = Le32(0);
+    msgs[i].buffer_offset = i * kBufferLen;
+    msgs[i].buffer_len = kBufferLen;
+  }
+  ReleasingExecutor executor;
+  for (auto _ : state) {
+    for (const auto& msg : msgs) {
+      CHECK(send(tx_fd, &msg, sizeof(msg), 0) == sizeof(msg));
+    }
+    executor.buffers_ = 0;
+    while (executor.buffers_ < burst) {
+      CHECK(connection->ReceivePlayback(executor));
+    }
+    for (size_t i = 0; i < burst; i++) {
+      IoStatusMsg reply;
+      CHECK(recv(tx_fd, &reply, sizeof(reply), 0) == sizeof(reply));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * burst);
+}
+BENCHMARK(BM_PlaybackBurst)->Arg(1)->Arg(4)->Arg(16);
+
+}  // namespace
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
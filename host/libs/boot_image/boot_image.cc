@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/boot_image/boot_image.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <bootimg.h>
+
+#include "host/libs/boot_image/cpio.h"
+#include "host/libs/boot_image/lz4_legacy.h"
+
+namespace cuttlefish {
+namespace {
+
+// Boot images of header version 3 and above have a fixed page size.
+constexpr uint32_t kBootImagePageSize = 4096;
+constexpr uint32_t kWrittenHeaderVersion = 4;
+
+size_t PageAlign(size_t value, size_t page_size) {
+  return (value + page_size - 1) / page_size * page_size;
+}
+
+std::string FixedString(const uint8_t* field, size_t size) {
+  auto chars = reinterpret_cast<const char*>(field);
+  return std::string(chars, strnlen(chars, size));
+}
+
+// Fails like mkbootimg on strings that don't fit, rather than dropping the
+// end of a kernel command line.
+bool CopyFixedString(const std::string& value, uint8_t* field, size_t size,
+                     const char* name) {
+  if (value.size() >= size) {
+    LOG(ERROR) << "The " << name << " is " << value.size()
+               << " bytes, more than the " << size - 1
+               << " the header has room for: \"" << value << "\"";
+    return false;
+  }
+  memcpy(field, value.data(), value.size());
+  return true;
+}
+
+// Reads a page aligned section, advancing `offset` past its padding.
+bool ReadSection(const std::string& data, size_t* offset, size_t size,
+                 size_t page_size, const char* name, std::string* out) {
+  if (*offset + size > data.size()) {
+    LOG(ERROR) << "Boot image is truncated, " << name << " needs " << size
+               << " bytes at offset " << *offset << " but the image is only "
+               << data.size() << " bytes";
+    return false;
+  }
+  *out = data.substr(*offset, size);
+  *offset += PageAlign(size, page_size);
+  return true;
+}
+
+void AppendSection(std::string* out, const void* data, size_t size,
+                   size_t page_size) {
+  out->append(reinterpret_cast<const char*>(data), size);
+  out->resize(PageAlign(out->size(), page_size), '\0');
+}
+
+}  // namespace
+
+bool ParseBootImage(const std::string& data, BootImage* image) {
+  if (data.size() < sizeof(boot_img_hdr_v3) ||
+      memcmp(data.data(), BOOT_MAGIC, BOOT_MAGIC_SIZE) != 0) {
+    LOG(ERROR) << "Not a boot image";
+    return false;
+  }
+  boot_img_hdr_v4 header = {};
+  memcpy(&header, data.data(), std::min(data.size(), sizeof(header)));
+  if (header.header_version < 3 || header.header_version > 4) {
+    LOG(ERROR) << "Unsupported boot image header version "
+               << header.header_version;
+    return false;
+  }
+  image->header_version = header.header_version;
+  image->os_version = header.os_version;
+  image->cmdline = FixedString(header.cmdline, sizeof(header.cmdline));
+  size_t offset = kBootImagePageSize;
+  return ReadSection(data, &offset, header.kernel_size, kBootImagePageSize,
+                     "kernel", &image->kernel) &&
+         ReadSection(data, &offset, header.ramdisk_size, kBootImagePageSize,
+                     "ramdisk", &image->ramdisk);
+}
+
+bool ParseVendorBootImage(const std::string& data, VendorBootImage* image) {
+  if (data.size() < sizeof(vendor_boot_img_hdr_v3) ||
+      memcmp(data.data(), VENDOR_BOOT_MAGIC, VENDOR_BOOT_MAGIC_SIZE) != 0) {
+    LOG(ERROR) << "Not a vendor boot image";
+    return false;
+  }
+  vendor_boot_img_hdr_v4 header = {};
+  memcpy(&header, data.data(), std::min(data.size(), sizeof(header)));
+  if (header.header_version < 3 || header.header_version > 4) {
+    LOG(ERROR) << "Unsupported vendor boot image header version "
+               << header.header_version;
+    return false;
+  }
+  if (header.page_size == 0) {
+    LOG(ERROR) << "Vendor boot image has a zero page size";
+    return false;
+  }
+  image->header_version = header.header_version;
+  image->page_size = header.page_size;
+  image->kernel_addr = header.kernel_addr;
+  image->ramdisk_addr = header.ramdisk_addr;
+  image->tags_addr = header.tags_addr;
+  image->dtb_addr = header.dtb_addr;
+  image->name = FixedString(header.name, sizeof(header.name));
+  image->cmdline = FixedString(header.cmdline, sizeof(header.cmdline));
+
+  size_t offset = PageAlign(header.header_size, header.page_size);
+  if (!ReadSection(data, &offset, header.vendor_ramdisk_size, header.page_size,
+                   "vendor ramdisk", &image->vendor_ramdisk) ||
+      !ReadSection(data, &offset, header.dtb_size, header.page_size, "dtb",
+                   &image->dtb)) {
+    return false;
+  }
+  image->bootconfig.clear();
+  if (header.header_version < 4) {
+    return true;
+  }
+  // The ramdisk table only describes how the fragments above are split; the
+  // fragments are repacked as a single one.
+  std::string ramdisk_table;
+  return ReadSection(data, &offset, header.vendor_ramdisk_table_size,
+                     header.page_size, "vendor ramdisk table",
+                     &ramdisk_table) &&
+         ReadSection(data, &offset, header.bootconfig_size, header.page_size,
+                     "bootconfig", &image->bootconfig);
+}
+
+bool SerializeBootImage(const BootImage& image, std::string* out) {
+  boot_img_hdr_v4 header = {};
+  memcpy(header.magic, BOOT_MAGIC, BOOT_MAGIC_SIZE);
+  header.kernel_size = image.kernel.size();
+  header.ramdisk_size = image.ramdisk.size();
+  header.os_version = image.os_version;
+  header.header_size = sizeof(header);
+  header.header_version = kWrittenHeaderVersion;
+  if (!CopyFixedString(image.cmdline, header.cmdline, sizeof(header.cmdline),
+                       "boot image cmdline")) {
+    return false;
+  }
+  header.signature_size = 0;
+
+  out->clear();
+  out->reserve(kBootImagePageSize +
+               PageAlign(image.kernel.size(), kBootImagePageSize) +
+               PageAlign(image.ramdisk.size(), kBootImagePageSize));
+  AppendSection(out, &header, sizeof(header), kBootImagePageSize);
+  AppendSection(out, image.kernel.data(), image.kernel.size(),
+                kBootImagePageSize);
+  AppendSection(out, image.ramdisk.data(), image.ramdisk.size(),
+                kBootImagePageSize);
+  return true;
+}
+
+bool SerializeVendorBootImage(const VendorBootImage& image,
+                              std::string* out) {
+  vendor_ramdisk_table_entry_v4 entry = {};
+  entry.ramdisk_size = image.vendor_ramdisk.size();
+  entry.ramdisk_offset = 0;
+  entry.ramdisk_type = VENDOR_RAMDISK_TYPE_PLATFORM;
+
+  vendor_boot_img_hdr_v4 header = {};
+  memcpy(header.magic, VENDOR_BOOT_MAGIC, VENDOR_BOOT_MAGIC_SIZE);
+  header.header_version = kWrittenHeaderVersion;
+  header.page_size = image.page_size;
+  header.kernel_addr = image.kernel_addr;
+  header.ramdisk_addr = image.ramdisk_addr;
+  header.vendor_ramdisk_size = image.vendor_ramdisk.size();
+  if (!CopyFixedString(image.cmdline, header.cmdline, sizeof(header.cmdline),
+                       "vendor boot image cmdline")) {
+    return false;
+  }
+  header.tags_addr = image.tags_addr;
+  if (!CopyFixedString(image.name, header.name, sizeof(header.name),
+                       "vendor boot image name")) {
+    return false;
+  }
+  header.header_size = sizeof(header);
+  header.dtb_size = image.dtb.size();
+  header.dtb_addr = image.dtb_addr;
+  header.vendor_ramdisk_table_size = sizeof(entry);
+  header.vendor_ramdisk_table_entry_num = 1;
+  header.vendor_ramdisk_table_entry_size = sizeof(entry);
+  header.bootconfig_size = image.bootconfig.size();
+
+  size_t page_size = image.page_size;
+  out->clear();
+  out->reserve(PageAlign(sizeof(header), page_size) +
+               PageAlign(image.vendor_ramdisk.size(), page_size) +
+               PageAlign(image.dtb.size(), page_size) +
+               PageAlign(sizeof(entry), page_size) +
+               PageAlign(image.bootconfig.size(), page_size));
+  AppendSection(out, &header, sizeof(header), page_size);
+  AppendSection(out, image.vendor_ramdisk.data(), image.vendor_ramdisk.size(),
+                page_size);
+  AppendSection(out, image.dtb.data(), image.dtb.size(), page_size);
+  AppendSection(out, &entry, sizeof(entry), page_size);
+  AppendSection(out, image.bootconfig.data(), image.bootconfig.size(),
+                page_size);
+  return true;
+}
+
+bool RemoveRamdiskTree(const std::string& ramdisk, const std::string& path,
+                       std::string* new_ramdisk) {
+  std::string cpio;
+  if (!Lz4LegacyDecompress(ramdisk, &cpio)) {
+    LOG(ERROR) << "Unable to decompress ramdisk";
+    return false;
+  }
+  std::vector<CpioEntry> entries;
+  if (!ParseCpioArchives(cpio, &entries)) {
+    LOG(ERROR) << "Unable to parse ramdisk";
+    return false;
+  }
+  // Release the decompressed copy before building the new one.
+  std::string().swap(cpio);
+  RemoveCpioTree(path, &entries);
+  *new_ramdisk = Lz4LegacyCompress(SerializeCpioArchive(std::move(entries)));
+  return true;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+/**
+ * In-process replacements for unpack_bootimg and mkbootimg, limited to the
+ * header versions cuttlefish builds (3 and 4).
+ */
+
+#include <stdint.h>
+
+#include <string>
+
+namespace cuttlefish {
+
+struct BootImage {
+  uint32_t header_version;
+  uint32_t os_version;
+  std::string cmdline;
+  std::string kernel;
+  std::string ramdisk;
+};
+
+struct VendorBootImage {
+  uint32_t header_version;
+  uint32_t page_size;
+  uint32_t kernel_addr;
+  uint32_t ramdisk_addr;
+  uint32_t tags_addr;
+  uint64_t dtb_addr;
+  std::string name;
+  std::string cmdline;
+  // All vendor ramdisk fragments, concatenated in table order.
+  std::string vendor_ramdisk;
+  std::string dtb;
+  // Empty for header version 3.
+  std::string bootconfig;
+};
+
+bool ParseBootImage(const std::string& data, BootImage* image);
+bool ParseVendorBootImage(const std::string& data, VendorBootImage* image);
+
+/**
+ * Serializes the images as header version 4, the way mkbootimg would when
+ * given the same sections. The vendor ramdisk is written as a single platform
+ * ramdisk fragment.
+ *
+ * Unlike the unpack_bootimg and mkbootimg repack this replaced, which never
+ * passed --os_version and so cleared it, the boot image keeps the os_version
+ * (OS version and security patch level) of the image it was parsed from.
+ *
+ * Fails, as mkbootimg does, when the cmdline or name don't fit the header.
+ */
+bool SerializeBootImage(const BootImage& image, std::string* out);
+bool SerializeVendorBootImage(const VendorBootImage& image, std::string* out);
+
+/**
+ * Decompresses an lz4 (legacy format) ramdisk, drops `path` and everything
+ * below it and recompresses the result, equivalent to extracting it with
+ * `lz4 -d | cpio -idu`, running `rm -rf` and repacking it with
+ * `mkbootfs | lz4 -l -12`.
+ */
+bool RemoveRamdiskTree(const std::string& ramdisk, const std::string& path,
+                       std::string* new_ramdisk);
+
+}  // namespace cuttlefish
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares the in-process ramdisk pipeline against the lz4 | cpio | mkbootfs
+// subprocess pipeline it replaced. The subprocess variant needs the host
+// tools under $ANDROID_SOONG_HOST_OUT/bin and is skipped otherwise.
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/subprocess.h"
+#include "host/libs/boot_image/boot_image.h"
+#include "host/libs/boot_image/cpio.h"
+#include "host/libs/boot_image/lz4_legacy.h"
+#include "host/libs/config/cuttlefish_config.h"
+
+namespace cuttlefish {
+namespace {
+
+// Roughly the shape of a vendor ramdisk: a few hundred small config files and
+// a handful of multi-megabyte kernel modules.
+std::string MakeRamdisk() {
+  std::mt19937 random(0);
+  auto contents = [&random](size_t size) {
+    std::string data(size, '\0');
+    for (auto& c : data) {
+      // Limited alphabet to keep it about as compressible as real modules.
+      c = "abcdefgh\0\x7f"[random() % 10];
+    }
+    return data;
+  };
+  std::vector<CpioEntry> entries;
+  entries.push_back({"etc", S_IFDIR | 0755, 0, 0, 0, ""});
+  for (int i = 0; i < 300; i++) {
+    entries.push_back({"etc/config" + std::to_string(i), S_IFREG | 0644, 0, 0,
+                       0, contents(4096)});
+  }
+  entries.push_back({"lib", S_IFDIR | 0755, 0, 0, 0, ""});
+  entries.push_back({"lib/modules", S_IFDIR | 0755, 0, 0, 0, ""});
+  for (int i = 0; i < 40; i++) {
+    entries.push_back({"lib/modules/module" + std::to_string(i) + ".ko",
+                       S_IFREG | 0644, 0, 0, 0, contents(1 << 20)});
+  }
+  return Lz4LegacyCompress(SerializeCpioArchive(std::move(entries)));
+}
+
+const std::string& Ramdisk() {
+  static const std::string* ramdisk = new std::string(MakeRamdisk());
+  return *ramdisk;
+}
+
+void BM_InProcessStripRamdisk(benchmark::State& state) {
+  const auto& ramdisk = Ramdisk();
+  for (auto _ : state) {
+    std::string stripped;
+    CHECK(RemoveRamdiskTree(ramdisk, "lib/modules", &stripped));
+    benchmark::DoNotOptimize(stripped);
+  }
+  state.SetBytesProcessed(state.iterations() * ramdisk.size());
+}
+BENCHMARK(BM_InProcessStripRamdisk)->Unit(benchmark::kMillisecond);
+
+void BM_SubprocessStripRamdisk(benchmark::State& state) {
+  for (const auto& tool : {"lz4", "toybox", "mkbootfs"}) {
+    if (!FileExists(HostBinaryPath(tool))) {
+      state.SkipWithError("Host tools not found");
+      return;
+    }
+  }
+  const auto& ramdisk = Ramdisk();
+  char tmp_template[] = "/tmp/boot_image_benchmark.XXXXXX";
+  std::string dir = mkdtemp(tmp_template);
+  auto ramdisk_fd = SharedFD::Creat(dir + "/ramdisk", 0644);
+  ramdisk_fd->Write(ramdisk.data(), ramdisk.size());
+  ramdisk_fd->Close();
+  const std::string stage = dir + "/stage";
+  for (auto _ : state) {
+    CHECK(execute({"/bin/bash", "-c",
+                   HostBinaryPath("lz4") + " -c -d -l " + dir + "/ramdisk > " +
+                       dir + "/ramdisk.cpio"}) == 0);
+    CHECK(execute({"mkdir", stage}) == 0);
+    CHECK(execute({"/bin/bash", "-c",
+                   "(cd " + stage + " && while " + HostBinaryPath("toybox") +
+                       " cpio -idu; do :; done) < " + dir + "/ramdisk.cpio"}) ==
+          0);
+    CHECK(execute({"rm", "-rf", stage + "/lib/modules"}) == 0);
+    CHECK(execute({"/bin/bash", "-c",
+                   HostBinaryPath("mkbootfs") + " " + stage + " > " + dir +
+                       "/stripped.cpio"}) == 0);
+    CHECK(execute({"/bin/bash", "-c",
+                   HostBinaryPath("lz4") + " -c -l -12 --favor-decSpeed " +
+                       dir + "/stripped.cpio > " + dir + "/stripped"}) == 0);
+    state.PauseTiming();
+    execute({"rm", "-rf", stage});
+    state.ResumeTiming();
+  }
+  state.SetBytesProcessed(state.iterations() * ramdisk.size());
+  execute({"rm", "-rf", dir});
+}
+BENCHMARK(BM_SubprocessStripRamdisk)->Unit(benchmark::kMillisecond);
+
+void BM_RepackVendorBootImage(benchmark::State& state) {
+  VendorBootImage image;
+  image.header_version = 4;
+  image.page_size = 4096;
+  image.kernel_addr = 0x10008000;
+  image.ramdisk_addr = 0x11000000;
+  image.tags_addr = 0x10000100;
+  image.dtb_addr = 0x11f00000;
+  image.vendor_ramdisk = Ramdisk();
+  image.dtb = std::string(64 << 10, 'd');
+  image.bootconfig = "androidboot.hardware=cutf_cvm\n";
+  std::string serialized;
+  CHECK(SerializeVendorBootImage(image, &serialized));
+  for (auto _ : state) {
+    VendorBootImage parsed;
+    CHECK(ParseVendorBootImage(serialized, &parsed));
+    parsed.bootconfig += "androidboot.serialno=CUTTLEFISHCVD01\n";
+    std::string repacked;
+    CHECK(SerializeVendorBootImage(parsed, &repacked));
+    benchmark::DoNotOptimize(repacked);
+  }
+  state.SetBytesProcessed(state.iterations() * serialized.size());
+}
+BENCHMARK(BM_RepackVendorBootImage)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
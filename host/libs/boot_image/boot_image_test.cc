@@ -0,0 +1,467 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "host/libs/boot_image/boot_image.h"
+#include "host/libs/boot_image/cpio.h"
+#include "host/libs/boot_image/lz4_legacy.h"
+
+namespace cuttlefish {
+namespace {
+
+// The offsets below are the ones documented for the boot image headers in
+// system/tools/mkbootimg/include/bootimg/bootimg.h, written out by hand so
+// the tests don't depend on the structs they are checking.
+constexpr size_t kBootPageSize = 4096;
+constexpr size_t kBootHeaderV3Size = 1580;
+constexpr size_t kBootHeaderV4Size = 1584;
+constexpr size_t kVendorHeaderV3Size = 2112;
+constexpr size_t kVendorHeaderV4Size = 2128;
+constexpr size_t kVendorRamdiskTableEntrySize = 108;
+
+uint32_t Le32At(const std::string& data, size_t offset) {
+  uint32_t value = 0;
+  for (int i = 3; i >= 0; i--) {
+    value = (value << 8) | static_cast<uint8_t>(data[offset + i]);
+  }
+  return value;
+}
+
+uint64_t Le64At(const std::string& data, size_t offset) {
+  return Le32At(data, offset) |
+         (static_cast<uint64_t>(Le32At(data, offset + 4)) << 32);
+}
+
+void PutLe32(std::string* data, size_t offset, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    (*data)[offset + i] = static_cast<char>((value >> (8 * i)) & 0xff);
+  }
+}
+
+void PutLe64(std::string* data, size_t offset, uint64_t value) {
+  PutLe32(data, offset, value & 0xffffffff);
+  PutLe32(data, offset + 4, value >> 32);
+}
+
+void PutString(std::string* data, size_t offset, const std::string& value) {
+  data->replace(offset, value.size(), value);
+}
+
+std::string CStringAt(const std::string& data, size_t offset) {
+  return std::string(data.c_str() + offset);
+}
+
+size_t PageAlign(size_t value, size_t page_size) {
+  return (value + page_size - 1) / page_size * page_size;
+}
+
+void AppendPage(std::string* image, const std::string& section,
+                size_t page_size) {
+  image->append(section);
+  image->resize(PageAlign(image->size(), page_size), '\0');
+}
+
+std::string MakeBootImageV3(const std::string& kernel,
+                            const std::string& ramdisk,
+                            const std::string& cmdline) {
+  std::string image(kBootPageSize, '\0');
+  PutString(&image, 0, "ANDROID!");
+  PutLe32(&image, 8, kernel.size());
+  PutLe32(&image, 12, ramdisk.size());
+  PutLe32(&image, 16, 0x1234);
+  PutLe32(&image, 20, kBootHeaderV3Size);
+  PutLe32(&image, 40, 3);
+  PutString(&image, 44, cmdline);
+  AppendPage(&image, kernel, kBootPageSize);
+  AppendPage(&image, ramdisk, kBootPageSize);
+  return image;
+}
+
+struct VendorRamdiskFragment {
+  std::string data;
+  uint32_t type;
+};
+
+std::string MakeVendorBootImage(
+    uint32_t header_version, uint32_t page_size,
+    const std::vector<VendorRamdiskFragment>& fragments,
+    const std::string& dtb, const std::string& bootconfig) {
+  size_t header_size =
+      header_version == 3 ? kVendorHeaderV3Size : kVendorHeaderV4Size;
+  std::string ramdisk, table;
+  for (const auto& fragment : fragments) {
+    std::string entry(kVendorRamdiskTableEntrySize, '\0');
+    PutLe32(&entry, 0, fragment.data.size());
+    PutLe32(&entry, 4, ramdisk.size());
+    PutLe32(&entry, 8, fragment.type);
+    table += entry;
+    ramdisk += fragment.data;
+  }
+  std::string image(header_size, '\0');
+  PutString(&image, 0, "VNDRBOOT");
+  PutLe32(&image, 8, header_version);
+  PutLe32(&image, 12, page_size);
+  PutLe32(&image, 16, 0x00008000);
+  PutLe32(&image, 20, 0x01000000);
+  PutLe32(&image, 24, ramdisk.size());
+  PutString(&image, 28, "console=ttyS0");
+  PutLe32(&image, 2076, 0x00000100);
+  PutString(&image, 2080, "cutf");
+  PutLe32(&image, 2096, header_size);
+  PutLe32(&image, 2100, dtb.size());
+  PutLe64(&image, 2104, 0x1f00000000ull);
+  if (header_version > 3) {
+    PutLe32(&image, 2112, table.size());
+    PutLe32(&image, 2116, fragments.size());
+    PutLe32(&image, 2120, kVendorRamdiskTableEntrySize);
+    PutLe32(&image, 2124, bootconfig.size());
+  }
+  image.resize(PageAlign(image.size(), page_size), '\0');
+  AppendPage(&image, ramdisk, page_size);
+  AppendPage(&image, dtb, page_size);
+  if (header_version > 3) {
+    AppendPage(&image, table, page_size);
+    AppendPage(&image, bootconfig, page_size);
+  }
+  return image;
+}
+
+CpioEntry File(const std::string& name, const std::string& data) {
+  return {name, S_IFREG | 0644, 0, 0, 0, data};
+}
+
+CpioEntry Dir(const std::string& name) {
+  return {name, S_IFDIR | 0755, 0, 0, 0, ""};
+}
+
+std::vector<std::string> Names(const std::vector<CpioEntry>& entries) {
+  std::vector<std::string> names;
+  for (const auto& entry : entries) {
+    names.push_back(entry.name);
+  }
+  return names;
+}
+
+TEST(BootImageTest, ParsesHeaderV3) {
+  BootImage image;
+  ASSERT_TRUE(ParseBootImage(
+      MakeBootImageV3("kernel", "ramdisk", "androidboot.foo=bar"), &image));
+  EXPECT_EQ(image.header_version, 3);
+  EXPECT_EQ(image.os_version, 0x1234);
+  EXPECT_EQ(image.cmdline, "androidboot.foo=bar");
+  EXPECT_EQ(image.kernel, "kernel");
+  EXPECT_EQ(image.ramdisk, "ramdisk");
+}
+
+TEST(BootImageTest, SerializesHeaderV4Layout) {
+  BootImage image;
+  image.header_version = 3;
+  image.os_version = 0x1234;
+  image.cmdline = "androidboot.foo=bar";
+  image.kernel = std::string(kBootPageSize + 1, 'k');
+  image.ramdisk = "ramdisk";
+
+  std::string data;
+  ASSERT_TRUE(SerializeBootImage(image, &data));
+  ASSERT_EQ(data.size(), 4 * kBootPageSize);
+  EXPECT_EQ(data.substr(0, 8), "ANDROID!");
+  EXPECT_EQ(Le32At(data, 8), image.kernel.size());
+  EXPECT_EQ(Le32At(data, 12), image.ramdisk.size());
+  EXPECT_EQ(Le32At(data, 16), 0x1234);
+  EXPECT_EQ(Le32At(data, 20), kBootHeaderV4Size);
+  EXPECT_EQ(Le32At(data, 40), 4);
+  EXPECT_EQ(CStringAt(data, 44), image.cmdline);
+  EXPECT_EQ(Le32At(data, 1580), 0);  // signature_size
+  EXPECT_EQ(data.substr(kBootPageSize, image.kernel.size()), image.kernel);
+  EXPECT_EQ(data.substr(3 * kBootPageSize, image.ramdisk.size()),
+            image.ramdisk);
+}
+
+TEST(BootImageTest, RoundTrips) {
+  BootImage image;
+  ASSERT_TRUE(ParseBootImage(MakeBootImageV3("kernel", "ramdisk", "cmdline"),
+                             &image));
+  std::string data;
+  ASSERT_TRUE(SerializeBootImage(image, &data));
+  BootImage reparsed;
+  ASSERT_TRUE(ParseBootImage(data, &reparsed));
+  EXPECT_EQ(reparsed.header_version, 4);
+  EXPECT_EQ(reparsed.os_version, image.os_version);
+  EXPECT_EQ(reparsed.cmdline, image.cmdline);
+  EXPECT_EQ(reparsed.kernel, image.kernel);
+  EXPECT_EQ(reparsed.ramdisk, image.ramdisk);
+}
+
+TEST(BootImageTest, RejectsOversizedCmdlines) {
+  BootImage image;
+  ASSERT_TRUE(ParseBootImage(MakeBootImageV3("kernel", "ramdisk", ""),
+                             &image));
+  std::string data;
+  // The header has room for 1536 bytes and the terminating null
+  image.cmdline = std::string(1535, 'a');
+  EXPECT_TRUE(SerializeBootImage(image, &data));
+  image.cmdline += "b";
+  EXPECT_FALSE(SerializeBootImage(image, &data));
+}
+
+TEST(BootImageTest, RejectsInvalidImages) {
+  BootImage image;
+  auto data = MakeBootImageV3("kernel", "ramdisk", "");
+  EXPECT_FALSE(ParseBootImage(data.substr(0, kBootPageSize + 2), &image));
+
+  auto bad_magic = data;
+  bad_magic[0] = 'X';
+  EXPECT_FALSE(ParseBootImage(bad_magic, &image));
+
+  auto bad_version = data;
+  PutLe32(&bad_version, 40, 2);
+  EXPECT_FALSE(ParseBootImage(bad_version, &image));
+}
+
+TEST(VendorBootImageTest, ParsesHeaderV3) {
+  VendorBootImage image;
+  ASSERT_TRUE(ParseVendorBootImage(
+      MakeVendorBootImage(3, 2048, {{"ramdisk", 1}}, "dtb", ""), &image));
+  EXPECT_EQ(image.header_version, 3);
+  EXPECT_EQ(image.page_size, 2048);
+  EXPECT_EQ(image.kernel_addr, 0x00008000);
+  EXPECT_EQ(image.ramdisk_addr, 0x01000000);
+  EXPECT_EQ(image.tags_addr, 0x00000100);
+  EXPECT_EQ(image.dtb_addr, 0x1f00000000ull);
+  EXPECT_EQ(image.name, "cutf");
+  EXPECT_EQ(image.cmdline, "console=ttyS0");
+  EXPECT_EQ(image.vendor_ramdisk, "ramdisk");
+  EXPECT_EQ(image.dtb, "dtb");
+  EXPECT_EQ(image.bootconfig, "");
+}
+
+TEST(VendorBootImageTest, ConcatenatesHeaderV4Fragments) {
+  VendorBootImage image;
+  ASSERT_TRUE(ParseVendorBootImage(
+      MakeVendorBootImage(4, 4096, {{"first", 1}, {"second", 2}}, "dtb",
+                          "androidboot.a=b\n"),
+      &image));
+  EXPECT_EQ(image.header_version, 4);
+  EXPECT_EQ(image.vendor_ramdisk, "firstsecond");
+  EXPECT_EQ(image.dtb, "dtb");
+  EXPECT_EQ(image.bootconfig, "androidboot.a=b\n");
+}
+
+TEST(VendorBootImageTest, SerializesHeaderV4Layout) {
+  VendorBootImage image;
+  ASSERT_TRUE(ParseVendorBootImage(
+      MakeVendorBootImage(4, 2048, {{"first", 1}, {"second", 2}}, "dtb",
+                          "androidboot.a=b\n"),
+      &image));
+
+  std::string data;
+  ASSERT_TRUE(SerializeVendorBootImage(image, &data));
+  // header, ramdisk, dtb, ramdisk table and bootconfig, one page each
+  ASSERT_EQ(data.size(), PageAlign(kVendorHeaderV4Size, 2048) + 4 * 2048);
+  EXPECT_EQ(data.substr(0, 8), "VNDRBOOT");
+  EXPECT_EQ(Le32At(data, 8), 4);
+  EXPECT_EQ(Le32At(data, 12), 2048);
+  EXPECT_EQ(Le32At(data, 16), 0x00008000);
+  EXPECT_EQ(Le32At(data, 20), 0x01000000);
+  EXPECT_EQ(Le32At(data, 24), 11);
+  EXPECT_EQ(CStringAt(data, 28), "console=ttyS0");
+  EXPECT_EQ(Le32At(data, 2076), 0x00000100);
+  EXPECT_EQ(CStringAt(data, 2080), "cutf");
+  EXPECT_EQ(Le32At(data, 2096), kVendorHeaderV4Size);
+  EXPECT_EQ(Le32At(data, 2100), 3);
+  EXPECT_EQ(Le64At(data, 2104), 0x1f00000000ull);
+  EXPECT_EQ(Le32At(data, 2112), kVendorRamdiskTableEntrySize);
+  EXPECT_EQ(Le32At(data, 2116), 1);
+  EXPECT_EQ(Le32At(data, 2120), kVendorRamdiskTableEntrySize);
+  EXPECT_EQ(Le32At(data, 2124), 16);
+
+  size_t ramdisk = 4096;
+  EXPECT_EQ(data.substr(ramdisk, 11), "firstsecond");
+  EXPECT_EQ(data.substr(ramdisk + 2048, 3), "dtb");
+  size_t table = ramdisk + 2 * 2048;
+  EXPECT_EQ(Le32At(data, table), 11);     // ramdisk_size
+  EXPECT_EQ(Le32At(data, table + 4), 0);  // ramdisk_offset
+  EXPECT_EQ(Le32At(data, table + 8), 1);  // VENDOR_RAMDISK_TYPE_PLATFORM
+  EXPECT_EQ(data.substr(table + 2048, 16), "androidboot.a=b\n");
+}
+
+TEST(VendorBootImageTest, RoundTrips) {
+  VendorBootImage image;
+  ASSERT_TRUE(ParseVendorBootImage(
+      MakeVendorBootImage(3, 4096, {{"ramdisk", 1}}, "dtb", ""), &image));
+  image.bootconfig = "androidboot.a=b\n";
+  std::string data;
+  ASSERT_TRUE(SerializeVendorBootImage(image, &data));
+  VendorBootImage reparsed;
+  ASSERT_TRUE(ParseVendorBootImage(data, &reparsed));
+  EXPECT_EQ(reparsed.header_version, 4);
+  EXPECT_EQ(reparsed.page_size, image.page_size);
+  EXPECT_EQ(reparsed.kernel_addr, image.kernel_addr);
+  EXPECT_EQ(reparsed.ramdisk_addr, image.ramdisk_addr);
+  EXPECT_EQ(reparsed.tags_addr, image.tags_addr);
+  EXPECT_EQ(reparsed.dtb_addr, image.dtb_addr);
+  EXPECT_EQ(reparsed.name, image.name);
+  EXPECT_EQ(reparsed.cmdline, image.cmdline);
+  EXPECT_EQ(reparsed.vendor_ramdisk, image.vendor_ramdisk);
+  EXPECT_EQ(reparsed.dtb, image.dtb);
+  EXPECT_EQ(reparsed.bootconfig, image.bootconfig);
+}
+
+TEST(VendorBootImageTest, RejectsOversizedStrings) {
+  VendorBootImage image;
+  ASSERT_TRUE(ParseVendorBootImage(
+      MakeVendorBootImage(4, 4096, {{"ramdisk", 1}}, "dtb", ""), &image));
+  std::string data;
+  image.cmdline = std::string(2047, 'a');
+  EXPECT_TRUE(SerializeVendorBootImage(image, &data));
+  // Bootconfig arguments appended to the cmdline can push it over
+  image.cmdline += " androidboot.serialno=CUTTLEFISHCVD01";
+  EXPECT_FALSE(SerializeVendorBootImage(image, &data));
+
+  image.cmdline = "console=ttyS0";
+  image.name = std::string(16, 'n');
+  EXPECT_FALSE(SerializeVendorBootImage(image, &data));
+}
+
+TEST(VendorBootImageTest, RejectsTruncatedImages) {
+  auto data = MakeVendorBootImage(4, 4096, {{"ramdisk", 1}}, "dtb", "a=b\n");
+  VendorBootImage image;
+  EXPECT_FALSE(ParseVendorBootImage(data.substr(0, data.size() - 4096 + 2),
+                                    &image));
+  EXPECT_FALSE(ParseVendorBootImage(data.substr(0, 100), &image));
+}
+
+TEST(CpioTest, RoundTripsInTraversalOrder) {
+  std::vector<CpioEntry> entries = {
+      File("lib/modules/b.ko", "b"),
+      Dir("lib"),
+      File("init", "#!/bin/sh"),
+      Dir("lib/modules"),
+      File("lib/modules/a.ko", "aaaaa"),
+      {"bin", S_IFLNK | 0777, 0, 0, 0, "system/bin"},
+      Dir("lib-extra"),
+  };
+  auto archive = SerializeCpioArchive(entries);
+  EXPECT_EQ(archive.substr(0, 6), "070701");
+  EXPECT_EQ(archive.size() % 256, 0);
+
+  std::vector<CpioEntry> parsed;
+  ASSERT_TRUE(ParseCpioArchives(archive, &parsed));
+  EXPECT_EQ(Names(parsed),
+            (std::vector<std::string>{"bin", "init", "lib", "lib/modules",
+                                      "lib/modules/a.ko", "lib/modules/b.ko",
+                                      "lib-extra"}));
+  EXPECT_EQ(parsed[0].mode, S_IFLNK | 0777);
+  EXPECT_EQ(parsed[0].data, "system/bin");
+  EXPECT_EQ(parsed[4].data, "aaaaa");
+  EXPECT_EQ(parsed[4].mode, S_IFREG | 0644);
+}
+
+TEST(CpioTest, LaterArchivesReplaceEntries) {
+  auto first = SerializeCpioArchive({Dir("etc"), File("etc/a", "old"),
+                                     File("etc/b", "kept")});
+  auto second = SerializeCpioArchive({File("./etc/a", "new")});
+  std::vector<CpioEntry> parsed;
+  ASSERT_TRUE(ParseCpioArchives(first + second, &parsed));
+  EXPECT_EQ(Names(parsed),
+            (std::vector<std::string>{"etc", "etc/a", "etc/b"}));
+  EXPECT_EQ(parsed[1].data, "new");
+  EXPECT_EQ(parsed[2].data, "kept");
+}
+
+TEST(CpioTest, RemovesTree) {
+  std::vector<CpioEntry> entries = {
+      Dir("lib"), Dir("lib/modules"), File("lib/modules/a.ko", "a"),
+      File("lib/modules.txt", "kept"), Dir("lib/modules2"),
+  };
+  RemoveCpioTree("./lib/modules/", &entries);
+  EXPECT_EQ(Names(entries), (std::vector<std::string>{
+                                "lib", "lib/modules.txt", "lib/modules2"}));
+}
+
+TEST(CpioTest, RejectsTruncatedArchives) {
+  auto archive = SerializeCpioArchive({File("a", std::string(100, 'a'))});
+  std::vector<CpioEntry> parsed;
+  EXPECT_FALSE(ParseCpioArchives(archive.substr(0, 150), &parsed));
+  EXPECT_FALSE(ParseCpioArchives("070701garbage", &parsed));
+}
+
+TEST(Lz4LegacyTest, RoundTripsSeveralBlocks) {
+  // More than one 8MB block
+  std::string data;
+  for (size_t i = 0; data.size() < (9 << 20); i++) {
+    data += std::to_string(i * 7919);
+  }
+  auto compressed = Lz4LegacyCompress(data);
+  EXPECT_EQ(Le32At(compressed, 0), 0x184C2102);
+  EXPECT_LT(compressed.size(), data.size());
+  std::string decompressed;
+  ASSERT_TRUE(Lz4LegacyDecompress(compressed, &decompressed));
+  EXPECT_EQ(decompressed, data);
+}
+
+TEST(Lz4LegacyTest, DecompressesPaddedConcatenatedFrames) {
+  // As found in the vendor ramdisk when fragments are page aligned
+  auto first = Lz4LegacyCompress("first fragment");
+  first.resize(PageAlign(first.size(), 4096), '\0');
+  auto second = Lz4LegacyCompress("second fragment");
+  std::string decompressed;
+  ASSERT_TRUE(Lz4LegacyDecompress(first + second, &decompressed));
+  EXPECT_EQ(decompressed, "first fragmentsecond fragment");
+
+  // Padding that doesn't end on a word boundary
+  for (size_t padding = 1; padding < 4; padding++) {
+    decompressed.clear();
+    auto unaligned = Lz4LegacyCompress("first fragment");
+    unaligned.append(padding, '\0');
+    ASSERT_TRUE(Lz4LegacyDecompress(unaligned + second, &decompressed))
+        << padding;
+    EXPECT_EQ(decompressed, "first fragmentsecond fragment");
+  }
+}
+
+TEST(Lz4LegacyTest, RejectsCorruptInput) {
+  auto compressed = Lz4LegacyCompress(std::string(1000, 'a'));
+  std::string decompressed;
+  EXPECT_FALSE(Lz4LegacyDecompress(compressed.substr(4), &decompressed));
+  EXPECT_FALSE(Lz4LegacyDecompress(
+      compressed.substr(0, compressed.size() - 1), &decompressed));
+}
+
+TEST(RamdiskTest, RemovesTreeFromCompressedRamdisk) {
+  auto ramdisk = Lz4LegacyCompress(SerializeCpioArchive(
+      {Dir("lib"), Dir("lib/modules"), File("lib/modules/a.ko", "module"),
+       File("init", "init")}));
+  std::string stripped;
+  ASSERT_TRUE(RemoveRamdiskTree(ramdisk, "lib/modules", &stripped));
+
+  std::string cpio;
+  ASSERT_TRUE(Lz4LegacyDecompress(stripped, &cpio));
+  std::vector<CpioEntry> entries;
+  ASSERT_TRUE(ParseCpioArchives(cpio, &entries));
+  EXPECT_EQ(Names(entries), (std::vector<std::string>{"init", "lib"}));
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/boot_image/cpio.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <map>
+
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kNewcMagic[] = "070701";
+constexpr size_t kHeaderSize = 110;
+constexpr char kTrailerName[] = "TRAILER!!!";
+// mkbootfs starts numbering inodes here.
+constexpr uint32_t kFirstInode = 300000;
+
+size_t Align4(size_t value) { return (value + 3) & ~static_cast<size_t>(3); }
+
+bool ParseHexField(const std::string& data, size_t offset, uint32_t* value) {
+  uint32_t result = 0;
+  for (size_t i = 0; i < 8; i++) {
+    char c = data[offset + i];
+    result <<= 4;
+    if (c >= '0' && c <= '9') {
+      result |= c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      result |= c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      result |= c - 'A' + 10;
+    } else {
+      return false;
+    }
+  }
+  *value = result;
+  return true;
+}
+
+std::string NormalizeName(std::string name) {
+  while (android::base::StartsWith(name, "./")) {
+    name = name.substr(2);
+  }
+  while (!name.empty() && name.back() == '/') {
+    name.pop_back();
+  }
+  return name;
+}
+
+// Orders paths the way a sorted depth first directory traversal visits them:
+// component by component, so that a directory precedes its children.
+bool TraversalOrder(const CpioEntry& a, const CpioEntry& b) {
+  auto a_parts = android::base::Split(a.name, "/");
+  auto b_parts = android::base::Split(b.name, "/");
+  return std::lexicographical_compare(a_parts.begin(), a_parts.end(),
+                                      b_parts.begin(), b_parts.end());
+}
+
+void AppendHeader(std::string* out, uint32_t ino, const CpioEntry& entry,
+                  uint32_t nlink, uint32_t mtime) {
+  char header[kHeaderSize + 1];
+  snprintf(header, sizeof(header),
+           "%s%08x%08x%08x%08x%08x%08x%08zx%08x%08x%08x%08x%08zx%08x",
+           kNewcMagic, ino, entry.mode, entry.uid, entry.gid, nlink, mtime,
+           entry.data.size(), 0, 0, 0, 0, entry.name.size() + 1, 0);
+  out->append(header, kHeaderSize);
+  out->append(entry.name);
+  out->push_back('\0');
+  out->resize(Align4(out->size()), '\0');
+  out->append(entry.data);
+  out->resize(Align4(out->size()), '\0');
+}
+
+}  // namespace
+
+bool ParseCpioArchives(const std::string& data,
+                       std::vector<CpioEntry>* entries) {
+  std::map<std::string, size_t> index;
+  for (size_t i = 0; i < entries->size(); i++) {
+    index[(*entries)[i].name] = i;
+  }
+  size_t pos = 0;
+  while (pos < data.size()) {
+    // Archives may be separated by zero padding.
+    if (data[pos] == '\0') {
+      pos++;
+      continue;
+    }
+    if (pos + kHeaderSize > data.size() ||
+        data.compare(pos, 6, kNewcMagic) != 0) {
+      LOG(ERROR) << "Invalid cpio header at offset " << pos;
+      return false;
+    }
+    uint32_t fields[13];
+    for (size_t i = 0; i < 13; i++) {
+      if (!ParseHexField(data, pos + 6 + 8 * i, &fields[i])) {
+        LOG(ERROR) << "Invalid cpio header field at offset " << pos;
+        return false;
+      }
+    }
+    uint32_t mode = fields[1];
+    uint32_t file_size = fields[6];
+    uint32_t name_size = fields[11];
+    size_t name_pos = pos + kHeaderSize;
+    size_t data_pos = Align4(name_pos + name_size);
+    size_t next_pos = Align4(data_pos + file_size);
+    if (name_size == 0 || data_pos + file_size > data.size()) {
+      LOG(ERROR) << "Truncated cpio entry at offset " << pos;
+      return false;
+    }
+    std::string name = data.substr(name_pos, name_size - 1);
+    pos = std::min(next_pos, data.size());
+    if (name == kTrailerName) {
+      continue;
+    }
+    name = NormalizeName(name);
+    if (name.empty() || name == ".") {
+      continue;
+    }
+    if (!S_ISREG(mode) && !S_ISDIR(mode) && !S_ISLNK(mode)) {
+      LOG(DEBUG) << "Skipping special file \"" << name << "\" in ramdisk";
+      continue;
+    }
+    CpioEntry entry;
+    entry.name = name;
+    entry.mode = mode;
+    entry.uid = fields[2];
+    entry.gid = fields[3];
+    entry.mtime = fields[5];
+    entry.data = data.substr(data_pos, file_size);
+    auto it = index.find(name);
+    if (it != index.end()) {
+      (*entries)[it->second] = std::move(entry);
+    } else {
+      index[name] = entries->size();
+      entries->emplace_back(std::move(entry));
+    }
+  }
+  return true;
+}
+
+void RemoveCpioTree(const std::string& path, std::vector<CpioEntry>* entries) {
+  auto prefix = NormalizeName(path) + "/";
+  auto removed = std::remove_if(
+      entries->begin(), entries->end(), [&prefix](const CpioEntry& entry) {
+        return entry.name + "/" == prefix ||
+               android::base::StartsWith(entry.name, prefix);
+      });
+  entries->erase(removed, entries->end());
+}
+
+std::string SerializeCpioArchive(std::vector<CpioEntry> entries) {
+  std::sort(entries.begin(), entries.end(), TraversalOrder);
+  size_t total_size = 0;
+  for (const auto& entry : entries) {
+    total_size += Align4(kHeaderSize + entry.name.size() + 1) +
+                  Align4(entry.data.size());
+  }
+  std::string out;
+  out.reserve(total_size + 512);
+  uint32_t ino = kFirstInode;
+  for (const auto& entry : entries) {
+    AppendHeader(&out, ino++, entry, 1, 0);
+  }
+  CpioEntry trailer{kTrailerName, 0, 0, 0, 0, ""};
+  AppendHeader(&out, ino, trailer, 0, 0);
+  out.resize((out.size() + 0xff) & ~static_cast<size_t>(0xff), '\0');
+  return out;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace cuttlefish {
+
+/**
+ * An entry of a "newc" (SVR4 without CRC) cpio archive, the format produced
+ * by mkbootfs and consumed by the kernel when unpacking an initramfs.
+ */
+struct CpioEntry {
+  std::string name;
+  uint32_t mode;
+  uint32_t uid;
+  uint32_t gid;
+  uint32_t mtime;
+  // File contents, or the link target for symlinks.
+  std::string data;
+};
+
+/**
+ * Parses one or more concatenated cpio archives, as found in a ramdisk built
+ * from several fragments. Entries of later archives replace entries with the
+ * same name from earlier ones, matching `cpio -idu` run over the whole input.
+ * Only regular files, directories and symlinks are kept.
+ */
+bool ParseCpioArchives(const std::string& data, std::vector<CpioEntry>* entries);
+
+/**
+ * Removes `path` and everything below it, like `rm -rf path` on an extracted
+ * ramdisk.
+ */
+void RemoveCpioTree(const std::string& path, std::vector<CpioEntry>* entries);
+
+/**
+ * Serializes the entries the way mkbootfs does: sorted depth first by name,
+ * with sequential inode numbers, zeroed timestamps and the output padded to a
+ * multiple of 256 bytes.
+ */
+std::string SerializeCpioArchive(std::vector<CpioEntry> entries);
+
+}  // namespace cuttlefish
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/boot_image/lz4_legacy.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <android-base/logging.h>
+#include <lz4.h>
+#include <lz4hc.h>
+
+namespace cuttlefish {
+namespace {
+
+constexpr uint32_t kLegacyMagic = 0x184C2102;
+// The legacy format always uses 8MB uncompressed blocks.
+constexpr size_t kLegacyBlockSize = 8 << 20;
+
+uint32_t ReadLe32(const char* data) {
+  auto bytes = reinterpret_cast<const uint8_t*>(data);
+  return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) |
+         (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+void AppendLe32(std::string* out, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    out->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+}  // namespace
+
+bool Lz4LegacyDecompress(const std::string& in, std::string* out) {
+  size_t pos = 0;
+  bool in_frame = false;
+  while (pos < in.size()) {
+    if (!in_frame && in[pos] == '\0') {
+      // Zero padding between frames, e.g. from page aligned ramdisk
+      // fragments. It needn't be a multiple of the word size.
+      pos++;
+      continue;
+    }
+    if (pos + 4 > in.size()) {
+      break;
+    }
+    uint32_t word = ReadLe32(in.data() + pos);
+    pos += 4;
+    if (word == kLegacyMagic) {
+      // Start of a new (possibly concatenated) frame.
+      in_frame = true;
+      continue;
+    }
+    if (!in_frame) {
+      LOG(ERROR) << "Missing lz4 legacy magic at offset " << pos - 4;
+      return false;
+    }
+    if (word == 0) {
+      // The frame ends where the padding starts
+      in_frame = false;
+      continue;
+    }
+    bool valid_size =
+        word <= static_cast<uint32_t>(LZ4_compressBound(kLegacyBlockSize)) &&
+        pos + word <= in.size();
+    if (!valid_size && in[pos - 4] == '\0') {
+      // Padding shorter than a word followed by the next frame's magic reads
+      // as a block size too large to be one.
+      in_frame = false;
+      pos -= 4;
+      continue;
+    }
+    if (!valid_size) {
+      LOG(ERROR) << "Invalid lz4 legacy block size " << word << " at offset "
+                 << pos - 4;
+      return false;
+    }
+    size_t out_pos = out->size();
+    out->resize(out_pos + kLegacyBlockSize);
+    int decompressed =
+        LZ4_decompress_safe(in.data() + pos, out->data() + out_pos, word,
+                            kLegacyBlockSize);
+    if (decompressed < 0) {
+      LOG(ERROR) << "Corrupt lz4 legacy block at offset " << pos - 4;
+      out->resize(out_pos);
+      return false;
+    }
+    out->resize(out_pos + decompressed);
+    pos += word;
+  }
+  if (std::any_of(in.begin() + pos, in.end(), [](char c) { return c != 0; })) {
+    LOG(ERROR) << "Truncated lz4 legacy stream";
+    return false;
+  }
+  return true;
+}
+
+std::string Lz4LegacyCompress(const std::string& in, int level) {
+  std::string out;
+  size_t num_blocks = (in.size() + kLegacyBlockSize - 1) / kLegacyBlockSize;
+  out.reserve(4 + num_blocks * (4 + LZ4_compressBound(kLegacyBlockSize)));
+  AppendLe32(&out, kLegacyMagic);
+  for (size_t pos = 0; pos < in.size(); pos += kLegacyBlockSize) {
+    int block_size = std::min(kLegacyBlockSize, in.size() - pos);
+    size_t header_pos = out.size();
+    AppendLe32(&out, 0);
+    int bound = LZ4_compressBound(block_size);
+    out.resize(header_pos + 4 + bound);
+    int compressed = LZ4_compress_HC(in.data() + pos,
+                                     out.data() + header_pos + 4, block_size,
+                                     bound, level);
+    CHECK(compressed > 0) << "lz4 compression failed";
+    out.resize(header_pos + 4 + compressed);
+    for (int i = 0; i < 4; i++) {
+      out[header_pos + i] = static_cast<char>((compressed >> (8 * i)) & 0xff);
+    }
+  }
+  return out;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <string>
+
+namespace cuttlefish {
+
+/**
+ * In-memory equivalents of `lz4 -d -l` and `lz4 -l -12`, operating on the
+ * legacy lz4 frame format understood by the kernel's initramfs unpacker.
+ */
+
+// Decompresses one or more concatenated legacy lz4 frames, optionally
+// separated by zero padding, appending the decompressed bytes to `out`.
+// Returns false if the input is malformed.
+bool Lz4LegacyDecompress(const std::string& in, std::string* out);
+
+// Compresses `in` into a single legacy lz4 frame at the given HC level.
+std::string Lz4LegacyCompress(const std::string& in, int level = 12);
+
+}  // namespace cuttlefish
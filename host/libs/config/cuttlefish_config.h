@@ -456,6 +456,19 @@ class CuttlefishConfig {
     std::string factory_reset_protected_path() const;
 
     std::string persistent_bootconfig_path() const;
+
+    // Host placement chosen by the placement planner. The NUMA node is -1
+    // and the cpu list empty when the instance is not bound.
+    int numa_node() const;
+    // In the kernel's cpulist format. With exclusive cpus there is one host
+    // cpu per vCPU, in vCPU order.
+    std::string cpu_affinity() const;
+    // Where the instance's host processes run, in the cpulist format. Leaves
+    // out the cores other instances are pinned to.
+    std::string host_cpu_affinity() const;
+    bool exclusive_cpus() const;
+    // Whether guest memory should be backed by huge pages.
+    bool hugepages() const;
   };
 
   // A view into an existing CuttlefishConfig object for a particular instance.
@@ -509,6 +522,12 @@ class CuttlefishConfig {
     void set_gnss_grpc_proxy_server_port(int gnss_grpc_proxy_server_port);
     // Gnss grpc proxy local file path
     void set_gnss_file_path(const std::string &gnss_file_path);
+    // Host placement
+    void set_numa_node(int numa_node);
+    void set_cpu_affinity(const std::string& cpu_affinity);
+    void set_host_cpu_affinity(const std::string& host_cpu_affinity);
+    void set_exclusive_cpus(bool exclusive_cpus);
+    void set_hugepages(bool hugepages);
   };
 
  private:
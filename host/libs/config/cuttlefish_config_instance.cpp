@@ -157,6 +157,52 @@ void CuttlefishConfig::MutableInstanceSpecific::set_modem_simulator_ports(
   (*Dictionary())[kModemSimulatorPorts] = modem_simulator_ports;
 }
 
+static constexpr char kNumaNode[] = "numa_node";
+int CuttlefishConfig::InstanceSpecific::numa_node() const {
+  if (!Dictionary()->isMember(kNumaNode)) {
+    return -1;
+  }
+  return (*Dictionary())[kNumaNode].asInt();
+}
+void CuttlefishConfig::MutableInstanceSpecific::set_numa_node(int numa_node) {
+  (*Dictionary())[kNumaNode] = numa_node;
+}
+
+static constexpr char kCpuAffinity[] = "cpu_affinity";
+std::string CuttlefishConfig::InstanceSpecific::cpu_affinity() const {
+  return (*Dictionary())[kCpuAffinity].asString();
+}
+void CuttlefishConfig::MutableInstanceSpecific::set_cpu_affinity(
+    const std::string& cpu_affinity) {
+  (*Dictionary())[kCpuAffinity] = cpu_affinity;
+}
+
+static constexpr char kHostCpuAffinity[] = "host_cpu_affinity";
+std::string CuttlefishConfig::InstanceSpecific::host_cpu_affinity() const {
+  return (*Dictionary())[kHostCpuAffinity].asString();
+}
+void CuttlefishConfig::MutableInstanceSpecific::set_host_cpu_affinity(
+    const std::string& host_cpu_affinity) {
+  (*Dictionary())[kHostCpuAffinity] = host_cpu_affinity;
+}
+
+static constexpr char kExclusiveCpus[] = "exclusive_cpus";
+bool CuttlefishConfig::InstanceSpecific::exclusive_cpus() const {
+  return (*Dictionary())[kExclusiveCpus].asBool();
+}
+void CuttlefishConfig::MutableInstanceSpecific::set_exclusive_cpus(
+    bool exclusive_cpus) {
+  (*Dictionary())[kExclusiveCpus] = exclusive_cpus;
+}
+
+static constexpr char kHugepages[] = "hugepages";
+bool CuttlefishConfig::InstanceSpecific::hugepages() const {
+  return (*Dictionary())[kHugepages].asBool();
+}
+void CuttlefishConfig::MutableInstanceSpecific::set_hugepages(bool hugepages) {
+  (*Dictionary())[kHugepages] = hugepages;
+}
+
 std::string CuttlefishConfig::InstanceSpecific::launcher_log_path() const {
   return AbsolutePath(PerInstancePath("launcher.log"));
 }
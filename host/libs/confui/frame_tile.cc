@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/confui/frame_tile.h"
+
+namespace cuttlefish {
+namespace confui {
+namespace {
+/*
+ * multiplies all four channels by factor / 255, rounded
+ *
+ * red and blue, then alpha and green, are computed two at a time in the
+ * halves of a 32 bit integer, which keeps the loops below free of branches
+ * so the compiler vectorises them.
+ */
+inline std::uint32_t ScaleChannels(std::uint32_t pixel, std::uint32_t factor) {
+  std::uint32_t rb = (pixel & 0x00ff00ff) * factor + 0x00800080;
+  rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+  std::uint32_t ag = ((pixel >> 8) & 0x00ff00ff) * factor + 0x00800080;
+  ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+  return rb | ag;
+}
+}  // namespace
+
+std::uint32_t Premultiply(std::uint32_t color) {
+  const auto alpha = color >> 24;
+  return (ScaleChannels(color, alpha) & 0x00ffffff) | (alpha << 24);
+}
+
+std::uint32_t BlendOver(std::uint32_t dst, std::uint32_t premultiplied_src) {
+  // no channel of a premultiplied pixel exceeds its alpha, so this can't
+  // carry into the next channel
+  return premultiplied_src +
+         ScaleChannels(dst, 255 - (premultiplied_src >> 24));
+}
+
+FrameTile::FrameTile(std::uint32_t x, std::uint32_t y, std::uint32_t width,
+                     std::uint32_t height, std::uint32_t background)
+    : x_(x),
+      y_(y),
+      width_(width),
+      height_(height),
+      pixels_(width * height, Premultiply(background)) {}
+
+bool FrameTile::DrawPixel(std::uint32_t x, std::uint32_t y,
+                          std::uint32_t color) {
+  if (x < x_ || y < y_ || x - x_ >= width_ || y - y_ >= height_) {
+    return false;
+  }
+  auto& pixel = pixels_[(y - y_) * width_ + (x - x_)];
+  pixel = BlendOver(pixel, Premultiply(color));
+  return true;
+}
+
+void FrameTile::BlitOnto(TeeUiFrame& frame, std::uint32_t frame_width) const {
+  for (std::uint32_t row = 0; row < height_; row++) {
+    const auto* src = pixels_.data() + row * width_;
+    auto* dst = frame.data() + (y_ + row) * frame_width + x_;
+    for (std::uint32_t col = 0; col < width_; col++) {
+      dst[col] = BlendOver(dst[col], src[col]);
+    }
+  }
+}
+
+}  // end of namespace confui
+}  // end of namespace cuttlefish
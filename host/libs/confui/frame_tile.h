@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "host/libs/confui/server_common.h"
+
+namespace cuttlefish {
+namespace confui {
+
+/**
+ * A rectangle of the confirmation UI screen holding premultiplied ARGB
+ * pixels, in the 0xAARRGGBB layout teeui uses for its colors.
+ *
+ * A tile starts fully transparent, or filled with an opaque background,
+ * and teeui elements are drawn into it once. The result can then be
+ * composited onto any number of frames.
+ */
+class FrameTile {
+ public:
+  FrameTile(std::uint32_t x, std::uint32_t y, std::uint32_t width,
+            std::uint32_t height, std::uint32_t background = 0);
+
+  /**
+   * blends a straight alpha teeui color over the pixel at (x, y), given
+   * in screen coordinates
+   *
+   * returns false if the pixel lies outside the tile
+   */
+  bool DrawPixel(std::uint32_t x, std::uint32_t y, std::uint32_t color);
+
+  // composites the tile over a frame of the given width
+  void BlitOnto(TeeUiFrame& frame, std::uint32_t frame_width) const;
+
+  std::uint32_t X() const { return x_; }
+  std::uint32_t Y() const { return y_; }
+  std::uint32_t Width() const { return width_; }
+  std::uint32_t Height() const { return height_; }
+  const TeeUiFrame& Pixels() const { return pixels_; }
+
+ private:
+  std::uint32_t x_;
+  std::uint32_t y_;
+  std::uint32_t width_;
+  std::uint32_t height_;
+  TeeUiFrame pixels_;
+};
+
+// color with its channels scaled by its alpha
+std::uint32_t Premultiply(std::uint32_t color);
+
+// a premultiplied pixel drawn over another
+std::uint32_t BlendOver(std::uint32_t dst, std::uint32_t premultiplied_src);
+
+}  // end of namespace confui
+}  // end of namespace cuttlefish
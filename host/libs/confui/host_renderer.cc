@@ -18,39 +18,48 @@
 
 namespace cuttlefish {
 namespace confui {
-static teeui::Color alfaCombineChannel(std::uint32_t shift, double alfa,
-                                       teeui::Color a, teeui::Color b) {
-  a >>= shift;
-  a &= 0xff;
-  b >>= shift;
-  b &= 0xff;
-  double acc = alfa * a + (1 - alfa) * b;
-  if (acc <= 0) return 0;
-  std::uint32_t result = acc;
-  if (result > 255) return 255 << shift;
-  return result << shift;
-}
 
 ConfUiRenderer::ConfUiRenderer(const std::uint32_t display)
     : display_num_(display),
       lang_id_{"en"},
       prompt_("Am I Yumi Meow?"),
-      current_height_(ScreenConnectorInfo::ScreenHeight(display_num_)),
-      current_width_(ScreenConnectorInfo::ScreenWidth(display_num_)),
+      current_height_(ScreenConnectorInfo::ScreenHeight(display)),
+      current_width_(ScreenConnectorInfo::ScreenWidth(display)),
+      color_bg_{kColorBackground},
+      color_text_{kColorDisabled},
+      shield_color_{kColorShield},
+      is_inverted_{false},
+      ctx_{GetDeviceContext()} {
+  RenderRawFrame(prompt_, lang_id_);
+}
+
+ConfUiRenderer::ConfUiRenderer(const std::uint32_t width,
+                               const std::uint32_t height)
+    : fixed_size_(ScreenSize{width, height}),
+      lang_id_{"en"},
+      prompt_("Am I Yumi Meow?"),
+      current_height_(height),
+      current_width_(width),
       color_bg_{kColorBackground},
       color_text_{kColorDisabled},
       shield_color_{kColorShield},
       is_inverted_{false},
       ctx_{GetDeviceContext()} {
-  auto opted_frame = RepaintRawFrame(prompt_, lang_id_);
-  if (opted_frame) {
-    raw_frame_ = std::move(opted_frame.value());
+  RenderRawFrame(prompt_, lang_id_);
+}
+
+ConfUiRenderer::ScreenSize ConfUiRenderer::GetScreenSize() const {
+  if (fixed_size_) {
+    return *fixed_size_;
   }
+  return {ScreenConnectorInfo::ScreenWidth(*display_num_),
+          ScreenConnectorInfo::ScreenHeight(*display_num_)};
 }
 
 void ConfUiRenderer::SetConfUiMessage(const std::string& msg) {
   prompt_ = msg;
-  SetText<LabelConfMsg>(msg);
+  // the label keeps pointing to the text
+  SetText<LabelConfMsg>(prompt_);
 }
 
 teeui::Error ConfUiRenderer::SetLangId(const std::string& lang_id) {
@@ -68,9 +77,6 @@ teeui::Error ConfUiRenderer::UpdateTranslations() {
   if (auto error = UpdateString<LabelOK>()) {
     return error;
   }
-  if (auto error = UpdateString<LabelOK>()) {
-    return error;
-  }
   if (auto error = UpdateString<LabelCancel>()) {
     return error;
   }
@@ -85,10 +91,8 @@ teeui::Error ConfUiRenderer::UpdateTranslations() {
 
 teeui::context<teeui::ConUIParameters> ConfUiRenderer::GetDeviceContext() {
   using namespace teeui;
-  const unsigned long long w = ScreenConnectorInfo::ScreenWidth(display_num_);
-  const unsigned long long h = ScreenConnectorInfo::ScreenHeight(display_num_);
-  const auto screen_width = operator""_px(w);
-  const auto screen_height = operator""_px(h);
+  const auto screen_width = operator""_px(current_width_);
+  const auto screen_height = operator""_px(current_height_);
   context<teeui::ConUIParameters> ctx(6.45211, 400.0 / 412.0);
   ctx.setParam<RightEdgeOfScreen>(screen_width);
   ctx.setParam<BottomOfScreen>(screen_height);
@@ -98,83 +102,105 @@ teeui::context<teeui::ConUIParameters> ConfUiRenderer::GetDeviceContext() {
   ctx.setParam<VolUpButtonBottom>(50.26_mm);
   ctx.setParam<DefaultFontSize>(14_dp);
   ctx.setParam<BodyFontSize>(16_dp);
+  UpdateColorScheme(&ctx);
   return ctx;
 }
 
 bool ConfUiRenderer::InitLayout(const std::string& lang_id) {
   layout_ = teeui::instantiateLayout(teeui::ConfUILayout(), ctx_);
-  SetLangId(lang_id);
-  if (auto error = UpdateTranslations()) {
+  if (auto error = SetLangId(lang_id)) {
     ConfUiLog(ERROR) << "Update Translation Error";
     return false;
   }
-  UpdateColorScheme(&ctx_);
+  auto color = kColorEnabled;
+  std::get<teeui::LabelOK>(layout_).setTextColor(color);
+  std::get<teeui::LabelCancel>(layout_).setTextColor(color);
+  SetConfUiMessage(prompt_);
   return true;
 }
 
-teeui::Error ConfUiRenderer::UpdatePixels(TeeUiFrame& raw_frame,
-                                          std::uint32_t x, std::uint32_t y,
-                                          teeui::Color color) {
-  auto buffer = raw_frame.data();
-  const auto height = ScreenConnectorInfo::ScreenHeight(display_num_);
-  const auto width = ScreenConnectorInfo::ScreenWidth(display_num_);
-  auto pos = width * y + x;
-  if (pos >= (height * width)) {
-    ConfUiLog(ERROR) << "Rendering Out of Bound";
-    return teeui::Error::OutOfBoundsDrawing;
-  }
-  const double alfa = ((color & 0xff000000) >> 24) / 255.0;
-  auto& pixel = *reinterpret_cast<teeui::Color*>(buffer + pos);
-  pixel = alfaCombineChannel(0, alfa, color, pixel) |
-          alfaCombineChannel(8, alfa, color, pixel) |
-          alfaCombineChannel(16, alfa, color, pixel);
-  return teeui::Error::OK;
+teeui::PixelDrawer ConfUiRenderer::MakeTileDrawer(FrameTile& tile) {
+  return teeui::makePixelDrawer(
+      [&tile](std::uint32_t x, std::uint32_t y,
+              teeui::Color color) -> teeui::Error {
+        if (!tile.DrawPixel(x, y, color)) {
+          ConfUiLog(ERROR) << "Rendering Out of Bound";
+          return teeui::Error::OutOfBoundsDrawing;
+        }
+        return teeui::Error::OK;
+      });
 }
 
 std::tuple<TeeUiFrame&, bool> ConfUiRenderer::RenderRawFrame(
     const std::string& confirmation_msg, const std::string& lang_id) {
-  /* we repaint only if one or more of the followng meet:
-   *
-   *  1. raw_frame_ is empty
-   *  2. the current_width_ and current_height_ is out of date
-   *  3. lang_id is different (e.g. new locale)
-   *
-   *  in the future, maybe you wanna inverted, new background, etc?
-   */
-  if (lang_id != lang_id_ || !IsFrameReady() ||
-      current_height_ != ScreenConnectorInfo::ScreenHeight(display_num_) ||
-      current_width_ != ScreenConnectorInfo::ScreenWidth(display_num_)) {
-    auto opted_new_frame = RepaintRawFrame(confirmation_msg, lang_id_);
-    if (opted_new_frame) {
-      // repainting from the scratch successful in a new frame
-      raw_frame_ = std::move(opted_new_frame.value());
-      return {raw_frame_, true};
-    }
-    // repaint failed even if it was necessary, so returns invalid values
+  const auto screen_size = GetScreenSize();
+  if (current_width_ != screen_size.width ||
+      current_height_ != screen_size.height) {
+    // every cached tile is laid out for the old size
+    current_width_ = screen_size.width;
+    current_height_ = screen_size.height;
+    ctx_ = GetDeviceContext();
+    layout_tiles_.clear();
+    message_tiles_.clear();
+  }
+  const FrameTile* layout_tile = GetLayoutTile(lang_id);
+  const FrameTile* message_tile =
+      layout_tile ? GetMessageTile(confirmation_msg) : nullptr;
+  if (!message_tile) {
+    // returns invalid values
     raw_frame_.clear();
     return {raw_frame_, false};
   }
-  // no need to repaint from the scratch. repaint the confirmation message only
-  // the frame is mostly already in raw_frame_
-  auto ret_code = RenderConfirmationMsgOnly(confirmation_msg);
-  return {raw_frame_, (ret_code == teeui::Error::OK)};
+  raw_frame_ = layout_tile->Pixels();
+  message_tile->BlitOnto(raw_frame_, current_width_);
+  return {raw_frame_, true};
 }
 
-std::optional<TeeUiFrame> ConfUiRenderer::RepaintRawFrame(
-    const std::string& confirmation_msg, const std::string& lang_id) {
-  /*
-   * NOTE: DON'T use current_width_/height_ to create this frame
-   * it may fail, and then we must not mess up the current_width_, height_
-   *
-   */
+const FrameTile* ConfUiRenderer::GetLayoutTile(const std::string& lang_id) {
+  auto it = std::find_if(
+      layout_tiles_.begin(), layout_tiles_.end(),
+      [&lang_id](const auto& entry) { return entry.first == lang_id; });
+  if (it != layout_tiles_.end()) {
+    layout_tiles_.splice(layout_tiles_.begin(), layout_tiles_, it);
+    return &layout_tiles_.front().second;
+  }
+  auto tile = RenderLayoutTile(lang_id);
+  if (!tile) {
+    return nullptr;
+  }
+  layout_tiles_.emplace_front(lang_id, std::move(*tile));
+  if (layout_tiles_.size() > kMaxCachedLayouts) {
+    layout_tiles_.pop_back();
+  }
+  return &layout_tiles_.front().second;
+}
+
+const FrameTile* ConfUiRenderer::GetMessageTile(
+    const std::string& confirmation_msg) {
+  auto it = std::find_if(message_tiles_.begin(), message_tiles_.end(),
+                         [&confirmation_msg](const auto& entry) {
+                           return entry.first == confirmation_msg;
+                         });
+  if (it != message_tiles_.end()) {
+    message_tiles_.splice(message_tiles_.begin(), message_tiles_, it);
+    return &message_tiles_.front().second;
+  }
+  auto tile = RenderMessageTile(confirmation_msg);
+  if (!tile) {
+    return nullptr;
+  }
+  message_tiles_.emplace_front(confirmation_msg, std::move(*tile));
+  if (message_tiles_.size() > kMaxCachedMessages) {
+    message_tiles_.pop_back();
+  }
+  return &message_tiles_.front().second;
+}
+
+std::optional<FrameTile> ConfUiRenderer::RenderLayoutTile(
+    const std::string& lang_id) {
   if (!InitLayout(lang_id)) {
     return std::nullopt;
   }
-  SetConfUiMessage(confirmation_msg);
-  auto color = kColorEnabled;
-  std::get<teeui::LabelOK>(layout_).setTextColor(color);
-  std::get<teeui::LabelCancel>(layout_).setTextColor(color);
-
   /* in the future, if ever we need to register a handler for the
      Label{OK,Cancel}. do this: std::get<teeui::LabelOK>(layout_)
      .setCB(teeui::makeCallback<teeui::Error, teeui::Event>(
@@ -185,60 +211,32 @@ std::optional<TeeUiFrame> ConfUiRenderer::RepaintRawFrame(
   */
   // we manually check if click happened, where if yes, and generate the label
   // event manually. So we won't register the handler here.
-  /**
-   * should be uint32_t for teeui APIs.
-   * It assumes that each raw frame buffer element is 4 bytes
-   */
-  TeeUiFrame new_raw_frame(
-      ScreenConnectorInfo::ScreenSizeInBytes(display_num_) / 4,
-      kColorBackground);
-
-  auto draw_pixel = teeui::makePixelDrawer(
-      [this, &new_raw_frame](std::uint32_t x, std::uint32_t y,
-                             teeui::Color color) -> teeui::Error {
-        return this->UpdatePixels(new_raw_frame, x, y, color);
-      });
-
-  // render all components
-  const auto error = drawElements(layout_, draw_pixel);
+  FrameTile tile(0, 0, current_width_, current_height_, color_bg_);
+  // everything but the message
+  using namespace teeui;
+  const auto error =
+      DrawElements<LabelOK, IconPower, LabelCancel, IconVolUp, IconShield,
+                   LabelTitle, LabelHint>(MakeTileDrawer(tile));
   if (error) {
     ConfUiLog(ERROR) << "Painting failed: " << error.code();
     return std::nullopt;
   }
-
-  // set current frame's dimension as frame generation was successful
-  current_height_ = ScreenConnectorInfo::ScreenHeight(display_num_);
-  current_width_ = ScreenConnectorInfo::ScreenWidth(display_num_);
-
-  return {new_raw_frame};
+  return tile;
 }
 
-teeui::Error ConfUiRenderer::RenderConfirmationMsgOnly(
+std::optional<FrameTile> ConfUiRenderer::RenderMessageTile(
     const std::string& confirmation_msg) {
-  // repaint labelbody on the raw_frame__ only
-  auto callback_func = [this](std::uint32_t x, std::uint32_t y,
-                              teeui::Color color) -> teeui::Error {
-    return UpdatePixels(raw_frame_, x, y, color);
-  };
-  auto draw_pixel = teeui::makePixelDrawer(callback_func);
-  LabelConfMsg& label = std::get<LabelConfMsg>(layout_);
-  auto b = GetBoundary(label);
-  for (std::uint32_t i = 0; i != b.w; i++) {
-    const auto col_index = i + b.x - 1;
-    for (std::uint32_t j = 0; j != b.y; j++) {
-      const auto row_index = (j + b.y - 1);
-      raw_frame_[current_width_ * row_index + col_index] = color_bg_;
-    }
-  }
-
+  // the message label doesn't depend on the language, any layout will do
   SetConfUiMessage(confirmation_msg);
-  ConfUiLog(DEBUG) << "Repaint Confirmation Msg with :" << prompt_;
-  if (auto error = std::get<LabelConfMsg>(layout_).draw(draw_pixel)) {
-    ConfUiLog(ERROR) << "Repainting Confirmation Message Label failed:"
+  ConfUiLog(DEBUG) << "Render Confirmation Msg with :" << prompt_;
+  auto& label = std::get<LabelConfMsg>(layout_);
+  auto tile = MakeTile(label);
+  if (auto error = label.draw(MakeTileDrawer(tile))) {
+    ConfUiLog(ERROR) << "Painting Confirmation Message Label failed:"
                      << error.code();
-    return error;
+    return std::nullopt;
   }
-  return teeui::Error::OK;
+  return tile;
 }
 
 }  // end of namespace confui
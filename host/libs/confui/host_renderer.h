@@ -16,17 +16,22 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <functional>
+#include <list>
 #include <memory>
+#include <optional>
 #include <string>
 #include <tuple>
+#include <utility>
 #include <vector>
 
 #include <freetype/ftglyph.h>  // $(croot)/external/freetype
 #include <teeui/utils.h>       // $(croot)/system/teeui/libteeui/.../include
 
 #include "common/libs/confui/confui.h"
+#include "host/libs/confui/frame_tile.h"
 #include "host/libs/confui/layouts/layout.h"
 #include "host/libs/confui/server_common.h"
 #include "host/libs/screen_connector/screen_connector.h"
@@ -36,21 +41,21 @@ namespace confui {
 
 /**
  * create a raw frame for confirmation UI dialog
+ *
+ * The parts of the dialog that don't depend on the prompt are rendered once
+ * per language into a full screen tile, and each prompt message once into a
+ * tile of its label. A frame is a copy of the former with the latter blended
+ * on top, so repeated prompts and languages skip teeui altogether.
  */
 class ConfUiRenderer {
  public:
   using LabelConfMsg = teeui::LabelBody;
 
   ConfUiRenderer(const std::uint32_t display);
+  // renders frames of a fixed size, not tied to any display
+  ConfUiRenderer(const std::uint32_t width, const std::uint32_t height);
 
   /**
-   * this does not repaint from the scratch all the time
-   *
-   * Unless repainting the whole thing is needed, it remove the message
-   * label, and re-draw there. There seems yet no fancy way of doing this.
-   * Thus, it repaint the background color on the top of the label, and
-   * draw the label on the new background
-   *
    * As HostRenderer is intended to be shared across sessions, HostRender
    * owns the buffer, and returns reference to the buffer. Note that no
    * 2 or more sessions are concurrently executed. Only 1 or 0 is active
@@ -62,58 +67,63 @@ class ConfUiRenderer {
   bool IsFrameReady() const { return !raw_frame_.empty(); }
 
  private:
-  struct Boundary {            // inclusive but.. LayoutElement's size is float
-    std::uint32_t x, y, w, h;  // (x, y) is the top left
+  struct ScreenSize {
+    std::uint32_t width;
+    std::uint32_t height;
   };
 
+  // so many languages or prompts are hardly used in a row
+  static constexpr std::size_t kMaxCachedLayouts = 4;
+  static constexpr std::size_t kMaxCachedMessages = 16;
+
+  ScreenSize GetScreenSize() const;
+
+  // the tile covering the area a layout element may draw on
   template <typename LayoutElement>
-  Boundary GetBoundary(LayoutElement&& e) {
+  FrameTile MakeTile(const LayoutElement& e) const {
     auto box = e.bounds_;
-    Boundary b;
-    // (x,y) is left top. so floor() makes sense
-    // w, h are witdh and height in float. perhaps ceiling makes more
-    // sense
-    b.x = static_cast<std::uint32_t>(box.x().floor().count());
-    b.y = static_cast<std::uint32_t>(box.y().floor().count());
-    b.w = static_cast<std::uint32_t>(box.w().ceil().count());
-    b.h = static_cast<std::uint32_t>(box.h().ceil().count());
-    return b;
+    // (x,y) is left top. so floor() makes sense, the far edges are rounded
+    // up and include the pixels on them, not to lose any partially covered
+    auto x = static_cast<std::uint32_t>(box.x().floor().count());
+    auto y = static_cast<std::uint32_t>(box.y().floor().count());
+    auto right = static_cast<std::uint32_t>((box.x() + box.w()).ceil().count());
+    auto bottom =
+        static_cast<std::uint32_t>((box.y() + box.h()).ceil().count());
+    right = std::min(right + 1, current_width_);
+    bottom = std::min(bottom + 1, current_height_);
+    x = std::min(x, right);
+    y = std::min(y, bottom);
+    return FrameTile(x, y, right - x, bottom - y);
   }
 
-  // essentially, to repaint from the scratch, so returns new frame
-  // when successful. Or, nullopt
-  std::optional<TeeUiFrame> RepaintRawFrame(const std::string& confirmation_msg,
-                                            const std::string& lang_id = "en");
+  // the cached tiles, rendered first if they are missing
+  const FrameTile* GetLayoutTile(const std::string& lang_id);
+  const FrameTile* GetMessageTile(const std::string& confirmation_msg);
+
+  std::optional<FrameTile> RenderLayoutTile(const std::string& lang_id);
+  std::optional<FrameTile> RenderMessageTile(
+      const std::string& confirmation_msg);
 
   bool InitLayout(const std::string& lang_id);
   teeui::Error UpdateTranslations();
   /**
    * could be confusing. update prompt_, and update the text_ in the Label
-   * object, the GUI components. This does not render immediately. And..
-   * to render it, we must clean up the existing dirty pixels, which
-   * this method does not do.
+   * object, the GUI components. This does not render immediately.
    */
   void SetConfUiMessage(const std::string& s);
   teeui::Error SetLangId(const std::string& lang_id);
   teeui::context<teeui::ConUIParameters> GetDeviceContext();
 
-  // effectively, will be send to teeui as a callback function
-  teeui::Error UpdatePixels(TeeUiFrame& buffer, std::uint32_t x,
-                            std::uint32_t y, teeui::Color color);
-
   // from Trusty
-  // second param is for type deduction
   template <typename... Elements>
-  static teeui::Error drawElements(std::tuple<Elements...>& layout,
-                                   const teeui::PixelDrawer& drawPixel) {
+  teeui::Error DrawElements(const teeui::PixelDrawer& drawPixel) {
     // Error::operator|| is overloaded, so we don't get short circuit
     // evaluation. But we get the first error that occurs. We will still try and
     // draw the remaining elements in the order they appear in the layout tuple.
-    return (std::get<Elements>(layout).draw(drawPixel) || ...);
+    return (std::get<Elements>(layout_).draw(drawPixel) || ...);
   }
 
-  // repaint the confirmation UI label only
-  teeui::Error RenderConfirmationMsgOnly(const std::string& confirmation_msg);
+  static teeui::PixelDrawer MakeTileDrawer(FrameTile& tile);
 
   // from Trusty
   template <typename Context>
@@ -154,7 +164,8 @@ class ConfUiRenderer {
     return Error::OK;
   }
 
-  const int display_num_;
+  const std::optional<std::uint32_t> display_num_;
+  const std::optional<ScreenSize> fixed_size_;
   teeui::layout_t<teeui::ConfUILayout> layout_;
   std::string lang_id_;
   std::string prompt_;  // confirmation ui message
@@ -166,6 +177,9 @@ class ConfUiRenderer {
   teeui::Color shield_color_;
   bool is_inverted_;
   teeui::context<teeui::ConUIParameters> ctx_;
+  // most recently used first
+  std::list<std::pair<std::string, FrameTile>> layout_tiles_;
+  std::list<std::pair<std::string, FrameTile>> message_tiles_;
 
   static constexpr const teeui::Color kColorEnabled = 0xff212121;
   static constexpr const teeui::Color kColorDisabled = 0xffbdbdbd;
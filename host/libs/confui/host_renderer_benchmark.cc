@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Time to the first frame of a confirmation prompt, for a fresh renderer and
+// for prompts and languages that are or aren't cached yet.
+
+#include <string>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+
+#include "host/libs/confui/host_renderer.h"
+
+namespace cuttlefish {
+namespace confui {
+namespace {
+
+constexpr std::uint32_t kWidth = 720;
+constexpr std::uint32_t kHeight = 1280;
+
+const std::vector<std::string> kLanguages = {"en", "fr", "de", "es",
+                                             "it", "ja", "ko", "pt"};
+
+std::string Prompt(std::int64_t i) {
+  return "Transfer " + std::to_string(i) + " coins to account #" +
+         std::to_string(i * 7919 % 100000) + "?";
+}
+
+void Render(ConfUiRenderer& renderer, const std::string& prompt,
+            const std::string& lang_id) {
+  auto [frame, is_success] = renderer.RenderRawFrame(prompt, lang_id);
+  CHECK(is_success);
+  benchmark::DoNotOptimize(frame.data());
+}
+
+// Nothing cached, the renderer of a fresh host process
+void BM_FirstFrame(benchmark::State& state) {
+  std::int64_t i = 0;
+  for (auto _ : state) {
+    ConfUiRenderer renderer(kWidth, kHeight);
+    Render(renderer, Prompt(i++), "en");
+  }
+}
+BENCHMARK(BM_FirstFrame)->Unit(benchmark::kMillisecond);
+
+// A new prompt in a language shown before
+void BM_NewPrompt(benchmark::State& state) {
+  ConfUiRenderer renderer(kWidth, kHeight);
+  std::int64_t i = 0;
+  for (auto _ : state) {
+    Render(renderer, Prompt(i++), "en");
+  }
+}
+BENCHMARK(BM_NewPrompt)->Unit(benchmark::kMillisecond);
+
+// The same few prompts over and over, as tests show them
+void BM_RepeatedPrompt(benchmark::State& state) {
+  ConfUiRenderer renderer(kWidth, kHeight);
+  std::int64_t i = 0;
+  for (auto _ : state) {
+    Render(renderer, Prompt(i++ % 4), "en");
+  }
+}
+BENCHMARK(BM_RepeatedPrompt)->Unit(benchmark::kMillisecond);
+
+// The same prompt cycling through the given number of languages
+void BM_SwitchLanguage(benchmark::State& state) {
+  ConfUiRenderer renderer(kWidth, kHeight);
+  const auto languages = static_cast<std::size_t>(state.range(0));
+  std::size_t i = 0;
+  for (auto _ : state) {
+    Render(renderer, Prompt(0), kLanguages[i++ % languages]);
+  }
+}
+BENCHMARK(BM_SwitchLanguage)->Arg(2)->Arg(8)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace confui
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
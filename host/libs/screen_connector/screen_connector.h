@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <cstdint>
@@ -38,6 +39,7 @@
 #include "host/libs/confui/host_utils.h"
 #include "host/libs/screen_connector/screen_connector_common.h"
 #include "host/libs/screen_connector/screen_connector_queue.h"
+#include "host/libs/screen_connector/shm_frame_ring.h"
 #include "host/libs/screen_connector/wayland_screen_connector.h"
 
 namespace cuttlefish {
@@ -68,8 +70,12 @@ class ScreenConnector : public ScreenConnectorInfo,
       /* ScImpl enqueues this type into the Q */
       ProcessedFrameType& msg)>;
 
+  // Frames are shared with other processes through a socket named
+  // `frame_ring_socket_name` in the instance internal directory, which must be
+  // different for every frontend.
   static std::unique_ptr<ScreenConnector<ProcessedFrameType>> Get(
-      const int frames_fd, HostModeCtrl& host_mode_ctrl) {
+      const int frames_fd, HostModeCtrl& host_mode_ctrl,
+      const std::string& frame_ring_socket_name) {
     auto config = cuttlefish::CuttlefishConfig::Get();
     ScreenConnector<ProcessedFrameType>* raw_ptr = nullptr;
     if (config->gpu_mode() == cuttlefish::kGpuModeDrmVirgl ||
@@ -80,6 +86,7 @@ class ScreenConnector : public ScreenConnectorInfo,
     } else {
       LOG(FATAL) << "Invalid gpu mode: " << config->gpu_mode();
     }
+    raw_ptr->StartFrameRing(frame_ring_socket_name);
     return std::unique_ptr<ScreenConnector<ProcessedFrameType>>(raw_ptr);
   }
 
@@ -168,8 +175,34 @@ class ScreenConnector : public ScreenConnectorInfo,
         cp_of_streamer_callback = callback_from_streamer_;
       }
       GenerateProcessedFrameCallbackImpl callback_for_sc_impl =
-          std::bind(cp_of_streamer_callback, std::placeholders::_1,
-                    std::placeholders::_2, std::ref(processed_frame));
+          [this, &cp_of_streamer_callback, &processed_frame](
+              std::uint32_t display_number, std::uint32_t frame_width,
+              std::uint32_t frame_height, std::uint32_t frame_stride_bytes,
+              std::uint8_t* frame_pixels,
+              std::chrono::steady_clock::time_point capture_time) {
+            processed_frame.capture_time_ = capture_time;
+            processed_frame.display_number_ = display_number;
+            if (display_number >= screen_count_) {
+              LOG(ERROR) << "Dropping a frame for display " << display_number
+                         << ", only " << screen_count_ << " are configured";
+              processed_frame.is_success_ = false;
+              return;
+            }
+            // Frames are read with the configured size of the display, a
+            // different buffer would be read past its end.
+            if (frame_width != ScreenWidth(display_number) ||
+                frame_height != ScreenHeight(display_number) ||
+                frame_stride_bytes != ScreenStrideBytes(display_number)) {
+              LOG(ERROR) << "Dropping a " << frame_width << "x" << frame_height
+                         << " frame with a stride of " << frame_stride_bytes
+                         << " bytes for display " << display_number;
+              processed_frame.is_success_ = false;
+              return;
+            }
+            PublishToFrameRing(display_number, frame_pixels);
+            cp_of_streamer_callback(display_number, frame_pixels,
+                                    processed_frame);
+          };
       ConfUiLog(VERBOSE) << cuttlefish::confui::thread::GetName(
                                 std::this_thread::get_id())
                          << " calling Android OnNextFrame. "
@@ -209,10 +242,12 @@ class ScreenConnector : public ScreenConnectorInfo,
       return false;
     }
     ProcessedFrameType processed_frame;
+    processed_frame.capture_time_ = std::chrono::steady_clock::now();
     auto this_thread_name = cuttlefish::confui::thread::GetName();
     ConfUiLog(DEBUG) << this_thread_name
                      << "is sending a #" + std::to_string(render_confui_cnt_)
                      << "Conf UI frame";
+    PublishToFrameRing(display, raw_frame);
     callback_from_streamer_(display, raw_frame, processed_frame);
     // now add processed_frame to the queue
     sc_confui_queue_.PushBack(std::move(processed_frame));
@@ -233,6 +268,7 @@ class ScreenConnector : public ScreenConnectorInfo,
   ScreenConnector(std::unique_ptr<T>&& impl, HostModeCtrl& host_mode_ctrl)
       : sc_android_src_{std::move(impl)},
         host_mode_ctrl_{host_mode_ctrl},
+        screen_count_{ScreenCount()},
         on_next_frame_cnt_{0},
         render_confui_cnt_{0},
         sc_android_queue_{sc_sem_},
@@ -240,9 +276,46 @@ class ScreenConnector : public ScreenConnectorInfo,
   ScreenConnector() = delete;
 
  private:
+  // Enough for a reader to process one frame while the next is written.
+  static constexpr std::uint32_t kFrameRingSlots = 3;
+
+  /*
+   * Shares the frames with other processes, such as recorders or screenshot
+   * tools, through a ring in shared memory. Readers get it from a socket in
+   * the instance internal directory.
+   */
+  void StartFrameRing(const std::string& socket_name) {
+    auto config = cuttlefish::CuttlefishConfig::Get();
+    std::uint64_t max_frame_size = 0;
+    for (std::uint32_t i = 0; i < ScreenCount(); i++) {
+      max_frame_size = std::max<std::uint64_t>(max_frame_size,
+                                               ScreenSizeInBytes(i));
+    }
+    frame_ring_ = ShmFrameRingWriter::Create(kFrameRingSlots, max_frame_size);
+    if (!frame_ring_) {
+      LOG(ERROR) << "Frames won't be shared with other processes";
+      return;
+    }
+    auto path =
+        config->ForDefaultInstance().PerInstanceInternalPath(socket_name);
+    if (!frame_ring_->ServeReaders(path)) {
+      frame_ring_.reset();
+    }
+  }
+
+  void PublishToFrameRing(std::uint32_t display_number,
+                          const std::uint8_t* frame_pixels) {
+    if (frame_ring_) {
+      frame_ring_->Publish(display_number, ScreenWidth(display_number),
+                           ScreenHeight(display_number),
+                           ScreenStrideBytes(display_number), frame_pixels);
+    }
+  }
+
   // either socket_based or wayland
   std::unique_ptr<ScreenConnectorSource> sc_android_src_;
   HostModeCtrl& host_mode_ctrl_;
+  const std::uint32_t screen_count_;
   unsigned long long int on_next_frame_cnt_;
   unsigned long long int render_confui_cnt_;
   Semaphore sc_sem_;
@@ -252,6 +325,8 @@ class ScreenConnector : public ScreenConnectorInfo,
   std::thread sc_android_frame_fetching_thread_;
   std::mutex streamer_callback_mutex_; // mutex to set & read callback_from_streamer_
   std::condition_variable streamer_callback_set_cv_;
+  // Owns the thread serving the ring to readers, stopped on destruction.
+  std::unique_ptr<ShmFrameRingWriter> frame_ring_;
 };
 
 }  // namespace cuttlefish
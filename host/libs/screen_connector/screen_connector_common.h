@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <type_traits>
@@ -34,8 +35,11 @@ struct is_movable {
 };
 
 // this callback type is going directly to socket-based or wayland ScreenConnector
-using GenerateProcessedFrameCallbackImpl = std::function<void(std::uint32_t /*display_number*/,
-                                                              std::uint8_t* /*frame_pixels*/)>;
+using GenerateProcessedFrameCallbackImpl = std::function<void(
+    std::uint32_t /*display_number*/, std::uint32_t /*frame_width*/,
+    std::uint32_t /*frame_height*/, std::uint32_t /*frame_stride_bytes*/,
+    std::uint8_t* /*frame_pixels*/,
+    std::chrono::steady_clock::time_point /*capture_time*/)>;
 
 class ScreenConnectorSource {
  public:
@@ -94,6 +98,8 @@ struct ScreenConnectorFrameRenderer {
 struct ScreenConnectorFrameInfo {
   std::uint32_t display_number_;
   bool is_success_;
+  // When the guest committed the frame, on the monotonic clock.
+  std::chrono::steady_clock::time_point capture_time_;
 };
 
 }  // namespace cuttlefish
@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/screen_connector/shm_frame_ring.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstring>
+
+#include <android-base/cmsg.h>
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+
+#include "common/libs/utils/size_utils.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::uint32_t kRingMagic = 0x52464643;  // "CFFR"
+constexpr std::uint32_t kRingVersion = 1;
+// Both headers take a whole cache line so the pixels stay aligned.
+constexpr std::uint64_t kHeaderSize = 64;
+
+struct RingHeader {
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint32_t slot_count;
+  std::uint32_t reserved;
+  std::uint64_t slot_size;
+  std::uint64_t max_frame_size;
+  // Incremented after every frame, readers wait on it with a futex.
+  std::atomic<std::uint32_t> futex_word;
+  std::uint32_t reserved2;
+  std::atomic<std::uint64_t> latest_frame_number;
+};
+static_assert(sizeof(RingHeader) <= kHeaderSize);
+
+struct SlotHeader {
+  // Odd while the slot is being written.
+  std::atomic<std::uint32_t> sequence;
+  std::uint32_t reserved;
+  ShmFrameMetadata metadata;
+};
+static_assert(sizeof(SlotHeader) <= kHeaderSize);
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free &&
+                  std::atomic<std::uint64_t>::is_always_lock_free,
+              "The ring is shared with other processes");
+
+std::uint64_t MonotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+std::uint64_t SlotOffset(const RingHeader* header, std::uint64_t frame_number) {
+  return kHeaderSize +
+         ((frame_number - 1) % header->slot_count) * header->slot_size;
+}
+
+// The ring is mapped at different addresses in every process, so the futex
+// must not be private.
+int FutexWait(const std::atomic<std::uint32_t>* word, std::uint32_t value,
+              const struct timespec* timeout) {
+  return syscall(SYS_futex, word, FUTEX_WAIT, value, timeout, nullptr, 0);
+}
+
+int FutexWake(std::atomic<std::uint32_t>* word) {
+  return syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+}  // namespace
+
+std::unique_ptr<ShmFrameRingWriter> ShmFrameRingWriter::Create(
+    std::uint32_t slot_count, std::uint64_t max_frame_size) {
+  CHECK(slot_count > 0) << "The frame ring needs at least one slot";
+  auto slot_size =
+      AlignToPowerOf2(kHeaderSize + max_frame_size, PARTITION_SIZE_SHIFT);
+  auto size = kHeaderSize + slot_count * slot_size;
+  auto memfd = SharedFD::MemfdCreate("cuttlefish_frame_ring",
+                                     MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (!memfd->IsOpen()) {
+    LOG(ERROR) << "Failed to create the frame ring: " << memfd->StrError();
+    return {};
+  }
+  if (memfd->Truncate(size) < 0) {
+    LOG(ERROR) << "Failed to resize the frame ring to " << size
+               << " bytes: " << memfd->StrError();
+    return {};
+  }
+  // Readers rely on the size, and a shrinking memfd would SIGBUS them.
+  if (memfd->Fcntl(F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0) {
+    LOG(ERROR) << "Failed to seal the frame ring: " << memfd->StrError();
+    return {};
+  }
+  auto mapping = memfd->MMap(nullptr, size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, 0);
+  if (!mapping) {
+    LOG(ERROR) << "Failed to map the frame ring: " << memfd->StrError();
+    return {};
+  }
+  // Only the mapping above stays writable. Without this a reader could reopen
+  // its descriptor through /proc read-write and corrupt the ring.
+  if (memfd->Fcntl(F_ADD_SEALS, F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0) {
+    LOG(ERROR) << "Failed to seal the frame ring: " << memfd->StrError();
+    return {};
+  }
+  auto header = new (mapping.get()) RingHeader{
+      .magic = kRingMagic,
+      .version = kRingVersion,
+      .slot_count = slot_count,
+      .slot_size = slot_size,
+      .max_frame_size = max_frame_size,
+  };
+  header->futex_word = 0;
+  header->latest_frame_number = 0;
+  return std::unique_ptr<ShmFrameRingWriter>(
+      new ShmFrameRingWriter(memfd, std::move(mapping)));
+}
+
+ShmFrameRingWriter::ShmFrameRingWriter(SharedFD memfd, ScopedMMap mapping)
+    : memfd_(memfd), mapping_(std::move(mapping)) {}
+
+ShmFrameRingWriter::~ShmFrameRingWriter() {
+  if (server_thread_.joinable()) {
+    stopping_ = true;
+    // Makes the pending accept fail.
+    server_->Shutdown(SHUT_RDWR);
+    server_thread_.join();
+  }
+}
+
+void ShmFrameRingWriter::Publish(std::uint32_t display_number,
+                                 std::uint32_t width, std::uint32_t height,
+                                 std::uint32_t stride_bytes,
+                                 const std::uint8_t* pixels) {
+  if (!readers_connected_) {
+    return;
+  }
+  auto base = reinterpret_cast<std::uint8_t*>(mapping_.get());
+  auto header = reinterpret_cast<RingHeader*>(base);
+  std::uint64_t size = static_cast<std::uint64_t>(stride_bytes) * height;
+  if (size > header->max_frame_size) {
+    LOG(ERROR) << "Frame of " << size << " bytes doesn't fit in the ring";
+    return;
+  }
+  std::lock_guard<std::mutex> lock(publish_mutex_);
+  auto frame_number = next_frame_number_++;
+  auto slot_base = base + SlotOffset(header, frame_number);
+  auto slot = reinterpret_cast<SlotHeader*>(slot_base);
+
+  auto sequence = slot->sequence.load(std::memory_order_relaxed);
+  slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot->metadata = {
+      .frame_number = frame_number,
+      .timestamp_ns = MonotonicNs(),
+      .display_number = display_number,
+      .width = width,
+      .height = height,
+      .stride_bytes = stride_bytes,
+      .size_bytes = static_cast<std::uint32_t>(size),
+  };
+  std::memcpy(slot_base + kHeaderSize, pixels, size);
+  slot->sequence.store(sequence + 2, std::memory_order_release);
+
+  header->latest_frame_number.store(frame_number, std::memory_order_release);
+  header->futex_word.fetch_add(1, std::memory_order_release);
+  FutexWake(&header->futex_word);
+}
+
+SharedFD ShmFrameRingWriter::ReadOnlyFd() const {
+  // Reopening the memfd through /proc gives a descriptor that can't be mapped
+  // writable. The seals stop it from being reopened writable in turn.
+  int fd = memfd_->UNMANAGED_Dup();
+  if (fd < 0) {
+    return SharedFD();
+  }
+  auto read_only =
+      SharedFD::Open("/proc/self/fd/" + std::to_string(fd), O_RDONLY);
+  close(fd);
+  return read_only;
+}
+
+bool ShmFrameRingWriter::ServeReaders(const std::string& path) {
+  CHECK(!server_thread_.joinable()) << "Already serving readers";
+  server_ = SharedFD::SocketLocalServer(path, false, SOCK_STREAM, 0600);
+  if (!server_->IsOpen()) {
+    LOG(ERROR) << "Unable to create the frame ring socket at " << path << ": "
+               << server_->StrError();
+    return false;
+  }
+  server_thread_ = std::thread([this]() { ServeLoop(); });
+  return true;
+}
+
+void ShmFrameRingWriter::ServeLoop() {
+  while (true) {
+    auto client = SharedFD::Accept(*server_);
+    if (!client->IsOpen()) {
+      if (!stopping_) {
+        LOG(ERROR) << "Failed to accept a frame ring reader: "
+                   << server_->StrError();
+      }
+      return;
+    }
+    auto fd = ReadOnlyFd();
+    if (!fd->IsOpen()) {
+      LOG(ERROR) << "Failed to reopen the frame ring: " << fd->StrError();
+      continue;
+    }
+    char unused = 0;
+    if (client->SendFileDescriptors(&unused, sizeof(unused), fd) < 0) {
+      LOG(ERROR) << "Failed to send the frame ring: " << client->StrError();
+      continue;
+    }
+    readers_connected_ = true;
+  }
+}
+
+std::unique_ptr<ShmFrameRingReader> ShmFrameRingReader::Create(SharedFD fd) {
+  struct stat st;
+  if (fd->Fstat(&st) < 0) {
+    LOG(ERROR) << "Failed to stat the frame ring: " << fd->StrError();
+    return {};
+  }
+  auto size = static_cast<std::uint64_t>(st.st_size);
+  auto mapping = fd->MMap(nullptr, size, PROT_READ, MAP_SHARED, 0);
+  if (!mapping) {
+    LOG(ERROR) << "Failed to map the frame ring: " << fd->StrError();
+    return {};
+  }
+  auto header = reinterpret_cast<const RingHeader*>(mapping.get());
+  if (size < kHeaderSize || header->magic != kRingMagic ||
+      header->version != kRingVersion || header->slot_count == 0 ||
+      header->slot_size < kHeaderSize + header->max_frame_size ||
+      kHeaderSize + header->slot_count * header->slot_size > size) {
+    LOG(ERROR) << "The frame ring is corrupted or of an unknown version";
+    return {};
+  }
+  return std::unique_ptr<ShmFrameRingReader>(
+      new ShmFrameRingReader(fd, std::move(mapping)));
+}
+
+std::unique_ptr<ShmFrameRingReader> ShmFrameRingReader::Connect(
+    const std::string& path) {
+  auto socket = SharedFD::SocketLocalClient(path, false, SOCK_STREAM);
+  if (!socket->IsOpen()) {
+    LOG(ERROR) << "Failed to connect to " << path << ": "
+               << socket->StrError();
+    return {};
+  }
+  android::base::unique_fd socket_fd(socket->UNMANAGED_Dup());
+  char unused;
+  std::vector<android::base::unique_fd> fds;
+  if (android::base::ReceiveFileDescriptorVector(
+          socket_fd.get(), &unused, sizeof(unused), 1, &fds) <= 0 ||
+      fds.size() != 1) {
+    PLOG(ERROR) << "Failed to receive the frame ring from " << path;
+    return {};
+  }
+  auto fd = SharedFD::Dup(fds[0].get());
+  return Create(fd);
+}
+
+ShmFrameRingReader::ShmFrameRingReader(SharedFD fd, ScopedMMap mapping)
+    : fd_(fd), mapping_(std::move(mapping)) {}
+
+std::uint64_t ShmFrameRingReader::LatestFrameNumber() const {
+  auto header = reinterpret_cast<const RingHeader*>(mapping_.get());
+  return header->latest_frame_number.load(std::memory_order_acquire);
+}
+
+bool ShmFrameRingReader::WaitForFrameAfter(
+    std::uint64_t frame_number, std::chrono::milliseconds timeout) const {
+  auto header = reinterpret_cast<const RingHeader*>(mapping_.get());
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (true) {
+    // Read the futex word first, a frame published after this load changes it
+    // and makes the wait return immediately.
+    auto word = header->futex_word.load(std::memory_order_acquire);
+    if (LatestFrameNumber() > frame_number) {
+      return true;
+    }
+    auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if (remaining.count() <= 0) {
+      return false;
+    }
+    struct timespec wait_time = {
+        .tv_sec = static_cast<time_t>(remaining.count() / 1000000000),
+        .tv_nsec = static_cast<long>(remaining.count() % 1000000000),
+    };
+    if (FutexWait(&header->futex_word, word, &wait_time) < 0 &&
+        errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT) {
+      PLOG(ERROR) << "Failed to wait for a frame";
+      return false;
+    }
+  }
+}
+
+bool ShmFrameRingReader::ReadFrame(std::uint64_t frame_number,
+                                   const FrameConsumer& consumer) const {
+  if (frame_number == 0) {
+    return false;
+  }
+  auto base = reinterpret_cast<const std::uint8_t*>(mapping_.get());
+  auto header = reinterpret_cast<const RingHeader*>(base);
+  auto slot_base = base + SlotOffset(header, frame_number);
+  auto slot = reinterpret_cast<const SlotHeader*>(slot_base);
+
+  auto sequence = slot->sequence.load(std::memory_order_acquire);
+  if (sequence & 1) {
+    return false;
+  }
+  ShmFrameMetadata metadata = slot->metadata;
+  if (metadata.frame_number != frame_number ||
+      metadata.size_bytes > header->max_frame_size) {
+    return false;
+  }
+  consumer(metadata, slot_base + kHeaderSize);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot->sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+bool ShmFrameRingReader::CopyLatestFrame(
+    ShmFrameMetadata* metadata, std::vector<std::uint8_t>* pixels) const {
+  while (true) {
+    auto frame_number = LatestFrameNumber();
+    if (frame_number == 0) {
+      return false;
+    }
+    auto copy = [metadata, pixels](const ShmFrameMetadata& frame_metadata,
+                                   const std::uint8_t* frame_pixels) {
+      *metadata = frame_metadata;
+      pixels->assign(frame_pixels, frame_pixels + frame_metadata.size_bytes);
+    };
+    if (ReadFrame(frame_number, copy)) {
+      return true;
+    }
+  }
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+
+// Names of the sockets, in the instance internal directory, that hand out the
+// frame ring of each frontend to other processes.
+constexpr char kWebRtcFrameRingSocketName[] = "webrtc_frame_ring.sock";
+constexpr char kVncFrameRingSocketName[] = "vnc_frame_ring.sock";
+
+struct ShmFrameMetadata {
+  // Starts at 1 and increases by one with every published frame, across all
+  // displays.
+  std::uint64_t frame_number;
+  // CLOCK_MONOTONIC time at which the frame was published.
+  std::uint64_t timestamp_ns;
+  std::uint32_t display_number;
+  std::uint32_t width;
+  std::uint32_t height;
+  std::uint32_t stride_bytes;
+  std::uint32_t size_bytes;
+};
+
+/**
+ * Publishes display frames into a ring of slots in a memfd that any number of
+ * processes can map read-only.
+ *
+ * Every slot is guarded by a sequence lock, so the writer never waits for the
+ * readers. A reader that is too slow sees the slot it was reading get
+ * overwritten and skips to a newer frame. New frames are announced through a
+ * futex in the shared memory.
+ */
+class ShmFrameRingWriter {
+ public:
+  static std::unique_ptr<ShmFrameRingWriter> Create(
+      std::uint32_t slot_count, std::uint64_t max_frame_size);
+  // Stops serving readers. Readers that already have the ring keep it mapped.
+  ~ShmFrameRingWriter();
+
+  // Copies a frame into the oldest slot and wakes up the readers. Frames are
+  // only copied once a reader has connected. Safe to call from several
+  // threads.
+  void Publish(std::uint32_t display_number, std::uint32_t width,
+               std::uint32_t height, std::uint32_t stride_bytes,
+               const std::uint8_t* pixels);
+
+  // A read-only descriptor of the ring, to be handed to readers.
+  SharedFD ReadOnlyFd() const;
+
+  // Sends a read-only descriptor of the ring to every client that connects to
+  // a socket created at `path`, from a thread owned by the writer.
+  bool ServeReaders(const std::string& path);
+
+  // Publishes even when no reader has connected through ServeReaders, for
+  // readers that got the descriptor some other way.
+  void SetReadersConnected() { readers_connected_ = true; }
+
+ private:
+  ShmFrameRingWriter(SharedFD memfd, ScopedMMap mapping);
+
+  void ServeLoop();
+
+  SharedFD memfd_;
+  ScopedMMap mapping_;
+  std::mutex publish_mutex_;
+  std::uint64_t next_frame_number_ = 1;
+  std::atomic<bool> readers_connected_ = false;
+  SharedFD server_;
+  std::thread server_thread_;
+  std::atomic<bool> stopping_ = false;
+};
+
+class ShmFrameRingReader {
+ public:
+  static std::unique_ptr<ShmFrameRingReader> Create(SharedFD fd);
+  // Connects to the socket served by ShmFrameRingWriter::ServeReaders.
+  static std::unique_ptr<ShmFrameRingReader> Connect(const std::string& path);
+
+  // Number of the newest published frame, 0 if there are none yet.
+  std::uint64_t LatestFrameNumber() const;
+
+  // Waits until a frame newer than `frame_number` is published. Returns false
+  // on timeout.
+  bool WaitForFrameAfter(std::uint64_t frame_number,
+                         std::chrono::milliseconds timeout) const;
+
+  // Runs `consumer` on the frame directly in the shared memory, without
+  // copying it. Returns false if the frame is no longer in the ring or was
+  // overwritten while `consumer` ran, in which case anything computed from the
+  // pixels must be discarded.
+  using FrameConsumer = std::function<void(const ShmFrameMetadata& /*metadata*/,
+                                           const std::uint8_t* /*pixels*/)>;
+  bool ReadFrame(std::uint64_t frame_number,
+                 const FrameConsumer& consumer) const;
+
+  // Copies the newest frame out of the ring, retrying if it gets overwritten.
+  bool CopyLatestFrame(ShmFrameMetadata* metadata,
+                       std::vector<std::uint8_t>* pixels) const;
+
+ private:
+  ShmFrameRingReader(SharedFD fd, ScopedMMap mapping);
+
+  SharedFD fd_;
+  ScopedMMap mapping_;
+};
+
+}  // namespace cuttlefish
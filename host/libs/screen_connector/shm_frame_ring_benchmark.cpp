@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+
+#include "host/libs/screen_connector/shm_frame_ring.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::uint32_t kWidth = 720;
+constexpr std::uint32_t kHeight = 1280;
+constexpr std::uint32_t kStride = kWidth * 4;
+constexpr std::uint64_t kFrameSize = kStride * kHeight;
+
+// Stands in for an encoder, touches one byte of every cache line.
+std::uint64_t Consume(const std::uint8_t* pixels, std::uint64_t size) {
+  std::uint64_t sum = 0;
+  for (std::uint64_t i = 0; i < size; i += 64) {
+    sum += pixels[i];
+  }
+  return sum;
+}
+
+// The writer publishes frames while `readers` threads read every frame they
+// can in place, each as if it were a separate process.
+void BM_SharedRing(benchmark::State& state) {
+  auto readers = state.range(0);
+  auto writer = ShmFrameRingWriter::Create(3, kFrameSize);
+  CHECK(writer);
+  writer->SetReadersConnected();
+  std::vector<std::uint8_t> frame(kFrameSize, 0x5a);
+
+  std::atomic<bool> done = false;
+  std::atomic<std::uint64_t> frames_read = 0;
+  std::atomic<std::uint64_t> frames_torn = 0;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < readers; i++) {
+    auto reader = ShmFrameRingReader::Create(writer->ReadOnlyFd());
+    CHECK(reader);
+    threads.emplace_back([reader = std::move(reader), &done, &frames_read,
+                          &frames_torn]() {
+      std::uint64_t last = 0;
+      std::uint64_t sum = 0;
+      while (!done) {
+        if (!reader->WaitForFrameAfter(last, std::chrono::milliseconds(10))) {
+          continue;
+        }
+        last = reader->LatestFrameNumber();
+        auto consume = [&sum](const ShmFrameMetadata& metadata,
+                              const std::uint8_t* pixels) {
+          sum += Consume(pixels, metadata.size_bytes);
+        };
+        if (reader->ReadFrame(last, consume)) {
+          frames_read++;
+        } else {
+          frames_torn++;
+        }
+      }
+      benchmark::DoNotOptimize(sum);
+    });
+  }
+
+  for (auto _ : state) {
+    writer->Publish(0, kWidth, kHeight, kStride, frame.data());
+  }
+  done = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  state.SetBytesProcessed(state.iterations() * kFrameSize);
+  state.counters["frames_read"] = frames_read.load();
+  state.counters["frames_torn"] = frames_torn.load();
+}
+BENCHMARK(BM_SharedRing)->Arg(0)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
+// What every consumer embedding its own copy of the frame costs the producer,
+// for comparison.
+void BM_CopyPerReader(benchmark::State& state) {
+  auto readers = state.range(0);
+  std::vector<std::uint8_t> frame(kFrameSize, 0x5a);
+  std::vector<std::vector<std::uint8_t>> copies(
+      readers, std::vector<std::uint8_t>(kFrameSize));
+  for (auto _ : state) {
+    for (auto& copy : copies) {
+      std::memcpy(copy.data(), frame.data(), kFrameSize);
+      benchmark::DoNotOptimize(Consume(copy.data(), kFrameSize));
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * kFrameSize);
+}
+BENCHMARK(BM_CopyPerReader)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
+}  // namespace
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
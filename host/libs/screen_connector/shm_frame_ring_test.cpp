@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/screen_connector/shm_frame_ring.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::uint32_t kWidth = 16;
+constexpr std::uint32_t kHeight = 8;
+constexpr std::uint32_t kStride = kWidth * 4;
+constexpr std::uint32_t kFrameSize = kStride * kHeight;
+
+std::vector<std::uint8_t> Frame(std::uint8_t value) {
+  return std::vector<std::uint8_t>(kFrameSize, value);
+}
+
+class ShmFrameRingTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    writer_ = ShmFrameRingWriter::Create(2, kFrameSize);
+    ASSERT_NE(writer_, nullptr);
+    reader_ = ShmFrameRingReader::Create(writer_->ReadOnlyFd());
+    ASSERT_NE(reader_, nullptr);
+  }
+
+  void Publish(std::uint8_t value, std::uint32_t display = 0) {
+    writer_->Publish(display, kWidth, kHeight, kStride, Frame(value).data());
+  }
+
+  std::unique_ptr<ShmFrameRingWriter> writer_;
+  std::unique_ptr<ShmFrameRingReader> reader_;
+};
+
+TEST_F(ShmFrameRingTest, PublishesNothingWithoutReaders) {
+  Publish(1);
+  EXPECT_EQ(reader_->LatestFrameNumber(), 0);
+  ShmFrameMetadata metadata;
+  std::vector<std::uint8_t> pixels;
+  EXPECT_FALSE(reader_->CopyLatestFrame(&metadata, &pixels));
+}
+
+TEST_F(ShmFrameRingTest, ReadsLatestFrame) {
+  writer_->SetReadersConnected();
+  Publish(1);
+  Publish(2, 1);
+  EXPECT_EQ(reader_->LatestFrameNumber(), 2);
+  ShmFrameMetadata metadata;
+  std::vector<std::uint8_t> pixels;
+  ASSERT_TRUE(reader_->CopyLatestFrame(&metadata, &pixels));
+  EXPECT_EQ(metadata.frame_number, 2);
+  EXPECT_EQ(metadata.display_number, 1);
+  EXPECT_EQ(metadata.width, kWidth);
+  EXPECT_EQ(metadata.height, kHeight);
+  EXPECT_EQ(metadata.stride_bytes, kStride);
+  EXPECT_EQ(metadata.size_bytes, kFrameSize);
+  EXPECT_GT(metadata.timestamp_ns, 0);
+  EXPECT_EQ(pixels, Frame(2));
+}
+
+TEST_F(ShmFrameRingTest, OverwrittenFramesAreGone) {
+  writer_->SetReadersConnected();
+  // Two slots, the third frame replaces the first.
+  Publish(1);
+  Publish(2);
+  Publish(3);
+  auto check = [](std::uint8_t value) {
+    return [value](const ShmFrameMetadata&, const std::uint8_t* pixels) {
+      EXPECT_EQ(pixels[0], value);
+    };
+  };
+  EXPECT_FALSE(reader_->ReadFrame(1, check(1)));
+  EXPECT_TRUE(reader_->ReadFrame(2, check(2)));
+  EXPECT_TRUE(reader_->ReadFrame(3, check(3)));
+  // Not published yet.
+  EXPECT_FALSE(reader_->ReadFrame(4, check(4)));
+  EXPECT_FALSE(reader_->ReadFrame(0, check(0)));
+}
+
+TEST_F(ShmFrameRingTest, DetectsOverwriteDuringRead) {
+  writer_->SetReadersConnected();
+  Publish(1);
+  bool consumed = false;
+  auto overwrite = [this, &consumed](const ShmFrameMetadata&,
+                                     const std::uint8_t*) {
+    consumed = true;
+    // The writer doesn't wait for the reader, frame 3 takes frame 1's slot.
+    Publish(2);
+    Publish(3);
+  };
+  EXPECT_FALSE(reader_->ReadFrame(1, overwrite));
+  EXPECT_TRUE(consumed);
+}
+
+TEST_F(ShmFrameRingTest, ConcurrentReadsNeverSeeTornFrames) {
+  writer_->SetReadersConnected();
+  constexpr int kFrames = 2000;
+  std::thread writer([this]() {
+    for (int i = 1; i <= kFrames; i++) {
+      Publish(i % 256);
+    }
+  });
+  std::uint64_t last = 0;
+  int read = 0;
+  while (last < kFrames) {
+    auto latest = reader_->LatestFrameNumber();
+    if (latest == last) {
+      continue;
+    }
+    std::vector<std::uint8_t> pixels;
+    auto copy = [&pixels](const ShmFrameMetadata& metadata,
+                          const std::uint8_t* frame) {
+      pixels.assign(frame, frame + metadata.size_bytes);
+    };
+    if (reader_->ReadFrame(latest, copy)) {
+      // A frame that was read successfully is whole: every byte has the
+      // value it was published with.
+      ASSERT_EQ(pixels, Frame(latest % 256)) << "frame " << latest;
+      read++;
+    }
+    last = latest;
+  }
+  writer.join();
+  EXPECT_GT(read, 0);
+}
+
+TEST_F(ShmFrameRingTest, WaitsForNewFrames) {
+  writer_->SetReadersConnected();
+  EXPECT_FALSE(reader_->WaitForFrameAfter(0, std::chrono::milliseconds(10)));
+  std::thread publisher([this]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    Publish(1);
+  });
+  EXPECT_TRUE(reader_->WaitForFrameAfter(0, std::chrono::seconds(10)));
+  publisher.join();
+  // Returns right away for frames already published.
+  EXPECT_TRUE(reader_->WaitForFrameAfter(0, std::chrono::milliseconds(0)));
+}
+
+TEST_F(ShmFrameRingTest, ServesReadOnlyRingOverSocket) {
+  TemporaryDir dir;
+  auto path = std::string(dir.path) + "/frame_ring.sock";
+  ASSERT_TRUE(writer_->ServeReaders(path));
+  auto reader = ShmFrameRingReader::Connect(path);
+  ASSERT_NE(reader, nullptr);
+
+  // Connecting enables publishing.
+  for (int i = 0; i < 1000 && reader->LatestFrameNumber() == 0; i++) {
+    Publish(7);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ShmFrameMetadata metadata;
+  std::vector<std::uint8_t> pixels;
+  ASSERT_TRUE(reader->CopyLatestFrame(&metadata, &pixels));
+  EXPECT_EQ(pixels, Frame(7));
+
+  auto fd = writer_->ReadOnlyFd();
+  EXPECT_FALSE(fd->MMap(nullptr, kFrameSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, 0));
+  // Destroying the writer stops the server thread.
+  writer_.reset();
+}
+
+TEST_F(ShmFrameRingTest, ReadersCantReopenTheRingWritable) {
+  int fd = writer_->ReadOnlyFd()->UNMANAGED_Dup();
+  ASSERT_GE(fd, 0);
+  auto reopened = SharedFD::Open("/proc/self/fd/" + std::to_string(fd), O_RDWR);
+  close(fd);
+  ASSERT_TRUE(reopened->IsOpen()) << reopened->StrError();
+  EXPECT_FALSE(reopened->MMap(nullptr, kFrameSize, PROT_READ | PROT_WRITE,
+                              MAP_SHARED, 0));
+  std::uint8_t byte = 1;
+  EXPECT_LT(reopened->Write(&byte, sizeof(byte)), 0);
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -33,6 +33,7 @@
 #include "common/libs/utils/files.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/config/known_paths.h"
+#include "host/libs/vm_manager/placement_planner.h"
 #include "host/libs/vm_manager/qemu_manager.h"
 
 namespace cuttlefish {
@@ -242,6 +243,25 @@ std::vector<Command> CrosvmManager::StartCommands(
   // crosvm_cmd.AddParameter("--null-audio");
   crosvm_cmd.AddParameter("--mem=", config.memory_mb());
   crosvm_cmd.AddParameter("--cpus=", config.cpus());
+  if (!instance.cpu_affinity().empty()) {
+    auto cpus = ParseCpuList(instance.cpu_affinity());
+    CHECK(cpus) << "Invalid cpu affinity: " << instance.cpu_affinity();
+    if (instance.exclusive_cpus() && (int)cpus->size() == config.cpus()) {
+      // Pin each vCPU to its own host cpu, e.g. 0=4:1=5
+      std::vector<std::string> vcpu_affinity;
+      for (size_t vcpu = 0; vcpu < cpus->size(); vcpu++) {
+        vcpu_affinity.push_back(std::to_string(vcpu) + "=" +
+                                std::to_string((*cpus)[vcpu]));
+      }
+      crosvm_cmd.AddParameter("--cpu-affinity=",
+                              android::base::Join(vcpu_affinity, ":"));
+    } else {
+      crosvm_cmd.AddParameter("--cpu-affinity=", instance.cpu_affinity());
+    }
+  }
+  if (instance.hugepages()) {
+    crosvm_cmd.AddParameter("--hugepages");
+  }
 
   auto disk_num = instance.virtual_disk_paths().size();
   CHECK_GE(VmManager::kMaxDisks, disk_num)
@@ -0,0 +1,495 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/vm_manager/placement_planner.h"
+
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <sstream>
+#include <utility>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace vm_manager {
+namespace {
+
+constexpr uint64_t kHugePageMb = 2;
+
+std::optional<std::string> ReadSysfsFile(const std::string& path) {
+  std::string contents;
+  if (!android::base::ReadFileToString(path, &contents)) {
+    return {};
+  }
+  return android::base::Trim(contents);
+}
+
+int ReadSysfsInt(const std::string& path, int default_value) {
+  auto contents = ReadSysfsFile(path);
+  int value;
+  if (!contents || !android::base::ParseInt(*contents, &value)) {
+    return default_value;
+  }
+  return value;
+}
+
+// Node meminfo lines look like "Node 0 MemTotal:       65809192 kB".
+uint64_t NodeMemoryMb(const std::string& meminfo) {
+  for (const auto& line : android::base::Split(meminfo, "\n")) {
+    auto fields = android::base::Tokenize(line, " ");
+    for (size_t i = 0; i + 1 < fields.size(); i++) {
+      uint64_t kb;
+      if (fields[i] == "MemTotal:" &&
+          android::base::ParseUint(fields[i + 1], &kb)) {
+        return kb / 1024;
+      }
+    }
+  }
+  return 0;
+}
+
+using CoreId = std::pair<int, int>;  // package id, core id
+
+struct NodeState {
+  const HostNumaNode* node;
+  // Threads of each physical core that no instance is pinned to yet.
+  std::vector<std::vector<int>> free_cores;
+  // vCPUs that can still be pinned: free threads with SMT, free cores
+  // without.
+  size_t free_slots;
+  // Cores with at least one thread pinned, by this plan or another launch.
+  std::set<CoreId> pinned_cores;
+  int instances = 0;
+  uint64_t free_memory_mb;
+  uint64_t free_hugepages;
+};
+
+CoreId CoreOf(const HostCpu& cpu) { return {cpu.package_id, cpu.core_id}; }
+
+NodeState InitialState(const HostNumaNode& node, const std::set<int>& taken,
+                       bool smt) {
+  std::map<CoreId, std::vector<int>> threads_by_core;
+  NodeState state = {
+      .node = &node,
+      .free_slots = 0,
+      .free_memory_mb = node.memory_mb,
+      .free_hugepages = node.free_hugepages,
+  };
+  for (const auto& cpu : node.cpus) {
+    threads_by_core[CoreOf(cpu)].push_back(cpu.id);
+    if (taken.count(cpu.id)) {
+      state.pinned_cores.insert(CoreOf(cpu));
+    }
+  }
+  for (auto& [core, threads] : threads_by_core) {
+    if (state.pinned_cores.count(core)) {
+      continue;
+    }
+    std::sort(threads.begin(), threads.end());
+    state.free_slots += smt ? threads.size() : 1;
+    state.free_cores.push_back(threads);
+  }
+  std::sort(state.free_cores.begin(), state.free_cores.end());
+  return state;
+}
+
+// Slots left unpinned on every node for the host processes and the instances
+// that don't get their own cores: one physical core.
+size_t HostSlots(const NodeState& state, bool smt) {
+  if (!smt || state.free_cores.empty()) {
+    return 1;
+  }
+  return state.free_cores.front().size();
+}
+
+std::vector<int> TakeCores(NodeState& state, size_t count, bool smt) {
+  std::map<int, CoreId> core_of;
+  for (const auto& cpu : state.node->cpus) {
+    core_of[cpu.id] = CoreOf(cpu);
+  }
+  std::vector<int> cpus;
+  auto core = state.free_cores.begin();
+  while (cpus.size() < count) {
+    // Without SMT in the guest a vCPU gets a whole core, so that the sibling
+    // threads can't compete with it.
+    size_t take = smt ? std::min(core->size(), count - cpus.size()) : 1;
+    state.pinned_cores.insert(core_of[core->front()]);
+    cpus.insert(cpus.end(), core->begin(), core->begin() + take);
+    core->erase(core->begin(), core->begin() + take);
+    if (!smt || core->empty()) {
+      core = state.free_cores.erase(core);
+    }
+  }
+  state.free_slots -= count;
+  return cpus;
+}
+
+std::vector<int> AllCpus(const HostNumaNode& node) {
+  std::vector<int> cpus;
+  for (const auto& cpu : node.cpus) {
+    cpus.push_back(cpu.id);
+  }
+  std::sort(cpus.begin(), cpus.end());
+  return cpus;
+}
+
+// The cpus of the node on cores no instance is pinned to.
+std::vector<int> UnpinnedCpus(const NodeState& state) {
+  std::vector<int> cpus;
+  for (const auto& cpu : state.node->cpus) {
+    if (!state.pinned_cores.count(CoreOf(cpu))) {
+      cpus.push_back(cpu.id);
+    }
+  }
+  std::sort(cpus.begin(), cpus.end());
+  return cpus;
+}
+
+// Places the instances, pinning each to its own cores when `pin` is set.
+// Returns nothing if that doesn't work out for every instance.
+std::optional<std::vector<InstancePlacement>> Place(
+    const HostTopology& topology, const PlacementOptions& options, bool pin) {
+  std::vector<NodeState> nodes;
+  for (const auto& node : topology.nodes) {
+    nodes.push_back(InitialState(node, options.taken_cpus, options.smt));
+  }
+  size_t cpus = options.cpus_per_instance;
+  uint64_t memory_mb = options.memory_mb;
+
+  std::vector<InstancePlacement> placements;
+  std::vector<NodeState*> placement_nodes;
+  for (int i = 0; i < options.num_instances; i++) {
+    NodeState* chosen = nullptr;
+    if (pin) {
+      // The node with the most unpinned cores that can hold the whole
+      // instance and still leave a core to the host processes.
+      for (auto& node : nodes) {
+        if (node.free_slots < cpus + HostSlots(node, options.smt) ||
+            node.free_memory_mb < memory_mb) {
+          continue;
+        }
+        if (!chosen || node.free_slots > chosen->free_slots) {
+          chosen = &node;
+        }
+      }
+      if (!chosen) {
+        return {};
+      }
+    } else {
+      // The node with the fewest instances for its size, preferring the ones
+      // that can hold the guest's memory.
+      auto load = [](const NodeState& node) {
+        return (double)(node.instances + 1) / node.node->cpus.size();
+      };
+      for (auto& node : nodes) {
+        bool fits = node.free_memory_mb >= memory_mb;
+        bool chosen_fits = chosen && chosen->free_memory_mb >= memory_mb;
+        if (!chosen || (fits && !chosen_fits) ||
+            (fits == chosen_fits && load(node) < load(*chosen))) {
+          chosen = &node;
+        }
+      }
+    }
+
+    InstancePlacement placement;
+    placement.node = chosen->node->id;
+    placement.exclusive = pin;
+    if (pin) {
+      placement.cpus = TakeCores(*chosen, cpus, options.smt);
+    }
+    if (options.hugetlbfs) {
+      auto pages = (memory_mb + kHugePageMb - 1) / kHugePageMb;
+      placement.hugepages = chosen->free_hugepages >= pages;
+      if (placement.hugepages) {
+        chosen->free_hugepages -= pages;
+      }
+    } else {
+      placement.hugepages = topology.transparent_hugepages;
+    }
+    chosen->free_memory_mb -= std::min(chosen->free_memory_mb, memory_mb);
+    chosen->instances++;
+    placements.push_back(std::move(placement));
+    placement_nodes.push_back(chosen);
+  }
+
+  // Only known once every instance has its cores.
+  for (size_t i = 0; i < placements.size(); i++) {
+    auto unpinned = UnpinnedCpus(*placement_nodes[i]);
+    if (unpinned.empty()) {
+      // Other launches pinned every core of the node.
+      LOG(WARNING) << "No unpinned cpus left on node " << placements[i].node
+                   << ", sharing all of them";
+      unpinned = AllCpus(*placement_nodes[i]->node);
+    }
+    placements[i].host_cpus = unpinned;
+    if (!placements[i].exclusive) {
+      placements[i].cpus = unpinned;
+    }
+  }
+  return placements;
+}
+
+}  // namespace
+
+std::optional<std::vector<int>> ParseCpuList(const std::string& cpu_list) {
+  std::vector<int> cpus;
+  for (const auto& range : android::base::Split(cpu_list, ",")) {
+    auto trimmed = android::base::Trim(range);
+    if (trimmed.empty()) {
+      continue;
+    }
+    auto bounds = android::base::Split(trimmed, "-");
+    int first, last;
+    if (bounds.size() > 2 || !android::base::ParseInt(bounds[0], &first, 0)) {
+      return {};
+    }
+    last = first;
+    if (bounds.size() == 2 &&
+        !android::base::ParseInt(bounds[1], &last, first)) {
+      return {};
+    }
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return cpus;
+}
+
+std::string FormatCpuList(const std::vector<int>& cpus) {
+  std::set<int> sorted(cpus.begin(), cpus.end());
+  std::stringstream out;
+  for (auto it = sorted.begin(); it != sorted.end();) {
+    auto first = *it;
+    auto last = first;
+    while (++it != sorted.end() && *it == last + 1) {
+      last = *it;
+    }
+    if (out.tellp() > 0) {
+      out << ",";
+    }
+    out << first;
+    if (last != first) {
+      out << "-" << last;
+    }
+  }
+  return out.str();
+}
+
+std::optional<HostTopology> HostTopology::FromSysfs(
+    const std::string& sysfs_root) {
+  auto cpu_dir = sysfs_root + "/devices/system/cpu";
+  auto online_list = ReadSysfsFile(cpu_dir + "/online");
+  if (!online_list) {
+    LOG(ERROR) << "Unable to read " << cpu_dir << "/online";
+    return {};
+  }
+  auto online = ParseCpuList(*online_list);
+  if (!online) {
+    LOG(ERROR) << "Unable to parse online CPUs \"" << *online_list << "\"";
+    return {};
+  }
+  std::set<int> online_set(online->begin(), online->end());
+
+  HostTopology topology;
+  auto node_dir = sysfs_root + "/devices/system/node";
+  for (const auto& entry : DirectoryContents(node_dir)) {
+    int node_id;
+    if (!android::base::StartsWith(entry, "node") ||
+        !android::base::ParseInt(entry.substr(4), &node_id)) {
+      continue;
+    }
+    auto path = node_dir + "/" + entry;
+    auto cpu_list = ParseCpuList(ReadSysfsFile(path + "/cpulist").value_or(""));
+    if (!cpu_list) {
+      LOG(ERROR) << "Unable to parse the CPUs of " << path;
+      return {};
+    }
+    auto meminfo = ReadSysfsFile(path + "/meminfo").value_or("");
+    auto free_hugepages = ReadSysfsInt(
+        path + "/hugepages/hugepages-2048kB/free_hugepages", 0);
+    HostNumaNode node = {
+        .id = node_id,
+        .memory_mb = NodeMemoryMb(meminfo),
+        .free_hugepages = (uint64_t)std::max(0, free_hugepages),
+    };
+    for (auto cpu : *cpu_list) {
+      if (!online_set.count(cpu)) {
+        continue;
+      }
+      auto topology_dir = cpu_dir + "/cpu" + std::to_string(cpu) + "/topology";
+      node.cpus.push_back(HostCpu{
+          .id = cpu,
+          .package_id =
+              ReadSysfsInt(topology_dir + "/physical_package_id", node_id),
+          .core_id = ReadSysfsInt(topology_dir + "/core_id", cpu),
+      });
+    }
+    // Memory only nodes can't host an instance's threads.
+    if (!node.cpus.empty()) {
+      topology.nodes.push_back(std::move(node));
+    }
+  }
+  std::sort(topology.nodes.begin(), topology.nodes.end(),
+            [](const auto& a, const auto& b) { return a.id < b.id; });
+
+  auto thp =
+      ReadSysfsFile(sysfs_root + "/kernel/mm/transparent_hugepage/enabled");
+  topology.transparent_hugepages =
+      thp && (thp->find("[always]") != std::string::npos ||
+              thp->find("[madvise]") != std::string::npos);
+  return topology;
+}
+
+std::vector<InstancePlacement> PlanPlacement(const HostTopology& topology,
+                                             const PlacementOptions& options) {
+  CHECK(!topology.nodes.empty()) << "No NUMA nodes with online CPUs";
+  // Pinning only some of the instances would leave the rest crowded on the
+  // few cores left over, so either all of them get their own cores or none.
+  if (options.pin_vcpus) {
+    auto placements = Place(topology, options, true);
+    if (placements) {
+      return *placements;
+    }
+  }
+  return *Place(topology, options, false);
+}
+
+std::set<int> CpusPinnedByRunningVms(const std::string& proc_root) {
+  std::set<int> pinned;
+  for (const auto& entry : DirectoryContents(proc_root)) {
+    int pid;
+    if (!android::base::ParseInt(entry, &pid)) {
+      continue;
+    }
+    std::string cmdline;
+    if (!android::base::ReadFileToString(proc_root + "/" + entry + "/cmdline",
+                                         &cmdline)) {
+      continue;
+    }
+    auto args = android::base::Split(cmdline, std::string(1, '\0'));
+    if (args.empty() || cpp_basename(args[0]) != "crosvm") {
+      continue;
+    }
+    // Only the per vCPU form, e.g. 0=4:1=5, pins cores. A plain cpulist is
+    // what instances sharing their node get.
+    constexpr char kAffinityFlag[] = "--cpu-affinity=";
+    for (const auto& arg : args) {
+      if (!android::base::StartsWith(arg, kAffinityFlag) ||
+          arg.find('=', sizeof(kAffinityFlag) - 1) == std::string::npos) {
+        continue;
+      }
+      auto value = arg.substr(sizeof(kAffinityFlag) - 1);
+      for (const auto& vcpu : android::base::Split(value, ":")) {
+        auto separator = vcpu.find('=');
+        if (separator == std::string::npos) {
+          continue;
+        }
+        auto cpus = ParseCpuList(vcpu.substr(separator + 1));
+        if (cpus) {
+          pinned.insert(cpus->begin(), cpus->end());
+        }
+      }
+    }
+  }
+  return pinned;
+}
+
+std::optional<std::string> HugetlbfsMountPoint(const std::string& mounts) {
+  // Lines look like "hugetlbfs /dev/hugepages hugetlbfs rw,pagesize=2M 0 0".
+  for (const auto& line : android::base::Split(mounts, "\n")) {
+    auto fields = android::base::Tokenize(line, " ");
+    if (fields.size() < 4 || fields[2] != "hugetlbfs") {
+      continue;
+    }
+    auto options = android::base::Split(fields[3], ",");
+    bool other_size = false;
+    for (const auto& option : options) {
+      if (android::base::StartsWith(option, "pagesize=") &&
+          option != "pagesize=2M" && option != "pagesize=2048k") {
+        other_size = true;
+      }
+    }
+    if (!other_size) {
+      return fields[1];
+    }
+  }
+  return {};
+}
+
+std::string PlacementReport(const HostTopology& topology,
+                            const std::vector<InstancePlacement>& placements,
+                            const std::vector<std::string>& instance_names) {
+  std::stringstream report;
+  report << "Placement of " << placements.size() << " instance(s) on "
+         << topology.nodes.size() << " NUMA node(s):\n";
+  for (const auto& node : topology.nodes) {
+    auto instances = std::count_if(
+        placements.begin(), placements.end(),
+        [&node](const auto& placement) { return placement.node == node.id; });
+    report << "  node " << node.id << ": cpus " << FormatCpuList(AllCpus(node))
+           << ", " << node.memory_mb << " MB, " << instances
+           << " instance(s)\n";
+  }
+  for (size_t i = 0; i < placements.size(); i++) {
+    const auto& placement = placements[i];
+    report << "  " << (i < instance_names.size() ? instance_names[i] : "?")
+           << ": node " << placement.node << ", cpus "
+           << FormatCpuList(placement.cpus)
+           << (placement.exclusive ? " (exclusive)" : " (shared)")
+           << ", host processes on " << FormatCpuList(placement.host_cpus)
+           << (placement.hugepages ? ", hugepages" : "") << "\n";
+  }
+  return report.str();
+}
+
+bool BindCurrentProcess(const std::vector<int>& cpus, int node) {
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (auto cpu : cpus) {
+    CPU_SET(cpu, &cpu_set);
+  }
+  if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+    PLOG(ERROR) << "Failed to set CPU affinity to " << FormatCpuList(cpus);
+    return false;
+  }
+  // The preferred policy falls back to other nodes rather than failing
+  // allocations when the node runs out of memory.
+  constexpr size_t kBitsPerWord = 8 * sizeof(unsigned long);
+  std::vector<unsigned long> node_mask(node / kBitsPerWord + 1, 0);
+  node_mask[node / kBitsPerWord] |= 1ul << (node % kBitsPerWord);
+  if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, node_mask.data(),
+              node_mask.size() * kBitsPerWord + 1) != 0) {
+    PLOG(ERROR) << "Failed to set the memory policy to node " << node;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace vm_manager
+}  // namespace cuttlefish
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace cuttlefish {
+namespace vm_manager {
+
+// Parses and formats the kernel's cpulist format, e.g. "0-3,8,10-11".
+std::optional<std::vector<int>> ParseCpuList(const std::string& cpu_list);
+std::string FormatCpuList(const std::vector<int>& cpus);
+
+struct HostCpu {
+  int id;
+  // Threads of the same physical core share package and core ids.
+  int package_id;
+  int core_id;
+};
+
+struct HostNumaNode {
+  int id;
+  std::vector<HostCpu> cpus;
+  uint64_t memory_mb;
+  // Free 2MB hugetlbfs pages on this node.
+  uint64_t free_hugepages;
+};
+
+struct HostTopology {
+  std::vector<HostNumaNode> nodes;
+  // Whether transparent huge pages are enabled for madvise()d memory.
+  bool transparent_hugepages = false;
+
+  // Reads the topology of the online CPUs from a sysfs tree, normally /sys.
+  static std::optional<HostTopology> FromSysfs(const std::string& sysfs_root);
+};
+
+struct PlacementOptions {
+  int num_instances = 1;
+  int cpus_per_instance = 1;
+  int memory_mb = 0;
+  // Guest memory is backed by hugetlbfs pages, which have to be reserved
+  // on the node, rather than by transparent huge pages.
+  bool hugetlbfs = false;
+  // Whether the VMM can pin each vCPU to a host cpu.
+  bool pin_vcpus = true;
+  // Whether the guest sees SMT. Without it each vCPU gets a whole core.
+  bool smt = false;
+  // Cpus pinned by instances from other launches, see CpusPinnedByRunningVms.
+  std::set<int> taken_cpus;
+};
+
+struct InstancePlacement {
+  int node;
+  // With exclusive placement there is one host CPU per vCPU, in vCPU order,
+  // otherwise the instance shares the unpinned CPUs of its node.
+  std::vector<int> cpus;
+  // Where the instance's host processes run: the CPUs of its node on cores
+  // that no instance is pinned to.
+  std::vector<int> host_cpus;
+  bool exclusive;
+  bool hugepages;
+};
+
+// Assigns each instance a NUMA node and a set of CPUs on it. When every
+// instance fits, each one is pinned to physical cores of its own, skipping the
+// cores other launches pinned and leaving at least one core per node to the
+// host processes. Otherwise no instance is pinned and they are spread over
+// the nodes in proportion to their CPU counts, sharing the unpinned CPUs.
+std::vector<InstancePlacement> PlanPlacement(const HostTopology& topology,
+                                             const PlacementOptions& options);
+
+// The host cpus that crosvm processes running on the host pinned vCPUs to,
+// read from their command lines under `proc_root`, normally /proc.
+std::set<int> CpusPinnedByRunningVms(const std::string& proc_root);
+
+// Where 2MB hugetlbfs pages are mounted according to the contents of
+// /proc/mounts, if anywhere.
+std::optional<std::string> HugetlbfsMountPoint(const std::string& mounts);
+
+// Human readable summary of the placement, one line per node and instance.
+std::string PlacementReport(const HostTopology& topology,
+                            const std::vector<InstancePlacement>& placements,
+                            const std::vector<std::string>& instance_names);
+
+// Restricts the calling process to the given CPUs and makes it prefer
+// allocating memory on the given node. Child processes inherit both.
+bool BindCurrentProcess(const std::vector<int>& cpus, int node);
+
+}  // namespace vm_manager
+}  // namespace cuttlefish
@@ -30,6 +30,7 @@
 #include <thread>
 #include <vector>
 
+#include <android-base/file.h>
 #include <android-base/strings.h>
 #include <android-base/logging.h>
 #include <vulkan/vulkan.h>
@@ -40,6 +41,7 @@
 #include "common/libs/utils/users.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/config/known_paths.h"
+#include "host/libs/vm_manager/placement_planner.h"
 
 namespace cuttlefish {
 namespace vm_manager {
@@ -261,6 +263,29 @@ std::vector<Command> QemuManager::StartCommands(
   qemu_cmd.AddParameter("size=", config.memory_mb(), "M",
                         ",maxmem=", maxmem, "M", slots);
 
+  if (instance.numa_node() >= 0) {
+    // Allocate the guest's memory on the node its cpus are on. Instances
+    // sharing a node may not all fit in its memory, so those only prefer it.
+    std::string backend = "memory-backend-ram";
+    if (instance.hugepages()) {
+      std::string mounts;
+      android::base::ReadFileToString("/proc/mounts", &mounts);
+      auto mount_point = HugetlbfsMountPoint(mounts);
+      if (mount_point) {
+        backend = "memory-backend-file,mem-path=" + *mount_point;
+      } else {
+        LOG(WARNING) << "hugetlbfs is not mounted, not using huge pages";
+      }
+    }
+    auto policy = instance.exclusive_cpus() ? "bind" : "preferred";
+    qemu_cmd.AddParameter("-object");
+    qemu_cmd.AddParameter(backend, ",id=mem0,size=", config.memory_mb(), "M",
+                          ",host-nodes=", instance.numa_node(),
+                          ",policy=", policy);
+    qemu_cmd.AddParameter("-numa");
+    qemu_cmd.AddParameter("node,memdev=mem0");
+  }
+
   qemu_cmd.AddParameter("-overcommit");
   qemu_cmd.AddParameter("mem-lock=off");
 
@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/vm_manager/placement_planner.h"
+
+#include <sys/stat.h>
+
+#include <set>
+#include <string>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace vm_manager {
+namespace {
+
+// A host with the given number of sockets, one NUMA node per socket, and
+// two threads per core numbered like Linux does on x86: cpu N and cpu
+// N + total_cores are siblings.
+HostTopology MakeTopology(int sockets, int cores_per_socket,
+                          uint64_t memory_mb_per_node) {
+  HostTopology topology;
+  int total_cores = sockets * cores_per_socket;
+  for (int socket = 0; socket < sockets; socket++) {
+    HostNumaNode node = {
+        .id = socket,
+        .memory_mb = memory_mb_per_node,
+        .free_hugepages = 0,
+    };
+    for (int core = 0; core < cores_per_socket; core++) {
+      int cpu = socket * cores_per_socket + core;
+      node.cpus.push_back({cpu, socket, core});
+      node.cpus.push_back({cpu + total_cores, socket, core});
+    }
+    topology.nodes.push_back(node);
+  }
+  return topology;
+}
+
+TEST(PlacementPlannerTest, CpuListRoundTrip) {
+  auto cpus = ParseCpuList("0-3,8,10-11\n");
+  ASSERT_TRUE(cpus);
+  EXPECT_EQ(*cpus, (std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_EQ(FormatCpuList(*cpus), "0-3,8,10-11");
+  EXPECT_EQ(FormatCpuList({5, 1, 2, 3}), "1-3,5");
+  EXPECT_TRUE(ParseCpuList("")->empty());
+  EXPECT_FALSE(ParseCpuList("1-2-3"));
+  EXPECT_FALSE(ParseCpuList("3-1"));
+  EXPECT_FALSE(ParseCpuList("a"));
+}
+
+TEST(PlacementPlannerTest, SpreadsInstancesAcrossSockets) {
+  auto topology = MakeTopology(2, 16, 65536);
+  PlacementOptions options = {
+      .num_instances = 4,
+      .cpus_per_instance = 4,
+      .memory_mb = 4096,
+  };
+  auto placements = PlanPlacement(topology, options);
+  ASSERT_EQ(placements.size(), 4);
+  int per_node[2] = {0, 0};
+  std::set<int> used_cores;
+  for (const auto& placement : placements) {
+    per_node[placement.node]++;
+    EXPECT_TRUE(placement.exclusive);
+    ASSERT_EQ(placement.cpus.size(), 4);
+    for (auto cpu : placement.cpus) {
+      // One thread per physical core, no core used twice.
+      int core = cpu % 32;
+      EXPECT_TRUE(used_cores.insert(core).second) << "cpu " << cpu;
+      // Every CPU is on the instance's node.
+      EXPECT_EQ(core / 16, placement.node);
+    }
+  }
+  EXPECT_EQ(per_node[0], 2);
+  EXPECT_EQ(per_node[1], 2);
+}
+
+TEST(PlacementPlannerTest, AssignsWholeCores) {
+  auto topology = MakeTopology(1, 8, 16384);
+  PlacementOptions options = {
+      .num_instances = 2,
+      .cpus_per_instance = 2,
+      .memory_mb = 2048,
+  };
+  auto placements = PlanPlacement(topology, options);
+  ASSERT_EQ(placements.size(), 2);
+  // The first thread of cores 0 and 1, then of cores 2 and 3. The sibling
+  // threads stay idle.
+  EXPECT_EQ(placements[0].cpus, (std::vector<int>{0, 1}));
+  EXPECT_EQ(placements[1].cpus, (std::vector<int>{2, 3}));
+  // Host processes run on the cores nobody is pinned to.
+  std::vector<int> unpinned = {4, 5, 6, 7, 12, 13, 14, 15};
+  EXPECT_EQ(placements[0].host_cpus, unpinned);
+  EXPECT_EQ(placements[1].host_cpus, unpinned);
+
+  // With SMT in the guest, both threads of a core.
+  options.smt = true;
+  placements = PlanPlacement(topology, options);
+  ASSERT_EQ(placements.size(), 2);
+  EXPECT_EQ(placements[0].cpus, (std::vector<int>{0, 8}));
+  EXPECT_EQ(placements[1].cpus, (std::vector<int>{1, 9}));
+}
+
+TEST(PlacementPlannerTest, LeavesACoreForHostProcesses) {
+  auto topology = MakeTopology(1, 4, 16384);
+  PlacementOptions options = {
+      .num_instances = 2,
+      .cpus_per_instance = 2,
+      .memory_mb = 2048,
+  };
+  // Pinning both would take every core.
+  auto placements = PlanPlacement(topology, options);
+  ASSERT_EQ(placements.size(), 2);
+  for (const auto& placement : placements) {
+    EXPECT_FALSE(placement.exclusive);
+    EXPECT_EQ(placement.cpus.size(), 8);
+  }
+
+  options.num_instances = 1;
+  placements = PlanPlacement(topology, options);
+  ASSERT_EQ(placements.size(), 1);
+  EXPECT_TRUE(placements[0].exclusive);
+}
+
+TEST(PlacementPlannerTest, SharesNodesWhenOversubscribed) {
+  // 40 instances of 4 CPUs on a 2 x 16 core host with SMT: 160 vCPUs on
+  // 64 host CPUs.
+  auto topology = MakeTopology(2, 16, 262144);
+  PlacementOptions options = {
+      .num_instances = 40,
+      .cpus_per_instance = 4,
+      .memory_mb = 4096,
+  };
+  auto placements = PlanPlacement(topology, options);
+  ASSERT_EQ(placements.size(), 40);
+  int per_node[2] = {0, 0};
+  for (const auto& placement : placements) {
+    per_node[placement.node]++;
+    // Nobody is pinned, so the instances float over their whole node, never
+    // across nodes.
+    EXPECT_FALSE(placement.exclusive);
+    EXPECT_EQ(placement.cpus.size(), 32);
+    EXPECT_EQ(placement.cpus, placement.host_cpus);
+  }
+  EXPECT_EQ(per_node[0], 20);
+  EXPECT_EQ(per_node[1], 20);
+}
+
+TEST(PlacementPlannerTest, SkipsCoresPinnedByOtherLaunches) {
+  auto topology = MakeTopology(1, 8, 16384);
+  PlacementOptions options = {
+      .num_instances = 1,
+      .cpus_per_instance = 2,
+      .memory_mb = 2048,
+      // The sibling of core 1, so the whole core is taken.
+      .taken_cpus = {0, 9},
+  };
+  auto placements = PlanPlacement(topology, options);
+  ASSERT_EQ(placements.size(), 1);
+  EXPECT_TRUE(placements[0].exclusive);
+  EXPECT_EQ(placements[0].cpus, (std::vector<int>{2, 3}));
+  EXPECT_EQ(placements[0].host_cpus,
+            (std::vector<int>{4, 5, 6, 7, 12, 13, 14, 15}));
+
+  // Instances that can't be pinned stay off the taken cores too.
+  options.num_instances = 4;
+  placements = PlanPlacement(topology, options);
+  ASSERT_EQ(placements.size(), 4);
+  for (const auto& placement : placements) {
+    EXPECT_FALSE(placement.exclusive);
+    EXPECT_EQ(placement.cpus,
+              (std::vector<int>{2, 3, 4, 5, 6, 7, 10, 11, 12, 13, 14, 15}));
+  }
+}
+
+TEST(PlacementPlannerTest, DoesNotPinWithoutVmmSupport) {
+  auto topology = MakeTopology(1, 8, 16384);
+  PlacementOptions options = {
+      .num_instances = 1,
+      .cpus_per_instance = 2,
+      .memory_mb = 2048,
+      .pin_vcpus = false,
+  };
+  auto placements = PlanPlacement(topology, options);
+  ASSERT_EQ(placements.size(), 1);
+  EXPECT_FALSE(placements[0].exclusive);
+  EXPECT_EQ(placements[0].cpus.size(), 16);
+}
+
+TEST(PlacementPlannerTest, AvoidsNodesWithoutMemory) {
+  auto topology = MakeTopology(2, 8, 8192);
+  topology.nodes[0].memory_mb = 1024;
+  PlacementOptions options = {
+      .num_instances = 2,
+      .cpus_per_instance = 2,
+      .memory_mb = 4096,
+  };
+  auto placements = PlanPlacement(topology, options);
+  ASSERT_EQ(placements.size(), 2);
+  EXPECT_EQ(placements[0].node, 1);
+  EXPECT_EQ(placements[1].node, 1);
+}
+
+TEST(PlacementPlannerTest, ReservesHugepagesPerNode) {
+  auto topology = MakeTopology(1, 8, 65536);
+  // Room for one 4GB guest.
+  topology.nodes[0].free_hugepages = 3000;
+  PlacementOptions options = {
+      .num_instances = 2,
+      .cpus_per_instance = 2,
+      .memory_mb = 4096,
+      .hugetlbfs = true,
+  };
+  auto placements = PlanPlacement(topology, options);
+  ASSERT_EQ(placements.size(), 2);
+  EXPECT_TRUE(placements[0].hugepages);
+  EXPECT_FALSE(placements[1].hugepages);
+
+  options.hugetlbfs = false;
+  topology.transparent_hugepages = true;
+  placements = PlanPlacement(topology, options);
+  EXPECT_TRUE(placements[0].hugepages);
+  EXPECT_TRUE(placements[1].hugepages);
+}
+
+void WriteSysfs(const std::string& root, const std::string& path,
+                const std::string& contents) {
+  auto full_path = root + "/" + path;
+  for (auto pos = full_path.find('/', root.size() + 1);
+       pos != std::string::npos; pos = full_path.find('/', pos + 1)) {
+    mkdir(full_path.substr(0, pos).c_str(), 0755);
+  }
+  ASSERT_TRUE(android::base::WriteStringToFile(contents, full_path));
+}
+
+TEST(PlacementPlannerTest, ReadsSysfs) {
+  TemporaryDir sysfs;
+  std::string root = sysfs.path;
+  WriteSysfs(root, "devices/system/cpu/online", "0-2\n");
+  WriteSysfs(root, "devices/system/node/node0/cpulist", "0-1\n");
+  WriteSysfs(root, "devices/system/node/node0/meminfo",
+             "Node 0 MemTotal:       2097152 kB\nNode 0 MemFree: 1 kB\n");
+  WriteSysfs(root,
+             "devices/system/node/node0/hugepages/hugepages-2048kB/"
+             "free_hugepages",
+             "16\n");
+  // cpu3 is offline.
+  WriteSysfs(root, "devices/system/node/node1/cpulist", "2-3\n");
+  WriteSysfs(root, "devices/system/node/node1/meminfo",
+             "Node 1 MemTotal:       1048576 kB\n");
+  // Memory only node.
+  WriteSysfs(root, "devices/system/node/node2/cpulist", "\n");
+  for (int cpu = 0; cpu < 4; cpu++) {
+    auto dir = "devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+    WriteSysfs(root, dir + "physical_package_id", cpu < 2 ? "0\n" : "1\n");
+    WriteSysfs(root, dir + "core_id", "7\n");
+  }
+  WriteSysfs(root, "kernel/mm/transparent_hugepage/enabled",
+             "always [madvise] never\n");
+
+  auto topology = HostTopology::FromSysfs(root);
+  ASSERT_TRUE(topology);
+  ASSERT_EQ(topology->nodes.size(), 2);
+  EXPECT_TRUE(topology->transparent_hugepages);
+
+  const auto& node0 = topology->nodes[0];
+  EXPECT_EQ(node0.id, 0);
+  EXPECT_EQ(node0.memory_mb, 2048);
+  EXPECT_EQ(node0.free_hugepages, 16);
+  ASSERT_EQ(node0.cpus.size(), 2);
+  EXPECT_EQ(node0.cpus[1].id, 1);
+  EXPECT_EQ(node0.cpus[1].package_id, 0);
+  EXPECT_EQ(node0.cpus[1].core_id, 7);
+
+  const auto& node1 = topology->nodes[1];
+  EXPECT_EQ(node1.id, 1);
+  EXPECT_EQ(node1.memory_mb, 1024);
+  ASSERT_EQ(node1.cpus.size(), 1);
+  EXPECT_EQ(node1.cpus[0].id, 2);
+  EXPECT_EQ(node1.cpus[0].package_id, 1);
+}
+
+TEST(PlacementPlannerTest, FindsCpusPinnedByRunningVms) {
+  TemporaryDir proc;
+  std::string root = proc.path;
+  auto cmdline = [](std::vector<std::string> args) {
+    std::string joined;
+    for (const auto& arg : args) {
+      joined += arg + std::string(1, '\0');
+    }
+    return joined;
+  };
+  WriteSysfs(root, "100/cmdline",
+             cmdline({"/usr/bin/crosvm", "run", "--cpus=2",
+                      "--cpu-affinity=0=4:1=5", "kernel"}));
+  // Instances sharing their node aren't pinned.
+  WriteSysfs(root, "101/cmdline",
+             cmdline({"/usr/bin/crosvm", "run", "--cpu-affinity=0-15"}));
+  WriteSysfs(root, "102/cmdline",
+             cmdline({"/usr/bin/other", "--cpu-affinity=0=7"}));
+  WriteSysfs(root, "self/cmdline", cmdline({"crosvm", "--cpu-affinity=0=8"}));
+  EXPECT_EQ(CpusPinnedByRunningVms(root), (std::set<int>{4, 5}));
+}
+
+TEST(PlacementPlannerTest, FindsHugetlbfsMountPoint) {
+  EXPECT_EQ(HugetlbfsMountPoint(
+                "proc /proc proc rw,nosuid 0 0\n"
+                "hugetlbfs /mnt/huge1G hugetlbfs rw,pagesize=1024M 0 0\n"
+                "hugetlbfs /mnt/huge hugetlbfs rw,relatime,pagesize=2M 0 0\n"),
+            "/mnt/huge");
+  EXPECT_EQ(HugetlbfsMountPoint("none /dev/hugepages hugetlbfs rw 0 0\n"),
+            "/dev/hugepages");
+  EXPECT_FALSE(HugetlbfsMountPoint("proc /proc proc rw 0 0\n"));
+}
+
+}  // namespace
+}  // namespace vm_manager
+}  // namespace cuttlefish
@@ -77,6 +77,8 @@ const struct wl_region_interface region_implementation = {
 void surface_destroy(wl_client*, wl_resource* surface) {
   LOG(VERBOSE) << __FUNCTION__
                << " surface=" << surface;
+
+  wl_resource_destroy(surface);
 }
 
 void surface_attach(wl_client*,
@@ -182,7 +184,10 @@ const struct wl_surface_interface surface_implementation = {
   .damage_buffer = surface_damage_buffer,
 };
 
-void surface_destroy_resource_callback(struct wl_resource*) {}
+void surface_destroy_resource_callback(struct wl_resource* surface_resource) {
+  Surface* surface = GetUserData<Surface>(surface_resource);
+  surface->surfaces().DestroySurface(surface->id());
+}
 
 void compositor_create_surface(wl_client* client,
                                wl_resource* compositor,
@@ -192,11 +197,11 @@ void compositor_create_surface(wl_client* client,
                << " id=" << id;
 
   // Wayland seems to use a single global id space for all objects.
-  static std::atomic<std::uint32_t> sNextDisplayId{0};
-  uint32_t display_id = sNextDisplayId++;
+  static std::atomic<std::uint32_t> sNextSurfaceId{0};
+  uint32_t surface_id = sNextSurfaceId++;
 
   Surfaces* surfaces = GetUserData<Surfaces>(compositor);
-  Surface* surface = surfaces->GetOrCreateSurface(display_id);
+  Surface* surface = surfaces->GetOrCreateSurface(surface_id);
 
   wl_resource* surface_resource = wl_resource_create(
       client, &wl_surface_interface, wl_resource_get_version(compositor), id);
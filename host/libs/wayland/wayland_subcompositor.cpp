@@ -21,6 +21,9 @@
 #include <wayland-server-core.h>
 #include <wayland-server-protocol.h>
 
+#include "host/libs/wayland/wayland_surface.h"
+#include "host/libs/wayland/wayland_utils.h"
+
 namespace wayland {
 namespace {
 
@@ -94,6 +97,8 @@ void subcompositor_get_subsurface(wl_client* client,
                << " surface=" << surface
                << " parent_surface=" << parent_surface;
 
+  GetUserData<Surface>(surface)->SetIsSubsurface();
+
   wl_resource* subsurface_resource =
       wl_resource_create(client, &wl_subsurface_interface, 1, id);
 
@@ -16,6 +16,8 @@
 
 #include "host/libs/wayland/wayland_surface.h"
 
+#include <chrono>
+
 #include <android-base/logging.h>
 #include <wayland-server-protocol.h>
 
@@ -23,8 +25,10 @@
 
 namespace wayland {
 
-Surface::Surface(std::uint32_t display_number, Surfaces& surfaces)
-    : display_number_(display_number), surfaces_(surfaces) {}
+Surface::Surface(std::uint32_t id, Surfaces& surfaces)
+    : id_(id), surfaces_(surfaces) {}
+
+void Surface::SetIsSubsurface() { surfaces_.ReleaseDisplayNumber(id_); }
 
 void Surface::SetRegion(const Region& region) {
   std::unique_lock<std::mutex> lock(state_mutex_);
@@ -37,6 +41,7 @@ void Surface::Attach(struct wl_resource* buffer) {
 }
 
 void Surface::Commit() {
+  const auto capture_time = std::chrono::steady_clock::now();
   std::unique_lock<std::mutex> lock(state_mutex_);
   state_.current_buffer = state_.pending_buffer;
   state_.pending_buffer = nullptr;
@@ -55,10 +60,13 @@ void Surface::Commit() {
   const int32_t buffer_h = wl_shm_buffer_get_height(shm_buffer);
   CHECK(buffer_h == state_.region.h);
 
+  const int32_t buffer_stride_bytes = wl_shm_buffer_get_stride(shm_buffer);
+
   uint8_t* buffer_pixels =
       reinterpret_cast<uint8_t*>(wl_shm_buffer_get_data(shm_buffer));
 
-  surfaces_.HandleSurfaceFrame(display_number_, buffer_pixels);
+  surfaces_.HandleSurfaceFrame(id_, buffer_w, buffer_h, buffer_stride_bytes,
+                               buffer_pixels, capture_time);
 
   wl_shm_buffer_end_access(shm_buffer);
 
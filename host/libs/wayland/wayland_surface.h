@@ -29,7 +29,7 @@ class Surfaces;
 // Tracks the buffer associated with a Wayland surface.
 class Surface {
  public:
-  Surface(std::uint32_t display_number, Surfaces& surfaces);
+  Surface(std::uint32_t id, Surfaces& surfaces);
   virtual ~Surface() = default;
 
   Surface(const Surface& rhs) = delete;
@@ -53,8 +53,15 @@ class Surface {
   // Commits the pending frame state.
   void Commit();
 
+  // Subsurfaces, such as the cursor, are drawn on top of a display instead of
+  // being one.
+  void SetIsSubsurface();
+
+  std::uint32_t id() const { return id_; }
+  Surfaces& surfaces() { return surfaces_; }
+
  private:
-  std::uint32_t display_number_;
+  std::uint32_t id_;
   Surfaces& surfaces_;
 
   struct State {
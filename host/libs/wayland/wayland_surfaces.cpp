@@ -31,17 +31,57 @@ Surface* Surfaces::GetOrCreateSurface(std::uint32_t id) {
   std::unique_ptr<Surface>& surface_ptr = it->second;
   if (inserted) {
     surface_ptr.reset(new Surface(id, *this));
+    AssignDisplayNumber(id);
   }
   return surface_ptr.get();
 }
 
+void Surfaces::DestroySurface(std::uint32_t id) {
+  std::unique_lock<std::mutex> lock(surfaces_mutex_);
+  surfaces_.erase(id);
+  display_numbers_.erase(id);
+}
+
+void Surfaces::AssignDisplayNumber(std::uint32_t surface_id) {
+  std::set<std::uint32_t> used;
+  for (const auto& [id, display_number] : display_numbers_) {
+    used.insert(display_number);
+  }
+  std::uint32_t display_number = 0;
+  while (used.count(display_number)) {
+    display_number++;
+  }
+  LOG(DEBUG) << "Surface " << surface_id << " shows display "
+             << display_number;
+  display_numbers_[surface_id] = display_number;
+}
+
+void Surfaces::ReleaseDisplayNumber(std::uint32_t surface_id) {
+  std::unique_lock<std::mutex> lock(surfaces_mutex_);
+  display_numbers_.erase(surface_id);
+}
+
+std::optional<std::uint32_t> Surfaces::GetDisplayNumber(
+    std::uint32_t surface_id) {
+  std::unique_lock<std::mutex> lock(surfaces_mutex_);
+  auto it = display_numbers_.find(surface_id);
+  if (it == display_numbers_.end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
 void Surfaces::OnNextFrame(const FrameCallback& frame_callback) {
   // Wraps the given callback in a std::package_task that can be waited upon
   // for completion.
   Surfaces::FrameCallbackPackaged frame_callback_packaged(
       [&frame_callback](std::uint32_t display_number,
-                        std::uint8_t* frame_pixels) {
-        frame_callback(display_number, frame_pixels);
+                        std::uint32_t frame_width, std::uint32_t frame_height,
+                        std::uint32_t frame_stride_bytes,
+                        std::uint8_t* frame_pixels,
+                        std::chrono::steady_clock::time_point capture_time) {
+        frame_callback(display_number, frame_width, frame_height,
+                       frame_stride_bytes, frame_pixels, capture_time);
       });
 
   {
@@ -53,11 +93,19 @@ void Surfaces::OnNextFrame(const FrameCallback& frame_callback) {
   frame_callback_packaged.get_future().get();
 }
 
-void Surfaces::HandleSurfaceFrame(std::uint32_t display_number,
-                                  std::uint8_t* frame_bytes) {
+void Surfaces::HandleSurfaceFrame(
+    std::uint32_t surface_id, std::uint32_t frame_width,
+    std::uint32_t frame_height, std::uint32_t frame_stride_bytes,
+    std::uint8_t* frame_bytes,
+    std::chrono::steady_clock::time_point capture_time) {
+  auto display_number = GetDisplayNumber(surface_id);
+  if (!display_number) {
+    return;
+  }
   std::unique_lock<std::mutex> lock(callback_mutex_);
   if (callback_) {
-    (*callback_.value())(display_number, frame_bytes);
+    (*callback_.value())(*display_number, frame_width, frame_height,
+                         frame_stride_bytes, frame_bytes, capture_time);
     callback_.reset();
   }
 }
@@ -17,10 +17,12 @@
 #pragma once
 
 #include <stdint.h>
+#include <chrono>
 #include <future>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <set>
 #include <thread>
 #include <unordered_map>
 
@@ -41,22 +43,51 @@ class Surfaces {
 
   Surface* GetOrCreateSurface(std::uint32_t id);
 
-  using FrameCallback = std::function<void(std::uint32_t /*display_number*/,
-                                           std::uint8_t* /*frame_pixels*/)>;
+  void DestroySurface(std::uint32_t id);
+
+  // The capture time is when the guest committed the frame.
+  using FrameCallback = std::function<void(
+      std::uint32_t /*display_number*/, std::uint32_t /*frame_width*/,
+      std::uint32_t /*frame_height*/, std::uint32_t /*frame_stride_bytes*/,
+      std::uint8_t* /*frame_pixels*/,
+      std::chrono::steady_clock::time_point /*capture_time*/)>;
 
   // Blocking
   void OnNextFrame(const FrameCallback& callback);
 
  private:
   friend class Surface;
-  void HandleSurfaceFrame(std::uint32_t display_number,
-                          std::uint8_t* frame_bytes);
+  void HandleSurfaceFrame(std::uint32_t surface_id, std::uint32_t frame_width,
+                          std::uint32_t frame_height,
+                          std::uint32_t frame_stride_bytes,
+                          std::uint8_t* frame_bytes,
+                          std::chrono::steady_clock::time_point capture_time);
+
+  // Called when the surface becomes a subsurface.
+  void ReleaseDisplayNumber(std::uint32_t surface_id);
+
+  // Requires surfaces_mutex_.
+  void AssignDisplayNumber(std::uint32_t surface_id);
+
+  // The display a surface shows, none for subsurfaces.
+  std::optional<std::uint32_t> GetDisplayNumber(std::uint32_t surface_id);
 
   std::mutex surfaces_mutex_;
   std::unordered_map<std::uint32_t, std::unique_ptr<Surface>> surfaces_;
 
+  // Surfaces get the lowest free display number when they are created, so
+  // the VMM creating one surface per scanout in order numbers the displays
+  // like the scanouts. Surface ids only increase as the VMM replaces the
+  // surface of a scanout, the display numbers of destroyed surfaces are given
+  // to the next ones. Subsurfaces, such as the cursor, give their number back
+  // when the VMM makes them one, before it creates the next surface.
+  std::unordered_map<std::uint32_t, std::uint32_t> display_numbers_;
+
   using FrameCallbackPackaged = std::packaged_task<void(
-      std::uint32_t /*display_number*/, std::uint8_t* /*frame_bytes*/)>;
+      std::uint32_t /*display_number*/, std::uint32_t /*frame_width*/,
+      std::uint32_t /*frame_height*/, std::uint32_t /*frame_stride_bytes*/,
+      std::uint8_t* /*frame_bytes*/,
+      std::chrono::steady_clock::time_point /*capture_time*/)>;
 
   std::mutex callback_mutex_;
   std::optional<FrameCallbackPackaged*> callback_;